@@ -0,0 +1,94 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_BATCH_H
+#define MQTT_BATCH_H
+
+#include "azure_c_shared_utility/macro_utils.h"
+#include "azure_c_shared_utility/tickcounter.h"
+#include "azure_c_shared_utility/umock_c_prod.h"
+#include "azure_umqtt_c/mqttconst.h"
+#include "azure_umqtt_c/mqtt_client.h"
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <cstddef>
+extern "C" {
+#else
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#endif // __cplusplus
+
+/* Largest length prefix of a record, the prefix is encoded like the MQTT remaining length */
+#define MQTT_BATCH_MAX_RECORD_PREFIX    4
+
+typedef struct MQTT_BATCH_TAG* MQTT_BATCH_HANDLE;
+
+#define MQTT_BATCH_READ_RESULT_VALUES   \
+    MQTT_BATCH_READ_OK,                 \
+    MQTT_BATCH_READ_END,                \
+    MQTT_BATCH_READ_ERROR
+
+DEFINE_ENUM(MQTT_BATCH_READ_RESULT, MQTT_BATCH_READ_RESULT_VALUES);
+
+typedef struct MQTT_BATCH_OPTIONS_TAG
+{
+    /* Largest PUBLISH payload of a batch, prefixes included, 0 uses the default */
+    size_t maxBytes;
+    /* Records after which a batch is published, 0 for no limit */
+    size_t maxRecords;
+    /* Time after its first record a batch is published by mqtt_batch_dowork, 0 uses the default */
+    tickcounter_ms_t maxAgeMs;
+    QOS_VALUE qos;
+    /* QoS 1 and 2 batches are numbered from firstPacketId to lastPacketId and around again, a range the
+       application does not use for its own publishes on the client. 0 for both uses the whole range. */
+    uint16_t firstPacketId;
+    uint16_t lastPacketId;
+} MQTT_BATCH_OPTIONS;
+
+/*
+*    @brief    Creates a publisher that packs the records appended for a topic into one PUBLISH of mqttHandle.
+*              Each record is written after its length, mqtt_batch_read_record splits the payload on receive.
+*    @return   return    A handle to the batch publisher or NULL on failure.
+*/
+MOCKABLE_FUNCTION(, MQTT_BATCH_HANDLE, mqtt_batch_create, MQTT_CLIENT_HANDLE, mqttHandle, const MQTT_BATCH_OPTIONS*, options);
+
+/*
+*    @brief    Releases the batch publisher, the records that were not published are dropped.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_batch_destroy, MQTT_BATCH_HANDLE, handle);
+
+/*
+*    @brief    Appends a copy of record to the batch of topicName. The batch is published first when the record does
+*              not fit in it, and right after when it reaches maxRecords or maxBytes.
+*    @return   return    Non-zero when the record is larger than maxBytes or a full batch could not be published, the
+*                        batch is then kept and published again by the next flush.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_batch_append, MQTT_BATCH_HANDLE, handle, const char*, topicName, const uint8_t*, record, size_t, length);
+
+/*
+*    @brief    Publishes the batches that are older than maxAgeMs, then calls mqtt_client_dowork. Call it in place
+*              of mqtt_client_dowork for the client of the batch publisher.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_batch_dowork, MQTT_BATCH_HANDLE, handle);
+
+/*
+*    @brief    Publishes every batch that holds records, whatever its age, before a disconnect for example.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_batch_flush, MQTT_BATCH_HANDLE, handle);
+
+/*
+*    @brief    Reads the record at offset of a received batch payload and moves offset past it. record points into
+*              payload.
+*    @return   return    MQTT_BATCH_READ_OK when a record was read, MQTT_BATCH_READ_END at the end of the payload,
+*                        where offset equals length, and MQTT_BATCH_READ_ERROR when the payload is malformed or a
+*                        parameter is invalid. offset is left unchanged when no record was read.
+*/
+MOCKABLE_FUNCTION(, MQTT_BATCH_READ_RESULT, mqtt_batch_read_record, const uint8_t*, payload, size_t, length, size_t*, offset, const uint8_t**, record, size_t*, recordLength);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_BATCH_H
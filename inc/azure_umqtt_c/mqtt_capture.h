@@ -0,0 +1,75 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_CAPTURE_H
+#define MQTT_CAPTURE_H
+
+#include "azure_c_shared_utility/macro_utils.h"
+#include "azure_c_shared_utility/umock_c_prod.h"
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <cstddef>
+extern "C" {
+#else
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#endif // __cplusplus
+
+typedef struct MQTT_CAPTURE_TAG* MQTT_CAPTURE_HANDLE;
+
+#define MQTT_CAPTURE_DIRECTION_VALUES   \
+    MQTT_CAPTURE_OUTGOING,              \
+    MQTT_CAPTURE_INCOMING
+
+DEFINE_ENUM(MQTT_CAPTURE_DIRECTION, MQTT_CAPTURE_DIRECTION_VALUES);
+
+typedef struct MQTT_CAPTURE_OPTIONS_TAG
+{
+    /* Prefix of the capture files, each file is named <filePrefix>_<index>.pcapng */
+    const char* filePrefix;
+    /* Size in bytes at which the current file is closed and a new one started, 0 disables rotation */
+    size_t maxFileSize;
+    /* Number of rotated files that are kept on disk, 0 keeps all of them */
+    size_t maxFileCount;
+    /* Size in bytes of each of the two staging buffers, records that do not fit are dropped */
+    size_t bufferSize;
+    /* Maximum time in milliseconds a record can stay in the staging buffer before being written */
+    unsigned int flushIntervalMs;
+    /* TCP port used for the synthetic broker endpoint, 1883 lets Wireshark pick the MQTT dissector */
+    uint16_t brokerPort;
+} MQTT_CAPTURE_OPTIONS;
+
+/*
+*    @brief    Creates a capture sink that writes MQTT bytes to rotating pcapng files on a background thread.
+*    @param    options    Capture configuration, the filePrefix is copied.
+*    @return   return     A handle to the capture sink or NULL on failure.
+*/
+MOCKABLE_FUNCTION(, MQTT_CAPTURE_HANDLE, mqtt_capture_create, const MQTT_CAPTURE_OPTIONS*, options);
+
+/*
+*    @brief    Flushes any pending records, stops the writer thread and closes the current file.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_capture_destroy, MQTT_CAPTURE_HANDLE, handle);
+
+/*
+*    @brief    Records a chunk of the MQTT byte stream; never blocks on file I/O.
+*    @param    handle       Handle to the capture sink.
+*    @param    direction    MQTT_CAPTURE_OUTGOING for client to broker bytes, MQTT_CAPTURE_INCOMING otherwise.
+*    @param    data         Bytes to record.
+*    @param    length       Number of bytes to record.
+*    @return   return       Zero if the record was staged, non-zero if it was invalid or dropped.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_capture_write, MQTT_CAPTURE_HANDLE, handle, MQTT_CAPTURE_DIRECTION, direction, const uint8_t*, data, size_t, length);
+
+/*
+*    @brief    Gets the number of records dropped because the staging buffers were full.
+*/
+MOCKABLE_FUNCTION(, size_t, mqtt_capture_get_dropped_count, MQTT_CAPTURE_HANDLE, handle);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_CAPTURE_H
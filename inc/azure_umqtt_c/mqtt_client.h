@@ -8,6 +8,9 @@
 #include "azure_c_shared_utility/macro_utils.h"
 #include "azure_umqtt_c/mqttconst.h"
 #include "azure_umqtt_c/mqtt_message.h"
+#include "azure_umqtt_c/mqtt_codec.h"
+#include "azure_umqtt_c/mqtt_capture.h"
+#include "azure_umqtt_c/mqtt_persist.h"
 #include "azure_c_shared_utility/umock_c_prod.h"
 
 #ifdef __cplusplus
@@ -45,8 +48,75 @@ DEFINE_ENUM(MQTT_CLIENT_EVENT_ERROR, MQTT_CLIENT_EVENT_ERROR_VALUES);
 
 typedef void(*ON_MQTT_OPERATION_CALLBACK)(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo, void* callbackCtx);
 typedef void(*ON_MQTT_ERROR_CALLBACK)(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR error, void* callbackCtx);
+typedef uint64_t MQTT_ACK_TOKEN;
+
 typedef void(*ON_MQTT_MESSAGE_RECV_CALLBACK)(MQTT_MESSAGE_HANDLE msgHandle, void* callbackCtx);
+typedef void(*ON_MQTT_MESSAGE_RECV_ACK_CALLBACK)(MQTT_MESSAGE_HANDLE msgHandle, MQTT_ACK_TOKEN ackToken, void* callbackCtx);
+typedef void(*ON_MQTT_MESSAGE_CHUNK_CALLBACK)(MQTT_MESSAGE_HANDLE msgHandle, const uint8_t* chunk, size_t chunkLength, size_t payloadOffset, size_t payloadLength, void* callbackCtx);
 typedef void(*ON_MQTT_DISCONNECTED_CALLBACK)(void* callbackCtx);
+typedef int(*ON_MQTT_PUBLISH_CHUNK_CALLBACK)(uint8_t* buffer, size_t bufferSize, size_t payloadOffset, size_t* chunkLength, void* callbackCtx);
+typedef void(*ON_MQTT_SUBSCRIBE_BATCH_COMPLETE)(MQTT_CLIENT_HANDLE handle, const QOS_VALUE* qosReturn, size_t qosCount, void* callbackCtx);
+typedef size_t(*MQTT_TRANSFORM_BOUND_FUNCTION)(size_t length);
+typedef int(*MQTT_TRANSFORM_FUNCTION)(const uint8_t* payload, size_t length, uint8_t* buffer, size_t bufferSize, size_t* resultLength);
+
+/* A payload transform, a compressor for example, see mqtt_client_set_payload_transform */
+typedef struct MQTT_PAYLOAD_TRANSFORM_TAG
+{
+    /* Flags transformed payloads as the MQTT 5.0 content type of the PUBLISH */
+    const char* contentType;
+    /* Largest encoded size of a payload of length bytes */
+    MQTT_TRANSFORM_BOUND_FUNCTION getEncodedBound;
+    /* Both return zero with resultLength set, non-zero when the result does not fit in bufferSize or the input is malformed */
+    MQTT_TRANSFORM_FUNCTION encode;
+    MQTT_TRANSFORM_FUNCTION decode;
+    /* Largest decoded payload accepted when maximumPacketSize of MQTT_CLIENT_OPTIONS is 0, 0 uses 16 MB */
+    size_t maxDecodedLength;
+} MQTT_PAYLOAD_TRANSFORM;
+
+#define MQTT_OFFLINE_DROP_POLICY_VALUES     \
+    MQTT_OFFLINE_DROP_OLDEST,               \
+    MQTT_OFFLINE_DROP_NEWEST
+
+DEFINE_ENUM(MQTT_OFFLINE_DROP_POLICY, MQTT_OFFLINE_DROP_POLICY_VALUES);
+
+typedef struct MQTT_OFFLINE_QUEUE_OPTIONS_TAG
+{
+    /* Maximum number of encoded bytes held while offline, 0 means no byte limit */
+    size_t maxBytes;
+    /* Maximum number of publishes held while offline, 0 means no message limit */
+    size_t maxMessages;
+    /* Which publish is dropped when a new one does not fit in the budget */
+    MQTT_OFFLINE_DROP_POLICY dropPolicy;
+    /* Reject QoS 0 publishes instead of queueing them */
+    bool discardQos0;
+    /* Publishes sent per second once the connection is accepted, 0 drains the whole queue at once */
+    size_t drainRatePerSecond;
+} MQTT_OFFLINE_QUEUE_OPTIONS;
+
+typedef struct MQTT_RECONNECT_OPTIONS_TAG
+{
+    /* Delay before the first reconnect attempt, doubled on every failed attempt */
+    size_t initialDelayMs;
+    /* Upper bound of the backoff delay */
+    size_t maxDelayMs;
+    /* Number of consecutive failed attempts before giving up, 0 retries forever */
+    size_t maxAttempts;
+    /* First of the consecutive packet ids used to restore the subscriptions, they never wrap past 0xFFFF.
+       0 selects 0xFF00, the application keeps to the ids below. */
+    uint16_t resubscribePacketId;
+} MQTT_RECONNECT_OPTIONS;
+
+typedef struct MQTT_CONNECTION_LIMITS_TAG
+{
+    /* QoS 1/2 publishes the server accepts to have outstanding at once */
+    uint16_t receiveMaximum;
+    /* Largest packet the server accepts, 0 when it has no limit */
+    uint32_t maximumPacketSize;
+    /* Highest topic alias the server accepts, 0 when topic aliases are not allowed */
+    uint16_t topicAliasMaximum;
+    QOS_VALUE maximumQos;
+    bool retainAvailable;
+} MQTT_CONNECTION_LIMITS;
 
 MOCKABLE_FUNCTION(, MQTT_CLIENT_HANDLE, mqtt_client_init, ON_MQTT_MESSAGE_RECV_CALLBACK, msgRecv, ON_MQTT_OPERATION_CALLBACK, opCallback, void*, opCallbackCtx, ON_MQTT_ERROR_CALLBACK, onErrorCallBack, void*, errorCBCtx);
 MOCKABLE_FUNCTION(, void, mqtt_client_deinit, MQTT_CLIENT_HANDLE, handle);
@@ -55,14 +125,124 @@ MOCKABLE_FUNCTION(, int, mqtt_client_connect, MQTT_CLIENT_HANDLE, handle, XIO_HA
 MOCKABLE_FUNCTION(, int, mqtt_client_disconnect, MQTT_CLIENT_HANDLE, handle, ON_MQTT_DISCONNECTED_CALLBACK, callback, void*, ctx);
 
 MOCKABLE_FUNCTION(, int, mqtt_client_subscribe, MQTT_CLIENT_HANDLE, handle, uint16_t, packetId, SUBSCRIBE_PAYLOAD*, subscribeList, size_t, count);
+/*
+*    @brief    Subscribes to a large list of filters using the fewest SUBSCRIBE packets that each fit in maxPacketSize
+*              (0 for the protocol maximum). The packets are sent back to back with consecutive packet ids starting
+*              at firstPacketId, and onComplete is called once with the granted QoS of every filter, in list order,
+*              after the last SUBACK. The individual SUBACKs are not reported to the operation callback.
+*    @param    packetCount    Optional, receives the number of packet ids used.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_subscribe_batch, MQTT_CLIENT_HANDLE, handle, uint16_t, firstPacketId, SUBSCRIBE_PAYLOAD*, subscribeList, size_t, count, size_t, maxPacketSize, ON_MQTT_SUBSCRIBE_BATCH_COMPLETE, onComplete, void*, callbackCtx, size_t*, packetCount);
 MOCKABLE_FUNCTION(, int, mqtt_client_unsubscribe, MQTT_CLIENT_HANDLE, handle, uint16_t, packetId, const char**, unsubscribeList, size_t, count);
 
 MOCKABLE_FUNCTION(, int, mqtt_client_publish, MQTT_CLIENT_HANDLE, handle, MQTT_MESSAGE_HANDLE, msgHandle);
+/*
+*    @brief    Publishes buffLen bytes of msgBuffer on the topic, QoS and retain flag of a template made with
+*              mqtt_codec_publish_template_create, which skips encoding the topic on every publish. packetId is only
+*              used for QoS 1 and 2. The publish is never a duplicate and does not use a topic alias. msgBuffer is
+*              sent as it is, the payload transform of a matching topic filter is not applied.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_publish_template, MQTT_CLIENT_HANDLE, handle, MQTT_PUBLISH_TEMPLATE_HANDLE, publishTemplate, uint16_t, packetId, const uint8_t*, msgBuffer, size_t, buffLen);
 
 MOCKABLE_FUNCTION(, void, mqtt_client_dowork, MQTT_CLIENT_HANDLE, handle);
 
 MOCKABLE_FUNCTION(, void, mqtt_client_set_trace, MQTT_CLIENT_HANDLE, handle, bool, traceOn, bool, rawBytesOn);
 
+/*
+*    @brief    Mirrors the raw MQTT byte stream into a pcapng capture sink. The sink is owned by the caller
+*              and must outlive the client or be removed by passing NULL.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_capture, MQTT_CLIENT_HANDLE, handle, MQTT_CAPTURE_HANDLE, captureHandle);
+
+/*
+*    @brief    Keeps QoS 1/2 PUBLISH packets in a persistent store until they are acknowledged. When a
+*              connection without clean session is accepted the outstanding packets are resent with DUP set.
+*              The store is owned by the caller and must outlive the client or be removed by passing NULL.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_persistence, MQTT_CLIENT_HANDLE, handle, MQTT_PERSIST_HANDLE, persistHandle);
+
+/*
+*    @brief    Queues publishes made while the client is not connected and sends them from mqtt_client_dowork
+*              once the CONNACK is accepted. Passing NULL options disables the queue and discards its content.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_offline_queue, MQTT_CLIENT_HANDLE, handle, const MQTT_OFFLINE_QUEUE_OPTIONS*, options);
+MOCKABLE_FUNCTION(, size_t, mqtt_client_get_offline_queue_count, MQTT_CLIENT_HANDLE, handle);
+
+/*
+*    @brief    Reopens the xio passed to mqtt_client_connect with jittered exponential backoff after a connection
+*              error, a failed send or a missing ping response, reusing the connect options. When the broker did not keep the
+*              session the subscriptions made since connect are restored, split into as few SUBSCRIBE packets as
+*              the maximum packet size allows. Their SUBACKs are not reported to the operation callback. Passing
+*              NULL options disables reconnection.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_reconnect, MQTT_CLIENT_HANDLE, handle, const MQTT_RECONNECT_OPTIONS*, options);
+
+/*
+*    @brief    Returns the limits the server announced in its MQTT 5.0 CONNACK, or the protocol defaults when
+*              the connection uses MQTT 3.1.1 or the server did not announce them.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_get_connection_limits, MQTT_CLIENT_HANDLE, handle, MQTT_CONNECTION_LIMITS*, limits);
+
+/*
+*    @brief    Bounds the number of QoS 1 and 2 publishes awaiting acknowledgement to the smaller of maxInflight
+*              and the server Receive Maximum, 0 only applies the server limit. While the window is full such
+*              publishes go to the offline queue when it is enabled and are rejected otherwise.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_max_inflight, MQTT_CLIENT_HANDLE, handle, uint16_t, maxInflight);
+MOCKABLE_FUNCTION(, int, mqtt_client_get_inflight_window, MQTT_CLIENT_HANDLE, handle, size_t*, inflightCount, size_t*, windowSize);
+
+/*
+*    @brief    The PUBACK and PUBREC packets of the publishes received in one read are sent together at the end of
+*              it. With a maxAckDelayMs above 0 they are held across reads and sent from mqtt_client_dowork once the
+*              oldest has waited that long. The server counts held acks against its Receive Maximum.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_ack_delay, MQTT_CLIENT_HANDLE, handle, size_t, maxAckDelayMs);
+
+/*
+*    @brief    Manual acknowledgement mode, msgRecv is called instead of the ON_MQTT_MESSAGE_RECV_CALLBACK and the
+*              PUBACK or PUBREC is only sent once ackToken is passed to mqtt_client_ack, which may be called from any
+*              thread. The acks are sent from the next mqtt_client_dowork. Tokens of messages received on a previous
+*              connection are dropped, the server delivers those messages again. Streamed messages are acknowledged
+*              after their last chunk as before. A NULL msgRecv turns the mode off.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_manual_ack, MQTT_CLIENT_HANDLE, handle, ON_MQTT_MESSAGE_RECV_ACK_CALLBACK, msgRecv, void*, callbackCtx);
+MOCKABLE_FUNCTION(, int, mqtt_client_ack, MQTT_CLIENT_HANDLE, handle, MQTT_ACK_TOKEN, ackToken);
+
+/*
+*    @brief    Incoming publishes with more than threshold bytes after the fixed header are not buffered, chunkCallback
+*              receives their payload in chunks as it arrives instead of the ON_MQTT_MESSAGE_RECV_CALLBACK. The message
+*              carries the topic and flags with an empty payload, the chunk at payloadOffset + chunkLength equal to
+*              payloadLength is the last one and the publish is acknowledged after it. A threshold of 0 or a NULL
+*              chunkCallback turns streaming off.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_message_stream, MQTT_CLIENT_HANDLE, handle, size_t, threshold, ON_MQTT_MESSAGE_CHUNK_CALLBACK, chunkCallback, void*, callbackCtx);
+
+/*
+*    @brief    Publishes payloadLength bytes without holding them in memory. The PUBLISH header is sent right away with
+*              the topic, QoS, packet id and flags of msgHandle, the payload of msgHandle is not used. mqtt_client_dowork
+*              then calls chunkCallback each time the previous chunk has been sent, it copies up to bufferSize bytes of
+*              the payload at payloadOffset into buffer and sets chunkLength, 0 bytes when no data is ready yet. Other
+*              packets are held until the last chunk is sent. Only one streamed publish can be sent at a time and it is
+*              neither persisted nor queued offline, a failing callback closes the connection. The chunks are sent as
+*              they are, the payload transform of a matching topic filter is not applied.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_publish_stream, MQTT_CLIENT_HANDLE, handle, MQTT_MESSAGE_HANDLE, msgHandle, size_t, payloadLength, size_t, chunkSize, ON_MQTT_PUBLISH_CHUNK_CALLBACK, chunkCallback, void*, callbackCtx);
+
+/*
+*    @brief    Encodes the payload of messages published on topics that match topicFilter with transform, and decodes the
+*              payload of messages received on them before the message callback is called. A transformed payload is
+*              sent after its decoded length and is flagged with the content type of the transform in MQTT 5.0 mode,
+*              where a payload that does not shrink is sent as it is. In MQTT 3.1.1 mode the topic filter is the flag,
+*              every payload on it is framed and one that does not shrink is stored after its length. Encoding and
+*              decoding reuse buffers owned by the client, the decoded payload is valid for the duration of the
+*              callback. A received payload whose decoded length is larger than maximumPacketSize, or when it is 0
+*              than maxDecodedLength, is reported as MQTT_CLIENT_PARSE_ERROR. mqtt_client_publish_template and
+*              mqtt_client_publish_stream do not transform their payload, do not use them on a transformed topic
+*              in MQTT 3.1.1 mode where its receivers expect every payload framed. transform is referenced, not
+*              copied, a NULL transform removes topicFilter.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_client_set_payload_transform, MQTT_CLIENT_HANDLE, handle, const char*, topicFilter, const MQTT_PAYLOAD_TRANSFORM*, transform);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
@@ -0,0 +1,268 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_CLIENT_HPP
+#define MQTT_CLIENT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+
+#include "azure_umqtt_c/mqtt_client.h"
+#include "azure_umqtt_c/mqtt_message.h"
+
+/*
+*    Header only C++17 layer over mqtt_client and mqtt_message. The types own their handle and are move only, the
+*    accessors are views over the memory of the handle and the callbacks are instantiated for the handler type, so
+*    nothing is allocated or copied per message on top of the C API. Errors are returned as the C API does.
+*/
+namespace azure_umqtt_c
+{
+#if __cplusplus >= 202002L
+    template <typename T>
+    using span = std::span<T>;
+#else
+    template <typename T>
+    class span
+    {
+    public:
+        constexpr span() noexcept : data_(nullptr), size_(0) {}
+        constexpr span(T* data, std::size_t size) noexcept : data_(data), size_(size) {}
+        template <std::size_t N>
+        constexpr span(T (&array)[N]) noexcept : data_(array), size_(N) {}
+
+        constexpr T* data() const noexcept { return data_; }
+        constexpr std::size_t size() const noexcept { return size_; }
+        constexpr bool empty() const noexcept { return size_ == 0; }
+        constexpr T* begin() const noexcept { return data_; }
+        constexpr T* end() const noexcept { return data_ + size_; }
+        constexpr T& operator[](std::size_t index) const noexcept { return data_[index]; }
+
+    private:
+        T* data_;
+        std::size_t size_;
+    };
+#endif
+
+    using byte_view = span<const std::uint8_t>;
+
+    class Message;
+
+    // Non owning view of a message, valid for the duration of the callback it is passed to
+    class MessageView
+    {
+    public:
+        explicit MessageView(MQTT_MESSAGE_HANDLE handle) noexcept : handle_(handle) {}
+
+        std::string_view topic() const noexcept
+        {
+            const char* topicName = mqttmessage_getTopicName(handle_);
+            return topicName == nullptr ? std::string_view() : std::string_view(topicName);
+        }
+        byte_view payload() const noexcept
+        {
+            const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(handle_);
+            return payload == nullptr ? byte_view() : byte_view(payload->message, payload->length);
+        }
+        std::uint16_t packet_id() const noexcept { return mqttmessage_getPacketId(handle_); }
+        QOS_VALUE qos() const noexcept { return mqttmessage_getQosType(handle_); }
+        bool is_duplicate() const noexcept { return mqttmessage_getIsDuplicateMsg(handle_); }
+        bool is_retained() const noexcept { return mqttmessage_getIsRetained(handle_); }
+        MQTT_MESSAGE_HANDLE get() const noexcept { return handle_; }
+
+        // Copies the message so it can outlive the callback
+        inline Message clone() const noexcept;
+
+    private:
+        MQTT_MESSAGE_HANDLE handle_;
+    };
+
+    class Message
+    {
+    public:
+        Message() noexcept : handle_(nullptr) {}
+        explicit Message(MQTT_MESSAGE_HANDLE handle) noexcept : handle_(handle) {}
+        Message(const Message&) = delete;
+        Message& operator=(const Message&) = delete;
+        Message(Message&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+        Message& operator=(Message&& other) noexcept
+        {
+            if (this != &other)
+            {
+                reset(std::exchange(other.handle_, nullptr));
+            }
+            return *this;
+        }
+        ~Message() { reset(); }
+
+        /* Copies topicName and payload into the message */
+        static Message create(std::uint16_t packetId, const char* topicName, QOS_VALUE qos, byte_view payload) noexcept
+        {
+            return Message(mqttmessage_create(packetId, topicName, qos, payload.data(), payload.size()));
+        }
+        /* Points at topicName and payload, which must outlive the message */
+        static Message create_in_place(std::uint16_t packetId, const char* topicName, QOS_VALUE qos, byte_view payload) noexcept
+        {
+            return Message(mqttmessage_create_in_place(packetId, topicName, qos, payload.data(), payload.size()));
+        }
+
+        explicit operator bool() const noexcept { return handle_ != nullptr; }
+        MessageView view() const noexcept { return MessageView(handle_); }
+        std::string_view topic() const noexcept { return view().topic(); }
+        byte_view payload() const noexcept { return view().payload(); }
+        std::uint16_t packet_id() const noexcept { return mqttmessage_getPacketId(handle_); }
+        QOS_VALUE qos() const noexcept { return mqttmessage_getQosType(handle_); }
+        bool is_duplicate() const noexcept { return mqttmessage_getIsDuplicateMsg(handle_); }
+        bool is_retained() const noexcept { return mqttmessage_getIsRetained(handle_); }
+        int set_duplicate(bool duplicateMsg) noexcept { return mqttmessage_setIsDuplicateMsg(handle_, duplicateMsg); }
+        int set_retained(bool retainMsg) noexcept { return mqttmessage_setIsRetained(handle_, retainMsg); }
+
+        MQTT_MESSAGE_HANDLE get() const noexcept { return handle_; }
+        MQTT_MESSAGE_HANDLE release() noexcept { return std::exchange(handle_, nullptr); }
+        void reset(MQTT_MESSAGE_HANDLE handle = nullptr) noexcept
+        {
+            MQTT_MESSAGE_HANDLE previous = std::exchange(handle_, handle);
+            if (previous != nullptr)
+            {
+                mqttmessage_destroy(previous);
+            }
+        }
+
+    private:
+        MQTT_MESSAGE_HANDLE handle_;
+    };
+
+    inline Message MessageView::clone() const noexcept
+    {
+        return Message(mqttmessage_clone(handle_));
+    }
+
+    namespace detail
+    {
+        template <typename Handler, typename = void>
+        struct has_on_operation : std::false_type {};
+        template <typename Handler>
+        struct has_on_operation<Handler, std::void_t<decltype(std::declval<Handler&>().on_operation(
+            std::declval<MQTT_CLIENT_EVENT_RESULT>(), std::declval<const void*>()))>> : std::true_type {};
+
+        template <typename Handler, typename = void>
+        struct has_on_error : std::false_type {};
+        template <typename Handler>
+        struct has_on_error<Handler, std::void_t<decltype(std::declval<Handler&>().on_error(
+            std::declval<MQTT_CLIENT_EVENT_ERROR>()))>> : std::true_type {};
+
+        template <typename Handler>
+        void on_message_recv(MQTT_MESSAGE_HANDLE msgHandle, void* callbackCtx)
+        {
+            static_cast<Handler*>(callbackCtx)->on_message(MessageView(msgHandle));
+        }
+
+        template <typename Handler>
+        void on_message_recv_ack(MQTT_MESSAGE_HANDLE msgHandle, MQTT_ACK_TOKEN ackToken, void* callbackCtx)
+        {
+            static_cast<Handler*>(callbackCtx)->on_message(MessageView(msgHandle), ackToken);
+        }
+
+        template <typename Handler>
+        void on_operation(MQTT_CLIENT_HANDLE, MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo, void* callbackCtx)
+        {
+            if constexpr (has_on_operation<Handler>::value)
+            {
+                static_cast<Handler*>(callbackCtx)->on_operation(actionResult, msgInfo);
+            }
+            else
+            {
+                (void)actionResult;
+                (void)msgInfo;
+                (void)callbackCtx;
+            }
+        }
+
+        template <typename Handler>
+        void on_error(MQTT_CLIENT_HANDLE, MQTT_CLIENT_EVENT_ERROR error, void* callbackCtx)
+        {
+            static_cast<Handler*>(callbackCtx)->on_error(error);
+        }
+    }
+
+    class Client
+    {
+    public:
+        Client() noexcept : handle_(nullptr) {}
+        explicit Client(MQTT_CLIENT_HANDLE handle) noexcept : handle_(handle) {}
+        Client(const Client&) = delete;
+        Client& operator=(const Client&) = delete;
+        Client(Client&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+        Client& operator=(Client&& other) noexcept
+        {
+            if (this != &other)
+            {
+                reset(std::exchange(other.handle_, nullptr));
+            }
+            return *this;
+        }
+        ~Client() { reset(); }
+
+        /*
+        *    Handler needs on_message(MessageView), its on_operation(MQTT_CLIENT_EVENT_RESULT, const void*) and
+        *    on_error(MQTT_CLIENT_EVENT_ERROR) are optional. The handler is referenced, not copied, and must outlive
+        *    the client.
+        */
+        template <typename Handler>
+        static Client create(Handler& handler) noexcept
+        {
+            ON_MQTT_ERROR_CALLBACK onError = nullptr;
+            if constexpr (detail::has_on_error<Handler>::value)
+            {
+                onError = &detail::on_error<Handler>;
+            }
+            return Client(mqtt_client_init(&detail::on_message_recv<Handler>, &detail::on_operation<Handler>, &handler, onError, &handler));
+        }
+
+        explicit operator bool() const noexcept { return handle_ != nullptr; }
+
+        int connect(XIO_HANDLE xioHandle, MQTT_CLIENT_OPTIONS& mqttOptions) noexcept { return mqtt_client_connect(handle_, xioHandle, &mqttOptions); }
+        int disconnect(ON_MQTT_DISCONNECTED_CALLBACK callback = nullptr, void* ctx = nullptr) noexcept { return mqtt_client_disconnect(handle_, callback, ctx); }
+        int subscribe(std::uint16_t packetId, span<SUBSCRIBE_PAYLOAD> subscribeList) noexcept
+        {
+            return mqtt_client_subscribe(handle_, packetId, subscribeList.data(), subscribeList.size());
+        }
+        int unsubscribe(std::uint16_t packetId, span<const char*> unsubscribeList) noexcept
+        {
+            return mqtt_client_unsubscribe(handle_, packetId, unsubscribeList.data(), unsubscribeList.size());
+        }
+        int publish(const Message& message) noexcept { return mqtt_client_publish(handle_, message.get()); }
+        int publish(MessageView message) noexcept { return mqtt_client_publish(handle_, message.get()); }
+        void dowork() noexcept { mqtt_client_dowork(handle_); }
+
+        /* handler.on_message(MessageView, MQTT_ACK_TOKEN) is called instead of on_message(MessageView) */
+        template <typename Handler>
+        int set_manual_ack(Handler& handler) noexcept
+        {
+            return mqtt_client_set_manual_ack(handle_, &detail::on_message_recv_ack<Handler>, &handler);
+        }
+        int clear_manual_ack() noexcept { return mqtt_client_set_manual_ack(handle_, nullptr, nullptr); }
+        int ack(MQTT_ACK_TOKEN ackToken) noexcept { return mqtt_client_ack(handle_, ackToken); }
+
+        MQTT_CLIENT_HANDLE get() const noexcept { return handle_; }
+        MQTT_CLIENT_HANDLE release() noexcept { return std::exchange(handle_, nullptr); }
+        void reset(MQTT_CLIENT_HANDLE handle = nullptr) noexcept
+        {
+            MQTT_CLIENT_HANDLE previous = std::exchange(handle_, handle);
+            if (previous != nullptr)
+            {
+                mqtt_client_deinit(previous);
+            }
+        }
+
+    private:
+        MQTT_CLIENT_HANDLE handle_;
+    };
+}
+
+#endif // MQTT_CLIENT_HPP
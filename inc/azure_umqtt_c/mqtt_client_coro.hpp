@@ -0,0 +1,386 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_CLIENT_CORO_HPP
+#define MQTT_CLIENT_CORO_HPP
+
+#include <array>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+
+#include "azure_umqtt_c/mqtt_client.hpp"
+
+/*
+*    C++20 awaitables over Client. The state of an operation lives in its awaiter, which is part of the coroutine
+*    frame, and is found again through a table keyed by packet id, so an operation in flight allocates nothing. The
+*    coroutines are resumed from AsyncClient::dowork, which has to run on the thread that awaits.
+*/
+namespace azure_umqtt_c
+{
+    /* Result of an operation that could not be sent, that the server refused or whose connection was lost */
+    constexpr int OPERATION_FAILED = 1;
+
+    struct ConnectResult
+    {
+        /* 0 once a CONNACK was received, non-zero when the connect failed or the connection was lost before it */
+        int result;
+        bool sessionPresent;
+        CONNECT_RETURN_CODE returnCode;
+    };
+
+    struct SubscribeResult
+    {
+        int result;
+        /* qosReturn points into the granted span passed to subscribe, qosCount is at most its size */
+        SUBSCRIBE_ACK suback;
+    };
+
+    namespace detail
+    {
+        struct PendingOperation
+        {
+            MQTT_CLIENT_EVENT_RESULT expected;
+            std::uint16_t packetId;
+            bool suspended;
+            bool completed;
+            int result;
+            void* awaiter;
+            PendingOperation* next;
+            std::coroutine_handle<> continuation;
+        };
+    }
+
+    template <typename Handler>
+    class AsyncClient
+    {
+    public:
+        /* The client calls handler.on_message and, when it has one, handler.on_error. It is not copied and must
+           outlive the AsyncClient, which stays at the address it was constructed at. */
+        explicit AsyncClient(Handler& handler) noexcept : handler_(handler), buckets_(), connect_(nullptr), readyHead_(nullptr), readyTail_(nullptr)
+        {
+            client_ = Client::create(*this);
+        }
+        AsyncClient(const AsyncClient&) = delete;
+        AsyncClient& operator=(const AsyncClient&) = delete;
+
+        explicit operator bool() const noexcept { return static_cast<bool>(client_); }
+        Client& client() noexcept { return client_; }
+
+        class ConnectAwaiter
+        {
+        public:
+            ConnectAwaiter(AsyncClient& owner, XIO_HANDLE xioHandle, MQTT_CLIENT_OPTIONS& mqttOptions) noexcept
+                : owner_(owner), xioHandle_(xioHandle), mqttOptions_(mqttOptions), operation_{ MQTT_CLIENT_ON_CONNACK, 0, false, false, 0, this, nullptr, {} }, connack_{ false, CONN_REFUSED_UNKNOWN }
+            {
+            }
+            ConnectAwaiter(const ConnectAwaiter&) = delete;
+
+            bool await_ready() noexcept
+            {
+                owner_.connect_ = this;
+                if (owner_.client_.connect(xioHandle_, mqttOptions_) != 0)
+                {
+                    owner_.connect_ = nullptr;
+                    operation_.result = OPERATION_FAILED;
+                    operation_.completed = true;
+                }
+                return operation_.completed;
+            }
+            void await_suspend(std::coroutine_handle<> continuation) noexcept
+            {
+                operation_.continuation = continuation;
+                operation_.suspended = true;
+            }
+            ConnectResult await_resume() const noexcept { return ConnectResult{ operation_.result, connack_.sessionPresent, connack_.returnCode }; }
+
+        private:
+            friend class AsyncClient;
+            struct Connack
+            {
+                bool sessionPresent;
+                CONNECT_RETURN_CODE returnCode;
+            };
+
+            AsyncClient& owner_;
+            XIO_HANDLE xioHandle_;
+            MQTT_CLIENT_OPTIONS& mqttOptions_;
+            detail::PendingOperation operation_;
+            Connack connack_;
+        };
+
+        class PublishAwaiter
+        {
+        public:
+            PublishAwaiter(AsyncClient& owner, MQTT_MESSAGE_HANDLE msgHandle) noexcept
+                : owner_(owner), msgHandle_(msgHandle), operation_{ MQTT_CLIENT_ON_PUBLISH_ACK, 0, false, false, 0, this, nullptr, {} }
+            {
+            }
+            PublishAwaiter(const PublishAwaiter&) = delete;
+
+            bool await_ready() noexcept
+            {
+                QOS_VALUE qosValue = mqttmessage_getQosType(msgHandle_);
+                operation_.packetId = mqttmessage_getPacketId(msgHandle_);
+                operation_.expected = (qosValue == DELIVER_EXACTLY_ONCE) ? MQTT_CLIENT_ON_PUBLISH_COMP : MQTT_CLIENT_ON_PUBLISH_ACK;
+                if (qosValue == DELIVER_AT_MOST_ONCE)
+                {
+                    // Nothing comes back for QoS 0, it is done once it is sent
+                    operation_.result = owner_.client_.publish(MessageView(msgHandle_));
+                    operation_.completed = true;
+                }
+                else
+                {
+                    owner_.add_pending(&operation_);
+                    if (owner_.client_.publish(MessageView(msgHandle_)) != 0)
+                    {
+                        owner_.remove_pending(&operation_);
+                        operation_.result = OPERATION_FAILED;
+                        operation_.completed = true;
+                    }
+                }
+                return operation_.completed;
+            }
+            void await_suspend(std::coroutine_handle<> continuation) noexcept
+            {
+                operation_.continuation = continuation;
+                operation_.suspended = true;
+            }
+            int await_resume() const noexcept { return operation_.result; }
+
+        private:
+            AsyncClient& owner_;
+            MQTT_MESSAGE_HANDLE msgHandle_;
+            detail::PendingOperation operation_;
+        };
+
+        class SubscribeAwaiter
+        {
+        public:
+            SubscribeAwaiter(AsyncClient& owner, std::uint16_t packetId, span<SUBSCRIBE_PAYLOAD> subscribeList, span<QOS_VALUE> granted) noexcept
+                : owner_(owner), subscribeList_(subscribeList), granted_(granted), operation_{ MQTT_CLIENT_ON_SUBSCRIBE_ACK, packetId, false, false, 0, this, nullptr, {} }, grantedCount_(0)
+            {
+            }
+            SubscribeAwaiter(const SubscribeAwaiter&) = delete;
+
+            bool await_ready() noexcept
+            {
+                owner_.add_pending(&operation_);
+                if (owner_.client_.subscribe(operation_.packetId, subscribeList_) != 0)
+                {
+                    owner_.remove_pending(&operation_);
+                    operation_.result = OPERATION_FAILED;
+                    operation_.completed = true;
+                }
+                return operation_.completed;
+            }
+            void await_suspend(std::coroutine_handle<> continuation) noexcept
+            {
+                operation_.continuation = continuation;
+                operation_.suspended = true;
+            }
+            SubscribeResult await_resume() const noexcept
+            {
+                SubscribeResult result;
+                result.result = operation_.result;
+                result.suback.packetId = operation_.packetId;
+                result.suback.qosReturn = granted_.data();
+                result.suback.qosCount = grantedCount_;
+                return result;
+            }
+
+        private:
+            friend class AsyncClient;
+
+            AsyncClient& owner_;
+            span<SUBSCRIBE_PAYLOAD> subscribeList_;
+            span<QOS_VALUE> granted_;
+            detail::PendingOperation operation_;
+            std::size_t grantedCount_;
+        };
+
+        /* Resumes with the CONNACK, or with a failure when the connection is lost first */
+        ConnectAwaiter connect(XIO_HANDLE xioHandle, MQTT_CLIENT_OPTIONS& mqttOptions) noexcept { return ConnectAwaiter(*this, xioHandle, mqttOptions); }
+        /* Resumes once QoS 0 is sent, on the PUBACK for QoS 1 and on the PUBCOMP for QoS 2, with OPERATION_FAILED
+           when the PUBACK, PUBREC or PUBCOMP carries an MQTT 5.0 failure reason code. The packet ids of the
+           publishes awaited at the same time have to differ. */
+        PublishAwaiter publish(const Message& message) noexcept { return PublishAwaiter(*this, message.get()); }
+        /* Resumes with the SUBACK, the granted QoS of each filter is copied to granted */
+        SubscribeAwaiter subscribe(std::uint16_t packetId, span<SUBSCRIBE_PAYLOAD> subscribeList, span<QOS_VALUE> granted = span<QOS_VALUE>()) noexcept
+        {
+            return SubscribeAwaiter(*this, packetId, subscribeList, granted);
+        }
+
+        /* Drives the client and then resumes the coroutines whose operation completed in it */
+        void dowork() noexcept
+        {
+            client_.dowork();
+            resume_ready();
+        }
+
+        // Callbacks of the client
+        void on_message(MessageView message) { handler_.on_message(message); }
+        void on_operation(MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo) noexcept
+        {
+            switch (actionResult)
+            {
+                case MQTT_CLIENT_ON_CONNACK:
+                    if (connect_ != nullptr)
+                    {
+                        const CONNECT_ACK* connack = static_cast<const CONNECT_ACK*>(msgInfo);
+                        ConnectAwaiter* awaiter = connect_;
+                        connect_ = nullptr;
+                        awaiter->connack_.sessionPresent = connack->isSessionPresent;
+                        awaiter->connack_.returnCode = connack->returnCode;
+                        complete(&awaiter->operation_, 0);
+                    }
+                    break;
+                case MQTT_CLIENT_ON_PUBLISH_ACK:
+                case MQTT_CLIENT_ON_PUBLISH_RECV:
+                case MQTT_CLIENT_ON_PUBLISH_COMP:
+                {
+                    const PUBLISH_ACK* publishAck = static_cast<const PUBLISH_ACK*>(msgInfo);
+                    bool failed = static_cast<std::uint8_t>(publishAck->reasonCode) >= static_cast<std::uint8_t>(MQTT_REASON_UNSPECIFIED_ERROR);
+                    // A failed PUBREC ends the QoS 2 exchange, no PUBCOMP follows it
+                    detail::PendingOperation* operation = (actionResult != MQTT_CLIENT_ON_PUBLISH_RECV) ? find_pending(actionResult, publishAck->packetId) :
+                        failed ? find_pending(MQTT_CLIENT_ON_PUBLISH_COMP, publishAck->packetId) : nullptr;
+                    if (operation != nullptr)
+                    {
+                        remove_pending(operation);
+                        complete(operation, failed ? OPERATION_FAILED : 0);
+                    }
+                    break;
+                }
+                case MQTT_CLIENT_ON_SUBSCRIBE_ACK:
+                {
+                    const SUBSCRIBE_ACK* suback = static_cast<const SUBSCRIBE_ACK*>(msgInfo);
+                    detail::PendingOperation* operation = find_pending(actionResult, suback->packetId);
+                    if (operation != nullptr)
+                    {
+                        SubscribeAwaiter* awaiter = static_cast<SubscribeAwaiter*>(operation->awaiter);
+                        std::size_t index;
+                        for (index = 0; index < suback->qosCount && index < awaiter->granted_.size(); index++)
+                        {
+                            awaiter->granted_[index] = suback->qosReturn[index];
+                        }
+                        awaiter->grantedCount_ = index;
+                        remove_pending(operation);
+                        complete(operation, 0);
+                    }
+                    break;
+                }
+                case MQTT_CLIENT_ON_DISCONNECT:
+                    fail_pending();
+                    break;
+                default:
+                    break;
+            }
+        }
+        void on_error(MQTT_CLIENT_EVENT_ERROR error)
+        {
+            fail_pending();
+            if constexpr (detail::has_on_error<Handler>::value)
+            {
+                handler_.on_error(error);
+            }
+            else
+            {
+                (void)error;
+            }
+        }
+
+    private:
+        static constexpr std::size_t BUCKET_COUNT = 256;
+
+        static std::size_t bucket_of(std::uint16_t packetId) noexcept { return packetId % BUCKET_COUNT; }
+
+        void add_pending(detail::PendingOperation* operation) noexcept
+        {
+            detail::PendingOperation*& head = buckets_[bucket_of(operation->packetId)];
+            operation->next = head;
+            head = operation;
+        }
+        void remove_pending(detail::PendingOperation* operation) noexcept
+        {
+            detail::PendingOperation** link = &buckets_[bucket_of(operation->packetId)];
+            while (*link != nullptr && *link != operation)
+            {
+                link = &(*link)->next;
+            }
+            if (*link != nullptr)
+            {
+                *link = operation->next;
+            }
+            operation->next = nullptr;
+        }
+        detail::PendingOperation* find_pending(MQTT_CLIENT_EVENT_RESULT expected, std::uint16_t packetId) const noexcept
+        {
+            detail::PendingOperation* operation = buckets_[bucket_of(packetId)];
+            while (operation != nullptr && (operation->packetId != packetId || operation->expected != expected))
+            {
+                operation = operation->next;
+            }
+            return operation;
+        }
+
+        // Coroutines are only queued here, resuming them from inside the client callback would reenter it
+        void complete(detail::PendingOperation* operation, int result) noexcept
+        {
+            operation->result = result;
+            operation->completed = true;
+            if (operation->suspended)
+            {
+                operation->next = nullptr;
+                if (readyTail_ == nullptr)
+                {
+                    readyHead_ = operation;
+                }
+                else
+                {
+                    readyTail_->next = operation;
+                }
+                readyTail_ = operation;
+            }
+        }
+        void fail_pending() noexcept
+        {
+            if (connect_ != nullptr)
+            {
+                ConnectAwaiter* awaiter = connect_;
+                connect_ = nullptr;
+                complete(&awaiter->operation_, OPERATION_FAILED);
+            }
+            for (detail::PendingOperation*& head : buckets_)
+            {
+                while (head != nullptr)
+                {
+                    detail::PendingOperation* operation = head;
+                    head = operation->next;
+                    complete(operation, OPERATION_FAILED);
+                }
+            }
+        }
+        void resume_ready() noexcept
+        {
+            detail::PendingOperation* operation = readyHead_;
+            readyHead_ = nullptr;
+            readyTail_ = nullptr;
+            while (operation != nullptr)
+            {
+                // The operation lives in the frame that is resumed, read the link first
+                detail::PendingOperation* next = operation->next;
+                operation->continuation.resume();
+                operation = next;
+            }
+        }
+
+        Handler& handler_;
+        Client client_;
+        std::array<detail::PendingOperation*, BUCKET_COUNT> buckets_;
+        ConnectAwaiter* connect_;
+        detail::PendingOperation* readyHead_;
+        detail::PendingOperation* readyTail_;
+    };
+}
+
+#endif // MQTT_CLIENT_CORO_HPP
@@ -21,8 +21,37 @@ extern "C" {
 #endif // __cplusplus
 
 typedef struct MQTTCODEC_INSTANCE_TAG* MQTTCODEC_HANDLE;
+typedef struct MQTT_PUBLISH_TEMPLATE_TAG* MQTT_PUBLISH_TEMPLATE_HANDLE;
+
+#define MQTT_PUBLISH_REPLY_SIZE     4
+
+/*
+*    @brief    Wire images of the packets whose encoding never changes. PINGREQ and DISCONNECT are sent as they are,
+*              the PUBACK, PUBREC, PUBREL and PUBCOMP templates are copied and given their packet id with
+*              MQTT_SET_REPLY_PACKET_ID.
+*/
+static const uint8_t MQTT_PINGREQ_PACKET[] = { PINGREQ_TYPE, 0x00 };
+static const uint8_t MQTT_DISCONNECT_PACKET[] = { DISCONNECT_TYPE, 0x00 };
+static const uint8_t MQTT_PUBACK_TEMPLATE[MQTT_PUBLISH_REPLY_SIZE] = { PUBACK_TYPE, 0x02, 0x00, 0x00 };
+static const uint8_t MQTT_PUBREC_TEMPLATE[MQTT_PUBLISH_REPLY_SIZE] = { PUBREC_TYPE, 0x02, 0x00, 0x00 };
+static const uint8_t MQTT_PUBREL_TEMPLATE[MQTT_PUBLISH_REPLY_SIZE] = { PUBREL_TYPE | 0x02, 0x02, 0x00, 0x00 };
+static const uint8_t MQTT_PUBCOMP_TEMPLATE[MQTT_PUBLISH_REPLY_SIZE] = { PUBCOMP_TYPE, 0x02, 0x00, 0x00 };
+
+#define MQTT_SET_REPLY_PACKET_ID(packet, packetId) \
+    ((packet)[2] = (uint8_t)((packetId) >> 8), (packet)[3] = (uint8_t)((packetId) & 0xFF))
+
+typedef struct MQTT_PACKET_DESC_TAG
+{
+    CONTROL_PACKET_TYPE packetType;
+    int flags;
+    bool carriedOver;
+    size_t offset;
+    size_t length;
+    const uint8_t* data;
+} MQTT_PACKET_DESC;
 
 typedef void(*ON_PACKET_COMPLETE_CALLBACK)(void* context, CONTROL_PACKET_TYPE packet, int flags, BUFFER_HANDLE headerData);
+typedef void(*ON_PUBLISH_STREAM_CALLBACK)(void* context, int flags, BUFFER_HANDLE headerData, size_t payloadLength, const uint8_t* chunk, size_t chunkLength);
 
 MOCKABLE_FUNCTION(, MQTTCODEC_HANDLE, mqtt_codec_create, ON_PACKET_COMPLETE_CALLBACK, packetComplete, void*, callbackCtx);
 MOCKABLE_FUNCTION(, void, mqtt_codec_destroy, MQTTCODEC_HANDLE, handle);
@@ -38,8 +67,64 @@ MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_ping);
 MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_subscribe, uint16_t, packetId, SUBSCRIBE_PAYLOAD*, subscribeList, size_t, count, STRING_HANDLE, trace_log);
 MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_unsubscribe, uint16_t, packetId, const char**, unsubscribeList, size_t, count, STRING_HANDLE, trace_log);
 
+/*
+*    @brief    MQTT 5.0 encoders, the CONNECT is selected by the protocolVersion of MQTT_CLIENT_OPTIONS. The acks,
+*              PINGREQ and DISCONNECT have the same 3.1.1 encoding when the reason code is success.
+*/
+MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_publish_v5, QOS_VALUE, qosValue, bool, duplicateMsg, bool, serverRetain, uint16_t, packetId, const char*, topicName, const uint8_t*, msgBuffer, size_t, buffLen, const MQTT_PROPERTIES*, properties, STRING_HANDLE, trace_log);
+MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_subscribe_v5, uint16_t, packetId, SUBSCRIBE_PAYLOAD*, subscribeList, size_t, count, STRING_HANDLE, trace_log);
+MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_unsubscribe_v5, uint16_t, packetId, const char**, unsubscribeList, size_t, count, STRING_HANDLE, trace_log);
+
+/*
+*    @brief    Encodes only the fixed and variable header of a PUBLISH whose payloadLength bytes of payload the
+*              caller sends right after it.
+*/
+MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_publish_header, QOS_VALUE, qosValue, bool, duplicateMsg, bool, serverRetain, uint16_t, packetId, const char*, topicName, size_t, payloadLength, STRING_HANDLE, trace_log);
+MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_publish_header_v5, QOS_VALUE, qosValue, bool, duplicateMsg, bool, serverRetain, uint16_t, packetId, const char*, topicName, size_t, payloadLength, const MQTT_PROPERTIES*, properties, STRING_HANDLE, trace_log);
+
+/*
+*    @brief    A publish template holds the encoded topic and the QoS and retain flags of a topic that is published
+*              to repeatedly, so each mqtt_codec_publish_template_encode only stamps the packet id and payload in.
+*              includeProperties adds the empty MQTT 5.0 property list. The template does not keep topicName.
+*/
+MOCKABLE_FUNCTION(, MQTT_PUBLISH_TEMPLATE_HANDLE, mqtt_codec_publish_template_create, QOS_VALUE, qosValue, bool, serverRetain, const char*, topicName);
+MOCKABLE_FUNCTION(, void, mqtt_codec_publish_template_destroy, MQTT_PUBLISH_TEMPLATE_HANDLE, handle);
+MOCKABLE_FUNCTION(, QOS_VALUE, mqtt_codec_publish_template_get_qos, MQTT_PUBLISH_TEMPLATE_HANDLE, handle);
+MOCKABLE_FUNCTION(, BUFFER_HANDLE, mqtt_codec_publish_template_encode, MQTT_PUBLISH_TEMPLATE_HANDLE, handle, bool, duplicateMsg, uint16_t, packetId, bool, includeProperties, const uint8_t*, msgBuffer, size_t, buffLen, STRING_HANDLE, trace_log);
+
+/*
+*    @brief    Decodes an MQTT 5.0 property list starting at its length. The string and binary properties point
+*              into buffer. consumed receives the size of the whole list including its length.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_codec_decode_properties, const uint8_t*, buffer, size_t, length, MQTT_PROPERTIES*, properties, size_t*, consumed);
+
+/*
+*    @brief    Incoming packets larger than maxPacketSize, counting the fixed header, are rejected before any memory
+*              is allocated for them. 0 only applies the protocol limit.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_codec_set_max_packet_size, MQTTCODEC_HANDLE, handle, size_t, maxPacketSize);
+
+/*
+*    @brief    A PUBLISH with a remaining length above threshold is passed to publishStream instead of the
+*              ON_PACKET_COMPLETE_CALLBACK. The first call has the variable header in headerData and no chunk, the
+*              following calls have headerData NULL and chunks of the payload that point into the received bytes.
+*              includeProperties tells that the variable header holds an MQTT 5.0 property list. A threshold of 0
+*              turns streaming off.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_codec_set_publish_stream, MQTTCODEC_HANDLE, handle, size_t, threshold, bool, includeProperties, ON_PUBLISH_STREAM_CALLBACK, publishStream);
+
 MOCKABLE_FUNCTION(, int, mqtt_codec_bytesReceived, MQTTCODEC_HANDLE, handle, const unsigned char*, buffer, size_t, size);
 
+/*
+*    @brief    Decodes every complete packet in buffer at once instead of calling the ON_PACKET_COMPLETE_CALLBACK.
+*              Each MQTT_PACKET_DESC has the offset of the variable header and the remaining length, data points at
+*              the variable header. offset is into buffer, or into the bytes the codec carried over from the previous
+*              calls when carriedOver is true. An incomplete packet at the end of buffer, and what does not fit in
+*              packets, is carried over to the next call, a call with a length of 0 drains it. data stays valid
+*              until the next call. A handle is used either with mqtt_codec_bytesReceived or with this function.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_codec_decode_batch, MQTTCODEC_HANDLE, handle, const uint8_t*, buffer, size_t, length, MQTT_PACKET_DESC*, packets, size_t, capacity, size_t*, count);
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
@@ -0,0 +1,50 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_COMPRESS_H
+#define MQTT_COMPRESS_H
+
+#include "azure_c_shared_utility/umock_c_prod.h"
+#include "azure_umqtt_c/mqtt_client.h"
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <cstddef>
+extern "C" {
+#else
+#include <stdint.h>
+#include <stddef.h>
+#endif // __cplusplus
+
+/* Content type the LZ4 transform flags its payloads with */
+#define MQTT_COMPRESS_LZ4_CONTENT_TYPE      "application/x-lz4-block"
+
+/*
+*    @brief    Largest LZ4 block a payload of length bytes can be compressed to.
+*/
+MOCKABLE_FUNCTION(, size_t, mqtt_compress_lz4_bound, size_t, length);
+
+/*
+*    @brief    Compresses payload into buffer in the LZ4 block format, which any LZ4 block decoder reads. Nothing is
+*              allocated, the match table lives on the stack.
+*    @return   return    Zero with the size of the block in encodedLength, non-zero when it does not fit in bufferSize.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_compress_lz4_encode, const uint8_t*, payload, size_t, length, uint8_t*, buffer, size_t, bufferSize, size_t*, encodedLength);
+
+/*
+*    @brief    Decompresses the LZ4 block in payload into buffer.
+*    @return   return    Zero with the decompressed size in decodedLength, non-zero when the block is malformed or
+*                        does not fit in bufferSize.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_compress_lz4_decode, const uint8_t*, payload, size_t, length, uint8_t*, buffer, size_t, bufferSize, size_t*, decodedLength);
+
+/*
+*    @brief    The LZ4 payload transform for mqtt_client_set_payload_transform.
+*/
+MOCKABLE_FUNCTION(, const MQTT_PAYLOAD_TRANSFORM*, mqtt_compress_get_lz4_transform);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_COMPRESS_H
@@ -0,0 +1,70 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_DISPATCHER_H
+#define MQTT_DISPATCHER_H
+
+#include "azure_c_shared_utility/umock_c_prod.h"
+#include "azure_umqtt_c/mqtt_client.h"
+#include "azure_umqtt_c/mqtt_message.h"
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <cstddef>
+extern "C" {
+#else
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#endif // __cplusplus
+
+typedef struct MQTT_DISPATCHER_TAG* MQTT_DISPATCHER_HANDLE;
+
+typedef struct MQTT_DISPATCHER_OPTIONS_TAG
+{
+    /* Number of worker threads, each one owns a queue and messages of a topic always go to the same one */
+    size_t workerCount;
+    /* Number of messages each worker queue holds before the receive path waits for room */
+    size_t queueDepth;
+} MQTT_DISPATCHER_OPTIONS;
+
+/*
+*    @brief    Creates a pool of worker threads that run the message handler outside of the mqtt_client_dowork
+*              thread. Messages with the same topic are handled in the order they were received, messages of
+*              different topics run in parallel.
+*    @param    options    Pool configuration, a workerCount or queueDepth of 0 uses the default.
+*    @param    handler    Called on a worker thread for each message. The message is destroyed once it returns.
+*    @param    handlerCtx Context passed to handler.
+*    @return   return     A handle to the dispatcher or NULL on failure.
+*/
+MOCKABLE_FUNCTION(, MQTT_DISPATCHER_HANDLE, mqtt_dispatcher_create, const MQTT_DISPATCHER_OPTIONS*, options, ON_MQTT_MESSAGE_RECV_ACK_CALLBACK, handler, void*, handlerCtx);
+
+/*
+*    @brief    Handles every message already queued, then stops and joins the workers.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_dispatcher_destroy, MQTT_DISPATCHER_HANDLE, handle);
+
+/*
+*    @brief    ON_MQTT_MESSAGE_RECV_CALLBACK for mqtt_client_init, the context is the MQTT_DISPATCHER_HANDLE. The
+*              message is copied to the worker queue of its topic, the handler gets an ackToken of 0. When the queue
+*              is full the call waits for room, which holds up mqtt_client_dowork and with it the reads from the
+*              broker.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_dispatcher_message_received, MQTT_MESSAGE_HANDLE, msgHandle, void*, callbackCtx);
+
+/*
+*    @brief    ON_MQTT_MESSAGE_RECV_ACK_CALLBACK for mqtt_client_set_manual_ack, the ackToken is passed on to the
+*              handler so the worker can call mqtt_client_ack once the message is processed.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_dispatcher_message_received_ack, MQTT_MESSAGE_HANDLE, msgHandle, MQTT_ACK_TOKEN, ackToken, void*, callbackCtx);
+
+/*
+*    @brief    Gets the number of times the receive path had to wait because a worker queue was full.
+*/
+MOCKABLE_FUNCTION(, size_t, mqtt_dispatcher_get_wait_count, MQTT_DISPATCHER_HANDLE, handle);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_DISPATCHER_H
@@ -0,0 +1,83 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_MUX_H
+#define MQTT_MUX_H
+
+#include "azure_c_shared_utility/umock_c_prod.h"
+#include "azure_umqtt_c/mqttconst.h"
+#include "azure_umqtt_c/mqtt_client.h"
+#include "azure_umqtt_c/mqtt_message.h"
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <cstddef>
+extern "C" {
+#else
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#endif // __cplusplus
+
+typedef struct MQTT_MUX_TAG* MQTT_MUX_HANDLE;
+typedef struct MQTT_MUX_SESSION_TAG* MQTT_MUX_SESSION_HANDLE;
+
+/*
+*    @brief    Creates a client whose connection is shared by many logical sessions, each one owning the topics under
+*              its prefix. Like the client, the multiplexer is not thread safe.
+*    @param    unroutedRecv    Optional, called for the messages whose topic is under no session prefix.
+*    @param    unroutedCtx     Context passed to unroutedRecv.
+*    @param    opCallback      Optional, called with the operations of the shared client.
+*    @param    opCallbackCtx   Context passed to opCallback.
+*    @param    onError         Optional, called with the errors of the shared client.
+*    @param    errorCtx        Context passed to onError.
+*    @return   return          A handle to the multiplexer or NULL on failure.
+*/
+MOCKABLE_FUNCTION(, MQTT_MUX_HANDLE, mqtt_mux_create, ON_MQTT_MESSAGE_RECV_CALLBACK, unroutedRecv, void*, unroutedCtx, ON_MQTT_OPERATION_CALLBACK, opCallback, void*, opCallbackCtx, ON_MQTT_ERROR_CALLBACK, onError, void*, errorCtx);
+
+/*
+*    @brief    Removes the sessions left and deinitializes the shared client.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_mux_destroy, MQTT_MUX_HANDLE, handle);
+
+/*
+*    @brief    Gets the shared client, connect it, drive it with mqtt_client_dowork and set its options as usual.
+*              Its packet ids are numbered by the multiplexer, publish on it only through the sessions.
+*/
+MOCKABLE_FUNCTION(, MQTT_CLIENT_HANDLE, mqtt_mux_get_client, MQTT_MUX_HANDLE, handle);
+
+/*
+*    @brief    Adds a session for the topics under topicPrefix, which holds no wildcard and is not the prefix of
+*              another session already. A message received on topicPrefix/<topic> is passed to msgRecv with the topic
+*              <topic>, on the mqtt_client_dowork thread and valid for the duration of the callback. When prefixes
+*              are nested the longest one gets the message. The session is a copy of the prefix and the callback.
+*    @return   return    A handle to the session or NULL on failure.
+*/
+MOCKABLE_FUNCTION(, MQTT_MUX_SESSION_HANDLE, mqtt_mux_add_session, MQTT_MUX_HANDLE, handle, const char*, topicPrefix, ON_MQTT_MESSAGE_RECV_CALLBACK, msgRecv, void*, callbackCtx);
+
+/*
+*    @brief    Removes the session, its subscriptions are left on the connection and the messages they bring are
+*              passed to unroutedRecv. May be called from the message callback of the session.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_mux_remove_session, MQTT_MUX_SESSION_HANDLE, session);
+
+/*
+*    @brief    Publishes msgHandle on topicPrefix/<topic of msgHandle>. The packet id of msgHandle is not used, the
+*              multiplexer numbers the QoS 1 and 2 publishes of all the sessions.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_mux_publish, MQTT_MUX_SESSION_HANDLE, session, MQTT_MESSAGE_HANDLE, msgHandle);
+
+/*
+*    @brief    Subscribes to topicPrefix/<filter> for every filter of subscribeList, "#" subscribes to every topic
+*              of the session. qosReturn of subscribeList is not updated, the SUBACK goes to opCallback.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_mux_subscribe, MQTT_MUX_SESSION_HANDLE, session, SUBSCRIBE_PAYLOAD*, subscribeList, size_t, count);
+MOCKABLE_FUNCTION(, int, mqtt_mux_unsubscribe, MQTT_MUX_SESSION_HANDLE, session, const char**, unsubscribeList, size_t, count);
+
+MOCKABLE_FUNCTION(, size_t, mqtt_mux_get_session_count, MQTT_MUX_HANDLE, handle);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_MUX_H
@@ -0,0 +1,77 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_PERSIST_H
+#define MQTT_PERSIST_H
+
+#include "azure_c_shared_utility/umock_c_prod.h"
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <cstddef>
+extern "C" {
+#else
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#endif // __cplusplus
+
+typedef struct MQTT_PERSIST_TAG* MQTT_PERSIST_HANDLE;
+
+typedef struct MQTT_PERSIST_OPTIONS_TAG
+{
+    /* Prefix of the store files, segments are named <filePrefix>_<index>.seg */
+    const char* filePrefix;
+    /* Size in bytes of each memory mapped segment, 0 selects the default of 1 MB */
+    size_t segmentSize;
+    /* Flush every appended record to disk before mqtt_persist_append returns */
+    bool syncOnAppend;
+} MQTT_PERSIST_OPTIONS;
+
+/*
+*    @brief    Callback invoked for each outstanding packet, in the order the packets were appended.
+*    @param    context     The context passed to mqtt_persist_foreach.
+*    @param    packetId    Packet id of the stored PUBLISH.
+*    @param    released    True if a PUBREC was received and only the PUBREL remains to be sent.
+*    @param    packet      The encoded PUBLISH packet, writable so the DUP flag can be set in place.
+*    @param    length      Length of the encoded packet.
+*/
+typedef void(*ON_PERSISTED_PACKET)(void* context, uint16_t packetId, bool released, uint8_t* packet, size_t length);
+
+/*
+*    @brief    Opens (or creates) a persistent outbound store and recovers the records left by a previous run.
+*              Where files cannot be memory mapped the segments are kept in memory and only reach their files
+*              when they are created, on mqtt_persist_close and, with syncOnAppend, on every append.
+*/
+MOCKABLE_FUNCTION(, MQTT_PERSIST_HANDLE, mqtt_persist_open, const MQTT_PERSIST_OPTIONS*, options);
+MOCKABLE_FUNCTION(, void, mqtt_persist_close, MQTT_PERSIST_HANDLE, handle);
+
+/*
+*    @brief    Appends an encoded QoS 1/2 PUBLISH packet to the log. Fails when a packet with the same packetId
+*              is still stored.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_persist_append, MQTT_PERSIST_HANDLE, handle, uint16_t, packetId, const uint8_t*, packet, size_t, length);
+
+/*
+*    @brief    Marks a QoS 2 packet as acknowledged by PUBREC so it is replayed as a PUBREL.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_persist_mark_released, MQTT_PERSIST_HANDLE, handle, uint16_t, packetId);
+
+/*
+*    @brief    Removes the packet once its PUBACK or PUBCOMP has been received.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_persist_remove, MQTT_PERSIST_HANDLE, handle, uint16_t, packetId);
+
+/*
+*    @brief    Moves the live records out of sparsely used segments and deletes the emptied segment files.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_persist_compact, MQTT_PERSIST_HANDLE, handle);
+
+MOCKABLE_FUNCTION(, int, mqtt_persist_foreach, MQTT_PERSIST_HANDLE, handle, ON_PERSISTED_PACKET, callback, void*, context);
+MOCKABLE_FUNCTION(, size_t, mqtt_persist_get_count, MQTT_PERSIST_HANDLE, handle);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_PERSIST_H
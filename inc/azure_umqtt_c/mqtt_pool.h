@@ -0,0 +1,101 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_POOL_H
+#define MQTT_POOL_H
+
+#include "azure_c_shared_utility/xio.h"
+#include "azure_c_shared_utility/umock_c_prod.h"
+#include "azure_umqtt_c/mqttconst.h"
+#include "azure_umqtt_c/mqtt_client.h"
+#include "azure_umqtt_c/mqtt_message.h"
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <cstddef>
+extern "C" {
+#else
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#endif // __cplusplus
+
+typedef struct MQTT_POOL_TAG* MQTT_POOL_HANDLE;
+
+typedef XIO_HANDLE(*MQTT_POOL_CREATE_XIO)(size_t shardIndex, void* context);
+typedef void(*ON_MQTT_POOL_ERROR_CALLBACK)(MQTT_POOL_HANDLE handle, size_t shardIndex, MQTT_CLIENT_EVENT_ERROR error, void* callbackCtx);
+
+typedef struct MQTT_POOL_OPTIONS_TAG
+{
+    /* Number of connections, each one has its own client, xio and thread */
+    size_t shardCount;
+    /* Time in milliseconds a shard thread sleeps between two calls to mqtt_client_dowork, 0 uses the default */
+    unsigned int doworkIntervalMs;
+} MQTT_POOL_OPTIONS;
+
+typedef struct MQTT_POOL_METRICS_TAG
+{
+    /* Shards whose CONNACK accepted the connection and that did not disconnect since */
+    size_t connectedCount;
+    size_t publishCount;
+    size_t publishFailureCount;
+    /* QoS 1 publishes that got their PUBACK and QoS 2 publishes that got their PUBCOMP */
+    size_t publishAckCount;
+    size_t inflightCount;
+    size_t errorCount;
+    /* Only meaningful when errorCount is not 0 */
+    MQTT_CLIENT_EVENT_ERROR lastError;
+} MQTT_POOL_METRICS;
+
+/*
+*    @brief    Creates a pool of shardCount clients and starts one thread per shard that drives its client.
+*    @param    options       Pool configuration.
+*    @param    createXio     Called by mqtt_pool_connect for every shard, the pool destroys the returned xio.
+*    @param    xioCtx        Context passed to createXio.
+*    @param    msgRecv       Optional, called on the shard thread for the messages received on any connection, after
+*                            its dowork so it may call into the pool. The message is a copy valid for the duration
+*                            of the callback, an mqtt_dispatcher can take the messages off the thread.
+*    @param    msgRecvCtx    Context passed to msgRecv.
+*    @param    onError       Optional, called on the shard thread with the index of the shard that failed, after
+*                            its dowork so it may call into the pool.
+*    @param    errorCtx      Context passed to onError.
+*    @return   return        A handle to the pool or NULL on failure.
+*/
+MOCKABLE_FUNCTION(, MQTT_POOL_HANDLE, mqtt_pool_create, const MQTT_POOL_OPTIONS*, options, MQTT_POOL_CREATE_XIO, createXio, void*, xioCtx, ON_MQTT_MESSAGE_RECV_CALLBACK, msgRecv, void*, msgRecvCtx, ON_MQTT_POOL_ERROR_CALLBACK, onError, void*, errorCtx);
+
+/*
+*    @brief    Stops the shard threads, then deinitializes the clients and destroys their xio.
+*/
+MOCKABLE_FUNCTION(, void, mqtt_pool_destroy, MQTT_POOL_HANDLE, handle);
+
+/*
+*    @brief    Connects every shard with a copy of mqttOptions whose clientId is suffixed with -<shardIndex>.
+*    @return   return    Zero if every shard started connecting, non-zero otherwise. The shards that did start are
+*                        left connecting and mqtt_pool_connect may be called again for the others, as well as for
+*                        the shards whose connection failed or was closed since.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_pool_connect, MQTT_POOL_HANDLE, handle, const MQTT_CLIENT_OPTIONS*, mqttOptions);
+MOCKABLE_FUNCTION(, int, mqtt_pool_disconnect, MQTT_POOL_HANDLE, handle);
+
+/*
+*    @brief    Publishes msgHandle on the shard selected by a hash of its topic, so the publishes of one topic keep
+*              their order on a single connection. The packet id of msgHandle is not used, each shard numbers its
+*              own QoS 1 and 2 publishes. May be called from any thread.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_pool_publish, MQTT_POOL_HANDLE, handle, MQTT_MESSAGE_HANDLE, msgHandle);
+
+/*
+*    @brief    Gets the index of the shard that publishes on topicName.
+*/
+MOCKABLE_FUNCTION(, size_t, mqtt_pool_get_shard_index, MQTT_POOL_HANDLE, handle, const char*, topicName);
+
+/*
+*    @brief    Sums the counters of all the shards, lastError is the last error reported by any of them.
+*/
+MOCKABLE_FUNCTION(, int, mqtt_pool_get_metrics, MQTT_POOL_HANDLE, handle, MQTT_POOL_METRICS*, metrics);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_POOL_H
@@ -43,6 +43,131 @@ DEFINE_ENUM(CONTROL_PACKET_TYPE, CONTROL_PACKET_TYPE_VALUES)
 
 DEFINE_ENUM(QOS_VALUE, QOS_VALUE_VALUES)
 
+#define MQTT_PROTOCOL_VERSION_VALUES \
+    MQTT_PROTOCOL_VERSION_DEFAULT = 0x00, \
+    MQTT_PROTOCOL_VERSION_3_1_1 = 0x04, \
+    MQTT_PROTOCOL_VERSION_5 = 0x05
+
+DEFINE_ENUM(MQTT_PROTOCOL_VERSION, MQTT_PROTOCOL_VERSION_VALUES)
+
+#define MQTT_REASON_CODE_VALUES \
+    MQTT_REASON_SUCCESS = 0x00, \
+    MQTT_REASON_GRANTED_QOS_1 = 0x01, \
+    MQTT_REASON_GRANTED_QOS_2 = 0x02, \
+    MQTT_REASON_DISCONNECT_WITH_WILL = 0x04, \
+    MQTT_REASON_NO_MATCHING_SUBSCRIBERS = 0x10, \
+    MQTT_REASON_NO_SUBSCRIPTION_EXISTED = 0x11, \
+    MQTT_REASON_CONTINUE_AUTHENTICATION = 0x18, \
+    MQTT_REASON_RE_AUTHENTICATE = 0x19, \
+    MQTT_REASON_UNSPECIFIED_ERROR = 0x80, \
+    MQTT_REASON_MALFORMED_PACKET = 0x81, \
+    MQTT_REASON_PROTOCOL_ERROR = 0x82, \
+    MQTT_REASON_IMPLEMENTATION_SPECIFIC_ERROR = 0x83, \
+    MQTT_REASON_UNSUPPORTED_PROTOCOL_VERSION = 0x84, \
+    MQTT_REASON_CLIENT_IDENTIFIER_NOT_VALID = 0x85, \
+    MQTT_REASON_BAD_USER_NAME_OR_PASSWORD = 0x86, \
+    MQTT_REASON_NOT_AUTHORIZED = 0x87, \
+    MQTT_REASON_SERVER_UNAVAILABLE = 0x88, \
+    MQTT_REASON_SERVER_BUSY = 0x89, \
+    MQTT_REASON_BANNED = 0x8A, \
+    MQTT_REASON_SERVER_SHUTTING_DOWN = 0x8B, \
+    MQTT_REASON_BAD_AUTHENTICATION_METHOD = 0x8C, \
+    MQTT_REASON_KEEP_ALIVE_TIMEOUT = 0x8D, \
+    MQTT_REASON_SESSION_TAKEN_OVER = 0x8E, \
+    MQTT_REASON_TOPIC_FILTER_INVALID = 0x8F, \
+    MQTT_REASON_TOPIC_NAME_INVALID = 0x90, \
+    MQTT_REASON_PACKET_IDENTIFIER_IN_USE = 0x91, \
+    MQTT_REASON_PACKET_IDENTIFIER_NOT_FOUND = 0x92, \
+    MQTT_REASON_RECEIVE_MAXIMUM_EXCEEDED = 0x93, \
+    MQTT_REASON_TOPIC_ALIAS_INVALID = 0x94, \
+    MQTT_REASON_PACKET_TOO_LARGE = 0x95, \
+    MQTT_REASON_MESSAGE_RATE_TOO_HIGH = 0x96, \
+    MQTT_REASON_QUOTA_EXCEEDED = 0x97, \
+    MQTT_REASON_ADMINISTRATIVE_ACTION = 0x98, \
+    MQTT_REASON_PAYLOAD_FORMAT_INVALID = 0x99, \
+    MQTT_REASON_RETAIN_NOT_SUPPORTED = 0x9A, \
+    MQTT_REASON_QOS_NOT_SUPPORTED = 0x9B, \
+    MQTT_REASON_USE_ANOTHER_SERVER = 0x9C, \
+    MQTT_REASON_SERVER_MOVED = 0x9D, \
+    MQTT_REASON_SHARED_SUBSCRIPTIONS_NOT_SUPPORTED = 0x9E, \
+    MQTT_REASON_CONNECTION_RATE_EXCEEDED = 0x9F, \
+    MQTT_REASON_MAXIMUM_CONNECT_TIME = 0xA0, \
+    MQTT_REASON_SUBSCRIPTION_IDENTIFIERS_NOT_SUPPORTED = 0xA1, \
+    MQTT_REASON_WILDCARD_SUBSCRIPTIONS_NOT_SUPPORTED = 0xA2
+
+DEFINE_ENUM(MQTT_REASON_CODE, MQTT_REASON_CODE_VALUES)
+
+#define MQTT_PROPERTY_ID_VALUES \
+    MQTT_PROPERTY_PAYLOAD_FORMAT_INDICATOR = 0x01, \
+    MQTT_PROPERTY_MESSAGE_EXPIRY_INTERVAL = 0x02, \
+    MQTT_PROPERTY_CONTENT_TYPE = 0x03, \
+    MQTT_PROPERTY_RESPONSE_TOPIC = 0x08, \
+    MQTT_PROPERTY_CORRELATION_DATA = 0x09, \
+    MQTT_PROPERTY_SUBSCRIPTION_IDENTIFIER = 0x0B, \
+    MQTT_PROPERTY_SESSION_EXPIRY_INTERVAL = 0x11, \
+    MQTT_PROPERTY_ASSIGNED_CLIENT_IDENTIFIER = 0x12, \
+    MQTT_PROPERTY_SERVER_KEEP_ALIVE = 0x13, \
+    MQTT_PROPERTY_AUTHENTICATION_METHOD = 0x15, \
+    MQTT_PROPERTY_AUTHENTICATION_DATA = 0x16, \
+    MQTT_PROPERTY_REQUEST_PROBLEM_INFORMATION = 0x17, \
+    MQTT_PROPERTY_WILL_DELAY_INTERVAL = 0x18, \
+    MQTT_PROPERTY_REQUEST_RESPONSE_INFORMATION = 0x19, \
+    MQTT_PROPERTY_RESPONSE_INFORMATION = 0x1A, \
+    MQTT_PROPERTY_SERVER_REFERENCE = 0x1C, \
+    MQTT_PROPERTY_REASON_STRING = 0x1F, \
+    MQTT_PROPERTY_RECEIVE_MAXIMUM = 0x21, \
+    MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM = 0x22, \
+    MQTT_PROPERTY_TOPIC_ALIAS = 0x23, \
+    MQTT_PROPERTY_MAXIMUM_QOS = 0x24, \
+    MQTT_PROPERTY_RETAIN_AVAILABLE = 0x25, \
+    MQTT_PROPERTY_USER_PROPERTY = 0x26, \
+    MQTT_PROPERTY_MAXIMUM_PACKET_SIZE = 0x27, \
+    MQTT_PROPERTY_WILDCARD_SUBSCRIPTION_AVAILABLE = 0x28, \
+    MQTT_PROPERTY_SUBSCRIPTION_IDENTIFIER_AVAILABLE = 0x29, \
+    MQTT_PROPERTY_SHARED_SUBSCRIPTION_AVAILABLE = 0x2A
+
+DEFINE_ENUM(MQTT_PROPERTY_ID, MQTT_PROPERTY_ID_VALUES)
+
+#define MQTT_PROPERTY_MASK(id)                  ((uint64_t)1 << (id))
+#define MQTT_PROPERTY_IS_SET(properties, id)    (((properties)->present & MQTT_PROPERTY_MASK(id)) != 0)
+
+/* Points into the packet the property was decoded from, the data is not zero terminated */
+typedef struct MQTT_PROPERTY_DATA_TAG
+{
+    const uint8_t* data;
+    size_t length;
+} MQTT_PROPERTY_DATA;
+
+/* MQTT 5.0 properties, a field is only meaningful when MQTT_PROPERTY_IS_SET reports it */
+typedef struct MQTT_PROPERTIES_TAG
+{
+    uint64_t present;
+    uint8_t payloadFormatIndicator;
+    uint32_t messageExpiryInterval;
+    MQTT_PROPERTY_DATA contentType;
+    MQTT_PROPERTY_DATA responseTopic;
+    MQTT_PROPERTY_DATA correlationData;
+    uint32_t subscriptionIdentifier;
+    uint32_t sessionExpiryInterval;
+    MQTT_PROPERTY_DATA assignedClientIdentifier;
+    uint16_t serverKeepAlive;
+    MQTT_PROPERTY_DATA authenticationMethod;
+    MQTT_PROPERTY_DATA authenticationData;
+    MQTT_PROPERTY_DATA responseInformation;
+    MQTT_PROPERTY_DATA serverReference;
+    MQTT_PROPERTY_DATA reasonString;
+    uint16_t receiveMaximum;
+    uint16_t topicAliasMaximum;
+    uint16_t topicAlias;
+    uint8_t maximumQos;
+    uint8_t retainAvailable;
+    size_t userPropertyCount;
+    uint32_t maximumPacketSize;
+    uint8_t wildcardSubscriptionAvailable;
+    uint8_t subscriptionIdentifierAvailable;
+    uint8_t sharedSubscriptionAvailable;
+} MQTT_PROPERTIES;
+
 typedef struct APP_PAYLOAD_TAG
 {
     uint8_t* message;
@@ -61,6 +186,14 @@ typedef struct MQTT_CLIENT_OPTIONS_TAG
     bool useCleanSession;
     QOS_VALUE qualityOfServiceValue;
     bool log_trace;
+    /* MQTT_PROTOCOL_VERSION_5 selects MQTT 5.0, the default is 3.1.1 */
+    MQTT_PROTOCOL_VERSION protocolVersion;
+    /* MQTT 5.0 CONNECT properties, a value of 0 leaves the property out */
+    uint32_t sessionExpiryInterval;
+    uint16_t receiveMaximum;
+    /* Also the limit for incoming packets, which applies to 3.1.1 as well */
+    uint32_t maximumPacketSize;
+    uint16_t topicAliasMaximum;
 } MQTT_CLIENT_OPTIONS;
 
 typedef enum CONNECT_RETURN_CODE_TAG
@@ -78,6 +211,9 @@ typedef struct CONNECT_ACK_TAG
 {
     bool isSessionPresent;
     CONNECT_RETURN_CODE returnCode;
+    /* MQTT 5.0 only, the reason code and the properties of the CONNACK, NULL on 3.1.1 */
+    MQTT_REASON_CODE reasonCode;
+    const MQTT_PROPERTIES* properties;
 } CONNECT_ACK;
 
 typedef struct SUBSCRIBE_PAYLOAD_TAG
@@ -101,6 +237,8 @@ typedef struct UNSUBSCRIBE_ACK_TAG
 typedef struct PUBLISH_ACK_TAG
 {
     uint16_t packetId;
+    /* MQTT 5.0 only, MQTT_REASON_SUCCESS when the packet has no reason code */
+    MQTT_REASON_CODE reasonCode;
 } PUBLISH_ACK;
 
 #ifdef __cplusplus
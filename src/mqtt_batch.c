@@ -0,0 +1,375 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <string.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/vector.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_umqtt_c/mqtt_message.h"
+#include "azure_umqtt_c/mqtt_batch.h"
+
+#define DEFAULT_BATCH_MAX_BYTES         4096
+#define DEFAULT_BATCH_MAX_AGE_MS        100
+#define MAX_RECORD_LENGTH               268435455
+#define NEXT_128_CHUNK                  0x80
+
+typedef struct BATCH_TOPIC_TAG
+{
+    char* topicName;
+    // maxBytes bytes, the length prefixed records of the pending batch
+    uint8_t* payload;
+    size_t payloadLength;
+    size_t recordCount;
+    tickcounter_ms_t firstRecordTime;
+} BATCH_TOPIC;
+
+typedef struct MQTT_BATCH_TAG
+{
+    MQTT_CLIENT_HANDLE mqttHandle;
+    TICK_COUNTER_HANDLE tickCounter;
+    size_t maxBytes;
+    size_t maxRecords;
+    tickcounter_ms_t maxAgeMs;
+    QOS_VALUE qos;
+    uint16_t firstPacketId;
+    uint16_t lastPacketId;
+    uint16_t nextPacketId;
+    VECTOR_HANDLE topics;
+} MQTT_BATCH;
+
+static size_t getPrefixSize(size_t length)
+{
+    return length < 0x80 ? 1 : length < 0x4000 ? 2 : length < 0x200000 ? 3 : 4;
+}
+
+static void writePrefix(uint8_t* iterator, size_t length)
+{
+    do
+    {
+        uint8_t encode = (uint8_t)(length % 128);
+        length /= 128;
+        if (length > 0)
+        {
+            encode |= NEXT_128_CHUNK;
+        }
+        *iterator++ = encode;
+    } while (length > 0);
+}
+
+static bool find_topic(const void* element, const void* value)
+{
+    return strcmp(((const BATCH_TOPIC*)element)->topicName, (const char*)value) == 0;
+}
+
+static uint16_t get_next_packet_id(MQTT_BATCH* batch)
+{
+    uint16_t result = 0;
+    /*Codes_SRS_MQTT_BATCH_07_015: [QoS 1 and 2 batches shall take the next packet id of the range, going around from lastPacketId to firstPacketId.]*/
+    if (batch->qos != DELIVER_AT_MOST_ONCE)
+    {
+        result = batch->nextPacketId;
+        batch->nextPacketId = (result == batch->lastPacketId) ? batch->firstPacketId : (uint16_t)(result + 1);
+    }
+    return result;
+}
+
+static int publish_batch(MQTT_BATCH* batch, BATCH_TOPIC* topic)
+{
+    int result;
+    /*Codes_SRS_MQTT_BATCH_07_014: [A batch shall be published with mqtt_client_publish as a message created in place over the batch payload, with the configured QoS.]*/
+    // The client encodes the payload before mqtt_client_publish returns, it can stay in the batch buffer
+    MQTT_MESSAGE_HANDLE msgHandle = mqttmessage_create_in_place(get_next_packet_id(batch), topic->topicName, batch->qos, topic->payload, topic->payloadLength);
+    if (msgHandle == NULL)
+    {
+        LogError("Failure creating batch message");
+        result = __FAILURE__;
+    }
+    else
+    {
+        if (mqtt_client_publish(batch->mqttHandle, msgHandle) != 0)
+        {
+            LogError("Failure publishing batch of %lu records on %s", (unsigned long)topic->recordCount, topic->topicName);
+            result = __FAILURE__;
+        }
+        else
+        {
+            topic->payloadLength = 0;
+            topic->recordCount = 0;
+            result = 0;
+        }
+        mqttmessage_destroy(msgHandle);
+    }
+    return result;
+}
+
+static BATCH_TOPIC* add_topic(MQTT_BATCH* batch, const char* topicName)
+{
+    BATCH_TOPIC* result;
+    BATCH_TOPIC topic;
+    size_t topicLength = strlen(topicName);
+    memset(&topic, 0, sizeof(BATCH_TOPIC));
+    if ((topic.topicName = (char*)malloc(topicLength + 1)) == NULL)
+    {
+        LogError("Failure allocating batch topic");
+        result = NULL;
+    }
+    else if ((topic.payload = (uint8_t*)malloc(batch->maxBytes)) == NULL)
+    {
+        LogError("Failure allocating batch of %lu bytes", (unsigned long)batch->maxBytes);
+        free(topic.topicName);
+        result = NULL;
+    }
+    else
+    {
+        (void)memcpy(topic.topicName, topicName, topicLength + 1);
+        if (VECTOR_push_back(batch->topics, &topic, 1) != 0)
+        {
+            LogError("Failure adding batch topic");
+            free(topic.payload);
+            free(topic.topicName);
+            result = NULL;
+        }
+        else
+        {
+            result = (BATCH_TOPIC*)VECTOR_back(batch->topics);
+        }
+    }
+    return result;
+}
+
+static int flush_batches(MQTT_BATCH* batch, bool expiredOnly)
+{
+    int result = 0;
+    tickcounter_ms_t now = 0;
+    if (expiredOnly && tickcounter_get_current_ms(batch->tickCounter, &now) != 0)
+    {
+        LogError("Failure getting the current time");
+        result = __FAILURE__;
+    }
+    else
+    {
+        size_t index;
+        size_t count = VECTOR_size(batch->topics);
+        for (index = 0; index < count; index++)
+        {
+            BATCH_TOPIC* topic = (BATCH_TOPIC*)VECTOR_element(batch->topics, index);
+            if (topic->recordCount > 0 && (!expiredOnly || now - topic->firstRecordTime >= batch->maxAgeMs) &&
+                publish_batch(batch, topic) != 0)
+            {
+                result = __FAILURE__;
+            }
+        }
+    }
+    return result;
+}
+
+MQTT_BATCH_HANDLE mqtt_batch_create(MQTT_CLIENT_HANDLE mqttHandle, const MQTT_BATCH_OPTIONS* options)
+{
+    MQTT_BATCH* result;
+    if (mqttHandle == NULL || (options != NULL && options->firstPacketId > options->lastPacketId))
+    {
+        /*Codes_SRS_MQTT_BATCH_07_001: [If mqttHandle is NULL, or options->firstPacketId is larger than options->lastPacketId, then mqtt_batch_create shall return NULL.]*/
+        LogError("Invalid parameter specified mqttHandle: %p, options: %p", mqttHandle, options);
+        result = NULL;
+    }
+    else if ((result = (MQTT_BATCH*)malloc(sizeof(MQTT_BATCH))) == NULL)
+    {
+        /*Codes_SRS_MQTT_BATCH_07_004: [If any allocation or the creation of the tick counter fails then mqtt_batch_create shall free everything it allocated and return NULL.]*/
+        LogError("Failure allocating batch publisher");
+    }
+    else
+    {
+        memset(result, 0, sizeof(MQTT_BATCH));
+        result->mqttHandle = mqttHandle;
+        /*Codes_SRS_MQTT_BATCH_07_002: [A NULL options, or a maxBytes or maxAgeMs of 0, shall select batches of 4096 bytes published 100 milliseconds after their first record, with no record limit and QoS 0.]*/
+        result->maxBytes = (options == NULL || options->maxBytes == 0) ? DEFAULT_BATCH_MAX_BYTES : options->maxBytes;
+        result->maxRecords = (options == NULL) ? 0 : options->maxRecords;
+        result->maxAgeMs = (options == NULL || options->maxAgeMs == 0) ? DEFAULT_BATCH_MAX_AGE_MS : options->maxAgeMs;
+        result->qos = (options == NULL) ? DELIVER_AT_MOST_ONCE : options->qos;
+        /*Codes_SRS_MQTT_BATCH_07_003: [If options is NULL or lastPacketId is 0 then the batches shall be numbered from 1 to 65535, otherwise from firstPacketId, or 1 when it is 0, to lastPacketId.]*/
+        if (options == NULL || options->lastPacketId == 0)
+        {
+            result->firstPacketId = 1;
+            result->lastPacketId = UINT16_MAX;
+        }
+        else
+        {
+            result->firstPacketId = options->firstPacketId == 0 ? 1 : options->firstPacketId;
+            result->lastPacketId = options->lastPacketId;
+        }
+        result->nextPacketId = result->firstPacketId;
+
+        if ((result->tickCounter = tickcounter_create()) == NULL)
+        {
+            /*Codes_SRS_MQTT_BATCH_07_004: [If any allocation or the creation of the tick counter fails then mqtt_batch_create shall free everything it allocated and return NULL.]*/
+            LogError("Failure creating batch tick counter");
+            free(result);
+            result = NULL;
+        }
+        else if ((result->topics = VECTOR_create(sizeof(BATCH_TOPIC))) == NULL)
+        {
+            LogError("Failure creating batch topic list");
+            tickcounter_destroy(result->tickCounter);
+            free(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+void mqtt_batch_destroy(MQTT_BATCH_HANDLE handle)
+{
+    /*Codes_SRS_MQTT_BATCH_07_005: [If handle is NULL then mqtt_batch_destroy shall do nothing.]*/
+    if (handle != NULL)
+    {
+        /*Codes_SRS_MQTT_BATCH_07_006: [mqtt_batch_destroy shall drop the records that were not published and free all resources.]*/
+        size_t index;
+        size_t count = VECTOR_size(handle->topics);
+        for (index = 0; index < count; index++)
+        {
+            BATCH_TOPIC* topic = (BATCH_TOPIC*)VECTOR_element(handle->topics, index);
+            free(topic->payload);
+            free(topic->topicName);
+        }
+        VECTOR_destroy(handle->topics);
+        tickcounter_destroy(handle->tickCounter);
+        free(handle);
+    }
+}
+
+int mqtt_batch_append(MQTT_BATCH_HANDLE handle, const char* topicName, const uint8_t* record, size_t length)
+{
+    int result;
+    if (handle == NULL || topicName == NULL || (record == NULL && length > 0))
+    {
+        /*Codes_SRS_MQTT_BATCH_07_007: [If handle or topicName is NULL, or record is NULL while length is not 0, then mqtt_batch_append shall return a non-zero value.]*/
+        LogError("Invalid parameter specified handle: %p, topicName: %p, record: %p", handle, topicName, record);
+        result = __FAILURE__;
+    }
+    else if (length > MAX_RECORD_LENGTH || getPrefixSize(length) + length > handle->maxBytes)
+    {
+        /*Codes_SRS_MQTT_BATCH_07_008: [If the record and its length prefix do not fit in maxBytes then mqtt_batch_append shall return a non-zero value.]*/
+        LogError("Record of %lu bytes does not fit in a batch of %lu bytes", (unsigned long)length, (unsigned long)handle->maxBytes);
+        result = __FAILURE__;
+    }
+    else
+    {
+        size_t recordSize = getPrefixSize(length) + length;
+        /*Codes_SRS_MQTT_BATCH_07_009: [mqtt_batch_append shall allocate the batch of a topic the first time a record is appended for it, and return a non-zero value if the allocation fails.]*/
+        BATCH_TOPIC* topic = (BATCH_TOPIC*)VECTOR_find_if(handle->topics, find_topic, topicName);
+        if (topic == NULL && (topic = add_topic(handle, topicName)) == NULL)
+        {
+            result = __FAILURE__;
+        }
+        else if (topic->payloadLength + recordSize > handle->maxBytes && publish_batch(handle, topic) != 0)
+        {
+            /*Codes_SRS_MQTT_BATCH_07_010: [If the record does not fit in the pending batch then mqtt_batch_append shall publish the batch first, and return a non-zero value keeping the batch if the publish fails.]*/
+            // The full batch stays as it is and is published again by the next flush
+            result = __FAILURE__;
+        }
+        else if (topic->recordCount == 0 && tickcounter_get_current_ms(handle->tickCounter, &topic->firstRecordTime) != 0)
+        {
+            /*Codes_SRS_MQTT_BATCH_07_011: [mqtt_batch_append shall record the time of the first record of a batch.]*/
+            LogError("Failure getting the current time");
+            result = __FAILURE__;
+        }
+        else
+        {
+            /*Codes_SRS_MQTT_BATCH_07_012: [mqtt_batch_append shall copy the record after its length, encoded like the MQTT remaining length, and return 0.]*/
+            writePrefix(topic->payload + topic->payloadLength, length);
+            if (length > 0)
+            {
+                (void)memcpy(topic->payload + topic->payloadLength + getPrefixSize(length), record, length);
+            }
+            topic->payloadLength += recordSize;
+            topic->recordCount++;
+
+            if ((handle->maxRecords > 0 && topic->recordCount >= handle->maxRecords) || topic->payloadLength == handle->maxBytes)
+            {
+                /*Codes_SRS_MQTT_BATCH_07_013: [When the batch reaches maxRecords records or maxBytes bytes mqtt_batch_append shall publish it, keeping it for the next flush if the publish fails.]*/
+                // The record is in the batch either way, a failed publish is retried by the next flush
+                (void)publish_batch(handle, topic);
+            }
+            result = 0;
+        }
+    }
+    return result;
+}
+
+void mqtt_batch_dowork(MQTT_BATCH_HANDLE handle)
+{
+    /*Codes_SRS_MQTT_BATCH_07_016: [If handle is NULL then mqtt_batch_dowork shall do nothing.]*/
+    if (handle != NULL)
+    {
+        /*Codes_SRS_MQTT_BATCH_07_017: [mqtt_batch_dowork shall publish the batches whose first record is at least maxAgeMs old, then call mqtt_client_dowork.]*/
+        (void)flush_batches(handle, true);
+        mqtt_client_dowork(handle->mqttHandle);
+    }
+}
+
+int mqtt_batch_flush(MQTT_BATCH_HANDLE handle)
+{
+    int result;
+    if (handle == NULL)
+    {
+        /*Codes_SRS_MQTT_BATCH_07_018: [If handle is NULL then mqtt_batch_flush shall return a non-zero value.]*/
+        LogError("Invalid parameter specified handle: %p", handle);
+        result = __FAILURE__;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_BATCH_07_019: [mqtt_batch_flush shall publish every batch that holds records and return a non-zero value if any publish fails.]*/
+        result = flush_batches(handle, false);
+    }
+    return result;
+}
+
+MQTT_BATCH_READ_RESULT mqtt_batch_read_record(const uint8_t* payload, size_t length, size_t* offset, const uint8_t** record, size_t* recordLength)
+{
+    MQTT_BATCH_READ_RESULT result;
+    if (offset == NULL || record == NULL || recordLength == NULL || (payload == NULL && length > 0) || *offset > length)
+    {
+        /*Codes_SRS_MQTT_BATCH_07_020: [If offset, record or recordLength is NULL, payload is NULL while length is not 0, or offset is past length, then mqtt_batch_read_record shall return MQTT_BATCH_READ_ERROR.]*/
+        LogError("Invalid parameter specified payload: %p, offset: %p, record: %p, recordLength: %p", payload, offset, record, recordLength);
+        result = MQTT_BATCH_READ_ERROR;
+    }
+    else if (*offset == length)
+    {
+        /*Codes_SRS_MQTT_BATCH_07_021: [If offset equals length then mqtt_batch_read_record shall return MQTT_BATCH_READ_END.]*/
+        result = MQTT_BATCH_READ_END;
+    }
+    else
+    {
+        size_t index = *offset;
+        size_t value = 0;
+        size_t multiplier = 1;
+        size_t prefixSize = 0;
+        bool complete = false;
+        while (!complete && prefixSize < MQTT_BATCH_MAX_RECORD_PREFIX && index < length)
+        {
+            uint8_t encode = payload[index++];
+            value += (size_t)(encode & 0x7F) * multiplier;
+            multiplier *= 128;
+            prefixSize++;
+            complete = (encode & NEXT_128_CHUNK) == 0;
+        }
+
+        if (!complete || value > length - index)
+        {
+            /*Codes_SRS_MQTT_BATCH_07_022: [If the length prefix is longer than 4 bytes, ends with the payload or gives a length past the end of the payload then mqtt_batch_read_record shall return MQTT_BATCH_READ_ERROR and leave offset unchanged.]*/
+            LogError("Malformed batch record at offset %lu", (unsigned long)*offset);
+            result = MQTT_BATCH_READ_ERROR;
+        }
+        else
+        {
+            /*Codes_SRS_MQTT_BATCH_07_023: [mqtt_batch_read_record shall point record to the record in payload, set recordLength, move offset past the record and return MQTT_BATCH_READ_OK.]*/
+            *record = payload + index;
+            *recordLength = value;
+            *offset = index + value;
+            result = MQTT_BATCH_READ_OK;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,530 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/agenttime.h"
+#include "azure_c_shared_utility/crt_abstractions.h"
+#include "azure_c_shared_utility/strings.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/condition.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_umqtt_c/mqtt_capture.h"
+
+#define PCAPNG_SHB_TYPE                 0x0A0D0D0A
+#define PCAPNG_IDB_TYPE                 0x00000001
+#define PCAPNG_EPB_TYPE                 0x00000006
+#define PCAPNG_BYTE_ORDER_MAGIC         0x1A2B3C4D
+#define PCAPNG_SHB_SIZE                 28
+#define PCAPNG_IDB_SIZE                 32
+#define PCAPNG_EPB_OVERHEAD             32
+#define PCAPNG_OPT_IF_TSRESOL           9
+#define PCAPNG_TSRESOL_NANOSECONDS      9
+#define LINKTYPE_RAW                    101
+
+#define IPV4_HEADER_SIZE                20
+#define TCP_HEADER_SIZE                 20
+#define SYNTHETIC_HEADER_SIZE           (IPV4_HEADER_SIZE + TCP_HEADER_SIZE)
+#define MAX_SEGMENT_PAYLOAD             (0xFFFF - SYNTHETIC_HEADER_SIZE)
+#define TCP_FLAGS_PSH_ACK               0x18
+#define IP_PROTOCOL_TCP                 6
+#define SYNTHETIC_CLIENT_ADDR           0x0A000001  // 10.0.0.1
+#define SYNTHETIC_BROKER_ADDR           0x0A000002  // 10.0.0.2
+#define SYNTHETIC_CLIENT_PORT           49152
+#define DEFAULT_BROKER_PORT             1883
+#define DEFAULT_BUFFER_SIZE             (256 * 1024)
+#define DEFAULT_FLUSH_INTERVAL_MS       500
+#define NANOSECONDS_PER_SECOND          1000000000ULL
+
+#define PAD_TO_32BIT(len)               (((len) + 3) & ~((size_t)3))
+
+DEFINE_ENUM_STRINGS(MQTT_CAPTURE_DIRECTION, MQTT_CAPTURE_DIRECTION_VALUES);
+
+typedef struct MQTT_CAPTURE_TAG
+{
+    char* filePrefix;
+    size_t maxFileSize;
+    size_t maxFileCount;
+    size_t bufferSize;
+    unsigned int flushIntervalMs;
+    uint16_t brokerPort;
+
+    LOCK_HANDLE lock;
+    COND_HANDLE writerSignal;
+    THREAD_HANDLE writerThread;
+    bool stopWriter;
+
+    // Guarded by lock: producers append encoded EPB blocks to stageBuffer
+    uint8_t* stageBuffer;
+    size_t stageLength;
+    size_t droppedCount;
+    uint32_t tcpSeq[2];
+    uint16_t ipIdentifier;
+
+    // Owned by the writer thread
+    uint8_t* writeBuffer;
+    FILE* captureFile;
+    size_t fileSize;
+    size_t fileIndex;
+} MQTT_CAPTURE;
+
+static void write_uint32(uint8_t* buffer, uint32_t value)
+{
+    // pcapng blocks are written in host byte order, the SHB magic tells the reader which one
+    (void)memcpy(buffer, &value, sizeof(value));
+}
+
+static void write_uint16(uint8_t* buffer, uint16_t value)
+{
+    (void)memcpy(buffer, &value, sizeof(value));
+}
+
+static uint32_t read_uint32(const uint8_t* buffer)
+{
+    uint32_t value;
+    (void)memcpy(&value, buffer, sizeof(value));
+    return value;
+}
+
+static void write_net_uint16(uint8_t* buffer, uint16_t value)
+{
+    buffer[0] = (uint8_t)(value >> 8);
+    buffer[1] = (uint8_t)(value & 0xFF);
+}
+
+static void write_net_uint32(uint8_t* buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t)(value >> 24);
+    buffer[1] = (uint8_t)(value >> 16);
+    buffer[2] = (uint8_t)(value >> 8);
+    buffer[3] = (uint8_t)(value & 0xFF);
+}
+
+static uint64_t get_capture_time_ns(void)
+{
+    uint64_t result;
+    struct timespec now;
+#ifdef _WIN32
+    if (timespec_get(&now, TIME_UTC) == 0)
+#else
+    if (clock_gettime(CLOCK_REALTIME, &now) != 0)
+#endif
+    {
+        result = (uint64_t)get_time(NULL) * NANOSECONDS_PER_SECOND;
+    }
+    else
+    {
+        result = (uint64_t)now.tv_sec * NANOSECONDS_PER_SECOND + (uint64_t)now.tv_nsec;
+    }
+    return result;
+}
+
+static uint16_t calculate_ipv4_checksum(const uint8_t* header)
+{
+    uint32_t sum = 0;
+    size_t index;
+    for (index = 0; index < IPV4_HEADER_SIZE; index += 2)
+    {
+        sum += (uint32_t)((header[index] << 8) | header[index + 1]);
+    }
+    while (sum >> 16)
+    {
+        sum = (sum & 0xFFFF) + (sum >> 16);
+    }
+    return (uint16_t)~sum;
+}
+
+static size_t encode_segment(MQTT_CAPTURE* capture, uint8_t* block, MQTT_CAPTURE_DIRECTION direction, uint64_t timestamp, const uint8_t* data, size_t length)
+{
+    size_t packetLen = SYNTHETIC_HEADER_SIZE + length;
+    size_t blockLen = PCAPNG_EPB_OVERHEAD + PAD_TO_32BIT(packetLen);
+    bool outgoing = (direction == MQTT_CAPTURE_OUTGOING);
+    uint8_t* ipHeader = block + 28;
+    uint8_t* tcpHeader = ipHeader + IPV4_HEADER_SIZE;
+
+    write_uint32(block, PCAPNG_EPB_TYPE);
+    write_uint32(block + 4, (uint32_t)blockLen);
+    write_uint32(block + 8, 0);
+    write_uint32(block + 12, (uint32_t)(timestamp >> 32));
+    write_uint32(block + 16, (uint32_t)(timestamp & 0xFFFFFFFF));
+    write_uint32(block + 20, (uint32_t)packetLen);
+    write_uint32(block + 24, (uint32_t)packetLen);
+
+    (void)memset(ipHeader, 0, SYNTHETIC_HEADER_SIZE);
+    ipHeader[0] = 0x45;
+    write_net_uint16(ipHeader + 2, (uint16_t)packetLen);
+    write_net_uint16(ipHeader + 4, capture->ipIdentifier++);
+    ipHeader[6] = 0x40; // Don't fragment
+    ipHeader[8] = 64;
+    ipHeader[9] = IP_PROTOCOL_TCP;
+    write_net_uint32(ipHeader + 12, outgoing ? SYNTHETIC_CLIENT_ADDR : SYNTHETIC_BROKER_ADDR);
+    write_net_uint32(ipHeader + 16, outgoing ? SYNTHETIC_BROKER_ADDR : SYNTHETIC_CLIENT_ADDR);
+    write_net_uint16(ipHeader + 10, calculate_ipv4_checksum(ipHeader));
+
+    // The TCP checksum is left at zero, Wireshark does not validate it by default
+    write_net_uint16(tcpHeader, outgoing ? SYNTHETIC_CLIENT_PORT : capture->brokerPort);
+    write_net_uint16(tcpHeader + 2, outgoing ? capture->brokerPort : SYNTHETIC_CLIENT_PORT);
+    write_net_uint32(tcpHeader + 4, capture->tcpSeq[outgoing ? 0 : 1]);
+    write_net_uint32(tcpHeader + 8, capture->tcpSeq[outgoing ? 1 : 0]);
+    tcpHeader[12] = (TCP_HEADER_SIZE / 4) << 4;
+    tcpHeader[13] = TCP_FLAGS_PSH_ACK;
+    write_net_uint16(tcpHeader + 14, 0xFFFF);
+    /*Codes_SRS_MQTT_CAPTURE_07_009: [The TCP sequence and acknowledgement numbers of each direction shall advance by the bytes recorded in that direction.]*/
+    capture->tcpSeq[outgoing ? 0 : 1] += (uint32_t)length;
+
+    (void)memcpy(tcpHeader + TCP_HEADER_SIZE, data, length);
+    (void)memset(tcpHeader + TCP_HEADER_SIZE + length, 0, PAD_TO_32BIT(packetLen) - packetLen);
+    write_uint32(block + blockLen - 4, (uint32_t)blockLen);
+    return blockLen;
+}
+
+static size_t calculate_encoded_size(size_t length)
+{
+    size_t result = 0;
+    do
+    {
+        size_t segmentLen = (length > MAX_SEGMENT_PAYLOAD) ? MAX_SEGMENT_PAYLOAD : length;
+        result += PCAPNG_EPB_OVERHEAD + PAD_TO_32BIT(SYNTHETIC_HEADER_SIZE + segmentLen);
+        length -= segmentLen;
+    } while (length > 0);
+    return result;
+}
+
+static int write_file_header(MQTT_CAPTURE* capture)
+{
+    int result;
+    uint8_t header[PCAPNG_SHB_SIZE + PCAPNG_IDB_SIZE];
+    uint8_t* idb = header + PCAPNG_SHB_SIZE;
+
+    /*Codes_SRS_MQTT_CAPTURE_07_013: [Every file shall be named <filePrefix>_<index>.pcapng and start with a Section Header Block and an Interface Description Block for raw IP with nanosecond timestamps.]*/
+    write_uint32(header, PCAPNG_SHB_TYPE);
+    write_uint32(header + 4, PCAPNG_SHB_SIZE);
+    write_uint32(header + 8, PCAPNG_BYTE_ORDER_MAGIC);
+    write_uint16(header + 12, 1);   // Major version
+    write_uint16(header + 14, 0);   // Minor version
+    (void)memset(header + 16, 0xFF, 8); // Section length unknown
+    write_uint32(header + 24, PCAPNG_SHB_SIZE);
+
+    write_uint32(idb, PCAPNG_IDB_TYPE);
+    write_uint32(idb + 4, PCAPNG_IDB_SIZE);
+    write_uint16(idb + 8, LINKTYPE_RAW);
+    write_uint16(idb + 10, 0);
+    write_uint32(idb + 12, 0);      // No snap length limit
+    write_uint16(idb + 16, PCAPNG_OPT_IF_TSRESOL);
+    write_uint16(idb + 18, 1);
+    write_uint32(idb + 20, 0);      // Option value is padded to 32 bits
+    idb[20] = PCAPNG_TSRESOL_NANOSECONDS;
+    write_uint32(idb + 24, 0);  // opt_endofopt
+    write_uint32(idb + 28, PCAPNG_IDB_SIZE);
+
+    if (fwrite(header, 1, sizeof(header), capture->captureFile) != sizeof(header))
+    {
+        LogError("Failure writing pcapng file header");
+        result = __FAILURE__;
+    }
+    else
+    {
+        capture->fileSize = sizeof(header);
+        result = 0;
+    }
+    return result;
+}
+
+static STRING_HANDLE construct_file_name(MQTT_CAPTURE* capture, size_t index)
+{
+    return STRING_construct_sprintf("%s_%05lu.pcapng", capture->filePrefix, (unsigned long)index);
+}
+
+static int open_next_capture_file(MQTT_CAPTURE* capture)
+{
+    int result;
+    STRING_HANDLE fileName;
+
+    if (capture->captureFile != NULL)
+    {
+        (void)fclose(capture->captureFile);
+        capture->captureFile = NULL;
+        capture->fileIndex++;
+    }
+
+    if (capture->maxFileCount > 0 && capture->fileIndex >= capture->maxFileCount)
+    {
+        STRING_HANDLE staleName = construct_file_name(capture, capture->fileIndex - capture->maxFileCount);
+        if (staleName != NULL)
+        {
+            (void)remove(STRING_c_str(staleName));
+            STRING_delete(staleName);
+        }
+    }
+
+    if ((fileName = construct_file_name(capture, capture->fileIndex)) == NULL)
+    {
+        LogError("Failure constructing capture file name");
+        result = __FAILURE__;
+    }
+    else
+    {
+        capture->captureFile = fopen(STRING_c_str(fileName), "wb");
+        if (capture->captureFile == NULL)
+        {
+            LogError("Failure opening capture file %s", STRING_c_str(fileName));
+            result = __FAILURE__;
+        }
+        else if (write_file_header(capture) != 0)
+        {
+            (void)fclose(capture->captureFile);
+            capture->captureFile = NULL;
+            result = __FAILURE__;
+        }
+        else
+        {
+            result = 0;
+        }
+        STRING_delete(fileName);
+    }
+    return result;
+}
+
+static void write_staged_blocks(MQTT_CAPTURE* capture, const uint8_t* blocks, size_t length)
+{
+    size_t offset = 0;
+    while (offset < length)
+    {
+        size_t blockLen = read_uint32(blocks + offset + 4);
+        /*Codes_SRS_MQTT_CAPTURE_07_014: [When a record would grow the file past maxFileSize the writer thread shall start the next file, and remove the oldest one when more than maxFileCount files exist.]*/
+        bool needsRotation = (capture->maxFileSize > 0 && capture->fileSize + blockLen > capture->maxFileSize &&
+            capture->fileSize > PCAPNG_SHB_SIZE + PCAPNG_IDB_SIZE);
+        if ((capture->captureFile == NULL || needsRotation) && open_next_capture_file(capture) != 0)
+        {
+            // Nothing can be written until a file can be opened, the rest of this batch is lost
+            break;
+        }
+        if (fwrite(blocks + offset, 1, blockLen, capture->captureFile) != blockLen)
+        {
+            LogError("Failure writing capture record");
+            break;
+        }
+        capture->fileSize += blockLen;
+        offset += blockLen;
+    }
+    if (capture->captureFile != NULL)
+    {
+        (void)fflush(capture->captureFile);
+    }
+}
+
+static int capture_writer_thread(void* context)
+{
+    MQTT_CAPTURE* capture = (MQTT_CAPTURE*)context;
+    bool running = true;
+    while (running)
+    {
+        size_t length = 0;
+        uint8_t* blocks = NULL;
+        if (Lock(capture->lock) != LOCK_OK)
+        {
+            LogError("Failure acquiring capture lock");
+            running = false;
+        }
+        else
+        {
+            if (capture->stageLength == 0 && !capture->stopWriter)
+            {
+                (void)Condition_Wait(capture->writerSignal, capture->lock, (int)capture->flushIntervalMs);
+            }
+            /*Codes_SRS_MQTT_CAPTURE_07_012: [The writer thread shall swap the staging buffers and write the staged records to the file at least every flushIntervalMs.]*/
+            // Swap the buffers so producers keep staging while this thread does the file I/O
+            blocks = capture->stageBuffer;
+            length = capture->stageLength;
+            capture->stageBuffer = capture->writeBuffer;
+            capture->stageLength = 0;
+            capture->writeBuffer = blocks;
+            running = !(capture->stopWriter && length == 0);
+            (void)Unlock(capture->lock);
+
+            if (length > 0)
+            {
+                write_staged_blocks(capture, blocks, length);
+            }
+        }
+    }
+    return 0;
+}
+
+static void destroy_capture_resources(MQTT_CAPTURE* capture)
+{
+    if (capture->writerSignal != NULL)
+    {
+        Condition_Deinit(capture->writerSignal);
+    }
+    if (capture->lock != NULL)
+    {
+        (void)Lock_Deinit(capture->lock);
+    }
+    if (capture->captureFile != NULL)
+    {
+        (void)fclose(capture->captureFile);
+    }
+    free(capture->stageBuffer);
+    free(capture->writeBuffer);
+    free(capture->filePrefix);
+    free(capture);
+}
+
+MQTT_CAPTURE_HANDLE mqtt_capture_create(const MQTT_CAPTURE_OPTIONS* options)
+{
+    MQTT_CAPTURE* result;
+    if (options == NULL || options->filePrefix == NULL)
+    {
+        /*Codes_SRS_MQTT_CAPTURE_07_001: [If options or options->filePrefix is NULL then mqtt_capture_create shall return NULL.]*/
+        LogError("Invalid parameter specified options: %p", options);
+        result = NULL;
+    }
+    else if ((result = (MQTT_CAPTURE*)malloc(sizeof(MQTT_CAPTURE))) == NULL)
+    {
+        LogError("Failure allocating capture instance");
+    }
+    else
+    {
+        memset(result, 0, sizeof(MQTT_CAPTURE));
+        result->maxFileSize = options->maxFileSize;
+        result->maxFileCount = options->maxFileCount;
+        /*Codes_SRS_MQTT_CAPTURE_07_003: [A bufferSize, flushIntervalMs or brokerPort of 0 shall select 256 KB, 500 milliseconds and port 1883.]*/
+        result->bufferSize = (options->bufferSize == 0) ? DEFAULT_BUFFER_SIZE : options->bufferSize;
+        result->flushIntervalMs = (options->flushIntervalMs == 0) ? DEFAULT_FLUSH_INTERVAL_MS : options->flushIntervalMs;
+        result->brokerPort = (options->brokerPort == 0) ? DEFAULT_BROKER_PORT : options->brokerPort;
+        result->tcpSeq[0] = 1;
+        result->tcpSeq[1] = 1;
+
+        /*Codes_SRS_MQTT_CAPTURE_07_002: [mqtt_capture_create shall copy filePrefix, allocate two staging buffers of bufferSize bytes and start the writer thread.]*/
+        if (mallocAndStrcpy_s(&result->filePrefix, options->filePrefix) != 0)
+        {
+            LogError("Failure copying capture file prefix");
+            /*Codes_SRS_MQTT_CAPTURE_07_004: [If any allocation or the creation of the lock, the condition or the thread fails then mqtt_capture_create shall free everything it allocated and return NULL.]*/
+            destroy_capture_resources(result);
+            result = NULL;
+        }
+        else if ((result->stageBuffer = (uint8_t*)malloc(result->bufferSize)) == NULL ||
+            (result->writeBuffer = (uint8_t*)malloc(result->bufferSize)) == NULL)
+        {
+            LogError("Failure allocating capture buffers of %lu bytes", (unsigned long)result->bufferSize);
+            destroy_capture_resources(result);
+            result = NULL;
+        }
+        else if ((result->lock = Lock_Init()) == NULL || (result->writerSignal = Condition_Init()) == NULL)
+        {
+            LogError("Failure creating capture synchronization objects");
+            destroy_capture_resources(result);
+            result = NULL;
+        }
+        else if (ThreadAPI_Create(&result->writerThread, capture_writer_thread, result) != THREADAPI_OK)
+        {
+            LogError("Failure creating capture writer thread");
+            destroy_capture_resources(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+void mqtt_capture_destroy(MQTT_CAPTURE_HANDLE handle)
+{
+    /*Codes_SRS_MQTT_CAPTURE_07_005: [If handle is NULL then mqtt_capture_destroy shall do nothing.]*/
+    if (handle != NULL)
+    {
+        MQTT_CAPTURE* capture = (MQTT_CAPTURE*)handle;
+        int threadResult;
+        if (Lock(capture->lock) == LOCK_OK)
+        {
+            capture->stopWriter = true;
+            (void)Condition_Post(capture->writerSignal);
+            (void)Unlock(capture->lock);
+        }
+        /*Codes_SRS_MQTT_CAPTURE_07_006: [mqtt_capture_destroy shall stop the writer thread once every staged record is written, close the current file and free all resources.]*/
+        // The writer drains whatever is still staged before it exits
+        (void)ThreadAPI_Join(capture->writerThread, &threadResult);
+        destroy_capture_resources(capture);
+    }
+}
+
+int mqtt_capture_write(MQTT_CAPTURE_HANDLE handle, MQTT_CAPTURE_DIRECTION direction, const uint8_t* data, size_t length)
+{
+    int result;
+    MQTT_CAPTURE* capture = (MQTT_CAPTURE*)handle;
+    if (capture == NULL || data == NULL || length == 0)
+    {
+        /*Codes_SRS_MQTT_CAPTURE_07_007: [If handle or data is NULL or length is 0 then mqtt_capture_write shall return a non-zero value.]*/
+        LogError("Invalid parameter specified handle: %p, data: %p, length: %lu", handle, data, (unsigned long)length);
+        result = __FAILURE__;
+    }
+    else
+    {
+        uint64_t timestamp = get_capture_time_ns();
+        size_t encodedSize = calculate_encoded_size(length);
+        if (Lock(capture->lock) != LOCK_OK)
+        {
+            LogError("Failure acquiring capture lock");
+            result = __FAILURE__;
+        }
+        else
+        {
+            if (capture->stageLength + encodedSize > capture->bufferSize)
+            {
+                /*Codes_SRS_MQTT_CAPTURE_07_010: [If the record does not fit in the staging buffer then mqtt_capture_write shall drop it, count it and return a non-zero value without waiting for the writer thread.]*/
+                // Never wait on the writer, dropping keeps the client I/O path unaffected
+                capture->droppedCount++;
+                result = __FAILURE__;
+            }
+            else
+            {
+                size_t offset = 0;
+                /*Codes_SRS_MQTT_CAPTURE_07_008: [mqtt_capture_write shall stage the bytes as pcapng Enhanced Packet Blocks holding synthetic IPv4/TCP segments between the client and brokerPort, without any file I/O, and return 0.]*/
+                while (offset < length)
+                {
+                    size_t segmentLen = (length - offset > MAX_SEGMENT_PAYLOAD) ? MAX_SEGMENT_PAYLOAD : length - offset;
+                    capture->stageLength += encode_segment(capture, capture->stageBuffer + capture->stageLength, direction, timestamp, data + offset, segmentLen);
+                    offset += segmentLen;
+                }
+                /*Codes_SRS_MQTT_CAPTURE_07_011: [mqtt_capture_write shall wake the writer thread once the staging buffer is half full.]*/
+                if (capture->stageLength >= capture->bufferSize / 2)
+                {
+                    (void)Condition_Post(capture->writerSignal);
+                }
+                result = 0;
+            }
+            (void)Unlock(capture->lock);
+        }
+    }
+    return result;
+}
+
+size_t mqtt_capture_get_dropped_count(MQTT_CAPTURE_HANDLE handle)
+{
+    size_t result;
+    MQTT_CAPTURE* capture = (MQTT_CAPTURE*)handle;
+    if (capture == NULL)
+    {
+        /*Codes_SRS_MQTT_CAPTURE_07_015: [If handle is NULL then mqtt_capture_get_dropped_count shall return 0.]*/
+        result = 0;
+    }
+    else if (Lock(capture->lock) != LOCK_OK)
+    {
+        result = 0;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_CAPTURE_07_016: [mqtt_capture_get_dropped_count shall return the number of records dropped because the staging buffer was full.]*/
+        result = capture->droppedCount;
+        (void)Unlock(capture->lock);
+    }
+    return result;
+}
@@ -2,19 +2,25 @@
 // Licensed under the MIT license. See LICENSE file in the project root for full license information.
 
 #include <stdlib.h>
+#include <string.h>
 #include "azure_c_shared_utility/agenttime.h"
 #include "azure_c_shared_utility/const_defines.h"
 #include "azure_c_shared_utility/crt_abstractions.h"
 #include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/lock.h"
 #include "azure_c_shared_utility/optimize_size.h"
 #include "azure_c_shared_utility/platform.h"
+#include "azure_c_shared_utility/singlylinkedlist.h"
 #include "azure_c_shared_utility/strings.h"
 #include "azure_c_shared_utility/threadapi.h"
 #include "azure_c_shared_utility/tickcounter.h"
+#include "azure_c_shared_utility/vector.h"
 #include "azure_c_shared_utility/xlogging.h"
 
 #include "azure_umqtt_c/mqtt_client.h"
 #include "azure_umqtt_c/mqtt_codec.h"
+#include "azure_umqtt_c/mqtt_capture.h"
+#include "azure_umqtt_c/mqtt_persist.h"
 #include <inttypes.h>
 
 #define VARIABLE_HEADER_OFFSET          2
@@ -26,12 +32,41 @@
 #define TIME_MAX_BUFFER                 16
 #define DEFAULT_MAX_PING_RESPONSE_TIME  80  // % of time to send pings
 #define MAX_CLOSE_RETRIES               20
+#define DEFAULT_RESUBSCRIBE_PACKET_ID   0xFF00  // Leaves 1 to 0xFEFF to the application
+#define MAX_REMAINING_LENGTH            268435455
+#define MAX_MQTT_PACKET_SIZE            (1 + 4 + MAX_REMAINING_LENGTH)
+#define SUBSCRIBE_PACKET_ID_SIZE        2
+#define SUBSCRIBE_ENTRY_OVERHEAD        3   // Topic length prefix and requested QoS
+#define DEFAULT_RECEIVE_MAXIMUM         65535
+#define MAX_OUTBOUND_TOPIC_ALIASES      128
+#define NEXT_128_CHUNK                  0x80
+#define MAX_TRANSFORM_HEADER_SIZE       4
+#define DEFAULT_MAX_DECODED_LENGTH      (16 * 1024 * 1024)
 
 static const char* const TRUE_CONST = "true";
 static const char* const FALSE_CONST = "false";
 
 DEFINE_ENUM_STRINGS(QOS_VALUE, QOS_VALUE_VALUES);
 
+typedef struct TOPIC_ALIAS_ENTRY_TAG
+{
+    char* topicName;
+    size_t topicLength;
+    uint32_t lastUsed;
+} TOPIC_ALIAS_ENTRY;
+
+typedef struct INBOUND_TOPIC_ALIAS_TAG
+{
+    size_t offset;
+    size_t length;
+} INBOUND_TOPIC_ALIAS;
+
+typedef struct PAYLOAD_TRANSFORM_ENTRY_TAG
+{
+    char* topicFilter;
+    const MQTT_PAYLOAD_TRANSFORM* transform;
+} PAYLOAD_TRANSFORM_ENTRY;
+
 typedef struct MQTT_CLIENT_TAG
 {
     XIO_HANDLE xioHandle;
@@ -49,14 +84,113 @@ typedef struct MQTT_CLIENT_TAG
     QOS_VALUE qosValue;
     uint16_t keepAliveInterval;
     MQTT_CLIENT_OPTIONS mqttOptions;
+    // CONNECT encoded from mqttOptions, reused on every open until the options change
+    BUFFER_HANDLE connectPacket;
     bool clientConnected;
     bool socketConnected;
     bool logTrace;
     bool rawBytesTrace;
     tickcounter_ms_t timeSincePing;
     uint16_t maxPingRespTime;
+    MQTT_CAPTURE_HANDLE captureHandle;
+    MQTT_PERSIST_HANDLE persistHandle;
+    SINGLYLINKEDLIST_HANDLE offlineQueue;
+    MQTT_OFFLINE_QUEUE_OPTIONS offlineOptions;
+    size_t offlineBytes;
+    size_t offlineCount;
+    tickcounter_ms_t offlineDrainMs;
+    bool reconnectEnabled;
+    // xorshift state of the reconnect jitter, seeded on the first reconnect
+    uint32_t jitterState;
+    bool reconnectPending;
+    bool reconnecting;
+    MQTT_RECONNECT_OPTIONS reconnectOptions;
+    XIO_HANDLE reconnectXio;
+    size_t reconnectAttempt;
+    tickcounter_ms_t nextReconnectMs;
+    SINGLYLINKEDLIST_HANDLE subscriptions;
+    // The SUBSCRIBE packets restoring the session use the ids from restorePacketId on
+    uint16_t restorePacketId;
+    size_t restorePacketCount;
+    size_t restorePendingCount;
+    SINGLYLINKEDLIST_HANDLE subscribeBatches;
+    MQTT_CONNECTION_LIMITS serverLimits;
+    TOPIC_ALIAS_ENTRY* topicAliases;
+    uint16_t topicAliasCount;
+    uint32_t topicAliasClock;
+    INBOUND_TOPIC_ALIAS* inboundAliases;
+    char* inboundAliasArena;
+    size_t inboundArenaSize;
+    size_t inboundArenaUsed;
+    size_t inboundArenaLive;
+    uint16_t maxInflight;
+    size_t inflightCount;
+    size_t streamThreshold;
+    ON_MQTT_MESSAGE_CHUNK_CALLBACK fnMessageChunk;
+    void* chunkCtx;
+    MQTT_MESSAGE_HANDLE streamMessage;
+    size_t streamOffset;
+    size_t streamLength;
+    ON_MQTT_PUBLISH_CHUNK_CALLBACK fnPublishChunk;
+    void* publishChunkCtx;
+    uint8_t* publishChunk;
+    size_t publishChunkSize;
+    size_t publishOffset;
+    size_t publishLength;
+    bool publishChunkPending;
+    bool publishStreamFailed;
+    SINGLYLINKEDLIST_HANDLE deferredPackets;
+    BUFFER_HANDLE pendingAcks;
+    size_t pendingAckLength;
+    tickcounter_ms_t pendingAckMs;
+    size_t maxAckDelayMs;
+    bool batchingAcks;
+    ON_MQTT_MESSAGE_RECV_ACK_CALLBACK fnMessageRecvAck;
+    void* recvAckCtx;
+    LOCK_HANDLE manualAckLock;
+    VECTOR_HANDLE manualAcks;
+    VECTOR_HANDLE drainingAcks;
+    uint32_t connectionEpoch;
+    PAYLOAD_TRANSFORM_ENTRY* payloadTransforms;
+    size_t payloadTransformCount;
+    uint8_t* encodeBuffer;
+    size_t encodeBufferSize;
+    uint8_t* decodeBuffer;
+    size_t decodeBufferSize;
 } MQTT_CLIENT;
 
+typedef struct OFFLINE_PUBLISH_TAG
+{
+    BUFFER_HANDLE packet;
+    QOS_VALUE qos;
+    uint16_t packetId;
+} OFFLINE_PUBLISH;
+
+typedef struct RECONNECT_SUBSCRIPTION_TAG
+{
+    char* topic;
+    QOS_VALUE qos;
+} RECONNECT_SUBSCRIPTION;
+
+typedef struct SUBSCRIBE_BATCH_PACKET_TAG
+{
+    uint16_t packetId;
+    size_t firstEntry;
+    size_t entryCount;
+    bool acknowledged;
+} SUBSCRIBE_BATCH_PACKET;
+
+typedef struct SUBSCRIBE_BATCH_TAG
+{
+    SUBSCRIBE_BATCH_PACKET* packets;
+    size_t packetCount;
+    size_t pendingCount;
+    QOS_VALUE* qosReturn;
+    size_t qosCount;
+    ON_MQTT_SUBSCRIBE_BATCH_COMPLETE onComplete;
+    void* callbackCtx;
+} SUBSCRIBE_BATCH;
+
 static void on_connection_closed(void* context)
 {
     MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
@@ -71,8 +205,35 @@ static void on_connection_closed(void* context)
     }
 }
 
+static void discardPublishStream(MQTT_CLIENT* mqtt_client)
+{
+    if (mqtt_client->publishChunk != NULL)
+    {
+        free(mqtt_client->publishChunk);
+        mqtt_client->publishChunk = NULL;
+        mqtt_client->fnPublishChunk = NULL;
+        mqtt_client->publishChunkPending = false;
+    }
+    if (mqtt_client->deferredPackets != NULL)
+    {
+        LIST_ITEM_HANDLE item;
+        while ((item = singlylinkedlist_get_head_item(mqtt_client->deferredPackets)) != NULL)
+        {
+            BUFFER_delete((BUFFER_HANDLE)singlylinkedlist_item_get_value(item));
+            (void)singlylinkedlist_remove(mqtt_client->deferredPackets, item);
+        }
+        singlylinkedlist_destroy(mqtt_client->deferredPackets);
+        mqtt_client->deferredPackets = NULL;
+    }
+}
+
 static void close_connection(MQTT_CLIENT* mqtt_client)
 {
+    // A streamed publish cannot be finished on another connection
+    discardPublishStream(mqtt_client);
+    // The server sends the unacknowledged publishes again, the ack tokens of this connection become stale
+    mqtt_client->pendingAckLength = 0;
+    mqtt_client->connectionEpoch++;
     if (mqtt_client->socketConnected)
     {
         (void)xio_close(mqtt_client->xioHandle, on_connection_closed, mqtt_client);
@@ -99,6 +260,65 @@ static void close_connection(MQTT_CLIENT* mqtt_client)
     mqtt_client->xioHandle = NULL;
 }
 
+// rand() is not seeded by the library and would give every process the same sequence
+static uint32_t nextJitter(MQTT_CLIENT* mqtt_client, tickcounter_ms_t current_ms)
+{
+    uint32_t state = mqtt_client->jitterState;
+    if (state == 0)
+    {
+        state = (uint32_t)current_ms ^ (uint32_t)(uintptr_t)mqtt_client ^ (uint32_t)((uint64_t)(uintptr_t)mqtt_client >> 32);
+        if (state == 0)
+        {
+            state = 0x9E3779B9;
+        }
+    }
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    mqtt_client->jitterState = state;
+    return state;
+}
+
+static void scheduleReconnect(MQTT_CLIENT* mqtt_client)
+{
+    tickcounter_ms_t current_ms;
+    if (mqtt_client->reconnectXio == NULL)
+    {
+        LogError("Error: no xio to reconnect");
+    }
+    else if (mqtt_client->reconnectOptions.maxAttempts > 0 && mqtt_client->reconnectAttempt >= mqtt_client->reconnectOptions.maxAttempts)
+    {
+        LogError("Error: giving up reconnecting after %lu attempts", (unsigned long)mqtt_client->reconnectAttempt);
+        mqtt_client->reconnecting = false;
+    }
+    else if (tickcounter_get_current_ms(mqtt_client->packetTickCntr, &current_ms) != 0)
+    {
+        LogError("Error: tickcounter_get_current_ms failed");
+    }
+    else
+    {
+        size_t attempt;
+        size_t delay = mqtt_client->reconnectOptions.initialDelayMs;
+        for (attempt = 0; attempt < mqtt_client->reconnectAttempt && delay < mqtt_client->reconnectOptions.maxDelayMs; attempt++)
+        {
+            delay *= 2;
+        }
+        if (delay > mqtt_client->reconnectOptions.maxDelayMs)
+        {
+            delay = mqtt_client->reconnectOptions.maxDelayMs;
+        }
+
+        /*Codes_SRS_MQTT_CLIENT_07_053: [After a connection error, a failed send or a missing ping response the client shall reopen the xio after a delay that doubles on each failed attempt, up to maxDelayMs, with a random jitter of up to half the delay.]*/
+        // Spread the clients that lost the same broker over the second half of the delay
+        delay = (delay / 2) + (size_t)nextJitter(mqtt_client, current_ms) % ((delay / 2) + 1);
+
+        mqtt_client->nextReconnectMs = current_ms + delay;
+        mqtt_client->reconnectAttempt++;
+        mqtt_client->reconnectPending = true;
+        mqtt_client->reconnecting = true;
+    }
+}
+
 static void set_error_callback(MQTT_CLIENT* mqtt_client, MQTT_CLIENT_EVENT_ERROR error_type)
 {
     if (mqtt_client->fnOnErrorCallBack)
@@ -106,6 +326,12 @@ static void set_error_callback(MQTT_CLIENT* mqtt_client, MQTT_CLIENT_EVENT_ERROR
         mqtt_client->fnOnErrorCallBack(mqtt_client, error_type, mqtt_client->errorCBCtx);
     }
     close_connection(mqtt_client);
+
+    if (mqtt_client->reconnectEnabled &&
+        (error_type == MQTT_CLIENT_CONNECTION_ERROR || error_type == MQTT_CLIENT_COMMUNICATION_ERROR || error_type == MQTT_CLIENT_NO_PING_RESPONSE))
+    {
+        scheduleReconnect(mqtt_client);
+    }
 }
 
 static STRING_HANDLE construct_trace_log_handle(MQTT_CLIENT* mqtt_client)
@@ -356,7 +582,7 @@ static void logIncomingRawTrace(MQTT_CLIENT* mqtt_client, CONTROL_PACKET_TYPE pa
 }
 #endif // NO_LOGGING
 
-static int sendPacketItem(MQTT_CLIENT* mqtt_client, const unsigned char* data, size_t length)
+static int transmitData(MQTT_CLIENT* mqtt_client, const unsigned char* data, size_t length, ON_SEND_COMPLETE on_send_complete)
 {
     int result;
 
@@ -367,7 +593,7 @@ static int sendPacketItem(MQTT_CLIENT* mqtt_client, const unsigned char* data, s
     }
     else
     {
-        result = xio_send(mqtt_client->xioHandle, (const void*)data, length, sendComplete, mqtt_client);
+        result = xio_send(mqtt_client->xioHandle, (const void*)data, length, on_send_complete, mqtt_client);
         if (result != 0)
         {
             LogError("%d: Failure sending control packet data", result);
@@ -378,11 +604,197 @@ static int sendPacketItem(MQTT_CLIENT* mqtt_client, const unsigned char* data, s
 #ifdef ENABLE_RAW_TRACE
             logOutgoingRawTrace(mqtt_client, (const uint8_t*)data, length);
 #endif
+            if (mqtt_client->captureHandle != NULL)
+            {
+                (void)mqtt_capture_write(mqtt_client->captureHandle, MQTT_CAPTURE_OUTGOING, (const uint8_t*)data, length);
+            }
+        }
+    }
+    return result;
+}
+
+static int deferPacket(MQTT_CLIENT* mqtt_client, const unsigned char* data, size_t length)
+{
+    int result;
+    BUFFER_HANDLE packet;
+    if (mqtt_client->deferredPackets == NULL && (mqtt_client->deferredPackets = singlylinkedlist_create()) == NULL)
+    {
+        LogError("Error: singlylinkedlist_create failed");
+        result = __FAILURE__;
+    }
+    else if ((packet = BUFFER_create(data, length)) == NULL)
+    {
+        LogError("Error: BUFFER_create failed");
+        result = __FAILURE__;
+    }
+    else if (singlylinkedlist_add(mqtt_client->deferredPackets, packet) == NULL)
+    {
+        LogError("Error: singlylinkedlist_add failed");
+        BUFFER_delete(packet);
+        result = __FAILURE__;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+static int sendPacketItem(MQTT_CLIENT* mqtt_client, const unsigned char* data, size_t length)
+{
+    int result;
+    if (mqtt_client->publishChunk != NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_088: [While a streamed publish is being sent the packets of the other operations shall be held and sent after its last chunk, as MQTT packets cannot interleave.]*/
+        result = deferPacket(mqtt_client, data, length);
+    }
+    else
+    {
+        result = transmitData(mqtt_client, data, length, sendComplete);
+    }
+    return result;
+}
+
+static int queueAcknowledgement(MQTT_CLIENT* mqtt_client, const unsigned char* data, size_t length)
+{
+    int result;
+    if (mqtt_client->pendingAcks == NULL && (mqtt_client->pendingAcks = BUFFER_new()) == NULL)
+    {
+        LogError("Error: BUFFER_new failed");
+        result = __FAILURE__;
+    }
+    else
+    {
+        // The buffer is kept between bursts and only grows
+        size_t capacity = BUFFER_length(mqtt_client->pendingAcks);
+        size_t available = capacity - mqtt_client->pendingAckLength;
+        if (available < length && BUFFER_enlarge(mqtt_client->pendingAcks, (length - available > capacity) ? length - available : capacity) != 0)
+        {
+            LogError("Error: BUFFER_enlarge failed");
+            result = __FAILURE__;
+        }
+        else
+        {
+            if (mqtt_client->pendingAckLength == 0 && mqtt_client->maxAckDelayMs > 0 &&
+                tickcounter_get_current_ms(mqtt_client->packetTickCntr, &mqtt_client->pendingAckMs) != 0)
+            {
+                LogError("Failure getting current ms tickcounter");
+                mqtt_client->pendingAckMs = 0;
+            }
+            (void)memcpy(BUFFER_u_char(mqtt_client->pendingAcks) + mqtt_client->pendingAckLength, data, length);
+            mqtt_client->pendingAckLength += length;
+            result = 0;
         }
     }
     return result;
 }
 
+static void flushAcknowledgements(MQTT_CLIENT* mqtt_client)
+{
+    if (mqtt_client->pendingAckLength > 0)
+    {
+        size_t length = mqtt_client->pendingAckLength;
+        mqtt_client->pendingAckLength = 0;
+        if (sendPacketItem(mqtt_client, BUFFER_u_char(mqtt_client->pendingAcks), length) != 0)
+        {
+            LogError("Error: sending the publish acknowledgements failed");
+        }
+    }
+}
+
+static void onPublishChunkSent(void* context, IO_SEND_RESULT send_result)
+{
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
+    mqtt_client->publishChunkPending = false;
+    if (send_result == IO_SEND_ERROR)
+    {
+        // The stream is aborted from mqtt_client_dowork, the chunk may still be in use here
+        LogError("MQTT Send Complete Failure for a publish chunk");
+        mqtt_client->publishStreamFailed = true;
+    }
+}
+
+static void completePublishStream(MQTT_CLIENT* mqtt_client)
+{
+    SINGLYLINKEDLIST_HANDLE deferredPackets = mqtt_client->deferredPackets;
+    mqtt_client->deferredPackets = NULL;
+    discardPublishStream(mqtt_client);
+
+    if (deferredPackets != NULL)
+    {
+        bool sendFailed = false;
+        LIST_ITEM_HANDLE item;
+        while ((item = singlylinkedlist_get_head_item(deferredPackets)) != NULL)
+        {
+            BUFFER_HANDLE packet = (BUFFER_HANDLE)singlylinkedlist_item_get_value(item);
+            (void)singlylinkedlist_remove(deferredPackets, item);
+            if (!sendFailed)
+            {
+                size_t size = BUFFER_length(packet);
+                if (transmitData(mqtt_client, BUFFER_u_char(packet), size, sendComplete) != 0)
+                {
+                    LogError("Error: sending a packet held during a streamed publish failed");
+                    sendFailed = true;
+                }
+            }
+            BUFFER_delete(packet);
+        }
+        singlylinkedlist_destroy(deferredPackets);
+
+        if (sendFailed && mqtt_client->socketConnected)
+        {
+            set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+        }
+    }
+}
+
+static void pumpPublishStream(MQTT_CLIENT* mqtt_client)
+{
+    bool failed = mqtt_client->publishStreamFailed;
+    // A chunk sent synchronously completes inside xio_send, so the next one is pulled by this loop
+    while (!failed && !mqtt_client->publishChunkPending && mqtt_client->publishOffset < mqtt_client->publishLength)
+    {
+        size_t remaining = mqtt_client->publishLength - mqtt_client->publishOffset;
+        size_t bufferSize = (remaining < mqtt_client->publishChunkSize) ? remaining : mqtt_client->publishChunkSize;
+        size_t chunkLength = 0;
+
+        /*Codes_SRS_MQTT_CLIENT_07_089: [mqtt_client_dowork shall pull the next chunk of a streamed publish into a buffer of at most chunkSize bytes once the previous chunk has been sent, a chunk of 0 bytes shall be pulled again on the next call.]*/
+        if (mqtt_client->fnPublishChunk(mqtt_client->publishChunk, bufferSize, mqtt_client->publishOffset, &chunkLength, mqtt_client->publishChunkCtx) != 0 ||
+            chunkLength > bufferSize)
+        {
+            LogError("Error: the publish chunk callback failed at offset %lu", (unsigned long)mqtt_client->publishOffset);
+            failed = true;
+        }
+        else if (chunkLength == 0)
+        {
+            break;
+        }
+        else
+        {
+            mqtt_client->publishChunkPending = true;
+            if (transmitData(mqtt_client, mqtt_client->publishChunk, chunkLength, onPublishChunkSent) != 0)
+            {
+                failed = true;
+            }
+            else
+            {
+                mqtt_client->publishOffset += chunkLength;
+                failed = mqtt_client->publishStreamFailed;
+            }
+        }
+    }
+
+    if (failed)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_090: [If a chunk cannot be pulled or sent the client shall report MQTT_CLIENT_COMMUNICATION_ERROR and close the connection, as the publish cannot be completed.]*/
+        set_error_callback(mqtt_client, MQTT_CLIENT_COMMUNICATION_ERROR);
+    }
+    else if (mqtt_client->publishOffset == mqtt_client->publishLength)
+    {
+        completePublishStream(mqtt_client);
+    }
+}
+
 static void onOpenComplete(void* context, IO_OPEN_RESULT open_result)
 {
     MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
@@ -395,17 +807,25 @@ static void onOpenComplete(void* context, IO_OPEN_RESULT open_result)
 
             STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
 
-            // Send the Connect packet
-            BUFFER_HANDLE connPacket = mqtt_codec_connect(&mqtt_client->mqttOptions, trace_log);
-            if (connPacket == NULL)
+            /*Codes_SRS_MQTT_CLIENT_07_111: [The CONNECT packet shall be encoded on the first open only and sent again as is on every later open, until mqtt_client_connect is called with different options.]*/
+            if (mqtt_client->connectPacket != NULL)
+            {
+                if (trace_log != NULL)
+                {
+                    // The fields were traced when the packet was encoded
+                    (void)STRING_copy(trace_log, "CONNECT");
+                }
+            }
+            else if ((mqtt_client->connectPacket = mqtt_codec_connect(&mqtt_client->mqttOptions, trace_log)) == NULL)
             {
                 LogError("Error: mqtt_codec_connect failed");
             }
-            else
+
+            if (mqtt_client->connectPacket != NULL)
             {
-                size_t size = BUFFER_length(connPacket);
+                size_t size = BUFFER_length(mqtt_client->connectPacket);
                 /*Codes_SRS_MQTT_CLIENT_07_009: [On success mqtt_client_connect shall send the MQTT CONNECT to the endpoint.]*/
-                if (sendPacketItem(mqtt_client, BUFFER_u_char(connPacket), size) != 0)
+                if (sendPacketItem(mqtt_client, BUFFER_u_char(mqtt_client->connectPacket), size) != 0)
                 {
                     LogError("Error: mqtt_codec_connect failed");
                 }
@@ -413,7 +833,6 @@ static void onOpenComplete(void* context, IO_OPEN_RESULT open_result)
                 {
                     log_outgoing_trace(mqtt_client, trace_log);
                 }
-                BUFFER_delete(connPacket);
             }
             if (trace_log != NULL)
             {
@@ -427,6 +846,11 @@ static void onOpenComplete(void* context, IO_OPEN_RESULT open_result)
                 mqtt_client->fnOnErrorCallBack(mqtt_client, MQTT_CLIENT_CONNECTION_ERROR, mqtt_client->errorCBCtx);
             }
             close_connection(mqtt_client);
+
+            if (open_result != IO_OPEN_OK && mqtt_client->reconnectEnabled)
+            {
+                scheduleReconnect(mqtt_client);
+            }
         }
     }
     else
@@ -440,10 +864,22 @@ static void onBytesReceived(void* context, const unsigned char* buffer, size_t s
     MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
     if (mqtt_client != NULL)
     {
+        if (mqtt_client->captureHandle != NULL)
+        {
+            (void)mqtt_capture_write(mqtt_client->captureHandle, MQTT_CAPTURE_INCOMING, (const uint8_t*)buffer, size);
+        }
+        mqtt_client->batchingAcks = true;
         if (mqtt_codec_bytesReceived(mqtt_client->codec_handle, buffer, size) != 0)
         {
             set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
         }
+        mqtt_client->batchingAcks = false;
+
+        if (mqtt_client->maxAckDelayMs == 0)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_093: [The PUBACK and PUBREC packets produced while processing the bytes of one receive call shall be sent together in a single write at the end of it.]*/
+            flushAcknowledgements(mqtt_client);
+        }
     }
     else
     {
@@ -466,8 +902,43 @@ static void onIoError(void* context)
     }
 }
 
+static void clearConnectPacket(MQTT_CLIENT* mqtt_client)
+{
+    if (mqtt_client->connectPacket != NULL)
+    {
+        BUFFER_delete(mqtt_client->connectPacket);
+        mqtt_client->connectPacket = NULL;
+    }
+}
+
+// A NULL string leaves the cloned one in place, see cloneMqttOptions
+static bool isSameOption(const char* current, const char* option)
+{
+    return option == NULL || (current != NULL && strcmp(current, option) == 0);
+}
+
+static bool isSameConnectOptions(const MQTT_CLIENT_OPTIONS* current, const MQTT_CLIENT_OPTIONS* mqttOptions)
+{
+    return isSameOption(current->clientId, mqttOptions->clientId) &&
+        isSameOption(current->willTopic, mqttOptions->willTopic) &&
+        isSameOption(current->willMessage, mqttOptions->willMessage) &&
+        isSameOption(current->username, mqttOptions->username) &&
+        isSameOption(current->password, mqttOptions->password) &&
+        current->keepAliveInterval == mqttOptions->keepAliveInterval &&
+        current->messageRetain == mqttOptions->messageRetain &&
+        current->useCleanSession == mqttOptions->useCleanSession &&
+        current->qualityOfServiceValue == mqttOptions->qualityOfServiceValue &&
+        current->protocolVersion == mqttOptions->protocolVersion &&
+        current->sessionExpiryInterval == mqttOptions->sessionExpiryInterval &&
+        current->receiveMaximum == mqttOptions->receiveMaximum &&
+        current->maximumPacketSize == mqttOptions->maximumPacketSize &&
+        current->topicAliasMaximum == mqttOptions->topicAliasMaximum;
+}
+
 static void clear_mqtt_options(MQTT_CLIENT* mqtt_client)
 {
+    clearConnectPacket(mqtt_client);
+
     if (mqtt_client->mqttOptions.clientId != NULL)
     {
         free(mqtt_client->mqttOptions.clientId);
@@ -594,6 +1065,11 @@ static int cloneMqttOptions(MQTT_CLIENT* mqtt_client, const MQTT_CLIENT_OPTIONS*
         mqtt_client->mqttOptions.messageRetain = mqttOptions->messageRetain;
         mqtt_client->mqttOptions.useCleanSession = mqttOptions->useCleanSession;
         mqtt_client->mqttOptions.qualityOfServiceValue = mqttOptions->qualityOfServiceValue;
+        mqtt_client->mqttOptions.protocolVersion = mqttOptions->protocolVersion;
+        mqtt_client->mqttOptions.sessionExpiryInterval = mqttOptions->sessionExpiryInterval;
+        mqtt_client->mqttOptions.receiveMaximum = mqttOptions->receiveMaximum;
+        mqtt_client->mqttOptions.maximumPacketSize = mqttOptions->maximumPacketSize;
+        mqtt_client->mqttOptions.topicAliasMaximum = mqttOptions->topicAliasMaximum;
     }
     else
     {
@@ -602,354 +1078,1754 @@ static int cloneMqttOptions(MQTT_CLIENT* mqtt_client, const MQTT_CLIENT_OPTIONS*
     return result;
 }
 
-static void ProcessPublishMessage(MQTT_CLIENT* mqtt_client, uint8_t* initialPos, size_t packetLength, int flags)
+static bool isProtocolV5(const MQTT_CLIENT* mqtt_client)
 {
-    bool isDuplicateMsg = (flags & DUPLICATE_FLAG_MASK) ? true : false;
-    bool isRetainMsg = (flags & RETAIN_FLAG_MASK) ? true : false;
-    QOS_VALUE qosValue = (flags == 0) ? DELIVER_AT_MOST_ONCE : (flags & QOS_LEAST_ONCE_FLAG_MASK) ? DELIVER_AT_LEAST_ONCE : DELIVER_EXACTLY_ONCE;
+    return mqtt_client->mqttOptions.protocolVersion == MQTT_PROTOCOL_VERSION_5;
+}
 
-    uint8_t* iterator = initialPos;
-    size_t numberOfBytesToBeRead = packetLength;
-    size_t lengthOfTopicName = numberOfBytesToBeRead;
-    char* topicName = byteutil_readUTF(&iterator, &lengthOfTopicName);
-    if (topicName == NULL)
+static void resetConnectionLimits(MQTT_CLIENT* mqtt_client)
+{
+    mqtt_client->serverLimits.receiveMaximum = DEFAULT_RECEIVE_MAXIMUM;
+    mqtt_client->serverLimits.maximumPacketSize = 0;
+    mqtt_client->serverLimits.topicAliasMaximum = 0;
+    mqtt_client->serverLimits.maximumQos = DELIVER_EXACTLY_ONCE;
+    mqtt_client->serverLimits.retainAvailable = true;
+}
+
+static void applyConnectionLimits(MQTT_CLIENT* mqtt_client, const MQTT_PROPERTIES* properties)
+{
+    if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_RECEIVE_MAXIMUM) && properties->receiveMaximum != 0)
     {
-        LogError("Publish MSG: failure reading topic name");
-        set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
+        mqtt_client->serverLimits.receiveMaximum = properties->receiveMaximum;
     }
-    else
+    if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_MAXIMUM_PACKET_SIZE))
     {
-        STRING_HANDLE trace_log = NULL;
+        mqtt_client->serverLimits.maximumPacketSize = properties->maximumPacketSize;
+    }
+    if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM))
+    {
+        mqtt_client->serverLimits.topicAliasMaximum = properties->topicAliasMaximum;
+    }
+    if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_MAXIMUM_QOS))
+    {
+        mqtt_client->serverLimits.maximumQos = (properties->maximumQos == 0) ? DELIVER_AT_MOST_ONCE : DELIVER_AT_LEAST_ONCE;
+    }
+    if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_RETAIN_AVAILABLE))
+    {
+        mqtt_client->serverLimits.retainAvailable = (properties->retainAvailable != 0);
+    }
+}
 
-#ifndef NO_LOGGING
-        if (mqtt_client->logTrace)
+static void resetTopicAliases(MQTT_CLIENT* mqtt_client)
+{
+    if (mqtt_client->topicAliases != NULL)
+    {
+        uint16_t index;
+        for (index = 0; index < mqtt_client->topicAliasCount; index++)
         {
-            trace_log = STRING_construct_sprintf("PUBLISH | IS_DUP: %s | RETAIN: %d | QOS: %s | TOPIC_NAME: %s", isDuplicateMsg ? TRUE_CONST : FALSE_CONST,
-                isRetainMsg ? 1 : 0, ENUM_TO_STRING(QOS_VALUE, qosValue), topicName);
+            free(mqtt_client->topicAliases[index].topicName);
         }
-#endif
-        uint16_t packetId = 0;
-        numberOfBytesToBeRead = packetLength - (iterator - initialPos);
-        if (qosValue != DELIVER_AT_MOST_ONCE)
+        free(mqtt_client->topicAliases);
+        mqtt_client->topicAliases = NULL;
+    }
+    mqtt_client->topicAliasCount = 0;
+    mqtt_client->topicAliasClock = 0;
+}
+
+static size_t getInflightWindow(const MQTT_CLIENT* mqtt_client)
+{
+    size_t result = mqtt_client->serverLimits.receiveMaximum;
+    if (mqtt_client->maxInflight != 0 && mqtt_client->maxInflight < result)
+    {
+        result = mqtt_client->maxInflight;
+    }
+    return result;
+}
+
+static bool isInflightWindowFull(const MQTT_CLIENT* mqtt_client, QOS_VALUE qos)
+{
+    return qos != DELIVER_AT_MOST_ONCE && mqtt_client->inflightCount >= getInflightWindow(mqtt_client);
+}
+
+static void releaseInflight(MQTT_CLIENT* mqtt_client)
+{
+    // Saturate so an acknowledgement for a packet sent on an earlier connection cannot underflow
+    if (mqtt_client->inflightCount > 0)
+    {
+        mqtt_client->inflightCount--;
+    }
+}
+
+static bool canUseTopicAlias(const MQTT_CLIENT* mqtt_client, QOS_VALUE qos, bool queuePublish)
+{
+    // Alias mappings only live as long as the connection, a packet that could be
+    // sent again on a later connection has to carry its topic name
+    return isProtocolV5(mqtt_client) && mqtt_client->serverLimits.topicAliasMaximum > 0 &&
+        mqtt_client->clientConnected && !queuePublish &&
+        (qos == DELIVER_AT_MOST_ONCE || mqtt_client->persistHandle == NULL);
+}
+
+static uint16_t acquireTopicAlias(MQTT_CLIENT* mqtt_client, const char* topicName, bool* isNewMapping)
+{
+    uint16_t result = 0;
+    size_t topicLength = strlen(topicName);
+    uint16_t capacity = (mqtt_client->serverLimits.topicAliasMaximum < MAX_OUTBOUND_TOPIC_ALIASES) ? mqtt_client->serverLimits.topicAliasMaximum : MAX_OUTBOUND_TOPIC_ALIASES;
+
+    *isNewMapping = false;
+    if (topicLength == 0)
+    {
+        result = 0;
+    }
+    else if (mqtt_client->topicAliases == NULL && (mqtt_client->topicAliases = (TOPIC_ALIAS_ENTRY*)malloc(capacity * sizeof(TOPIC_ALIAS_ENTRY))) == NULL)
+    {
+        LogError("Failure allocating topic alias table");
+        result = 0;
+    }
+    else
+    {
+        uint16_t index;
+        uint16_t lruIndex = 0;
+        for (index = 0; index < mqtt_client->topicAliasCount; index++)
         {
-            packetId = byteutil_read_uint16(&iterator, numberOfBytesToBeRead);
-#ifndef NO_LOGGING
-            if (mqtt_client->logTrace)
+            TOPIC_ALIAS_ENTRY* entry = &mqtt_client->topicAliases[index];
+            if (entry->topicLength == topicLength && memcmp(entry->topicName, topicName, topicLength) == 0)
             {
-                STRING_sprintf(trace_log, " | PACKET_ID: %"PRIu16, packetId);
+                break;
+            }
+            if (entry->lastUsed < mqtt_client->topicAliases[lruIndex].lastUsed)
+            {
+                lruIndex = index;
             }
-#endif
         }
-        if ((qosValue != DELIVER_AT_MOST_ONCE) && (packetId == 0))
+
+        if (index < mqtt_client->topicAliasCount)
         {
-            LogError("Publish MSG: packetId=0, invalid");
-            set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
+            result = index + 1;
         }
         else
         {
-            numberOfBytesToBeRead = packetLength - (iterator - initialPos);
-
-            MQTT_MESSAGE_HANDLE msgHandle = mqttmessage_create_in_place(packetId, topicName, qosValue, iterator, numberOfBytesToBeRead);
-            if (msgHandle == NULL)
+            char* topicCopy = (char*)malloc(topicLength + 1);
+            if (topicCopy == NULL)
             {
-                LogError("failure in mqttmessage_create");
-                set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
-            }
-            else if (mqttmessage_setIsDuplicateMsg(msgHandle, isDuplicateMsg) != 0 ||
-                     mqttmessage_setIsRetained(msgHandle, isRetainMsg) != 0)
-            {
-                LogError("failure setting mqtt message property");
-                set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+                LogError("Failure allocating topic alias entry");
+                result = 0;
             }
             else
             {
-#ifndef NO_LOGGING
-                if (mqtt_client->logTrace)
-                {
-                    STRING_sprintf(trace_log, " | PAYLOAD_LEN: %lu", (unsigned long)numberOfBytesToBeRead);
-                    log_incoming_trace(mqtt_client, trace_log);
-                }
-#endif
-                mqtt_client->fnMessageRecv(msgHandle, mqtt_client->ctx);
-
-                BUFFER_HANDLE pubRel = NULL;
-                if (qosValue == DELIVER_EXACTLY_ONCE)
-                {
-                    pubRel = mqtt_codec_publishReceived(packetId);
-                    if (pubRel == NULL)
-                    {
-                        LogError("Failed to allocate publish receive message.");
-                        set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
-                    }
-                }
-                else if (qosValue == DELIVER_AT_LEAST_ONCE)
+                (void)memcpy(topicCopy, topicName, topicLength + 1);
+                if (mqtt_client->topicAliasCount < capacity)
                 {
-                    pubRel = mqtt_codec_publishAck(packetId);
-                    if (pubRel == NULL)
-                    {
-                        LogError("Failed to allocate publish ack message.");
-                        set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
-                    }
+                    index = mqtt_client->topicAliasCount++;
                 }
-                if (pubRel != NULL)
+                else
                 {
-                    size_t size = BUFFER_length(pubRel);
-                    (void)sendPacketItem(mqtt_client, BUFFER_u_char(pubRel), size);
-                    BUFFER_delete(pubRel);
+                    /*Codes_SRS_MQTT_CLIENT_07_070: [When every alias allowed by the server is in use the least recently used alias shall be remapped to the new topic.]*/
+                    index = lruIndex;
+                    free(mqtt_client->topicAliases[index].topicName);
                 }
+                mqtt_client->topicAliases[index].topicName = topicCopy;
+                mqtt_client->topicAliases[index].topicLength = topicLength;
+                *isNewMapping = true;
+                result = index + 1;
             }
-            mqttmessage_destroy(msgHandle);
         }
 
-        if (trace_log != NULL)
+        if (result != 0)
         {
-            STRING_delete(trace_log);
+            mqtt_client->topicAliases[result - 1].lastUsed = ++mqtt_client->topicAliasClock;
         }
-
-        free(topicName);
     }
+    return result;
 }
 
-static void recvCompleteCallback(void* context, CONTROL_PACKET_TYPE packet, int flags, BUFFER_HANDLE headerData)
+static void forgetTopicAlias(MQTT_CLIENT* mqtt_client, uint16_t alias)
 {
-    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
-    if (mqtt_client != NULL)
+    // The mapping never reached the server, drop it so the topic is sent in full next time
+    TOPIC_ALIAS_ENTRY* entry = &mqtt_client->topicAliases[alias - 1];
+    free(entry->topicName);
+    entry->topicName = NULL;
+    entry->topicLength = 0;
+    entry->lastUsed = 0;
+}
+
+static void resetInboundTopicAliases(MQTT_CLIENT* mqtt_client)
+{
+    if (mqtt_client->inboundAliases != NULL)
     {
-        size_t packetLength = 0;
-        uint8_t* iterator = NULL;
-        if (headerData != NULL)
-        {
-            packetLength = BUFFER_length(headerData);
-            iterator = BUFFER_u_char(headerData);
-        }
+        free(mqtt_client->inboundAliases);
+        mqtt_client->inboundAliases = NULL;
+    }
+    if (mqtt_client->inboundAliasArena != NULL)
+    {
+        free(mqtt_client->inboundAliasArena);
+        mqtt_client->inboundAliasArena = NULL;
+    }
+    mqtt_client->inboundArenaSize = 0;
+    mqtt_client->inboundArenaUsed = 0;
+    mqtt_client->inboundArenaLive = 0;
+}
 
-#ifdef ENABLE_RAW_TRACE
-        logIncomingRawTrace(mqtt_client, packet, (uint8_t)flags, iterator, packetLength);
-#endif
-        if ((iterator != NULL && packetLength > 0) || packet == PINGRESP_TYPE)
+static int compactInboundAliasArena(MQTT_CLIENT* mqtt_client, size_t needed)
+{
+    int result;
+    // Copy the live topics to a new arena with room to spare, so remapped aliases
+    // only cost an allocation once the arena fills up with stale topics
+    size_t arenaSize = (mqtt_client->inboundArenaLive + needed) * 2;
+    char* arena = (char*)malloc(arenaSize);
+    if (arena == NULL)
+    {
+        LogError("Failure allocating inbound topic alias arena");
+        result = __FAILURE__;
+    }
+    else
+    {
+        size_t used = 0;
+        uint16_t index;
+        for (index = 0; index < mqtt_client->mqttOptions.topicAliasMaximum; index++)
         {
-            switch (packet)
+            INBOUND_TOPIC_ALIAS* entry = &mqtt_client->inboundAliases[index];
+            if (entry->length != 0)
             {
-                case CONNACK_TYPE:
-                {
-                    /*Codes_SRS_MQTT_CLIENT_07_028: [If the actionResult parameter is of type CONNECT_ACK then the msgInfo value shall be a CONNECT_ACK structure.]*/
-                    CONNECT_ACK connack = { 0 };
-                    connack.isSessionPresent = (byteutil_readByte(&iterator) == 0x1) ? true : false;
-                    uint8_t rc = byteutil_readByte(&iterator);
-                    connack.returnCode =
-                        (rc < ((uint8_t)CONN_REFUSED_UNKNOWN)) ?
-                        (CONNECT_RETURN_CODE)rc : CONN_REFUSED_UNKNOWN;
-
-#ifndef NO_LOGGING
-                    if (mqtt_client->logTrace)
-                    {
-                        STRING_HANDLE trace_log = STRING_construct_sprintf("CONNACK | SESSION_PRESENT: %s | RETURN_CODE: 0x%x", connack.isSessionPresent ? TRUE_CONST : FALSE_CONST, connack.returnCode);
-                        log_incoming_trace(mqtt_client, trace_log);
-                        STRING_delete(trace_log);
-                    }
-#endif
-                    mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_CONNACK, (void*)&connack, mqtt_client->ctx);
-
-                    if (connack.returnCode == CONNECTION_ACCEPTED)
-                    {
-                        mqtt_client->clientConnected = true;
-                    }
-                    break;
-                }
-                case PUBLISH_TYPE:
-                {
-                    ProcessPublishMessage(mqtt_client, iterator, packetLength, flags);
-                    break;
-                }
-                case PUBACK_TYPE:
-                case PUBREC_TYPE:
-                case PUBREL_TYPE:
-                case PUBCOMP_TYPE:
-                {
-                    /*Codes_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-                    MQTT_CLIENT_EVENT_RESULT action = (packet == PUBACK_TYPE) ? MQTT_CLIENT_ON_PUBLISH_ACK :
-                        (packet == PUBREC_TYPE) ? MQTT_CLIENT_ON_PUBLISH_RECV :
-                        (packet == PUBREL_TYPE) ? MQTT_CLIENT_ON_PUBLISH_REL : MQTT_CLIENT_ON_PUBLISH_COMP;
-
-                    PUBLISH_ACK publish_ack = { 0 };
-                    publish_ack.packetId = byteutil_read_uint16(&iterator, packetLength);
-
-#ifndef NO_LOGGING
-                    if (mqtt_client->logTrace)
-                    {
-                        STRING_HANDLE trace_log = STRING_construct_sprintf("%s | PACKET_ID: %"PRIu16, packet == PUBACK_TYPE ? "PUBACK" : (packet == PUBREC_TYPE) ? "PUBREC" : (packet == PUBREL_TYPE) ? "PUBREL" : "PUBCOMP",
-                            publish_ack.packetId);
-
-                        log_incoming_trace(mqtt_client, trace_log);
-                        STRING_delete(trace_log);
-                    }
-#endif
-                    BUFFER_HANDLE pubRel = NULL;
-                    mqtt_client->fnOperationCallback(mqtt_client, action, (void*)&publish_ack, mqtt_client->ctx);
-                    if (packet == PUBREC_TYPE)
-                    {
-                        pubRel = mqtt_codec_publishRelease(publish_ack.packetId);
-                        if (pubRel == NULL)
-                        {
-                            LogError("Failed to allocate publish release message.");
-                            set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
-                        }
-                    }
-                    else if (packet == PUBREL_TYPE)
-                    {
-                        pubRel = mqtt_codec_publishComplete(publish_ack.packetId);
-                        if (pubRel == NULL)
-                        {
-                            LogError("Failed to allocate publish complete message.");
-                            set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
-                        }
-                    }
-                    if (pubRel != NULL)
-                    {
-                        size_t size = BUFFER_length(pubRel);
-                        (void)sendPacketItem(mqtt_client, BUFFER_u_char(pubRel), size);
-                        BUFFER_delete(pubRel);
-                    }
-                    break;
-                }
-                case SUBACK_TYPE:
-                {
-
-                    /*Codes_SRS_MQTT_CLIENT_07_030: [If the actionResult parameter is of type SUBACK_TYPE then the msgInfo value shall be a SUBSCRIBE_ACK structure.]*/
-                    SUBSCRIBE_ACK suback = { 0 };
-
-                    size_t remainLen = packetLength;
-                    suback.packetId = byteutil_read_uint16(&iterator, packetLength);
-                    remainLen -= 2;
-
-#ifndef NO_LOGGING
-                    STRING_HANDLE trace_log = NULL;
-                    if (mqtt_client->logTrace)
-                    {
-                        trace_log = STRING_construct_sprintf("SUBACK | PACKET_ID: %"PRIu16, suback.packetId);
-                    }
-#endif
-                    // Allocate the remaining len
-                    suback.qosReturn = (QOS_VALUE*)malloc(sizeof(QOS_VALUE)*remainLen);
-                    if (suback.qosReturn != NULL)
-                    {
-                        while (remainLen > 0)
-                        {
-                            uint8_t qosRet = byteutil_readByte(&iterator);
-                            suback.qosReturn[suback.qosCount++] =
-                                (qosRet <= ((uint8_t)DELIVER_EXACTLY_ONCE)) ?
-                                (QOS_VALUE)qosRet :  DELIVER_FAILURE;
-                            remainLen--;
-#ifndef NO_LOGGING
-                            if (mqtt_client->logTrace)
-                            {
-                                STRING_sprintf(trace_log, " | RETURN_CODE: %"PRIu16, suback.qosReturn[suback.qosCount-1]);
-                            }
-#endif
-                        }
-
-#ifndef NO_LOGGING
-                        if (mqtt_client->logTrace)
-                        {
-                            log_incoming_trace(mqtt_client, trace_log);
-                            STRING_delete(trace_log);
-                        }
-#endif
-                        mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_SUBSCRIBE_ACK, (void*)&suback, mqtt_client->ctx);
-                        free(suback.qosReturn);
-                    }
-                    else
-                    {
-                        LogError("allocation of quality of service value failed.");
-                        set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
-                    }
-                    break;
-                }
-                case UNSUBACK_TYPE:
-                {
-                    /*Codes_SRS_MQTT_CLIENT_07_031: [If the actionResult parameter is of type UNSUBACK_TYPE then the msgInfo value shall be a UNSUBSCRIBE_ACK structure.]*/
-                    UNSUBSCRIBE_ACK unsuback = { 0 };
-                    unsuback.packetId = byteutil_read_uint16(&iterator, packetLength);
-
-#ifndef NO_LOGGING
-                    if (mqtt_client->logTrace)
-                    {
-                        STRING_HANDLE trace_log = STRING_construct_sprintf("UNSUBACK | PACKET_ID: %"PRIu16, unsuback.packetId);
-                        log_incoming_trace(mqtt_client, trace_log);
-                        STRING_delete(trace_log);
-                    }
-#endif
-                    mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_UNSUBSCRIBE_ACK, (void*)&unsuback, mqtt_client->ctx);
-                    break;
-                }
-                case PINGRESP_TYPE:
-                    mqtt_client->timeSincePing = 0;
-#ifndef NO_LOGGING
-                    if (mqtt_client->logTrace)
-                    {
-                        STRING_HANDLE trace_log = STRING_construct_sprintf("PINGRESP");
-                        log_incoming_trace(mqtt_client, trace_log);
-                        STRING_delete(trace_log);
-                    }
-#endif
-                    // Forward ping response to operation callback
-                    mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_PING_RESPONSE, NULL, mqtt_client->ctx);
-                    break;
-                default:
-                    break;
+                (void)memcpy(arena + used, mqtt_client->inboundAliasArena + entry->offset, entry->length + 1);
+                entry->offset = used;
+                used += entry->length + 1;
             }
         }
+        if (mqtt_client->inboundAliasArena != NULL)
+        {
+            free(mqtt_client->inboundAliasArena);
+        }
+        mqtt_client->inboundAliasArena = arena;
+        mqtt_client->inboundArenaSize = arenaSize;
+        mqtt_client->inboundArenaUsed = used;
+        result = 0;
     }
-    else
-    {
-        LogError("recvCompleteCallback context failed.");
-    }
+    return result;
 }
 
-MQTT_CLIENT_HANDLE mqtt_client_init(ON_MQTT_MESSAGE_RECV_CALLBACK msgRecv, ON_MQTT_OPERATION_CALLBACK operation_cb, void* opCallbackCtx, ON_MQTT_ERROR_CALLBACK onErrorCallBack, void* errorCBCtx)
+static int storeInboundTopicAlias(MQTT_CLIENT* mqtt_client, uint16_t alias, const char* topicName, size_t topicLength)
 {
-    MQTT_CLIENT* result;
-    /*Codes_SRS_MQTT_CLIENT_07_001: [If the parameters ON_MQTT_MESSAGE_RECV_CALLBACK is NULL then mqttclient_init shall return NULL.]*/
-    if (msgRecv == NULL || operation_cb == NULL)
+    int result;
+    if (mqtt_client->inboundAliases == NULL)
     {
-        LogError("Invalid parameter specified msgRecv: %p, operation_cb: %p", msgRecv, operation_cb);
-        result = NULL;
+        size_t tableSize = mqtt_client->mqttOptions.topicAliasMaximum * sizeof(INBOUND_TOPIC_ALIAS);
+        if ((mqtt_client->inboundAliases = (INBOUND_TOPIC_ALIAS*)malloc(tableSize)) != NULL)
+        {
+            memset(mqtt_client->inboundAliases, 0, tableSize);
+        }
+    }
+
+    if (mqtt_client->inboundAliases == NULL)
+    {
+        LogError("Failure allocating inbound topic alias table");
+        result = __FAILURE__;
     }
     else
     {
-        result = malloc(sizeof(MQTT_CLIENT));
-        if (result == NULL)
+        INBOUND_TOPIC_ALIAS* entry = &mqtt_client->inboundAliases[alias - 1];
+        if (entry->length == topicLength && memcmp(mqtt_client->inboundAliasArena + entry->offset, topicName, topicLength) == 0)
         {
-            /*Codes_SRS_MQTT_CLIENT_07_002: [If any failure is encountered then mqttclient_init shall return NULL.]*/
-            LogError("mqtt_client_init failure: Allocation Failure");
+            // The server repeated the current mapping
+            result = 0;
         }
         else
         {
-            memset(result, 0, sizeof(MQTT_CLIENT));
-            /*Codes_SRS_MQTT_CLIENT_07_003: [mqttclient_init shall allocate MQTTCLIENT_DATA_INSTANCE and return the MQTTCLIENT_HANDLE on success.]*/
-            result->packetState = UNKNOWN_TYPE;
-            result->fnOperationCallback = operation_cb;
-            result->ctx = opCallbackCtx;
-            result->fnMessageRecv = msgRecv;
-            result->fnOnErrorCallBack = onErrorCallBack;
-            result->errorCBCtx = errorCBCtx;
-            result->qosValue = DELIVER_AT_MOST_ONCE;
-            result->packetTickCntr = tickcounter_create();
-            result->maxPingRespTime = DEFAULT_MAX_PING_RESPONSE_TIME;
-            if (result->packetTickCntr == NULL)
+            size_t needed = topicLength + 1;
+            if (entry->length != 0)
             {
-                /*Codes_SRS_MQTT_CLIENT_07_002: [If any failure is encountered then mqttclient_init shall return NULL.]*/
-                LogError("mqtt_client_init failure: tickcounter_create failure");
-                free(result);
-                result = NULL;
+                mqtt_client->inboundArenaLive -= entry->length + 1;
+                entry->length = 0;
+            }
+
+            if (mqtt_client->inboundArenaUsed + needed > mqtt_client->inboundArenaSize && compactInboundAliasArena(mqtt_client, needed) != 0)
+            {
+                result = __FAILURE__;
             }
             else
             {
-                result->codec_handle = mqtt_codec_create(recvCompleteCallback, result);
-                if (result->codec_handle == NULL)
-                {
-                    /*Codes_SRS_MQTT_CLIENT_07_002: [If any failure is encountered then mqttclient_init shall return NULL.]*/
-                    LogError("mqtt_client_init failure: mqtt_codec_create failure");
+                (void)memcpy(mqtt_client->inboundAliasArena + mqtt_client->inboundArenaUsed, topicName, needed);
+                entry->offset = mqtt_client->inboundArenaUsed;
+                entry->length = topicLength;
+                mqtt_client->inboundArenaUsed += needed;
+                mqtt_client->inboundArenaLive += needed;
+                result = 0;
+            }
+        }
+    }
+    return result;
+}
+
+static const char* resolveInboundTopicAlias(MQTT_CLIENT* mqtt_client, uint16_t alias, const char* topicName, size_t topicLength)
+{
+    const char* result;
+    if (alias == 0 || alias > mqtt_client->mqttOptions.topicAliasMaximum)
+    {
+        LogError("Publish MSG: topic alias %u is out of range", (unsigned int)alias);
+        result = NULL;
+    }
+    else if (topicName == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_073: [A PUBLISH with an empty topic shall be delivered with the topic mapped to its alias, without copying the topic.]*/
+        const INBOUND_TOPIC_ALIAS* entry = (mqtt_client->inboundAliases == NULL) ? NULL : &mqtt_client->inboundAliases[alias - 1];
+        result = (entry == NULL || entry->length == 0) ? NULL : mqtt_client->inboundAliasArena + entry->offset;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_072: [In MQTT 5.0 mode a PUBLISH carrying both a topic and a topic alias shall map the alias to the topic for the rest of the connection.]*/
+        if (storeInboundTopicAlias(mqtt_client, alias, topicName, topicLength) != 0)
+        {
+            LogError("Publish MSG: failure storing topic alias %u", (unsigned int)alias);
+        }
+        result = topicName;
+    }
+    return result;
+}
+
+static size_t getRemainingLengthSize(size_t remainingLength)
+{
+    return (remainingLength < 128) ? 1 : (remainingLength < 16384) ? 2 : (remainingLength < 2097152) ? 3 : 4;
+}
+
+// '+' matches one topic level and a trailing '#' the rest, wildcards do not match topics starting with '$'
+static bool isTopicFilterMatch(const char* topicFilter, const char* topicName)
+{
+    bool result;
+    if (topicName[0] == '$' && (topicFilter[0] == '+' || topicFilter[0] == '#'))
+    {
+        result = false;
+    }
+    else
+    {
+        bool matching = true;
+        result = false;
+        while (matching && !result)
+        {
+            if (*topicFilter == '\0')
+            {
+                result = (*topicName == '\0');
+                matching = false;
+            }
+            else if (*topicFilter == '#' || (*topicName == '\0' && strcmp(topicFilter, "/#") == 0))
+            {
+                result = true;
+            }
+            else if (*topicFilter == '+')
+            {
+                while (*topicName != '\0' && *topicName != '/')
+                {
+                    topicName++;
+                }
+                topicFilter++;
+            }
+            else if (*topicFilter == *topicName)
+            {
+                topicFilter++;
+                topicName++;
+            }
+            else
+            {
+                matching = false;
+            }
+        }
+    }
+    return result;
+}
+
+static const MQTT_PAYLOAD_TRANSFORM* findTransformByTopic(const MQTT_CLIENT* mqtt_client, const char* topicName)
+{
+    const MQTT_PAYLOAD_TRANSFORM* result = NULL;
+    size_t index;
+    for (index = 0; index < mqtt_client->payloadTransformCount && result == NULL; index++)
+    {
+        if (isTopicFilterMatch(mqtt_client->payloadTransforms[index].topicFilter, topicName))
+        {
+            result = mqtt_client->payloadTransforms[index].transform;
+        }
+    }
+    return result;
+}
+
+static const MQTT_PAYLOAD_TRANSFORM* findTransformByContentType(const MQTT_CLIENT* mqtt_client, const MQTT_PROPERTY_DATA* contentType)
+{
+    const MQTT_PAYLOAD_TRANSFORM* result = NULL;
+    size_t index;
+    for (index = 0; index < mqtt_client->payloadTransformCount && result == NULL; index++)
+    {
+        const char* transformType = mqtt_client->payloadTransforms[index].transform->contentType;
+        if (strlen(transformType) == contentType->length && memcmp(transformType, contentType->data, contentType->length) == 0)
+        {
+            result = mqtt_client->payloadTransforms[index].transform;
+        }
+    }
+    return result;
+}
+
+// Grows a buffer of the client that is kept from one message to the next, its content is not preserved
+static int reserveTransformBuffer(uint8_t** buffer, size_t* bufferSize, size_t size)
+{
+    int result;
+    if (size <= *bufferSize)
+    {
+        result = 0;
+    }
+    else
+    {
+        uint8_t* grown = (uint8_t*)malloc(size);
+        if (grown == NULL)
+        {
+            LogError("Failure allocating transform buffer of %lu bytes", (unsigned long)size);
+            result = __FAILURE__;
+        }
+        else
+        {
+            if (*buffer != NULL)
+            {
+                free(*buffer);
+            }
+            *buffer = grown;
+            *bufferSize = size;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+// A transformed payload starts with its decoded length, encoded like the MQTT remaining length
+static size_t writeTransformHeader(uint8_t* iterator, size_t length)
+{
+    size_t result = 0;
+    do
+    {
+        uint8_t encode = (uint8_t)(length % 128);
+        length /= 128;
+        if (length > 0)
+        {
+            encode |= NEXT_128_CHUNK;
+        }
+        iterator[result++] = encode;
+    } while (length > 0);
+    return result;
+}
+
+static int readTransformHeader(const uint8_t* payload, size_t length, size_t* decodedLength, size_t* headerSize)
+{
+    int result = __FAILURE__;
+    size_t multiplier = 1;
+    size_t index = 0;
+    *decodedLength = 0;
+    while (index < length && index < MAX_TRANSFORM_HEADER_SIZE)
+    {
+        uint8_t encode = payload[index++];
+        *decodedLength += (size_t)(encode & 0x7F) * multiplier;
+        multiplier *= 128;
+        if ((encode & NEXT_128_CHUNK) == 0)
+        {
+            *headerSize = index;
+            result = 0;
+            break;
+        }
+    }
+    return result;
+}
+
+static int encodeTransformedPayload(MQTT_CLIENT* mqtt_client, const MQTT_PAYLOAD_TRANSFORM* transform, const APP_PAYLOAD* payload, APP_PAYLOAD* encoded, bool* isTransformed)
+{
+    int result;
+    size_t headerSize = getRemainingLengthSize(payload->length);
+    size_t bound = transform->getEncodedBound(payload->length);
+    size_t encodedLength;
+    if (payload->length > MAX_REMAINING_LENGTH)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_115: [mqtt_client_publish shall return a non-zero value for a payload to transform that is larger than 268435455 bytes, the largest length its header can hold.]*/
+        LogError("Error: payload of %lu bytes is too large to transform", (unsigned long)payload->length);
+        result = __FAILURE__;
+    }
+    else if (reserveTransformBuffer(&mqtt_client->encodeBuffer, &mqtt_client->encodeBufferSize, headerSize + (bound > payload->length ? bound : payload->length)) != 0)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        uint8_t* buffer = mqtt_client->encodeBuffer;
+        // The content type property, its identifier and length come on top of the payload in MQTT 5.0 mode
+        size_t overhead = headerSize + (isProtocolV5(mqtt_client) ? 3 + strlen(transform->contentType) : 0);
+        (void)writeTransformHeader(buffer, payload->length);
+        *isTransformed = transform->encode(payload->message, payload->length, buffer + headerSize, mqtt_client->encodeBufferSize - headerSize, &encodedLength) == 0 &&
+            overhead + encodedLength < payload->length;
+        if (*isTransformed)
+        {
+            encoded->message = buffer;
+            encoded->length = headerSize + encodedLength;
+        }
+        else if (isProtocolV5(mqtt_client))
+        {
+            // Without the content type the payload goes out as it is
+            *encoded = *payload;
+        }
+        else
+        {
+            // Without a content type the topic is the flag, the payload is stored after its length
+            if (payload->length > 0)
+            {
+                (void)memcpy(buffer + headerSize, payload->message, payload->length);
+            }
+            encoded->message = buffer;
+            encoded->length = headerSize + payload->length;
+        }
+        result = 0;
+    }
+    return result;
+}
+
+static int decodeTransformedPayload(MQTT_CLIENT* mqtt_client, const MQTT_PAYLOAD_TRANSFORM* transform, uint8_t** payload, size_t* length)
+{
+    int result;
+    size_t decodedLength;
+    size_t headerSize;
+    // The length comes from the peer, it is checked before a buffer of that size is allocated
+    size_t maxDecodedLength = (mqtt_client->mqttOptions.maximumPacketSize != 0) ? mqtt_client->mqttOptions.maximumPacketSize :
+        (transform->maxDecodedLength != 0) ? transform->maxDecodedLength : DEFAULT_MAX_DECODED_LENGTH;
+    if (readTransformHeader(*payload, *length, &decodedLength, &headerSize) != 0)
+    {
+        LogError("Publish MSG: malformed transform header");
+        result = __FAILURE__;
+    }
+    else if (decodedLength > maxDecodedLength)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_114: [A transformed payload whose decoded length is larger than the maximumPacketSize of MQTT_CLIENT_OPTIONS, or when it is 0 than the maxDecodedLength of the transform, shall not be decoded.]*/
+        LogError("Publish MSG: decoded payload of %lu bytes exceeds %lu bytes", (unsigned long)decodedLength, (unsigned long)maxDecodedLength);
+        result = __FAILURE__;
+    }
+    else if (*length - headerSize == decodedLength)
+    {
+        // Stored, it did not shrink
+        *payload += headerSize;
+        *length = decodedLength;
+        result = 0;
+    }
+    else if (reserveTransformBuffer(&mqtt_client->decodeBuffer, &mqtt_client->decodeBufferSize, decodedLength) != 0)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        size_t actualLength;
+        if (transform->decode(*payload + headerSize, *length - headerSize, mqtt_client->decodeBuffer, decodedLength, &actualLength) != 0 || actualLength != decodedLength)
+        {
+            LogError("Publish MSG: failure decoding payload of %lu bytes", (unsigned long)decodedLength);
+            result = __FAILURE__;
+        }
+        else
+        {
+            *payload = mqtt_client->decodeBuffer;
+            *length = decodedLength;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+static void clearPayloadTransforms(MQTT_CLIENT* mqtt_client)
+{
+    if (mqtt_client->payloadTransforms != NULL)
+    {
+        size_t index;
+        for (index = 0; index < mqtt_client->payloadTransformCount; index++)
+        {
+            free(mqtt_client->payloadTransforms[index].topicFilter);
+        }
+        free(mqtt_client->payloadTransforms);
+        mqtt_client->payloadTransforms = NULL;
+        mqtt_client->payloadTransformCount = 0;
+    }
+    if (mqtt_client->encodeBuffer != NULL)
+    {
+        free(mqtt_client->encodeBuffer);
+        mqtt_client->encodeBuffer = NULL;
+        mqtt_client->encodeBufferSize = 0;
+    }
+    if (mqtt_client->decodeBuffer != NULL)
+    {
+        free(mqtt_client->decodeBuffer);
+        mqtt_client->decodeBuffer = NULL;
+        mqtt_client->decodeBufferSize = 0;
+    }
+}
+
+static CONNECT_RETURN_CODE getConnectReturnCode(uint8_t reasonCode)
+{
+    CONNECT_RETURN_CODE result;
+    switch (reasonCode)
+    {
+        case MQTT_REASON_SUCCESS: result = CONNECTION_ACCEPTED; break;
+        case MQTT_REASON_UNSUPPORTED_PROTOCOL_VERSION: result = CONN_REFUSED_UNACCEPTABLE_VERSION; break;
+        case MQTT_REASON_CLIENT_IDENTIFIER_NOT_VALID: result = CONN_REFUSED_ID_REJECTED; break;
+        case MQTT_REASON_SERVER_UNAVAILABLE:
+        case MQTT_REASON_SERVER_BUSY: result = CONN_REFUSED_SERVER_UNAVAIL; break;
+        case MQTT_REASON_BAD_USER_NAME_OR_PASSWORD: result = CONN_REFUSED_BAD_USERNAME_PASSWORD; break;
+        case MQTT_REASON_NOT_AUTHORIZED: result = CONN_REFUSED_NOT_AUTHORIZED; break;
+        default: result = CONN_REFUSED_UNKNOWN; break;
+    }
+    return result;
+}
+
+static BUFFER_HANDLE encodeSubscribePacket(MQTT_CLIENT* mqtt_client, uint16_t packetId, SUBSCRIBE_PAYLOAD* subscribeList, size_t count, STRING_HANDLE trace_log)
+{
+    return isProtocolV5(mqtt_client) ? mqtt_codec_subscribe_v5(packetId, subscribeList, count, trace_log) : mqtt_codec_subscribe(packetId, subscribeList, count, trace_log);
+}
+
+static void buildPublishReply(uint8_t reply[MQTT_PUBLISH_REPLY_SIZE], const uint8_t* replyTemplate, uint16_t packetId)
+{
+    /*Codes_SRS_MQTT_CLIENT_07_102: [The PUBACK, PUBREC, PUBREL and PUBCOMP packets shall be built from the constant templates of mqtt_codec by setting their packet id, without allocating.]*/
+    (void)memcpy(reply, replyTemplate, MQTT_PUBLISH_REPLY_SIZE);
+    MQTT_SET_REPLY_PACKET_ID(reply, packetId);
+}
+
+static int sendPublishReply(MQTT_CLIENT* mqtt_client, const uint8_t* replyTemplate, uint16_t packetId)
+{
+    uint8_t reply[MQTT_PUBLISH_REPLY_SIZE];
+    buildPublishReply(reply, replyTemplate, packetId);
+    return sendPacketItem(mqtt_client, reply, MQTT_PUBLISH_REPLY_SIZE);
+}
+
+static void sendPublishAcknowledgement(MQTT_CLIENT* mqtt_client, QOS_VALUE qosValue, uint16_t packetId)
+{
+    if (qosValue == DELIVER_EXACTLY_ONCE || qosValue == DELIVER_AT_LEAST_ONCE)
+    {
+        uint8_t reply[MQTT_PUBLISH_REPLY_SIZE];
+        buildPublishReply(reply, (qosValue == DELIVER_EXACTLY_ONCE) ? MQTT_PUBREC_TEMPLATE : MQTT_PUBACK_TEMPLATE, packetId);
+        if (!mqtt_client->batchingAcks || queueAcknowledgement(mqtt_client, reply, MQTT_PUBLISH_REPLY_SIZE) != 0)
+        {
+            (void)sendPacketItem(mqtt_client, reply, MQTT_PUBLISH_REPLY_SIZE);
+        }
+    }
+}
+
+static MQTT_ACK_TOKEN makeAckToken(MQTT_CLIENT* mqtt_client, QOS_VALUE qosValue, uint16_t packetId)
+{
+    MQTT_ACK_TOKEN result;
+    if (qosValue == DELIVER_AT_MOST_ONCE)
+    {
+        result = 0;
+    }
+    else
+    {
+        result = ((MQTT_ACK_TOKEN)mqtt_client->connectionEpoch << 32) | ((MQTT_ACK_TOKEN)qosValue << 16) | packetId;
+    }
+    return result;
+}
+
+static void sendManualAcknowledgements(MQTT_CLIENT* mqtt_client)
+{
+    VECTOR_HANDLE tokens = NULL;
+    if (Lock(mqtt_client->manualAckLock) != LOCK_OK)
+    {
+        LogError("Failure locking the manual acknowledgements");
+    }
+    else
+    {
+        // The tokens are swapped out so that mqtt_client_ack does not wait for the sends
+        if (VECTOR_size(mqtt_client->manualAcks) > 0)
+        {
+            tokens = mqtt_client->manualAcks;
+            mqtt_client->manualAcks = mqtt_client->drainingAcks;
+            mqtt_client->drainingAcks = tokens;
+        }
+        (void)Unlock(mqtt_client->manualAckLock);
+    }
+
+    if (tokens != NULL)
+    {
+        size_t count = VECTOR_size(tokens);
+        size_t index;
+        mqtt_client->batchingAcks = true;
+        for (index = 0; index < count; index++)
+        {
+            MQTT_ACK_TOKEN token = *(MQTT_ACK_TOKEN*)VECTOR_element(tokens, index);
+            /*Codes_SRS_MQTT_CLIENT_07_099: [The acknowledgement of a token from a previous connection shall be dropped, the server sends that publish again.]*/
+            if ((uint32_t)(token >> 32) == mqtt_client->connectionEpoch)
+            {
+                sendPublishAcknowledgement(mqtt_client, (QOS_VALUE)((token >> 16) & 0xff), (uint16_t)token);
+            }
+        }
+        mqtt_client->batchingAcks = false;
+        VECTOR_clear(tokens);
+
+        if (mqtt_client->maxAckDelayMs == 0)
+        {
+            flushAcknowledgements(mqtt_client);
+        }
+    }
+}
+
+static void ProcessPublishMessage(MQTT_CLIENT* mqtt_client, uint8_t* initialPos, size_t packetLength, int flags, bool isStreamed)
+{
+    bool isDuplicateMsg = (flags & DUPLICATE_FLAG_MASK) ? true : false;
+    bool isRetainMsg = (flags & RETAIN_FLAG_MASK) ? true : false;
+    QOS_VALUE qosValue = (flags == 0) ? DELIVER_AT_MOST_ONCE : (flags & QOS_LEAST_ONCE_FLAG_MASK) ? DELIVER_AT_LEAST_ONCE : DELIVER_EXACTLY_ONCE;
+
+    uint8_t* iterator = initialPos;
+    size_t numberOfBytesToBeRead = packetLength;
+    size_t lengthOfTopicName = numberOfBytesToBeRead;
+    char* topicName = NULL;
+    bool isAliasedTopic = false;
+    if (isProtocolV5(mqtt_client) && packetLength >= 2 && initialPos[0] == 0 && initialPos[1] == 0)
+    {
+        // An empty topic name is resolved from the topic alias property
+        iterator += 2;
+        lengthOfTopicName = 0;
+        isAliasedTopic = true;
+    }
+    else
+    {
+        topicName = byteutil_readUTF(&iterator, &lengthOfTopicName);
+    }
+
+    if (topicName == NULL && !isAliasedTopic)
+    {
+        LogError("Publish MSG: failure reading topic name");
+        set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
+    }
+    else
+    {
+        STRING_HANDLE trace_log = NULL;
+        const char* topicView = topicName;
+
+#ifndef NO_LOGGING
+        if (mqtt_client->logTrace)
+        {
+            trace_log = STRING_construct_sprintf("PUBLISH | IS_DUP: %s | RETAIN: %d | QOS: %s | TOPIC_NAME: %s", isDuplicateMsg ? TRUE_CONST : FALSE_CONST,
+                isRetainMsg ? 1 : 0, ENUM_TO_STRING(QOS_VALUE, qosValue), (topicName != NULL) ? topicName : "");
+        }
+#endif
+        uint16_t packetId = 0;
+        numberOfBytesToBeRead = packetLength - (iterator - initialPos);
+        if (qosValue != DELIVER_AT_MOST_ONCE)
+        {
+            packetId = byteutil_read_uint16(&iterator, numberOfBytesToBeRead);
+#ifndef NO_LOGGING
+            if (mqtt_client->logTrace)
+            {
+                STRING_sprintf(trace_log, " | PACKET_ID: %"PRIu16, packetId);
+            }
+#endif
+        }
+        bool isValidProperties = true;
+        const MQTT_PAYLOAD_TRANSFORM* transform = NULL;
+        if (isProtocolV5(mqtt_client))
+        {
+            MQTT_PROPERTIES properties;
+            size_t propertiesSize = 0;
+            numberOfBytesToBeRead = packetLength - (iterator - initialPos);
+            /*Codes_SRS_MQTT_CLIENT_07_064: [In MQTT 5.0 mode the client shall skip the property list of an incoming PUBLISH before the payload, a malformed list shall be reported as MQTT_CLIENT_PARSE_ERROR.]*/
+            if (mqtt_codec_decode_properties(iterator, numberOfBytesToBeRead, &properties, &propertiesSize) != 0)
+            {
+                isValidProperties = false;
+            }
+            else
+            {
+                iterator += propertiesSize;
+                if (MQTT_PROPERTY_IS_SET(&properties, MQTT_PROPERTY_TOPIC_ALIAS))
+                {
+#ifndef NO_LOGGING
+                    if (mqtt_client->logTrace)
+                    {
+                        STRING_sprintf(trace_log, " | TOPIC_ALIAS: %"PRIu16, properties.topicAlias);
+                    }
+#endif
+                    topicView = resolveInboundTopicAlias(mqtt_client, properties.topicAlias, topicName, lengthOfTopicName);
+                }
+                if (mqtt_client->payloadTransformCount > 0 && MQTT_PROPERTY_IS_SET(&properties, MQTT_PROPERTY_CONTENT_TYPE))
+                {
+                    transform = findTransformByContentType(mqtt_client, &properties.contentType);
+                }
+            }
+        }
+        else if (mqtt_client->payloadTransformCount > 0)
+        {
+            transform = findTransformByTopic(mqtt_client, topicView);
+        }
+
+        numberOfBytesToBeRead = packetLength - (iterator - initialPos);
+        uint8_t* payloadView = iterator;
+        size_t payloadLength = numberOfBytesToBeRead;
+
+        if ((qosValue != DELIVER_AT_MOST_ONCE) && (packetId == 0))
+        {
+            LogError("Publish MSG: packetId=0, invalid");
+            set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
+        }
+        else if (!isValidProperties)
+        {
+            LogError("Publish MSG: invalid properties");
+            set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
+        }
+        else if (topicView == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_074: [A topic alias that is out of range or was never mapped shall be reported as MQTT_CLIENT_PARSE_ERROR.]*/
+            LogError("Publish MSG: unknown topic alias");
+            set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
+        }
+        else if (transform != NULL && !isStreamed && decodeTransformedPayload(mqtt_client, transform, &payloadView, &payloadLength) != 0)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_110: [A transformed payload that cannot be decoded shall be reported as MQTT_CLIENT_PARSE_ERROR and the message shall not be delivered.]*/
+            set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
+        }
+        else
+        {
+            // A streamed message keeps its own copy of the topic, the header it was read from goes away before the payload arrives
+            /*Codes_SRS_MQTT_CLIENT_07_109: [A PUBLISH flagged with the content type of a transform in MQTT 5.0 mode, or received on a topic matching the filter of a transform in MQTT 3.1.1 mode, shall be delivered with its payload decoded into a buffer of the client.]*/
+            MQTT_MESSAGE_HANDLE msgHandle = isStreamed ? mqttmessage_create(packetId, topicView, qosValue, NULL, 0) :
+                mqttmessage_create_in_place(packetId, topicView, qosValue, payloadView, payloadLength);
+            if (msgHandle == NULL)
+            {
+                LogError("failure in mqttmessage_create");
+                set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+            }
+            else if (mqttmessage_setIsDuplicateMsg(msgHandle, isDuplicateMsg) != 0 ||
+                     mqttmessage_setIsRetained(msgHandle, isRetainMsg) != 0)
+            {
+                LogError("failure setting mqtt message property");
+                set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+            }
+            else
+            {
+#ifndef NO_LOGGING
+                if (mqtt_client->logTrace)
+                {
+                    STRING_sprintf(trace_log, " | PAYLOAD_LEN: %lu", (unsigned long)(isStreamed ? mqtt_client->streamLength : numberOfBytesToBeRead));
+                    log_incoming_trace(mqtt_client, trace_log);
+                }
+#endif
+                if (isStreamed)
+                {
+                    // The message outlives this call, its payload follows in chunks
+                    mqtt_client->streamMessage = msgHandle;
+                    msgHandle = NULL;
+                }
+                else if (mqtt_client->fnMessageRecvAck != NULL)
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_097: [In manual acknowledgement mode the ON_MQTT_MESSAGE_RECV_ACK_CALLBACK shall be called with the ack token of the message instead of the ON_MQTT_MESSAGE_RECV_CALLBACK and no PUBACK or PUBREC shall be sent.]*/
+                    mqtt_client->fnMessageRecvAck(msgHandle, makeAckToken(mqtt_client, qosValue, packetId), mqtt_client->recvAckCtx);
+                }
+                else
+                {
+                    mqtt_client->fnMessageRecv(msgHandle, mqtt_client->ctx);
+                    sendPublishAcknowledgement(mqtt_client, qosValue, packetId);
+                }
+            }
+            mqttmessage_destroy(msgHandle);
+        }
+
+        if (trace_log != NULL)
+        {
+            STRING_delete(trace_log);
+        }
+
+        if (topicName != NULL)
+        {
+            free(topicName);
+        }
+    }
+}
+
+static void discardMessageStream(MQTT_CLIENT* mqtt_client)
+{
+    // A stream cut short by a lost connection ends without its final chunk
+    if (mqtt_client->streamMessage != NULL)
+    {
+        mqttmessage_destroy(mqtt_client->streamMessage);
+        mqtt_client->streamMessage = NULL;
+    }
+}
+
+static void onPublishStream(void* context, int flags, BUFFER_HANDLE headerData, size_t payloadLength, const uint8_t* chunk, size_t chunkLength)
+{
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
+    if (mqtt_client != NULL)
+    {
+        if (headerData != NULL)
+        {
+            size_t headerLength = BUFFER_length(headerData);
+            discardMessageStream(mqtt_client);
+            mqtt_client->streamOffset = 0;
+            mqtt_client->streamLength = payloadLength;
+            ProcessPublishMessage(mqtt_client, BUFFER_u_char(headerData), headerLength, flags, true);
+        }
+
+        // An empty payload is reported as a single empty final chunk
+        if (mqtt_client->streamMessage != NULL && (headerData == NULL || payloadLength == 0))
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_082: [For a streamed PUBLISH the chunk callback shall be called for every payload chunk with a message that holds the topic, QoS, packet id and flags of the PUBLISH, the offset of the chunk and the payload length.]*/
+            mqtt_client->fnMessageChunk(mqtt_client->streamMessage, chunk, chunkLength, mqtt_client->streamOffset, mqtt_client->streamLength, mqtt_client->chunkCtx);
+            mqtt_client->streamOffset += chunkLength;
+            if (mqtt_client->streamOffset >= mqtt_client->streamLength)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_083: [The PUBACK or PUBREC of a streamed PUBLISH shall be sent once its final chunk has been delivered.]*/
+                QOS_VALUE qosValue = mqttmessage_getQosType(mqtt_client->streamMessage);
+                uint16_t packetId = mqttmessage_getPacketId(mqtt_client->streamMessage);
+                discardMessageStream(mqtt_client);
+                sendPublishAcknowledgement(mqtt_client, qosValue, packetId);
+            }
+        }
+    }
+}
+
+static int applyInboundLimits(MQTT_CLIENT* mqtt_client, uint32_t previousMaxPacketSize)
+{
+    int result;
+    /*Codes_SRS_MQTT_CLIENT_07_084: [mqtt_client_connect shall reject incoming packets larger than the maximumPacketSize of MQTT_CLIENT_OPTIONS, in 3.1.1 as well as in MQTT 5.0.]*/
+    if (mqtt_client->mqttOptions.maximumPacketSize != previousMaxPacketSize &&
+        mqtt_codec_set_max_packet_size(mqtt_client->codec_handle, mqtt_client->mqttOptions.maximumPacketSize) != 0)
+    {
+        result = __FAILURE__;
+    }
+    // The layout of the PUBLISH header depends on the protocol version of this connection
+    else if (mqtt_client->streamThreshold != 0 &&
+        mqtt_codec_set_publish_stream(mqtt_client->codec_handle, mqtt_client->streamThreshold, isProtocolV5(mqtt_client), onPublishStream) != 0)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+static int sendPublishPacket(MQTT_CLIENT* mqtt_client, BUFFER_HANDLE publishPacket, QOS_VALUE qos, uint16_t packetId)
+{
+    int result;
+    size_t size = BUFFER_length(publishPacket);
+    if (mqtt_client->persistHandle != NULL && qos != DELIVER_AT_MOST_ONCE &&
+        mqtt_persist_append(mqtt_client->persistHandle, packetId, BUFFER_u_char(publishPacket), size) != 0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_044: [If the QoS 1 or 2 PUBLISH packet cannot be persisted then mqtt_client_publish shall return a non-zero value without sending it.]*/
+        LogError("Error: mqtt_persist_append failed");
+        result = __FAILURE__;
+    }
+    else if (sendPacketItem(mqtt_client, BUFFER_u_char(publishPacket), size) != 0)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        if (qos != DELIVER_AT_MOST_ONCE)
+        {
+            mqtt_client->inflightCount++;
+        }
+        result = 0;
+    }
+    return result;
+}
+
+static void removeOfflineHead(MQTT_CLIENT* mqtt_client, LIST_ITEM_HANDLE item)
+{
+    OFFLINE_PUBLISH* offline_publish = (OFFLINE_PUBLISH*)singlylinkedlist_item_get_value(item);
+    mqtt_client->offlineBytes -= BUFFER_length(offline_publish->packet);
+    mqtt_client->offlineCount--;
+    (void)singlylinkedlist_remove(mqtt_client->offlineQueue, item);
+    BUFFER_delete(offline_publish->packet);
+    free(offline_publish);
+}
+
+static void clearOfflineQueue(MQTT_CLIENT* mqtt_client)
+{
+    if (mqtt_client->offlineQueue != NULL)
+    {
+        LIST_ITEM_HANDLE item;
+        while ((item = singlylinkedlist_get_head_item(mqtt_client->offlineQueue)) != NULL)
+        {
+            removeOfflineHead(mqtt_client, item);
+        }
+        singlylinkedlist_destroy(mqtt_client->offlineQueue);
+        mqtt_client->offlineQueue = NULL;
+    }
+}
+
+static bool isOfflineBudgetExceeded(MQTT_CLIENT* mqtt_client, size_t size)
+{
+    return (mqtt_client->offlineOptions.maxMessages > 0 && mqtt_client->offlineCount >= mqtt_client->offlineOptions.maxMessages) ||
+        (mqtt_client->offlineOptions.maxBytes > 0 && mqtt_client->offlineBytes + size > mqtt_client->offlineOptions.maxBytes);
+}
+
+static int enqueueOfflinePublish(MQTT_CLIENT* mqtt_client, BUFFER_HANDLE publishPacket, QOS_VALUE qos, uint16_t packetId)
+{
+    int result;
+    size_t size = BUFFER_length(publishPacket);
+    if (qos == DELIVER_AT_MOST_ONCE && mqtt_client->offlineOptions.discardQos0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_047: [If discardQos0 is set then a QoS 0 publish made while offline shall be discarded and mqtt_client_publish shall return a non-zero value.]*/
+        LogError("Error: discarding QoS 0 publish while offline");
+        result = __FAILURE__;
+    }
+    else
+    {
+        if (mqtt_client->offlineOptions.dropPolicy == MQTT_OFFLINE_DROP_OLDEST)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_048: [With MQTT_OFFLINE_DROP_OLDEST the oldest queued publishes shall be dropped until the new publish fits in the budget.]*/
+            LIST_ITEM_HANDLE item;
+            while (isOfflineBudgetExceeded(mqtt_client, size) && (item = singlylinkedlist_get_head_item(mqtt_client->offlineQueue)) != NULL)
+            {
+                removeOfflineHead(mqtt_client, item);
+            }
+        }
+
+        if (isOfflineBudgetExceeded(mqtt_client, size))
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_049: [If the new publish does not fit in the budget then it shall be dropped and mqtt_client_publish shall return a non-zero value.]*/
+            LogError("Error: offline queue is full, dropping publish");
+            result = __FAILURE__;
+        }
+        else
+        {
+            OFFLINE_PUBLISH* offline_publish = (OFFLINE_PUBLISH*)malloc(sizeof(OFFLINE_PUBLISH));
+            if (offline_publish == NULL)
+            {
+                LogError("Failure allocating offline publish");
+                result = __FAILURE__;
+            }
+            else
+            {
+                offline_publish->packet = publishPacket;
+                offline_publish->qos = qos;
+                offline_publish->packetId = packetId;
+                if (singlylinkedlist_add(mqtt_client->offlineQueue, offline_publish) == NULL)
+                {
+                    LogError("Failure adding offline publish");
+                    free(offline_publish);
+                    result = __FAILURE__;
+                }
+                else
+                {
+                    mqtt_client->offlineBytes += size;
+                    mqtt_client->offlineCount++;
+                    result = 0;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+static void drainOfflineQueue(MQTT_CLIENT* mqtt_client)
+{
+    size_t budget;
+    size_t rate = mqtt_client->offlineOptions.drainRatePerSecond;
+    tickcounter_ms_t current_ms;
+
+    if (rate == 0)
+    {
+        budget = mqtt_client->offlineCount;
+    }
+    else if (tickcounter_get_current_ms(mqtt_client->packetTickCntr, &current_ms) != 0)
+    {
+        LogError("Error: tickcounter_get_current_ms failed");
+        budget = 0;
+    }
+    else
+    {
+        budget = (size_t)(((current_ms - mqtt_client->offlineDrainMs) * rate) / 1000);
+        if (budget >= rate)
+        {
+            // Never burst more than one second worth of publishes
+            budget = rate;
+            mqtt_client->offlineDrainMs = current_ms;
+        }
+        else
+        {
+            mqtt_client->offlineDrainMs += (tickcounter_ms_t)((budget * 1000) / rate);
+        }
+    }
+
+    /*Codes_SRS_MQTT_CLIENT_07_050: [Once the CONNACK is accepted mqtt_client_dowork shall send the queued publishes in order, no more than drainRatePerSecond per second.]*/
+    while (budget > 0)
+    {
+        LIST_ITEM_HANDLE item = singlylinkedlist_get_head_item(mqtt_client->offlineQueue);
+        if (item == NULL)
+        {
+            break;
+        }
+        else
+        {
+            OFFLINE_PUBLISH* offline_publish = (OFFLINE_PUBLISH*)singlylinkedlist_item_get_value(item);
+            if (isInflightWindowFull(mqtt_client, offline_publish->qos))
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_078: [mqtt_client_dowork shall stop draining the offline queue at a QoS 1 or 2 publish while the in-flight window is full.]*/
+                break;
+            }
+            else if (sendPublishPacket(mqtt_client, offline_publish->packet, offline_publish->qos, offline_publish->packetId) != 0)
+            {
+                // Keep the publish at the head of the queue and retry on the next dowork
+                LogError("Error: sending offline publish failed");
+                break;
+            }
+            removeOfflineHead(mqtt_client, item);
+            budget--;
+        }
+    }
+}
+
+static bool isMatchingSubscription(LIST_ITEM_HANDLE list_item, const void* match_context)
+{
+    const RECONNECT_SUBSCRIPTION* subscription = (const RECONNECT_SUBSCRIPTION*)singlylinkedlist_item_get_value(list_item);
+    return strcmp(subscription->topic, (const char*)match_context) == 0;
+}
+
+static void removeSubscription(MQTT_CLIENT* mqtt_client, LIST_ITEM_HANDLE item)
+{
+    RECONNECT_SUBSCRIPTION* subscription = (RECONNECT_SUBSCRIPTION*)singlylinkedlist_item_get_value(item);
+    (void)singlylinkedlist_remove(mqtt_client->subscriptions, item);
+    free(subscription->topic);
+    free(subscription);
+}
+
+static void clearSubscriptions(MQTT_CLIENT* mqtt_client)
+{
+    if (mqtt_client->subscriptions != NULL)
+    {
+        LIST_ITEM_HANDLE item;
+        while ((item = singlylinkedlist_get_head_item(mqtt_client->subscriptions)) != NULL)
+        {
+            removeSubscription(mqtt_client, item);
+        }
+    }
+}
+
+static void recordSubscriptions(MQTT_CLIENT* mqtt_client, const SUBSCRIBE_PAYLOAD* subscribeList, size_t count)
+{
+    size_t index;
+    for (index = 0; index < count; index++)
+    {
+        LIST_ITEM_HANDLE item = singlylinkedlist_find(mqtt_client->subscriptions, isMatchingSubscription, subscribeList[index].subscribeTopic);
+        if (item != NULL)
+        {
+            ((RECONNECT_SUBSCRIPTION*)singlylinkedlist_item_get_value(item))->qos = subscribeList[index].qosReturn;
+        }
+        else
+        {
+            RECONNECT_SUBSCRIPTION* subscription = (RECONNECT_SUBSCRIPTION*)malloc(sizeof(RECONNECT_SUBSCRIPTION));
+            if (subscription == NULL)
+            {
+                LogError("Failure allocating subscription");
+            }
+            else if (mallocAndStrcpy_s(&subscription->topic, subscribeList[index].subscribeTopic) != 0)
+            {
+                LogError("Failure copying subscription topic");
+                free(subscription);
+            }
+            else
+            {
+                subscription->qos = subscribeList[index].qosReturn;
+                if (singlylinkedlist_add(mqtt_client->subscriptions, subscription) == NULL)
+                {
+                    LogError("Failure adding subscription");
+                    free(subscription->topic);
+                    free(subscription);
+                }
+            }
+        }
+    }
+}
+
+static void forgetSubscriptions(MQTT_CLIENT* mqtt_client, const char** unsubscribeList, size_t count)
+{
+    size_t index;
+    for (index = 0; index < count; index++)
+    {
+        LIST_ITEM_HANDLE item = singlylinkedlist_find(mqtt_client->subscriptions, isMatchingSubscription, unsubscribeList[index]);
+        if (item != NULL)
+        {
+            removeSubscription(mqtt_client, item);
+        }
+    }
+}
+
+static size_t getSubscribePacketSize(size_t remainingLength)
+{
+    return 1 + getRemainingLengthSize(remainingLength) + remainingLength;
+}
+
+static size_t getSubscribeHeaderSize(const MQTT_CLIENT* mqtt_client)
+{
+    // MQTT 5.0 adds an empty property list after the packet id
+    return SUBSCRIBE_PACKET_ID_SIZE + (isProtocolV5(mqtt_client) ? 1 : 0);
+}
+
+// Greedily fills each packet up to maxPacketSize, which gives the fewest packets while keeping the list
+// order. Returns the packet count, or 0 if one filter alone does not fit. packets may be NULL to only count.
+static size_t planSubscribePackets(const SUBSCRIBE_PAYLOAD* subscribeList, size_t count, size_t maxPacketSize, size_t headerSize, SUBSCRIBE_BATCH_PACKET* packets)
+{
+    size_t packetCount = 0;
+    size_t remainingLength = 0;
+    size_t index;
+    for (index = 0; index < count; index++)
+    {
+        size_t entrySize = SUBSCRIBE_ENTRY_OVERHEAD + strlen(subscribeList[index].subscribeTopic);
+        if (packetCount > 0 && getSubscribePacketSize(remainingLength + entrySize) <= maxPacketSize)
+        {
+            remainingLength += entrySize;
+            if (packets != NULL)
+            {
+                packets[packetCount - 1].entryCount++;
+            }
+        }
+        else if (getSubscribePacketSize(headerSize + entrySize) > maxPacketSize)
+        {
+            LogError("Error: subscription %s does not fit in a packet of %lu bytes", subscribeList[index].subscribeTopic, (unsigned long)maxPacketSize);
+            packetCount = 0;
+            break;
+        }
+        else
+        {
+            if (packets != NULL)
+            {
+                packets[packetCount].firstEntry = index;
+                packets[packetCount].entryCount = 1;
+                packets[packetCount].acknowledged = false;
+            }
+            packetCount++;
+            remainingLength = headerSize + entrySize;
+        }
+    }
+    return packetCount;
+}
+
+static void restoreSubscriptions(MQTT_CLIENT* mqtt_client)
+{
+    size_t count = 0;
+    LIST_ITEM_HANDLE item;
+    for (item = singlylinkedlist_get_head_item(mqtt_client->subscriptions); item != NULL; item = singlylinkedlist_get_next_item(item))
+    {
+        count++;
+    }
+
+    mqtt_client->restorePacketCount = 0;
+    mqtt_client->restorePendingCount = 0;
+    if (count > 0)
+    {
+        // A packet holds one filter at least, the list and the plan are one allocation
+        SUBSCRIBE_PAYLOAD* subscribeList = (SUBSCRIBE_PAYLOAD*)malloc(count * (sizeof(SUBSCRIBE_PAYLOAD) + sizeof(SUBSCRIBE_BATCH_PACKET)));
+        if (subscribeList == NULL)
+        {
+            LogError("Failure allocating resubscribe list");
+        }
+        else
+        {
+            SUBSCRIBE_BATCH_PACKET* packets = (SUBSCRIBE_BATCH_PACKET*)(subscribeList + count);
+            size_t packetCount;
+            size_t index = 0;
+            uint16_t packetId = (mqtt_client->reconnectOptions.resubscribePacketId != 0) ? mqtt_client->reconnectOptions.resubscribePacketId : DEFAULT_RESUBSCRIBE_PACKET_ID;
+            for (item = singlylinkedlist_get_head_item(mqtt_client->subscriptions); item != NULL; item = singlylinkedlist_get_next_item(item))
+            {
+                const RECONNECT_SUBSCRIPTION* subscription = (const RECONNECT_SUBSCRIPTION*)singlylinkedlist_item_get_value(item);
+                subscribeList[index].subscribeTopic = subscription->topic;
+                subscribeList[index].qosReturn = subscription->qos;
+                index++;
+            }
+
+            /*Codes_SRS_MQTT_CLIENT_07_054: [If the broker did not keep the session the client shall restore every subscription made since mqtt_client_connect in the fewest SUBSCRIBE packets no larger than the maximum packet size, using consecutive packet ids starting at resubscribePacketId.]*/
+            packetCount = planSubscribePackets(subscribeList, count,
+                (mqtt_client->serverLimits.maximumPacketSize != 0) ? mqtt_client->serverLimits.maximumPacketSize : MAX_MQTT_PACKET_SIZE,
+                getSubscribeHeaderSize(mqtt_client), packets);
+            if (packetCount > (size_t)(UINT16_MAX - packetId) + 1)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_114: [The packet ids of the restoring SUBSCRIBE packets shall not wrap past 0xFFFF into the ids of the application, the subscriptions shall not be restored when they do not fit.]*/
+                LogError("Error: %lu resubscribe packets do not fit in the packet ids from %d", (unsigned long)packetCount, packetId);
+            }
+            else
+            {
+                mqtt_client->restorePacketId = packetId;
+                for (index = 0; index < packetCount; index++)
+                {
+                    BUFFER_HANDLE subPacket = encodeSubscribePacket(mqtt_client, (uint16_t)(packetId + index), &subscribeList[packets[index].firstEntry], packets[index].entryCount, NULL);
+                    if (subPacket == NULL)
+                    {
+                        LogError("Error: encoding the resubscribe packet failed");
+                        break;
+                    }
+                    else
+                    {
+                        size_t size = BUFFER_length(subPacket);
+                        mqtt_client->packetState = SUBSCRIBE_TYPE;
+                        if (sendPacketItem(mqtt_client, BUFFER_u_char(subPacket), size) != 0)
+                        {
+                            LogError("Error: resubscribe send failed");
+                            BUFFER_delete(subPacket);
+                            break;
+                        }
+                        BUFFER_delete(subPacket);
+                    }
+                    mqtt_client->restorePacketCount++;
+                }
+                mqtt_client->restorePendingCount = mqtt_client->restorePacketCount;
+            }
+            free(subscribeList);
+        }
+    }
+}
+
+static bool completeRestoreSubscribe(MQTT_CLIENT* mqtt_client, const SUBSCRIBE_ACK* suback)
+{
+    bool result;
+    if (mqtt_client->restorePendingCount == 0 || suback->packetId < mqtt_client->restorePacketId ||
+        (size_t)(suback->packetId - mqtt_client->restorePacketId) >= mqtt_client->restorePacketCount)
+    {
+        result = false;
+    }
+    else
+    {
+        size_t index;
+        for (index = 0; index < suback->qosCount; index++)
+        {
+            if (suback->qosReturn[index] == DELIVER_FAILURE)
+            {
+                LogError("Error: the server refused to restore a subscription of packet %d", suback->packetId);
+            }
+        }
+        mqtt_client->restorePendingCount--;
+        result = true;
+    }
+    return result;
+}
+
+static void attemptReconnect(MQTT_CLIENT* mqtt_client)
+{
+    tickcounter_ms_t current_ms;
+    if (tickcounter_get_current_ms(mqtt_client->packetTickCntr, &current_ms) != 0)
+    {
+        LogError("Error: tickcounter_get_current_ms failed");
+    }
+    else if (current_ms >= mqtt_client->nextReconnectMs)
+    {
+        mqtt_client->reconnectPending = false;
+        mqtt_client->xioHandle = mqtt_client->reconnectXio;
+        mqtt_client->packetState = UNKNOWN_TYPE;
+        mqtt_client->socketConnected = false;
+        mqtt_client->clientConnected = false;
+        mqtt_client->timeSincePing = 0;
+
+        /*Codes_SRS_MQTT_CLIENT_07_055: [When the backoff delay has elapsed mqtt_client_dowork shall reopen the xio and send a CONNECT with the options given to mqtt_client_connect.]*/
+        if (xio_open(mqtt_client->xioHandle, onOpenComplete, mqtt_client, onBytesReceived, mqtt_client, onIoError, mqtt_client) != 0)
+        {
+            LogError("Error: io_open failed");
+            mqtt_client->xioHandle = NULL;
+            scheduleReconnect(mqtt_client);
+        }
+    }
+}
+
+static void destroySubscribeBatch(SUBSCRIBE_BATCH* batch)
+{
+    free(batch->packets);
+    free(batch->qosReturn);
+    free(batch);
+}
+
+static bool isMatchingSubscribeBatch(LIST_ITEM_HANDLE list_item, const void* match_context)
+{
+    bool result = false;
+    const SUBSCRIBE_BATCH* batch = (const SUBSCRIBE_BATCH*)singlylinkedlist_item_get_value(list_item);
+    uint16_t packetId = *(const uint16_t*)match_context;
+    size_t index;
+    for (index = 0; index < batch->packetCount; index++)
+    {
+        if (batch->packets[index].packetId == packetId)
+        {
+            result = true;
+            break;
+        }
+    }
+    return result;
+}
+
+static bool completeSubscribeBatch(MQTT_CLIENT* mqtt_client, const SUBSCRIBE_ACK* suback)
+{
+    bool result;
+    LIST_ITEM_HANDLE item = singlylinkedlist_find(mqtt_client->subscribeBatches, isMatchingSubscribeBatch, &suback->packetId);
+    if (item == NULL)
+    {
+        result = false;
+    }
+    else
+    {
+        SUBSCRIBE_BATCH* batch = (SUBSCRIBE_BATCH*)singlylinkedlist_item_get_value(item);
+        size_t index;
+        for (index = 0; index < batch->packetCount; index++)
+        {
+            SUBSCRIBE_BATCH_PACKET* packet = &batch->packets[index];
+            if (packet->packetId == suback->packetId && !packet->acknowledged)
+            {
+                size_t qosCount = (suback->qosCount < packet->entryCount) ? suback->qosCount : packet->entryCount;
+                (void)memcpy(&batch->qosReturn[packet->firstEntry], suback->qosReturn, qosCount * sizeof(QOS_VALUE));
+                packet->acknowledged = true;
+                batch->pendingCount--;
+                break;
+            }
+        }
+
+        /*Codes_SRS_MQTT_CLIENT_07_059: [Once every packet of the batch is acknowledged onComplete shall be called with the granted QoS of every filter in list order, the individual SUBACKs shall not be reported to the operation callback.]*/
+        if (batch->pendingCount == 0)
+        {
+            (void)singlylinkedlist_remove(mqtt_client->subscribeBatches, item);
+            batch->onComplete(mqtt_client, batch->qosReturn, batch->qosCount, batch->callbackCtx);
+            destroySubscribeBatch(batch);
+        }
+        result = true;
+    }
+    return result;
+}
+
+static void replayPersistedPacket(void* context, uint16_t packetId, bool released, uint8_t* packet, size_t length)
+{
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
+    if (released)
+    {
+        if (sendPublishReply(mqtt_client, MQTT_PUBREL_TEMPLATE, packetId) == 0)
+        {
+            mqtt_client->inflightCount++;
+        }
+    }
+    else
+    {
+        // The stored packet is updated in place so a later replay is also flagged as duplicate
+        packet[0] |= DUPLICATE_FLAG_MASK;
+        if (sendPacketItem(mqtt_client, packet, length) != 0)
+        {
+            LogError("Failure resending persisted packet %"PRIu16, packetId);
+        }
+        else
+        {
+            mqtt_client->inflightCount++;
+        }
+    }
+}
+
+static void recvCompleteCallback(void* context, CONTROL_PACKET_TYPE packet, int flags, BUFFER_HANDLE headerData)
+{
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)context;
+    if (mqtt_client != NULL)
+    {
+        size_t packetLength = 0;
+        uint8_t* iterator = NULL;
+        if (headerData != NULL)
+        {
+            packetLength = BUFFER_length(headerData);
+            iterator = BUFFER_u_char(headerData);
+        }
+
+#ifdef ENABLE_RAW_TRACE
+        logIncomingRawTrace(mqtt_client, packet, (uint8_t)flags, iterator, packetLength);
+#endif
+        if ((iterator != NULL && packetLength > 0) || packet == PINGRESP_TYPE || packet == DISCONNECT_TYPE)
+        {
+            switch (packet)
+            {
+                case CONNACK_TYPE:
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_028: [If the actionResult parameter is of type CONNECT_ACK then the msgInfo value shall be a CONNECT_ACK structure.]*/
+                    CONNECT_ACK connack = { 0 };
+                    MQTT_PROPERTIES properties;
+                    connack.isSessionPresent = (byteutil_readByte(&iterator) == 0x1) ? true : false;
+                    uint8_t rc = byteutil_readByte(&iterator);
+                    resetConnectionLimits(mqtt_client);
+                    /*Codes_SRS_MQTT_CLIENT_07_071: [Every CONNACK shall discard the topic aliases of the previous connection.]*/
+                    resetTopicAliases(mqtt_client);
+                    resetInboundTopicAliases(mqtt_client);
+                    mqtt_client->inflightCount = 0;
+                    if (isProtocolV5(mqtt_client))
+                    {
+                        /*Codes_SRS_MQTT_CLIENT_07_062: [In MQTT 5.0 mode the CONNACK reason code shall be passed in reasonCode and mapped to the closest CONNECT_RETURN_CODE, and its properties shall be passed in properties.]*/
+                        size_t propertiesSize = 0;
+                        connack.reasonCode = (MQTT_REASON_CODE)rc;
+                        connack.returnCode = getConnectReturnCode(rc);
+                        if (packetLength > 2 && mqtt_codec_decode_properties(iterator, packetLength - 2, &properties, &propertiesSize) == 0)
+                        {
+                            connack.properties = &properties;
+                            /*Codes_SRS_MQTT_CLIENT_07_063: [The Receive Maximum, Maximum Packet Size, Topic Alias Maximum, Maximum QoS and Retain Available announced in the CONNACK shall replace the defaults returned by mqtt_client_get_connection_limits.]*/
+                            applyConnectionLimits(mqtt_client, &properties);
+                        }
+                        else if (packetLength > 2)
+                        {
+                            LogError("CONNACK: invalid properties");
+                        }
+                    }
+                    else
+                    {
+                        connack.returnCode =
+                            (rc < ((uint8_t)CONN_REFUSED_UNKNOWN)) ?
+                            (CONNECT_RETURN_CODE)rc : CONN_REFUSED_UNKNOWN;
+                    }
+
+#ifndef NO_LOGGING
+                    if (mqtt_client->logTrace)
+                    {
+                        STRING_HANDLE trace_log = STRING_construct_sprintf("CONNACK | SESSION_PRESENT: %s | RETURN_CODE: 0x%x", connack.isSessionPresent ? TRUE_CONST : FALSE_CONST, connack.returnCode);
+                        log_incoming_trace(mqtt_client, trace_log);
+                        STRING_delete(trace_log);
+                    }
+#endif
+                    mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_CONNACK, (void*)&connack, mqtt_client->ctx);
+
+                    if (connack.returnCode == CONNECTION_ACCEPTED)
+                    {
+                        mqtt_client->clientConnected = true;
+                        mqtt_client->reconnectAttempt = 0;
+
+                        if (mqtt_client->reconnecting)
+                        {
+                            mqtt_client->reconnecting = false;
+                            if (!connack.isSessionPresent && mqtt_client->subscriptions != NULL)
+                            {
+                                restoreSubscriptions(mqtt_client);
+                            }
+                        }
+
+                        if (mqtt_client->persistHandle != NULL && !mqtt_client->mqttOptions.useCleanSession)
+                        {
+                            /*Codes_SRS_MQTT_CLIENT_07_042: [When the CONNACK is accepted and useCleanSession is false the client shall resend every persisted packet in order, PUBLISH packets with the DUP flag set and released packets as a PUBREL.]*/
+                            (void)mqtt_persist_foreach(mqtt_client->persistHandle, replayPersistedPacket, mqtt_client);
+                        }
+
+                        if (mqtt_client->offlineQueue != NULL && tickcounter_get_current_ms(mqtt_client->packetTickCntr, &mqtt_client->offlineDrainMs) != 0)
+                        {
+                            LogError("Error: tickcounter_get_current_ms failed");
+                            mqtt_client->offlineDrainMs = 0;
+                        }
+                    }
+                    break;
+                }
+                case PUBLISH_TYPE:
+                {
+                    ProcessPublishMessage(mqtt_client, iterator, packetLength, flags, false);
+                    break;
+                }
+                case PUBACK_TYPE:
+                case PUBREC_TYPE:
+                case PUBREL_TYPE:
+                case PUBCOMP_TYPE:
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
+                    MQTT_CLIENT_EVENT_RESULT action = (packet == PUBACK_TYPE) ? MQTT_CLIENT_ON_PUBLISH_ACK :
+                        (packet == PUBREC_TYPE) ? MQTT_CLIENT_ON_PUBLISH_RECV :
+                        (packet == PUBREL_TYPE) ? MQTT_CLIENT_ON_PUBLISH_REL : MQTT_CLIENT_ON_PUBLISH_COMP;
+
+                    PUBLISH_ACK publish_ack = { 0 };
+                    publish_ack.packetId = byteutil_read_uint16(&iterator, packetLength);
+                    if (isProtocolV5(mqtt_client) && packetLength > 2)
+                    {
+                        /*Codes_SRS_MQTT_CLIENT_07_065: [In MQTT 5.0 mode the reason code of a PUBACK, PUBREC, PUBREL or PUBCOMP shall be passed in the reasonCode of the PUBLISH_ACK, MQTT_REASON_SUCCESS when it is omitted.]*/
+                        publish_ack.reasonCode = (MQTT_REASON_CODE)byteutil_readByte(&iterator);
+                    }
+
+#ifndef NO_LOGGING
+                    if (mqtt_client->logTrace)
+                    {
+                        STRING_HANDLE trace_log = STRING_construct_sprintf("%s | PACKET_ID: %"PRIu16, packet == PUBACK_TYPE ? "PUBACK" : (packet == PUBREC_TYPE) ? "PUBREC" : (packet == PUBREL_TYPE) ? "PUBREL" : "PUBCOMP",
+                            publish_ack.packetId);
+
+                        log_incoming_trace(mqtt_client, trace_log);
+                        STRING_delete(trace_log);
+                    }
+#endif
+                    bool pubrecFailed = (packet == PUBREC_TYPE && (uint8_t)publish_ack.reasonCode >= (uint8_t)MQTT_REASON_UNSPECIFIED_ERROR);
+                    if (packet == PUBACK_TYPE || packet == PUBCOMP_TYPE || pubrecFailed)
+                    {
+                        /*Codes_SRS_MQTT_CLIENT_07_076: [A QoS 1 or 2 publish shall hold a slot of the in-flight window from the time it is sent until its PUBACK, its PUBCOMP or a PUBREC with a failure reason code is received, before the operation callback is called.]*/
+                        releaseInflight(mqtt_client);
+                    }
+                    mqtt_client->fnOperationCallback(mqtt_client, action, (void*)&publish_ack, mqtt_client->ctx);
+                    if (mqtt_client->persistHandle != NULL)
+                    {
+                        /*Codes_SRS_MQTT_CLIENT_07_043: [On PUBACK, PUBCOMP or a PUBREC with a failure reason code the client shall remove the packet from the persistent store, on any other PUBREC it shall mark the packet as released.]*/
+                        if (packet == PUBACK_TYPE || packet == PUBCOMP_TYPE || pubrecFailed)
+                        {
+                            (void)mqtt_persist_remove(mqtt_client->persistHandle, publish_ack.packetId);
+                        }
+                        else if (packet == PUBREC_TYPE)
+                        {
+                            (void)mqtt_persist_mark_released(mqtt_client->persistHandle, publish_ack.packetId);
+                        }
+                    }
+                    /*Codes_SRS_MQTT_CLIENT_07_113: [A PUBREC with a failure reason code shall end the QoS 2 exchange, no PUBREL shall be sent.]*/
+                    if (packet == PUBREC_TYPE && !pubrecFailed)
+                    {
+                        (void)sendPublishReply(mqtt_client, MQTT_PUBREL_TEMPLATE, publish_ack.packetId);
+                    }
+                    else if (packet == PUBREL_TYPE)
+                    {
+                        (void)sendPublishReply(mqtt_client, MQTT_PUBCOMP_TEMPLATE, publish_ack.packetId);
+                    }
+                    break;
+                }
+                case SUBACK_TYPE:
+                {
+
+                    /*Codes_SRS_MQTT_CLIENT_07_030: [If the actionResult parameter is of type SUBACK_TYPE then the msgInfo value shall be a SUBSCRIBE_ACK structure.]*/
+                    SUBSCRIBE_ACK suback = { 0 };
+
+                    size_t remainLen = packetLength;
+                    suback.packetId = byteutil_read_uint16(&iterator, packetLength);
+                    remainLen -= 2;
+                    if (isProtocolV5(mqtt_client))
+                    {
+                        // The reason codes 0 to 2 are the granted QoS, every other value is a failure
+                        MQTT_PROPERTIES properties;
+                        size_t propertiesSize = 0;
+                        if (mqtt_codec_decode_properties(iterator, remainLen, &properties, &propertiesSize) != 0)
+                        {
+                            LogError("SUBACK: invalid properties");
+                            set_error_callback(mqtt_client, MQTT_CLIENT_PARSE_ERROR);
+                            break;
+                        }
+                        iterator += propertiesSize;
+                        remainLen -= propertiesSize;
+                    }
+
+#ifndef NO_LOGGING
+                    STRING_HANDLE trace_log = NULL;
+                    if (mqtt_client->logTrace)
+                    {
+                        trace_log = STRING_construct_sprintf("SUBACK | PACKET_ID: %"PRIu16, suback.packetId);
+                    }
+#endif
+                    // Allocate the remaining len
+                    suback.qosReturn = (QOS_VALUE*)malloc(sizeof(QOS_VALUE)*remainLen);
+                    if (suback.qosReturn != NULL)
+                    {
+                        while (remainLen > 0)
+                        {
+                            uint8_t qosRet = byteutil_readByte(&iterator);
+                            suback.qosReturn[suback.qosCount++] =
+                                (qosRet <= ((uint8_t)DELIVER_EXACTLY_ONCE)) ?
+                                (QOS_VALUE)qosRet :  DELIVER_FAILURE;
+                            remainLen--;
+#ifndef NO_LOGGING
+                            if (mqtt_client->logTrace)
+                            {
+                                STRING_sprintf(trace_log, " | RETURN_CODE: %"PRIu16, suback.qosReturn[suback.qosCount-1]);
+                            }
+#endif
+                        }
+
+#ifndef NO_LOGGING
+                        if (mqtt_client->logTrace)
+                        {
+                            log_incoming_trace(mqtt_client, trace_log);
+                            STRING_delete(trace_log);
+                        }
+#endif
+                        /*Codes_SRS_MQTT_CLIENT_07_115: [The SUBACKs of the packets restoring the subscriptions shall not be reported to the operation callback.]*/
+                        if (!completeRestoreSubscribe(mqtt_client, &suback) &&
+                            (mqtt_client->subscribeBatches == NULL || !completeSubscribeBatch(mqtt_client, &suback)))
+                        {
+                            mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_SUBSCRIBE_ACK, (void*)&suback, mqtt_client->ctx);
+                        }
+                        free(suback.qosReturn);
+                    }
+                    else
+                    {
+                        LogError("allocation of quality of service value failed.");
+                        set_error_callback(mqtt_client, MQTT_CLIENT_MEMORY_ERROR);
+                    }
+                    break;
+                }
+                case UNSUBACK_TYPE:
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_031: [If the actionResult parameter is of type UNSUBACK_TYPE then the msgInfo value shall be a UNSUBSCRIBE_ACK structure.]*/
+                    UNSUBSCRIBE_ACK unsuback = { 0 };
+                    unsuback.packetId = byteutil_read_uint16(&iterator, packetLength);
+
+#ifndef NO_LOGGING
+                    if (mqtt_client->logTrace)
+                    {
+                        STRING_HANDLE trace_log = STRING_construct_sprintf("UNSUBACK | PACKET_ID: %"PRIu16, unsuback.packetId);
+                        log_incoming_trace(mqtt_client, trace_log);
+                        STRING_delete(trace_log);
+                    }
+#endif
+                    mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_UNSUBSCRIBE_ACK, (void*)&unsuback, mqtt_client->ctx);
+                    break;
+                }
+                case PINGRESP_TYPE:
+                    mqtt_client->timeSincePing = 0;
+#ifndef NO_LOGGING
+                    if (mqtt_client->logTrace)
+                    {
+                        STRING_HANDLE trace_log = STRING_construct_sprintf("PINGRESP");
+                        log_incoming_trace(mqtt_client, trace_log);
+                        STRING_delete(trace_log);
+                    }
+#endif
+                    // Forward ping response to operation callback
+                    mqtt_client->fnOperationCallback(mqtt_client, MQTT_CLIENT_ON_PING_RESPONSE, NULL, mqtt_client->ctx);
+                    break;
+                case DISCONNECT_TYPE:
+                {
+                    // Only an MQTT 5.0 server sends a DISCONNECT, a remaining length of 0 means normal disconnection
+                    uint8_t reasonCode = (iterator != NULL && packetLength > 0) ? byteutil_readByte(&iterator) : 0x00;
+                    LogError("Server disconnected with reason code 0x%x", reasonCode);
+                    /*Codes_SRS_MQTT_CLIENT_07_066: [When the server sends a DISCONNECT the client shall no longer be connected and shall report MQTT_CLIENT_CONNECTION_ERROR.]*/
+                    mqtt_client->clientConnected = false;
+                    set_error_callback(mqtt_client, MQTT_CLIENT_CONNECTION_ERROR);
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+    else
+    {
+        LogError("recvCompleteCallback context failed.");
+    }
+}
+
+MQTT_CLIENT_HANDLE mqtt_client_init(ON_MQTT_MESSAGE_RECV_CALLBACK msgRecv, ON_MQTT_OPERATION_CALLBACK operation_cb, void* opCallbackCtx, ON_MQTT_ERROR_CALLBACK onErrorCallBack, void* errorCBCtx)
+{
+    MQTT_CLIENT* result;
+    /*Codes_SRS_MQTT_CLIENT_07_001: [If the parameters ON_MQTT_MESSAGE_RECV_CALLBACK is NULL then mqttclient_init shall return NULL.]*/
+    if (msgRecv == NULL || operation_cb == NULL)
+    {
+        LogError("Invalid parameter specified msgRecv: %p, operation_cb: %p", msgRecv, operation_cb);
+        result = NULL;
+    }
+    else
+    {
+        result = malloc(sizeof(MQTT_CLIENT));
+        if (result == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_002: [If any failure is encountered then mqttclient_init shall return NULL.]*/
+            LogError("mqtt_client_init failure: Allocation Failure");
+        }
+        else
+        {
+            memset(result, 0, sizeof(MQTT_CLIENT));
+            /*Codes_SRS_MQTT_CLIENT_07_003: [mqttclient_init shall allocate MQTTCLIENT_DATA_INSTANCE and return the MQTTCLIENT_HANDLE on success.]*/
+            result->packetState = UNKNOWN_TYPE;
+            result->fnOperationCallback = operation_cb;
+            result->ctx = opCallbackCtx;
+            result->fnMessageRecv = msgRecv;
+            result->fnOnErrorCallBack = onErrorCallBack;
+            result->errorCBCtx = errorCBCtx;
+            result->qosValue = DELIVER_AT_MOST_ONCE;
+            result->packetTickCntr = tickcounter_create();
+            result->maxPingRespTime = DEFAULT_MAX_PING_RESPONSE_TIME;
+            resetConnectionLimits(result);
+            if (result->packetTickCntr == NULL)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_002: [If any failure is encountered then mqttclient_init shall return NULL.]*/
+                LogError("mqtt_client_init failure: tickcounter_create failure");
+                free(result);
+                result = NULL;
+            }
+            else
+            {
+                result->codec_handle = mqtt_codec_create(recvCompleteCallback, result);
+                if (result->codec_handle == NULL)
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_002: [If any failure is encountered then mqttclient_init shall return NULL.]*/
+                    LogError("mqtt_client_init failure: mqtt_codec_create failure");
                     tickcounter_destroy(result->packetTickCntr);
                     free(result);
                     result = NULL;
@@ -960,350 +2836,1172 @@ MQTT_CLIENT_HANDLE mqtt_client_init(ON_MQTT_MESSAGE_RECV_CALLBACK msgRecv, ON_MQ
     return result;
 }
 
-void mqtt_client_deinit(MQTT_CLIENT_HANDLE handle)
+void mqtt_client_deinit(MQTT_CLIENT_HANDLE handle)
+{
+    /*Codes_SRS_MQTT_CLIENT_07_004: [If the parameter handle is NULL then function mqtt_client_deinit shall do nothing.]*/
+    if (handle != NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_005: [mqtt_client_deinit shall deallocate all memory allocated in this unit.]*/
+        MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+        tickcounter_destroy(mqtt_client->packetTickCntr);
+        mqtt_codec_destroy(mqtt_client->codec_handle);
+        clear_mqtt_options(mqtt_client);
+        clearOfflineQueue(mqtt_client);
+        resetTopicAliases(mqtt_client);
+        resetInboundTopicAliases(mqtt_client);
+        discardMessageStream(mqtt_client);
+        discardPublishStream(mqtt_client);
+        if (mqtt_client->pendingAcks != NULL)
+        {
+            BUFFER_delete(mqtt_client->pendingAcks);
+        }
+        if (mqtt_client->manualAckLock != NULL)
+        {
+            VECTOR_destroy(mqtt_client->manualAcks);
+            VECTOR_destroy(mqtt_client->drainingAcks);
+            (void)Lock_Deinit(mqtt_client->manualAckLock);
+        }
+        if (mqtt_client->subscriptions != NULL)
+        {
+            clearSubscriptions(mqtt_client);
+            singlylinkedlist_destroy(mqtt_client->subscriptions);
+        }
+        if (mqtt_client->subscribeBatches != NULL)
+        {
+            LIST_ITEM_HANDLE item;
+            while ((item = singlylinkedlist_get_head_item(mqtt_client->subscribeBatches)) != NULL)
+            {
+                SUBSCRIBE_BATCH* batch = (SUBSCRIBE_BATCH*)singlylinkedlist_item_get_value(item);
+                (void)singlylinkedlist_remove(mqtt_client->subscribeBatches, item);
+                destroySubscribeBatch(batch);
+            }
+            singlylinkedlist_destroy(mqtt_client->subscribeBatches);
+        }
+        clearPayloadTransforms(mqtt_client);
+        free(mqtt_client);
+    }
+}
+
+int mqtt_client_connect(MQTT_CLIENT_HANDLE handle, XIO_HANDLE xioHandle, MQTT_CLIENT_OPTIONS* mqttOptions)
+{
+    int result;
+    /*SRS_MQTT_CLIENT_07_006: [If any of the parameters handle, ioHandle, or mqttOptions are NULL then mqtt_client_connect shall return a non-zero value.]*/
+    if (handle == NULL || mqttOptions == NULL || xioHandle == NULL)
+    {
+        LogError("mqtt_client_connect: NULL argument (handle = %p, mqttOptions = %p, xioHandle: %p)", handle, mqttOptions, xioHandle);
+        result = __FAILURE__;
+    }
+    else
+    {
+        MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+        mqtt_client->xioHandle = xioHandle;
+        mqtt_client->reconnectXio = xioHandle;
+        mqtt_client->reconnectPending = false;
+        mqtt_client->reconnecting = false;
+        mqtt_client->reconnectAttempt = 0;
+        mqtt_client->restorePendingCount = 0;
+        mqtt_client->packetState = UNKNOWN_TYPE;
+        mqtt_client->qosValue = mqttOptions->qualityOfServiceValue;
+        mqtt_client->keepAliveInterval = mqttOptions->keepAliveInterval;
+        mqtt_client->maxPingRespTime = (DEFAULT_MAX_PING_RESPONSE_TIME < mqttOptions->keepAliveInterval/2) ? DEFAULT_MAX_PING_RESPONSE_TIME : mqttOptions->keepAliveInterval/2;
+        resetConnectionLimits(mqtt_client);
+        uint32_t previousMaxPacketSize = mqtt_client->mqttOptions.maximumPacketSize;
+        /*Codes_SRS_MQTT_CLIENT_07_112: [mqtt_client_connect shall discard the encoded CONNECT packet when any of the options differ from the ones it was encoded from.]*/
+        if (!isSameConnectOptions(&mqtt_client->mqttOptions, mqttOptions))
+        {
+            clearConnectPacket(mqtt_client);
+        }
+        if (cloneMqttOptions(mqtt_client, mqttOptions) != 0)
+        {
+            LogError("Error: Clone Mqtt Options failed");
+            result = __FAILURE__;
+        }
+        else if (applyInboundLimits(mqtt_client, previousMaxPacketSize) != 0)
+        {
+            LogError("Error: applying the inbound packet limits failed");
+            result = __FAILURE__;
+            clear_mqtt_options(mqtt_client);
+        }
+        /*Codes_SRS_MQTT_CLIENT_07_008: [mqtt_client_connect shall open the XIO_HANDLE by calling into the xio_open interface.]*/
+        else if (xio_open(xioHandle, onOpenComplete, mqtt_client, onBytesReceived, mqtt_client, onIoError, mqtt_client) != 0)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_007: [If any failure is encountered then mqtt_client_connect shall return a non-zero value.]*/
+            LogError("Error: io_open failed");
+            result = __FAILURE__;
+            mqtt_client->xioHandle = NULL;
+            // Remove cloned options
+            clear_mqtt_options(mqtt_client);
+        }
+        else
+        {
+            result = 0;
+        }
+    }
+    return result;
+}
+
+static int submitPublishPacket(MQTT_CLIENT* mqtt_client, BUFFER_HANDLE publishPacket, QOS_VALUE qos, uint16_t packetId, bool windowFull, bool queuePublish, STRING_HANDLE trace_log)
+{
+    int result;
+    if (windowFull && !queuePublish)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_077: [When the in-flight window is full a QoS 1 or 2 publish shall be added to the offline queue if it is enabled, otherwise mqtt_client_publish shall return a non-zero value without sending it.]*/
+        LogError("Error: in-flight window of %lu publishes is full", (unsigned long)getInflightWindow(mqtt_client));
+        BUFFER_delete(publishPacket);
+        result = __FAILURE__;
+    }
+    else if (mqtt_client->serverLimits.maximumPacketSize != 0 && BUFFER_length(publishPacket) > mqtt_client->serverLimits.maximumPacketSize)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_067: [mqtt_client_publish shall return a non-zero value without sending when the encoded PUBLISH is larger than the Maximum Packet Size announced by the server.]*/
+        LogError("Error: publish exceeds the server maximum packet size %lu", (unsigned long)mqtt_client->serverLimits.maximumPacketSize);
+        BUFFER_delete(publishPacket);
+        result = __FAILURE__;
+    }
+    else
+    {
+        mqtt_client->packetState = PUBLISH_TYPE;
+
+        if (queuePublish)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_046: [While the client is not connected, or queued publishes are still draining, mqtt_client_publish shall add the encoded publish to the offline queue.]*/
+            if (enqueueOfflinePublish(mqtt_client, publishPacket, qos, packetId) != 0)
+            {
+                BUFFER_delete(publishPacket);
+                result = __FAILURE__;
+            }
+            else
+            {
+                log_outgoing_trace(mqtt_client, trace_log);
+                result = 0;
+            }
+        }
+        else
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_022: [On success mqtt_client_publish shall send the MQTT SUBCRIBE packet to the endpoint.]*/
+            if (sendPublishPacket(mqtt_client, publishPacket, qos, packetId) != 0)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
+                LogError("Error: mqtt_client_publish send failed");
+                result = __FAILURE__;
+            }
+            else
+            {
+                log_outgoing_trace(mqtt_client, trace_log);
+                result = 0;
+            }
+            BUFFER_delete(publishPacket);
+        }
+    }
+    return result;
+}
+
+int mqtt_client_publish(MQTT_CLIENT_HANDLE handle, MQTT_MESSAGE_HANDLE msgHandle)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL || msgHandle == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_019: [If one of the parameters handle or msgHandle is NULL then mqtt_client_publish shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, msgHandle: %p", mqtt_client, msgHandle);
+        result = __FAILURE__;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_021: [mqtt_client_publish shall get the message information from the MQTT_MESSAGE_HANDLE.]*/
+        const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(msgHandle);
+        if (payload == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
+            LogError("Error: mqttmessage_getApplicationMsg failed");
+            result = __FAILURE__;
+        }
+        else
+        {
+            STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
+
+            QOS_VALUE qos = mqttmessage_getQosType(msgHandle);
+            bool isDuplicate = mqttmessage_getIsDuplicateMsg(msgHandle);
+            bool isRetained = mqttmessage_getIsRetained(msgHandle);
+            uint16_t packetId = mqttmessage_getPacketId(msgHandle);
+            const char* topicName = mqttmessage_getTopicName(msgHandle);
+            bool windowFull = isInflightWindowFull(mqtt_client, qos);
+            bool queuePublish = mqtt_client->offlineQueue != NULL &&
+                (!mqtt_client->socketConnected || !mqtt_client->clientConnected || mqtt_client->offlineCount > 0 || windowFull);
+            const MQTT_PAYLOAD_TRANSFORM* transform = (topicName != NULL && mqtt_client->payloadTransformCount > 0) ? findTransformByTopic(mqtt_client, topicName) : NULL;
+            APP_PAYLOAD sendPayload = *payload;
+            bool isTransformed = false;
+
+            /*Codes_SRS_MQTT_CLIENT_07_108: [When the topic matches the filter of a transform, mqtt_client_publish shall send the payload encoded by the transform after its decoded length, flagged with the content type of the transform in MQTT 5.0 mode. A payload that does not shrink shall be sent as it is in MQTT 5.0 mode and stored after its length in MQTT 3.1.1 mode.]*/
+            if (transform != NULL && encodeTransformedPayload(mqtt_client, transform, payload, &sendPayload, &isTransformed) != 0)
+            {
+                LogError("Error: failure transforming the payload of %s", topicName);
+                result = __FAILURE__;
+            }
+            else
+            {
+                MQTT_PROPERTIES publishProperties;
+                const MQTT_PROPERTIES* properties = NULL;
+                const char* encodedTopic = topicName;
+                uint16_t topicAlias = 0;
+                bool isNewAlias = false;
+
+                publishProperties.present = 0;
+                if (isTransformed && isProtocolV5(mqtt_client))
+                {
+                    publishProperties.present |= MQTT_PROPERTY_MASK(MQTT_PROPERTY_CONTENT_TYPE);
+                    publishProperties.contentType.data = (const uint8_t*)transform->contentType;
+                    publishProperties.contentType.length = strlen(transform->contentType);
+                    properties = &publishProperties;
+                }
+
+                if (topicName != NULL && canUseTopicAlias(mqtt_client, qos, queuePublish))
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_069: [In MQTT 5.0 mode, when the server allows topic aliases, mqtt_client_publish shall send a topic with its new alias the first time and only the alias with an empty topic afterwards.]*/
+                    topicAlias = acquireTopicAlias(mqtt_client, topicName, &isNewAlias);
+                    if (topicAlias != 0)
+                    {
+                        publishProperties.present |= MQTT_PROPERTY_MASK(MQTT_PROPERTY_TOPIC_ALIAS);
+                        publishProperties.topicAlias = topicAlias;
+                        properties = &publishProperties;
+                        if (!isNewAlias)
+                        {
+                            encodedTopic = "";
+                        }
+                    }
+                }
+
+                BUFFER_HANDLE publishPacket = isProtocolV5(mqtt_client) ?
+                    mqtt_codec_publish_v5(qos, isDuplicate, isRetained, packetId, encodedTopic, sendPayload.message, sendPayload.length, properties, trace_log) :
+                    mqtt_codec_publish(qos, isDuplicate, isRetained, packetId, topicName, sendPayload.message, sendPayload.length, trace_log);
+                if (publishPacket == NULL)
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
+                    LogError("Error: mqtt_codec_publish failed");
+                    result = __FAILURE__;
+                }
+                else
+                {
+                    result = submitPublishPacket(mqtt_client, publishPacket, qos, packetId, windowFull, queuePublish, trace_log);
+                }
+                if (result != 0 && isNewAlias)
+                {
+                    forgetTopicAlias(mqtt_client, topicAlias);
+                }
+            }
+            if (trace_log != NULL)
+            {
+                STRING_delete(trace_log);
+            }
+        }
+    }
+    return result;
+}
+
+int mqtt_client_publish_template(MQTT_CLIENT_HANDLE handle, MQTT_PUBLISH_TEMPLATE_HANDLE publishTemplate, uint16_t packetId, const uint8_t* msgBuffer, size_t buffLen)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL || publishTemplate == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_104: [If the parameter handle or publishTemplate is NULL then mqtt_client_publish_template shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, publishTemplate: %p", mqtt_client, publishTemplate);
+        result = __FAILURE__;
+    }
+    else
+    {
+        STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
+        QOS_VALUE qos = mqtt_codec_publish_template_get_qos(publishTemplate);
+        bool windowFull = isInflightWindowFull(mqtt_client, qos);
+        bool queuePublish = mqtt_client->offlineQueue != NULL &&
+            (!mqtt_client->socketConnected || !mqtt_client->clientConnected || mqtt_client->offlineCount > 0 || windowFull);
+
+        /*Codes_SRS_MQTT_CLIENT_07_105: [mqtt_client_publish_template shall encode the PUBLISH with mqtt_codec_publish_template_encode, with an empty property list in MQTT 5.0 mode, and send, queue or reject it like mqtt_client_publish.]*/
+        BUFFER_HANDLE publishPacket = mqtt_codec_publish_template_encode(publishTemplate, false, packetId, isProtocolV5(mqtt_client), msgBuffer, buffLen, trace_log);
+        if (publishPacket == NULL)
+        {
+            LogError("Error: mqtt_codec_publish_template_encode failed");
+            result = __FAILURE__;
+        }
+        else
+        {
+            result = submitPublishPacket(mqtt_client, publishPacket, qos, packetId, windowFull, queuePublish, trace_log);
+        }
+        if (trace_log != NULL)
+        {
+            STRING_delete(trace_log);
+        }
+    }
+    return result;
+}
+
+int mqtt_client_subscribe(MQTT_CLIENT_HANDLE handle, uint16_t packetId, SUBSCRIBE_PAYLOAD* subscribeList, size_t count)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL || subscribeList == NULL || count == 0 || packetId == 0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_013: [If any of the parameters handle, subscribeList is NULL or count is 0 then mqtt_client_subscribe shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, subscribeList: %p, count: %lu, packetId: %d", mqtt_client, subscribeList, (unsigned long)count, packetId);
+        result = __FAILURE__;
+    }
+    else
+    {
+        STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
+
+        BUFFER_HANDLE subPacket = encodeSubscribePacket(mqtt_client, packetId, subscribeList, count, trace_log);
+        if (subPacket == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_014: [If any failure is encountered then mqtt_client_subscribe shall return a non-zero value.]*/
+            LogError("Error: mqtt_codec_subscribe failed");
+            result = __FAILURE__;
+        }
+        else
+        {
+            mqtt_client->packetState = SUBSCRIBE_TYPE;
+
+            size_t size = BUFFER_length(subPacket);
+            /*Codes_SRS_MQTT_CLIENT_07_015: [On success mqtt_client_subscribe shall send the MQTT SUBCRIBE packet to the endpoint.]*/
+            if (sendPacketItem(mqtt_client, BUFFER_u_char(subPacket), size) != 0)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_014: [If any failure is encountered then mqtt_client_subscribe shall return a non-zero value.]*/
+                LogError("Error: mqtt_client_subscribe send failed");
+                result = __FAILURE__;
+            }
+            else
+            {
+                if (mqtt_client->subscriptions != NULL)
+                {
+                    recordSubscriptions(mqtt_client, subscribeList, count);
+                }
+                log_outgoing_trace(mqtt_client, trace_log);
+                result = 0;
+            }
+            BUFFER_delete(subPacket);
+        }
+        if (trace_log != NULL)
+        {
+            STRING_delete(trace_log);
+        }
+    }
+    return result;
+}
+
+int mqtt_client_subscribe_batch(MQTT_CLIENT_HANDLE handle, uint16_t firstPacketId, SUBSCRIBE_PAYLOAD* subscribeList, size_t count, size_t maxPacketSize, ON_MQTT_SUBSCRIBE_BATCH_COMPLETE onComplete, void* callbackCtx, size_t* packetCount)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    size_t plannedCount;
+    size_t headerSize = SUBSCRIBE_PACKET_ID_SIZE;
+    if (mqtt_client != NULL)
+    {
+        headerSize = getSubscribeHeaderSize(mqtt_client);
+        if (maxPacketSize == 0)
+        {
+            maxPacketSize = (mqtt_client->serverLimits.maximumPacketSize != 0) ? mqtt_client->serverLimits.maximumPacketSize : MAX_MQTT_PACKET_SIZE;
+        }
+    }
+
+    if (mqtt_client == NULL || subscribeList == NULL || count == 0 || firstPacketId == 0 || onComplete == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_057: [If any of the parameters handle, subscribeList or onComplete is NULL, count is 0 or firstPacketId is 0 then mqtt_client_subscribe_batch shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, subscribeList: %p, count: %lu, packetId: %d, onComplete: %p", mqtt_client, subscribeList, (unsigned long)count, firstPacketId, onComplete);
+        result = __FAILURE__;
+    }
+    else if ((plannedCount = planSubscribePackets(subscribeList, count, maxPacketSize, headerSize, NULL)) == 0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_058: [mqtt_client_subscribe_batch shall split subscribeList into the fewest SUBSCRIBE packets no larger than maxPacketSize, and fail if a single filter does not fit.]*/
+        result = __FAILURE__;
+    }
+    else if (mqtt_client->subscribeBatches == NULL && (mqtt_client->subscribeBatches = singlylinkedlist_create()) == NULL)
+    {
+        LogError("Failure creating subscribe batch list");
+        result = __FAILURE__;
+    }
+    else
+    {
+        SUBSCRIBE_BATCH* batch = (SUBSCRIBE_BATCH*)malloc(sizeof(SUBSCRIBE_BATCH));
+        if (batch == NULL)
+        {
+            LogError("Failure allocating subscribe batch");
+            result = __FAILURE__;
+        }
+        else if ((batch->packets = (SUBSCRIBE_BATCH_PACKET*)malloc(plannedCount * sizeof(SUBSCRIBE_BATCH_PACKET))) == NULL)
+        {
+            LogError("Failure allocating subscribe batch packets");
+            free(batch);
+            result = __FAILURE__;
+        }
+        else if ((batch->qosReturn = (QOS_VALUE*)malloc(count * sizeof(QOS_VALUE))) == NULL)
+        {
+            LogError("Failure allocating subscribe batch results");
+            free(batch->packets);
+            free(batch);
+            result = __FAILURE__;
+        }
+        else
+        {
+            LIST_ITEM_HANDLE item;
+            uint16_t packetId = firstPacketId;
+            size_t index;
+
+            batch->packetCount = planSubscribePackets(subscribeList, count, maxPacketSize, headerSize, batch->packets);
+            batch->pendingCount = batch->packetCount;
+            batch->qosCount = count;
+            batch->onComplete = onComplete;
+            batch->callbackCtx = callbackCtx;
+            for (index = 0; index < count; index++)
+            {
+                batch->qosReturn[index] = DELIVER_FAILURE;
+            }
+            for (index = 0; index < batch->packetCount; index++)
+            {
+                batch->packets[index].packetId = packetId;
+                packetId = (packetId == UINT16_MAX) ? 1 : (uint16_t)(packetId + 1);
+            }
+
+            if ((item = singlylinkedlist_add(mqtt_client->subscribeBatches, batch)) == NULL)
+            {
+                LogError("Failure adding subscribe batch");
+                destroySubscribeBatch(batch);
+                result = __FAILURE__;
+            }
+            else
+            {
+                result = 0;
+                /*Codes_SRS_MQTT_CLIENT_07_060: [mqtt_client_subscribe_batch shall send every packet without waiting for the previous SUBACK, using consecutive packet ids starting at firstPacketId.]*/
+                for (index = 0; index < batch->packetCount; index++)
+                {
+                    SUBSCRIBE_BATCH_PACKET* packet = &batch->packets[index];
+                    BUFFER_HANDLE subPacket = encodeSubscribePacket(mqtt_client, packet->packetId, &subscribeList[packet->firstEntry], packet->entryCount, NULL);
+                    if (subPacket == NULL)
+                    {
+                        LogError("Error: mqtt_codec_subscribe failed");
+                        result = __FAILURE__;
+                    }
+                    else
+                    {
+                        size_t size = BUFFER_length(subPacket);
+                        mqtt_client->packetState = SUBSCRIBE_TYPE;
+                        if (sendPacketItem(mqtt_client, BUFFER_u_char(subPacket), size) != 0)
+                        {
+                            LogError("Error: mqtt_client_subscribe_batch send failed");
+                            result = __FAILURE__;
+                        }
+                        BUFFER_delete(subPacket);
+                    }
+
+                    if (result != 0)
+                    {
+                        break;
+                    }
+                    else if (mqtt_client->subscriptions != NULL)
+                    {
+                        recordSubscriptions(mqtt_client, &subscribeList[packet->firstEntry], packet->entryCount);
+                    }
+                }
+
+                if (result != 0)
+                {
+                    // SUBACKs of the packets already sent are reported to the operation callback
+                    (void)singlylinkedlist_remove(mqtt_client->subscribeBatches, item);
+                    destroySubscribeBatch(batch);
+                }
+                else if (packetCount != NULL)
+                {
+                    *packetCount = plannedCount;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+int mqtt_client_unsubscribe(MQTT_CLIENT_HANDLE handle, uint16_t packetId, const char** unsubscribeList, size_t count)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL || unsubscribeList == NULL || count == 0 || packetId == 0)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_016: [If any of the parameters handle, unsubscribeList is NULL or count is 0 then mqtt_client_unsubscribe shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, unsubscribeList: %p, count: %lu, packetId: %d", mqtt_client, unsubscribeList, (unsigned long)count, packetId);
+        result = __FAILURE__;
+    }
+    else
+    {
+        STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
+
+        BUFFER_HANDLE unsubPacket = isProtocolV5(mqtt_client) ?
+            mqtt_codec_unsubscribe_v5(packetId, unsubscribeList, count, trace_log) :
+            mqtt_codec_unsubscribe(packetId, unsubscribeList, count, trace_log);
+        if (unsubPacket == NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_017: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
+            LogError("Error: mqtt_codec_unsubscribe failed");
+            result = __FAILURE__;
+        }
+        else
+        {
+            mqtt_client->packetState = UNSUBSCRIBE_TYPE;
+
+            size_t size = BUFFER_length(unsubPacket);
+            /*Codes_SRS_MQTT_CLIENT_07_018: [On success mqtt_client_unsubscribe shall send the MQTT SUBCRIBE packet to the endpoint.]*/
+            if (sendPacketItem(mqtt_client, BUFFER_u_char(unsubPacket), size) != 0)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_017: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.].]*/
+                LogError("Error: mqtt_client_unsubscribe send failed");
+                result = __FAILURE__;
+            }
+            else
+            {
+                if (mqtt_client->subscriptions != NULL)
+                {
+                    forgetSubscriptions(mqtt_client, unsubscribeList, count);
+                }
+                log_outgoing_trace(mqtt_client, trace_log);
+                result = 0;
+            }
+            BUFFER_delete(unsubPacket);
+        }
+        if (trace_log != NULL)
+        {
+            STRING_delete(trace_log);
+        }
+    }
+    return result;
+}
+
+int mqtt_client_disconnect(MQTT_CLIENT_HANDLE handle, ON_MQTT_DISCONNECTED_CALLBACK callback, void* ctx)
 {
-    /*Codes_SRS_MQTT_CLIENT_07_004: [If the parameter handle is NULL then function mqtt_client_deinit shall do nothing.]*/
-    if (handle != NULL)
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL)
     {
-        /*Codes_SRS_MQTT_CLIENT_07_005: [mqtt_client_deinit shall deallocate all memory allocated in this unit.]*/
-        MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
-        tickcounter_destroy(mqtt_client->packetTickCntr);
-        mqtt_codec_destroy(mqtt_client->codec_handle);
-        clear_mqtt_options(mqtt_client);
-        free(mqtt_client);
+        /*Codes_SRS_MQTT_CLIENT_07_010: [If the parameters handle is NULL then mqtt_client_disconnect shall return a non-zero value.]*/
+        result = __FAILURE__;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_056: [mqtt_client_disconnect shall stop any pending reconnection and forget the subscriptions to restore.]*/
+        mqtt_client->reconnectXio = NULL;
+        mqtt_client->reconnectPending = false;
+        mqtt_client->reconnecting = false;
+        mqtt_client->restorePendingCount = 0;
+        clearSubscriptions(mqtt_client);
+
+        if (mqtt_client->clientConnected)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_095: [mqtt_client_disconnect shall send the held acknowledgements before the DISCONNECT packet.]*/
+            flushAcknowledgements(mqtt_client);
+
+            /* Codes_SRS_MQTT_CLIENT_07_037: [ if callback is not NULL callback shall be called once the mqtt connection has been disconnected ] */
+            mqtt_client->disconnect_cb = callback;
+            mqtt_client->disconnect_ctx = ctx;
+            mqtt_client->packetState = DISCONNECT_TYPE;
+
+            /*Codes_SRS_MQTT_CLIENT_07_012: [On success mqtt_client_disconnect shall send the MQTT DISCONNECT packet to the endpoint.]*/
+            /*Codes_SRS_MQTT_CLIENT_07_103: [The PINGREQ and DISCONNECT packets shall be sent from the constant packets of mqtt_codec.]*/
+            if (sendPacketItem(mqtt_client, MQTT_DISCONNECT_PACKET, sizeof(MQTT_DISCONNECT_PACKET)) != 0)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_011: [If any failure is encountered then mqtt_client_disconnect shall return a non-zero value.]*/
+                LogError("Error: mqtt_client_disconnect send failed");
+                result = __FAILURE__;
+            }
+            else
+            {
+                if (mqtt_client->logTrace)
+                {
+                    STRING_HANDLE trace_log = STRING_construct("DISCONNECT");
+                    log_outgoing_trace(mqtt_client, trace_log);
+                    STRING_delete(trace_log);
+                }
+                result = 0;
+            }
+            clear_mqtt_options(mqtt_client);
+        }
+        else
+        {
+            // If the client is not connected then just close the underlying socket
+            mqtt_client->disconnect_cb = callback;
+            mqtt_client->disconnect_ctx = ctx;
+
+            close_connection(mqtt_client);
+            clear_mqtt_options(mqtt_client);
+            result = 0;
+        }
     }
+    return result;
 }
 
-int mqtt_client_connect(MQTT_CLIENT_HANDLE handle, XIO_HANDLE xioHandle, MQTT_CLIENT_OPTIONS* mqttOptions)
+void mqtt_client_dowork(MQTT_CLIENT_HANDLE handle)
+{
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    /*Codes_SRS_MQTT_CLIENT_18_001: [If the client is disconnected, mqtt_client_dowork shall do nothing.]*/
+    /*Codes_SRS_MQTT_CLIENT_07_023: [If the parameter handle is NULL then mqtt_client_dowork shall do nothing.]*/
+    if (mqtt_client != NULL && mqtt_client->reconnectPending)
+    {
+        attemptReconnect(mqtt_client);
+    }
+
+    if (mqtt_client != NULL && mqtt_client->xioHandle != NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_024: [mqtt_client_dowork shall call the xio_dowork function to complete operations.]*/
+        xio_dowork(mqtt_client->xioHandle);
+
+        if (mqtt_client->publishChunk != NULL)
+        {
+            pumpPublishStream(mqtt_client);
+        }
+
+        if (mqtt_client->manualAckLock != NULL)
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_098: [mqtt_client_dowork shall send the acknowledgements queued by mqtt_client_ack since its last call together in a single write.]*/
+            sendManualAcknowledgements(mqtt_client);
+        }
+
+        if (mqtt_client->pendingAckLength > 0)
+        {
+            tickcounter_ms_t current_ms;
+            if (tickcounter_get_current_ms(mqtt_client->packetTickCntr, &current_ms) != 0 ||
+                current_ms - mqtt_client->pendingAckMs >= mqtt_client->maxAckDelayMs)
+            {
+                /*Codes_SRS_MQTT_CLIENT_07_094: [With a maximum ack delay the acknowledgements shall be held across receive calls and sent from mqtt_client_dowork once the oldest has waited maxAckDelayMs.]*/
+                flushAcknowledgements(mqtt_client);
+            }
+        }
+
+        if (mqtt_client->offlineCount > 0 && mqtt_client->socketConnected && mqtt_client->clientConnected && mqtt_client->publishChunk == NULL)
+        {
+            drainOfflineQueue(mqtt_client);
+        }
+
+        /*Codes_SRS_MQTT_CLIENT_07_025: [mqtt_client_dowork shall retrieve the the last packet send value and ...]*/
+        if (mqtt_client->socketConnected && mqtt_client->clientConnected && mqtt_client->keepAliveInterval > 0)
+        {
+            tickcounter_ms_t current_ms;
+            if (tickcounter_get_current_ms(mqtt_client->packetTickCntr, &current_ms) != 0)
+            {
+                LogError("Error: tickcounter_get_current_ms failed");
+            }
+            else
+            {
+                /* Codes_SRS_MQTT_CLIENT_07_035: [If the timeSincePing has expired past the maxPingRespTime then mqtt_client_dowork shall call the Error Callback function with the message MQTT_CLIENT_NO_PING_RESPONSE] */
+                if (mqtt_client->timeSincePing > 0 && ((current_ms - mqtt_client->timeSincePing)/1000) > mqtt_client->maxPingRespTime)
+                {
+                    // We haven't gotten a ping response in the alloted time
+                    set_error_callback(mqtt_client, MQTT_CLIENT_NO_PING_RESPONSE);
+                    mqtt_client->timeSincePing = 0;
+                    mqtt_client->packetSendTimeMs = 0;
+                    mqtt_client->packetState = UNKNOWN_TYPE;
+                }
+                else if (((current_ms - mqtt_client->packetSendTimeMs) / 1000) >= mqtt_client->keepAliveInterval)
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_026: [if keepAliveInternal is > 0 and the send time is greater than the MQTT KeepAliveInterval then it shall construct an MQTT PINGREQ packet.]*/
+                    (void)sendPacketItem(mqtt_client, MQTT_PINGREQ_PACKET, sizeof(MQTT_PINGREQ_PACKET));
+                    (void)tickcounter_get_current_ms(mqtt_client->packetTickCntr, &mqtt_client->timeSincePing);
+
+                    if (mqtt_client->logTrace)
+                    {
+                        STRING_HANDLE trace_log = STRING_construct("PINGREQ");
+                        log_outgoing_trace(mqtt_client, trace_log);
+                        STRING_delete(trace_log);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void mqtt_client_set_trace(MQTT_CLIENT_HANDLE handle, bool traceOn, bool rawBytesOn)
+{
+    AZURE_UNREFERENCED_PARAMETER(handle);
+    AZURE_UNREFERENCED_PARAMETER(traceOn);
+    AZURE_UNREFERENCED_PARAMETER(rawBytesOn);
+#ifndef NO_LOGGING
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client != NULL)
+    {
+        mqtt_client->logTrace = traceOn;
+#ifdef ENABLE_RAW_TRACE
+        mqtt_client->rawBytesTrace = rawBytesOn;
+#endif
+    }
+#endif
+}
+
+int mqtt_client_set_capture(MQTT_CLIENT_HANDLE handle, MQTT_CAPTURE_HANDLE captureHandle)
 {
     int result;
-    /*SRS_MQTT_CLIENT_07_006: [If any of the parameters handle, ioHandle, or mqttOptions are NULL then mqtt_client_connect shall return a non-zero value.]*/
-    if (handle == NULL || mqttOptions == NULL || xioHandle == NULL)
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_038: [If the parameter handle is NULL then mqtt_client_set_capture shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p", mqtt_client);
+        result = __FAILURE__;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_039: [mqtt_client_set_capture shall record every byte sent and received by the client into captureHandle, a NULL captureHandle stops the capture.]*/
+        mqtt_client->captureHandle = captureHandle;
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_client_set_persistence(MQTT_CLIENT_HANDLE handle, MQTT_PERSIST_HANDLE persistHandle)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_040: [If the parameter handle is NULL then mqtt_client_set_persistence shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p", mqtt_client);
+        result = __FAILURE__;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_041: [mqtt_client_set_persistence shall store every QoS 1 and 2 PUBLISH packet in persistHandle until it is acknowledged, a NULL persistHandle disables persistence.]*/
+        mqtt_client->persistHandle = persistHandle;
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_client_set_offline_queue(MQTT_CLIENT_HANDLE handle, const MQTT_OFFLINE_QUEUE_OPTIONS* options)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_045: [If the parameter handle is NULL then mqtt_client_set_offline_queue shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p", mqtt_client);
+        result = __FAILURE__;
+    }
+    else if (options == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_051: [If options is NULL then mqtt_client_set_offline_queue shall discard the queued publishes and disable the offline queue.]*/
+        clearOfflineQueue(mqtt_client);
+        result = 0;
+    }
+    else if (mqtt_client->offlineQueue == NULL && (mqtt_client->offlineQueue = singlylinkedlist_create()) == NULL)
+    {
+        LogError("Failure creating offline queue");
+        result = __FAILURE__;
+    }
+    else
+    {
+        mqtt_client->offlineOptions = *options;
+        result = 0;
+    }
+    return result;
+}
+
+size_t mqtt_client_get_offline_queue_count(MQTT_CLIENT_HANDLE handle)
+{
+    size_t result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL)
+    {
+        LogError("Invalid parameter specified mqtt_client: %p", mqtt_client);
+        result = 0;
+    }
+    else
+    {
+        result = mqtt_client->offlineCount;
+    }
+    return result;
+}
+
+int mqtt_client_set_reconnect(MQTT_CLIENT_HANDLE handle, const MQTT_RECONNECT_OPTIONS* options)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL || (options != NULL && options->maxDelayMs < options->initialDelayMs))
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_052: [If the parameter handle is NULL or maxDelayMs is smaller than initialDelayMs then mqtt_client_set_reconnect shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, options: %p", mqtt_client, options);
+        result = __FAILURE__;
+    }
+    else if (options == NULL)
+    {
+        mqtt_client->reconnectEnabled = false;
+        mqtt_client->reconnectPending = false;
+        mqtt_client->reconnecting = false;
+        if (mqtt_client->subscriptions != NULL)
+        {
+            clearSubscriptions(mqtt_client);
+            singlylinkedlist_destroy(mqtt_client->subscriptions);
+            mqtt_client->subscriptions = NULL;
+        }
+        result = 0;
+    }
+    else if (mqtt_client->subscriptions == NULL && (mqtt_client->subscriptions = singlylinkedlist_create()) == NULL)
+    {
+        LogError("Failure creating subscription list");
+        result = __FAILURE__;
+    }
+    else
+    {
+        mqtt_client->reconnectOptions = *options;
+        mqtt_client->reconnectEnabled = true;
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_client_get_connection_limits(MQTT_CLIENT_HANDLE handle, MQTT_CONNECTION_LIMITS* limits)
+{
+    int result;
+    if (handle == NULL || limits == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_061: [If the parameters handle or limits are NULL then mqtt_client_get_connection_limits shall return a non-zero value.]*/
+        LogError("Invalid parameter specified handle: %p, limits: %p", handle, limits);
+        result = __FAILURE__;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_068: [mqtt_client_get_connection_limits shall copy the limits negotiated with the server into limits, the 3.1.1 defaults being a Receive Maximum of 65535, no Maximum Packet Size, no topic aliases, QoS 2 and retain available.]*/
+        *limits = handle->serverLimits;
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_client_set_max_inflight(MQTT_CLIENT_HANDLE handle, uint16_t maxInflight)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_075: [If the parameter handle is NULL then mqtt_client_set_max_inflight shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p", mqtt_client);
+        result = __FAILURE__;
+    }
+    else
+    {
+        mqtt_client->maxInflight = maxInflight;
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_client_set_ack_delay(MQTT_CLIENT_HANDLE handle, size_t maxAckDelayMs)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_092: [If the parameter handle is NULL then mqtt_client_set_ack_delay shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p", mqtt_client);
+        result = __FAILURE__;
+    }
+    else
+    {
+        mqtt_client->maxAckDelayMs = maxAckDelayMs;
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_client_set_manual_ack(MQTT_CLIENT_HANDLE handle, ON_MQTT_MESSAGE_RECV_ACK_CALLBACK msgRecv, void* callbackCtx)
+{
+    int result;
+    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
+    if (mqtt_client == NULL)
     {
-        LogError("mqtt_client_connect: NULL argument (handle = %p, mqttOptions = %p, xioHandle: %p)", handle, mqttOptions, xioHandle);
+        /*Codes_SRS_MQTT_CLIENT_07_096: [If the parameter handle is NULL then mqtt_client_set_manual_ack shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p", mqtt_client);
         result = __FAILURE__;
     }
-    else
+    else if (msgRecv != NULL && mqtt_client->manualAckLock == NULL)
     {
-        MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
-        mqtt_client->xioHandle = xioHandle;
-        mqtt_client->packetState = UNKNOWN_TYPE;
-        mqtt_client->qosValue = mqttOptions->qualityOfServiceValue;
-        mqtt_client->keepAliveInterval = mqttOptions->keepAliveInterval;
-        mqtt_client->maxPingRespTime = (DEFAULT_MAX_PING_RESPONSE_TIME < mqttOptions->keepAliveInterval/2) ? DEFAULT_MAX_PING_RESPONSE_TIME : mqttOptions->keepAliveInterval/2;
-        if (cloneMqttOptions(mqtt_client, mqttOptions) != 0)
-        {
-            LogError("Error: Clone Mqtt Options failed");
-            result = __FAILURE__;
-        }
-        /*Codes_SRS_MQTT_CLIENT_07_008: [mqtt_client_connect shall open the XIO_HANDLE by calling into the xio_open interface.]*/
-        else if (xio_open(xioHandle, onOpenComplete, mqtt_client, onBytesReceived, mqtt_client, onIoError, mqtt_client) != 0)
+        if ((mqtt_client->manualAcks = VECTOR_create(sizeof(MQTT_ACK_TOKEN))) == NULL ||
+            (mqtt_client->drainingAcks = VECTOR_create(sizeof(MQTT_ACK_TOKEN))) == NULL ||
+            (mqtt_client->manualAckLock = Lock_Init()) == NULL)
         {
-            /*Codes_SRS_MQTT_CLIENT_07_007: [If any failure is encountered then mqtt_client_connect shall return a non-zero value.]*/
-            LogError("Error: io_open failed");
+            LogError("Failure allocating the manual acknowledgement queue");
+            if (mqtt_client->manualAcks != NULL)
+            {
+                VECTOR_destroy(mqtt_client->manualAcks);
+            }
+            if (mqtt_client->drainingAcks != NULL)
+            {
+                VECTOR_destroy(mqtt_client->drainingAcks);
+            }
+            mqtt_client->manualAcks = NULL;
+            mqtt_client->drainingAcks = NULL;
             result = __FAILURE__;
-            mqtt_client->xioHandle = NULL;
-            // Remove cloned options
-            clear_mqtt_options(mqtt_client);
         }
         else
         {
+            mqtt_client->fnMessageRecvAck = msgRecv;
+            mqtt_client->recvAckCtx = callbackCtx;
             result = 0;
         }
     }
+    else
+    {
+        // The queue is kept so that tokens handed out before stay valid
+        mqtt_client->fnMessageRecvAck = msgRecv;
+        mqtt_client->recvAckCtx = callbackCtx;
+        result = 0;
+    }
     return result;
 }
 
-int mqtt_client_publish(MQTT_CLIENT_HANDLE handle, MQTT_MESSAGE_HANDLE msgHandle)
+int mqtt_client_ack(MQTT_CLIENT_HANDLE handle, MQTT_ACK_TOKEN ackToken)
 {
     int result;
     MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
-    if (mqtt_client == NULL || msgHandle == NULL)
+    uint32_t qosValue = (uint32_t)((ackToken >> 16) & 0xffff);
+    if (mqtt_client == NULL || mqtt_client->manualAckLock == NULL ||
+        (ackToken != 0 && qosValue != DELIVER_AT_LEAST_ONCE && qosValue != DELIVER_EXACTLY_ONCE))
     {
-        /*Codes_SRS_MQTT_CLIENT_07_019: [If one of the parameters handle or msgHandle is NULL then mqtt_client_publish shall return a non-zero value.]*/
-        LogError("Invalid parameter specified mqtt_client: %p, msgHandle: %p", mqtt_client, msgHandle);
+        /*Codes_SRS_MQTT_CLIENT_07_100: [If the parameter handle is NULL, manual acknowledgement was never enabled or ackToken was not handed out by the client then mqtt_client_ack shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, ackToken: %" PRIu64, mqtt_client, ackToken);
+        result = __FAILURE__;
+    }
+    else if (ackToken == 0)
+    {
+        // QoS 0 messages have nothing to acknowledge
+        result = 0;
+    }
+    else if (Lock(mqtt_client->manualAckLock) != LOCK_OK)
+    {
+        LogError("Failure locking the manual acknowledgements");
         result = __FAILURE__;
     }
     else
     {
-        /*Codes_SRS_MQTT_CLIENT_07_021: [mqtt_client_publish shall get the message information from the MQTT_MESSAGE_HANDLE.]*/
-        const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(msgHandle);
-        if (payload == NULL)
+        /*Codes_SRS_MQTT_CLIENT_07_101: [mqtt_client_ack may be called from any thread, it shall queue the acknowledgement for the next call to mqtt_client_dowork.]*/
+        if (VECTOR_push_back(mqtt_client->manualAcks, &ackToken, 1) != 0)
         {
-            /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
-            LogError("Error: mqttmessage_getApplicationMsg failed");
+            LogError("Failure queuing the acknowledgement");
             result = __FAILURE__;
         }
         else
         {
-            STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
-
-            QOS_VALUE qos = mqttmessage_getQosType(msgHandle);
-            bool isDuplicate = mqttmessage_getIsDuplicateMsg(msgHandle);
-            bool isRetained = mqttmessage_getIsRetained(msgHandle);
-            uint16_t packetId = mqttmessage_getPacketId(msgHandle);
-            const char* topicName = mqttmessage_getTopicName(msgHandle);
-            BUFFER_HANDLE publishPacket = mqtt_codec_publish(qos, isDuplicate, isRetained, packetId, topicName, payload->message, payload->length, trace_log);
-            if (publishPacket == NULL)
-            {
-                /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
-                LogError("Error: mqtt_codec_publish failed");
-                result = __FAILURE__;
-            }
-            else
-            {
-                mqtt_client->packetState = PUBLISH_TYPE;
-
-                /*Codes_SRS_MQTT_CLIENT_07_022: [On success mqtt_client_publish shall send the MQTT SUBCRIBE packet to the endpoint.]*/
-                size_t size = BUFFER_length(publishPacket);
-                if (sendPacketItem(mqtt_client, BUFFER_u_char(publishPacket), size) != 0)
-                {
-                    /*Codes_SRS_MQTT_CLIENT_07_020: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
-                    LogError("Error: mqtt_client_publish send failed");
-                    result = __FAILURE__;
-                }
-                else
-                {
-                    log_outgoing_trace(mqtt_client, trace_log);
-                    result = 0;
-                }
-                BUFFER_delete(publishPacket);
-            }
-            if (trace_log != NULL)
-            {
-                STRING_delete(trace_log);
-            }
+            result = 0;
         }
+        (void)Unlock(mqtt_client->manualAckLock);
     }
     return result;
 }
 
-int mqtt_client_subscribe(MQTT_CLIENT_HANDLE handle, uint16_t packetId, SUBSCRIBE_PAYLOAD* subscribeList, size_t count)
+int mqtt_client_get_inflight_window(MQTT_CLIENT_HANDLE handle, size_t* inflightCount, size_t* windowSize)
 {
     int result;
     MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
-    if (mqtt_client == NULL || subscribeList == NULL || count == 0 || packetId == 0)
+    if (mqtt_client == NULL || inflightCount == NULL || windowSize == NULL)
     {
-        /*Codes_SRS_MQTT_CLIENT_07_013: [If any of the parameters handle, subscribeList is NULL or count is 0 then mqtt_client_subscribe shall return a non-zero value.]*/
-        LogError("Invalid parameter specified mqtt_client: %p, subscribeList: %p, count: %lu, packetId: %d", mqtt_client, subscribeList, (unsigned long)count, packetId);
+        /*Codes_SRS_MQTT_CLIENT_07_079: [If any of the parameters handle, inflightCount or windowSize is NULL then mqtt_client_get_inflight_window shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, inflightCount: %p, windowSize: %p", mqtt_client, inflightCount, windowSize);
         result = __FAILURE__;
     }
     else
     {
-        STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
-
-        BUFFER_HANDLE subPacket = mqtt_codec_subscribe(packetId, subscribeList, count, trace_log);
-        if (subPacket == NULL)
-        {
-            /*Codes_SRS_MQTT_CLIENT_07_014: [If any failure is encountered then mqtt_client_subscribe shall return a non-zero value.]*/
-            LogError("Error: mqtt_codec_subscribe failed");
-            result = __FAILURE__;
-        }
-        else
-        {
-            mqtt_client->packetState = SUBSCRIBE_TYPE;
-
-            size_t size = BUFFER_length(subPacket);
-            /*Codes_SRS_MQTT_CLIENT_07_015: [On success mqtt_client_subscribe shall send the MQTT SUBCRIBE packet to the endpoint.]*/
-            if (sendPacketItem(mqtt_client, BUFFER_u_char(subPacket), size) != 0)
-            {
-                /*Codes_SRS_MQTT_CLIENT_07_014: [If any failure is encountered then mqtt_client_subscribe shall return a non-zero value.]*/
-                LogError("Error: mqtt_client_subscribe send failed");
-                result = __FAILURE__;
-            }
-            else
-            {
-                log_outgoing_trace(mqtt_client, trace_log);
-                result = 0;
-            }
-            BUFFER_delete(subPacket);
-        }
-        if (trace_log != NULL)
-        {
-            STRING_delete(trace_log);
-        }
+        /*Codes_SRS_MQTT_CLIENT_07_080: [mqtt_client_get_inflight_window shall return the number of unacknowledged QoS 1 and 2 publishes and the size of the window, the smaller of maxInflight and the server Receive Maximum.]*/
+        *inflightCount = mqtt_client->inflightCount;
+        *windowSize = getInflightWindow(mqtt_client);
+        result = 0;
     }
     return result;
 }
 
-int mqtt_client_unsubscribe(MQTT_CLIENT_HANDLE handle, uint16_t packetId, const char** unsubscribeList, size_t count)
+int mqtt_client_set_message_stream(MQTT_CLIENT_HANDLE handle, size_t threshold, ON_MQTT_MESSAGE_CHUNK_CALLBACK chunkCallback, void* callbackCtx)
 {
     int result;
     MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
-    if (mqtt_client == NULL || unsubscribeList == NULL || count == 0 || packetId == 0)
+    if (mqtt_client == NULL)
     {
-        /*Codes_SRS_MQTT_CLIENT_07_016: [If any of the parameters handle, unsubscribeList is NULL or count is 0 then mqtt_client_unsubscribe shall return a non-zero value.]*/
-        LogError("Invalid parameter specified mqtt_client: %p, unsubscribeList: %p, count: %lu, packetId: %d", mqtt_client, unsubscribeList, (unsigned long)count, packetId);
+        /*Codes_SRS_MQTT_CLIENT_07_081: [If the parameter handle is NULL then mqtt_client_set_message_stream shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p", mqtt_client);
         result = __FAILURE__;
     }
     else
     {
-        STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
-
-        BUFFER_HANDLE unsubPacket = mqtt_codec_unsubscribe(packetId, unsubscribeList, count, trace_log);
-        if (unsubPacket == NULL)
+        size_t streamThreshold = (chunkCallback != NULL) ? threshold : 0;
+        if (mqtt_codec_set_publish_stream(mqtt_client->codec_handle, streamThreshold, isProtocolV5(mqtt_client), onPublishStream) != 0)
         {
-            /*Codes_SRS_MQTT_CLIENT_07_017: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.]*/
-            LogError("Error: mqtt_codec_unsubscribe failed");
+            LogError("Error: mqtt_codec_set_publish_stream failed");
             result = __FAILURE__;
         }
         else
         {
-            mqtt_client->packetState = UNSUBSCRIBE_TYPE;
-
-            size_t size = BUFFER_length(unsubPacket);
-            /*Codes_SRS_MQTT_CLIENT_07_018: [On success mqtt_client_unsubscribe shall send the MQTT SUBCRIBE packet to the endpoint.]*/
-            if (sendPacketItem(mqtt_client, BUFFER_u_char(unsubPacket), size) != 0)
-            {
-                /*Codes_SRS_MQTT_CLIENT_07_017: [If any failure is encountered then mqtt_client_unsubscribe shall return a non-zero value.].]*/
-                LogError("Error: mqtt_client_unsubscribe send failed");
-                result = __FAILURE__;
-            }
-            else
-            {
-                log_outgoing_trace(mqtt_client, trace_log);
-                result = 0;
-            }
-            BUFFER_delete(unsubPacket);
-        }
-        if (trace_log != NULL)
-        {
-            STRING_delete(trace_log);
+            mqtt_client->streamThreshold = streamThreshold;
+            mqtt_client->fnMessageChunk = chunkCallback;
+            mqtt_client->chunkCtx = callbackCtx;
+            result = 0;
         }
     }
     return result;
 }
 
-int mqtt_client_disconnect(MQTT_CLIENT_HANDLE handle, ON_MQTT_DISCONNECTED_CALLBACK callback, void* ctx)
+int mqtt_client_publish_stream(MQTT_CLIENT_HANDLE handle, MQTT_MESSAGE_HANDLE msgHandle, size_t payloadLength, size_t chunkSize, ON_MQTT_PUBLISH_CHUNK_CALLBACK chunkCallback, void* callbackCtx)
 {
     int result;
     MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
-    if (mqtt_client == NULL)
+    if (mqtt_client == NULL || msgHandle == NULL || chunkCallback == NULL || chunkSize == 0)
     {
-        /*Codes_SRS_MQTT_CLIENT_07_010: [If the parameters handle is NULL then mqtt_client_disconnect shall return a non-zero value.]*/
+        /*Codes_SRS_MQTT_CLIENT_07_085: [If any of the parameters handle, msgHandle or chunkCallback is NULL or chunkSize is 0 then mqtt_client_publish_stream shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, msgHandle: %p, chunkCallback: %p, chunkSize: %lu", mqtt_client, msgHandle, chunkCallback, (unsigned long)chunkSize);
+        result = __FAILURE__;
+    }
+    else if (!mqtt_client->socketConnected || !mqtt_client->clientConnected || mqtt_client->publishChunk != NULL)
+    {
+        /*Codes_SRS_MQTT_CLIENT_07_086: [mqtt_client_publish_stream shall return a non-zero value when the client is not connected or another streamed publish is being sent, a streamed publish is neither queued offline nor persisted.]*/
+        LogError("Error: a streamed publish needs a connected client without another streamed publish");
         result = __FAILURE__;
     }
     else
     {
-        if (mqtt_client->clientConnected)
+        QOS_VALUE qos = mqttmessage_getQosType(msgHandle);
+        if (isInflightWindowFull(mqtt_client, qos))
+        {
+            /*Codes_SRS_MQTT_CLIENT_07_087: [mqtt_client_publish_stream shall return a non-zero value without sending when the in-flight window is full or the PUBLISH would be larger than the Maximum Packet Size announced by the server.]*/
+            LogError("Error: in-flight window of %lu publishes is full", (unsigned long)getInflightWindow(mqtt_client));
+            result = __FAILURE__;
+        }
+        else
         {
-            BUFFER_HANDLE disconnectPacket = mqtt_codec_disconnect();
-            if (disconnectPacket == NULL)
+            STRING_HANDLE trace_log = construct_trace_log_handle(mqtt_client);
+            bool isDuplicate = mqttmessage_getIsDuplicateMsg(msgHandle);
+            bool isRetained = mqttmessage_getIsRetained(msgHandle);
+            uint16_t packetId = mqttmessage_getPacketId(msgHandle);
+            const char* topicName = mqttmessage_getTopicName(msgHandle);
+            size_t bufferSize = (payloadLength < chunkSize) ? payloadLength : chunkSize;
+            uint8_t* chunk = NULL;
+
+            /*Codes_SRS_MQTT_CLIENT_07_091: [mqtt_client_publish_stream shall send the fixed and variable header of the PUBLISH declaring payloadLength bytes of payload and return, the payload is pulled from chunkCallback by mqtt_client_dowork.]*/
+            BUFFER_HANDLE headerPacket = isProtocolV5(mqtt_client) ?
+                mqtt_codec_publish_header_v5(qos, isDuplicate, isRetained, packetId, topicName, payloadLength, NULL, trace_log) :
+                mqtt_codec_publish_header(qos, isDuplicate, isRetained, packetId, topicName, payloadLength, trace_log);
+            if (headerPacket == NULL)
             {
-                /*Codes_SRS_MQTT_CLIENT_07_011: [If any failure is encountered then mqtt_client_disconnect shall return a non-zero value.]*/
-                LogError("Error: mqtt_client_disconnect failed");
-                mqtt_client->packetState = PACKET_TYPE_ERROR;
+                LogError("Error: mqtt_codec_publish_header failed");
                 result = __FAILURE__;
             }
             else
             {
-                /* Codes_SRS_MQTT_CLIENT_07_037: [ if callback is not NULL callback shall be called once the mqtt connection has been disconnected ] */
-                mqtt_client->disconnect_cb = callback;
-                mqtt_client->disconnect_ctx = ctx;
-                mqtt_client->packetState = DISCONNECT_TYPE;
-
-                size_t size = BUFFER_length(disconnectPacket);
-                /*Codes_SRS_MQTT_CLIENT_07_012: [On success mqtt_client_disconnect shall send the MQTT DISCONNECT packet to the endpoint.]*/
-                if (sendPacketItem(mqtt_client, BUFFER_u_char(disconnectPacket), size) != 0)
+                size_t size = BUFFER_length(headerPacket);
+                if (mqtt_client->serverLimits.maximumPacketSize != 0 && size + payloadLength > mqtt_client->serverLimits.maximumPacketSize)
+                {
+                    /*Codes_SRS_MQTT_CLIENT_07_087: [mqtt_client_publish_stream shall return a non-zero value without sending when the in-flight window is full or the PUBLISH would be larger than the Maximum Packet Size announced by the server.]*/
+                    LogError("Error: publish exceeds the server maximum packet size %lu", (unsigned long)mqtt_client->serverLimits.maximumPacketSize);
+                    result = __FAILURE__;
+                }
+                else if (bufferSize > 0 && (chunk = (uint8_t*)malloc(bufferSize)) == NULL)
+                {
+                    LogError("Error: allocating the publish chunk failed");
+                    result = __FAILURE__;
+                }
+                else if (sendPacketItem(mqtt_client, BUFFER_u_char(headerPacket), size) != 0)
                 {
-                    /*Codes_SRS_MQTT_CLIENT_07_011: [If any failure is encountered then mqtt_client_disconnect shall return a non-zero value.]*/
-                    LogError("Error: mqtt_client_disconnect send failed");
+                    LogError("Error: mqtt_client_publish_stream send failed");
+                    free(chunk);
                     result = __FAILURE__;
                 }
                 else
                 {
-                    if (mqtt_client->logTrace)
+                    mqtt_client->packetState = PUBLISH_TYPE;
+                    if (qos != DELIVER_AT_MOST_ONCE)
                     {
-                        STRING_HANDLE trace_log = STRING_construct("DISCONNECT");
-                        log_outgoing_trace(mqtt_client, trace_log);
-                        STRING_delete(trace_log);
+                        mqtt_client->inflightCount++;
+                    }
+                    if (chunk != NULL)
+                    {
+                        mqtt_client->fnPublishChunk = chunkCallback;
+                        mqtt_client->publishChunkCtx = callbackCtx;
+                        mqtt_client->publishChunk = chunk;
+                        mqtt_client->publishChunkSize = bufferSize;
+                        mqtt_client->publishOffset = 0;
+                        mqtt_client->publishLength = payloadLength;
+                        mqtt_client->publishChunkPending = false;
+                        mqtt_client->publishStreamFailed = false;
                     }
+                    log_outgoing_trace(mqtt_client, trace_log);
                     result = 0;
                 }
-                BUFFER_delete(disconnectPacket);
+                BUFFER_delete(headerPacket);
+            }
+            if (trace_log != NULL)
+            {
+                STRING_delete(trace_log);
             }
-            clear_mqtt_options(mqtt_client);
-        }
-        else
-        {
-            // If the client is not connected then just close the underlying socket
-            mqtt_client->disconnect_cb = callback;
-            mqtt_client->disconnect_ctx = ctx;
-
-            close_connection(mqtt_client);
-            clear_mqtt_options(mqtt_client);
-            result = 0;
         }
     }
     return result;
 }
 
-void mqtt_client_dowork(MQTT_CLIENT_HANDLE handle)
+int mqtt_client_set_payload_transform(MQTT_CLIENT_HANDLE handle, const char* topicFilter, const MQTT_PAYLOAD_TRANSFORM* transform)
 {
+    int result;
     MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
-    /*Codes_SRS_MQTT_CLIENT_18_001: [If the client is disconnected, mqtt_client_dowork shall do nothing.]*/
-    /*Codes_SRS_MQTT_CLIENT_07_023: [If the parameter handle is NULL then mqtt_client_dowork shall do nothing.]*/
-    if (mqtt_client != NULL && mqtt_client->xioHandle != NULL)
+    if (mqtt_client == NULL || topicFilter == NULL || *topicFilter == '\0' ||
+        (transform != NULL && (transform->contentType == NULL || transform->getEncodedBound == NULL || transform->encode == NULL || transform->decode == NULL)))
     {
-        /*Codes_SRS_MQTT_CLIENT_07_024: [mqtt_client_dowork shall call the xio_dowork function to complete operations.]*/
-        xio_dowork(mqtt_client->xioHandle);
+        /*Codes_SRS_MQTT_CLIENT_07_106: [If the parameter handle or topicFilter is NULL, topicFilter is empty or a member of transform is NULL then mqtt_client_set_payload_transform shall return a non-zero value.]*/
+        LogError("Invalid parameter specified mqtt_client: %p, topicFilter: %p, transform: %p", mqtt_client, topicFilter, transform);
+        result = __FAILURE__;
+    }
+    else
+    {
+        size_t index;
+        for (index = 0; index < mqtt_client->payloadTransformCount; index++)
+        {
+            if (strcmp(mqtt_client->payloadTransforms[index].topicFilter, topicFilter) == 0)
+            {
+                break;
+            }
+        }
 
-        /*Codes_SRS_MQTT_CLIENT_07_025: [mqtt_client_dowork shall retrieve the the last packet send value and ...]*/
-        if (mqtt_client->socketConnected && mqtt_client->clientConnected && mqtt_client->keepAliveInterval > 0)
+        /*Codes_SRS_MQTT_CLIENT_07_107: [mqtt_client_set_payload_transform shall add topicFilter with transform, replace the transform of a topicFilter already set, or remove topicFilter when transform is NULL.]*/
+        if (index < mqtt_client->payloadTransformCount)
         {
-            tickcounter_ms_t current_ms;
-            if (tickcounter_get_current_ms(mqtt_client->packetTickCntr, &current_ms) != 0)
+            if (transform != NULL)
             {
-                LogError("Error: tickcounter_get_current_ms failed");
+                mqtt_client->payloadTransforms[index].transform = transform;
             }
             else
             {
-                /* Codes_SRS_MQTT_CLIENT_07_035: [If the timeSincePing has expired past the maxPingRespTime then mqtt_client_dowork shall call the Error Callback function with the message MQTT_CLIENT_NO_PING_RESPONSE] */
-                if (mqtt_client->timeSincePing > 0 && ((current_ms - mqtt_client->timeSincePing)/1000) > mqtt_client->maxPingRespTime)
-                {
-                    // We haven't gotten a ping response in the alloted time
-                    set_error_callback(mqtt_client, MQTT_CLIENT_NO_PING_RESPONSE);
-                    mqtt_client->timeSincePing = 0;
-                    mqtt_client->packetSendTimeMs = 0;
-                    mqtt_client->packetState = UNKNOWN_TYPE;
-                }
-                else if (((current_ms - mqtt_client->packetSendTimeMs) / 1000) >= mqtt_client->keepAliveInterval)
+                free(mqtt_client->payloadTransforms[index].topicFilter);
+                mqtt_client->payloadTransformCount--;
+                (void)memmove(&mqtt_client->payloadTransforms[index], &mqtt_client->payloadTransforms[index + 1], (mqtt_client->payloadTransformCount - index) * sizeof(PAYLOAD_TRANSFORM_ENTRY));
+            }
+            result = 0;
+        }
+        else if (transform == NULL)
+        {
+            result = 0;
+        }
+        else
+        {
+            PAYLOAD_TRANSFORM_ENTRY* entries = (PAYLOAD_TRANSFORM_ENTRY*)malloc((mqtt_client->payloadTransformCount + 1) * sizeof(PAYLOAD_TRANSFORM_ENTRY));
+            char* filterCopy;
+            if (entries == NULL)
+            {
+                LogError("Failure allocating payload transforms");
+                result = __FAILURE__;
+            }
+            else if (mallocAndStrcpy_s(&filterCopy, topicFilter) != 0)
+            {
+                LogError("Failure copying topic filter");
+                free(entries);
+                result = __FAILURE__;
+            }
+            else
+            {
+                if (mqtt_client->payloadTransforms != NULL)
                 {
-                    /*Codes_SRS_MQTT_CLIENT_07_026: [if keepAliveInternal is > 0 and the send time is greater than the MQTT KeepAliveInterval then it shall construct an MQTT PINGREQ packet.]*/
-                    BUFFER_HANDLE pingPacket = mqtt_codec_ping();
-                    if (pingPacket != NULL)
-                    {
-                        size_t size = BUFFER_length(pingPacket);
-                        (void)sendPacketItem(mqtt_client, BUFFER_u_char(pingPacket), size);
-                        BUFFER_delete(pingPacket);
-                        (void)tickcounter_get_current_ms(mqtt_client->packetTickCntr, &mqtt_client->timeSincePing);
-
-                        if (mqtt_client->logTrace)
-                        {
-                            STRING_HANDLE trace_log = STRING_construct("PINGREQ");
-                            log_outgoing_trace(mqtt_client, trace_log);
-                            STRING_delete(trace_log);
-                        }
-                    }
+                    (void)memcpy(entries, mqtt_client->payloadTransforms, mqtt_client->payloadTransformCount * sizeof(PAYLOAD_TRANSFORM_ENTRY));
+                    free(mqtt_client->payloadTransforms);
                 }
+                entries[mqtt_client->payloadTransformCount].topicFilter = filterCopy;
+                entries[mqtt_client->payloadTransformCount].transform = transform;
+                mqtt_client->payloadTransforms = entries;
+                mqtt_client->payloadTransformCount++;
+                result = 0;
             }
         }
     }
-}
-
-void mqtt_client_set_trace(MQTT_CLIENT_HANDLE handle, bool traceOn, bool rawBytesOn)
-{
-    AZURE_UNREFERENCED_PARAMETER(handle);
-    AZURE_UNREFERENCED_PARAMETER(traceOn);
-    AZURE_UNREFERENCED_PARAMETER(rawBytesOn);
-#ifndef NO_LOGGING
-    MQTT_CLIENT* mqtt_client = (MQTT_CLIENT*)handle;
-    if (mqtt_client != NULL)
-    {
-        mqtt_client->logTrace = traceOn;
-#ifdef ENABLE_RAW_TRACE
-        mqtt_client->rawBytesTrace = rawBytesOn;
-#endif
-    }
-#endif
+    return result;
 }
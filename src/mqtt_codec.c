@@ -11,6 +11,9 @@
 #include "azure_c_shared_utility/xlogging.h"
 #include "azure_umqtt_c/mqtt_codec.h"
 #include <inttypes.h>
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
 
 #define PAYLOAD_OFFSET                      5
 #define PACKET_TYPE_BYTE(p)                 (CONTROL_PACKET_TYPE)((uint8_t)(((uint8_t)(p)) & 0xf0))
@@ -30,6 +33,7 @@
 #define PUBLISH_QOS_RETAIN                  0x1
 
 #define PROTOCOL_NUMBER                     4
+#define PROTOCOL_NUMBER_V5                  5
 #define CONN_FLAG_BYTE_OFFSET               7
 
 #define CONNECT_FIXED_HEADER_SIZE           2
@@ -38,11 +42,17 @@
 #define UNSUBSCRIBE_FIXED_HEADER_FLAG       0x2
 
 #define MAX_SEND_SIZE                       0xFFFFFF7F
+#define MAX_VARIABLE_BYTE_INTEGER_SIZE      4
+#define MAX_REMAINING_LENGTH                268435455
 
-#define CODEC_STATE_VALUES      \
-    CODEC_STATE_FIXED_HEADER,   \
-    CODEC_STATE_VAR_HEADER,     \
-    CODEC_STATE_PAYLOAD
+#define PUBLISH_TOPIC_LENGTH_SIZE           2
+
+#define CODEC_STATE_VALUES          \
+    CODEC_STATE_FIXED_HEADER,       \
+    CODEC_STATE_VAR_HEADER,         \
+    CODEC_STATE_PAYLOAD,            \
+    CODEC_STATE_STREAM_HEADER,      \
+    CODEC_STATE_STREAM_PAYLOAD
 
 static const char* const TRUE_CONST = "true";
 static const char* const FALSE_CONST = "false";
@@ -60,6 +70,15 @@ typedef struct MQTTCODEC_INSTANCE_TAG
     void* callContext;
     uint8_t storeRemainLen[4];
     size_t remainLenIndex;
+    size_t maxPacketSize;
+    size_t streamThreshold;
+    bool streamProperties;
+    ON_PUBLISH_STREAM_CALLBACK publishStream;
+    size_t streamRemaining;
+    size_t streamPayloadLength;
+    BUFFER_HANDLE batchCarry;
+    size_t batchLength;
+    size_t batchConsumed;
 } MQTTCODEC_INSTANCE;
 
 typedef struct PUBLISH_HEADER_INFO_TAG
@@ -68,8 +87,20 @@ typedef struct PUBLISH_HEADER_INFO_TAG
     uint16_t packetId;
     const char* msgBuffer;
     QOS_VALUE qualityOfServiceValue;
+    bool includeProperties;
+    const MQTT_PROPERTIES* properties;
 } PUBLISH_HEADER_INFO;
 
+typedef struct MQTT_PUBLISH_TEMPLATE_TAG
+{
+    QOS_VALUE qosValue;
+    bool serverRetain;
+    uint8_t headerFlags;
+    // The topic as it is written on the wire, its length prefix followed by the topic and a terminating zero
+    size_t encodedTopicLength;
+    uint8_t* encodedTopic;
+} MQTT_PUBLISH_TEMPLATE;
+
 static const char* retrieve_qos_value(QOS_VALUE value)
 {
     switch (value)
@@ -114,6 +145,239 @@ static void byteutil_writeUTF(uint8_t** buffer, const char* stringData, uint16_t
     }
 }
 
+static void byteutil_writeUint32(uint8_t** buffer, uint32_t value)
+{
+    if (buffer != NULL)
+    {
+        byteutil_writeInt(buffer, (uint16_t)(value >> 16));
+        byteutil_writeInt(buffer, (uint16_t)(value & 0xFFFF));
+    }
+}
+
+// The continuation bits of the bytes available to the variable byte integer decoder
+static const uint32_t VAR_INT_AVAILABLE[] = { 0, 0x80, 0x8080, 0x808080, 0x80808080 };
+
+static void byteutil_writeVarInt(uint8_t** buffer, uint32_t value)
+{
+    if (buffer != NULL)
+    {
+        do
+        {
+            uint8_t encode = value % 128;
+            value /= 128;
+            if (value > 0)
+            {
+                encode |= NEXT_128_CHUNK;
+            }
+            **buffer = encode;
+            (*buffer)++;
+        } while (value > 0);
+    }
+}
+
+static size_t getVarIntSize(size_t value)
+{
+    return (value < 128) ? 1 : (value < 16384) ? 2 : (value < 2097152) ? 3 : 4;
+}
+
+/* Decodes a variable byte integer from up to four bytes without a loop over them. consumed is 0 when
+   the integer continues past the available bytes, a fourth byte with a continuation bit is malformed. */
+static int decodeVarInt(const uint8_t* buffer, size_t length, uint32_t* value, size_t* consumed)
+{
+    int result;
+    uint32_t word;
+    uint32_t lastBytes;
+    if (length >= MAX_VARIABLE_BYTE_INTEGER_SIZE)
+    {
+        // Compilers turn this into a single unaligned load
+        word = (uint32_t)buffer[0] | ((uint32_t)buffer[1] << 8) | ((uint32_t)buffer[2] << 16) | ((uint32_t)buffer[3] << 24);
+        lastBytes = ~word & VAR_INT_AVAILABLE[MAX_VARIABLE_BYTE_INTEGER_SIZE];
+    }
+    else
+    {
+        size_t index;
+        word = 0;
+        for (index = 0; index < length; index++)
+        {
+            word |= (uint32_t)buffer[index] << (8 * index);
+        }
+        lastBytes = ~word & VAR_INT_AVAILABLE[length];
+    }
+
+    // The last byte is the first one without its continuation bit
+    if (lastBytes == 0)
+    {
+        *consumed = 0;
+        *value = 0;
+        result = (length >= MAX_VARIABLE_BYTE_INTEGER_SIZE) ? __FAILURE__ : 0;
+    }
+    else
+    {
+#if defined(__GNUC__)
+        size_t lastIndex = (size_t)__builtin_ctz(lastBytes) >> 3;
+#else
+        size_t lastIndex = (size_t)((lastBytes & 0x80) == 0) + (size_t)((lastBytes & 0x8080) == 0) + (size_t)((lastBytes & 0x808080) == 0);
+#endif
+        // Drop the bytes after the last one and the continuation bits, then pack the 7 bit groups
+        word &= 0x7f7f7f7fu >> (8 * (3 - lastIndex));
+#if defined(__BMI2__)
+        *value = _pext_u32(word, 0x7f7f7f7fu);
+#else
+        word = (word & 0x007f007fu) | ((word & 0x7f007f00u) >> 1);
+        *value = (word & 0x3fffu) | ((word & 0x3fff0000u) >> 2);
+#endif
+        *consumed = lastIndex + 1;
+        result = 0;
+    }
+    return result;
+}
+
+static int byteutil_readVarInt(const uint8_t* buffer, size_t length, uint32_t* value, size_t* consumed)
+{
+    int result;
+    if (decodeVarInt(buffer, length, value, consumed) != 0 || *consumed == 0)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        result = 0;
+    }
+    return result;
+}
+
+static size_t getConnectPropertiesLength(const MQTT_CLIENT_OPTIONS* mqttOptions)
+{
+    size_t result = 0;
+    if (mqttOptions->sessionExpiryInterval != 0)
+    {
+        result += 1 + 4;
+    }
+    if (mqttOptions->receiveMaximum != 0)
+    {
+        result += 1 + 2;
+    }
+    if (mqttOptions->maximumPacketSize != 0)
+    {
+        result += 1 + 4;
+    }
+    if (mqttOptions->topicAliasMaximum != 0)
+    {
+        result += 1 + 2;
+    }
+    return result;
+}
+
+static void writeConnectProperties(uint8_t** iterator, const MQTT_CLIENT_OPTIONS* mqttOptions, size_t propertiesLength)
+{
+    byteutil_writeVarInt(iterator, (uint32_t)propertiesLength);
+    if (mqttOptions->sessionExpiryInterval != 0)
+    {
+        byteutil_writeByte(iterator, MQTT_PROPERTY_SESSION_EXPIRY_INTERVAL);
+        byteutil_writeUint32(iterator, mqttOptions->sessionExpiryInterval);
+    }
+    if (mqttOptions->receiveMaximum != 0)
+    {
+        byteutil_writeByte(iterator, MQTT_PROPERTY_RECEIVE_MAXIMUM);
+        byteutil_writeInt(iterator, mqttOptions->receiveMaximum);
+    }
+    if (mqttOptions->maximumPacketSize != 0)
+    {
+        byteutil_writeByte(iterator, MQTT_PROPERTY_MAXIMUM_PACKET_SIZE);
+        byteutil_writeUint32(iterator, mqttOptions->maximumPacketSize);
+    }
+    if (mqttOptions->topicAliasMaximum != 0)
+    {
+        byteutil_writeByte(iterator, MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM);
+        byteutil_writeInt(iterator, mqttOptions->topicAliasMaximum);
+    }
+}
+
+// Only the properties a client may put on a PUBLISH are encoded, returns 0 if a string property is too long
+static size_t getPublishPropertiesLength(const MQTT_PROPERTIES* properties, bool* isValid)
+{
+    size_t result = 0;
+    *isValid = true;
+    if (properties != NULL)
+    {
+        if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_PAYLOAD_FORMAT_INDICATOR))
+        {
+            result += 1 + 1;
+        }
+        if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_MESSAGE_EXPIRY_INTERVAL))
+        {
+            result += 1 + 4;
+        }
+        if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_TOPIC_ALIAS))
+        {
+            *isValid = *isValid && properties->topicAlias != 0;
+            result += 1 + 2;
+        }
+        if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_CONTENT_TYPE))
+        {
+            *isValid = *isValid && properties->contentType.length <= USHRT_MAX;
+            result += 1 + 2 + properties->contentType.length;
+        }
+        if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_RESPONSE_TOPIC))
+        {
+            *isValid = *isValid && properties->responseTopic.length <= USHRT_MAX;
+            result += 1 + 2 + properties->responseTopic.length;
+        }
+        if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_CORRELATION_DATA))
+        {
+            *isValid = *isValid && properties->correlationData.length <= USHRT_MAX;
+            result += 1 + 2 + properties->correlationData.length;
+        }
+    }
+    return result;
+}
+
+static void writePropertyData(uint8_t** iterator, MQTT_PROPERTY_ID id, const MQTT_PROPERTY_DATA* value)
+{
+    byteutil_writeByte(iterator, (uint8_t)id);
+    byteutil_writeInt(iterator, (uint16_t)value->length);
+    if (value->length > 0)
+    {
+        (void)memcpy(*iterator, value->data, value->length);
+        *iterator += value->length;
+    }
+}
+
+static void writePublishProperties(uint8_t** iterator, const MQTT_PROPERTIES* properties, size_t propertiesLength)
+{
+    byteutil_writeVarInt(iterator, (uint32_t)propertiesLength);
+    if (properties != NULL)
+    {
+        if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_PAYLOAD_FORMAT_INDICATOR))
+        {
+            byteutil_writeByte(iterator, MQTT_PROPERTY_PAYLOAD_FORMAT_INDICATOR);
+            byteutil_writeByte(iterator, properties->payloadFormatIndicator);
+        }
+        if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_MESSAGE_EXPIRY_INTERVAL))
+        {
+            byteutil_writeByte(iterator, MQTT_PROPERTY_MESSAGE_EXPIRY_INTERVAL);
+            byteutil_writeUint32(iterator, properties->messageExpiryInterval);
+        }
+        if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_TOPIC_ALIAS))
+        {
+            byteutil_writeByte(iterator, MQTT_PROPERTY_TOPIC_ALIAS);
+            byteutil_writeInt(iterator, properties->topicAlias);
+        }
+        if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_CONTENT_TYPE))
+        {
+            writePropertyData(iterator, MQTT_PROPERTY_CONTENT_TYPE, &properties->contentType);
+        }
+        if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_RESPONSE_TOPIC))
+        {
+            writePropertyData(iterator, MQTT_PROPERTY_RESPONSE_TOPIC, &properties->responseTopic);
+        }
+        if (MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_CORRELATION_DATA))
+        {
+            writePropertyData(iterator, MQTT_PROPERTY_CORRELATION_DATA, &properties->correlationData);
+        }
+    }
+}
+
 static CONTROL_PACKET_TYPE processControlPacketType(uint8_t pktByte, int* flags)
 {
     CONTROL_PACKET_TYPE result;
@@ -206,7 +470,11 @@ static int addListItemsToSubscribePacket(BUFFER_HANDLE ctrlPacket, SUBSCRIBE_PAY
 static int constructConnectVariableHeader(BUFFER_HANDLE ctrlPacket, const MQTT_CLIENT_OPTIONS* mqttOptions, STRING_HANDLE trace_log)
 {
     int result = 0;
-    if (BUFFER_enlarge(ctrlPacket, CONNECT_VARIABLE_HEADER_SIZE) != 0)
+    bool isV5 = (mqttOptions->protocolVersion == MQTT_PROTOCOL_VERSION_5);
+    uint8_t protocolNumber = isV5 ? PROTOCOL_NUMBER_V5 : PROTOCOL_NUMBER;
+    size_t propertiesLength = isV5 ? getConnectPropertiesLength(mqttOptions) : 0;
+    size_t propertiesSize = isV5 ? getVarIntSize(propertiesLength) + propertiesLength : 0;
+    if (BUFFER_enlarge(ctrlPacket, CONNECT_VARIABLE_HEADER_SIZE + propertiesSize) != 0)
     {
         result = __FAILURE__;
     }
@@ -221,12 +489,17 @@ static int constructConnectVariableHeader(BUFFER_HANDLE ctrlPacket, const MQTT_C
         {
             if (trace_log != NULL)
             {
-                STRING_sprintf(trace_log, " | VER: %d | KEEPALIVE: %d | FLAGS:", PROTOCOL_NUMBER, mqttOptions->keepAliveInterval);
+                STRING_sprintf(trace_log, " | VER: %d | KEEPALIVE: %d | FLAGS:", protocolNumber, mqttOptions->keepAliveInterval);
             }
             byteutil_writeUTF(&iterator, "MQTT", 4);
-            byteutil_writeByte(&iterator, PROTOCOL_NUMBER);
+            byteutil_writeByte(&iterator, protocolNumber);
             byteutil_writeByte(&iterator, 0); // Flags will be entered later
             byteutil_writeInt(&iterator, mqttOptions->keepAliveInterval);
+            if (isV5)
+            {
+                /* Codes_SRS_MQTT_CODEC_07_037: [When protocolVersion is MQTT_PROTOCOL_VERSION_5 mqtt_codec_connect shall use protocol level 5 and encode the non-zero sessionExpiryInterval, receiveMaximum, maximumPacketSize and topicAliasMaximum as CONNECT properties.] */
+                writeConnectProperties(&iterator, mqttOptions, propertiesLength);
+            }
             result = 0;
         }
     }
@@ -245,13 +518,27 @@ static int constructPublishVariableHeader(BUFFER_HANDLE ctrlPacket, const PUBLIS
     topicLen = strlen(publishHeader->topicName);
     spaceLen += 2;
 
+    size_t propertiesLength = 0;
+    bool isValidProperties = true;
+
     if (publishHeader->qualityOfServiceValue != DELIVER_AT_MOST_ONCE)
     {
         // Packet Id is only set if the QOS is not 0
         idLen = 2;
     }
+    if (publishHeader->includeProperties)
+    {
+        propertiesLength = getPublishPropertiesLength(publishHeader->properties, &isValidProperties);
+        spaceLen += getVarIntSize(propertiesLength) + propertiesLength;
+    }
 
-    if (topicLen > USHRT_MAX)
+    if (topicLen > USHRT_MAX || !isValidProperties)
+    {
+        result = __FAILURE__;
+    }
+    /* Codes_SRS_MQTT_CODEC_07_043: [mqtt_codec_publish_v5 shall return NULL if topicName is empty and properties does not hold a non-zero topic alias.] */
+    else if (topicLen == 0 && publishHeader->includeProperties &&
+        (publishHeader->properties == NULL || !MQTT_PROPERTY_IS_SET(publishHeader->properties, MQTT_PROPERTY_TOPIC_ALIAS)))
     {
         result = __FAILURE__;
     }
@@ -283,16 +570,20 @@ static int constructPublishVariableHeader(BUFFER_HANDLE ctrlPacket, const PUBLIS
                 }
                 byteutil_writeInt(&iterator, publishHeader->packetId);
             }
+            if (publishHeader->includeProperties)
+            {
+                writePublishProperties(&iterator, publishHeader->properties, propertiesLength);
+            }
             result = 0;
         }
     }
     return result;
 }
 
-static int constructSubscibeTypeVariableHeader(BUFFER_HANDLE ctrlPacket, uint16_t packetId)
+static int constructSubscibeTypeVariableHeader(BUFFER_HANDLE ctrlPacket, uint16_t packetId, bool includeProperties)
 {
     int result = 0;
-    if (BUFFER_enlarge(ctrlPacket, 2) != 0)
+    if (BUFFER_enlarge(ctrlPacket, includeProperties ? 3 : 2) != 0)
     {
         result = __FAILURE__;
     }
@@ -306,6 +597,11 @@ static int constructSubscibeTypeVariableHeader(BUFFER_HANDLE ctrlPacket, uint16_
         else
         {
             byteutil_writeInt(&iterator, packetId);
+            if (includeProperties)
+            {
+                // Empty property list
+                byteutil_writeByte(&iterator, 0);
+            }
             result = 0;
         }
     }
@@ -343,7 +639,7 @@ static BUFFER_HANDLE constructPublishReply(CONTROL_PACKET_TYPE type, uint8_t fla
     return result;
 }
 
-static int constructFixedHeader(BUFFER_HANDLE ctrlPacket, CONTROL_PACKET_TYPE packetType, uint8_t flags)
+static int constructFixedHeaderWithPayload(BUFFER_HANDLE ctrlPacket, CONTROL_PACKET_TYPE packetType, uint8_t flags, size_t payloadLength)
 {
     int result;
     if (ctrlPacket == NULL)
@@ -353,21 +649,15 @@ static int constructFixedHeader(BUFFER_HANDLE ctrlPacket, CONTROL_PACKET_TYPE pa
     else
     {
         size_t packetLen = BUFFER_length(ctrlPacket);
-        uint8_t remainSize[4] ={ 0 };
-        size_t index = 0;
+        size_t index;
 
-        // Calculate the length of packet
-        do
+        // The remaining length also counts the payload the caller sends after the packet
+        if (payloadLength > MAX_REMAINING_LENGTH || packetLen > MAX_REMAINING_LENGTH - payloadLength)
         {
-            uint8_t encode = packetLen % 128;
-            packetLen /= 128;
-            // if there are more data to encode, set the top bit of this byte
-            if (packetLen > 0)
-            {
-                encode |= NEXT_128_CHUNK;
-            }
-            remainSize[index++] = encode;
-        } while (packetLen > 0);
+            return __FAILURE__;
+        }
+        packetLen += payloadLength;
+        index = getVarIntSize(packetLen);
 
         BUFFER_HANDLE fixedHeader = BUFFER_new();
         if (fixedHeader == NULL)
@@ -384,7 +674,7 @@ static int constructFixedHeader(BUFFER_HANDLE ctrlPacket, CONTROL_PACKET_TYPE pa
             uint8_t* iterator = BUFFER_u_char(fixedHeader);
             *iterator = (uint8_t)packetType | flags;
             iterator++;
-            (void)memcpy(iterator, remainSize, index);
+            byteutil_writeVarInt(&iterator, (uint32_t)packetLen);
 
             result = BUFFER_prepend(ctrlPacket, fixedHeader);
             BUFFER_delete(fixedHeader);
@@ -393,6 +683,11 @@ static int constructFixedHeader(BUFFER_HANDLE ctrlPacket, CONTROL_PACKET_TYPE pa
     return result;
 }
 
+static int constructFixedHeader(BUFFER_HANDLE ctrlPacket, CONTROL_PACKET_TYPE packetType, uint8_t flags)
+{
+    return constructFixedHeaderWithPayload(ctrlPacket, packetType, flags, 0);
+}
+
 static int constructConnPayload(BUFFER_HANDLE ctrlPacket, const MQTT_CLIENT_OPTIONS* mqttOptions, STRING_HANDLE trace_log)
 {
     int result = 0;
@@ -435,6 +730,13 @@ static int constructConnPayload(BUFFER_HANDLE ctrlPacket, const MQTT_CLIENT_OPTI
             willTopicLen = strlen(mqttOptions->willTopic);
         }
 
+        bool isV5 = (mqttOptions->protocolVersion == MQTT_PROTOCOL_VERSION_5);
+        if (isV5 && willMessageLen > 0 && willTopicLen > 0)
+        {
+            // Empty will property list
+            spaceLen += 1;
+        }
+
         size_t currLen = BUFFER_length(ctrlPacket);
         size_t totalLen = clientLen + usernameLen + passwordLen + willMessageLen + willTopicLen + spaceLen;
 
@@ -482,6 +784,10 @@ static int constructConnPayload(BUFFER_HANDLE ctrlPacket, const MQTT_CLIENT_OPTI
                         (void)STRING_sprintf(connect_payload_trace, " | WILL_TOPIC: %s", mqttOptions->willTopic);
                     }
                     packet[CONN_FLAG_BYTE_OFFSET] |= WILL_FLAG_FLAG;
+                    if (isV5)
+                    {
+                        byteutil_writeByte(&iterator, 0);
+                    }
                     byteutil_writeUTF(&iterator, mqttOptions->willTopic, (uint16_t)willTopicLen);
                     packet[CONN_FLAG_BYTE_OFFSET] |= (mqttOptions->qualityOfServiceValue << 3);
                     if (mqttOptions->messageRetain)
@@ -530,6 +836,54 @@ static int constructConnPayload(BUFFER_HANDLE ctrlPacket, const MQTT_CLIENT_OPTI
     return result;
 }
 
+static int beginPacketData(MQTTCODEC_INSTANCE* codecData, uint32_t totalLen, size_t lengthSize)
+{
+    int result = 0;
+    codecData->codecState = CODEC_STATE_VAR_HEADER;
+
+    // The whole packet is the type byte, the remaining length bytes and the remaining length
+    size_t packetSize = 1 + lengthSize + (size_t)totalLen;
+
+    if (codecData->maxPacketSize != 0 && packetSize > codecData->maxPacketSize)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_045: [ When a maximum packet size is set mqtt_codec_bytesReceived shall return a non-zero value for a packet whose fixed header declares a larger packet, before allocating any memory for it. ] */
+        LogError("Incoming packet of %lu bytes exceeds the maximum packet size of %lu", (unsigned long)packetSize, (unsigned long)codecData->maxPacketSize);
+        result = __FAILURE__;
+    }
+    else if (totalLen > 0)
+    {
+        codecData->bufferOffset = 0;
+        codecData->headerData = BUFFER_new();
+        if (codecData->headerData == NULL)
+        {
+            /* Codes_SRS_MQTT_CODEC_07_035: [ If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value. ] */
+            LogError("Failed BUFFER_new");
+            result = __FAILURE__;
+        }
+        else
+        {
+            size_t bufferSize = (size_t)totalLen;
+            if (codecData->currPacket == PUBLISH_TYPE && codecData->publishStream != NULL &&
+                codecData->streamThreshold != 0 && bufferSize > codecData->streamThreshold)
+            {
+                /* Codes_SRS_MQTT_CODEC_07_048: [ A PUBLISH whose remaining length is larger than the stream threshold shall not be buffered, mqtt_codec_bytesReceived shall pass its variable header and then its payload chunks to the ON_PUBLISH_STREAM_CALLBACK. ] */
+                // Only the variable header is buffered, it grows as its length becomes known
+                codecData->codecState = CODEC_STATE_STREAM_HEADER;
+                codecData->streamRemaining = bufferSize;
+                bufferSize = PUBLISH_TOPIC_LENGTH_SIZE;
+            }
+            if (BUFFER_pre_build(codecData->headerData, bufferSize) != 0)
+            {
+                /* Codes_SRS_MQTT_CODEC_07_035: [ If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value. ] */
+                LogError("Failed BUFFER_pre_build");
+                result = __FAILURE__;
+            }
+
+        }
+    }
+    return result;
+}
+
 static int prepareheaderDataInfo(MQTTCODEC_INSTANCE* codecData, uint8_t remainLen)
 {
     int result;
@@ -537,61 +891,40 @@ static int prepareheaderDataInfo(MQTTCODEC_INSTANCE* codecData, uint8_t remainLe
     {
         result = __FAILURE__;
     }
+    else if (codecData->remainLenIndex >= sizeof(codecData->storeRemainLen))
+    {
+        /* Codes_SRS_MQTT_CODEC_07_046: [ mqtt_codec_bytesReceived shall return a non-zero value when the remaining length of a packet continues past four bytes. ] */
+        LogError("Remaining length exceeds %lu bytes", (unsigned long)sizeof(codecData->storeRemainLen));
+        result = __FAILURE__;
+    }
     else
     {
         result = 0;
         codecData->storeRemainLen[codecData->remainLenIndex++] = remainLen;
         if (remainLen <= 0x7f)
         {
-            int multiplier = 1;
-            int totalLen = 0;
-            size_t index = 0;
-            uint8_t encodeByte = 0;
-            do
-            {
-                encodeByte = codecData->storeRemainLen[index++];
-                totalLen += (encodeByte & 127) * multiplier;
-                multiplier *= NEXT_128_CHUNK;
-
-                if (multiplier > 128 * 128 * 128)
-                {
-                    result = __FAILURE__;
-                    break;
-                }
-            } while ((encodeByte & NEXT_128_CHUNK) != 0);
-
-            codecData->codecState = CODEC_STATE_VAR_HEADER;
+            uint32_t totalLen;
+            size_t lengthSize;
+            // The last byte ends the length, it cannot be malformed or incomplete here
+            (void)decodeVarInt(codecData->storeRemainLen, codecData->remainLenIndex, &totalLen, &lengthSize);
 
             // Reset remainLen Index
             codecData->remainLenIndex = 0;
             memset(codecData->storeRemainLen, 0, 4 * sizeof(uint8_t));
 
-            if (totalLen > 0)
-            {
-                codecData->bufferOffset = 0;
-                codecData->headerData = BUFFER_new();
-                if (codecData->headerData == NULL)
-                {
-                    /* Codes_SRS_MQTT_CODEC_07_035: [ If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value. ] */
-                    LogError("Failed BUFFER_new");
-                    result = __FAILURE__;
-                }
-                else
-                {
-                    if (BUFFER_pre_build(codecData->headerData, totalLen) != 0)
-                    {
-                        /* Codes_SRS_MQTT_CODEC_07_035: [ If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value. ] */
-                        LogError("Failed BUFFER_pre_build");
-                        result = __FAILURE__;
-                    }
-
-                }
-            }
+            result = beginPacketData(codecData, totalLen, lengthSize);
         }
     }
     return result;
 }
 
+static void resetPacketState(MQTTCODEC_INSTANCE* codecData)
+{
+    codecData->currPacket = UNKNOWN_TYPE;
+    codecData->codecState = CODEC_STATE_FIXED_HEADER;
+    codecData->headerFlags = 0;
+}
+
 static void completePacketData(MQTTCODEC_INSTANCE* codecData)
 {
     if (codecData)
@@ -602,74 +935,286 @@ static void completePacketData(MQTTCODEC_INSTANCE* codecData)
         }
 
         // Clean up data
-        codecData->currPacket = UNKNOWN_TYPE;
-        codecData->codecState = CODEC_STATE_FIXED_HEADER;
-        codecData->headerFlags = 0;
+        resetPacketState(codecData);
         BUFFER_delete(codecData->headerData);
         codecData->headerData = NULL;
     }
 }
 
-MQTTCODEC_HANDLE mqtt_codec_create(ON_PACKET_COMPLETE_CALLBACK packetComplete, void* callbackCtx)
+// Returns the length of the PUBLISH variable header as far as the bytes received so far tell,
+// the header is complete once it equals length. 0 means the property length is malformed.
+static size_t getStreamHeaderLength(const uint8_t* header, size_t length, int flags, bool includeProperties)
 {
-    MQTTCODEC_HANDLE result;
-    result = malloc(sizeof(MQTTCODEC_INSTANCE));
-    /* Codes_SRS_MQTT_CODEC_07_001: [If a failure is encountered then mqtt_codec_create shall return NULL.] */
-    if (result != NULL)
+    size_t result = PUBLISH_TOPIC_LENGTH_SIZE;
+    if (length >= PUBLISH_TOPIC_LENGTH_SIZE)
     {
-        /* Codes_SRS_MQTT_CODEC_07_002: [On success mqtt_codec_create shall return a MQTTCODEC_HANDLE value.] */
-        result->currPacket = UNKNOWN_TYPE;
-        result->codecState = CODEC_STATE_FIXED_HEADER;
-        result->headerFlags = 0;
-        result->bufferOffset = 0;
-        result->packetComplete = packetComplete;
-        result->callContext = callbackCtx;
-        result->headerData = NULL;
-        memset(result->storeRemainLen, 0, 4 * sizeof(uint8_t));
-        result->remainLenIndex = 0;
+        result += ((size_t)header[0] << 8) | header[1];
+        if ((flags & (PUBLISH_QOS_AT_LEAST_ONCE | PUBLISH_QOS_EXACTLY_ONCE)) != 0)
+        {
+            result += 2;
+        }
+        if (includeProperties && length >= result)
+        {
+            uint32_t propertiesLength;
+            size_t consumed;
+            if (byteutil_readVarInt(header + result, length - result, &propertiesLength, &consumed) == 0)
+            {
+                result += consumed + propertiesLength;
+            }
+            else if (length - result < MAX_VARIABLE_BYTE_INTEGER_SIZE)
+            {
+                // The property length continues in the next byte
+                result = length + 1;
+            }
+            else
+            {
+                result = 0;
+            }
+        }
     }
     return result;
 }
 
-void mqtt_codec_destroy(MQTTCODEC_HANDLE handle)
-{
-    /* Codes_SRS_MQTT_CODEC_07_003: [If the handle parameter is NULL then mqtt_codec_destroy shall do nothing.] */
-    if (handle != NULL)
-    {
-        MQTTCODEC_INSTANCE* codecData = (MQTTCODEC_INSTANCE*)handle;
-        /* Codes_SRS_MQTT_CODEC_07_004: [mqtt_codec_destroy shall deallocate all memory that has been allocated by this object.] */
-        BUFFER_delete(codecData->headerData);
-        free(codecData);
-    }
-}
-
-BUFFER_HANDLE mqtt_codec_connect(const MQTT_CLIENT_OPTIONS* mqttOptions, STRING_HANDLE trace_log)
+static int processStreamHeaderByte(MQTTCODEC_INSTANCE* codecData, uint8_t value)
 {
-    BUFFER_HANDLE result;
-    /* Codes_SRS_MQTT_CODEC_07_008: [If the parameters mqttOptions is NULL then mqtt_codec_connect shall return a null value.] */
-    if (mqttOptions == NULL)
+    int result;
+    uint8_t* dataBytes = BUFFER_u_char(codecData->headerData);
+    if (dataBytes == NULL)
     {
-        result = NULL;
+        result = __FAILURE__;
     }
     else
     {
-        /* Codes_SRS_MQTT_CODEC_07_009: [mqtt_codec_connect shall construct a BUFFER_HANDLE that represents a MQTT CONNECT packet.] */
-        result = BUFFER_new();
-        if (result != NULL)
+        dataBytes[codecData->bufferOffset++] = value;
+        codecData->streamRemaining--;
+        result = 0;
+        if (codecData->bufferOffset == BUFFER_length(codecData->headerData))
         {
-            STRING_HANDLE varible_header_log = NULL;
-            if (trace_log != NULL)
+            size_t headerLength = getStreamHeaderLength(dataBytes, codecData->bufferOffset, codecData->headerFlags, codecData->streamProperties);
+            if (headerLength == 0 || headerLength - codecData->bufferOffset > codecData->streamRemaining)
             {
-                varible_header_log = STRING_new();
+                /* Codes_SRS_MQTT_CODEC_07_050: [ mqtt_codec_bytesReceived shall return a non-zero value when the variable header of a streamed PUBLISH is malformed or longer than the packet. ] */
+                LogError("Malformed PUBLISH variable header");
+                result = __FAILURE__;
             }
-            // Add Variable Header Information
-            if (constructConnectVariableHeader(result, mqttOptions, varible_header_log) != 0)
+            else if (headerLength > codecData->bufferOffset)
             {
-                /* Codes_SRS_MQTT_CODEC_07_010: [If any error is encountered then mqtt_codec_connect shall return NULL.] */
-                BUFFER_delete(result);
-                result = NULL;
-            }
-            else
+                if (BUFFER_enlarge(codecData->headerData, headerLength - codecData->bufferOffset) != 0)
+                {
+                    LogError("Failed BUFFER_enlarge");
+                    result = __FAILURE__;
+                }
+            }
+            else
+            {
+                codecData->streamPayloadLength = codecData->streamRemaining;
+                codecData->publishStream(codecData->callContext, codecData->headerFlags, codecData->headerData, codecData->streamPayloadLength, NULL, 0);
+                BUFFER_delete(codecData->headerData);
+                codecData->headerData = NULL;
+                if (codecData->streamRemaining == 0)
+                {
+                    resetPacketState(codecData);
+                }
+                else
+                {
+                    codecData->codecState = CODEC_STATE_STREAM_PAYLOAD;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+/* Reads the fixed header of the packet at the start of data, packetSize is 0 while the fixed header is incomplete */
+static int scanBatchPacket(const MQTTCODEC_INSTANCE* codecData, const uint8_t* data, size_t length, MQTT_PACKET_DESC* packet, size_t* headerSize, size_t* packetSize)
+{
+    int result;
+    uint32_t remainLength;
+    size_t lengthSize = 0;
+
+    *packetSize = 0;
+    if (length < 2)
+    {
+        result = 0;
+    }
+    else if (decodeVarInt(data + 1, length - 1, &remainLength, &lengthSize) != 0)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_058: [ mqtt_codec_decode_batch shall return a non-zero value and drop the carried bytes when a packet has a malformed remaining length or is larger than the maximum packet size. ] */
+        LogError("Invalid remaining length in batch");
+        result = __FAILURE__;
+    }
+    else if (lengthSize == 0)
+    {
+        result = 0;
+    }
+    else if (codecData->maxPacketSize != 0 && 1 + lengthSize + (size_t)remainLength > codecData->maxPacketSize)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_058: [ mqtt_codec_decode_batch shall return a non-zero value and drop the carried bytes when a packet has a malformed remaining length or is larger than the maximum packet size. ] */
+        LogError("Incoming packet exceeds the maximum packet size of %lu", (unsigned long)codecData->maxPacketSize);
+        result = __FAILURE__;
+    }
+    else
+    {
+        packet->packetType = processControlPacketType(data[0], &packet->flags);
+        packet->length = remainLength;
+        *headerSize = 1 + lengthSize;
+        *packetSize = *headerSize + remainLength;
+        result = 0;
+    }
+    return result;
+}
+
+static int appendBatchCarry(MQTTCODEC_INSTANCE* codecData, const uint8_t* data, size_t length)
+{
+    int result;
+    if (codecData->batchCarry == NULL && (codecData->batchCarry = BUFFER_new()) == NULL)
+    {
+        LogError("Failed BUFFER_new");
+        result = __FAILURE__;
+    }
+    else
+    {
+        size_t available = BUFFER_length(codecData->batchCarry) - codecData->batchLength;
+        if (available < length && BUFFER_enlarge(codecData->batchCarry, length - available) != 0)
+        {
+            LogError("Failed BUFFER_enlarge");
+            result = __FAILURE__;
+        }
+        else
+        {
+            (void)memcpy(BUFFER_u_char(codecData->batchCarry) + codecData->batchLength, data, length);
+            codecData->batchLength += length;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+// Drops the carried bytes whose packets were reported by the previous call
+static void releaseBatchCarry(MQTTCODEC_INSTANCE* codecData)
+{
+    if (codecData->batchConsumed > 0)
+    {
+        size_t remaining = codecData->batchLength - codecData->batchConsumed;
+        if (remaining > 0)
+        {
+            uint8_t* carry = BUFFER_u_char(codecData->batchCarry);
+            (void)memmove(carry, carry + codecData->batchConsumed, remaining);
+        }
+        codecData->batchLength = remaining;
+        codecData->batchConsumed = 0;
+    }
+}
+
+MQTTCODEC_HANDLE mqtt_codec_create(ON_PACKET_COMPLETE_CALLBACK packetComplete, void* callbackCtx)
+{
+    MQTTCODEC_HANDLE result;
+    result = malloc(sizeof(MQTTCODEC_INSTANCE));
+    /* Codes_SRS_MQTT_CODEC_07_001: [If a failure is encountered then mqtt_codec_create shall return NULL.] */
+    if (result != NULL)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_002: [On success mqtt_codec_create shall return a MQTTCODEC_HANDLE value.] */
+        result->currPacket = UNKNOWN_TYPE;
+        result->codecState = CODEC_STATE_FIXED_HEADER;
+        result->headerFlags = 0;
+        result->bufferOffset = 0;
+        result->packetComplete = packetComplete;
+        result->callContext = callbackCtx;
+        result->headerData = NULL;
+        memset(result->storeRemainLen, 0, 4 * sizeof(uint8_t));
+        result->remainLenIndex = 0;
+        result->maxPacketSize = 0;
+        result->streamThreshold = 0;
+        result->streamProperties = false;
+        result->publishStream = NULL;
+        result->streamRemaining = 0;
+        result->streamPayloadLength = 0;
+        result->batchCarry = NULL;
+        result->batchLength = 0;
+        result->batchConsumed = 0;
+    }
+    return result;
+}
+
+int mqtt_codec_set_max_packet_size(MQTTCODEC_HANDLE handle, size_t maxPacketSize)
+{
+    int result;
+    if (handle == NULL)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_044: [ If the handle parameter is NULL then mqtt_codec_set_max_packet_size shall return a non-zero value. ] */
+        LogError("Invalid parameter specified handle: %p", handle);
+        result = __FAILURE__;
+    }
+    else
+    {
+        handle->maxPacketSize = maxPacketSize;
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_codec_set_publish_stream(MQTTCODEC_HANDLE handle, size_t threshold, bool includeProperties, ON_PUBLISH_STREAM_CALLBACK publishStream)
+{
+    int result;
+    if (handle == NULL)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_047: [ If the handle parameter is NULL then mqtt_codec_set_publish_stream shall return a non-zero value. ] */
+        LogError("Invalid parameter specified handle: %p", handle);
+        result = __FAILURE__;
+    }
+    else
+    {
+        handle->streamThreshold = threshold;
+        handle->streamProperties = includeProperties;
+        handle->publishStream = publishStream;
+        result = 0;
+    }
+    return result;
+}
+
+void mqtt_codec_destroy(MQTTCODEC_HANDLE handle)
+{
+    /* Codes_SRS_MQTT_CODEC_07_003: [If the handle parameter is NULL then mqtt_codec_destroy shall do nothing.] */
+    if (handle != NULL)
+    {
+        MQTTCODEC_INSTANCE* codecData = (MQTTCODEC_INSTANCE*)handle;
+        /* Codes_SRS_MQTT_CODEC_07_004: [mqtt_codec_destroy shall deallocate all memory that has been allocated by this object.] */
+        BUFFER_delete(codecData->headerData);
+        if (codecData->batchCarry != NULL)
+        {
+            BUFFER_delete(codecData->batchCarry);
+        }
+        free(codecData);
+    }
+}
+
+BUFFER_HANDLE mqtt_codec_connect(const MQTT_CLIENT_OPTIONS* mqttOptions, STRING_HANDLE trace_log)
+{
+    BUFFER_HANDLE result;
+    /* Codes_SRS_MQTT_CODEC_07_008: [If the parameters mqttOptions is NULL then mqtt_codec_connect shall return a null value.] */
+    if (mqttOptions == NULL)
+    {
+        result = NULL;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CODEC_07_009: [mqtt_codec_connect shall construct a BUFFER_HANDLE that represents a MQTT CONNECT packet.] */
+        result = BUFFER_new();
+        if (result != NULL)
+        {
+            STRING_HANDLE varible_header_log = NULL;
+            if (trace_log != NULL)
+            {
+                varible_header_log = STRING_new();
+            }
+            // Add Variable Header Information
+            if (constructConnectVariableHeader(result, mqttOptions, varible_header_log) != 0)
+            {
+                /* Codes_SRS_MQTT_CODEC_07_010: [If any error is encountered then mqtt_codec_connect shall return NULL.] */
+                BUFFER_delete(result);
+                result = NULL;
+            }
+            else
             {
                 if (constructConnPayload(result, mqttOptions, varible_header_log) != 0)
                 {
@@ -738,7 +1283,7 @@ BUFFER_HANDLE mqtt_codec_disconnect()
     return result;
 }
 
-BUFFER_HANDLE mqtt_codec_publish(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, const uint8_t* msgBuffer, size_t buffLen, STRING_HANDLE trace_log)
+static BUFFER_HANDLE encodePublish(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, const uint8_t* msgBuffer, size_t buffLen, bool headerOnly, bool includeProperties, const MQTT_PROPERTIES* properties, STRING_HANDLE trace_log)
 {
     BUFFER_HANDLE result;
     /* Codes_SRS_MQTT_CODEC_07_005: [If the parameters topicName is NULL then mqtt_codec_publish shall return NULL.] */
@@ -758,6 +1303,8 @@ BUFFER_HANDLE mqtt_codec_publish(QOS_VALUE qosValue, bool duplicateMsg, bool ser
         publishInfo.topicName = topicName;
         publishInfo.packetId = packetId;
         publishInfo.qualityOfServiceValue = qosValue;
+        publishInfo.includeProperties = includeProperties;
+        publishInfo.properties = properties;
 
         uint8_t headerFlags = 0;
         if (duplicateMsg) headerFlags |= PUBLISH_DUP_FLAG;
@@ -795,7 +1342,14 @@ BUFFER_HANDLE mqtt_codec_publish(QOS_VALUE qosValue, bool duplicateMsg, bool ser
             else
             {
                 size_t payloadOffset = BUFFER_length(result);
-                if (buffLen > 0)
+                if (headerOnly)
+                {
+                    if (trace_log)
+                    {
+                        STRING_sprintf(varible_header_log, " | PAYLOAD_LEN: %lu", (unsigned long)buffLen);
+                    }
+                }
+                else if (buffLen > 0)
                 {
                     if (BUFFER_enlarge(result, buffLen) != 0)
                     {
@@ -831,7 +1385,7 @@ BUFFER_HANDLE mqtt_codec_publish(QOS_VALUE qosValue, bool duplicateMsg, bool ser
                     {
                         (void)STRING_copy(trace_log, "PUBLISH");
                     }
-                    if (constructFixedHeader(result, PUBLISH_TYPE, headerFlags) != 0)
+                    if (constructFixedHeaderWithPayload(result, PUBLISH_TYPE, headerFlags, headerOnly ? buffLen : 0) != 0)
                     {
                         /* Codes_SRS_MQTT_CODEC_07_006: [If any error is encountered then mqtt_codec_publish shall return NULL.] */
                         BUFFER_delete(result);
@@ -855,6 +1409,158 @@ BUFFER_HANDLE mqtt_codec_publish(QOS_VALUE qosValue, bool duplicateMsg, bool ser
     return result;
 }
 
+BUFFER_HANDLE mqtt_codec_publish(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, const uint8_t* msgBuffer, size_t buffLen, STRING_HANDLE trace_log)
+{
+    return encodePublish(qosValue, duplicateMsg, serverRetain, packetId, topicName, msgBuffer, buffLen, false, false, NULL, trace_log);
+}
+
+BUFFER_HANDLE mqtt_codec_publish_v5(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, const uint8_t* msgBuffer, size_t buffLen, const MQTT_PROPERTIES* properties, STRING_HANDLE trace_log)
+{
+    /* Codes_SRS_MQTT_CODEC_07_038: [mqtt_codec_publish_v5 shall encode a PUBLISH like mqtt_codec_publish followed by a property list holding the payload format indicator, message expiry interval, topic alias, content type, response topic and correlation data set in properties, an empty list if properties is NULL.] */
+    return encodePublish(qosValue, duplicateMsg, serverRetain, packetId, topicName, msgBuffer, buffLen, false, true, properties, trace_log);
+}
+
+BUFFER_HANDLE mqtt_codec_publish_header(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, size_t payloadLength, STRING_HANDLE trace_log)
+{
+    /* Codes_SRS_MQTT_CODEC_07_051: [mqtt_codec_publish_header shall encode the fixed and variable header of a PUBLISH like mqtt_codec_publish, with a remaining length that counts payloadLength bytes of payload that are not part of the returned buffer.] */
+    /* Codes_SRS_MQTT_CODEC_07_052: [mqtt_codec_publish_header shall return NULL if topicName is NULL or the remaining length would be greater than 268435455.] */
+    return encodePublish(qosValue, duplicateMsg, serverRetain, packetId, topicName, NULL, payloadLength, true, false, NULL, trace_log);
+}
+
+BUFFER_HANDLE mqtt_codec_publish_header_v5(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, size_t payloadLength, const MQTT_PROPERTIES* properties, STRING_HANDLE trace_log)
+{
+    /* Codes_SRS_MQTT_CODEC_07_053: [mqtt_codec_publish_header_v5 shall encode the PUBLISH header like mqtt_codec_publish_header followed by the property list of mqtt_codec_publish_v5.] */
+    return encodePublish(qosValue, duplicateMsg, serverRetain, packetId, topicName, NULL, payloadLength, true, true, properties, trace_log);
+}
+
+MQTT_PUBLISH_TEMPLATE_HANDLE mqtt_codec_publish_template_create(QOS_VALUE qosValue, bool serverRetain, const char* topicName)
+{
+    MQTT_PUBLISH_TEMPLATE* result;
+    size_t topicLen;
+    /* Codes_SRS_MQTT_CODEC_07_060: [mqtt_codec_publish_template_create shall return NULL if topicName is NULL, empty or longer than 65535 bytes.] */
+    if (topicName == NULL || (topicLen = strlen(topicName)) == 0 || topicLen > USHRT_MAX)
+    {
+        LogError("Invalid parameter specified topicName: %p", topicName);
+        result = NULL;
+    }
+    else if ((result = (MQTT_PUBLISH_TEMPLATE*)malloc(sizeof(MQTT_PUBLISH_TEMPLATE) + PUBLISH_TOPIC_LENGTH_SIZE + topicLen + 1)) == NULL)
+    {
+        LogError("Failure allocating publish template");
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CODEC_07_061: [mqtt_codec_publish_template_create shall encode the topic and the QoS and retain flags once, in a single allocation.] */
+        uint8_t* iterator;
+        result->qosValue = qosValue;
+        result->serverRetain = serverRetain;
+        result->headerFlags = (uint8_t)PUBLISH_TYPE;
+        if (serverRetain)
+        {
+            result->headerFlags |= PUBLISH_QOS_RETAIN;
+        }
+        if (qosValue == DELIVER_AT_LEAST_ONCE)
+        {
+            result->headerFlags |= PUBLISH_QOS_AT_LEAST_ONCE;
+        }
+        else if (qosValue == DELIVER_EXACTLY_ONCE)
+        {
+            result->headerFlags |= PUBLISH_QOS_EXACTLY_ONCE;
+        }
+        result->encodedTopicLength = PUBLISH_TOPIC_LENGTH_SIZE + topicLen;
+        result->encodedTopic = (uint8_t*)(result + 1);
+        iterator = result->encodedTopic;
+        byteutil_writeUTF(&iterator, topicName, (uint16_t)topicLen);
+        *iterator = '\0';
+    }
+    return result;
+}
+
+void mqtt_codec_publish_template_destroy(MQTT_PUBLISH_TEMPLATE_HANDLE handle)
+{
+    free(handle);
+}
+
+QOS_VALUE mqtt_codec_publish_template_get_qos(MQTT_PUBLISH_TEMPLATE_HANDLE handle)
+{
+    QOS_VALUE result;
+    if (handle == NULL)
+    {
+        LogError("Invalid parameter specified handle: %p", handle);
+        result = DELIVER_FAILURE;
+    }
+    else
+    {
+        result = handle->qosValue;
+    }
+    return result;
+}
+
+BUFFER_HANDLE mqtt_codec_publish_template_encode(MQTT_PUBLISH_TEMPLATE_HANDLE handle, bool duplicateMsg, uint16_t packetId, bool includeProperties, const uint8_t* msgBuffer, size_t buffLen, STRING_HANDLE trace_log)
+{
+    BUFFER_HANDLE result;
+    size_t idLen = (handle != NULL && handle->qosValue != DELIVER_AT_MOST_ONCE) ? 2 : 0;
+    size_t propertiesLen = includeProperties ? 1 : 0;
+    /* Codes_SRS_MQTT_CODEC_07_062: [mqtt_codec_publish_template_encode shall return NULL if handle is NULL, msgBuffer is NULL with a non-zero buffLen or the remaining length would be greater than 268435455.] */
+    if (handle == NULL || (msgBuffer == NULL && buffLen > 0))
+    {
+        LogError("Invalid parameter specified handle: %p, msgBuffer: %p", handle, msgBuffer);
+        result = NULL;
+    }
+    else if (buffLen > MAX_REMAINING_LENGTH - (handle->encodedTopicLength + idLen + propertiesLen))
+    {
+        LogError("Publish payload of %lu bytes is too large", (unsigned long)buffLen);
+        result = NULL;
+    }
+    else if ((result = BUFFER_new()) == NULL)
+    {
+        LogError("Failure allocating publish packet");
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CODEC_07_063: [mqtt_codec_publish_template_encode shall compute the remaining length once and write the fixed header, the cached topic, the packet id when the QoS is not 0, an empty property list when includeProperties is true and the payload into a single buffer.] */
+        size_t remainingLength = handle->encodedTopicLength + idLen + propertiesLen + buffLen;
+        if (BUFFER_pre_build(result, 1 + getVarIntSize(remainingLength) + remainingLength) != 0)
+        {
+            LogError("Failure allocating publish packet");
+            BUFFER_delete(result);
+            result = NULL;
+        }
+        else
+        {
+            uint8_t* iterator = BUFFER_u_char(result);
+            byteutil_writeByte(&iterator, duplicateMsg ? (uint8_t)(handle->headerFlags | PUBLISH_DUP_FLAG) : handle->headerFlags);
+            byteutil_writeVarInt(&iterator, (uint32_t)remainingLength);
+            (void)memcpy(iterator, handle->encodedTopic, handle->encodedTopicLength);
+            iterator += handle->encodedTopicLength;
+            if (idLen > 0)
+            {
+                byteutil_writeInt(&iterator, packetId);
+            }
+            if (includeProperties)
+            {
+                byteutil_writeByte(&iterator, 0);
+            }
+            if (buffLen > 0)
+            {
+                (void)memcpy(iterator, msgBuffer, buffLen);
+            }
+
+            if (trace_log != NULL)
+            {
+                (void)STRING_copy(trace_log, "PUBLISH");
+                STRING_sprintf(trace_log, " | IS_DUP: %s | RETAIN: %d | QOS: %s | TOPIC_NAME: %s", duplicateMsg ? TRUE_CONST : FALSE_CONST,
+                    handle->serverRetain ? 1 : 0, retrieve_qos_value(handle->qosValue), (const char*)handle->encodedTopic + PUBLISH_TOPIC_LENGTH_SIZE);
+                if (idLen > 0)
+                {
+                    STRING_sprintf(trace_log, " | PACKET_ID: %"PRIu16, packetId);
+                }
+                STRING_sprintf(trace_log, " | PAYLOAD_LEN: %lu", (unsigned long)buffLen);
+            }
+        }
+    }
+    return result;
+}
+
 BUFFER_HANDLE mqtt_codec_publishAck(uint16_t packetId)
 {
     /* Codes_SRS_MQTT_CODEC_07_013: [On success mqtt_codec_publishAck shall return a BUFFER_HANDLE representation of a MQTT PUBACK packet.] */
@@ -918,7 +1624,7 @@ BUFFER_HANDLE mqtt_codec_ping()
     return result;
 }
 
-BUFFER_HANDLE mqtt_codec_subscribe(uint16_t packetId, SUBSCRIBE_PAYLOAD* subscribeList, size_t count, STRING_HANDLE trace_log)
+static BUFFER_HANDLE encodeSubscribe(uint16_t packetId, SUBSCRIBE_PAYLOAD* subscribeList, size_t count, bool includeProperties, STRING_HANDLE trace_log)
 {
     BUFFER_HANDLE result;
     /* Codes_SRS_MQTT_CODEC_07_023: [If the parameters subscribeList is NULL or if count is 0 then mqtt_codec_subscribe shall return NULL.] */
@@ -932,7 +1638,7 @@ BUFFER_HANDLE mqtt_codec_subscribe(uint16_t packetId, SUBSCRIBE_PAYLOAD* subscri
         result = BUFFER_new();
         if (result != NULL)
         {
-            if (constructSubscibeTypeVariableHeader(result, packetId) != 0)
+            if (constructSubscibeTypeVariableHeader(result, packetId, includeProperties) != 0)
             {
                 /* Codes_SRS_MQTT_CODEC_07_025: [If any error is encountered then mqtt_codec_subscribe shall return NULL.] */
                 BUFFER_delete(result);
@@ -983,7 +1689,18 @@ BUFFER_HANDLE mqtt_codec_subscribe(uint16_t packetId, SUBSCRIBE_PAYLOAD* subscri
     return result;
 }
 
-BUFFER_HANDLE mqtt_codec_unsubscribe(uint16_t packetId, const char** unsubscribeList, size_t count, STRING_HANDLE trace_log)
+BUFFER_HANDLE mqtt_codec_subscribe(uint16_t packetId, SUBSCRIBE_PAYLOAD* subscribeList, size_t count, STRING_HANDLE trace_log)
+{
+    return encodeSubscribe(packetId, subscribeList, count, false, trace_log);
+}
+
+BUFFER_HANDLE mqtt_codec_subscribe_v5(uint16_t packetId, SUBSCRIBE_PAYLOAD* subscribeList, size_t count, STRING_HANDLE trace_log)
+{
+    /* Codes_SRS_MQTT_CODEC_07_039: [mqtt_codec_subscribe_v5 and mqtt_codec_unsubscribe_v5 shall encode the packet like their 3.1.1 counterparts with an empty property list after the packet id.] */
+    return encodeSubscribe(packetId, subscribeList, count, true, trace_log);
+}
+
+static BUFFER_HANDLE encodeUnsubscribe(uint16_t packetId, const char** unsubscribeList, size_t count, bool includeProperties, STRING_HANDLE trace_log)
 {
     BUFFER_HANDLE result;
     /* Codes_SRS_MQTT_CODEC_07_027: [If the parameters unsubscribeList is NULL or if count is 0 then mqtt_codec_unsubscribe shall return NULL.] */
@@ -997,7 +1714,7 @@ BUFFER_HANDLE mqtt_codec_unsubscribe(uint16_t packetId, const char** unsubscribe
         result = BUFFER_new();
         if (result != NULL)
         {
-            if (constructSubscibeTypeVariableHeader(result, packetId) != 0)
+            if (constructSubscibeTypeVariableHeader(result, packetId, includeProperties) != 0)
             {
                 /* Codes_SRS_MQTT_CODEC_07_029: [If any error is encountered then mqtt_codec_unsubscribe shall return NULL.] */
                 BUFFER_delete(result);
@@ -1047,6 +1764,205 @@ BUFFER_HANDLE mqtt_codec_unsubscribe(uint16_t packetId, const char** unsubscribe
     return result;
 }
 
+BUFFER_HANDLE mqtt_codec_unsubscribe(uint16_t packetId, const char** unsubscribeList, size_t count, STRING_HANDLE trace_log)
+{
+    return encodeUnsubscribe(packetId, unsubscribeList, count, false, trace_log);
+}
+
+BUFFER_HANDLE mqtt_codec_unsubscribe_v5(uint16_t packetId, const char** unsubscribeList, size_t count, STRING_HANDLE trace_log)
+{
+    /* Codes_SRS_MQTT_CODEC_07_039: [mqtt_codec_subscribe_v5 and mqtt_codec_unsubscribe_v5 shall encode the packet like their 3.1.1 counterparts with an empty property list after the packet id.] */
+    return encodeUnsubscribe(packetId, unsubscribeList, count, true, trace_log);
+}
+
+static int readPropertyData(const uint8_t* buffer, size_t length, size_t* index, MQTT_PROPERTY_DATA* value)
+{
+    int result;
+    if (*index + 2 > length)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        value->length = ((size_t)buffer[*index] << 8) | buffer[*index + 1];
+        *index += 2;
+        if (*index + value->length > length)
+        {
+            result = __FAILURE__;
+        }
+        else
+        {
+            value->data = buffer + *index;
+            *index += value->length;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+static int readPropertyInteger(const uint8_t* buffer, size_t length, size_t* index, size_t size, uint32_t* value)
+{
+    int result;
+    if (*index + size > length)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        size_t pos;
+        *value = 0;
+        for (pos = 0; pos < size; pos++)
+        {
+            *value = (*value << 8) | buffer[*index + pos];
+        }
+        *index += size;
+        result = 0;
+    }
+    return result;
+}
+
+static int readProperty(const uint8_t* buffer, size_t length, size_t* index, MQTT_PROPERTIES* properties)
+{
+    int result;
+    uint8_t id = buffer[(*index)++];
+    uint32_t value = 0;
+    size_t consumed;
+
+    switch (id)
+    {
+        case MQTT_PROPERTY_PAYLOAD_FORMAT_INDICATOR:
+        case MQTT_PROPERTY_REQUEST_PROBLEM_INFORMATION:
+        case MQTT_PROPERTY_REQUEST_RESPONSE_INFORMATION:
+        case MQTT_PROPERTY_MAXIMUM_QOS:
+        case MQTT_PROPERTY_RETAIN_AVAILABLE:
+        case MQTT_PROPERTY_WILDCARD_SUBSCRIPTION_AVAILABLE:
+        case MQTT_PROPERTY_SUBSCRIPTION_IDENTIFIER_AVAILABLE:
+        case MQTT_PROPERTY_SHARED_SUBSCRIPTION_AVAILABLE:
+            result = readPropertyInteger(buffer, length, index, 1, &value);
+            break;
+        case MQTT_PROPERTY_SERVER_KEEP_ALIVE:
+        case MQTT_PROPERTY_RECEIVE_MAXIMUM:
+        case MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM:
+        case MQTT_PROPERTY_TOPIC_ALIAS:
+            result = readPropertyInteger(buffer, length, index, 2, &value);
+            break;
+        case MQTT_PROPERTY_MESSAGE_EXPIRY_INTERVAL:
+        case MQTT_PROPERTY_SESSION_EXPIRY_INTERVAL:
+        case MQTT_PROPERTY_WILL_DELAY_INTERVAL:
+        case MQTT_PROPERTY_MAXIMUM_PACKET_SIZE:
+            result = readPropertyInteger(buffer, length, index, 4, &value);
+            break;
+        case MQTT_PROPERTY_SUBSCRIPTION_IDENTIFIER:
+            result = byteutil_readVarInt(buffer + *index, length - *index, &value, &consumed);
+            if (result == 0)
+            {
+                *index += consumed;
+            }
+            break;
+        case MQTT_PROPERTY_CONTENT_TYPE:
+            result = readPropertyData(buffer, length, index, &properties->contentType);
+            break;
+        case MQTT_PROPERTY_RESPONSE_TOPIC:
+            result = readPropertyData(buffer, length, index, &properties->responseTopic);
+            break;
+        case MQTT_PROPERTY_CORRELATION_DATA:
+            result = readPropertyData(buffer, length, index, &properties->correlationData);
+            break;
+        case MQTT_PROPERTY_ASSIGNED_CLIENT_IDENTIFIER:
+            result = readPropertyData(buffer, length, index, &properties->assignedClientIdentifier);
+            break;
+        case MQTT_PROPERTY_AUTHENTICATION_METHOD:
+            result = readPropertyData(buffer, length, index, &properties->authenticationMethod);
+            break;
+        case MQTT_PROPERTY_AUTHENTICATION_DATA:
+            result = readPropertyData(buffer, length, index, &properties->authenticationData);
+            break;
+        case MQTT_PROPERTY_RESPONSE_INFORMATION:
+            result = readPropertyData(buffer, length, index, &properties->responseInformation);
+            break;
+        case MQTT_PROPERTY_SERVER_REFERENCE:
+            result = readPropertyData(buffer, length, index, &properties->serverReference);
+            break;
+        case MQTT_PROPERTY_REASON_STRING:
+            result = readPropertyData(buffer, length, index, &properties->reasonString);
+            break;
+        case MQTT_PROPERTY_USER_PROPERTY:
+        {
+            // User properties are counted but not kept, they are a name and a value string
+            MQTT_PROPERTY_DATA name;
+            MQTT_PROPERTY_DATA userValue;
+            result = (readPropertyData(buffer, length, index, &name) == 0 && readPropertyData(buffer, length, index, &userValue) == 0) ? 0 : __FAILURE__;
+            properties->userPropertyCount++;
+            break;
+        }
+        default:
+            LogError("Unknown MQTT property 0x%x", id);
+            result = __FAILURE__;
+            break;
+    }
+
+    if (result == 0)
+    {
+        properties->present |= MQTT_PROPERTY_MASK(id);
+        switch (id)
+        {
+            case MQTT_PROPERTY_PAYLOAD_FORMAT_INDICATOR: properties->payloadFormatIndicator = (uint8_t)value; break;
+            case MQTT_PROPERTY_MESSAGE_EXPIRY_INTERVAL: properties->messageExpiryInterval = value; break;
+            case MQTT_PROPERTY_SUBSCRIPTION_IDENTIFIER: properties->subscriptionIdentifier = value; break;
+            case MQTT_PROPERTY_SESSION_EXPIRY_INTERVAL: properties->sessionExpiryInterval = value; break;
+            case MQTT_PROPERTY_SERVER_KEEP_ALIVE: properties->serverKeepAlive = (uint16_t)value; break;
+            case MQTT_PROPERTY_RECEIVE_MAXIMUM: properties->receiveMaximum = (uint16_t)value; break;
+            case MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM: properties->topicAliasMaximum = (uint16_t)value; break;
+            case MQTT_PROPERTY_TOPIC_ALIAS: properties->topicAlias = (uint16_t)value; break;
+            case MQTT_PROPERTY_MAXIMUM_QOS: properties->maximumQos = (uint8_t)value; break;
+            case MQTT_PROPERTY_RETAIN_AVAILABLE: properties->retainAvailable = (uint8_t)value; break;
+            case MQTT_PROPERTY_MAXIMUM_PACKET_SIZE: properties->maximumPacketSize = value; break;
+            case MQTT_PROPERTY_WILDCARD_SUBSCRIPTION_AVAILABLE: properties->wildcardSubscriptionAvailable = (uint8_t)value; break;
+            case MQTT_PROPERTY_SUBSCRIPTION_IDENTIFIER_AVAILABLE: properties->subscriptionIdentifierAvailable = (uint8_t)value; break;
+            case MQTT_PROPERTY_SHARED_SUBSCRIPTION_AVAILABLE: properties->sharedSubscriptionAvailable = (uint8_t)value; break;
+            default: break;
+        }
+    }
+    return result;
+}
+
+int mqtt_codec_decode_properties(const uint8_t* buffer, size_t length, MQTT_PROPERTIES* properties, size_t* consumed)
+{
+    int result;
+    uint32_t propertiesLength;
+    size_t lengthSize;
+    /* Codes_SRS_MQTT_CODEC_07_040: [If the parameters buffer, properties or consumed are NULL then mqtt_codec_decode_properties shall return a non-zero value.] */
+    if (buffer == NULL || properties == NULL || consumed == NULL)
+    {
+        LogError("Invalid parameter specified buffer: %p, properties: %p, consumed: %p", buffer, properties, consumed);
+        result = __FAILURE__;
+    }
+    /* Codes_SRS_MQTT_CODEC_07_042: [If the property list is truncated, malformed or holds an unknown property mqtt_codec_decode_properties shall return a non-zero value.] */
+    else if (byteutil_readVarInt(buffer, length, &propertiesLength, &lengthSize) != 0 || propertiesLength > length - lengthSize)
+    {
+        LogError("Malformed property length");
+        result = __FAILURE__;
+    }
+    else
+    {
+        /* Codes_SRS_MQTT_CODEC_07_041: [mqtt_codec_decode_properties shall decode the variable byte integer length and every property that follows into properties, and store the number of bytes read in consumed.] */
+        size_t index = lengthSize;
+        size_t end = lengthSize + propertiesLength;
+
+        memset(properties, 0, sizeof(MQTT_PROPERTIES));
+        result = 0;
+        while (index < end && result == 0)
+        {
+            result = readProperty(buffer, end, &index, properties);
+        }
+        if (result == 0)
+        {
+            *consumed = end;
+        }
+    }
+    return result;
+}
+
 int mqtt_codec_bytesReceived(MQTTCODEC_HANDLE handle, const unsigned char* buffer, size_t size)
 {
     int result;
@@ -1079,13 +1995,30 @@ int mqtt_codec_bytesReceived(MQTTCODEC_HANDLE handle, const unsigned char* buffe
                 }
                 else
                 {
-                    if (prepareheaderDataInfo(codec_Data, iterator) != 0)
+                    uint32_t totalLen;
+                    size_t lengthSize = 0;
+                    int prepareResult;
+                    // The remaining length is decoded at once when the buffer holds all of it
+                    if (codec_Data->remainLenIndex == 0 &&
+                        decodeVarInt(buffer + index, size - index, &totalLen, &lengthSize) == 0 && lengthSize > 0)
+                    {
+                        index += lengthSize - 1;
+                        prepareResult = beginPacketData(codec_Data, totalLen, lengthSize);
+                    }
+                    else
+                    {
+                        prepareResult = prepareheaderDataInfo(codec_Data, iterator);
+                    }
+
+                    if (prepareResult != 0)
                     {
                         /* Codes_SRS_MQTT_CODEC_07_035: [If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value.] */
                         codec_Data->currPacket = PACKET_TYPE_ERROR;
                         result = __FAILURE__;
                     }
-                    if (codec_Data->currPacket == PINGRESP_TYPE)
+                    // A packet with a remaining length of 0, such as a PINGRESP or a DISCONNECT without reason code, ends here
+                    if (codec_Data->currPacket == PINGRESP_TYPE ||
+                        (codec_Data->codecState == CODEC_STATE_VAR_HEADER && codec_Data->headerData == NULL && codec_Data->currPacket != PACKET_TYPE_ERROR))
                     {
                         /* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
                         completePacketData(codec_Data);
@@ -1122,6 +2055,32 @@ int mqtt_codec_bytesReceived(MQTTCODEC_HANDLE handle, const unsigned char* buffe
                     }
                 }
             }
+            else if (codec_Data->codecState == CODEC_STATE_STREAM_HEADER)
+            {
+                if (processStreamHeaderByte(codec_Data, iterator) != 0)
+                {
+                    /* Codes_SRS_MQTT_CODEC_07_035: [If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value.] */
+                    codec_Data->currPacket = PACKET_TYPE_ERROR;
+                    result = __FAILURE__;
+                }
+            }
+            else if (codec_Data->codecState == CODEC_STATE_STREAM_PAYLOAD)
+            {
+                /* Codes_SRS_MQTT_CODEC_07_049: [ Payload chunks of a streamed PUBLISH shall point into the buffer passed to mqtt_codec_bytesReceived, one chunk per call for the bytes of the packet it holds. ] */
+                size_t chunkLength = size - index;
+                if (chunkLength > codec_Data->streamRemaining)
+                {
+                    chunkLength = codec_Data->streamRemaining;
+                }
+                codec_Data->streamRemaining -= chunkLength;
+                codec_Data->publishStream(codec_Data->callContext, codec_Data->headerFlags, NULL, codec_Data->streamPayloadLength, buffer + index, chunkLength);
+                // The loop increment moves past the last byte of the chunk
+                index += chunkLength - 1;
+                if (codec_Data->streamRemaining == 0)
+                {
+                    resetPacketState(codec_Data);
+                }
+            }
             else
             {
                 /* Codes_SRS_MQTT_CODEC_07_035: [If any error is encountered then the packet state will be marked as error and mqtt_codec_bytesReceived shall return a non-zero value.] */
@@ -1132,3 +2091,117 @@ int mqtt_codec_bytesReceived(MQTTCODEC_HANDLE handle, const unsigned char* buffe
     }
     return result;
 }
+
+int mqtt_codec_decode_batch(MQTTCODEC_HANDLE handle, const uint8_t* buffer, size_t length, MQTT_PACKET_DESC* packets, size_t capacity, size_t* count)
+{
+    int result;
+    if (handle == NULL || (buffer == NULL && length > 0) || packets == NULL || capacity == 0 || count == NULL)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_054: [ If the handle, packets or count parameter is NULL, capacity is 0 or buffer is NULL with a non-zero length then mqtt_codec_decode_batch shall return a non-zero value. ] */
+        LogError("Invalid parameter specified handle: %p, buffer: %p, packets: %p, capacity: %lu, count: %p", handle, buffer, packets, (unsigned long)capacity, count);
+        result = __FAILURE__;
+    }
+    else if (handle->currPacket != UNKNOWN_TYPE || handle->codecState != CODEC_STATE_FIXED_HEADER)
+    {
+        /* Codes_SRS_MQTT_CODEC_07_059: [ mqtt_codec_decode_batch shall return a non-zero value while mqtt_codec_bytesReceived is in the middle of a packet. ] */
+        LogError("mqtt_codec_bytesReceived is in the middle of a packet");
+        result = __FAILURE__;
+    }
+    else
+    {
+        size_t used = 0;
+        size_t position = 0;
+        size_t headerSize;
+        size_t packetSize;
+        size_t index;
+
+        *count = 0;
+        result = 0;
+        releaseBatchCarry(handle);
+
+        /* Codes_SRS_MQTT_CODEC_07_056: [ The bytes of an incomplete packet at the end of buffer shall be kept in the codec and the packet reported by a following call once the rest of it is received. ] */
+        while (result == 0 && *count < capacity && position < handle->batchLength)
+        {
+            MQTT_PACKET_DESC* packet = &packets[*count];
+            size_t carried = handle->batchLength - position;
+            if (scanBatchPacket(handle, BUFFER_u_char(handle->batchCarry) + position, carried, packet, &headerSize, &packetSize) != 0)
+            {
+                result = __FAILURE__;
+            }
+            else if (packetSize != 0 && packetSize <= carried)
+            {
+                packet->carriedOver = true;
+                packet->offset = position + headerSize;
+                position += packetSize;
+                (*count)++;
+            }
+            else
+            {
+                // Only the bytes of the carried packet are moved, the fixed header one byte at a time
+                size_t needed = (packetSize != 0) ? packetSize - carried : 1;
+                if (needed > length - used)
+                {
+                    needed = length - used;
+                }
+                if (needed == 0)
+                {
+                    break;
+                }
+                else if (appendBatchCarry(handle, buffer + used, needed) != 0)
+                {
+                    result = __FAILURE__;
+                }
+                else
+                {
+                    used += needed;
+                }
+            }
+        }
+
+        /* Codes_SRS_MQTT_CODEC_07_055: [ mqtt_codec_decode_batch shall fill packets with the type, flags, variable header offset and remaining length of each complete packet, up to capacity, and set count to their number. ] */
+        while (result == 0 && *count < capacity && position == handle->batchLength && used < length)
+        {
+            MQTT_PACKET_DESC* packet = &packets[*count];
+            if (scanBatchPacket(handle, buffer + used, length - used, packet, &headerSize, &packetSize) != 0)
+            {
+                result = __FAILURE__;
+            }
+            else if (packetSize != 0 && packetSize <= length - used)
+            {
+                packet->carriedOver = false;
+                packet->offset = used + headerSize;
+                used += packetSize;
+                (*count)++;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        /* Codes_SRS_MQTT_CODEC_07_057: [ When packets is full the bytes that are not reported shall be kept in the codec and reported by the following calls. ] */
+        if (result == 0 && used < length && appendBatchCarry(handle, buffer + used, length - used) != 0)
+        {
+            result = __FAILURE__;
+        }
+
+        if (result != 0)
+        {
+            /* Codes_SRS_MQTT_CODEC_07_058: [ mqtt_codec_decode_batch shall return a non-zero value and drop the carried bytes when a packet has a malformed remaining length or is larger than the maximum packet size. ] */
+            *count = 0;
+            handle->batchLength = 0;
+            handle->batchConsumed = 0;
+        }
+        else
+        {
+            // The carried bytes only stop moving once every append is done
+            const uint8_t* carry = (position > 0) ? BUFFER_u_char(handle->batchCarry) : NULL;
+            handle->batchConsumed = position;
+            for (index = 0; index < *count; index++)
+            {
+                packets[index].data = (packets[index].carriedOver ? carry : buffer) + packets[index].offset;
+            }
+        }
+    }
+    return result;
+}
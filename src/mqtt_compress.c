@@ -0,0 +1,298 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <string.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_umqtt_c/mqtt_compress.h"
+
+#define HASH_LOG                12
+#define HASH_MULTIPLIER         2654435761u
+#define MIN_MATCH               4
+#define MAX_OFFSET              65535
+// The last 5 bytes are always literals and the last match starts 12 bytes before the end at the latest
+#define LAST_LITERALS           5
+#define MATCH_FIND_LIMIT        12
+#define RUN_MASK                15
+#define MAX_RUN_BYTE            255
+
+static uint32_t read_uint32(const uint8_t* iterator)
+{
+    uint32_t result;
+    (void)memcpy(&result, iterator, sizeof(result));
+    return result;
+}
+
+static uint32_t hash_sequence(uint32_t sequence)
+{
+    return (sequence * HASH_MULTIPLIER) >> (32 - HASH_LOG);
+}
+
+static size_t get_length_size(size_t length)
+{
+    return length < RUN_MASK ? 0 : (length - RUN_MASK) / MAX_RUN_BYTE + 1;
+}
+
+static uint8_t* write_length(uint8_t* iterator, size_t length)
+{
+    if (length >= RUN_MASK)
+    {
+        length -= RUN_MASK;
+        while (length >= MAX_RUN_BYTE)
+        {
+            *iterator++ = MAX_RUN_BYTE;
+            length -= MAX_RUN_BYTE;
+        }
+        *iterator++ = (uint8_t)length;
+    }
+    return iterator;
+}
+
+static int read_length(const uint8_t* payload, size_t length, size_t* index, size_t* value)
+{
+    int result = 0;
+    if (*value == RUN_MASK)
+    {
+        uint8_t runByte;
+        do
+        {
+            if (*index >= length)
+            {
+                result = __FAILURE__;
+                break;
+            }
+            runByte = payload[(*index)++];
+            *value += runByte;
+        } while (runByte == MAX_RUN_BYTE);
+    }
+    return result;
+}
+
+// Writes literalLength literals and, when matchLength is not 0, the match that follows them
+static int write_sequence(const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength, uint8_t* buffer, size_t bufferSize, size_t* position)
+{
+    int result;
+    size_t sequenceSize = 1 + get_length_size(literalLength) + literalLength;
+    if (matchLength > 0)
+    {
+        sequenceSize += 2 + get_length_size(matchLength - MIN_MATCH);
+    }
+
+    if (sequenceSize > bufferSize - *position)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_COMPRESS_07_005: [Each sequence shall be written as a token, the literal length run, the literals, the little endian offset and the match length run, as the LZ4 block format defines them.]*/
+        uint8_t* iterator = buffer + *position;
+        uint8_t* token = iterator++;
+        *token = (uint8_t)((literalLength < RUN_MASK ? literalLength : RUN_MASK) << 4);
+        iterator = write_length(iterator, literalLength);
+        if (literalLength > 0)
+        {
+            (void)memcpy(iterator, literals, literalLength);
+            iterator += literalLength;
+        }
+        if (matchLength > 0)
+        {
+            size_t matchRun = matchLength - MIN_MATCH;
+            *token |= (uint8_t)(matchRun < RUN_MASK ? matchRun : RUN_MASK);
+            *iterator++ = (uint8_t)(offset & 0xFF);
+            *iterator++ = (uint8_t)(offset >> 8);
+            iterator = write_length(iterator, matchRun);
+        }
+        *position = iterator - buffer;
+        result = 0;
+    }
+    return result;
+}
+
+static size_t transform_bound(size_t length)
+{
+    return mqtt_compress_lz4_bound(length);
+}
+
+static int transform_encode(const uint8_t* payload, size_t length, uint8_t* buffer, size_t bufferSize, size_t* encodedLength)
+{
+    return mqtt_compress_lz4_encode(payload, length, buffer, bufferSize, encodedLength);
+}
+
+static int transform_decode(const uint8_t* payload, size_t length, uint8_t* buffer, size_t bufferSize, size_t* decodedLength)
+{
+    return mqtt_compress_lz4_decode(payload, length, buffer, bufferSize, decodedLength);
+}
+
+static const MQTT_PAYLOAD_TRANSFORM LZ4_TRANSFORM =
+{
+    MQTT_COMPRESS_LZ4_CONTENT_TYPE,
+    transform_bound,
+    transform_encode,
+    transform_decode,
+    0
+};
+
+size_t mqtt_compress_lz4_bound(size_t length)
+{
+    /*Codes_SRS_MQTT_COMPRESS_07_001: [mqtt_compress_lz4_bound shall return the largest size of the LZ4 block of a payload of length bytes, length + length / 255 + 16.]*/
+    return length + length / MAX_RUN_BYTE + 16;
+}
+
+int mqtt_compress_lz4_encode(const uint8_t* payload, size_t length, uint8_t* buffer, size_t bufferSize, size_t* encodedLength)
+{
+    int result;
+    if ((payload == NULL && length > 0) || buffer == NULL || encodedLength == NULL)
+    {
+        /*Codes_SRS_MQTT_COMPRESS_07_002: [If buffer or encodedLength is NULL, or payload is NULL while length is not 0, then mqtt_compress_lz4_encode shall return a non-zero value.]*/
+        LogError("Invalid parameter specified payload: %p, buffer: %p, encodedLength: %p", payload, buffer, encodedLength);
+        result = __FAILURE__;
+    }
+    else
+    {
+        size_t position = 0;
+        size_t anchor = 0;
+        result = 0;
+        /*Codes_SRS_MQTT_COMPRESS_07_003: [A payload of 12 bytes or less shall be encoded as a single sequence of literals.]*/
+        // Payloads too short to hold a match are stored as literals
+        if (length > MATCH_FIND_LIMIT)
+        {
+            uint32_t hashTable[1 << HASH_LOG];
+            size_t matchFindLimit = length - MATCH_FIND_LIMIT;
+            size_t matchLimit = length - LAST_LITERALS;
+            size_t index = 0;
+            /*Codes_SRS_MQTT_COMPRESS_07_004: [mqtt_compress_lz4_encode shall find matches of at least 4 bytes within the last 65535 bytes with a hash table on the stack, leaving the last 5 bytes as literals.]*/
+            (void)memset(hashTable, 0, sizeof(hashTable));
+            while (result == 0 && index <= matchFindLimit)
+            {
+                uint32_t sequence = read_uint32(payload + index);
+                uint32_t hash = hash_sequence(sequence);
+                size_t candidate = hashTable[hash];
+                hashTable[hash] = (uint32_t)index;
+                if (candidate < index && index - candidate <= MAX_OFFSET && read_uint32(payload + candidate) == sequence)
+                {
+                    size_t matchLength = MIN_MATCH;
+                    while (index > anchor && candidate > 0 && payload[index - 1] == payload[candidate - 1])
+                    {
+                        index--;
+                        candidate--;
+                        matchLength++;
+                    }
+                    while (index + matchLength < matchLimit && payload[index + matchLength] == payload[candidate + matchLength])
+                    {
+                        matchLength++;
+                    }
+                    result = write_sequence(payload + anchor, index - anchor, index - candidate, matchLength, buffer, bufferSize, &position);
+                    index += matchLength;
+                    anchor = index;
+                }
+                else
+                {
+                    index++;
+                }
+            }
+        }
+
+        if (result != 0 || write_sequence(payload + anchor, length - anchor, 0, 0, buffer, bufferSize, &position) != 0)
+        {
+            /*Codes_SRS_MQTT_COMPRESS_07_006: [If the block does not fit in bufferSize then mqtt_compress_lz4_encode shall return a non-zero value.]*/
+            result = __FAILURE__;
+        }
+        else
+        {
+            /*Codes_SRS_MQTT_COMPRESS_07_007: [On success mqtt_compress_lz4_encode shall set encodedLength to the size of the block and return 0.]*/
+            *encodedLength = position;
+        }
+    }
+    return result;
+}
+
+int mqtt_compress_lz4_decode(const uint8_t* payload, size_t length, uint8_t* buffer, size_t bufferSize, size_t* decodedLength)
+{
+    int result;
+    if ((payload == NULL && length > 0) || (buffer == NULL && bufferSize > 0) || decodedLength == NULL)
+    {
+        /*Codes_SRS_MQTT_COMPRESS_07_008: [If decodedLength is NULL, payload is NULL while length is not 0, or buffer is NULL while bufferSize is not 0, then mqtt_compress_lz4_decode shall return a non-zero value.]*/
+        LogError("Invalid parameter specified payload: %p, buffer: %p, decodedLength: %p", payload, buffer, decodedLength);
+        result = __FAILURE__;
+    }
+    else
+    {
+        size_t index = 0;
+        size_t position = 0;
+        result = 0;
+        while (result == 0 && index < length)
+        {
+            uint8_t token = payload[index++];
+            size_t literalLength = token >> 4;
+            if (read_length(payload, length, &index, &literalLength) != 0 ||
+                literalLength > length - index || literalLength > bufferSize - position)
+            {
+                /*Codes_SRS_MQTT_COMPRESS_07_009: [If a length run, the literals or an offset goes past the end of the payload then mqtt_compress_lz4_decode shall return a non-zero value.]*/
+                /*Codes_SRS_MQTT_COMPRESS_07_011: [If the literals or a match do not fit in bufferSize then mqtt_compress_lz4_decode shall return a non-zero value without writing past the buffer.]*/
+                result = __FAILURE__;
+            }
+            else
+            {
+                if (literalLength > 0)
+                {
+                    (void)memcpy(buffer + position, payload + index, literalLength);
+                }
+                index += literalLength;
+                position += literalLength;
+
+                // The last sequence ends with its literals
+                if (index < length)
+                {
+                    size_t offset = 0;
+                    size_t matchLength = token & RUN_MASK;
+                    if (length - index >= 2)
+                    {
+                        offset = payload[index] | ((size_t)payload[index + 1] << 8);
+                        index += 2;
+                    }
+
+                    if (offset == 0 || offset > position ||
+                        read_length(payload, length, &index, &matchLength) != 0 || matchLength + MIN_MATCH > bufferSize - position)
+                    {
+                        /*Codes_SRS_MQTT_COMPRESS_07_009: [If a length run, the literals or an offset goes past the end of the payload then mqtt_compress_lz4_decode shall return a non-zero value.]*/
+                        /*Codes_SRS_MQTT_COMPRESS_07_010: [If an offset is 0 or points before the start of the decoded bytes then mqtt_compress_lz4_decode shall return a non-zero value.]*/
+                        /*Codes_SRS_MQTT_COMPRESS_07_011: [If the literals or a match do not fit in bufferSize then mqtt_compress_lz4_decode shall return a non-zero value without writing past the buffer.]*/
+                        result = __FAILURE__;
+                    }
+                    else
+                    {
+                        /*Codes_SRS_MQTT_COMPRESS_07_012: [mqtt_compress_lz4_decode shall copy a match a byte at a time so a match may overlap the bytes it produces.]*/
+                        // The match can overlap the bytes it produces, it is copied a byte at a time
+                        uint8_t* iterator = buffer + position;
+                        const uint8_t* source = iterator - offset;
+                        size_t copyIndex;
+                        matchLength += MIN_MATCH;
+                        for (copyIndex = 0; copyIndex < matchLength; copyIndex++)
+                        {
+                            iterator[copyIndex] = source[copyIndex];
+                        }
+                        position += matchLength;
+                    }
+                }
+            }
+        }
+
+        if (result != 0)
+        {
+            LogError("Malformed LZ4 block");
+        }
+        else
+        {
+            /*Codes_SRS_MQTT_COMPRESS_07_013: [On success mqtt_compress_lz4_decode shall set decodedLength to the decompressed size and return 0.]*/
+            *decodedLength = position;
+        }
+    }
+    return result;
+}
+
+const MQTT_PAYLOAD_TRANSFORM* mqtt_compress_get_lz4_transform(void)
+{
+    /*Codes_SRS_MQTT_COMPRESS_07_014: [mqtt_compress_get_lz4_transform shall return a transform with the content type application/x-lz4-block that calls mqtt_compress_lz4_bound, mqtt_compress_lz4_encode and mqtt_compress_lz4_decode, and the default largest decoded payload.]*/
+    return &LZ4_TRANSFORM;
+}
@@ -0,0 +1,337 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <string.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/condition.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_umqtt_c/mqtt_dispatcher.h"
+#include "mqtt_topic_hash.h"
+
+#define DEFAULT_WORKER_COUNT            4
+#define DEFAULT_QUEUE_DEPTH             64
+
+typedef struct DISPATCH_ITEM_TAG
+{
+    MQTT_MESSAGE_HANDLE msgHandle;
+    MQTT_ACK_TOKEN ackToken;
+} DISPATCH_ITEM;
+
+typedef struct DISPATCH_WORKER_TAG
+{
+    struct MQTT_DISPATCHER_TAG* dispatcher;
+    LOCK_HANDLE lock;
+    COND_HANDLE notEmpty;
+    COND_HANDLE notFull;
+    THREAD_HANDLE thread;
+    bool threadStarted;
+
+    // Guarded by lock: a ring of queueDepth items
+    DISPATCH_ITEM* items;
+    size_t head;
+    size_t count;
+    bool stopWorker;
+} DISPATCH_WORKER;
+
+typedef struct MQTT_DISPATCHER_TAG
+{
+    ON_MQTT_MESSAGE_RECV_ACK_CALLBACK handler;
+    void* handlerCtx;
+    size_t workerCount;
+    size_t queueDepth;
+    DISPATCH_WORKER* workers;
+
+    LOCK_HANDLE statsLock;
+    size_t waitCount;
+} MQTT_DISPATCHER;
+
+static int dispatch_worker_thread(void* context)
+{
+    DISPATCH_WORKER* worker = (DISPATCH_WORKER*)context;
+    MQTT_DISPATCHER* dispatcher = worker->dispatcher;
+    bool running = true;
+    while (running)
+    {
+        if (Lock(worker->lock) != LOCK_OK)
+        {
+            LogError("Failure acquiring dispatcher worker lock");
+            running = false;
+        }
+        else
+        {
+            DISPATCH_ITEM item = { NULL, 0 };
+            /*Codes_SRS_MQTT_DISPATCHER_07_014: [A worker shall only exit once it is stopped and its queue is empty.]*/
+            while (worker->count == 0 && !worker->stopWorker)
+            {
+                (void)Condition_Wait(worker->notEmpty, worker->lock, 0);
+            }
+            if (worker->count > 0)
+            {
+                item = worker->items[worker->head];
+                worker->head = (worker->head + 1) % dispatcher->queueDepth;
+                worker->count--;
+                (void)Condition_Post(worker->notFull);
+            }
+            else
+            {
+                // Only stop once the queue is drained so destroy does not lose messages
+                running = false;
+            }
+            (void)Unlock(worker->lock);
+
+            if (item.msgHandle != NULL)
+            {
+                /*Codes_SRS_MQTT_DISPATCHER_07_013: [Each worker shall call handler with the queued message, its ackToken and handlerCtx in the order the messages were queued, then destroy the message.]*/
+                dispatcher->handler(item.msgHandle, item.ackToken, dispatcher->handlerCtx);
+                mqttmessage_destroy(item.msgHandle);
+            }
+        }
+    }
+    return 0;
+}
+
+static void stop_dispatch_workers(MQTT_DISPATCHER* dispatcher)
+{
+    size_t index;
+    for (index = 0; index < dispatcher->workerCount; index++)
+    {
+        DISPATCH_WORKER* worker = &dispatcher->workers[index];
+        if (worker->threadStarted && Lock(worker->lock) == LOCK_OK)
+        {
+            worker->stopWorker = true;
+            (void)Condition_Post(worker->notEmpty);
+            (void)Unlock(worker->lock);
+        }
+    }
+    for (index = 0; index < dispatcher->workerCount; index++)
+    {
+        DISPATCH_WORKER* worker = &dispatcher->workers[index];
+        if (worker->threadStarted)
+        {
+            int threadResult;
+            (void)ThreadAPI_Join(worker->thread, &threadResult);
+            worker->threadStarted = false;
+        }
+    }
+}
+
+static void destroy_dispatcher_resources(MQTT_DISPATCHER* dispatcher)
+{
+    if (dispatcher->workers != NULL)
+    {
+        size_t index;
+        for (index = 0; index < dispatcher->workerCount; index++)
+        {
+            DISPATCH_WORKER* worker = &dispatcher->workers[index];
+            if (worker->items != NULL)
+            {
+                // Anything left here was queued after the worker failed, release it
+                while (worker->count > 0)
+                {
+                    mqttmessage_destroy(worker->items[worker->head].msgHandle);
+                    worker->head = (worker->head + 1) % dispatcher->queueDepth;
+                    worker->count--;
+                }
+                free(worker->items);
+            }
+            if (worker->notFull != NULL)
+            {
+                Condition_Deinit(worker->notFull);
+            }
+            if (worker->notEmpty != NULL)
+            {
+                Condition_Deinit(worker->notEmpty);
+            }
+            if (worker->lock != NULL)
+            {
+                (void)Lock_Deinit(worker->lock);
+            }
+        }
+        free(dispatcher->workers);
+    }
+    if (dispatcher->statsLock != NULL)
+    {
+        (void)Lock_Deinit(dispatcher->statsLock);
+    }
+    free(dispatcher);
+}
+
+static int create_dispatch_worker(MQTT_DISPATCHER* dispatcher, DISPATCH_WORKER* worker)
+{
+    int result;
+    worker->dispatcher = dispatcher;
+    if ((worker->items = (DISPATCH_ITEM*)malloc(dispatcher->queueDepth * sizeof(DISPATCH_ITEM))) == NULL)
+    {
+        LogError("Failure allocating dispatcher queue of %lu items", (unsigned long)dispatcher->queueDepth);
+        result = __FAILURE__;
+    }
+    else if ((worker->lock = Lock_Init()) == NULL || (worker->notEmpty = Condition_Init()) == NULL ||
+        (worker->notFull = Condition_Init()) == NULL)
+    {
+        LogError("Failure creating dispatcher synchronization objects");
+        result = __FAILURE__;
+    }
+    else if (ThreadAPI_Create(&worker->thread, dispatch_worker_thread, worker) != THREADAPI_OK)
+    {
+        LogError("Failure creating dispatcher worker thread");
+        result = __FAILURE__;
+    }
+    else
+    {
+        worker->threadStarted = true;
+        result = 0;
+    }
+    return result;
+}
+
+MQTT_DISPATCHER_HANDLE mqtt_dispatcher_create(const MQTT_DISPATCHER_OPTIONS* options, ON_MQTT_MESSAGE_RECV_ACK_CALLBACK handler, void* handlerCtx)
+{
+    MQTT_DISPATCHER* result;
+    if (handler == NULL)
+    {
+        /*Codes_SRS_MQTT_DISPATCHER_07_001: [If handler is NULL then mqtt_dispatcher_create shall return NULL.]*/
+        LogError("Invalid parameter specified handler: %p", handler);
+        result = NULL;
+    }
+    else if ((result = (MQTT_DISPATCHER*)malloc(sizeof(MQTT_DISPATCHER))) == NULL)
+    {
+        LogError("Failure allocating dispatcher instance");
+    }
+    else
+    {
+        memset(result, 0, sizeof(MQTT_DISPATCHER));
+        result->handler = handler;
+        result->handlerCtx = handlerCtx;
+        /*Codes_SRS_MQTT_DISPATCHER_07_002: [If options is NULL, or its workerCount or queueDepth is 0, then mqtt_dispatcher_create shall use 4 workers and a queue depth of 64 messages.]*/
+        result->workerCount = (options == NULL || options->workerCount == 0) ? DEFAULT_WORKER_COUNT : options->workerCount;
+        result->queueDepth = (options == NULL || options->queueDepth == 0) ? DEFAULT_QUEUE_DEPTH : options->queueDepth;
+
+        if ((result->statsLock = Lock_Init()) == NULL)
+        {
+            /*Codes_SRS_MQTT_DISPATCHER_07_004: [If any allocation or the creation of a lock, a condition or a thread fails then mqtt_dispatcher_create shall stop the started workers, free everything it allocated and return NULL.]*/
+            LogError("Failure creating dispatcher lock");
+            destroy_dispatcher_resources(result);
+            result = NULL;
+        }
+        else if ((result->workers = (DISPATCH_WORKER*)malloc(result->workerCount * sizeof(DISPATCH_WORKER))) == NULL)
+        {
+            LogError("Failure allocating %lu dispatcher workers", (unsigned long)result->workerCount);
+            destroy_dispatcher_resources(result);
+            result = NULL;
+        }
+        else
+        {
+            size_t index;
+            /*Codes_SRS_MQTT_DISPATCHER_07_003: [mqtt_dispatcher_create shall start workerCount worker threads, each with its own queue of queueDepth messages.]*/
+            memset(result->workers, 0, result->workerCount * sizeof(DISPATCH_WORKER));
+            for (index = 0; index < result->workerCount; index++)
+            {
+                if (create_dispatch_worker(result, &result->workers[index]) != 0)
+                {
+                    break;
+                }
+            }
+            if (index < result->workerCount)
+            {
+                /*Codes_SRS_MQTT_DISPATCHER_07_004: [If any allocation or the creation of a lock, a condition or a thread fails then mqtt_dispatcher_create shall stop the started workers, free everything it allocated and return NULL.]*/
+                stop_dispatch_workers(result);
+                destroy_dispatcher_resources(result);
+                result = NULL;
+            }
+        }
+    }
+    return result;
+}
+
+void mqtt_dispatcher_destroy(MQTT_DISPATCHER_HANDLE handle)
+{
+    /*Codes_SRS_MQTT_DISPATCHER_07_005: [If handle is NULL then mqtt_dispatcher_destroy shall do nothing.]*/
+    if (handle != NULL)
+    {
+        /*Codes_SRS_MQTT_DISPATCHER_07_006: [mqtt_dispatcher_destroy shall let every worker handle the messages already queued, join the worker threads and free all resources.]*/
+        // The workers drain their queues before they exit
+        stop_dispatch_workers(handle);
+        destroy_dispatcher_resources(handle);
+    }
+}
+
+void mqtt_dispatcher_message_received_ack(MQTT_MESSAGE_HANDLE msgHandle, MQTT_ACK_TOKEN ackToken, void* callbackCtx)
+{
+    MQTT_DISPATCHER* dispatcher = (MQTT_DISPATCHER*)callbackCtx;
+    MQTT_MESSAGE_HANDLE msgCopy;
+    if (dispatcher == NULL || msgHandle == NULL)
+    {
+        /*Codes_SRS_MQTT_DISPATCHER_07_007: [If msgHandle or callbackCtx is NULL then mqtt_dispatcher_message_received_ack shall do nothing.]*/
+        LogError("Invalid parameter specified msgHandle: %p, callbackCtx: %p", msgHandle, callbackCtx);
+    }
+    else if ((msgCopy = mqttmessage_clone(msgHandle)) == NULL)
+    {
+        /*Codes_SRS_MQTT_DISPATCHER_07_008: [mqtt_dispatcher_message_received_ack shall copy the message, since the client destroys msgHandle once the callback returns.]*/
+        /*Codes_SRS_MQTT_DISPATCHER_07_009: [If the message cannot be copied then mqtt_dispatcher_message_received_ack shall drop it.]*/
+        // The client destroys msgHandle once this returns, the worker needs its own copy
+        LogError("Failure copying message for dispatch");
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_DISPATCHER_07_010: [mqtt_dispatcher_message_received_ack shall queue the copy and ackToken on the worker selected by the hash of the topic name.]*/
+        DISPATCH_WORKER* worker = &dispatcher->workers[mqtt_topic_hash(mqttmessage_getTopicName(msgCopy)) % dispatcher->workerCount];
+        if (Lock(worker->lock) != LOCK_OK)
+        {
+            LogError("Failure acquiring dispatcher worker lock");
+            mqttmessage_destroy(msgCopy);
+        }
+        else
+        {
+            if (worker->count == dispatcher->queueDepth)
+            {
+                /*Codes_SRS_MQTT_DISPATCHER_07_011: [If the queue of the worker is full then mqtt_dispatcher_message_received_ack shall count the wait and block until the worker makes room.]*/
+                if (Lock(dispatcher->statsLock) == LOCK_OK)
+                {
+                    dispatcher->waitCount++;
+                    (void)Unlock(dispatcher->statsLock);
+                }
+                // Waiting here keeps the dowork thread from reading more than the workers can take
+                while (worker->count == dispatcher->queueDepth)
+                {
+                    (void)Condition_Wait(worker->notFull, worker->lock, 0);
+                }
+            }
+            worker->items[(worker->head + worker->count) % dispatcher->queueDepth].msgHandle = msgCopy;
+            worker->items[(worker->head + worker->count) % dispatcher->queueDepth].ackToken = ackToken;
+            worker->count++;
+            (void)Condition_Post(worker->notEmpty);
+            (void)Unlock(worker->lock);
+        }
+    }
+}
+
+void mqtt_dispatcher_message_received(MQTT_MESSAGE_HANDLE msgHandle, void* callbackCtx)
+{
+    /*Codes_SRS_MQTT_DISPATCHER_07_012: [mqtt_dispatcher_message_received shall behave as mqtt_dispatcher_message_received_ack with an ackToken of 0.]*/
+    mqtt_dispatcher_message_received_ack(msgHandle, 0, callbackCtx);
+}
+
+size_t mqtt_dispatcher_get_wait_count(MQTT_DISPATCHER_HANDLE handle)
+{
+    size_t result;
+    if (handle == NULL)
+    {
+        /*Codes_SRS_MQTT_DISPATCHER_07_015: [If handle is NULL then mqtt_dispatcher_get_wait_count shall return 0.]*/
+        result = 0;
+    }
+    else if (Lock(handle->statsLock) != LOCK_OK)
+    {
+        result = 0;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_DISPATCHER_07_016: [mqtt_dispatcher_get_wait_count shall return the number of times the receive path waited for room in a full queue.]*/
+        result = handle->waitCount;
+        (void)Unlock(handle->statsLock);
+    }
+    return result;
+}
@@ -162,7 +162,9 @@ MQTT_MESSAGE_HANDLE mqttmessage_clone(MQTT_MESSAGE_HANDLE handle)
     else
     {
         /* Codes_SRS_MQTTMESSAGE_07_008: [mqttmessage_clone shall create a new MQTT_MESSAGE_HANDLE with data content identical of the handle value.] */
-        result = mqttmessage_create(handle->packetId, handle->topicName, handle->qosInfo, handle->appPayload.message, handle->appPayload.length);
+        // An in place message only has the const topic and payload, the getters pick whichever is set
+        const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(handle);
+        result = mqttmessage_create(handle->packetId, mqttmessage_getTopicName(handle), handle->qosInfo, payload->message, payload->length);
         if (result != NULL)
         {
             result->isDuplicateMsg = handle->isDuplicateMsg;
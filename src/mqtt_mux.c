@@ -0,0 +1,504 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <string.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_umqtt_c/mqtt_mux.h"
+
+#define INITIAL_SESSION_CAPACITY        8
+#define TOPIC_LEVEL_SEPARATOR           '/'
+
+typedef struct MQTT_MUX_SESSION_TAG
+{
+    struct MQTT_MUX_TAG* mux;
+    ON_MQTT_MESSAGE_RECV_CALLBACK fnMessageRecv;
+    void* callbackCtx;
+    size_t prefixLength;
+    // Allocated with the session
+    char* topicPrefix;
+} MQTT_MUX_SESSION;
+
+typedef struct MQTT_MUX_TAG
+{
+    MQTT_CLIENT_HANDLE mqttClient;
+    ON_MQTT_MESSAGE_RECV_CALLBACK fnUnroutedRecv;
+    void* unroutedCtx;
+    ON_MQTT_OPERATION_CALLBACK fnOperationCallback;
+    void* opCallbackCtx;
+    ON_MQTT_ERROR_CALLBACK fnOnError;
+    void* errorCtx;
+    uint16_t nextPacketId;
+
+    // Sorted by prefix, a topic is routed with one binary search per topic level
+    MQTT_MUX_SESSION** sessions;
+    size_t sessionCount;
+    size_t sessionCapacity;
+
+    // Kept from one publish to the next, holds topicPrefix/<topic>
+    char* topicBuffer;
+    size_t topicBufferSize;
+} MQTT_MUX;
+
+static uint16_t get_next_packet_id(MQTT_MUX* mux)
+{
+    uint16_t result = mux->nextPacketId;
+    /*Codes_SRS_MQTT_MUX_07_020: [QoS 1 and 2 publishes shall take the next packet id of the multiplexer, wrapping from 65535 to 1, QoS 0 publishes a packet id of 0.]*/
+    mux->nextPacketId = (mux->nextPacketId == UINT16_MAX) ? 1 : mux->nextPacketId + 1;
+    return result;
+}
+
+// strcmp of the session prefix with the first length characters of prefix
+static int compare_prefix(const char* sessionPrefix, const char* prefix, size_t length)
+{
+    int result = strncmp(sessionPrefix, prefix, length);
+    if (result == 0 && sessionPrefix[length] != '\0')
+    {
+        result = 1;
+    }
+    return result;
+}
+
+// index is where the prefix is, or where it goes when it is not found
+static bool find_session_index(const MQTT_MUX* mux, const char* prefix, size_t length, size_t* index)
+{
+    bool result = false;
+    size_t low = 0;
+    size_t high = mux->sessionCount;
+    while (low < high && !result)
+    {
+        size_t middle = low + (high - low) / 2;
+        int compare = compare_prefix(mux->sessions[middle]->topicPrefix, prefix, length);
+        if (compare < 0)
+        {
+            low = middle + 1;
+        }
+        else if (compare > 0)
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle;
+            result = true;
+        }
+    }
+    *index = low;
+    return result;
+}
+
+static MQTT_MUX_SESSION* find_session(const MQTT_MUX* mux, const char* topicName)
+{
+    MQTT_MUX_SESSION* result = NULL;
+    const char* separator;
+    /*Codes_SRS_MQTT_MUX_07_012: [A message shall be routed to the session with the longest prefix that matches the topic up to a level separator, found with a binary search per topic level.]*/
+    // Every level boundary is looked up so the longest prefix wins
+    for (separator = strchr(topicName, TOPIC_LEVEL_SEPARATOR); separator != NULL; separator = strchr(separator + 1, TOPIC_LEVEL_SEPARATOR))
+    {
+        size_t index;
+        if (find_session_index(mux, topicName, separator - topicName, &index))
+        {
+            result = mux->sessions[index];
+        }
+    }
+    return result;
+}
+
+static void on_mux_message_recv(MQTT_MESSAGE_HANDLE msgHandle, void* callbackCtx)
+{
+    MQTT_MUX* mux = (MQTT_MUX*)callbackCtx;
+    const char* topicName = mqttmessage_getTopicName(msgHandle);
+    MQTT_MUX_SESSION* session = (topicName == NULL || mux->sessionCount == 0) ? NULL : find_session(mux, topicName);
+    if (session == NULL)
+    {
+        /*Codes_SRS_MQTT_MUX_07_013: [A message whose topic is under no session prefix shall be passed to unroutedRecv when it is not NULL.]*/
+        if (mux->fnUnroutedRecv != NULL)
+        {
+            mux->fnUnroutedRecv(msgHandle, mux->unroutedCtx);
+        }
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_MUX_07_014: [The session shall get a message created in place with the topic after its prefix and the packet id, QoS, payload, duplicate and retain flags of the message received.]*/
+        // The session gets its own topic, the message points into the one received
+        const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(msgHandle);
+        uint16_t packetId = mqttmessage_getPacketId(msgHandle);
+        QOS_VALUE qosValue = mqttmessage_getQosType(msgHandle);
+        MQTT_MESSAGE_HANDLE sessionMsg = mqttmessage_create_in_place(packetId, topicName + session->prefixLength + 1, qosValue, payload->message, payload->length);
+        if (sessionMsg == NULL)
+        {
+            LogError("Failure creating the message of session %s", session->topicPrefix);
+        }
+        else
+        {
+            (void)mqttmessage_setIsDuplicateMsg(sessionMsg, mqttmessage_getIsDuplicateMsg(msgHandle));
+            (void)mqttmessage_setIsRetained(sessionMsg, mqttmessage_getIsRetained(msgHandle));
+            session->fnMessageRecv(sessionMsg, session->callbackCtx);
+            mqttmessage_destroy(sessionMsg);
+        }
+    }
+}
+
+static void on_mux_operation(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo, void* callbackCtx)
+{
+    MQTT_MUX* mux = (MQTT_MUX*)callbackCtx;
+    /*Codes_SRS_MQTT_MUX_07_003: [The operations and errors of the shared client shall be passed to opCallback and onError when they are not NULL.]*/
+    if (mux->fnOperationCallback != NULL)
+    {
+        mux->fnOperationCallback(handle, actionResult, msgInfo, mux->opCallbackCtx);
+    }
+}
+
+static void on_mux_error(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR error, void* callbackCtx)
+{
+    MQTT_MUX* mux = (MQTT_MUX*)callbackCtx;
+    /*Codes_SRS_MQTT_MUX_07_003: [The operations and errors of the shared client shall be passed to opCallback and onError when they are not NULL.]*/
+    if (mux->fnOnError != NULL)
+    {
+        mux->fnOnError(handle, error, mux->errorCtx);
+    }
+}
+
+// Writes topicPrefix/<topic> at destination, which holds prefixLength + 1 + strlen(topic) + 1 bytes
+static void write_session_topic(const MQTT_MUX_SESSION* session, const char* topic, char* destination)
+{
+    size_t topicLength = strlen(topic);
+    (void)memcpy(destination, session->topicPrefix, session->prefixLength);
+    destination[session->prefixLength] = TOPIC_LEVEL_SEPARATOR;
+    (void)memcpy(destination + session->prefixLength + 1, topic, topicLength + 1);
+}
+
+// Copies the topics of a subscribe or unsubscribe under the session prefix, the list and the topics are one allocation
+static const char** create_session_topics(const MQTT_MUX_SESSION* session, const char* const* topics, size_t stride, size_t count)
+{
+    const char** result;
+    size_t size = count * sizeof(const char*);
+    size_t index;
+    for (index = 0; index < count; index++)
+    {
+        const char* topic = *(const char* const*)((const uint8_t*)topics + index * stride);
+        size += session->prefixLength + 1 + strlen(topic) + 1;
+    }
+
+    if ((result = (const char**)malloc(size)) == NULL)
+    {
+        LogError("Failure allocating %lu session topics", (unsigned long)count);
+    }
+    else
+    {
+        char* iterator = (char*)(result + count);
+        for (index = 0; index < count; index++)
+        {
+            const char* topic = *(const char* const*)((const uint8_t*)topics + index * stride);
+            write_session_topic(session, topic, iterator);
+            result[index] = iterator;
+            iterator += session->prefixLength + 1 + strlen(topic) + 1;
+        }
+    }
+    return result;
+}
+
+static bool is_valid_prefix(const char* topicPrefix)
+{
+    return *topicPrefix != '\0' && strchr(topicPrefix, '+') == NULL && strchr(topicPrefix, '#') == NULL;
+}
+
+MQTT_MUX_HANDLE mqtt_mux_create(ON_MQTT_MESSAGE_RECV_CALLBACK unroutedRecv, void* unroutedCtx, ON_MQTT_OPERATION_CALLBACK opCallback, void* opCallbackCtx, ON_MQTT_ERROR_CALLBACK onError, void* errorCtx)
+{
+    MQTT_MUX* result;
+    if ((result = (MQTT_MUX*)malloc(sizeof(MQTT_MUX))) == NULL)
+    {
+        /*Codes_SRS_MQTT_MUX_07_002: [If the allocation or mqtt_client_init fails then mqtt_mux_create shall free everything it allocated and return NULL.]*/
+        LogError("Failure allocating multiplexer");
+    }
+    else
+    {
+        memset(result, 0, sizeof(MQTT_MUX));
+        result->fnUnroutedRecv = unroutedRecv;
+        result->unroutedCtx = unroutedCtx;
+        result->fnOperationCallback = opCallback;
+        result->opCallbackCtx = opCallbackCtx;
+        result->fnOnError = onError;
+        result->errorCtx = errorCtx;
+        result->nextPacketId = 1;
+        /*Codes_SRS_MQTT_MUX_07_001: [mqtt_mux_create shall allocate the multiplexer and create the shared client with mqtt_client_init.]*/
+        if ((result->mqttClient = mqtt_client_init(on_mux_message_recv, on_mux_operation, result, on_mux_error, result)) == NULL)
+        {
+            /*Codes_SRS_MQTT_MUX_07_002: [If the allocation or mqtt_client_init fails then mqtt_mux_create shall free everything it allocated and return NULL.]*/
+            LogError("Failure creating the shared client");
+            free(result);
+            result = NULL;
+        }
+    }
+    return result;
+}
+
+void mqtt_mux_destroy(MQTT_MUX_HANDLE handle)
+{
+    /*Codes_SRS_MQTT_MUX_07_004: [If handle is NULL then mqtt_mux_destroy shall do nothing.]*/
+    if (handle != NULL)
+    {
+        size_t index;
+        /*Codes_SRS_MQTT_MUX_07_005: [mqtt_mux_destroy shall deinitialize the shared client, free the sessions left and all resources.]*/
+        mqtt_client_deinit(handle->mqttClient);
+        for (index = 0; index < handle->sessionCount; index++)
+        {
+            free(handle->sessions[index]);
+        }
+        if (handle->sessions != NULL)
+        {
+            free(handle->sessions);
+        }
+        if (handle->topicBuffer != NULL)
+        {
+            free(handle->topicBuffer);
+        }
+        free(handle);
+    }
+}
+
+MQTT_CLIENT_HANDLE mqtt_mux_get_client(MQTT_MUX_HANDLE handle)
+{
+    MQTT_CLIENT_HANDLE result;
+    /*Codes_SRS_MQTT_MUX_07_006: [If handle is NULL then mqtt_mux_get_client shall return NULL, otherwise it shall return the shared client.]*/
+    if (handle == NULL)
+    {
+        LogError("Invalid parameter specified handle: %p", handle);
+        result = NULL;
+    }
+    else
+    {
+        result = handle->mqttClient;
+    }
+    return result;
+}
+
+MQTT_MUX_SESSION_HANDLE mqtt_mux_add_session(MQTT_MUX_HANDLE handle, const char* topicPrefix, ON_MQTT_MESSAGE_RECV_CALLBACK msgRecv, void* callbackCtx)
+{
+    MQTT_MUX_SESSION* result;
+    size_t index;
+    if (handle == NULL || topicPrefix == NULL || msgRecv == NULL || !is_valid_prefix(topicPrefix))
+    {
+        /*Codes_SRS_MQTT_MUX_07_007: [If handle, topicPrefix or msgRecv is NULL, or topicPrefix is empty or holds a wildcard, then mqtt_mux_add_session shall return NULL.]*/
+        LogError("Invalid parameter specified handle: %p, topicPrefix: %s, msgRecv: %p", handle, topicPrefix == NULL ? "NULL" : topicPrefix, msgRecv);
+        result = NULL;
+    }
+    else if (find_session_index(handle, topicPrefix, strlen(topicPrefix), &index))
+    {
+        /*Codes_SRS_MQTT_MUX_07_008: [If a session already uses topicPrefix then mqtt_mux_add_session shall return NULL.]*/
+        LogError("A session already uses the prefix %s", topicPrefix);
+        result = NULL;
+    }
+    else
+    {
+        size_t prefixLength = strlen(topicPrefix);
+        /*Codes_SRS_MQTT_MUX_07_009: [mqtt_mux_add_session shall double the session list when it is full, starting with 8 sessions.]*/
+        if (handle->sessionCount == handle->sessionCapacity)
+        {
+            size_t capacity = (handle->sessionCapacity == 0) ? INITIAL_SESSION_CAPACITY : handle->sessionCapacity * 2;
+            MQTT_MUX_SESSION** sessions = (MQTT_MUX_SESSION**)malloc(capacity * sizeof(MQTT_MUX_SESSION*));
+            if (sessions == NULL)
+            {
+                /*Codes_SRS_MQTT_MUX_07_010: [If an allocation fails then mqtt_mux_add_session shall return NULL.]*/
+                LogError("Failure allocating %lu sessions", (unsigned long)capacity);
+            }
+            else
+            {
+                if (handle->sessions != NULL)
+                {
+                    (void)memcpy(sessions, handle->sessions, handle->sessionCount * sizeof(MQTT_MUX_SESSION*));
+                    free(handle->sessions);
+                }
+                handle->sessions = sessions;
+                handle->sessionCapacity = capacity;
+            }
+        }
+
+        if (handle->sessionCount == handle->sessionCapacity)
+        {
+            result = NULL;
+        }
+        else if ((result = (MQTT_MUX_SESSION*)malloc(sizeof(MQTT_MUX_SESSION) + prefixLength + 1)) == NULL)
+        {
+            /*Codes_SRS_MQTT_MUX_07_010: [If an allocation fails then mqtt_mux_add_session shall return NULL.]*/
+            LogError("Failure allocating session");
+        }
+        else
+        {
+            /*Codes_SRS_MQTT_MUX_07_011: [mqtt_mux_add_session shall allocate the session with a copy of topicPrefix and insert it in the list sorted by prefix.]*/
+            result->mux = handle;
+            result->fnMessageRecv = msgRecv;
+            result->callbackCtx = callbackCtx;
+            result->prefixLength = prefixLength;
+            result->topicPrefix = (char*)(result + 1);
+            (void)memcpy(result->topicPrefix, topicPrefix, prefixLength + 1);
+
+            (void)memmove(&handle->sessions[index + 1], &handle->sessions[index], (handle->sessionCount - index) * sizeof(MQTT_MUX_SESSION*));
+            handle->sessions[index] = result;
+            handle->sessionCount++;
+        }
+    }
+    return result;
+}
+
+void mqtt_mux_remove_session(MQTT_MUX_SESSION_HANDLE session)
+{
+    /*Codes_SRS_MQTT_MUX_07_015: [If session is NULL then mqtt_mux_remove_session shall do nothing.]*/
+    if (session != NULL)
+    {
+        MQTT_MUX* mux = session->mux;
+        size_t index;
+        /*Codes_SRS_MQTT_MUX_07_016: [mqtt_mux_remove_session shall remove the session from the list and free it, leaving its subscriptions on the connection.]*/
+        if (find_session_index(mux, session->topicPrefix, session->prefixLength, &index))
+        {
+            mux->sessionCount--;
+            (void)memmove(&mux->sessions[index], &mux->sessions[index + 1], (mux->sessionCount - index) * sizeof(MQTT_MUX_SESSION*));
+        }
+        free(session);
+    }
+}
+
+int mqtt_mux_publish(MQTT_MUX_SESSION_HANDLE session, MQTT_MESSAGE_HANDLE msgHandle)
+{
+    int result;
+    const char* topicName;
+    if (session == NULL || msgHandle == NULL || (topicName = mqttmessage_getTopicName(msgHandle)) == NULL)
+    {
+        /*Codes_SRS_MQTT_MUX_07_017: [If session or msgHandle is NULL, or the message has no topic, then mqtt_mux_publish shall return a non-zero value.]*/
+        LogError("Invalid parameter specified session: %p, msgHandle: %p", session, msgHandle);
+        result = __FAILURE__;
+    }
+    else
+    {
+        MQTT_MUX* mux = session->mux;
+        size_t topicSize = session->prefixLength + 1 + strlen(topicName) + 1;
+        /*Codes_SRS_MQTT_MUX_07_018: [mqtt_mux_publish shall write topicPrefix/<topic> in a buffer kept from one publish to the next, growing it when the topic does not fit, and return a non-zero value if it cannot grow.]*/
+        if (topicSize > mux->topicBufferSize)
+        {
+            char* topicBuffer = (char*)malloc(topicSize);
+            if (topicBuffer != NULL)
+            {
+                if (mux->topicBuffer != NULL)
+                {
+                    free(mux->topicBuffer);
+                }
+                mux->topicBuffer = topicBuffer;
+                mux->topicBufferSize = topicSize;
+            }
+        }
+
+        if (topicSize > mux->topicBufferSize)
+        {
+            LogError("Failure allocating topic of %lu bytes", (unsigned long)topicSize);
+            result = __FAILURE__;
+        }
+        else
+        {
+            QOS_VALUE qosValue = mqttmessage_getQosType(msgHandle);
+            const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(msgHandle);
+            MQTT_MESSAGE_HANDLE sessionMsg;
+            write_session_topic(session, topicName, mux->topicBuffer);
+
+            /*Codes_SRS_MQTT_MUX_07_019: [mqtt_mux_publish shall publish a message created in place over that topic and the payload of msgHandle, with its duplicate and retain flags, and return the result of mqtt_client_publish.]*/
+            // The client encodes the topic and payload before returning, nothing else is copied
+            if ((sessionMsg = mqttmessage_create_in_place(qosValue == DELIVER_AT_MOST_ONCE ? 0 : get_next_packet_id(mux), mux->topicBuffer,
+                qosValue, payload->message, payload->length)) == NULL)
+            {
+                LogError("Failure creating session message");
+                result = __FAILURE__;
+            }
+            else
+            {
+                (void)mqttmessage_setIsDuplicateMsg(sessionMsg, mqttmessage_getIsDuplicateMsg(msgHandle));
+                (void)mqttmessage_setIsRetained(sessionMsg, mqttmessage_getIsRetained(msgHandle));
+                result = mqtt_client_publish(mux->mqttClient, sessionMsg);
+                mqttmessage_destroy(sessionMsg);
+            }
+        }
+    }
+    return result;
+}
+
+int mqtt_mux_subscribe(MQTT_MUX_SESSION_HANDLE session, SUBSCRIBE_PAYLOAD* subscribeList, size_t count)
+{
+    int result;
+    if (session == NULL || subscribeList == NULL || count == 0)
+    {
+        /*Codes_SRS_MQTT_MUX_07_021: [If session or subscribeList is NULL, or count is 0, then mqtt_mux_subscribe shall return a non-zero value.]*/
+        LogError("Invalid parameter specified session: %p, subscribeList: %p, count: %lu", session, subscribeList, (unsigned long)count);
+        result = __FAILURE__;
+    }
+    else
+    {
+        SUBSCRIBE_PAYLOAD* sessionList = (SUBSCRIBE_PAYLOAD*)malloc(count * sizeof(SUBSCRIBE_PAYLOAD));
+        const char** topics = NULL;
+        if (sessionList == NULL || (topics = create_session_topics(session, &subscribeList[0].subscribeTopic, sizeof(SUBSCRIBE_PAYLOAD), count)) == NULL)
+        {
+            /*Codes_SRS_MQTT_MUX_07_023: [If the prefixed filters cannot be allocated then mqtt_mux_subscribe shall return a non-zero value.]*/
+            LogError("Failure creating session subscriptions");
+            result = __FAILURE__;
+        }
+        else
+        {
+            size_t index;
+            for (index = 0; index < count; index++)
+            {
+                sessionList[index].subscribeTopic = topics[index];
+                sessionList[index].qosReturn = subscribeList[index].qosReturn;
+            }
+            /*Codes_SRS_MQTT_MUX_07_022: [mqtt_mux_subscribe shall subscribe to topicPrefix/<filter> for every filter of subscribeList with the next packet id of the multiplexer and return the result of mqtt_client_subscribe.]*/
+            result = mqtt_client_subscribe(session->mux->mqttClient, get_next_packet_id(session->mux), sessionList, count);
+        }
+
+        if (topics != NULL)
+        {
+            free((void*)topics);
+        }
+        if (sessionList != NULL)
+        {
+            free(sessionList);
+        }
+    }
+    return result;
+}
+
+int mqtt_mux_unsubscribe(MQTT_MUX_SESSION_HANDLE session, const char** unsubscribeList, size_t count)
+{
+    int result;
+    const char** topics;
+    if (session == NULL || unsubscribeList == NULL || count == 0)
+    {
+        /*Codes_SRS_MQTT_MUX_07_024: [If session or unsubscribeList is NULL, or count is 0, then mqtt_mux_unsubscribe shall return a non-zero value.]*/
+        LogError("Invalid parameter specified session: %p, unsubscribeList: %p, count: %lu", session, unsubscribeList, (unsigned long)count);
+        result = __FAILURE__;
+    }
+    else if ((topics = create_session_topics(session, unsubscribeList, sizeof(const char*), count)) == NULL)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_MUX_07_025: [mqtt_mux_unsubscribe shall unsubscribe from topicPrefix/<topic> for every topic of unsubscribeList with the next packet id of the multiplexer and return the result of mqtt_client_unsubscribe, or a non-zero value if the prefixed topics cannot be allocated.]*/
+        result = mqtt_client_unsubscribe(session->mux->mqttClient, get_next_packet_id(session->mux), topics, count);
+        free((void*)topics);
+    }
+    return result;
+}
+
+size_t mqtt_mux_get_session_count(MQTT_MUX_HANDLE handle)
+{
+    size_t result;
+    /*Codes_SRS_MQTT_MUX_07_026: [If handle is NULL then mqtt_mux_get_session_count shall return 0, otherwise it shall return the number of sessions.]*/
+    if (handle == NULL)
+    {
+        LogError("Invalid parameter specified handle: %p", handle);
+        result = 0;
+    }
+    else
+    {
+        result = handle->sessionCount;
+    }
+    return result;
+}
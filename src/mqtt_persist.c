@@ -0,0 +1,875 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/crt_abstractions.h"
+#include "azure_c_shared_utility/strings.h"
+#include "azure_c_shared_utility/vector.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_umqtt_c/mqtt_persist.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+#define USE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define SEGMENT_MAGIC                   0x50514D55  // "UMQP"
+#define SEGMENT_VERSION                 1
+#define SEGMENT_HEADER_SIZE             8
+#define RECORD_HEADER_SIZE              12
+#define DEFAULT_SEGMENT_SIZE            (1024 * 1024)
+
+#define RECORD_STATE_REMOVED            0x00
+#define RECORD_STATE_PUBLISH            0x01
+#define RECORD_STATE_RELEASED           0x02
+
+#define RECORD_LENGTH_OFFSET            0
+#define RECORD_SEQUENCE_OFFSET          4
+#define RECORD_PACKET_ID_OFFSET         8
+#define RECORD_STATE_OFFSET             10
+
+#define PAD_TO_32BIT(len)               (((len) + 3) & ~((size_t)3))
+
+/* Segment layout, all fields in host byte order:
+   [magic:4][version:4] followed by records of
+   [length:4][sequence:4][packetId:2][state:1][reserved:1][packet:length] padded to 4 bytes.
+   A zero length marks the end of the used area. The length is written last so a record
+   interrupted by a crash is never seen on recovery. */
+
+typedef struct PERSIST_SEGMENT_TAG
+{
+    size_t index;
+    uint8_t* base;
+    size_t size;
+    size_t used;
+    size_t liveCount;
+    size_t liveBytes;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#elif defined(USE_MMAP)
+    int fd;
+#else
+    FILE* file;
+#endif
+} PERSIST_SEGMENT;
+
+typedef struct PERSIST_ENTRY_TAG
+{
+    uint32_t sequence;
+    uint16_t packetId;
+    size_t segmentIndex;
+    size_t offset;
+} PERSIST_ENTRY;
+
+typedef struct MQTT_PERSIST_TAG
+{
+    char* filePrefix;
+    size_t segmentSize;
+    bool syncOnAppend;
+    // Mapped segments ordered by index, the last one receives the appends
+    VECTOR_HANDLE segments;
+    // Live records ordered by sequence, which is the replay order
+    VECTOR_HANDLE entries;
+    size_t firstSegmentIndex;
+    size_t nextSegmentIndex;
+    uint32_t nextSequence;
+} MQTT_PERSIST;
+
+static void write_uint32(uint8_t* buffer, uint32_t value)
+{
+    (void)memcpy(buffer, &value, sizeof(value));
+}
+
+static uint32_t read_uint32(const uint8_t* buffer)
+{
+    uint32_t value;
+    (void)memcpy(&value, buffer, sizeof(value));
+    return value;
+}
+
+static void write_uint16(uint8_t* buffer, uint16_t value)
+{
+    (void)memcpy(buffer, &value, sizeof(value));
+}
+
+static uint16_t read_uint16(const uint8_t* buffer)
+{
+    uint16_t value;
+    (void)memcpy(&value, buffer, sizeof(value));
+    return value;
+}
+
+static STRING_HANDLE construct_segment_path(MQTT_PERSIST* persist, size_t index)
+{
+    return STRING_construct_sprintf("%s_%05lu.seg", persist->filePrefix, (unsigned long)index);
+}
+
+static int sync_segment(PERSIST_SEGMENT* segment)
+{
+    int result;
+#ifdef _WIN32
+    result = (FlushViewOfFile(segment->base, 0) && FlushFileBuffers(segment->file)) ? 0 : __FAILURE__;
+#elif defined(USE_MMAP)
+    result = (msync(segment->base, segment->size, MS_SYNC) == 0) ? 0 : __FAILURE__;
+#else
+    result = (fseek(segment->file, 0, SEEK_SET) == 0 && fwrite(segment->base, 1, segment->size, segment->file) == segment->size &&
+        fflush(segment->file) == 0) ? 0 : __FAILURE__;
+#endif
+    return result;
+}
+
+static int map_segment(PERSIST_SEGMENT* segment, const char* path, size_t size, bool create)
+{
+    int result;
+#ifdef _WIN32
+    LARGE_INTEGER fileSize;
+    segment->mapping = NULL;
+    segment->base = NULL;
+    segment->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, create ? CREATE_NEW : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (segment->file == INVALID_HANDLE_VALUE)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        if (create)
+        {
+            fileSize.QuadPart = (LONGLONG)size;
+        }
+        else if (!GetFileSizeEx(segment->file, &fileSize))
+        {
+            fileSize.QuadPart = 0;
+        }
+
+        if (fileSize.QuadPart < SEGMENT_HEADER_SIZE ||
+            (segment->mapping = CreateFileMappingA(segment->file, NULL, PAGE_READWRITE, (DWORD)(fileSize.QuadPart >> 32), (DWORD)fileSize.QuadPart, NULL)) == NULL ||
+            (segment->base = (uint8_t*)MapViewOfFile(segment->mapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)fileSize.QuadPart)) == NULL)
+        {
+            if (segment->mapping != NULL)
+            {
+                (void)CloseHandle(segment->mapping);
+            }
+            (void)CloseHandle(segment->file);
+            result = __FAILURE__;
+        }
+        else
+        {
+            segment->size = (size_t)fileSize.QuadPart;
+            result = 0;
+        }
+    }
+#elif defined(USE_MMAP)
+    struct stat fileStat;
+    segment->fd = open(path, create ? (O_RDWR | O_CREAT | O_EXCL) : O_RDWR, 0600);
+    if (segment->fd < 0)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        if (create)
+        {
+            if (ftruncate(segment->fd, (off_t)size) != 0)
+            {
+                size = 0;
+            }
+        }
+        else
+        {
+            size = (fstat(segment->fd, &fileStat) == 0) ? (size_t)fileStat.st_size : 0;
+        }
+
+        if (size < SEGMENT_HEADER_SIZE ||
+            (segment->base = (uint8_t*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0)) == (uint8_t*)MAP_FAILED)
+        {
+            (void)close(segment->fd);
+            result = __FAILURE__;
+        }
+        else
+        {
+            segment->size = size;
+            result = 0;
+        }
+    }
+#else
+    // Without file mapping the segment is read into memory and written back by sync_segment
+    FILE* existing = create ? fopen(path, "rb") : NULL;
+    segment->base = NULL;
+    if (existing != NULL)
+    {
+        (void)fclose(existing);
+        result = __FAILURE__;
+    }
+    else if ((segment->file = fopen(path, create ? "w+b" : "r+b")) == NULL)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        if (!create)
+        {
+            long fileSize = (fseek(segment->file, 0, SEEK_END) == 0) ? ftell(segment->file) : -1;
+            size = (fileSize > 0 && fseek(segment->file, 0, SEEK_SET) == 0) ? (size_t)fileSize : 0;
+        }
+
+        if (size < SEGMENT_HEADER_SIZE || (segment->base = (uint8_t*)malloc(size)) == NULL)
+        {
+            (void)fclose(segment->file);
+            result = __FAILURE__;
+        }
+        else
+        {
+            segment->size = size;
+            if (create)
+            {
+                memset(segment->base, 0, size);
+                result = sync_segment(segment);
+            }
+            else
+            {
+                result = (fread(segment->base, 1, size, segment->file) == size) ? 0 : __FAILURE__;
+            }
+
+            if (result != 0)
+            {
+                free(segment->base);
+                (void)fclose(segment->file);
+            }
+        }
+    }
+#endif
+    return result;
+}
+
+static void unmap_segment(PERSIST_SEGMENT* segment)
+{
+#ifdef _WIN32
+    (void)UnmapViewOfFile(segment->base);
+    (void)CloseHandle(segment->mapping);
+    (void)CloseHandle(segment->file);
+#elif defined(USE_MMAP)
+    (void)munmap(segment->base, segment->size);
+    (void)close(segment->fd);
+#else
+    free(segment->base);
+    (void)fclose(segment->file);
+#endif
+}
+
+static void write_manifest(MQTT_PERSIST* persist)
+{
+    STRING_HANDLE path = STRING_construct_sprintf("%s.manifest", persist->filePrefix);
+    if (path == NULL)
+    {
+        LogError("Failure constructing manifest path");
+    }
+    else
+    {
+        FILE* manifest = fopen(STRING_c_str(path), "w");
+        if (manifest == NULL)
+        {
+            LogError("Failure opening manifest %s", STRING_c_str(path));
+        }
+        else
+        {
+            (void)fprintf(manifest, "%lu %lu\n", (unsigned long)persist->firstSegmentIndex, (unsigned long)persist->nextSegmentIndex);
+            (void)fclose(manifest);
+        }
+        STRING_delete(path);
+    }
+}
+
+static void read_manifest(MQTT_PERSIST* persist)
+{
+    STRING_HANDLE path = STRING_construct_sprintf("%s.manifest", persist->filePrefix);
+    persist->firstSegmentIndex = 0;
+    persist->nextSegmentIndex = 0;
+    if (path != NULL)
+    {
+        FILE* manifest = fopen(STRING_c_str(path), "r");
+        if (manifest != NULL)
+        {
+            unsigned long first;
+            unsigned long next;
+            if (fscanf(manifest, "%lu %lu", &first, &next) == 2 && first <= next)
+            {
+                persist->firstSegmentIndex = (size_t)first;
+                persist->nextSegmentIndex = (size_t)next;
+            }
+            (void)fclose(manifest);
+        }
+        STRING_delete(path);
+    }
+}
+
+static PERSIST_SEGMENT* find_segment(MQTT_PERSIST* persist, size_t index, size_t* position)
+{
+    PERSIST_SEGMENT* result = NULL;
+    size_t count = VECTOR_size(persist->segments);
+    size_t pos;
+    for (pos = 0; pos < count; pos++)
+    {
+        PERSIST_SEGMENT* segment = (PERSIST_SEGMENT*)VECTOR_element(persist->segments, pos);
+        if (segment->index == index)
+        {
+            if (position != NULL)
+            {
+                *position = pos;
+            }
+            result = segment;
+            break;
+        }
+    }
+    return result;
+}
+
+// Newest first, so a stale record recovered with the same packet id is never picked
+static PERSIST_ENTRY* find_entry(MQTT_PERSIST* persist, uint16_t packetId)
+{
+    PERSIST_ENTRY* result = NULL;
+    size_t pos = VECTOR_size(persist->entries);
+    while (pos > 0)
+    {
+        PERSIST_ENTRY* entry = (PERSIST_ENTRY*)VECTOR_element(persist->entries, --pos);
+        if (entry->packetId == packetId)
+        {
+            result = entry;
+            break;
+        }
+    }
+    return result;
+}
+
+static void delete_segment(MQTT_PERSIST* persist, size_t position)
+{
+    PERSIST_SEGMENT* segment = (PERSIST_SEGMENT*)VECTOR_element(persist->segments, position);
+    STRING_HANDLE path = construct_segment_path(persist, segment->index);
+    unmap_segment(segment);
+    if (path == NULL || remove(STRING_c_str(path)) != 0)
+    {
+        LogError("Failure removing segment %lu", (unsigned long)segment->index);
+    }
+    STRING_delete(path);
+    VECTOR_erase(persist->segments, segment, 1);
+
+    segment = (PERSIST_SEGMENT*)VECTOR_front(persist->segments);
+    persist->firstSegmentIndex = (segment != NULL) ? segment->index : persist->nextSegmentIndex;
+    write_manifest(persist);
+}
+
+static PERSIST_SEGMENT* create_segment(MQTT_PERSIST* persist, size_t minimumSize)
+{
+    PERSIST_SEGMENT* result;
+    PERSIST_SEGMENT segment;
+    STRING_HANDLE path;
+    size_t size = (minimumSize > persist->segmentSize) ? PAD_TO_32BIT(minimumSize) : persist->segmentSize;
+
+    memset(&segment, 0, sizeof(segment));
+    segment.index = persist->nextSegmentIndex;
+    if ((path = construct_segment_path(persist, segment.index)) == NULL)
+    {
+        LogError("Failure constructing segment path");
+        result = NULL;
+    }
+    else
+    {
+        if (map_segment(&segment, STRING_c_str(path), size, true) != 0)
+        {
+            LogError("Failure mapping segment %s", STRING_c_str(path));
+            result = NULL;
+        }
+        else
+        {
+            write_uint32(segment.base, SEGMENT_MAGIC);
+            write_uint32(segment.base + 4, SEGMENT_VERSION);
+            segment.used = SEGMENT_HEADER_SIZE;
+
+            if (VECTOR_push_back(persist->segments, &segment, 1) != 0)
+            {
+                LogError("Failure adding segment");
+                unmap_segment(&segment);
+                (void)remove(STRING_c_str(path));
+                result = NULL;
+            }
+            else
+            {
+                persist->nextSegmentIndex++;
+                write_manifest(persist);
+                result = (PERSIST_SEGMENT*)VECTOR_back(persist->segments);
+            }
+        }
+        STRING_delete(path);
+    }
+    return result;
+}
+
+static int write_record(MQTT_PERSIST* persist, uint32_t sequence, uint16_t packetId, uint8_t state, const uint8_t* packet, size_t length, PERSIST_ENTRY* entry)
+{
+    int result;
+    size_t recordSize = PAD_TO_32BIT(RECORD_HEADER_SIZE + length);
+    PERSIST_SEGMENT* segment = (PERSIST_SEGMENT*)VECTOR_back(persist->segments);
+
+    /*Codes_SRS_MQTT_PERSIST_07_012: [mqtt_persist_append shall write the record to the active segment, creating a new segment when the record does not fit, and write the record length last so a partially written record is never recovered.]*/
+    // Keep room for the terminating zero length after the record
+    if (segment == NULL || segment->used + recordSize + sizeof(uint32_t) > segment->size)
+    {
+        segment = create_segment(persist, SEGMENT_HEADER_SIZE + recordSize + sizeof(uint32_t));
+    }
+
+    if (segment == NULL)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        uint8_t* record = segment->base + segment->used;
+        write_uint32(record + recordSize + RECORD_LENGTH_OFFSET, 0);
+        write_uint32(record + RECORD_SEQUENCE_OFFSET, sequence);
+        write_uint16(record + RECORD_PACKET_ID_OFFSET, packetId);
+        record[RECORD_STATE_OFFSET] = state;
+        record[RECORD_STATE_OFFSET + 1] = 0;
+        (void)memcpy(record + RECORD_HEADER_SIZE, packet, length);
+        write_uint32(record + RECORD_LENGTH_OFFSET, (uint32_t)length);
+
+        entry->sequence = sequence;
+        entry->packetId = packetId;
+        entry->segmentIndex = segment->index;
+        entry->offset = segment->used;
+
+        segment->used += recordSize;
+        segment->liveCount++;
+        segment->liveBytes += recordSize;
+
+        /*Codes_SRS_MQTT_PERSIST_07_013: [If syncOnAppend is set then mqtt_persist_append shall flush the segment before it returns.]*/
+        if (persist->syncOnAppend && sync_segment(segment) != 0)
+        {
+            LogError("Failure syncing segment %lu", (unsigned long)segment->index);
+            result = __FAILURE__;
+        }
+        else
+        {
+            result = 0;
+        }
+    }
+    return result;
+}
+
+static void release_record(MQTT_PERSIST* persist, const PERSIST_ENTRY* entry)
+{
+    size_t position;
+    PERSIST_SEGMENT* segment = find_segment(persist, entry->segmentIndex, &position);
+    if (segment != NULL)
+    {
+        uint8_t* record = segment->base + entry->offset;
+        record[RECORD_STATE_OFFSET] = RECORD_STATE_REMOVED;
+        segment->liveCount--;
+        segment->liveBytes -= PAD_TO_32BIT(RECORD_HEADER_SIZE + read_uint32(record + RECORD_LENGTH_OFFSET));
+
+        if (segment->liveCount == 0)
+        {
+            if (position + 1 < VECTOR_size(persist->segments))
+            {
+                /*Codes_SRS_MQTT_PERSIST_07_019: [When a sealed segment is left without live records mqtt_persist_remove shall delete its file and update the manifest.]*/
+                delete_segment(persist, position);
+            }
+            else
+            {
+                // The active segment is rewound instead of being deleted
+                write_uint32(segment->base + SEGMENT_HEADER_SIZE, 0);
+                segment->used = SEGMENT_HEADER_SIZE;
+            }
+        }
+    }
+}
+
+static int compare_entries(const void* left, const void* right)
+{
+    int32_t diff = (int32_t)(((const PERSIST_ENTRY*)left)->sequence - ((const PERSIST_ENTRY*)right)->sequence);
+    return (diff < 0) ? -1 : ((diff > 0) ? 1 : 0);
+}
+
+static int recover_segment(MQTT_PERSIST* persist, size_t index)
+{
+    int result;
+    PERSIST_SEGMENT segment;
+    STRING_HANDLE path = construct_segment_path(persist, index);
+
+    memset(&segment, 0, sizeof(segment));
+    segment.index = index;
+    if (path == NULL)
+    {
+        result = __FAILURE__;
+    }
+    else if (map_segment(&segment, STRING_c_str(path), 0, false) != 0)
+    {
+        /*Codes_SRS_MQTT_PERSIST_07_005: [Missing segments and segments with an invalid header shall be ignored.]*/
+        // Segments deleted by compaction leave holes in the index range
+        STRING_delete(path);
+        result = 0;
+    }
+    else if (read_uint32(segment.base) != SEGMENT_MAGIC || read_uint32(segment.base + 4) != SEGMENT_VERSION)
+    {
+        /*Codes_SRS_MQTT_PERSIST_07_005: [Missing segments and segments with an invalid header shall be ignored.]*/
+        LogError("Ignoring segment %s with an invalid header", STRING_c_str(path));
+        unmap_segment(&segment);
+        STRING_delete(path);
+        result = 0;
+    }
+    else
+    {
+        result = 0;
+        segment.used = SEGMENT_HEADER_SIZE;
+        while (segment.used + RECORD_HEADER_SIZE <= segment.size)
+        {
+            uint8_t* record = segment.base + segment.used;
+            size_t length = read_uint32(record + RECORD_LENGTH_OFFSET);
+            size_t recordSize = PAD_TO_32BIT(RECORD_HEADER_SIZE + length);
+            if (length == 0 || recordSize > segment.size - segment.used)
+            {
+                break;
+            }
+
+            if (record[RECORD_STATE_OFFSET] != RECORD_STATE_REMOVED)
+            {
+                PERSIST_ENTRY entry;
+                entry.sequence = read_uint32(record + RECORD_SEQUENCE_OFFSET);
+                entry.packetId = read_uint16(record + RECORD_PACKET_ID_OFFSET);
+                entry.segmentIndex = index;
+                entry.offset = segment.used;
+                if (VECTOR_push_back(persist->entries, &entry, 1) != 0)
+                {
+                    result = __FAILURE__;
+                    break;
+                }
+                if ((int32_t)(entry.sequence - persist->nextSequence) >= 0)
+                {
+                    persist->nextSequence = entry.sequence + 1;
+                }
+                segment.liveCount++;
+                segment.liveBytes += recordSize;
+            }
+            segment.used += recordSize;
+        }
+
+        if (result != 0 || VECTOR_push_back(persist->segments, &segment, 1) != 0)
+        {
+            LogError("Failure recovering segment %s", STRING_c_str(path));
+            unmap_segment(&segment);
+            result = __FAILURE__;
+        }
+        STRING_delete(path);
+    }
+    return result;
+}
+
+static void destroy_persist(MQTT_PERSIST* persist)
+{
+    if (persist->segments != NULL)
+    {
+        size_t count = VECTOR_size(persist->segments);
+        size_t pos;
+        for (pos = 0; pos < count; pos++)
+        {
+            unmap_segment((PERSIST_SEGMENT*)VECTOR_element(persist->segments, pos));
+        }
+        VECTOR_destroy(persist->segments);
+    }
+    if (persist->entries != NULL)
+    {
+        VECTOR_destroy(persist->entries);
+    }
+    free(persist->filePrefix);
+    free(persist);
+}
+
+MQTT_PERSIST_HANDLE mqtt_persist_open(const MQTT_PERSIST_OPTIONS* options)
+{
+    MQTT_PERSIST* result;
+    if (options == NULL || options->filePrefix == NULL)
+    {
+        /*Codes_SRS_MQTT_PERSIST_07_001: [If options or options->filePrefix is NULL then mqtt_persist_open shall return NULL.]*/
+        LogError("Invalid parameter specified options: %p", options);
+        result = NULL;
+    }
+    else if ((result = (MQTT_PERSIST*)malloc(sizeof(MQTT_PERSIST))) == NULL)
+    {
+        /*Codes_SRS_MQTT_PERSIST_07_003: [If any allocation fails then mqtt_persist_open shall free everything it allocated and return NULL.]*/
+        LogError("Failure allocating persist handle");
+    }
+    else
+    {
+        memset(result, 0, sizeof(MQTT_PERSIST));
+        /*Codes_SRS_MQTT_PERSIST_07_002: [A segmentSize of 0 shall select 1 MB, any other segmentSize shall be padded to a multiple of 4 bytes.]*/
+        result->segmentSize = (options->segmentSize == 0) ? DEFAULT_SEGMENT_SIZE : PAD_TO_32BIT(options->segmentSize);
+        result->syncOnAppend = options->syncOnAppend;
+
+        if (mallocAndStrcpy_s(&result->filePrefix, options->filePrefix) != 0 ||
+            (result->segments = VECTOR_create(sizeof(PERSIST_SEGMENT))) == NULL ||
+            (result->entries = VECTOR_create(sizeof(PERSIST_ENTRY))) == NULL)
+        {
+            /*Codes_SRS_MQTT_PERSIST_07_003: [If any allocation fails then mqtt_persist_open shall free everything it allocated and return NULL.]*/
+            LogError("Failure allocating persist resources");
+            destroy_persist(result);
+            result = NULL;
+        }
+        else
+        {
+            size_t index;
+            /*Codes_SRS_MQTT_PERSIST_07_004: [mqtt_persist_open shall read the segment range from <filePrefix>.manifest and recover the records of every segment <filePrefix>_<index>.seg in that range.]*/
+            read_manifest(result);
+            for (index = result->firstSegmentIndex; index < result->nextSegmentIndex; index++)
+            {
+                if (recover_segment(result, index) != 0)
+                {
+                    break;
+                }
+            }
+
+            if (index < result->nextSegmentIndex)
+            {
+                /*Codes_SRS_MQTT_PERSIST_07_006: [If a segment cannot be recovered then mqtt_persist_open shall free everything it allocated and return NULL.]*/
+                destroy_persist(result);
+                result = NULL;
+            }
+            else
+            {
+                size_t entryCount = VECTOR_size(result->entries);
+                if (entryCount > 1)
+                {
+                    /*Codes_SRS_MQTT_PERSIST_07_007: [mqtt_persist_open shall order the recovered records by the sequence they were appended in.]*/
+                    qsort(VECTOR_front(result->entries), entryCount, sizeof(PERSIST_ENTRY), compare_entries);
+                }
+            }
+        }
+    }
+    return result;
+}
+
+void mqtt_persist_close(MQTT_PERSIST_HANDLE handle)
+{
+    /*Codes_SRS_MQTT_PERSIST_07_008: [If handle is NULL then mqtt_persist_close shall do nothing.]*/
+    if (handle != NULL)
+    {
+        size_t count = VECTOR_size(handle->segments);
+        size_t pos;
+        for (pos = 0; pos < count; pos++)
+        {
+            /*Codes_SRS_MQTT_PERSIST_07_009: [mqtt_persist_close shall flush every segment to its file and free all resources.]*/
+            (void)sync_segment((PERSIST_SEGMENT*)VECTOR_element(handle->segments, pos));
+        }
+        destroy_persist(handle);
+    }
+}
+
+int mqtt_persist_append(MQTT_PERSIST_HANDLE handle, uint16_t packetId, const uint8_t* packet, size_t length)
+{
+    int result;
+    if (handle == NULL || packet == NULL || length == 0 || length > UINT32_MAX - RECORD_HEADER_SIZE)
+    {
+        /*Codes_SRS_MQTT_PERSIST_07_010: [If handle or packet is NULL, or length is 0 or does not fit a record, then mqtt_persist_append shall return a non-zero value.]*/
+        LogError("Invalid parameter specified handle: %p, packet: %p, length: %lu", handle, packet, (unsigned long)length);
+        result = __FAILURE__;
+    }
+    else if (find_entry(handle, packetId) != NULL)
+    {
+        // Records are found by packet id, two live records with one id would be ambiguous
+        /*Codes_SRS_MQTT_PERSIST_07_011: [If a packet with the same packetId is still stored then mqtt_persist_append shall return a non-zero value.]*/
+        LogError("Packet %u is already stored", (unsigned int)packetId);
+        result = __FAILURE__;
+    }
+    else
+    {
+        PERSIST_ENTRY entry;
+        if (write_record(handle, handle->nextSequence, packetId, RECORD_STATE_PUBLISH, packet, length, &entry) != 0)
+        {
+            /*Codes_SRS_MQTT_PERSIST_07_014: [If writing or tracking the record fails then mqtt_persist_append shall return a non-zero value, otherwise it shall return 0.]*/
+            LogError("Failure writing record for packet %u", (unsigned int)packetId);
+            result = __FAILURE__;
+        }
+        else if (VECTOR_push_back(handle->entries, &entry, 1) != 0)
+        {
+            LogError("Failure adding record for packet %u", (unsigned int)packetId);
+            release_record(handle, &entry);
+            result = __FAILURE__;
+        }
+        else
+        {
+            handle->nextSequence++;
+            result = 0;
+        }
+    }
+    return result;
+}
+
+int mqtt_persist_mark_released(MQTT_PERSIST_HANDLE handle, uint16_t packetId)
+{
+    int result;
+    PERSIST_ENTRY* entry;
+    PERSIST_SEGMENT* segment;
+    if (handle == NULL)
+    {
+        /*Codes_SRS_MQTT_PERSIST_07_015: [If handle is NULL or no packet with packetId is stored then mqtt_persist_mark_released shall return a non-zero value.]*/
+        LogError("Invalid parameter specified handle: %p", handle);
+        result = __FAILURE__;
+    }
+    else if ((entry = find_entry(handle, packetId)) == NULL ||
+        (segment = find_segment(handle, entry->segmentIndex, NULL)) == NULL)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_PERSIST_07_016: [mqtt_persist_mark_released shall mark the record as released in place and return 0.]*/
+        segment->base[entry->offset + RECORD_STATE_OFFSET] = RECORD_STATE_RELEASED;
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_persist_remove(MQTT_PERSIST_HANDLE handle, uint16_t packetId)
+{
+    int result;
+    PERSIST_ENTRY* entry;
+    if (handle == NULL)
+    {
+        /*Codes_SRS_MQTT_PERSIST_07_017: [If handle is NULL or no packet with packetId is stored then mqtt_persist_remove shall return a non-zero value.]*/
+        LogError("Invalid parameter specified handle: %p", handle);
+        result = __FAILURE__;
+    }
+    else if ((entry = find_entry(handle, packetId)) == NULL)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_PERSIST_07_018: [mqtt_persist_remove shall mark the record as removed and return 0.]*/
+        release_record(handle, entry);
+        VECTOR_erase(handle->entries, entry, 1);
+        result = 0;
+    }
+    return result;
+}
+
+int mqtt_persist_compact(MQTT_PERSIST_HANDLE handle)
+{
+    int result;
+    if (handle == NULL)
+    {
+        /*Codes_SRS_MQTT_PERSIST_07_020: [If handle is NULL then mqtt_persist_compact shall return a non-zero value.]*/
+        LogError("Invalid parameter specified handle: %p", handle);
+        result = __FAILURE__;
+    }
+    else
+    {
+        size_t entryCount = VECTOR_size(handle->entries);
+        size_t activeIndex = handle->nextSegmentIndex - 1;
+        size_t pos;
+
+        result = 0;
+        /*Codes_SRS_MQTT_PERSIST_07_021: [mqtt_persist_compact shall move the live records of every sealed segment that is less than half live to the active segment, keeping their order.]*/
+        // Relocate the live records of every sealed segment that is less than half live
+        for (pos = 0; pos < entryCount; pos++)
+        {
+            PERSIST_ENTRY* entry = (PERSIST_ENTRY*)VECTOR_element(handle->entries, pos);
+            PERSIST_SEGMENT* segment = find_segment(handle, entry->segmentIndex, NULL);
+            if (segment != NULL && segment->index < activeIndex && segment->liveBytes * 2 < segment->used - SEGMENT_HEADER_SIZE)
+            {
+                PERSIST_ENTRY moved;
+                uint8_t* record = segment->base + entry->offset;
+                if (write_record(handle, entry->sequence, entry->packetId, record[RECORD_STATE_OFFSET], record + RECORD_HEADER_SIZE, read_uint32(record + RECORD_LENGTH_OFFSET), &moved) != 0)
+                {
+                    /*Codes_SRS_MQTT_PERSIST_07_022: [If a record cannot be moved then mqtt_persist_compact shall return a non-zero value.]*/
+                    LogError("Failure relocating packet %u", (unsigned int)entry->packetId);
+                    result = __FAILURE__;
+                    break;
+                }
+                else
+                {
+                    // Tombstone without deleting so the source segment is removed below
+                    segment = find_segment(handle, entry->segmentIndex, NULL);
+                    segment->base[entry->offset + RECORD_STATE_OFFSET] = RECORD_STATE_REMOVED;
+                    segment->liveCount--;
+                    segment->liveBytes -= PAD_TO_32BIT(RECORD_HEADER_SIZE + read_uint32(segment->base + entry->offset + RECORD_LENGTH_OFFSET));
+                    *entry = moved;
+                }
+            }
+        }
+
+        /*Codes_SRS_MQTT_PERSIST_07_023: [mqtt_persist_compact shall delete every sealed segment left without live records.]*/
+        // Drop the sealed segments left without live records
+        pos = 0;
+        while (pos + 1 < VECTOR_size(handle->segments))
+        {
+            PERSIST_SEGMENT* segment = (PERSIST_SEGMENT*)VECTOR_element(handle->segments, pos);
+            if (segment->liveCount == 0)
+            {
+                delete_segment(handle, pos);
+            }
+            else
+            {
+                pos++;
+            }
+        }
+    }
+    return result;
+}
+
+int mqtt_persist_foreach(MQTT_PERSIST_HANDLE handle, ON_PERSISTED_PACKET callback, void* context)
+{
+    int result;
+    if (handle == NULL || callback == NULL)
+    {
+        /*Codes_SRS_MQTT_PERSIST_07_024: [If handle or callback is NULL then mqtt_persist_foreach shall return a non-zero value.]*/
+        LogError("Invalid parameter specified handle: %p, callback: %p", handle, callback);
+        result = __FAILURE__;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_PERSIST_07_025: [mqtt_persist_foreach shall call callback for every stored packet in the order the packets were appended, with the released flag and the writable packet bytes, and return 0.]*/
+        size_t entryCount = VECTOR_size(handle->entries);
+        size_t pos;
+        for (pos = 0; pos < entryCount; pos++)
+        {
+            PERSIST_ENTRY* entry = (PERSIST_ENTRY*)VECTOR_element(handle->entries, pos);
+            PERSIST_SEGMENT* segment = find_segment(handle, entry->segmentIndex, NULL);
+            if (segment != NULL)
+            {
+                uint8_t* record = segment->base + entry->offset;
+                callback(context, entry->packetId, record[RECORD_STATE_OFFSET] == RECORD_STATE_RELEASED, record + RECORD_HEADER_SIZE, read_uint32(record + RECORD_LENGTH_OFFSET));
+            }
+        }
+        result = 0;
+    }
+    return result;
+}
+
+size_t mqtt_persist_get_count(MQTT_PERSIST_HANDLE handle)
+{
+    size_t result;
+    if (handle == NULL)
+    {
+        /*Codes_SRS_MQTT_PERSIST_07_026: [If handle is NULL then mqtt_persist_get_count shall return 0.]*/
+        LogError("Invalid parameter specified handle: %p", handle);
+        result = 0;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_PERSIST_07_027: [mqtt_persist_get_count shall return the number of stored packets.]*/
+        result = VECTOR_size(handle->entries);
+    }
+    return result;
+}
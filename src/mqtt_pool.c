@@ -0,0 +1,606 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stdlib.h>
+#include <string.h>
+#include "azure_c_shared_utility/optimize_size.h"
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/strings.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/vector.h"
+#include "azure_c_shared_utility/xlogging.h"
+#include "azure_umqtt_c/mqtt_pool.h"
+#include "mqtt_topic_hash.h"
+
+#define DEFAULT_DOWORK_INTERVAL_MS      10
+
+typedef struct POOL_SHARD_TAG
+{
+    struct MQTT_POOL_TAG* pool;
+    size_t shardIndex;
+    LOCK_HANDLE lock;
+    THREAD_HANDLE thread;
+    bool threadStarted;
+
+    // Guarded by lock: the client is not thread safe, the shard thread and the publishers take turns
+    MQTT_CLIENT_HANDLE mqttClient;
+    XIO_HANDLE xioHandle;
+    bool isConnecting;
+    bool isConnected;
+    bool stopShard;
+    uint16_t nextPacketId;
+    size_t publishCount;
+    size_t publishFailureCount;
+    size_t publishAckCount;
+    bool errorPending;
+    MQTT_CLIENT_EVENT_ERROR pendingError;
+    // Copies of the messages received during a dowork, swapped with deliveredMessages to be passed out of the lock
+    VECTOR_HANDLE pendingMessages;
+
+    // Only used by the shard thread
+    VECTOR_HANDLE deliveredMessages;
+} POOL_SHARD;
+
+typedef struct MQTT_POOL_TAG
+{
+    size_t shardCount;
+    unsigned int doworkIntervalMs;
+    MQTT_POOL_CREATE_XIO createXio;
+    void* xioCtx;
+    ON_MQTT_MESSAGE_RECV_CALLBACK fnMessageRecv;
+    void* msgRecvCtx;
+    ON_MQTT_POOL_ERROR_CALLBACK fnOnError;
+    void* errorCtx;
+    POOL_SHARD* shards;
+
+    LOCK_HANDLE statsLock;
+    size_t errorCount;
+    MQTT_CLIENT_EVENT_ERROR lastError;
+} MQTT_POOL;
+
+static void destroy_messages(VECTOR_HANDLE messages)
+{
+    size_t index;
+    for (index = 0; index < VECTOR_size(messages); index++)
+    {
+        mqttmessage_destroy(*(MQTT_MESSAGE_HANDLE*)VECTOR_element(messages, index));
+    }
+    VECTOR_clear(messages);
+}
+
+// Called from within the shard client, so with the shard lock held
+static void on_shard_message_recv(MQTT_MESSAGE_HANDLE msgHandle, void* callbackCtx)
+{
+    // The client passes the operation context, which is the shard
+    POOL_SHARD* shard = (POOL_SHARD*)callbackCtx;
+    if (shard->pool->fnMessageRecv != NULL)
+    {
+        /*Codes_SRS_MQTT_POOL_07_006: [Messages received by a shard shall be copied and passed to msgRecv once the shard lock is released.]*/
+        // Delivered once the shard lock is released so the callback can call into the pool
+        MQTT_MESSAGE_HANDLE msgCopy = mqttmessage_clone(msgHandle);
+        if (msgCopy == NULL)
+        {
+            LogError("Failure copying message received on shard %lu", (unsigned long)shard->shardIndex);
+        }
+        else if (VECTOR_push_back(shard->pendingMessages, &msgCopy, 1) != 0)
+        {
+            LogError("Failure queuing message received on shard %lu", (unsigned long)shard->shardIndex);
+            mqttmessage_destroy(msgCopy);
+        }
+    }
+}
+
+// Called from within the shard client, so with the shard lock held
+static void on_shard_operation(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo, void* callbackCtx)
+{
+    POOL_SHARD* shard = (POOL_SHARD*)callbackCtx;
+    (void)handle;
+    switch (actionResult)
+    {
+        /*Codes_SRS_MQTT_POOL_07_008: [A CONNACK that accepts the connection shall mark the shard connected, a PUBACK or PUBCOMP shall be counted as acknowledged and a disconnect shall mark the shard neither connecting nor connected.]*/
+        case MQTT_CLIENT_ON_CONNACK:
+        {
+            const CONNECT_ACK* connack = (const CONNECT_ACK*)msgInfo;
+            shard->isConnected = (connack != NULL && connack->returnCode == CONNECTION_ACCEPTED);
+            break;
+        }
+        case MQTT_CLIENT_ON_PUBLISH_ACK:
+        case MQTT_CLIENT_ON_PUBLISH_COMP:
+            shard->publishAckCount++;
+            break;
+        case MQTT_CLIENT_ON_DISCONNECT:
+            shard->isConnecting = false;
+            shard->isConnected = false;
+            break;
+        default:
+            break;
+    }
+}
+
+static void on_shard_error(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR error, void* callbackCtx)
+{
+    POOL_SHARD* shard = (POOL_SHARD*)callbackCtx;
+    MQTT_POOL* pool = shard->pool;
+    (void)handle;
+    /*Codes_SRS_MQTT_POOL_07_007: [On an error of its client the shard shall no longer be connecting, count the error and call onError with the shard index once the shard lock is released.]*/
+    // The connection is gone, mqtt_pool_connect may start it again
+    shard->isConnecting = false;
+    shard->isConnected = false;
+    // Reported once the shard lock is released so the callback can publish again
+    shard->errorPending = true;
+    shard->pendingError = error;
+    if (Lock(pool->statsLock) == LOCK_OK)
+    {
+        pool->errorCount++;
+        pool->lastError = error;
+        (void)Unlock(pool->statsLock);
+    }
+}
+
+static int pool_shard_thread(void* context)
+{
+    POOL_SHARD* shard = (POOL_SHARD*)context;
+    MQTT_POOL* pool = shard->pool;
+    bool running = true;
+    while (running)
+    {
+        bool errorPending = false;
+        MQTT_CLIENT_EVENT_ERROR error = MQTT_CLIENT_UNKNOWN_ERROR;
+        if (Lock(shard->lock) != LOCK_OK)
+        {
+            LogError("Failure acquiring shard lock");
+            running = false;
+        }
+        else
+        {
+            if (shard->stopShard)
+            {
+                running = false;
+            }
+            else
+            {
+                VECTOR_HANDLE received;
+                /*Codes_SRS_MQTT_POOL_07_005: [Each shard thread shall call mqtt_client_dowork under the shard lock every doworkIntervalMs until the pool is destroyed.]*/
+                mqtt_client_dowork(shard->mqttClient);
+                errorPending = shard->errorPending;
+                error = shard->pendingError;
+                shard->errorPending = false;
+                // deliveredMessages is empty, the next dowork queues into it
+                received = shard->pendingMessages;
+                shard->pendingMessages = shard->deliveredMessages;
+                shard->deliveredMessages = received;
+            }
+            (void)Unlock(shard->lock);
+        }
+
+        if (running)
+        {
+            size_t index;
+            for (index = 0; index < VECTOR_size(shard->deliveredMessages); index++)
+            {
+                /*Codes_SRS_MQTT_POOL_07_006: [Messages received by a shard shall be copied and passed to msgRecv once the shard lock is released.]*/
+                pool->fnMessageRecv(*(MQTT_MESSAGE_HANDLE*)VECTOR_element(shard->deliveredMessages, index), pool->msgRecvCtx);
+            }
+            destroy_messages(shard->deliveredMessages);
+        }
+        if (errorPending && pool->fnOnError != NULL)
+        {
+            /*Codes_SRS_MQTT_POOL_07_007: [On an error of its client the shard shall no longer be connecting, count the error and call onError with the shard index once the shard lock is released.]*/
+            pool->fnOnError(pool, shard->shardIndex, error, pool->errorCtx);
+        }
+        if (running)
+        {
+            ThreadAPI_Sleep(pool->doworkIntervalMs);
+        }
+    }
+    return 0;
+}
+
+static void stop_pool_shards(MQTT_POOL* pool)
+{
+    size_t index;
+    for (index = 0; index < pool->shardCount; index++)
+    {
+        POOL_SHARD* shard = &pool->shards[index];
+        if (shard->threadStarted && Lock(shard->lock) == LOCK_OK)
+        {
+            shard->stopShard = true;
+            (void)Unlock(shard->lock);
+        }
+    }
+    for (index = 0; index < pool->shardCount; index++)
+    {
+        POOL_SHARD* shard = &pool->shards[index];
+        if (shard->threadStarted)
+        {
+            int threadResult;
+            (void)ThreadAPI_Join(shard->thread, &threadResult);
+            shard->threadStarted = false;
+        }
+    }
+}
+
+static void destroy_pool_resources(MQTT_POOL* pool)
+{
+    if (pool->shards != NULL)
+    {
+        size_t index;
+        for (index = 0; index < pool->shardCount; index++)
+        {
+            POOL_SHARD* shard = &pool->shards[index];
+            if (shard->mqttClient != NULL)
+            {
+                mqtt_client_deinit(shard->mqttClient);
+            }
+            // The client does not own its xio, destroying it also closes a connection left open
+            if (shard->xioHandle != NULL)
+            {
+                xio_destroy(shard->xioHandle);
+            }
+            if (shard->pendingMessages != NULL)
+            {
+                destroy_messages(shard->pendingMessages);
+                VECTOR_destroy(shard->pendingMessages);
+            }
+            if (shard->deliveredMessages != NULL)
+            {
+                VECTOR_destroy(shard->deliveredMessages);
+            }
+            if (shard->lock != NULL)
+            {
+                (void)Lock_Deinit(shard->lock);
+            }
+        }
+        free(pool->shards);
+    }
+    if (pool->statsLock != NULL)
+    {
+        (void)Lock_Deinit(pool->statsLock);
+    }
+    free(pool);
+}
+
+static int create_pool_shard(MQTT_POOL* pool, POOL_SHARD* shard, size_t shardIndex)
+{
+    int result;
+    shard->pool = pool;
+    shard->shardIndex = shardIndex;
+    shard->nextPacketId = 1;
+    /*Codes_SRS_MQTT_POOL_07_003: [mqtt_pool_create shall create shardCount shards, each with a lock, a client created with mqtt_client_init and a thread.]*/
+    if ((shard->lock = Lock_Init()) == NULL)
+    {
+        LogError("Failure creating shard lock");
+        result = __FAILURE__;
+    }
+    else if ((shard->pendingMessages = VECTOR_create(sizeof(MQTT_MESSAGE_HANDLE))) == NULL ||
+        (shard->deliveredMessages = VECTOR_create(sizeof(MQTT_MESSAGE_HANDLE))) == NULL)
+    {
+        LogError("Failure creating message queues of shard %lu", (unsigned long)shardIndex);
+        result = __FAILURE__;
+    }
+    else if ((shard->mqttClient = mqtt_client_init(on_shard_message_recv, on_shard_operation, shard, on_shard_error, shard)) == NULL)
+    {
+        LogError("Failure creating client of shard %lu", (unsigned long)shardIndex);
+        result = __FAILURE__;
+    }
+    else if (ThreadAPI_Create(&shard->thread, pool_shard_thread, shard) != THREADAPI_OK)
+    {
+        LogError("Failure creating thread of shard %lu", (unsigned long)shardIndex);
+        result = __FAILURE__;
+    }
+    else
+    {
+        shard->threadStarted = true;
+        result = 0;
+    }
+    return result;
+}
+
+MQTT_POOL_HANDLE mqtt_pool_create(const MQTT_POOL_OPTIONS* options, MQTT_POOL_CREATE_XIO createXio, void* xioCtx, ON_MQTT_MESSAGE_RECV_CALLBACK msgRecv, void* msgRecvCtx, ON_MQTT_POOL_ERROR_CALLBACK onError, void* errorCtx)
+{
+    MQTT_POOL* result;
+    if (options == NULL || options->shardCount == 0 || createXio == NULL)
+    {
+        /*Codes_SRS_MQTT_POOL_07_001: [If options or createXio is NULL, or options->shardCount is 0, then mqtt_pool_create shall return NULL.]*/
+        LogError("Invalid parameter specified options: %p, createXio: %p", options, createXio);
+        result = NULL;
+    }
+    else if ((result = (MQTT_POOL*)malloc(sizeof(MQTT_POOL))) == NULL)
+    {
+        LogError("Failure allocating pool instance");
+    }
+    else
+    {
+        memset(result, 0, sizeof(MQTT_POOL));
+        result->shardCount = options->shardCount;
+        /*Codes_SRS_MQTT_POOL_07_002: [A doworkIntervalMs of 0 shall select 10 milliseconds.]*/
+        result->doworkIntervalMs = (options->doworkIntervalMs == 0) ? DEFAULT_DOWORK_INTERVAL_MS : options->doworkIntervalMs;
+        result->createXio = createXio;
+        result->xioCtx = xioCtx;
+        result->fnMessageRecv = msgRecv;
+        result->msgRecvCtx = msgRecvCtx;
+        result->fnOnError = onError;
+        result->errorCtx = errorCtx;
+
+        if ((result->statsLock = Lock_Init()) == NULL)
+        {
+            /*Codes_SRS_MQTT_POOL_07_004: [If any allocation or the creation of a lock, a client or a thread fails then mqtt_pool_create shall stop the started shards, free everything it allocated and return NULL.]*/
+            LogError("Failure creating pool lock");
+            destroy_pool_resources(result);
+            result = NULL;
+        }
+        else if ((result->shards = (POOL_SHARD*)malloc(result->shardCount * sizeof(POOL_SHARD))) == NULL)
+        {
+            LogError("Failure allocating %lu shards", (unsigned long)result->shardCount);
+            destroy_pool_resources(result);
+            result = NULL;
+        }
+        else
+        {
+            size_t index;
+            memset(result->shards, 0, result->shardCount * sizeof(POOL_SHARD));
+            for (index = 0; index < result->shardCount; index++)
+            {
+                if (create_pool_shard(result, &result->shards[index], index) != 0)
+                {
+                    break;
+                }
+            }
+            if (index < result->shardCount)
+            {
+                /*Codes_SRS_MQTT_POOL_07_004: [If any allocation or the creation of a lock, a client or a thread fails then mqtt_pool_create shall stop the started shards, free everything it allocated and return NULL.]*/
+                stop_pool_shards(result);
+                destroy_pool_resources(result);
+                result = NULL;
+            }
+        }
+    }
+    return result;
+}
+
+void mqtt_pool_destroy(MQTT_POOL_HANDLE handle)
+{
+    /*Codes_SRS_MQTT_POOL_07_009: [If handle is NULL then mqtt_pool_destroy shall do nothing.]*/
+    if (handle != NULL)
+    {
+        /*Codes_SRS_MQTT_POOL_07_010: [mqtt_pool_destroy shall stop and join the shard threads, then deinitialize every client, destroy its xio and free all resources.]*/
+        stop_pool_shards(handle);
+        destroy_pool_resources(handle);
+    }
+}
+
+int mqtt_pool_connect(MQTT_POOL_HANDLE handle, const MQTT_CLIENT_OPTIONS* mqttOptions)
+{
+    int result;
+    if (handle == NULL || mqttOptions == NULL || mqttOptions->clientId == NULL)
+    {
+        /*Codes_SRS_MQTT_POOL_07_011: [If handle, mqttOptions or mqttOptions->clientId is NULL then mqtt_pool_connect shall return a non-zero value.]*/
+        LogError("Invalid parameter specified handle: %p, mqttOptions: %p", handle, mqttOptions);
+        result = __FAILURE__;
+    }
+    else
+    {
+        size_t index;
+        result = 0;
+        for (index = 0; index < handle->shardCount; index++)
+        {
+            POOL_SHARD* shard = &handle->shards[index];
+            STRING_HANDLE clientId;
+            /*Codes_SRS_MQTT_POOL_07_012: [mqtt_pool_connect shall skip the shards that are already connecting.]*/
+            if (shard->isConnecting)
+            {
+                // Already connecting from a previous call
+            }
+            else if ((clientId = STRING_construct_sprintf("%s-%lu", mqttOptions->clientId, (unsigned long)index)) == NULL)
+            {
+                LogError("Failure constructing client id of shard %lu", (unsigned long)index);
+                result = __FAILURE__;
+            }
+            else
+            {
+                /*Codes_SRS_MQTT_POOL_07_013: [mqtt_pool_connect shall connect every other shard with a copy of mqttOptions whose clientId is suffixed with -<shardIndex>, creating the xio of the shard with createXio unless it already has one.]*/
+                MQTT_CLIENT_OPTIONS shardOptions = *mqttOptions;
+                shardOptions.clientId = (char*)STRING_c_str(clientId);
+                if (Lock(shard->lock) != LOCK_OK)
+                {
+                    LogError("Failure acquiring shard lock");
+                    result = __FAILURE__;
+                }
+                else
+                {
+                    // The xio of a disconnected shard is reused, the client reopens it
+                    if (shard->xioHandle == NULL && (shard->xioHandle = handle->createXio(index, handle->xioCtx)) == NULL)
+                    {
+                        LogError("Failure creating xio of shard %lu", (unsigned long)index);
+                        result = __FAILURE__;
+                    }
+                    else if (mqtt_client_connect(shard->mqttClient, shard->xioHandle, &shardOptions) != 0)
+                    {
+                        /*Codes_SRS_MQTT_POOL_07_014: [If a shard cannot be connected then mqtt_pool_connect shall carry on with the other shards and return a non-zero value, otherwise it shall return 0.]*/
+                        LogError("Failure connecting shard %lu", (unsigned long)index);
+                        result = __FAILURE__;
+                    }
+                    else
+                    {
+                        shard->isConnecting = true;
+                    }
+                    (void)Unlock(shard->lock);
+                }
+                STRING_delete(clientId);
+            }
+        }
+    }
+    return result;
+}
+
+int mqtt_pool_disconnect(MQTT_POOL_HANDLE handle)
+{
+    int result;
+    if (handle == NULL)
+    {
+        /*Codes_SRS_MQTT_POOL_07_015: [If handle is NULL then mqtt_pool_disconnect shall return a non-zero value.]*/
+        LogError("Invalid parameter specified handle: %p", handle);
+        result = __FAILURE__;
+    }
+    else
+    {
+        size_t index;
+        result = 0;
+        for (index = 0; index < handle->shardCount; index++)
+        {
+            POOL_SHARD* shard = &handle->shards[index];
+            if (Lock(shard->lock) != LOCK_OK)
+            {
+                LogError("Failure acquiring shard lock");
+                result = __FAILURE__;
+            }
+            else
+            {
+                /*Codes_SRS_MQTT_POOL_07_016: [mqtt_pool_disconnect shall call mqtt_client_disconnect for every connecting shard and return a non-zero value if any call fails.]*/
+                if (shard->isConnecting && mqtt_client_disconnect(shard->mqttClient, NULL, NULL) != 0)
+                {
+                    LogError("Failure disconnecting shard %lu", (unsigned long)index);
+                    result = __FAILURE__;
+                }
+                shard->isConnecting = false;
+                (void)Unlock(shard->lock);
+            }
+        }
+    }
+    return result;
+}
+
+size_t mqtt_pool_get_shard_index(MQTT_POOL_HANDLE handle, const char* topicName)
+{
+    size_t result;
+    if (handle == NULL)
+    {
+        /*Codes_SRS_MQTT_POOL_07_017: [If handle is NULL then mqtt_pool_get_shard_index shall return 0.]*/
+        result = 0;
+    }
+    else
+    {
+        /*Codes_SRS_MQTT_POOL_07_018: [mqtt_pool_get_shard_index shall return the hash of topicName modulo shardCount.]*/
+        result = mqtt_topic_hash(topicName) % handle->shardCount;
+    }
+    return result;
+}
+
+int mqtt_pool_publish(MQTT_POOL_HANDLE handle, MQTT_MESSAGE_HANDLE msgHandle)
+{
+    int result;
+    if (handle == NULL || msgHandle == NULL)
+    {
+        /*Codes_SRS_MQTT_POOL_07_019: [If handle or msgHandle is NULL then mqtt_pool_publish shall return a non-zero value.]*/
+        LogError("Invalid parameter specified handle: %p, msgHandle: %p", handle, msgHandle);
+        result = __FAILURE__;
+    }
+    else
+    {
+        const char* topicName = mqttmessage_getTopicName(msgHandle);
+        /*Codes_SRS_MQTT_POOL_07_020: [mqtt_pool_publish shall publish on the shard selected by the hash of the topic name, under the shard lock.]*/
+        POOL_SHARD* shard = &handle->shards[mqtt_topic_hash(topicName) % handle->shardCount];
+        if (Lock(shard->lock) != LOCK_OK)
+        {
+            LogError("Failure acquiring shard lock");
+            result = __FAILURE__;
+        }
+        else
+        {
+            QOS_VALUE qosValue = mqttmessage_getQosType(msgHandle);
+            const APP_PAYLOAD* payload = mqttmessage_getApplicationMsg(msgHandle);
+            uint16_t packetId = 0;
+            MQTT_MESSAGE_HANDLE shardMsg;
+            /*Codes_SRS_MQTT_POOL_07_021: [For QoS 1 and 2 mqtt_pool_publish shall use the next packet id of the shard, wrapping from 65535 to 1.]*/
+            if (qosValue != DELIVER_AT_MOST_ONCE)
+            {
+                packetId = shard->nextPacketId;
+                shard->nextPacketId = (shard->nextPacketId == UINT16_MAX) ? 1 : shard->nextPacketId + 1;
+            }
+
+            /*Codes_SRS_MQTT_POOL_07_022: [mqtt_pool_publish shall publish a message created in place over the topic and payload of msgHandle, with its duplicate and retain flags.]*/
+            // Same topic and payload with the packet id of the shard, nothing is copied
+            if ((shardMsg = mqttmessage_create_in_place(packetId, topicName, qosValue, payload->message, payload->length)) == NULL)
+            {
+                LogError("Failure creating shard message");
+                result = __FAILURE__;
+            }
+            else
+            {
+                (void)mqttmessage_setIsDuplicateMsg(shardMsg, mqttmessage_getIsDuplicateMsg(msgHandle));
+                (void)mqttmessage_setIsRetained(shardMsg, mqttmessage_getIsRetained(msgHandle));
+                result = mqtt_client_publish(shard->mqttClient, shardMsg);
+                mqttmessage_destroy(shardMsg);
+            }
+
+            /*Codes_SRS_MQTT_POOL_07_023: [mqtt_pool_publish shall count the publish as succeeded or failed and return the result of mqtt_client_publish.]*/
+            if (result == 0)
+            {
+                shard->publishCount++;
+            }
+            else
+            {
+                shard->publishFailureCount++;
+            }
+            (void)Unlock(shard->lock);
+        }
+    }
+    return result;
+}
+
+int mqtt_pool_get_metrics(MQTT_POOL_HANDLE handle, MQTT_POOL_METRICS* metrics)
+{
+    int result;
+    if (handle == NULL || metrics == NULL)
+    {
+        /*Codes_SRS_MQTT_POOL_07_024: [If handle or metrics is NULL then mqtt_pool_get_metrics shall return a non-zero value.]*/
+        LogError("Invalid parameter specified handle: %p, metrics: %p", handle, metrics);
+        result = __FAILURE__;
+    }
+    else
+    {
+        size_t index;
+        /*Codes_SRS_MQTT_POOL_07_025: [mqtt_pool_get_metrics shall sum the counters and the inflight window of every shard, set the error count and the last error of the pool and return 0.]*/
+        memset(metrics, 0, sizeof(MQTT_POOL_METRICS));
+        result = 0;
+        for (index = 0; index < handle->shardCount && result == 0; index++)
+        {
+            POOL_SHARD* shard = &handle->shards[index];
+            if (Lock(shard->lock) != LOCK_OK)
+            {
+                LogError("Failure acquiring shard lock");
+                result = __FAILURE__;
+            }
+            else
+            {
+                size_t inflightCount;
+                size_t windowSize;
+                metrics->connectedCount += shard->isConnected ? 1 : 0;
+                metrics->publishCount += shard->publishCount;
+                metrics->publishFailureCount += shard->publishFailureCount;
+                metrics->publishAckCount += shard->publishAckCount;
+                if (mqtt_client_get_inflight_window(shard->mqttClient, &inflightCount, &windowSize) == 0)
+                {
+                    metrics->inflightCount += inflightCount;
+                }
+                (void)Unlock(shard->lock);
+            }
+        }
+        if (result == 0)
+        {
+            if (Lock(handle->statsLock) != LOCK_OK)
+            {
+                LogError("Failure acquiring pool lock");
+                result = __FAILURE__;
+            }
+            else
+            {
+                metrics->errorCount = handle->errorCount;
+                metrics->lastError = handle->lastError;
+                (void)Unlock(handle->statsLock);
+            }
+        }
+    }
+    return result;
+}
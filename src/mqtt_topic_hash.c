@@ -0,0 +1,22 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <stddef.h>
+#include "mqtt_topic_hash.h"
+
+#define FNV_OFFSET_BASIS                2166136261u
+#define FNV_PRIME                       16777619u
+
+uint32_t mqtt_topic_hash(const char* topicName)
+{
+    uint32_t hash = FNV_OFFSET_BASIS;
+    if (topicName != NULL)
+    {
+        const unsigned char* iterator;
+        for (iterator = (const unsigned char*)topicName; *iterator != '\0'; iterator++)
+        {
+            hash = (hash ^ *iterator) * FNV_PRIME;
+        }
+    }
+    return hash;
+}
@@ -0,0 +1,26 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifndef MQTT_TOPIC_HASH_H
+#define MQTT_TOPIC_HASH_H
+
+#include "azure_c_shared_utility/umock_c_prod.h"
+
+#ifdef __cplusplus
+#include <cstdint>
+extern "C" {
+#else
+#include <stdint.h>
+#endif // __cplusplus
+
+/*
+*    @brief    Hashes topicName with FNV-1a, a NULL topic hashes like an empty one. Internal to the library, the
+*              dispatcher and the pool use it so that one topic always lands on the same worker or shard.
+*/
+MOCKABLE_FUNCTION(, uint32_t, mqtt_topic_hash, const char*, topicName);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
+#endif // MQTT_TOPIC_HASH_H
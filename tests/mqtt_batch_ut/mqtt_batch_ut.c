@@ -0,0 +1,862 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "umock_c.h"
+#include "umock_c_negative_tests.h"
+#include "umocktypes_charptr.h"
+#include "umocktypes_stdint.h"
+#include "umocktypes_bool.h"
+#include "umocktypes.h"
+#include "umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/tickcounter.h"
+#include "azure_c_shared_utility/vector.h"
+#include "azure_umqtt_c/mqtt_client.h"
+#include "azure_umqtt_c/mqtt_message.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_batch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    extern VECTOR_HANDLE real_VECTOR_create(size_t elementSize);
+    extern void real_VECTOR_destroy(VECTOR_HANDLE handle);
+    extern int real_VECTOR_push_back(VECTOR_HANDLE handle, const void* elements, size_t numElements);
+    extern void* real_VECTOR_element(VECTOR_HANDLE handle, size_t index);
+    extern void* real_VECTOR_back(VECTOR_HANDLE handle);
+    extern void* real_VECTOR_find_if(VECTOR_HANDLE handle, PREDICATE_FUNCTION pred, const void* value);
+    extern size_t real_VECTOR_size(VECTOR_HANDLE handle);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define TEST_MQTT_CLIENT_HANDLE     (MQTT_CLIENT_HANDLE)0x11
+#define TEST_TICK_COUNTER_HANDLE    (TICK_COUNTER_HANDLE)0x12
+#define TEST_MESSAGE_HANDLE         (MQTT_MESSAGE_HANDLE)0x13
+
+static const char* TEST_TOPIC_NAME = "telemetry/device1";
+static const char* TEST_OTHER_TOPIC_NAME = "telemetry/device2";
+static const uint8_t TEST_RECORD[] = { 'a', 'b', 'c' };
+static const uint8_t TEST_OTHER_RECORD[] = { 'd', 'e', 'f', 'g', 'h' };
+
+static tickcounter_ms_t g_current_ms;
+
+static int my_tickcounter_get_current_ms(TICK_COUNTER_HANDLE tick_counter, tickcounter_ms_t* current_ms)
+{
+    (void)tick_counter;
+    *current_ms = g_current_ms;
+    return 0;
+}
+
+TEST_DEFINE_ENUM_TYPE(QOS_VALUE, QOS_VALUE_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(QOS_VALUE, QOS_VALUE_VALUES);
+TEST_DEFINE_ENUM_TYPE(MQTT_BATCH_READ_RESULT, MQTT_BATCH_READ_RESULT_VALUES);
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    char temp_str[256];
+    (void)snprintf(temp_str, sizeof(temp_str), "umock_c reported error :%s", ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+    ASSERT_FAIL(temp_str);
+}
+
+static MQTT_BATCH_HANDLE create_batch(const MQTT_BATCH_OPTIONS* options)
+{
+    MQTT_BATCH_HANDLE handle = mqtt_batch_create(TEST_MQTT_CLIENT_HANDLE, options);
+    ASSERT_IS_NOT_NULL(handle);
+    umock_c_reset_all_calls();
+    return handle;
+}
+
+static void setup_batch_options(MQTT_BATCH_OPTIONS* options, size_t maxBytes, size_t maxRecords)
+{
+    memset(options, 0, sizeof(MQTT_BATCH_OPTIONS));
+    options->maxBytes = maxBytes;
+    options->maxRecords = maxRecords;
+    options->qos = DELIVER_AT_MOST_ONCE;
+}
+
+static void setup_publish_mocks(uint16_t packetId, QOS_VALUE qos, const uint8_t* payload, size_t length)
+{
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(packetId, TEST_TOPIC_NAME, qos, IGNORED_PTR_ARG, length))
+        .ValidateArgumentBuffer(4, payload, length);
+    STRICT_EXPECTED_CALL(mqtt_client_publish(TEST_MQTT_CLIENT_HANDLE, TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(TEST_MESSAGE_HANDLE));
+}
+
+BEGIN_TEST_SUITE(mqtt_batch_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_charptr_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_bool_register_types());
+
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_CLIENT_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_MESSAGE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(TICK_COUNTER_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(VECTOR_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(PREDICATE_FUNCTION, void*);
+    REGISTER_TYPE(QOS_VALUE, QOS_VALUE);
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+    REGISTER_GLOBAL_MOCK_HOOK(tickcounter_get_current_ms, my_tickcounter_get_current_ms);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_create, real_VECTOR_create);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_destroy, real_VECTOR_destroy);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_push_back, real_VECTOR_push_back);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_element, real_VECTOR_element);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_back, real_VECTOR_back);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_find_if, real_VECTOR_find_if);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_size, real_VECTOR_size);
+
+    REGISTER_GLOBAL_MOCK_RETURN(tickcounter_create, TEST_TICK_COUNTER_HANDLE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_create_in_place, TEST_MESSAGE_HANDLE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_client_publish, 0);
+
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(gballoc_malloc, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(tickcounter_create, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(tickcounter_get_current_ms, __LINE__);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(VECTOR_create, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(VECTOR_push_back, __LINE__);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqttmessage_create_in_place, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_client_publish, __LINE__);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    g_current_ms = 0;
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_001: [If mqttHandle is NULL, or options->firstPacketId is larger than options->lastPacketId, then mqtt_batch_create shall return NULL.]*/
+TEST_FUNCTION(mqtt_batch_create_mqttHandle_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_BATCH_HANDLE handle = mqtt_batch_create(NULL, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_BATCH_07_001: [If mqttHandle is NULL, or options->firstPacketId is larger than options->lastPacketId, then mqtt_batch_create shall return NULL.]*/
+TEST_FUNCTION(mqtt_batch_create_packet_id_range_reversed_fail)
+{
+    // arrange
+    MQTT_BATCH_OPTIONS options;
+    setup_batch_options(&options, 0, 0);
+    options.firstPacketId = 20;
+    options.lastPacketId = 10;
+
+    // act
+    MQTT_BATCH_HANDLE handle = mqtt_batch_create(TEST_MQTT_CLIENT_HANDLE, &options);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_BATCH_07_002: [A NULL options, or a maxBytes or maxAgeMs of 0, shall select batches of 4096 bytes published 100 milliseconds after their first record, with no record limit and QoS 0.]*/
+TEST_FUNCTION(mqtt_batch_create_succeed)
+{
+    // arrange
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_create());
+    EXPECTED_CALL(VECTOR_create(IGNORED_NUM_ARG));
+
+    // act
+    MQTT_BATCH_HANDLE handle = mqtt_batch_create(TEST_MQTT_CLIENT_HANDLE, NULL);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_004: [If any allocation or the creation of the tick counter fails then mqtt_batch_create shall free everything it allocated and return NULL.]*/
+TEST_FUNCTION(mqtt_batch_create_fail)
+{
+    // arrange
+    int negativeTestsInitResult = umock_c_negative_tests_init();
+    ASSERT_ARE_EQUAL(int, 0, negativeTestsInitResult);
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_create());
+    EXPECTED_CALL(VECTOR_create(IGNORED_NUM_ARG));
+
+    umock_c_negative_tests_snapshot();
+
+    size_t count = umock_c_negative_tests_call_count();
+    for (size_t index = 0; index < count; index++)
+    {
+        umock_c_negative_tests_reset();
+        umock_c_negative_tests_fail_call(index);
+
+        // act
+        MQTT_BATCH_HANDLE handle = mqtt_batch_create(TEST_MQTT_CLIENT_HANDLE, NULL);
+
+        // assert
+        ASSERT_IS_NULL(handle);
+    }
+
+    // cleanup
+    umock_c_negative_tests_deinit();
+}
+
+/*Tests_SRS_MQTT_BATCH_07_009: [mqtt_batch_append shall allocate the batch of a topic the first time a record is appended for it, and return a non-zero value if the allocation fails.]*/
+/*Tests_SRS_MQTT_BATCH_07_011: [mqtt_batch_append shall record the time of the first record of a batch.]*/
+/*Tests_SRS_MQTT_BATCH_07_012: [mqtt_batch_append shall copy the record after its length, encoded like the MQTT remaining length, and return 0.]*/
+TEST_FUNCTION(mqtt_batch_append_first_record_succeed)
+{
+    // arrange
+    MQTT_BATCH_HANDLE handle = create_batch(NULL);
+
+    EXPECTED_CALL(VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(strlen(TEST_TOPIC_NAME) + 1));
+    STRICT_EXPECTED_CALL(gballoc_malloc(4096));
+    EXPECTED_CALL(VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1));
+    EXPECTED_CALL(VECTOR_back(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_PTR_ARG));
+
+    // act
+    int result = mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_RECORD, sizeof(TEST_RECORD));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_009: [mqtt_batch_append shall allocate the batch of a topic the first time a record is appended for it, and return a non-zero value if the allocation fails.]*/
+TEST_FUNCTION(mqtt_batch_append_topic_allocation_fail)
+{
+    // arrange
+    MQTT_BATCH_HANDLE handle = create_batch(NULL);
+
+    EXPECTED_CALL(VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(strlen(TEST_TOPIC_NAME) + 1));
+    STRICT_EXPECTED_CALL(gballoc_malloc(4096))
+        .SetReturn(NULL);
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    int result = mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_RECORD, sizeof(TEST_RECORD));
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_007: [If handle or topicName is NULL, or record is NULL while length is not 0, then mqtt_batch_append shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_batch_append_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_batch_append(NULL, TEST_TOPIC_NAME, TEST_RECORD, sizeof(TEST_RECORD));
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_BATCH_07_005: [If handle is NULL then mqtt_batch_destroy shall do nothing.]*/
+TEST_FUNCTION(mqtt_batch_destroy_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_batch_destroy(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_BATCH_07_007: [If handle or topicName is NULL, or record is NULL while length is not 0, then mqtt_batch_append shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_batch_append_topicName_NULL_fail)
+{
+    // arrange
+    MQTT_BATCH_HANDLE handle = create_batch(NULL);
+
+    // act
+    int result = mqtt_batch_append(handle, NULL, TEST_RECORD, sizeof(TEST_RECORD));
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_018: [If handle is NULL then mqtt_batch_flush shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_batch_flush_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_batch_flush(NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_BATCH_07_016: [If handle is NULL then mqtt_batch_dowork shall do nothing.]*/
+TEST_FUNCTION(mqtt_batch_dowork_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_batch_dowork(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_BATCH_07_008: [If the record and its length prefix do not fit in maxBytes then mqtt_batch_append shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_batch_append_record_larger_than_batch_fail)
+{
+    // arrange
+    MQTT_BATCH_OPTIONS options;
+    setup_batch_options(&options, 8, 0);
+    MQTT_BATCH_HANDLE handle = create_batch(&options);
+    uint8_t record[8] = { 0 };
+
+    // act
+    int result = mqtt_batch_append(handle, TEST_TOPIC_NAME, record, sizeof(record));
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_012: [mqtt_batch_append shall copy the record after its length, encoded like the MQTT remaining length, and return 0.]*/
+/*Tests_SRS_MQTT_BATCH_07_014: [A batch shall be published with mqtt_client_publish as a message created in place over the batch payload, with the configured QoS.]*/
+/*Tests_SRS_MQTT_BATCH_07_019: [mqtt_batch_flush shall publish every batch that holds records and return a non-zero value if any publish fails.]*/
+TEST_FUNCTION(mqtt_batch_flush_publishes_length_prefixed_records)
+{
+    // arrange
+    MQTT_BATCH_HANDLE handle = create_batch(NULL);
+    uint8_t longRecord[200];
+    uint8_t expected[1 + sizeof(TEST_RECORD) + 1 + 2 + sizeof(longRecord)];
+    size_t index = 0;
+    memset(longRecord, 'x', sizeof(longRecord));
+    expected[index++] = (uint8_t)sizeof(TEST_RECORD);
+    memcpy(expected + index, TEST_RECORD, sizeof(TEST_RECORD));
+    index += sizeof(TEST_RECORD);
+    expected[index++] = 0;
+    expected[index++] = 0xC8;
+    expected[index++] = 0x01;
+    memcpy(expected + index, longRecord, sizeof(longRecord));
+
+    ASSERT_ARE_EQUAL(int, 0, mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_RECORD, sizeof(TEST_RECORD)));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_batch_append(handle, TEST_TOPIC_NAME, NULL, 0));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_batch_append(handle, TEST_TOPIC_NAME, longRecord, sizeof(longRecord)));
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(VECTOR_size(IGNORED_PTR_ARG));
+    EXPECTED_CALL(VECTOR_element(IGNORED_PTR_ARG, 0));
+    setup_publish_mocks(0, DELIVER_AT_MOST_ONCE, expected, sizeof(expected));
+
+    // act
+    int result = mqtt_batch_flush(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_019: [mqtt_batch_flush shall publish every batch that holds records and return a non-zero value if any publish fails.]*/
+TEST_FUNCTION(mqtt_batch_flush_keeps_topics_apart)
+{
+    // arrange
+    MQTT_BATCH_HANDLE handle = create_batch(NULL);
+    const uint8_t expected[] = { 3, 'a', 'b', 'c' };
+    const uint8_t otherExpected[] = { 5, 'd', 'e', 'f', 'g', 'h' };
+
+    ASSERT_ARE_EQUAL(int, 0, mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_RECORD, sizeof(TEST_RECORD)));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_batch_append(handle, TEST_OTHER_TOPIC_NAME, TEST_OTHER_RECORD, sizeof(TEST_OTHER_RECORD)));
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(VECTOR_size(IGNORED_PTR_ARG));
+    EXPECTED_CALL(VECTOR_element(IGNORED_PTR_ARG, 0));
+    setup_publish_mocks(0, DELIVER_AT_MOST_ONCE, expected, sizeof(expected));
+    EXPECTED_CALL(VECTOR_element(IGNORED_PTR_ARG, 1));
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(0, TEST_OTHER_TOPIC_NAME, DELIVER_AT_MOST_ONCE, IGNORED_PTR_ARG, sizeof(otherExpected)))
+        .ValidateArgumentBuffer(4, otherExpected, sizeof(otherExpected));
+    STRICT_EXPECTED_CALL(mqtt_client_publish(TEST_MQTT_CLIENT_HANDLE, TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(TEST_MESSAGE_HANDLE));
+
+    // act
+    int result = mqtt_batch_flush(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_019: [mqtt_batch_flush shall publish every batch that holds records and return a non-zero value if any publish fails.]*/
+TEST_FUNCTION(mqtt_batch_flush_empty_batch_publishes_nothing)
+{
+    // arrange
+    MQTT_BATCH_HANDLE handle = create_batch(NULL);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_RECORD, sizeof(TEST_RECORD)));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_batch_flush(handle));
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(VECTOR_size(IGNORED_PTR_ARG));
+    EXPECTED_CALL(VECTOR_element(IGNORED_PTR_ARG, 0));
+
+    // act
+    int result = mqtt_batch_flush(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_019: [mqtt_batch_flush shall publish every batch that holds records and return a non-zero value if any publish fails.]*/
+TEST_FUNCTION(mqtt_batch_flush_publish_fail_keeps_batch)
+{
+    // arrange
+    MQTT_BATCH_HANDLE handle = create_batch(NULL);
+    const uint8_t expected[] = { 3, 'a', 'b', 'c' };
+    ASSERT_ARE_EQUAL(int, 0, mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_RECORD, sizeof(TEST_RECORD)));
+    STRICT_EXPECTED_CALL(mqtt_client_publish(TEST_MQTT_CLIENT_HANDLE, TEST_MESSAGE_HANDLE))
+        .SetReturn(__LINE__);
+    ASSERT_ARE_NOT_EQUAL(int, 0, mqtt_batch_flush(handle));
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(VECTOR_size(IGNORED_PTR_ARG));
+    EXPECTED_CALL(VECTOR_element(IGNORED_PTR_ARG, 0));
+    setup_publish_mocks(0, DELIVER_AT_MOST_ONCE, expected, sizeof(expected));
+
+    // act
+    int result = mqtt_batch_flush(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_010: [If the record does not fit in the pending batch then mqtt_batch_append shall publish the batch first, and return a non-zero value keeping the batch if the publish fails.]*/
+TEST_FUNCTION(mqtt_batch_append_record_not_fitting_publishes_batch_first)
+{
+    // arrange
+    MQTT_BATCH_OPTIONS options;
+    setup_batch_options(&options, 8, 0);
+    MQTT_BATCH_HANDLE handle = create_batch(&options);
+    const uint8_t expected[] = { 5, 'd', 'e', 'f', 'g', 'h' };
+    ASSERT_ARE_EQUAL(int, 0, mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_OTHER_RECORD, sizeof(TEST_OTHER_RECORD)));
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    setup_publish_mocks(0, DELIVER_AT_MOST_ONCE, expected, sizeof(expected));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_PTR_ARG));
+
+    // act
+    int result = mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_RECORD, sizeof(TEST_RECORD));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_010: [If the record does not fit in the pending batch then mqtt_batch_append shall publish the batch first, and return a non-zero value keeping the batch if the publish fails.]*/
+TEST_FUNCTION(mqtt_batch_append_full_batch_publish_fail_keeps_batch)
+{
+    // arrange
+    MQTT_BATCH_OPTIONS options;
+    setup_batch_options(&options, 8, 0);
+    MQTT_BATCH_HANDLE handle = create_batch(&options);
+    const uint8_t expected[] = { 5, 'd', 'e', 'f', 'g', 'h' };
+    ASSERT_ARE_EQUAL(int, 0, mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_OTHER_RECORD, sizeof(TEST_OTHER_RECORD)));
+    STRICT_EXPECTED_CALL(mqtt_client_publish(TEST_MQTT_CLIENT_HANDLE, TEST_MESSAGE_HANDLE))
+        .SetReturn(__LINE__);
+    ASSERT_ARE_NOT_EQUAL(int, 0, mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_RECORD, sizeof(TEST_RECORD)));
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(VECTOR_size(IGNORED_PTR_ARG));
+    EXPECTED_CALL(VECTOR_element(IGNORED_PTR_ARG, 0));
+    setup_publish_mocks(0, DELIVER_AT_MOST_ONCE, expected, sizeof(expected));
+
+    // act
+    int result = mqtt_batch_flush(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_013: [When the batch reaches maxRecords records or maxBytes bytes mqtt_batch_append shall publish it, keeping it for the next flush if the publish fails.]*/
+TEST_FUNCTION(mqtt_batch_append_record_filling_batch_publishes)
+{
+    // arrange
+    MQTT_BATCH_OPTIONS options;
+    setup_batch_options(&options, 4, 0);
+    MQTT_BATCH_HANDLE handle = create_batch(&options);
+    const uint8_t expected[] = { 3, 'a', 'b', 'c' };
+
+    EXPECTED_CALL(VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(gballoc_malloc(strlen(TEST_TOPIC_NAME) + 1));
+    STRICT_EXPECTED_CALL(gballoc_malloc(4));
+    EXPECTED_CALL(VECTOR_push_back(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 1));
+    EXPECTED_CALL(VECTOR_back(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_PTR_ARG));
+    setup_publish_mocks(0, DELIVER_AT_MOST_ONCE, expected, sizeof(expected));
+
+    // act
+    int result = mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_RECORD, sizeof(TEST_RECORD));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_013: [When the batch reaches maxRecords records or maxBytes bytes mqtt_batch_append shall publish it, keeping it for the next flush if the publish fails.]*/
+TEST_FUNCTION(mqtt_batch_append_maxRecords_publishes)
+{
+    // arrange
+    MQTT_BATCH_OPTIONS options;
+    setup_batch_options(&options, 0, 2);
+    MQTT_BATCH_HANDLE handle = create_batch(&options);
+    const uint8_t expected[] = { 3, 'a', 'b', 'c', 5, 'd', 'e', 'f', 'g', 'h' };
+    ASSERT_ARE_EQUAL(int, 0, mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_RECORD, sizeof(TEST_RECORD)));
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(VECTOR_find_if(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    setup_publish_mocks(0, DELIVER_AT_MOST_ONCE, expected, sizeof(expected));
+
+    // act
+    int result = mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_OTHER_RECORD, sizeof(TEST_OTHER_RECORD));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_003: [If options is NULL or lastPacketId is 0 then the batches shall be numbered from 1 to 65535, otherwise from firstPacketId, or 1 when it is 0, to lastPacketId.]*/
+/*Tests_SRS_MQTT_BATCH_07_015: [QoS 1 and 2 batches shall take the next packet id of the range, going around from lastPacketId to firstPacketId.]*/
+TEST_FUNCTION(mqtt_batch_flush_numbers_packet_ids_in_range)
+{
+    // arrange
+    MQTT_BATCH_OPTIONS options;
+    setup_batch_options(&options, 0, 1);
+    options.qos = DELIVER_AT_LEAST_ONCE;
+    options.firstPacketId = 10;
+    options.lastPacketId = 11;
+    MQTT_BATCH_HANDLE handle = create_batch(&options);
+    const uint8_t expected[] = { 3, 'a', 'b', 'c' };
+
+    setup_publish_mocks(10, DELIVER_AT_LEAST_ONCE, expected, sizeof(expected));
+    setup_publish_mocks(11, DELIVER_AT_LEAST_ONCE, expected, sizeof(expected));
+    setup_publish_mocks(10, DELIVER_AT_LEAST_ONCE, expected, sizeof(expected));
+
+    // act
+    for (size_t index = 0; index < 3; index++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_RECORD, sizeof(TEST_RECORD)));
+    }
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, "", umock_c_get_expected_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_017: [mqtt_batch_dowork shall publish the batches whose first record is at least maxAgeMs old, then call mqtt_client_dowork.]*/
+TEST_FUNCTION(mqtt_batch_dowork_publishes_only_expired_batches)
+{
+    // arrange
+    MQTT_BATCH_OPTIONS options;
+    setup_batch_options(&options, 0, 0);
+    options.maxAgeMs = 100;
+    MQTT_BATCH_HANDLE handle = create_batch(&options);
+    const uint8_t expected[] = { 3, 'a', 'b', 'c' };
+    g_current_ms = 1000;
+    ASSERT_ARE_EQUAL(int, 0, mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_RECORD, sizeof(TEST_RECORD)));
+    g_current_ms = 1099;
+    mqtt_batch_dowork(handle);
+    umock_c_reset_all_calls();
+    g_current_ms = 1100;
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_PTR_ARG));
+    EXPECTED_CALL(VECTOR_size(IGNORED_PTR_ARG));
+    EXPECTED_CALL(VECTOR_element(IGNORED_PTR_ARG, 0));
+    setup_publish_mocks(0, DELIVER_AT_MOST_ONCE, expected, sizeof(expected));
+    STRICT_EXPECTED_CALL(mqtt_client_dowork(TEST_MQTT_CLIENT_HANDLE));
+
+    // act
+    mqtt_batch_dowork(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_017: [mqtt_batch_dowork shall publish the batches whose first record is at least maxAgeMs old, then call mqtt_client_dowork.]*/
+TEST_FUNCTION(mqtt_batch_dowork_young_batch_not_published)
+{
+    // arrange
+    MQTT_BATCH_HANDLE handle = create_batch(NULL);
+    g_current_ms = 1000;
+    ASSERT_ARE_EQUAL(int, 0, mqtt_batch_append(handle, TEST_TOPIC_NAME, TEST_RECORD, sizeof(TEST_RECORD)));
+    umock_c_reset_all_calls();
+    g_current_ms = 1099;
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_TICK_COUNTER_HANDLE, IGNORED_PTR_ARG));
+    EXPECTED_CALL(VECTOR_size(IGNORED_PTR_ARG));
+    EXPECTED_CALL(VECTOR_element(IGNORED_PTR_ARG, 0));
+    STRICT_EXPECTED_CALL(mqtt_client_dowork(TEST_MQTT_CLIENT_HANDLE));
+
+    // act
+    mqtt_batch_dowork(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_batch_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_021: [If offset equals length then mqtt_batch_read_record shall return MQTT_BATCH_READ_END.]*/
+/*Tests_SRS_MQTT_BATCH_07_023: [mqtt_batch_read_record shall point record to the record in payload, set recordLength, move offset past the record and return MQTT_BATCH_READ_OK.]*/
+TEST_FUNCTION(mqtt_batch_read_record_reads_records_then_end)
+{
+    // arrange
+    uint8_t payload[1 + 3 + 1 + 2 + 200];
+    size_t offset = 0;
+    const uint8_t* record = NULL;
+    size_t recordLength = 0;
+    memset(payload, 'x', sizeof(payload));
+    payload[0] = 3;
+    payload[4] = 0;
+    payload[5] = 0xC8;
+    payload[6] = 0x01;
+
+    // act
+    MQTT_BATCH_READ_RESULT first = mqtt_batch_read_record(payload, sizeof(payload), &offset, &record, &recordLength);
+
+    // assert
+    ASSERT_ARE_EQUAL(MQTT_BATCH_READ_RESULT, MQTT_BATCH_READ_OK, first);
+    ASSERT_ARE_EQUAL(void_ptr, payload + 1, record);
+    ASSERT_ARE_EQUAL(size_t, 3, recordLength);
+    ASSERT_ARE_EQUAL(size_t, 4, offset);
+
+    ASSERT_ARE_EQUAL(MQTT_BATCH_READ_RESULT, MQTT_BATCH_READ_OK, mqtt_batch_read_record(payload, sizeof(payload), &offset, &record, &recordLength));
+    ASSERT_ARE_EQUAL(size_t, 0, recordLength);
+    ASSERT_ARE_EQUAL(size_t, 5, offset);
+
+    ASSERT_ARE_EQUAL(MQTT_BATCH_READ_RESULT, MQTT_BATCH_READ_OK, mqtt_batch_read_record(payload, sizeof(payload), &offset, &record, &recordLength));
+    ASSERT_ARE_EQUAL(void_ptr, payload + 7, record);
+    ASSERT_ARE_EQUAL(size_t, 200, recordLength);
+    ASSERT_ARE_EQUAL(size_t, sizeof(payload), offset);
+
+    ASSERT_ARE_EQUAL(MQTT_BATCH_READ_RESULT, MQTT_BATCH_READ_END, mqtt_batch_read_record(payload, sizeof(payload), &offset, &record, &recordLength));
+    ASSERT_ARE_EQUAL(size_t, sizeof(payload), offset);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_BATCH_07_021: [If offset equals length then mqtt_batch_read_record shall return MQTT_BATCH_READ_END.]*/
+TEST_FUNCTION(mqtt_batch_read_record_empty_payload_end)
+{
+    // arrange
+    size_t offset = 0;
+    const uint8_t* record = NULL;
+    size_t recordLength = 0;
+
+    // act
+    MQTT_BATCH_READ_RESULT result = mqtt_batch_read_record(NULL, 0, &offset, &record, &recordLength);
+
+    // assert
+    ASSERT_ARE_EQUAL(MQTT_BATCH_READ_RESULT, MQTT_BATCH_READ_END, result);
+    ASSERT_ARE_EQUAL(size_t, 0, offset);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_020: [If offset, record or recordLength is NULL, payload is NULL while length is not 0, or offset is past length, then mqtt_batch_read_record shall return MQTT_BATCH_READ_ERROR.]*/
+TEST_FUNCTION(mqtt_batch_read_record_offset_NULL_fail)
+{
+    // arrange
+    const uint8_t payload[] = { 1, 'a' };
+    const uint8_t* record = NULL;
+    size_t recordLength = 0;
+
+    // act
+    MQTT_BATCH_READ_RESULT result = mqtt_batch_read_record(payload, sizeof(payload), NULL, &record, &recordLength);
+
+    // assert
+    ASSERT_ARE_EQUAL(MQTT_BATCH_READ_RESULT, MQTT_BATCH_READ_ERROR, result);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_020: [If offset, record or recordLength is NULL, payload is NULL while length is not 0, or offset is past length, then mqtt_batch_read_record shall return MQTT_BATCH_READ_ERROR.]*/
+TEST_FUNCTION(mqtt_batch_read_record_offset_past_end_fail)
+{
+    // arrange
+    const uint8_t payload[] = { 1, 'a' };
+    size_t offset = 3;
+    const uint8_t* record = NULL;
+    size_t recordLength = 0;
+
+    // act
+    MQTT_BATCH_READ_RESULT result = mqtt_batch_read_record(payload, sizeof(payload), &offset, &record, &recordLength);
+
+    // assert
+    ASSERT_ARE_EQUAL(MQTT_BATCH_READ_RESULT, MQTT_BATCH_READ_ERROR, result);
+    ASSERT_ARE_EQUAL(size_t, 3, offset);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_022: [If the length prefix is longer than 4 bytes, ends with the payload or gives a length past the end of the payload then mqtt_batch_read_record shall return MQTT_BATCH_READ_ERROR and leave offset unchanged.]*/
+TEST_FUNCTION(mqtt_batch_read_record_prefix_too_long_fail)
+{
+    // arrange
+    const uint8_t payload[] = { 0x80, 0x80, 0x80, 0x80, 0x01, 'a' };
+    size_t offset = 0;
+    const uint8_t* record = NULL;
+    size_t recordLength = 0;
+
+    // act
+    MQTT_BATCH_READ_RESULT result = mqtt_batch_read_record(payload, sizeof(payload), &offset, &record, &recordLength);
+
+    // assert
+    ASSERT_ARE_EQUAL(MQTT_BATCH_READ_RESULT, MQTT_BATCH_READ_ERROR, result);
+    ASSERT_ARE_EQUAL(size_t, 0, offset);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_022: [If the length prefix is longer than 4 bytes, ends with the payload or gives a length past the end of the payload then mqtt_batch_read_record shall return MQTT_BATCH_READ_ERROR and leave offset unchanged.]*/
+TEST_FUNCTION(mqtt_batch_read_record_prefix_cut_at_end_fail)
+{
+    // arrange
+    const uint8_t payload[] = { 1, 'a', 0x80 };
+    size_t offset = 2;
+    const uint8_t* record = NULL;
+    size_t recordLength = 0;
+
+    // act
+    MQTT_BATCH_READ_RESULT result = mqtt_batch_read_record(payload, sizeof(payload), &offset, &record, &recordLength);
+
+    // assert
+    ASSERT_ARE_EQUAL(MQTT_BATCH_READ_RESULT, MQTT_BATCH_READ_ERROR, result);
+    ASSERT_ARE_EQUAL(size_t, 2, offset);
+}
+
+/*Tests_SRS_MQTT_BATCH_07_022: [If the length prefix is longer than 4 bytes, ends with the payload or gives a length past the end of the payload then mqtt_batch_read_record shall return MQTT_BATCH_READ_ERROR and leave offset unchanged.]*/
+TEST_FUNCTION(mqtt_batch_read_record_length_past_end_fail)
+{
+    // arrange
+    const uint8_t payload[] = { 4, 'a', 'b', 'c' };
+    size_t offset = 0;
+    const uint8_t* record = NULL;
+    size_t recordLength = 0;
+
+    // act
+    MQTT_BATCH_READ_RESULT result = mqtt_batch_read_record(payload, sizeof(payload), &offset, &record, &recordLength);
+
+    // assert
+    ASSERT_ARE_EQUAL(MQTT_BATCH_READ_RESULT, MQTT_BATCH_READ_ERROR, result);
+    ASSERT_ARE_EQUAL(size_t, 0, offset);
+    ASSERT_IS_NULL(record);
+}
+
+END_TEST_SUITE(mqtt_batch_ut)
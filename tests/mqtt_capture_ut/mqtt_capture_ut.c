@@ -0,0 +1,676 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdarg>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "umock_c.h"
+#include "umock_c_negative_tests.h"
+#include "umocktypes_charptr.h"
+#include "umocktypes_stdint.h"
+#include "umocktypes_bool.h"
+#include "umocktypes.h"
+#include "umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/agenttime.h"
+#include "azure_c_shared_utility/crt_abstractions.h"
+#include "azure_c_shared_utility/strings.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/condition.h"
+#include "azure_c_shared_utility/threadapi.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_capture.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    STRING_HANDLE STRING_construct_sprintf(const char* format, ...)
+    {
+        char buffer[128];
+        char* result;
+        va_list args;
+        va_start(args, format);
+        (void)vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        if ((result = (char*)my_gballoc_malloc(strlen(buffer) + 1)) != NULL)
+        {
+            (void)strcpy(result, buffer);
+        }
+        return (STRING_HANDLE)result;
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define TEST_LOCK_HANDLE                (LOCK_HANDLE)0x11
+#define TEST_COND_HANDLE                (COND_HANDLE)0x12
+#define TEST_THREAD_HANDLE              (THREAD_HANDLE)0x13
+#define TEST_FILE_PREFIX                "mqtt_capture_ut"
+#define TEST_MAX_FILE_INDEX             4
+
+#define TEST_SHB_SIZE                   28
+#define TEST_IDB_SIZE                   32
+#define TEST_FILE_HEADER_SIZE           (TEST_SHB_SIZE + TEST_IDB_SIZE)
+#define TEST_EPB_HEADER_SIZE            28
+#define TEST_SYNTHETIC_HEADER_SIZE      40
+
+static const uint8_t TEST_OUTGOING_BYTES[] = { 0x30, 0x03, 0x00, 0x01, 'a' };
+static const uint8_t TEST_INCOMING_BYTES[] = { 0x40, 0x02, 0x00, 0x01 };
+
+static THREAD_START_FUNC g_writerFunc;
+static void* g_writerArg;
+static uint8_t g_fileContent[1024];
+
+static int my_mallocAndStrcpy_s(char** destination, const char* source)
+{
+    size_t src_len = strlen(source);
+    *destination = (char*)my_gballoc_malloc(src_len + 1);
+    memcpy(*destination, source, src_len + 1);
+    return 0;
+}
+
+static const char* my_STRING_c_str(STRING_HANDLE handle)
+{
+    return (const char*)handle;
+}
+
+static void my_STRING_delete(STRING_HANDLE handle)
+{
+    my_gballoc_free(handle);
+}
+
+static THREADAPI_RESULT my_ThreadAPI_Create(THREAD_HANDLE* threadHandle, THREAD_START_FUNC func, void* arg)
+{
+    g_writerFunc = func;
+    g_writerArg = arg;
+    *threadHandle = TEST_THREAD_HANDLE;
+    return THREADAPI_OK;
+}
+
+// There is no real writer thread, it runs when destroy joins it and writes everything staged
+static THREADAPI_RESULT my_ThreadAPI_Join(THREAD_HANDLE threadHandle, int* res)
+{
+    (void)threadHandle;
+    *res = g_writerFunc(g_writerArg);
+    return THREADAPI_OK;
+}
+
+static void get_capture_file_name(char* fileName, size_t size, size_t index)
+{
+    (void)snprintf(fileName, size, "%s_%05lu.pcapng", TEST_FILE_PREFIX, (unsigned long)index);
+}
+
+static size_t read_capture_file(size_t index)
+{
+    char fileName[64];
+    size_t result = 0;
+    FILE* file;
+    get_capture_file_name(fileName, sizeof(fileName), index);
+    if ((file = fopen(fileName, "rb")) != NULL)
+    {
+        result = fread(g_fileContent, 1, sizeof(g_fileContent), file);
+        (void)fclose(file);
+    }
+    return result;
+}
+
+static bool capture_file_exists(size_t index)
+{
+    char fileName[64];
+    FILE* file;
+    get_capture_file_name(fileName, sizeof(fileName), index);
+    if ((file = fopen(fileName, "rb")) != NULL)
+    {
+        (void)fclose(file);
+    }
+    return file != NULL;
+}
+
+static void remove_capture_files(void)
+{
+    size_t index;
+    for (index = 0; index < TEST_MAX_FILE_INDEX; index++)
+    {
+        char fileName[64];
+        get_capture_file_name(fileName, sizeof(fileName), index);
+        (void)remove(fileName);
+    }
+}
+
+// pcapng blocks are in host byte order, the synthetic IP and TCP headers in network order
+static uint32_t get_block_uint32(size_t offset)
+{
+    uint32_t value;
+    memcpy(&value, g_fileContent + offset, sizeof(value));
+    return value;
+}
+
+static uint16_t get_block_uint16(size_t offset)
+{
+    uint16_t value;
+    memcpy(&value, g_fileContent + offset, sizeof(value));
+    return value;
+}
+
+static uint32_t get_net_uint32(size_t offset)
+{
+    return ((uint32_t)g_fileContent[offset] << 24) | ((uint32_t)g_fileContent[offset + 1] << 16) |
+        ((uint32_t)g_fileContent[offset + 2] << 8) | (uint32_t)g_fileContent[offset + 3];
+}
+
+static uint16_t get_net_uint16(size_t offset)
+{
+    return (uint16_t)((g_fileContent[offset] << 8) | g_fileContent[offset + 1]);
+}
+
+static void setup_capture_options(MQTT_CAPTURE_OPTIONS* options)
+{
+    memset(options, 0, sizeof(MQTT_CAPTURE_OPTIONS));
+    options->filePrefix = TEST_FILE_PREFIX;
+}
+
+static MQTT_CAPTURE_HANDLE create_capture(const MQTT_CAPTURE_OPTIONS* options)
+{
+    MQTT_CAPTURE_HANDLE handle = mqtt_capture_create(options);
+    ASSERT_IS_NOT_NULL(handle);
+    umock_c_reset_all_calls();
+    return handle;
+}
+
+static void assert_file_header(void)
+{
+    // Section header block
+    ASSERT_ARE_EQUAL(int, 0x0A0D0D0A, (int)get_block_uint32(0));
+    ASSERT_ARE_EQUAL(int, TEST_SHB_SIZE, (int)get_block_uint32(4));
+    ASSERT_ARE_EQUAL(int, 0x1A2B3C4D, (int)get_block_uint32(8));
+    ASSERT_ARE_EQUAL(int, 1, (int)get_block_uint16(12));
+    ASSERT_ARE_EQUAL(int, 0, (int)get_block_uint16(14));
+    ASSERT_ARE_EQUAL(int, -1, (int)get_block_uint32(16));
+    ASSERT_ARE_EQUAL(int, -1, (int)get_block_uint32(20));
+    ASSERT_ARE_EQUAL(int, TEST_SHB_SIZE, (int)get_block_uint32(24));
+
+    // Interface description block, raw IP with an if_tsresol option of nanoseconds
+    ASSERT_ARE_EQUAL(int, 1, (int)get_block_uint32(TEST_SHB_SIZE));
+    ASSERT_ARE_EQUAL(int, TEST_IDB_SIZE, (int)get_block_uint32(TEST_SHB_SIZE + 4));
+    ASSERT_ARE_EQUAL(int, 101, (int)get_block_uint16(TEST_SHB_SIZE + 8));
+    ASSERT_ARE_EQUAL(int, 0, (int)get_block_uint32(TEST_SHB_SIZE + 12));
+    ASSERT_ARE_EQUAL(int, 9, (int)get_block_uint16(TEST_SHB_SIZE + 16));
+    ASSERT_ARE_EQUAL(int, 1, (int)get_block_uint16(TEST_SHB_SIZE + 18));
+    ASSERT_ARE_EQUAL(int, 9, (int)g_fileContent[TEST_SHB_SIZE + 20]);
+    ASSERT_ARE_EQUAL(int, 0, (int)get_block_uint32(TEST_SHB_SIZE + 24));
+    ASSERT_ARE_EQUAL(int, TEST_IDB_SIZE, (int)get_block_uint32(TEST_SHB_SIZE + 28));
+}
+
+static size_t assert_packet_block(size_t offset, bool outgoing, uint16_t brokerPort, uint16_t ipIdentifier, uint32_t seq, uint32_t ack, const uint8_t* payload, size_t length)
+{
+    size_t packetLen = TEST_SYNTHETIC_HEADER_SIZE + length;
+    size_t blockLen = 32 + ((packetLen + 3) & ~(size_t)3);
+    size_t ipHeader = offset + TEST_EPB_HEADER_SIZE;
+    size_t tcpHeader = ipHeader + 20;
+    uint32_t checksum = 0;
+    size_t index;
+
+    // Enhanced packet block on interface 0
+    ASSERT_ARE_EQUAL(int, 6, (int)get_block_uint32(offset));
+    ASSERT_ARE_EQUAL(size_t, blockLen, (size_t)get_block_uint32(offset + 4));
+    ASSERT_ARE_EQUAL(int, 0, (int)get_block_uint32(offset + 8));
+    ASSERT_ARE_EQUAL(size_t, packetLen, (size_t)get_block_uint32(offset + 20));
+    ASSERT_ARE_EQUAL(size_t, packetLen, (size_t)get_block_uint32(offset + 24));
+    ASSERT_ARE_EQUAL(size_t, blockLen, (size_t)get_block_uint32(offset + blockLen - 4));
+
+    // IPv4 header with a valid checksum
+    ASSERT_ARE_EQUAL(int, 0x45, (int)g_fileContent[ipHeader]);
+    ASSERT_ARE_EQUAL(size_t, packetLen, (size_t)get_net_uint16(ipHeader + 2));
+    ASSERT_ARE_EQUAL(int, ipIdentifier, (int)get_net_uint16(ipHeader + 4));
+    ASSERT_ARE_EQUAL(int, 6, (int)g_fileContent[ipHeader + 9]);
+    ASSERT_ARE_EQUAL(int, outgoing ? 0x0A000001 : 0x0A000002, (int)get_net_uint32(ipHeader + 12));
+    ASSERT_ARE_EQUAL(int, outgoing ? 0x0A000002 : 0x0A000001, (int)get_net_uint32(ipHeader + 16));
+    for (index = 0; index < 20; index += 2)
+    {
+        checksum += get_net_uint16(ipHeader + index);
+    }
+    checksum = (checksum & 0xFFFF) + (checksum >> 16);
+    ASSERT_ARE_EQUAL(int, 0xFFFF, (int)checksum);
+
+    // TCP header between the client and broker ports
+    ASSERT_ARE_EQUAL(int, outgoing ? 49152 : brokerPort, (int)get_net_uint16(tcpHeader));
+    ASSERT_ARE_EQUAL(int, outgoing ? brokerPort : 49152, (int)get_net_uint16(tcpHeader + 2));
+    ASSERT_ARE_EQUAL(int, (int)seq, (int)get_net_uint32(tcpHeader + 4));
+    ASSERT_ARE_EQUAL(int, (int)ack, (int)get_net_uint32(tcpHeader + 8));
+    ASSERT_ARE_EQUAL(int, 0x50, (int)g_fileContent[tcpHeader + 12]);
+    ASSERT_ARE_EQUAL(int, 0x18, (int)g_fileContent[tcpHeader + 13]);
+
+    // The MQTT bytes, padded with zeros to 32 bits
+    ASSERT_ARE_EQUAL(int, 0, memcmp(g_fileContent + tcpHeader + 20, payload, length));
+    for (index = TEST_EPB_HEADER_SIZE + packetLen; index < blockLen - 4; index++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, (int)g_fileContent[offset + index]);
+    }
+    return blockLen;
+}
+
+TEST_DEFINE_ENUM_TYPE(LOCK_RESULT, LOCK_RESULT_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(LOCK_RESULT, LOCK_RESULT_VALUES);
+TEST_DEFINE_ENUM_TYPE(COND_RESULT, COND_RESULT_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(COND_RESULT, COND_RESULT_VALUES);
+TEST_DEFINE_ENUM_TYPE(THREADAPI_RESULT, THREADAPI_RESULT_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(THREADAPI_RESULT, THREADAPI_RESULT_VALUES);
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    char temp_str[256];
+    (void)snprintf(temp_str, sizeof(temp_str), "umock_c reported error :%s", ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+    ASSERT_FAIL(temp_str);
+}
+
+BEGIN_TEST_SUITE(mqtt_capture_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_charptr_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_bool_register_types());
+
+    REGISTER_UMOCK_ALIAS_TYPE(LOCK_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(COND_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(THREAD_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(THREAD_START_FUNC, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(STRING_HANDLE, void*);
+    REGISTER_TYPE(LOCK_RESULT, LOCK_RESULT);
+    REGISTER_TYPE(COND_RESULT, COND_RESULT);
+    REGISTER_TYPE(THREADAPI_RESULT, THREADAPI_RESULT);
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+    REGISTER_GLOBAL_MOCK_HOOK(mallocAndStrcpy_s, my_mallocAndStrcpy_s);
+    REGISTER_GLOBAL_MOCK_HOOK(STRING_c_str, my_STRING_c_str);
+    REGISTER_GLOBAL_MOCK_HOOK(STRING_delete, my_STRING_delete);
+    REGISTER_GLOBAL_MOCK_HOOK(ThreadAPI_Create, my_ThreadAPI_Create);
+    REGISTER_GLOBAL_MOCK_HOOK(ThreadAPI_Join, my_ThreadAPI_Join);
+
+    REGISTER_GLOBAL_MOCK_RETURN(Lock_Init, TEST_LOCK_HANDLE);
+    REGISTER_GLOBAL_MOCK_RETURN(Lock, LOCK_OK);
+    REGISTER_GLOBAL_MOCK_RETURN(Unlock, LOCK_OK);
+    REGISTER_GLOBAL_MOCK_RETURN(Condition_Init, TEST_COND_HANDLE);
+    REGISTER_GLOBAL_MOCK_RETURN(Condition_Post, COND_OK);
+    REGISTER_GLOBAL_MOCK_RETURN(Condition_Wait, COND_TIMEOUT);
+    REGISTER_GLOBAL_MOCK_RETURN(get_time, time(NULL));
+
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(gballoc_malloc, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mallocAndStrcpy_s, __LINE__);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(Lock_Init, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(Condition_Init, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(ThreadAPI_Create, THREADAPI_ERROR);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    g_writerFunc = NULL;
+    g_writerArg = NULL;
+    memset(g_fileContent, 0, sizeof(g_fileContent));
+    remove_capture_files();
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    remove_capture_files();
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/*Tests_SRS_MQTT_CAPTURE_07_001: [If options or options->filePrefix is NULL then mqtt_capture_create shall return NULL.]*/
+TEST_FUNCTION(mqtt_capture_create_options_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_CAPTURE_HANDLE handle = mqtt_capture_create(NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CAPTURE_07_001: [If options or options->filePrefix is NULL then mqtt_capture_create shall return NULL.]*/
+TEST_FUNCTION(mqtt_capture_create_filePrefix_NULL_fail)
+{
+    // arrange
+    MQTT_CAPTURE_OPTIONS options;
+    setup_capture_options(&options);
+    options.filePrefix = NULL;
+
+    // act
+    MQTT_CAPTURE_HANDLE handle = mqtt_capture_create(&options);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CAPTURE_07_002: [mqtt_capture_create shall copy filePrefix, allocate two staging buffers of bufferSize bytes and start the writer thread.]*/
+TEST_FUNCTION(mqtt_capture_create_succeed)
+{
+    // arrange
+    MQTT_CAPTURE_OPTIONS options;
+    setup_capture_options(&options);
+    options.bufferSize = 512;
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(mallocAndStrcpy_s(IGNORED_PTR_ARG, TEST_FILE_PREFIX));
+    STRICT_EXPECTED_CALL(gballoc_malloc(512));
+    STRICT_EXPECTED_CALL(gballoc_malloc(512));
+    STRICT_EXPECTED_CALL(Lock_Init());
+    STRICT_EXPECTED_CALL(Condition_Init());
+    EXPECTED_CALL(ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+
+    // act
+    MQTT_CAPTURE_HANDLE handle = mqtt_capture_create(&options);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_capture_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_CAPTURE_07_004: [If any allocation or the creation of the lock, the condition or the thread fails then mqtt_capture_create shall free everything it allocated and return NULL.]*/
+TEST_FUNCTION(mqtt_capture_create_fail)
+{
+    // arrange
+    MQTT_CAPTURE_OPTIONS options;
+    int negativeTestsInitResult = umock_c_negative_tests_init();
+    ASSERT_ARE_EQUAL(int, 0, negativeTestsInitResult);
+    setup_capture_options(&options);
+    options.bufferSize = 512;
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(mallocAndStrcpy_s(IGNORED_PTR_ARG, TEST_FILE_PREFIX));
+    STRICT_EXPECTED_CALL(gballoc_malloc(512));
+    STRICT_EXPECTED_CALL(gballoc_malloc(512));
+    STRICT_EXPECTED_CALL(Lock_Init());
+    STRICT_EXPECTED_CALL(Condition_Init());
+    EXPECTED_CALL(ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+
+    umock_c_negative_tests_snapshot();
+
+    size_t count = umock_c_negative_tests_call_count();
+    for (size_t index = 0; index < count; index++)
+    {
+        umock_c_negative_tests_reset();
+        umock_c_negative_tests_fail_call(index);
+
+        // act
+        MQTT_CAPTURE_HANDLE handle = mqtt_capture_create(&options);
+
+        // assert
+        ASSERT_IS_NULL(handle);
+    }
+
+    // cleanup
+    umock_c_negative_tests_deinit();
+}
+
+/*Tests_SRS_MQTT_CAPTURE_07_007: [If handle or data is NULL or length is 0 then mqtt_capture_write shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_capture_write_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_capture_write(NULL, MQTT_CAPTURE_OUTGOING, TEST_OUTGOING_BYTES, sizeof(TEST_OUTGOING_BYTES));
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CAPTURE_07_007: [If handle or data is NULL or length is 0 then mqtt_capture_write shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_capture_write_data_NULL_fail)
+{
+    // arrange
+    MQTT_CAPTURE_OPTIONS options;
+    setup_capture_options(&options);
+    MQTT_CAPTURE_HANDLE handle = create_capture(&options);
+
+    // act
+    int result = mqtt_capture_write(handle, MQTT_CAPTURE_OUTGOING, NULL, 4);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_capture_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_CAPTURE_07_007: [If handle or data is NULL or length is 0 then mqtt_capture_write shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_capture_write_length_0_fail)
+{
+    // arrange
+    MQTT_CAPTURE_OPTIONS options;
+    setup_capture_options(&options);
+    MQTT_CAPTURE_HANDLE handle = create_capture(&options);
+
+    // act
+    int result = mqtt_capture_write(handle, MQTT_CAPTURE_OUTGOING, TEST_OUTGOING_BYTES, 0);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_capture_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_CAPTURE_07_008: [mqtt_capture_write shall stage the bytes as pcapng Enhanced Packet Blocks holding synthetic IPv4/TCP segments between the client and brokerPort, without any file I/O, and return 0.]*/
+TEST_FUNCTION(mqtt_capture_write_stages_without_file_io)
+{
+    // arrange
+    MQTT_CAPTURE_OPTIONS options;
+    setup_capture_options(&options);
+    MQTT_CAPTURE_HANDLE handle = create_capture(&options);
+
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+
+    // act
+    int result = mqtt_capture_write(handle, MQTT_CAPTURE_OUTGOING, TEST_OUTGOING_BYTES, sizeof(TEST_OUTGOING_BYTES));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_FALSE(capture_file_exists(0));
+
+    // cleanup
+    mqtt_capture_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_CAPTURE_07_005: [If handle is NULL then mqtt_capture_destroy shall do nothing.]*/
+TEST_FUNCTION(mqtt_capture_destroy_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_capture_destroy(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CAPTURE_07_006: [mqtt_capture_destroy shall stop the writer thread once every staged record is written, close the current file and free all resources.]*/
+/*Tests_SRS_MQTT_CAPTURE_07_009: [The TCP sequence and acknowledgement numbers of each direction shall advance by the bytes recorded in that direction.]*/
+/*Tests_SRS_MQTT_CAPTURE_07_013: [Every file shall be named <filePrefix>_<index>.pcapng and start with a Section Header Block and an Interface Description Block for raw IP with nanosecond timestamps.]*/
+TEST_FUNCTION(mqtt_capture_destroy_writes_pcapng_blocks)
+{
+    // arrange
+    MQTT_CAPTURE_OPTIONS options;
+    size_t offset = TEST_FILE_HEADER_SIZE;
+    setup_capture_options(&options);
+    MQTT_CAPTURE_HANDLE handle = create_capture(&options);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_capture_write(handle, MQTT_CAPTURE_OUTGOING, TEST_OUTGOING_BYTES, sizeof(TEST_OUTGOING_BYTES)));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_capture_write(handle, MQTT_CAPTURE_INCOMING, TEST_INCOMING_BYTES, sizeof(TEST_INCOMING_BYTES)));
+
+    // act
+    mqtt_capture_destroy(handle);
+
+    // assert
+    size_t fileSize = read_capture_file(0);
+    assert_file_header();
+    offset += assert_packet_block(offset, true, 1883, 0, 1, 1, TEST_OUTGOING_BYTES, sizeof(TEST_OUTGOING_BYTES));
+    // The broker side acknowledges everything the client sent so far
+    offset += assert_packet_block(offset, false, 1883, 1, 1, 1 + sizeof(TEST_OUTGOING_BYTES), TEST_INCOMING_BYTES, sizeof(TEST_INCOMING_BYTES));
+    ASSERT_ARE_EQUAL(size_t, offset, fileSize);
+    ASSERT_IS_FALSE(capture_file_exists(1));
+}
+
+/*Tests_SRS_MQTT_CAPTURE_07_003: [A bufferSize, flushIntervalMs or brokerPort of 0 shall select 256 KB, 500 milliseconds and port 1883.]*/
+TEST_FUNCTION(mqtt_capture_uses_broker_port_option)
+{
+    // arrange
+    MQTT_CAPTURE_OPTIONS options;
+    setup_capture_options(&options);
+    options.brokerPort = 8883;
+    MQTT_CAPTURE_HANDLE handle = create_capture(&options);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_capture_write(handle, MQTT_CAPTURE_INCOMING, TEST_INCOMING_BYTES, sizeof(TEST_INCOMING_BYTES)));
+
+    // act
+    mqtt_capture_destroy(handle);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(size_t, 0, read_capture_file(0));
+    (void)assert_packet_block(TEST_FILE_HEADER_SIZE, false, 8883, 0, 1, 1, TEST_INCOMING_BYTES, sizeof(TEST_INCOMING_BYTES));
+}
+
+/*Tests_SRS_MQTT_CAPTURE_07_010: [If the record does not fit in the staging buffer then mqtt_capture_write shall drop it, count it and return a non-zero value without waiting for the writer thread.]*/
+/*Tests_SRS_MQTT_CAPTURE_07_011: [mqtt_capture_write shall wake the writer thread once the staging buffer is half full.]*/
+/*Tests_SRS_MQTT_CAPTURE_07_016: [mqtt_capture_get_dropped_count shall return the number of records dropped because the staging buffer was full.]*/
+TEST_FUNCTION(mqtt_capture_write_full_buffer_drops_record)
+{
+    // arrange
+    MQTT_CAPTURE_OPTIONS options;
+    setup_capture_options(&options);
+    options.bufferSize = 128;
+    MQTT_CAPTURE_HANDLE handle = create_capture(&options);
+
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Condition_Post(TEST_COND_HANDLE));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+
+    // act
+    int result = mqtt_capture_write(handle, MQTT_CAPTURE_OUTGOING, TEST_OUTGOING_BYTES, sizeof(TEST_OUTGOING_BYTES));
+    int droppedResult = mqtt_capture_write(handle, MQTT_CAPTURE_OUTGOING, TEST_OUTGOING_BYTES, sizeof(TEST_OUTGOING_BYTES));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_NOT_EQUAL(int, 0, droppedResult);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_capture_get_dropped_count(handle));
+
+    // cleanup
+    mqtt_capture_destroy(handle);
+    ASSERT_ARE_EQUAL(size_t, TEST_FILE_HEADER_SIZE + 80, read_capture_file(0));
+}
+
+/*Tests_SRS_MQTT_CAPTURE_07_012: [The writer thread shall swap the staging buffers and write the staged records to the file at least every flushIntervalMs.]*/
+/*Tests_SRS_MQTT_CAPTURE_07_014: [When a record would grow the file past maxFileSize the writer thread shall start the next file, and remove the oldest one when more than maxFileCount files exist.]*/
+TEST_FUNCTION(mqtt_capture_rotates_and_removes_oldest_file)
+{
+    // arrange
+    MQTT_CAPTURE_OPTIONS options;
+    size_t index;
+    setup_capture_options(&options);
+    // Room for the file header and one 80 byte record
+    options.maxFileSize = 200;
+    options.maxFileCount = 2;
+    MQTT_CAPTURE_HANDLE handle = create_capture(&options);
+    for (index = 0; index < 3; index++)
+    {
+        ASSERT_ARE_EQUAL(int, 0, mqtt_capture_write(handle, MQTT_CAPTURE_OUTGOING, TEST_OUTGOING_BYTES, sizeof(TEST_OUTGOING_BYTES)));
+    }
+
+    // act
+    mqtt_capture_destroy(handle);
+
+    // assert
+    ASSERT_IS_FALSE(capture_file_exists(0));
+    ASSERT_ARE_EQUAL(size_t, TEST_FILE_HEADER_SIZE + 80, read_capture_file(1));
+    assert_file_header();
+    (void)assert_packet_block(TEST_FILE_HEADER_SIZE, true, 1883, 1, 1 + sizeof(TEST_OUTGOING_BYTES), 1, TEST_OUTGOING_BYTES, sizeof(TEST_OUTGOING_BYTES));
+    ASSERT_ARE_EQUAL(size_t, TEST_FILE_HEADER_SIZE + 80, read_capture_file(2));
+    assert_file_header();
+    (void)assert_packet_block(TEST_FILE_HEADER_SIZE, true, 1883, 2, 1 + 2 * sizeof(TEST_OUTGOING_BYTES), 1, TEST_OUTGOING_BYTES, sizeof(TEST_OUTGOING_BYTES));
+}
+
+/*Tests_SRS_MQTT_CAPTURE_07_015: [If handle is NULL then mqtt_capture_get_dropped_count shall return 0.]*/
+TEST_FUNCTION(mqtt_capture_get_dropped_count_handle_NULL_returns_0)
+{
+    // arrange
+
+    // act
+    size_t result = mqtt_capture_get_dropped_count(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, result);
+}
+
+END_TEST_SUITE(mqtt_capture_ut)
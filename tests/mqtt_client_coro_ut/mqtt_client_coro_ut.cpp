@@ -0,0 +1,581 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+#include "testrunnerswitcher.h"
+#include "umock_c.h"
+#include "umock_c_negative_tests.h"
+#include "umocktypes_charptr.h"
+#include "umocktypes_stdint.h"
+#include "umocktypes_bool.h"
+#include "umocktypes.h"
+#include "umocktypes_c.h"
+
+#define ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_client.h"
+#include "azure_umqtt_c/mqtt_message.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_client_coro.hpp"
+
+using azure_umqtt_c::AsyncClient;
+using azure_umqtt_c::ConnectResult;
+using azure_umqtt_c::Message;
+using azure_umqtt_c::OPERATION_FAILED;
+using azure_umqtt_c::SubscribeResult;
+using azure_umqtt_c::span;
+
+#define TEST_MQTT_CLIENT_HANDLE         (MQTT_CLIENT_HANDLE)0x11
+#define TEST_XIO_HANDLE                 (XIO_HANDLE)0x12
+#define TEST_PACKET_ID                  (uint16_t)0x21
+
+struct TestHandler
+{
+    size_t errorCount = 0;
+
+    void on_message(azure_umqtt_c::MessageView message)
+    {
+        (void)message;
+    }
+    void on_error(MQTT_CLIENT_EVENT_ERROR error)
+    {
+        (void)error;
+        errorCount++;
+    }
+};
+
+using TestAsyncClient = AsyncClient<TestHandler>;
+
+// Runs until the first co_await that suspends and keeps the frame until the test ends
+class TestTask
+{
+public:
+    struct promise_type
+    {
+        TestTask get_return_object() noexcept { return TestTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+
+    explicit TestTask(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+    TestTask(TestTask&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+    TestTask(const TestTask&) = delete;
+    ~TestTask()
+    {
+        if (handle_)
+        {
+            handle_.destroy();
+        }
+    }
+
+    bool done() const noexcept { return handle_.done(); }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+static MQTT_CLIENT_OPTIONS g_mqttOptions;
+static QOS_VALUE g_qosValue;
+
+static ON_MQTT_OPERATION_CALLBACK g_opCallback;
+static void* g_opCallbackCtx;
+static ON_MQTT_ERROR_CALLBACK g_onError;
+static void* g_errorCBCtx;
+
+static MQTT_CLIENT_HANDLE my_mqtt_client_init(ON_MQTT_MESSAGE_RECV_CALLBACK msgRecv, ON_MQTT_OPERATION_CALLBACK opCallback, void* opCallbackCtx, ON_MQTT_ERROR_CALLBACK onErrorCallBack, void* errorCBCtx)
+{
+    (void)msgRecv;
+    g_opCallback = opCallback;
+    g_opCallbackCtx = opCallbackCtx;
+    g_onError = onErrorCallBack;
+    g_errorCBCtx = errorCBCtx;
+    return TEST_MQTT_CLIENT_HANDLE;
+}
+
+// The message handles of the tests are their packet id
+static uint16_t my_mqttmessage_getPacketId(MQTT_MESSAGE_HANDLE handle)
+{
+    return (uint16_t)(uintptr_t)handle;
+}
+
+static QOS_VALUE my_mqttmessage_getQosType(MQTT_MESSAGE_HANDLE handle)
+{
+    (void)handle;
+    return g_qosValue;
+}
+
+static Message make_message(uint16_t packetId)
+{
+    return Message((MQTT_MESSAGE_HANDLE)(uintptr_t)packetId);
+}
+
+static TestTask await_connect(TestAsyncClient& client, ConnectResult* result)
+{
+    *result = co_await client.connect(TEST_XIO_HANDLE, g_mqttOptions);
+}
+
+static TestTask await_publish(TestAsyncClient& client, const Message& message, int* result)
+{
+    *result = co_await client.publish(message);
+}
+
+static TestTask await_subscribe(TestAsyncClient& client, uint16_t packetId, span<SUBSCRIBE_PAYLOAD> subscribeList, span<QOS_VALUE> granted, SubscribeResult* result)
+{
+    *result = co_await client.subscribe(packetId, subscribeList, granted);
+}
+
+static void receive_publish_ack(MQTT_CLIENT_EVENT_RESULT actionResult, uint16_t packetId, MQTT_REASON_CODE reasonCode)
+{
+    PUBLISH_ACK publishAck = { packetId, reasonCode };
+    g_opCallback(TEST_MQTT_CLIENT_HANDLE, actionResult, &publishAck, g_opCallbackCtx);
+}
+
+TEST_DEFINE_ENUM_TYPE(QOS_VALUE, QOS_VALUE_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(QOS_VALUE, QOS_VALUE_VALUES);
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    char temp_str[256];
+    (void)snprintf(temp_str, sizeof(temp_str), "umock_c reported error :%s", ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+    ASSERT_FAIL(temp_str);
+}
+
+BEGIN_TEST_SUITE(mqtt_client_coro_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_charptr_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_bool_register_types());
+
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_CLIENT_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_MESSAGE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(XIO_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_MESSAGE_RECV_CALLBACK, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_OPERATION_CALLBACK, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_ERROR_CALLBACK, void*);
+    REGISTER_TYPE(QOS_VALUE, QOS_VALUE);
+
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_init, my_mqtt_client_init);
+    REGISTER_GLOBAL_MOCK_HOOK(mqttmessage_getPacketId, my_mqttmessage_getPacketId);
+    REGISTER_GLOBAL_MOCK_HOOK(mqttmessage_getQosType, my_mqttmessage_getQosType);
+
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_client_connect, 0);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_client_publish, 0);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_client_subscribe, 0);
+
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_client_connect, __LINE__);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_client_publish, __LINE__);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_client_subscribe, __LINE__);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    g_qosValue = DELIVER_AT_LEAST_ONCE;
+    g_opCallback = NULL;
+    g_opCallbackCtx = NULL;
+    g_onError = NULL;
+    g_errorCBCtx = NULL;
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+TEST_FUNCTION(ConnectAwaiter_resumes_on_connack)
+{
+    // arrange
+    TestHandler handler;
+    TestAsyncClient client(handler);
+    ConnectResult result = { -1, false, CONN_REFUSED_UNKNOWN };
+    CONNECT_ACK connack = { true, CONNECTION_ACCEPTED, MQTT_REASON_SUCCESS, NULL };
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_client_connect(TEST_MQTT_CLIENT_HANDLE, TEST_XIO_HANDLE, &g_mqttOptions));
+    STRICT_EXPECTED_CALL(mqtt_client_dowork(TEST_MQTT_CLIENT_HANDLE));
+
+    // act
+    TestTask task = await_connect(client, &result);
+    ASSERT_IS_FALSE(task.done());
+    g_opCallback(TEST_MQTT_CLIENT_HANDLE, MQTT_CLIENT_ON_CONNACK, &connack, g_opCallbackCtx);
+    // the coroutine is only resumed from dowork, never from inside the callback
+    ASSERT_IS_FALSE(task.done());
+    client.dowork();
+
+    // assert
+    ASSERT_IS_TRUE(task.done());
+    ASSERT_ARE_EQUAL(int, 0, result.result);
+    ASSERT_IS_TRUE(result.sessionPresent);
+    ASSERT_IS_TRUE(result.returnCode == CONNECTION_ACCEPTED);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(ConnectAwaiter_connect_fail_completes_without_suspending)
+{
+    // arrange
+    TestHandler handler;
+    TestAsyncClient client(handler);
+    ConnectResult result = { -1, false, CONNECTION_ACCEPTED };
+    CONNECT_ACK connack = { true, CONNECTION_ACCEPTED, MQTT_REASON_SUCCESS, NULL };
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_client_connect(TEST_MQTT_CLIENT_HANDLE, TEST_XIO_HANDLE, &g_mqttOptions))
+        .SetReturn(__LINE__);
+
+    // act
+    TestTask task = await_connect(client, &result);
+
+    // assert
+    ASSERT_IS_TRUE(task.done());
+    ASSERT_ARE_EQUAL(int, OPERATION_FAILED, result.result);
+    ASSERT_IS_TRUE(result.returnCode == CONN_REFUSED_UNKNOWN);
+    // a late CONNACK no longer refers to the finished awaiter
+    g_opCallback(TEST_MQTT_CLIENT_HANDLE, MQTT_CLIENT_ON_CONNACK, &connack, g_opCallbackCtx);
+    ASSERT_IS_TRUE(result.returnCode == CONN_REFUSED_UNKNOWN);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(PublishAwaiter_qos0_completes_once_sent)
+{
+    // arrange
+    TestHandler handler;
+    TestAsyncClient client(handler);
+    Message message = make_message(TEST_PACKET_ID);
+    int result = -1;
+    g_qosValue = DELIVER_AT_MOST_ONCE;
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(message.get()));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(message.get()));
+    STRICT_EXPECTED_CALL(mqtt_client_publish(TEST_MQTT_CLIENT_HANDLE, message.get()));
+
+    // act
+    TestTask task = await_publish(client, message, &result);
+
+    // assert
+    ASSERT_IS_TRUE(task.done());
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(PublishAwaiter_qos1_resumes_on_puback)
+{
+    // arrange
+    TestHandler handler;
+    TestAsyncClient client(handler);
+    Message message = make_message(TEST_PACKET_ID);
+    int result = -1;
+
+    // act
+    TestTask task = await_publish(client, message, &result);
+    ASSERT_IS_FALSE(task.done());
+    receive_publish_ack(MQTT_CLIENT_ON_PUBLISH_ACK, TEST_PACKET_ID + 1, MQTT_REASON_SUCCESS);
+    client.dowork();
+    ASSERT_IS_FALSE(task.done());
+    receive_publish_ack(MQTT_CLIENT_ON_PUBLISH_ACK, TEST_PACKET_ID, MQTT_REASON_SUCCESS);
+    client.dowork();
+
+    // assert
+    ASSERT_IS_TRUE(task.done());
+    ASSERT_ARE_EQUAL(int, 0, result);
+}
+
+TEST_FUNCTION(PublishAwaiter_qos2_resumes_on_pubcomp)
+{
+    // arrange
+    TestHandler handler;
+    TestAsyncClient client(handler);
+    Message message = make_message(TEST_PACKET_ID);
+    int result = -1;
+    g_qosValue = DELIVER_EXACTLY_ONCE;
+
+    // act
+    TestTask task = await_publish(client, message, &result);
+    receive_publish_ack(MQTT_CLIENT_ON_PUBLISH_RECV, TEST_PACKET_ID, MQTT_REASON_SUCCESS);
+    client.dowork();
+    ASSERT_IS_FALSE(task.done());
+    receive_publish_ack(MQTT_CLIENT_ON_PUBLISH_ACK, TEST_PACKET_ID, MQTT_REASON_SUCCESS);
+    client.dowork();
+    ASSERT_IS_FALSE(task.done());
+    receive_publish_ack(MQTT_CLIENT_ON_PUBLISH_COMP, TEST_PACKET_ID, MQTT_REASON_SUCCESS);
+    client.dowork();
+
+    // assert
+    ASSERT_IS_TRUE(task.done());
+    ASSERT_ARE_EQUAL(int, 0, result);
+}
+
+TEST_FUNCTION(PublishAwaiter_puback_failure_reason_fails)
+{
+    // arrange
+    TestHandler handler;
+    TestAsyncClient client(handler);
+    Message message = make_message(TEST_PACKET_ID);
+    int result = -1;
+
+    // act
+    TestTask task = await_publish(client, message, &result);
+    receive_publish_ack(MQTT_CLIENT_ON_PUBLISH_ACK, TEST_PACKET_ID, MQTT_REASON_QUOTA_EXCEEDED);
+    client.dowork();
+
+    // assert
+    ASSERT_IS_TRUE(task.done());
+    ASSERT_ARE_EQUAL(int, OPERATION_FAILED, result);
+}
+
+TEST_FUNCTION(PublishAwaiter_pubrec_failure_reason_fails_qos2)
+{
+    // arrange
+    TestHandler handler;
+    TestAsyncClient client(handler);
+    Message message = make_message(TEST_PACKET_ID);
+    int result = -1;
+    g_qosValue = DELIVER_EXACTLY_ONCE;
+
+    // act
+    TestTask task = await_publish(client, message, &result);
+    receive_publish_ack(MQTT_CLIENT_ON_PUBLISH_RECV, TEST_PACKET_ID, MQTT_REASON_UNSPECIFIED_ERROR);
+    client.dowork();
+
+    // assert
+    ASSERT_IS_TRUE(task.done());
+    ASSERT_ARE_EQUAL(int, OPERATION_FAILED, result);
+}
+
+TEST_FUNCTION(PublishAwaiter_publish_fail_completes_without_suspending)
+{
+    // arrange
+    TestHandler handler;
+    TestAsyncClient client(handler);
+    Message message = make_message(TEST_PACKET_ID);
+    int result = -1;
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(message.get()));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(message.get()));
+    STRICT_EXPECTED_CALL(mqtt_client_publish(TEST_MQTT_CLIENT_HANDLE, message.get()))
+        .SetReturn(__LINE__);
+
+    // act
+    TestTask task = await_publish(client, message, &result);
+
+    // assert
+    ASSERT_IS_TRUE(task.done());
+    ASSERT_ARE_EQUAL(int, OPERATION_FAILED, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    // the operation is no longer pending, its packet id can be awaited again
+    TestTask retry = await_publish(client, message, &result);
+    receive_publish_ack(MQTT_CLIENT_ON_PUBLISH_ACK, TEST_PACKET_ID, MQTT_REASON_SUCCESS);
+    client.dowork();
+    ASSERT_IS_TRUE(retry.done());
+    ASSERT_ARE_EQUAL(int, 0, result);
+}
+
+TEST_FUNCTION(SubscribeAwaiter_copies_granted_qos)
+{
+    // arrange
+    TestHandler handler;
+    TestAsyncClient client(handler);
+    SUBSCRIBE_PAYLOAD subscribeList[2] = { { "topic/a", DELIVER_AT_LEAST_ONCE }, { "topic/b", DELIVER_EXACTLY_ONCE } };
+    QOS_VALUE granted[2] = { DELIVER_FAILURE, DELIVER_FAILURE };
+    QOS_VALUE qosReturn[3] = { DELIVER_AT_LEAST_ONCE, DELIVER_AT_MOST_ONCE, DELIVER_EXACTLY_ONCE };
+    SUBSCRIBE_ACK suback = { TEST_PACKET_ID, qosReturn, 3 };
+    SubscribeResult result = { -1, { 0, NULL, 0 } };
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_client_subscribe(TEST_MQTT_CLIENT_HANDLE, TEST_PACKET_ID, subscribeList, 2));
+    STRICT_EXPECTED_CALL(mqtt_client_dowork(TEST_MQTT_CLIENT_HANDLE));
+
+    // act
+    TestTask task = await_subscribe(client, TEST_PACKET_ID, subscribeList, granted, &result);
+    ASSERT_IS_FALSE(task.done());
+    g_opCallback(TEST_MQTT_CLIENT_HANDLE, MQTT_CLIENT_ON_SUBSCRIBE_ACK, &suback, g_opCallbackCtx);
+    client.dowork();
+
+    // assert
+    ASSERT_IS_TRUE(task.done());
+    ASSERT_ARE_EQUAL(int, 0, result.result);
+    ASSERT_ARE_EQUAL(int, TEST_PACKET_ID, result.suback.packetId);
+    ASSERT_ARE_EQUAL(void_ptr, granted, result.suback.qosReturn);
+    ASSERT_ARE_EQUAL(size_t, 2, result.suback.qosCount);
+    ASSERT_ARE_EQUAL(QOS_VALUE, DELIVER_AT_LEAST_ONCE, granted[0]);
+    ASSERT_ARE_EQUAL(QOS_VALUE, DELIVER_AT_MOST_ONCE, granted[1]);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(SubscribeAwaiter_subscribe_fail_completes_without_suspending)
+{
+    // arrange
+    TestHandler handler;
+    TestAsyncClient client(handler);
+    SUBSCRIBE_PAYLOAD subscribeList[1] = { { "topic/a", DELIVER_AT_LEAST_ONCE } };
+    SubscribeResult result = { -1, { 0, NULL, 0 } };
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_client_subscribe(TEST_MQTT_CLIENT_HANDLE, TEST_PACKET_ID, subscribeList, 1))
+        .SetReturn(__LINE__);
+
+    // act
+    TestTask task = await_subscribe(client, TEST_PACKET_ID, subscribeList, span<QOS_VALUE>(), &result);
+
+    // assert
+    ASSERT_IS_TRUE(task.done());
+    ASSERT_ARE_EQUAL(int, OPERATION_FAILED, result.result);
+    ASSERT_ARE_EQUAL(size_t, 0, result.suback.qosCount);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(fail_pending_on_error_fails_every_operation)
+{
+    // arrange
+    TestHandler handler;
+    TestAsyncClient client(handler);
+    Message message = make_message(TEST_PACKET_ID);
+    SUBSCRIBE_PAYLOAD subscribeList[1] = { { "topic/a", DELIVER_AT_LEAST_ONCE } };
+    ConnectResult connectResult = { -1, false, CONN_REFUSED_UNKNOWN };
+    int publishResult = -1;
+    SubscribeResult subscribeResult = { -1, { 0, NULL, 0 } };
+
+    TestTask connectTask = await_connect(client, &connectResult);
+    TestTask publishTask = await_publish(client, message, &publishResult);
+    TestTask subscribeTask = await_subscribe(client, TEST_PACKET_ID + 1, subscribeList, span<QOS_VALUE>(), &subscribeResult);
+
+    // act
+    g_onError(TEST_MQTT_CLIENT_HANDLE, MQTT_CLIENT_NO_PING_RESPONSE, g_errorCBCtx);
+    client.dowork();
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, handler.errorCount);
+    ASSERT_IS_TRUE(connectTask.done());
+    ASSERT_IS_TRUE(publishTask.done());
+    ASSERT_IS_TRUE(subscribeTask.done());
+    ASSERT_ARE_EQUAL(int, OPERATION_FAILED, connectResult.result);
+    ASSERT_ARE_EQUAL(int, OPERATION_FAILED, publishResult);
+    ASSERT_ARE_EQUAL(int, OPERATION_FAILED, subscribeResult.result);
+}
+
+TEST_FUNCTION(fail_pending_on_disconnect_fails_every_operation)
+{
+    // arrange
+    TestHandler handler;
+    TestAsyncClient client(handler);
+    Message first = make_message(TEST_PACKET_ID);
+    Message second = make_message(TEST_PACKET_ID + 1);
+    int firstResult = -1;
+    int secondResult = -1;
+
+    TestTask firstTask = await_publish(client, first, &firstResult);
+    TestTask secondTask = await_publish(client, second, &secondResult);
+
+    // act
+    g_opCallback(TEST_MQTT_CLIENT_HANDLE, MQTT_CLIENT_ON_DISCONNECT, NULL, g_opCallbackCtx);
+    client.dowork();
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, handler.errorCount);
+    ASSERT_IS_TRUE(firstTask.done());
+    ASSERT_IS_TRUE(secondTask.done());
+    ASSERT_ARE_EQUAL(int, OPERATION_FAILED, firstResult);
+    ASSERT_ARE_EQUAL(int, OPERATION_FAILED, secondResult);
+}
+
+TEST_FUNCTION(bucket_collision_completes_the_matching_operation)
+{
+    // arrange
+    TestHandler handler;
+    TestAsyncClient client(handler);
+    // 1, 257 and 513 share a bucket of the pending table
+    Message first = make_message(1);
+    Message second = make_message(257);
+    Message third = make_message(513);
+    int firstResult = -1;
+    int secondResult = -1;
+    int thirdResult = -1;
+
+    TestTask firstTask = await_publish(client, first, &firstResult);
+    TestTask secondTask = await_publish(client, second, &secondResult);
+    TestTask thirdTask = await_publish(client, third, &thirdResult);
+
+    // act
+    receive_publish_ack(MQTT_CLIENT_ON_PUBLISH_ACK, 257, MQTT_REASON_SUCCESS);
+    client.dowork();
+
+    // assert
+    ASSERT_IS_FALSE(firstTask.done());
+    ASSERT_IS_TRUE(secondTask.done());
+    ASSERT_IS_FALSE(thirdTask.done());
+    ASSERT_ARE_EQUAL(int, 0, secondResult);
+
+    receive_publish_ack(MQTT_CLIENT_ON_PUBLISH_ACK, 513, MQTT_REASON_QUOTA_EXCEEDED);
+    receive_publish_ack(MQTT_CLIENT_ON_PUBLISH_ACK, 1, MQTT_REASON_SUCCESS);
+    client.dowork();
+
+    ASSERT_IS_TRUE(firstTask.done());
+    ASSERT_IS_TRUE(thirdTask.done());
+    ASSERT_ARE_EQUAL(int, 0, firstResult);
+    ASSERT_ARE_EQUAL(int, OPERATION_FAILED, thirdResult);
+}
+
+TEST_FUNCTION(bucket_collision_matches_the_operation_type)
+{
+    // arrange
+    TestHandler handler;
+    TestAsyncClient client(handler);
+    Message message = make_message(1);
+    SUBSCRIBE_PAYLOAD subscribeList[1] = { { "topic/a", DELIVER_AT_LEAST_ONCE } };
+    QOS_VALUE qosReturn[1] = { DELIVER_AT_LEAST_ONCE };
+    SUBSCRIBE_ACK suback = { 1, qosReturn, 1 };
+    int publishResult = -1;
+    SubscribeResult subscribeResult = { -1, { 0, NULL, 0 } };
+
+    TestTask publishTask = await_publish(client, message, &publishResult);
+    TestTask subscribeTask = await_subscribe(client, 1, subscribeList, span<QOS_VALUE>(), &subscribeResult);
+
+    // act
+    receive_publish_ack(MQTT_CLIENT_ON_PUBLISH_ACK, 1, MQTT_REASON_SUCCESS);
+    client.dowork();
+
+    // assert
+    ASSERT_IS_TRUE(publishTask.done());
+    ASSERT_IS_FALSE(subscribeTask.done());
+
+    g_opCallback(TEST_MQTT_CLIENT_HANDLE, MQTT_CLIENT_ON_SUBSCRIBE_ACK, &suback, g_opCallbackCtx);
+    client.dowork();
+
+    ASSERT_IS_TRUE(subscribeTask.done());
+    ASSERT_ARE_EQUAL(int, 0, subscribeResult.result);
+}
+
+END_TEST_SUITE(mqtt_client_coro_ut)
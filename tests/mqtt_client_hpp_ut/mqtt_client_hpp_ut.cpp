@@ -0,0 +1,528 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "testrunnerswitcher.h"
+#include "umock_c.h"
+#include "umock_c_negative_tests.h"
+#include "umocktypes_charptr.h"
+#include "umocktypes_stdint.h"
+#include "umocktypes_bool.h"
+#include "umocktypes.h"
+#include "umocktypes_c.h"
+
+#define ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_client.h"
+#include "azure_umqtt_c/mqtt_message.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_client.hpp"
+
+using azure_umqtt_c::Client;
+using azure_umqtt_c::Message;
+using azure_umqtt_c::MessageView;
+using azure_umqtt_c::byte_view;
+using azure_umqtt_c::span;
+
+#define TEST_MQTT_CLIENT_HANDLE         (MQTT_CLIENT_HANDLE)0x11
+#define TEST_OTHER_CLIENT_HANDLE        (MQTT_CLIENT_HANDLE)0x12
+#define TEST_MESSAGE_HANDLE             (MQTT_MESSAGE_HANDLE)0x21
+#define TEST_OTHER_MESSAGE_HANDLE       (MQTT_MESSAGE_HANDLE)0x22
+#define TEST_CLONE_MESSAGE_HANDLE       (MQTT_MESSAGE_HANDLE)0x23
+#define TEST_PACKET_ID                  (uint16_t)0x31
+
+static const char* TEST_TOPIC_NAME = "devices/dev1/messages";
+static uint8_t TEST_PAYLOAD_BYTES[] = { 'd', 'a', 't', 'a' };
+static APP_PAYLOAD TEST_APP_PAYLOAD = { TEST_PAYLOAD_BYTES, sizeof(TEST_PAYLOAD_BYTES) };
+
+static ON_MQTT_MESSAGE_RECV_CALLBACK g_msgRecv;
+static ON_MQTT_OPERATION_CALLBACK g_opCallback;
+static void* g_opCallbackCtx;
+static ON_MQTT_ERROR_CALLBACK g_onError;
+static void* g_errorCBCtx;
+
+struct TestHandler
+{
+    size_t messageCount = 0;
+    std::string_view topic;
+    size_t payloadLength = 0;
+    size_t operationCount = 0;
+    MQTT_CLIENT_EVENT_RESULT lastResult = MQTT_CLIENT_ON_CONNACK;
+    size_t errorCount = 0;
+    MQTT_CLIENT_EVENT_ERROR lastError = MQTT_CLIENT_CONNECTION_ERROR;
+
+    void on_message(MessageView message)
+    {
+        messageCount++;
+        topic = message.topic();
+        payloadLength = message.payload().size();
+    }
+    void on_operation(MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo)
+    {
+        (void)msgInfo;
+        operationCount++;
+        lastResult = actionResult;
+    }
+    void on_error(MQTT_CLIENT_EVENT_ERROR error)
+    {
+        errorCount++;
+        lastError = error;
+    }
+};
+
+struct MessageOnlyHandler
+{
+    size_t messageCount = 0;
+
+    void on_message(MessageView message)
+    {
+        (void)message;
+        messageCount++;
+    }
+};
+
+static MQTT_CLIENT_HANDLE my_mqtt_client_init(ON_MQTT_MESSAGE_RECV_CALLBACK msgRecv, ON_MQTT_OPERATION_CALLBACK opCallback, void* opCallbackCtx, ON_MQTT_ERROR_CALLBACK onErrorCallBack, void* errorCBCtx)
+{
+    g_msgRecv = msgRecv;
+    g_opCallback = opCallback;
+    g_opCallbackCtx = opCallbackCtx;
+    g_onError = onErrorCallBack;
+    g_errorCBCtx = errorCBCtx;
+    return TEST_MQTT_CLIENT_HANDLE;
+}
+
+TEST_DEFINE_ENUM_TYPE(QOS_VALUE, QOS_VALUE_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(QOS_VALUE, QOS_VALUE_VALUES);
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    char temp_str[256];
+    (void)snprintf(temp_str, sizeof(temp_str), "umock_c reported error :%s", ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+    ASSERT_FAIL(temp_str);
+}
+
+BEGIN_TEST_SUITE(mqtt_client_hpp_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_charptr_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_bool_register_types());
+
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_CLIENT_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_MESSAGE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_MESSAGE_RECV_CALLBACK, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_OPERATION_CALLBACK, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_ERROR_CALLBACK, void*);
+    REGISTER_TYPE(QOS_VALUE, QOS_VALUE);
+
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_init, my_mqtt_client_init);
+
+    REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_getTopicName, TEST_TOPIC_NAME);
+    REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_getApplicationMsg, &TEST_APP_PAYLOAD);
+    REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_clone, TEST_CLONE_MESSAGE_HANDLE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_create, TEST_MESSAGE_HANDLE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_client_publish, 0);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_client_subscribe, 0);
+
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_client_init, NULL);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    g_msgRecv = NULL;
+    g_opCallback = NULL;
+    g_opCallbackCtx = NULL;
+    g_onError = NULL;
+    g_errorCBCtx = NULL;
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+TEST_FUNCTION(Client_create_succeed)
+{
+    // arrange
+    TestHandler handler;
+    STRICT_EXPECTED_CALL(mqtt_client_init(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &handler, IGNORED_PTR_ARG, &handler));
+    STRICT_EXPECTED_CALL(mqtt_client_deinit(TEST_MQTT_CLIENT_HANDLE));
+
+    // act
+    {
+        Client client = Client::create(handler);
+
+        // assert
+        ASSERT_IS_TRUE((bool)client);
+        ASSERT_ARE_EQUAL(void_ptr, TEST_MQTT_CLIENT_HANDLE, client.get());
+        ASSERT_IS_NOT_NULL((void*)g_msgRecv);
+        ASSERT_IS_NOT_NULL((void*)g_opCallback);
+        ASSERT_IS_NOT_NULL((void*)g_onError);
+    }
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(Client_create_without_on_error_passes_NULL)
+{
+    // arrange
+    MessageOnlyHandler handler;
+    STRICT_EXPECTED_CALL(mqtt_client_init(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &handler, NULL, &handler));
+    STRICT_EXPECTED_CALL(mqtt_client_deinit(TEST_MQTT_CLIENT_HANDLE));
+
+    // act
+    {
+        Client client = Client::create(handler);
+
+        // assert
+        ASSERT_IS_TRUE((bool)client);
+        ASSERT_IS_NULL((void*)g_onError);
+
+        // an operation without on_operation in the handler is ignored
+        g_opCallback(TEST_MQTT_CLIENT_HANDLE, MQTT_CLIENT_ON_CONNACK, NULL, g_opCallbackCtx);
+        g_msgRecv(TEST_MESSAGE_HANDLE, g_opCallbackCtx);
+        ASSERT_ARE_EQUAL(size_t, 1, handler.messageCount);
+    }
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(Client_create_fail)
+{
+    // arrange
+    TestHandler handler;
+    STRICT_EXPECTED_CALL(mqtt_client_init(IGNORED_PTR_ARG, IGNORED_PTR_ARG, &handler, IGNORED_PTR_ARG, &handler))
+        .SetReturn(NULL);
+
+    // act
+    {
+        Client client = Client::create(handler);
+
+        // assert
+        ASSERT_IS_FALSE((bool)client);
+        ASSERT_IS_NULL(client.get());
+    }
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(Client_callbacks_reach_handler)
+{
+    // arrange
+    TestHandler handler;
+    Client client = Client::create(handler);
+    umock_c_reset_all_calls();
+
+    // act
+    g_msgRecv(TEST_MESSAGE_HANDLE, g_opCallbackCtx);
+    g_opCallback(TEST_MQTT_CLIENT_HANDLE, MQTT_CLIENT_ON_SUBSCRIBE_ACK, NULL, g_opCallbackCtx);
+    g_onError(TEST_MQTT_CLIENT_HANDLE, MQTT_CLIENT_NO_PING_RESPONSE, g_errorCBCtx);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, handler.messageCount);
+    ASSERT_IS_TRUE(handler.topic == TEST_TOPIC_NAME);
+    ASSERT_ARE_EQUAL(size_t, sizeof(TEST_PAYLOAD_BYTES), handler.payloadLength);
+    ASSERT_ARE_EQUAL(size_t, 1, handler.operationCount);
+    ASSERT_IS_TRUE(handler.lastResult == MQTT_CLIENT_ON_SUBSCRIBE_ACK);
+    ASSERT_ARE_EQUAL(size_t, 1, handler.errorCount);
+    ASSERT_IS_TRUE(handler.lastError == MQTT_CLIENT_NO_PING_RESPONSE);
+}
+
+TEST_FUNCTION(Client_move_constructor_transfers_handle)
+{
+    // arrange
+    TestHandler handler;
+
+    {
+        Client source = Client::create(handler);
+        umock_c_reset_all_calls();
+        STRICT_EXPECTED_CALL(mqtt_client_deinit(TEST_MQTT_CLIENT_HANDLE));
+
+        // act
+        {
+            Client target(std::move(source));
+
+            // assert
+            ASSERT_IS_FALSE((bool)source);
+            ASSERT_ARE_EQUAL(void_ptr, TEST_MQTT_CLIENT_HANDLE, target.get());
+        }
+    }
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(Client_move_assignment_deinits_previous_handle)
+{
+    // arrange
+    TestHandler handler;
+
+    {
+        Client source = Client::create(handler);
+        Client target(TEST_OTHER_CLIENT_HANDLE);
+        umock_c_reset_all_calls();
+        STRICT_EXPECTED_CALL(mqtt_client_deinit(TEST_OTHER_CLIENT_HANDLE));
+        STRICT_EXPECTED_CALL(mqtt_client_deinit(TEST_MQTT_CLIENT_HANDLE));
+
+        // act
+        target = std::move(source);
+
+        // assert
+        ASSERT_IS_FALSE((bool)source);
+        ASSERT_ARE_EQUAL(void_ptr, TEST_MQTT_CLIENT_HANDLE, target.get());
+    }
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(Client_release_does_not_deinit)
+{
+    // arrange
+    TestHandler handler;
+    MQTT_CLIENT_HANDLE released;
+
+    {
+        Client client = Client::create(handler);
+        umock_c_reset_all_calls();
+
+        // act
+        released = client.release();
+
+        // assert
+        ASSERT_IS_FALSE((bool)client);
+    }
+    ASSERT_ARE_EQUAL(void_ptr, TEST_MQTT_CLIENT_HANDLE, released);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(Client_publish_passes_message_handle)
+{
+    // arrange
+    TestHandler handler;
+    Client client = Client::create(handler);
+    Message message(TEST_MESSAGE_HANDLE);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_client_publish(TEST_MQTT_CLIENT_HANDLE, TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_client_publish(TEST_MQTT_CLIENT_HANDLE, TEST_OTHER_MESSAGE_HANDLE));
+
+    // act
+    int ownedResult = client.publish(message);
+    int viewResult = client.publish(MessageView(TEST_OTHER_MESSAGE_HANDLE));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, ownedResult);
+    ASSERT_ARE_EQUAL(int, 0, viewResult);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(Client_subscribe_passes_span)
+{
+    // arrange
+    TestHandler handler;
+    Client client = Client::create(handler);
+    SUBSCRIBE_PAYLOAD subscribeList[2] = { { "topic/a", DELIVER_AT_MOST_ONCE }, { "topic/b", DELIVER_AT_LEAST_ONCE } };
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_client_subscribe(TEST_MQTT_CLIENT_HANDLE, TEST_PACKET_ID, subscribeList, 2));
+
+    // act
+    int result = client.subscribe(TEST_PACKET_ID, subscribeList);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(MessageView_topic_succeed)
+{
+    // arrange
+    MessageView view(TEST_MESSAGE_HANDLE);
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+
+    // act
+    std::string_view topic = view.topic();
+
+    // assert
+    ASSERT_ARE_EQUAL(void_ptr, TEST_TOPIC_NAME, topic.data());
+    ASSERT_ARE_EQUAL(size_t, strlen(TEST_TOPIC_NAME), topic.size());
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(MessageView_topic_NULL_returns_empty_view)
+{
+    // arrange
+    MessageView view(TEST_MESSAGE_HANDLE);
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE))
+        .SetReturn(NULL);
+
+    // act
+    std::string_view topic = view.topic();
+
+    // assert
+    ASSERT_IS_TRUE(topic.empty());
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(MessageView_payload_succeed)
+{
+    // arrange
+    MessageView view(TEST_MESSAGE_HANDLE);
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+
+    // act
+    byte_view payload = view.payload();
+
+    // assert
+    ASSERT_ARE_EQUAL(void_ptr, TEST_PAYLOAD_BYTES, payload.data());
+    ASSERT_ARE_EQUAL(size_t, sizeof(TEST_PAYLOAD_BYTES), payload.size());
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(MessageView_payload_NULL_returns_empty_view)
+{
+    // arrange
+    MessageView view(TEST_MESSAGE_HANDLE);
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE))
+        .SetReturn(NULL);
+
+    // act
+    byte_view payload = view.payload();
+
+    // assert
+    ASSERT_IS_TRUE(payload.empty());
+    ASSERT_IS_NULL(payload.data());
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(MessageView_clone_succeed)
+{
+    // arrange
+    MessageView view(TEST_MESSAGE_HANDLE);
+    STRICT_EXPECTED_CALL(mqttmessage_clone(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(TEST_CLONE_MESSAGE_HANDLE));
+
+    // act
+    {
+        Message copy = view.clone();
+
+        // assert
+        ASSERT_IS_TRUE((bool)copy);
+        ASSERT_ARE_EQUAL(void_ptr, TEST_CLONE_MESSAGE_HANDLE, copy.get());
+    }
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(MessageView_clone_fail)
+{
+    // arrange
+    MessageView view(TEST_MESSAGE_HANDLE);
+    STRICT_EXPECTED_CALL(mqttmessage_clone(TEST_MESSAGE_HANDLE))
+        .SetReturn(NULL);
+
+    // act
+    {
+        Message copy = view.clone();
+
+        // assert
+        ASSERT_IS_FALSE((bool)copy);
+    }
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(Message_create_passes_payload)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(mqttmessage_create(TEST_PACKET_ID, TEST_TOPIC_NAME, DELIVER_EXACTLY_ONCE, TEST_PAYLOAD_BYTES, sizeof(TEST_PAYLOAD_BYTES)));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(TEST_MESSAGE_HANDLE));
+
+    // act
+    {
+        Message message = Message::create(TEST_PACKET_ID, TEST_TOPIC_NAME, DELIVER_EXACTLY_ONCE, TEST_PAYLOAD_BYTES);
+
+        // assert
+        ASSERT_ARE_EQUAL(void_ptr, TEST_MESSAGE_HANDLE, message.get());
+    }
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(Message_move_constructor_transfers_handle)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(TEST_MESSAGE_HANDLE));
+
+    {
+        Message source(TEST_MESSAGE_HANDLE);
+
+        // act
+        Message target(std::move(source));
+
+        // assert
+        ASSERT_IS_FALSE((bool)source);
+        ASSERT_ARE_EQUAL(void_ptr, TEST_MESSAGE_HANDLE, target.get());
+    }
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(Message_move_assignment_destroys_previous_handle)
+{
+    // arrange
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(TEST_OTHER_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(TEST_MESSAGE_HANDLE));
+
+    {
+        Message source(TEST_MESSAGE_HANDLE);
+        Message target(TEST_OTHER_MESSAGE_HANDLE);
+
+        // act
+        target = std::move(source);
+
+        // assert
+        ASSERT_IS_FALSE((bool)source);
+        ASSERT_ARE_EQUAL(void_ptr, TEST_MESSAGE_HANDLE, target.get());
+    }
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+TEST_FUNCTION(Message_release_does_not_destroy)
+{
+    // arrange
+    MQTT_MESSAGE_HANDLE released;
+
+    {
+        Message message(TEST_MESSAGE_HANDLE);
+
+        // act
+        released = message.release();
+
+        // assert
+        ASSERT_IS_FALSE((bool)message);
+    }
+    ASSERT_ARE_EQUAL(void_ptr, TEST_MESSAGE_HANDLE, released);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+END_TEST_SUITE(mqtt_client_hpp_ut)
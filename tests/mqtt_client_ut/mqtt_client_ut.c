@@ -41,9 +41,14 @@ static void my_gballoc_free(void* ptr)
 #include "azure_c_shared_utility/buffer_.h"
 #include "azure_c_shared_utility/strings.h"
 #include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/singlylinkedlist.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/vector.h"
 
 #include "azure_umqtt_c/mqtt_codec.h"
 #include "azure_umqtt_c/mqtt_message.h"
+#include "azure_umqtt_c/mqtt_capture.h"
+#include "azure_umqtt_c/mqtt_persist.h"
 #include "azure_c_shared_utility/gballoc.h"
 #include "azure_c_shared_utility/platform.h"
 
@@ -74,6 +79,10 @@ extern "C"
 
 TEST_DEFINE_ENUM_TYPE(QOS_VALUE, QOS_VALUE_VALUES);
 IMPLEMENT_UMOCK_C_ENUM_TYPE(QOS_VALUE, QOS_VALUE_VALUES);
+TEST_DEFINE_ENUM_TYPE(MQTT_CAPTURE_DIRECTION, MQTT_CAPTURE_DIRECTION_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(MQTT_CAPTURE_DIRECTION, MQTT_CAPTURE_DIRECTION_VALUES);
+TEST_DEFINE_ENUM_TYPE(LOCK_RESULT, LOCK_RESULT_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(LOCK_RESULT, LOCK_RESULT_VALUES);
 
 static const char* TEST_USERNAME = "testuser";
 static const char* TEST_PASSWORD = "testpassword";
@@ -95,12 +104,34 @@ static BUFFER_HANDLE TEST_BUFFER_HANDLE = (BUFFER_HANDLE)0x15;
 static const uint16_t TEST_KEEP_ALIVE_INTERVAL = 20;
 static const uint16_t TEST_PACKET_ID = (uint16_t)0x1234;
 static const unsigned char* TEST_BUFFER_U_CHAR = (const unsigned char*)0x19;
+static const MQTT_CAPTURE_HANDLE TEST_CAPTURE_HANDLE = (MQTT_CAPTURE_HANDLE)0x1a;
+static const MQTT_PERSIST_HANDLE TEST_PERSIST_HANDLE = (MQTT_PERSIST_HANDLE)0x1b;
+static const SINGLYLINKEDLIST_HANDLE TEST_LIST_HANDLE = (SINGLYLINKEDLIST_HANDLE)0x1c;
+static const LIST_ITEM_HANDLE TEST_LIST_ITEM_HANDLE = (LIST_ITEM_HANDLE)0x1d;
+static const LOCK_HANDLE TEST_LOCK_HANDLE = (LOCK_HANDLE)0x1e;
+static const VECTOR_HANDLE TEST_VECTOR_HANDLE = (VECTOR_HANDLE)0x1f;
+static const MQTT_PUBLISH_TEMPLATE_HANDLE TEST_PUBLISH_TEMPLATE_HANDLE = (MQTT_PUBLISH_TEMPLATE_HANDLE)0x20;
 
 static bool g_operationCallbackInvoked;
 static bool g_errorCallbackInvoked;
 static bool g_msgRecvCallbackInvoked;
-static bool g_mqtt_codec_publish_func_fail;
+static MQTT_ACK_TOKEN g_ackToken;
 static tickcounter_ms_t g_current_ms;
+static const void* g_offline_item;
+static bool g_batchCompleteInvoked;
+static QOS_VALUE g_batchQosReturn[2];
+static size_t g_batchQosCount;
+static MQTT_PROPERTIES g_decoded_properties;
+static const char* g_publish_topic;
+static uint16_t g_publish_alias;
+static const char* g_message_topic;
+static ON_PUBLISH_STREAM_CALLBACK g_publishStream;
+static size_t g_chunkBytes;
+static size_t g_finalChunks;
+static size_t g_publishChunkCalls;
+static int g_publishChunkResult;
+static size_t g_codecPublishes;
+static void* g_packetCompleteCtx;
 ON_PACKET_COMPLETE_CALLBACK g_packetComplete;
 ON_IO_OPEN_COMPLETE g_openComplete;
 ON_BYTES_RECEIVED g_bytesRecv;
@@ -128,11 +159,33 @@ extern "C" {
 
     static MQTTCODEC_HANDLE my_mqtt_codec_create(ON_PACKET_COMPLETE_CALLBACK packetComplete, void* callContext)
     {
-        (void)callContext;
         g_packetComplete = packetComplete;
+        g_packetCompleteCtx = callContext;
         return TEST_MQTTCODEC_HANDLE;
     }
 
+    static int my_mqtt_codec_bytesReceived(MQTTCODEC_HANDLE handle, const unsigned char* buffer, size_t size)
+    {
+        size_t index;
+        (void)handle;
+        (void)buffer;
+        (void)size;
+        for (index = 0; index < g_codecPublishes; index++)
+        {
+            g_packetComplete(g_packetCompleteCtx, PUBLISH_TYPE, 0x0a, TEST_BUFFER_HANDLE);
+        }
+        return 0;
+    }
+
+    static int my_mqtt_codec_set_publish_stream(MQTTCODEC_HANDLE handle, size_t threshold, bool includeProperties, ON_PUBLISH_STREAM_CALLBACK publishStream)
+    {
+        (void)handle;
+        (void)threshold;
+        (void)includeProperties;
+        g_publishStream = publishStream;
+        return 0;
+    }
+
     static int my_xio_open(XIO_HANDLE handle, ON_IO_OPEN_COMPLETE on_io_open_complete, void* on_io_open_complete_context, ON_BYTES_RECEIVED on_bytes_received, void* on_bytes_received_context, ON_IO_ERROR on_io_error, void* on_io_error_context)
     {
         (void)handle;
@@ -163,45 +216,45 @@ extern "C" {
         return 0;
     }
 
-    static BUFFER_HANDLE my_mqtt_codec_publishComplete(uint16_t packetId)
+    static BUFFER_HANDLE my_mqtt_codec_publish_v5(QOS_VALUE qosValue, bool duplicateMsg, bool serverRetain, uint16_t packetId, const char* topicName, const uint8_t* msgBuffer, size_t buffLen, const MQTT_PROPERTIES* properties, STRING_HANDLE trace_log)
     {
+        (void)qosValue;
+        (void)duplicateMsg;
+        (void)serverRetain;
         (void)packetId;
-        BUFFER_HANDLE buffer_result = TEST_BUFFER_HANDLE;
-        if (g_mqtt_codec_publish_func_fail)
-        {
-            buffer_result = NULL;
-        }
-        return buffer_result;
+        (void)msgBuffer;
+        (void)buffLen;
+        (void)trace_log;
+        g_publish_topic = topicName;
+        g_publish_alias = (properties != NULL && MQTT_PROPERTY_IS_SET(properties, MQTT_PROPERTY_TOPIC_ALIAS)) ? properties->topicAlias : 0;
+        return TEST_BUFFER_HANDLE;
     }
 
-    static BUFFER_HANDLE my_mqtt_codec_publishRelease(uint16_t packetId)
+    static int my_mqtt_codec_decode_properties(const uint8_t* buffer, size_t length, MQTT_PROPERTIES* properties, size_t* consumed)
     {
-        (void)packetId;
-        BUFFER_HANDLE buffer_result = TEST_BUFFER_HANDLE;
-        if (g_mqtt_codec_publish_func_fail)
-        {
-            buffer_result = NULL;
-        }
-        return buffer_result;
+        (void)buffer;
+        *properties = g_decoded_properties;
+        *consumed = length;
+        return 0;
     }
 
     static MQTT_MESSAGE_HANDLE my_mqttmessage_create(uint16_t packetId, const char* topicName, QOS_VALUE qosValue, const uint8_t* appMsg, size_t appMsgLength)
     {
         (void)packetId;
-        (void)topicName;
         (void)qosValue;
         (void)appMsg;
         (void)appMsgLength;
+        g_message_topic = topicName;
         return (MQTT_MESSAGE_HANDLE)my_gballoc_malloc(1);
     }
 
     static MQTT_MESSAGE_HANDLE my_mqttmessage_create_in_place(uint16_t packetId, const char* topicName, QOS_VALUE qosValue, const uint8_t* appMsg, size_t appMsgLength)
     {
         (void)packetId;
-        (void)topicName;
         (void)qosValue;
         (void)appMsg;
         (void)appMsgLength;
+        g_message_topic = topicName;
         return (MQTT_MESSAGE_HANDLE)my_gballoc_malloc(1);
     }
 
@@ -240,6 +293,40 @@ extern "C" {
         return (STRING_HANDLE)my_gballoc_malloc(1);
     }
 
+    // The offline queue tests never hold more than one publish
+    static LIST_ITEM_HANDLE my_singlylinkedlist_add(SINGLYLINKEDLIST_HANDLE list, const void* item)
+    {
+        (void)list;
+        g_offline_item = item;
+        return TEST_LIST_ITEM_HANDLE;
+    }
+
+    static LIST_ITEM_HANDLE my_singlylinkedlist_get_head_item(SINGLYLINKEDLIST_HANDLE list)
+    {
+        (void)list;
+        return (g_offline_item != NULL) ? TEST_LIST_ITEM_HANDLE : NULL;
+    }
+
+    static const void* my_singlylinkedlist_item_get_value(LIST_ITEM_HANDLE item_handle)
+    {
+        (void)item_handle;
+        return g_offline_item;
+    }
+
+    static LIST_ITEM_HANDLE my_singlylinkedlist_find(SINGLYLINKEDLIST_HANDLE list, LIST_MATCH_FUNCTION match_function, const void* match_context)
+    {
+        (void)list;
+        return (g_offline_item != NULL && match_function(TEST_LIST_ITEM_HANDLE, match_context)) ? TEST_LIST_ITEM_HANDLE : NULL;
+    }
+
+    static int my_singlylinkedlist_remove(SINGLYLINKEDLIST_HANDLE list, LIST_ITEM_HANDLE item_handle)
+    {
+        (void)list;
+        (void)item_handle;
+        g_offline_item = NULL;
+        return 0;
+    }
+
     static int TEST_mallocAndStrcpy_s(char** destination, const char* source)
     {
         size_t src_len = strlen(source);
@@ -279,6 +366,7 @@ TEST_SUITE_INITIALIZE(suite_init)
     ASSERT_ARE_EQUAL(int, 0, result);
 
     REGISTER_UMOCK_ALIAS_TYPE(ON_PACKET_COMPLETE_CALLBACK, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_PUBLISH_STREAM_CALLBACK, void*);
     REGISTER_UMOCK_ALIAS_TYPE(TICK_COUNTER_HANDLE, void*);
     REGISTER_UMOCK_ALIAS_TYPE(MQTTCODEC_HANDLE, void*);
     REGISTER_UMOCK_ALIAS_TYPE(XIO_HANDLE, void*);
@@ -289,9 +377,22 @@ TEST_SUITE_INITIALIZE(suite_init)
     REGISTER_UMOCK_ALIAS_TYPE(ON_BYTES_RECEIVED, void*);
     REGISTER_UMOCK_ALIAS_TYPE(ON_IO_ERROR, void*);
     REGISTER_UMOCK_ALIAS_TYPE(STRING_HANDLE, void*);
-    REGISTER_UMOCK_ALIAS_TYPE(ON_IO_CLOSE_COMPLETE, void*)
+    REGISTER_UMOCK_ALIAS_TYPE(ON_IO_CLOSE_COMPLETE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_CAPTURE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_PERSIST_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(SINGLYLINKEDLIST_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(LIST_ITEM_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(LIST_MATCH_FUNCTION, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_PERSISTED_PACKET, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_MESSAGE_RECV_ACK_CALLBACK, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_ACK_TOKEN, uint64_t);
+    REGISTER_UMOCK_ALIAS_TYPE(LOCK_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(VECTOR_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_PUBLISH_TEMPLATE_HANDLE, void*);
 
     REGISTER_TYPE(QOS_VALUE, QOS_VALUE);
+    REGISTER_TYPE(MQTT_CAPTURE_DIRECTION, MQTT_CAPTURE_DIRECTION);
+    REGISTER_TYPE(LOCK_RESULT, LOCK_RESULT);
 
     REGISTER_GLOBAL_MOCK_HOOK(mallocAndStrcpy_s, TEST_mallocAndStrcpy_s);
 
@@ -306,6 +407,9 @@ TEST_SUITE_INITIALIZE(suite_init)
     REGISTER_GLOBAL_MOCK_RETURN(STRING_c_str, "Test");
 
     REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_create, my_mqtt_codec_create);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_set_publish_stream, my_mqtt_codec_set_publish_stream);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_set_publish_stream, __FAILURE__);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_set_max_packet_size, __FAILURE__);
     REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_create, NULL);
 
     REGISTER_GLOBAL_MOCK_HOOK(xio_open, my_xio_open);
@@ -316,18 +420,31 @@ TEST_SUITE_INITIALIZE(suite_init)
     REGISTER_GLOBAL_MOCK_HOOK(tickcounter_get_current_ms, my_tickcounter_get_current_ms);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(tickcounter_get_current_ms, __FAILURE__);
 
-    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_publishRelease, my_mqtt_codec_publishRelease);
-    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_publishComplete, my_mqtt_codec_publishComplete);
     REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_connect, TEST_BUFFER_HANDLE);
 
     REGISTER_GLOBAL_MOCK_RETURN(get_time, time(NULL) );
 
     REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_publish, TEST_BUFFER_HANDLE);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_publish, NULL);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_publish_template_encode, TEST_BUFFER_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_publish_template_encode, NULL);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_publish_template_get_qos, DELIVER_AT_MOST_ONCE);
     REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_subscribe, TEST_BUFFER_HANDLE);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_subscribe, NULL);
     REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_unsubscribe, TEST_BUFFER_HANDLE);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_unsubscribe, NULL);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_publish_v5, my_mqtt_codec_publish_v5);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_publish_v5, NULL);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_subscribe_v5, TEST_BUFFER_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_subscribe_v5, NULL);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_unsubscribe_v5, TEST_BUFFER_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_unsubscribe_v5, NULL);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_publish_header, TEST_BUFFER_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_publish_header, NULL);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_publish_header_v5, TEST_BUFFER_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_publish_header_v5, NULL);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_decode_properties, my_mqtt_codec_decode_properties);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_decode_properties, __FAILURE__);
     REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_disconnect, TEST_BUFFER_HANDLE);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_disconnect, NULL);
     REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_ping, TEST_BUFFER_HANDLE);
@@ -337,7 +454,17 @@ TEST_SUITE_INITIALIZE(suite_init)
     REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_publishReceived, TEST_BUFFER_HANDLE);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_publishReceived, NULL);
     REGISTER_GLOBAL_MOCK_RETURN(mqtt_codec_bytesReceived, 0);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_codec_bytesReceived, my_mqtt_codec_bytesReceived);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_codec_bytesReceived, __FAILURE__);
+    REGISTER_GLOBAL_MOCK_RETURN(Lock_Init, TEST_LOCK_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(Lock_Init, NULL);
+    REGISTER_GLOBAL_MOCK_RETURN(Lock, LOCK_OK);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(Lock, LOCK_ERROR);
+    REGISTER_GLOBAL_MOCK_RETURN(Unlock, LOCK_OK);
+    REGISTER_GLOBAL_MOCK_RETURN(VECTOR_create, TEST_VECTOR_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(VECTOR_create, NULL);
+    REGISTER_GLOBAL_MOCK_RETURN(VECTOR_push_back, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(VECTOR_push_back, __FAILURE__);
     REGISTER_GLOBAL_MOCK_RETURN(xio_close, 0);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(xio_close, __FAILURE__);
 
@@ -349,6 +476,8 @@ TEST_SUITE_INITIALIZE(suite_init)
 
     REGISTER_GLOBAL_MOCK_RETURN(BUFFER_u_char, (unsigned char*)TEST_BUFFER_U_CHAR);
     REGISTER_GLOBAL_MOCK_RETURN(BUFFER_length, 11);
+    REGISTER_GLOBAL_MOCK_RETURN(BUFFER_create, TEST_BUFFER_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(BUFFER_create, NULL);
 
     REGISTER_GLOBAL_MOCK_HOOK(mqttmessage_create, my_mqttmessage_create);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqttmessage_create, NULL);
@@ -370,6 +499,27 @@ TEST_SUITE_INITIALIZE(suite_init)
 
     REGISTER_GLOBAL_MOCK_RETURN(mallocAndStrcpy_s, 0);
     REGISTER_GLOBAL_MOCK_FAIL_RETURN(mallocAndStrcpy_s, __FAILURE__);
+
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_capture_write, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_capture_write, __FAILURE__);
+
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_persist_append, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_persist_append, __FAILURE__);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_persist_remove, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_persist_remove, __FAILURE__);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_persist_mark_released, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_persist_mark_released, __FAILURE__);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_persist_foreach, 0);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_persist_foreach, __FAILURE__);
+
+    REGISTER_GLOBAL_MOCK_RETURN(singlylinkedlist_create, TEST_LIST_HANDLE);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(singlylinkedlist_create, NULL);
+    REGISTER_GLOBAL_MOCK_HOOK(singlylinkedlist_add, my_singlylinkedlist_add);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(singlylinkedlist_add, NULL);
+    REGISTER_GLOBAL_MOCK_HOOK(singlylinkedlist_get_head_item, my_singlylinkedlist_get_head_item);
+    REGISTER_GLOBAL_MOCK_HOOK(singlylinkedlist_item_get_value, my_singlylinkedlist_item_get_value);
+    REGISTER_GLOBAL_MOCK_HOOK(singlylinkedlist_remove, my_singlylinkedlist_remove);
+    REGISTER_GLOBAL_MOCK_HOOK(singlylinkedlist_find, my_singlylinkedlist_find);
 }
 
 TEST_SUITE_CLEANUP(suite_cleanup)
@@ -386,11 +536,25 @@ TEST_FUNCTION_INITIALIZE(method_init)
     }
 
     g_current_ms = 0;
+    g_offline_item = NULL;
+    g_batchCompleteInvoked = false;
+    g_batchQosCount = 0;
+    memset(&g_decoded_properties, 0, sizeof(g_decoded_properties));
+    g_publish_topic = NULL;
+    g_publish_alias = 0;
+    g_message_topic = NULL;
+    g_publishStream = NULL;
+    g_chunkBytes = 0;
+    g_finalChunks = 0;
+    g_publishChunkCalls = 0;
+    g_publishChunkResult = 0;
     g_packetComplete = NULL;
+    g_packetCompleteCtx = NULL;
+    g_codecPublishes = 0;
     g_operationCallbackInvoked = false;
     g_errorCallbackInvoked = false;
     g_msgRecvCallbackInvoked = false;
-    g_mqtt_codec_publish_func_fail = false;
+    g_ackToken = 0;
     g_openComplete = NULL;
     g_onCompleteCtx = NULL;
     g_sendComplete = NULL;
@@ -429,12 +593,8 @@ static void setup_publish_callback_mocks(unsigned char* PUBLISH_RESP, size_t len
     STRICT_EXPECTED_CALL(mqttmessage_create_in_place(TEST_PACKET_ID, IGNORED_PTR_ARG, qos_value, IGNORED_PTR_ARG, TEST_APP_PAYLOAD.length));
     STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_PTR_ARG, true));
     STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_PTR_ARG, true));
-    STRICT_EXPECTED_CALL(mqtt_codec_publishReceived(TEST_PACKET_ID));
-    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG)).SetReturn(length);
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG)).SetReturn(PUBLISH_RESP);
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
     EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
-    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
     STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_PTR_ARG));
     EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
 }
@@ -469,12 +629,8 @@ static void setup_mqtt_clear_options_mocks(MQTT_CLIENT_OPTIONS* mqttOptions)
 
 static void setup_mqtt_client_disconnect_mocks(MQTT_CLIENT_OPTIONS* mqttOptions)
 {
-    STRICT_EXPECTED_CALL(mqtt_codec_disconnect());
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
-    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
-    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 2, IGNORED_PTR_ARG, IGNORED_PTR_ARG)).IgnoreArgument_buffer();
 
     setup_mqtt_clear_options_mocks(mqttOptions);
 }
@@ -516,6 +672,11 @@ static void setup_mqtt_client_connect_mocks(MQTT_CLIENT_OPTIONS* mqttOptions)
         STRICT_EXPECTED_CALL(mallocAndStrcpy_s(IGNORED_PTR_ARG, mqttOptions->password));
     }
 
+    if (mqttOptions->maximumPacketSize != 0)
+    {
+        STRICT_EXPECTED_CALL(mqtt_codec_set_max_packet_size(TEST_MQTTCODEC_HANDLE, mqttOptions->maximumPacketSize));
+    }
+
     STRICT_EXPECTED_CALL(xio_open(TEST_IO_HANDLE, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
         .IgnoreArgument(2)
         .IgnoreArgument(3)
@@ -529,7 +690,6 @@ static void setup_mqtt_client_connect_mocks(MQTT_CLIENT_OPTIONS* mqttOptions)
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG))
         .IgnoreArgument_current_ms();
     EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
-    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
 }
 
 static void setup_mqtt_client_connect_retry_mocks(MQTT_CLIENT_OPTIONS* mqttOptions)
@@ -577,6 +737,71 @@ static void TestRecvCallback(MQTT_MESSAGE_HANDLE msgHandle, void* context)
     g_msgRecvCallbackInvoked = true;
 }
 
+static void TestRecvAckCallback(MQTT_MESSAGE_HANDLE msgHandle, MQTT_ACK_TOKEN ackToken, void* context)
+{
+    (void)msgHandle;
+    (void)context;
+    g_msgRecvCallbackInvoked = true;
+    g_ackToken = ackToken;
+}
+
+static void TestChunkCallback(MQTT_MESSAGE_HANDLE msgHandle, const uint8_t* chunk, size_t chunkLength, size_t payloadOffset, size_t payloadLength, void* context)
+{
+    (void)msgHandle;
+    (void)chunk;
+    (void)context;
+    g_chunkBytes += chunkLength;
+    if (payloadOffset + chunkLength == payloadLength)
+    {
+        g_finalChunks++;
+    }
+}
+
+#define TEST_ENCODED_BYTE   0xAB
+
+static size_t TestTransformBound(size_t length)
+{
+    return length;
+}
+
+static int TestTransformEncode(const uint8_t* payload, size_t length, uint8_t* buffer, size_t bufferSize, size_t* resultLength)
+{
+    (void)payload;
+    (void)length;
+    (void)bufferSize;
+    buffer[0] = TEST_ENCODED_BYTE;
+    *resultLength = 1;
+    return 0;
+}
+
+static int TestTransformDecode(const uint8_t* payload, size_t length, uint8_t* buffer, size_t bufferSize, size_t* resultLength)
+{
+    int result;
+    if (length != 1 || payload[0] != TEST_ENCODED_BYTE || bufferSize < TEST_APP_PAYLOAD.length)
+    {
+        result = __FAILURE__;
+    }
+    else
+    {
+        memcpy(buffer, TEST_APP_PAYLOAD.message, TEST_APP_PAYLOAD.length);
+        *resultLength = TEST_APP_PAYLOAD.length;
+        result = 0;
+    }
+    return result;
+}
+
+static const MQTT_PAYLOAD_TRANSFORM TEST_PAYLOAD_TRANSFORM = { "application/test", TestTransformBound, TestTransformEncode, TestTransformDecode, 0 };
+
+static int TestPublishChunkCallback(uint8_t* buffer, size_t bufferSize, size_t payloadOffset, size_t* chunkLength, void* context)
+{
+    (void)payloadOffset;
+    (void)context;
+    g_publishChunkCalls++;
+    (void)memset(buffer, 0x5a, bufferSize);
+    *chunkLength = bufferSize;
+    return g_publishChunkResult;
+}
+
 static void TestOpCallback(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_RESULT actionResult, const void* msgInfo, void* context)
 {
     (void)handle;
@@ -691,6 +916,19 @@ static void TestErrorCallback(MQTT_CLIENT_HANDLE handle, MQTT_CLIENT_EVENT_ERROR
     }
 }
 
+static void TestSubscribeBatchComplete(MQTT_CLIENT_HANDLE handle, const QOS_VALUE* qosReturn, size_t qosCount, void* context)
+{
+    size_t index;
+    (void)handle;
+    (void)context;
+    g_batchCompleteInvoked = true;
+    g_batchQosCount = qosCount;
+    for (index = 0; index < qosCount && index < sizeof(g_batchQosReturn) / sizeof(g_batchQosReturn[0]); index++)
+    {
+        g_batchQosReturn[index] = qosReturn[index];
+    }
+}
+
 static void SetupMqttLibOptions(MQTT_CLIENT_OPTIONS* options, const char* clientId,
     const char* willMsg,
     const char* willTopic,
@@ -724,6 +962,37 @@ static void make_connack(MQTT_CLIENT_HANDLE mqttHandle, MQTT_CLIENT_OPTIONS* mqt
     g_packetComplete(mqttHandle, CONNACK_TYPE, 0, connack_handle);
 }
 
+static void make_connack_v5(MQTT_CLIENT_HANDLE mqttHandle, MQTT_CLIENT_OPTIONS* mqttOptions)
+{
+    mqttOptions->protocolVersion = MQTT_PROTOCOL_VERSION_5;
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, mqttOptions);
+
+    unsigned char CONNACK_RESP[] = { 0x0, 0x0, 0x3, 0x22, 0x00, 0x0a };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
+    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, TEST_BUFFER_HANDLE);
+}
+
+static void setup_mqtt_client_publish_v5_mocks(void)
+{
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+}
+
+static void setup_mqtt_client_publish_v5_send_mocks(void)
+{
+    EXPECTED_CALL(mqtt_codec_publish_v5(DELIVER_AT_LEAST_ONCE, true, true, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+}
+
 /* mqttclient_connect */
 
 /*Tests_SRS_MQTT_CLIENT_07_003: [mqttclient_init shall allocate MQTTCLIENT_DATA_INSTANCE and return the MQTTCLIENT_HANDLE on success.]*/
@@ -1597,6 +1866,87 @@ TEST_FUNCTION(mqtt_client_publish_succeeds)
     mqtt_client_deinit(mqttHandle);
 }
 
+/*Tests_SRS_MQTT_CLIENT_07_104: [If the parameter handle or publishTemplate is NULL then mqtt_client_publish_template shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_publish_template_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_publish_template(NULL, TEST_PUBLISH_TEMPLATE_HANDLE, TEST_PACKET_ID, TEST_APP_PAYLOAD.message, TEST_APP_PAYLOAD.length);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_104: [If the parameter handle or publishTemplate is NULL then mqtt_client_publish_template shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_publish_template_template_NULL_fail)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_publish_template(mqttHandle, NULL, TEST_PACKET_ID, TEST_APP_PAYLOAD.message, TEST_APP_PAYLOAD.length);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_105: [mqtt_client_publish_template shall encode the PUBLISH with mqtt_codec_publish_template_encode, with an empty property list in MQTT 5.0 mode, and send, queue or reject it like mqtt_client_publish.]*/
+TEST_FUNCTION(mqtt_client_publish_template_encode_fail)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_codec_publish_template_get_qos(TEST_PUBLISH_TEMPLATE_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish_template_encode(TEST_PUBLISH_TEMPLATE_HANDLE, false, TEST_PACKET_ID, false, TEST_APP_PAYLOAD.message, TEST_APP_PAYLOAD.length, NULL))
+        .SetReturn((BUFFER_HANDLE)NULL);
+
+    // act
+    int result = mqtt_client_publish_template(mqttHandle, TEST_PUBLISH_TEMPLATE_HANDLE, TEST_PACKET_ID, TEST_APP_PAYLOAD.message, TEST_APP_PAYLOAD.length);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_105: [mqtt_client_publish_template shall encode the PUBLISH with mqtt_codec_publish_template_encode, with an empty property list in MQTT 5.0 mode, and send, queue or reject it like mqtt_client_publish.]*/
+TEST_FUNCTION(mqtt_client_publish_template_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_codec_publish_template_get_qos(TEST_PUBLISH_TEMPLATE_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish_template_encode(TEST_PUBLISH_TEMPLATE_HANDLE, false, TEST_PACKET_ID, false, TEST_APP_PAYLOAD.message, TEST_APP_PAYLOAD.length, NULL));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish_template(mqttHandle, TEST_PUBLISH_TEMPLATE_HANDLE, TEST_PACKET_ID, TEST_APP_PAYLOAD.message, TEST_APP_PAYLOAD.length);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
 TEST_FUNCTION(mqtt_client_disconnect_handle_NULL_fail)
 {
     // arrange
@@ -1625,7 +1975,7 @@ TEST_FUNCTION(mqtt_client_disconnect_fail)
 
     umock_c_negative_tests_snapshot();
 
-    size_t calls_cannot_fail[] = { 1, 2, 5, 6, 7, 8, 9, 10 };
+    size_t calls_cannot_fail[] = { 2, 3, 4, 5, 6, 7 };
 
     // act
     size_t count = umock_c_negative_tests_call_count();
@@ -1760,6 +2110,7 @@ TEST_FUNCTION(mqtt_client_dowork_ping_handle_NULL_fails)
 /*Tests_SRS_MQTT_CLIENT_07_024: [mqtt_client_dowork shall call the xio_dowork function to complete operations.]*/
 /*Tests_SRS_MQTT_CLIENT_07_025: [mqtt_client_dowork shall retrieve the the last packet send value and ...]*/
 /*Tests_SRS_MQTT_CLIENT_07_026: [if keepAliveInternal is > 0 and the send time is greater than the MQTT KeepAliveInterval then it shall construct an MQTT PINGREQ packet.]*/
+/*Tests_SRS_MQTT_CLIENT_07_103: [The PINGREQ and DISCONNECT packets shall be sent from the constant packets of mqtt_codec.]*/
 TEST_FUNCTION(mqtt_client_dowork_ping_succeeds)
 {
     // arrange
@@ -1783,12 +2134,8 @@ TEST_FUNCTION(mqtt_client_dowork_ping_succeeds)
 
     EXPECTED_CALL(xio_dowork(IGNORED_PTR_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
-    STRICT_EXPECTED_CALL(mqtt_codec_ping());
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
-    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
-    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 2, IGNORED_PTR_ARG, IGNORED_PTR_ARG)).IgnoreArgument_buffer();
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
 
     // act
@@ -2218,7 +2565,7 @@ TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_EXACTLY_ONCE_fail)
     umock_c_negative_tests_snapshot();
 
     // act
-    size_t calls_cannot_fail[] = { 0, 1, 7, 8, 11, 12, 13 };
+    size_t calls_cannot_fail[] = { 0, 1, 8, 9 };
     size_t count = umock_c_negative_tests_call_count();
     for (size_t index = 0; index < count; index++)
     {
@@ -2234,7 +2581,7 @@ TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_EXACTLY_ONCE_fail)
         sprintf(tmp_msg, "IoTHubClient_LL_Create failure in test %zu/%zu", index, count);
         g_packetComplete(mqttHandle, PUBLISH_TYPE, flag, publish_handle);
 
-        if (index == 2 || index == 3 || index == 4 || index == 5 || index == 6)
+        if (index == 2 || index == 3 || index == 4 || index == 5)
             ASSERT_IS_TRUE(g_errorCallbackInvoked);
     }
 
@@ -2263,12 +2610,8 @@ TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_AT_LEAST_ONCE_succeeds)
     STRICT_EXPECTED_CALL(mqttmessage_create_in_place(TEST_PACKET_ID, IGNORED_PTR_ARG, DELIVER_AT_LEAST_ONCE, IGNORED_PTR_ARG, TEST_APP_PAYLOAD.length));
     STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_PTR_ARG, true));
     STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_PTR_ARG, false));
-    STRICT_EXPECTED_CALL(mqtt_codec_publishAck(TEST_PACKET_ID));
-    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
-    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
-    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 4, IGNORED_PTR_ARG, IGNORED_PTR_ARG)).IgnoreArgument_buffer();
     STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_PTR_ARG));
     EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
 
@@ -2303,12 +2646,8 @@ TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_AT_LEAST_ONCE_no_body_suc
     STRICT_EXPECTED_CALL(mqttmessage_create_in_place(TEST_PACKET_ID, IGNORED_PTR_ARG, DELIVER_AT_LEAST_ONCE, IGNORED_PTR_ARG, 0));
     STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_PTR_ARG, true));
     STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_PTR_ARG, false));
-    STRICT_EXPECTED_CALL(mqtt_codec_publishAck(TEST_PACKET_ID));
-    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
-    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
-    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 4, IGNORED_PTR_ARG, IGNORED_PTR_ARG)).IgnoreArgument_buffer();
     STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_PTR_ARG));
     EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
 
@@ -2457,6 +2796,7 @@ TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_ACK_succeeds)
 }
 
 /*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
+/*Tests_SRS_MQTT_CLIENT_07_102: [The PUBACK, PUBREC, PUBREL and PUBCOMP packets shall be built from the constant templates of mqtt_codec by setting their packet id, without allocating.]*/
 TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RECEIVE_succeeds)
 {
     // arrange
@@ -2475,52 +2815,14 @@ TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RECEIVE_succeeds)
     BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
     STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
     STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_ACK_RESP);
-    EXPECTED_CALL(mqtt_codec_publishRelease(IGNORED_NUM_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
-    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
-    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
-
-    // act
-    g_packetComplete(mqttHandle, PUBREC_TYPE, 0, packet_handle);
-
-    // assert
-    ASSERT_IS_TRUE(g_operationCallbackInvoked);
-    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-
-    // cleanup
-    mqtt_client_deinit(mqttHandle);
-}
-
-/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RECEIVE_fails)
-{
-    // arrange
-    unsigned char PUBLISH_ACK_RESP[] = { 0x12, 0x34 };
-    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData;
-    PUBLISH_ACK puback ={ 0 };
-    puback.packetId = 0x1234;
-
-    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_RECV;
-    testData.msgInfo = &puback;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
-    umock_c_reset_all_calls();
-
-    BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_ACK_RESP);
-    EXPECTED_CALL(mqtt_codec_publishRelease(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 4, IGNORED_PTR_ARG, IGNORED_PTR_ARG)).IgnoreArgument_buffer();
 
     // act
-    g_mqtt_codec_publish_func_fail = true;
     g_packetComplete(mqttHandle, PUBREC_TYPE, 0, packet_handle);
 
     // assert
     ASSERT_IS_TRUE(g_operationCallbackInvoked);
-    ASSERT_IS_TRUE(g_errorCallbackInvoked);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
@@ -2546,12 +2848,8 @@ TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RELEASE_succeeds)
     BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
     STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
     STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_ACK_RESP);
-    EXPECTED_CALL(mqtt_codec_publishComplete(IGNORED_NUM_ARG));
-    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
-    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
-    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 4, IGNORED_PTR_ARG, IGNORED_PTR_ARG)).IgnoreArgument_buffer();
 
     // act
     g_packetComplete(mqttHandle, PUBREL_TYPE, 0, packet_handle);
@@ -2564,48 +2862,6 @@ TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RELEASE_succeeds)
     mqtt_client_deinit(mqttHandle);
 }
 
-/*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
-TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_RELEASE_fails)
-{
-    // arrange
-    unsigned char PUBLISH_ACK_RESP[] ={ 0x12, 0x34 };
-    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
-    TEST_COMPLETE_DATA_INSTANCE testData;
-    PUBLISH_ACK puback ={ 0 };
-    puback.packetId = 0x1234;
-
-    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_REL;
-    testData.msgInfo = &puback;
-
-    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
-    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
-    make_connack(mqttHandle, &mqttOptions);
-    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
-    umock_c_reset_all_calls();
-
-    BUFFER_HANDLE packet_handle = TEST_BUFFER_HANDLE;
-    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
-    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_ACK_RESP);
-    EXPECTED_CALL(mqtt_codec_publishComplete(IGNORED_NUM_ARG));
-    STRICT_EXPECTED_CALL(xio_close(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
-    for (size_t index = 0; index < MAX_CLOSE_RETRIES; index++)
-    {
-        STRICT_EXPECTED_CALL(xio_dowork(IGNORED_PTR_ARG));
-        STRICT_EXPECTED_CALL(ThreadAPI_Sleep(CLOSE_SLEEP_VALUE));
-    }
-
-    // act
-    g_mqtt_codec_publish_func_fail = true;
-    g_packetComplete(mqttHandle, PUBREL_TYPE, 0, packet_handle);
-
-    // assert
-    ASSERT_IS_TRUE(g_errorCallbackInvoked);
-    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
-
-    // cleanup
-    mqtt_client_deinit(mqttHandle);
-}
-
 /*Test_SRS_MQTT_CLIENT_07_029: [If the actionResult parameter are of types PUBACK_TYPE, PUBREC_TYPE, PUBREL_TYPE or PUBCOMP_TYPE then the msgInfo value shall be a PUBLISH_ACK structure.]*/
 TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_COMPLETE_succeeds)
 {
@@ -2849,23 +3105,41 @@ TEST_FUNCTION(mqtt_client_recvCompleteCallback_PINGRESP_succeeds)
     mqtt_client_deinit(mqttHandle);
 }
 
-TEST_FUNCTION(mqtt_client_set_trace_succeeds)
+/*Tests_SRS_MQTT_CLIENT_07_066: [When the server sends a DISCONNECT the client shall no longer be connected and shall report MQTT_CLIENT_CONNECTION_ERROR.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_DISCONNECT_no_reason_code_succeeds)
 {
     // arrange
     MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
     umock_c_reset_all_calls();
 
     // act
-    mqtt_client_set_trace(mqttHandle, true, true);
+    g_packetComplete(mqttHandle, DISCONNECT_TYPE, 0, NULL);
 
     // assert
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
     ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
 
     // cleanup
     mqtt_client_deinit(mqttHandle);
 }
 
-TEST_FUNCTION(mqtt_client_set_trace_traceOn_NULL_fail)
+TEST_FUNCTION(mqtt_client_set_trace_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    mqtt_client_set_trace(mqttHandle, true, true);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+TEST_FUNCTION(mqtt_client_set_trace_traceOn_NULL_fail)
 {
     // arrange
 
@@ -2940,15 +3214,11 @@ TEST_FUNCTION(mqtt_client_trace_PUBLISH_succeeds)
     STRICT_EXPECTED_CALL(get_time(IGNORED_PTR_ARG));
     STRICT_EXPECTED_CALL(STRING_c_str(IGNORED_PTR_ARG));
 #endif
-    STRICT_EXPECTED_CALL(mqtt_codec_publishReceived(TEST_PACKET_ID)).SetReturn((BUFFER_HANDLE)0x111111);
-    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG)).SetReturn(length);
-    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG)).SetReturn(PUBLISH_RESP);
     STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
     EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
 #ifdef ENABLE_RAW_TRACE
     STRICT_EXPECTED_CALL(get_time(IGNORED_PTR_ARG));
 #endif
-    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
     STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_PTR_ARG));
 #ifndef NO_LOGGING    
     STRICT_EXPECTED_CALL(STRING_delete(IGNORED_PTR_ARG));
@@ -3082,4 +3352,2066 @@ TEST_FUNCTION(mqtt_client_trace_UNSUBSCRIBE_ACK_succeeds)
     mqtt_client_deinit(mqttHandle);
 }
 
+/*Tests_SRS_MQTT_CLIENT_07_038: [If the parameter handle is NULL then mqtt_client_set_capture shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_capture_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_set_capture(NULL, TEST_CAPTURE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_039: [mqtt_client_set_capture shall record every byte sent and received by the client into captureHandle, a NULL captureHandle stops the capture.]*/
+TEST_FUNCTION(mqtt_client_set_capture_publish_records_outgoing_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    int result = mqtt_client_set_capture(mqttHandle, TEST_CAPTURE_HANDLE);
+    ASSERT_ARE_EQUAL(int, 0, result);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_MOST_ONCE, true, true, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(mqtt_capture_write(TEST_CAPTURE_HANDLE, MQTT_CAPTURE_OUTGOING, TEST_BUFFER_U_CHAR, 11));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_039: [mqtt_client_set_capture shall record every byte sent and received by the client into captureHandle, a NULL captureHandle stops the capture.]*/
+TEST_FUNCTION(mqtt_client_set_capture_bytes_received_records_incoming_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    (void)mqtt_client_set_capture(mqttHandle, TEST_CAPTURE_HANDLE);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_capture_write(TEST_CAPTURE_HANDLE, MQTT_CAPTURE_INCOMING, TEST_BUFFER_U_CHAR, 1));
+    EXPECTED_CALL(mqtt_codec_bytesReceived(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+
+    // act
+    g_bytesRecv(g_bytesRecvCtx, TEST_BUFFER_U_CHAR, 1);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_040: [If the parameter handle is NULL then mqtt_client_set_persistence shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_persistence_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_set_persistence(NULL, TEST_PERSIST_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_041: [mqtt_client_set_persistence shall store every QoS 1 and 2 PUBLISH packet in persistHandle until it is acknowledged, a NULL persistHandle disables persistence.]*/
+TEST_FUNCTION(mqtt_client_set_persistence_publish_appends_packet_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    int result = mqtt_client_set_persistence(mqttHandle, TEST_PERSIST_HANDLE);
+    ASSERT_ARE_EQUAL(int, 0, result);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_persist_append(TEST_PERSIST_HANDLE, TEST_PACKET_ID, TEST_BUFFER_U_CHAR, 11));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_044: [If the QoS 1 or 2 PUBLISH packet cannot be persisted then mqtt_client_publish shall return a non-zero value without sending it.]*/
+TEST_FUNCTION(mqtt_client_set_persistence_publish_append_fail)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_persistence(mqttHandle, TEST_PERSIST_HANDLE);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_persist_append(TEST_PERSIST_HANDLE, TEST_PACKET_ID, TEST_BUFFER_U_CHAR, 11)).SetReturn(__FAILURE__);
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_043: [On PUBACK, PUBCOMP or a PUBREC with a failure reason code the client shall remove the packet from the persistent store, on any other PUBREC it shall mark the packet as released.]*/
+TEST_FUNCTION(mqtt_client_set_persistence_PUBACK_removes_packet_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_ACK_RESP[] = { 0x12, 0x34 };
+    size_t length = sizeof(PUBLISH_ACK_RESP) / sizeof(PUBLISH_ACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    PUBLISH_ACK puback = { 0 };
+    puback.packetId = 0x1234;
+
+    testData.actionResult = MQTT_CLIENT_ON_PUBLISH_ACK;
+    testData.msgInfo = &puback;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    (void)mqtt_client_set_persistence(mqttHandle, TEST_PERSIST_HANDLE);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_ACK_RESP);
+    STRICT_EXPECTED_CALL(mqtt_persist_remove(TEST_PERSIST_HANDLE, 0x1234));
+
+    // act
+    g_packetComplete(mqttHandle, PUBACK_TYPE, 0, TEST_BUFFER_HANDLE);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_043: [On PUBACK, PUBCOMP or a PUBREC with a failure reason code the client shall remove the packet from the persistent store, on any other PUBREC it shall mark the packet as released.]*/
+/*Tests_SRS_MQTT_CLIENT_07_113: [A PUBREC with a failure reason code shall end the QoS 2 exchange, no PUBREL shall be sent.]*/
+TEST_FUNCTION(mqtt_client_set_persistence_v5_PUBREC_failure_removes_packet_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x0, 0x0, 0x0 };
+    unsigned char PUBREC_RESP[] = { 0x12, 0x34, 0x80 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.protocolVersion = MQTT_PROTOCOL_VERSION_5;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_persistence(mqttHandle, TEST_PERSIST_HANDLE);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(CONNACK_RESP));
+    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, TEST_BUFFER_HANDLE);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(PUBREC_RESP));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBREC_RESP);
+    STRICT_EXPECTED_CALL(mqtt_persist_remove(TEST_PERSIST_HANDLE, 0x1234));
+
+    // act
+    g_packetComplete(mqttHandle, PUBREC_TYPE, 0, TEST_BUFFER_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_042: [When the CONNACK is accepted and useCleanSession is false the client shall resend every persisted packet in order, PUBLISH packets with the DUP flag set and released packets as a PUBREL.]*/
+TEST_FUNCTION(mqtt_client_set_persistence_CONNACK_replays_packets_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    TEST_COMPLETE_DATA_INSTANCE testData;
+
+    CONNECT_ACK connack = { 0 };
+    connack.isSessionPresent = true;
+    connack.returnCode = CONNECTION_ACCEPTED;
+    testData.actionResult = MQTT_CLIENT_ON_CONNACK;
+    testData.msgInfo = &connack;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    (void)mqtt_client_set_persistence(mqttHandle, TEST_PERSIST_HANDLE);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
+    STRICT_EXPECTED_CALL(mqtt_persist_foreach(TEST_PERSIST_HANDLE, IGNORED_PTR_ARG, mqttHandle)).IgnoreArgument(2);
+
+    // act
+    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, TEST_BUFFER_HANDLE);
+
+    // assert
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_045: [If the parameter handle is NULL then mqtt_client_set_offline_queue shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_offline_queue_handle_NULL_fail)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+
+    // act
+    int result = mqtt_client_set_offline_queue(NULL, &options);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_046: [While the client is not connected, or queued publishes are still draining, mqtt_client_publish shall add the encoded publish to the offline queue.]*/
+TEST_FUNCTION(mqtt_client_set_offline_queue_publish_while_disconnected_queues_succeeds)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    int result = mqtt_client_set_offline_queue(mqttHandle, &options);
+    ASSERT_ARE_EQUAL(int, 0, result);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(singlylinkedlist_add(TEST_LIST_HANDLE, IGNORED_PTR_ARG));
+
+    // act
+    result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_client_get_offline_queue_count(mqttHandle));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_049: [If the new publish does not fit in the budget then it shall be dropped and mqtt_client_publish shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_offline_queue_drop_newest_when_full_fail)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    options.maxMessages = 1;
+    options.dropPolicy = MQTT_OFFLINE_DROP_NEWEST;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_offline_queue(mqttHandle, &options);
+    (void)mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_client_get_offline_queue_count(mqttHandle));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_047: [If discardQos0 is set then a QoS 0 publish made while offline shall be discarded and mqtt_client_publish shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_offline_queue_discard_QoS0_fail)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    options.discardQos0 = true;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_offline_queue(mqttHandle, &options);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE)).SetReturn(DELIVER_AT_MOST_ONCE);
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_MOST_ONCE, true, true, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_client_get_offline_queue_count(mqttHandle));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_050: [Once the CONNACK is accepted mqtt_client_dowork shall send the queued publishes in order, no more than drainRatePerSecond per second.]*/
+TEST_FUNCTION(mqtt_client_set_offline_queue_dowork_drains_after_connack_succeeds)
+{
+    // arrange
+    MQTT_OFFLINE_QUEUE_OPTIONS options = { 0 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_offline_queue(mqttHandle, &options);
+    (void)mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    unsigned char CONNACK_RESP[] = { 0x1, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, TEST_BUFFER_HANDLE);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(xio_dowork(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(singlylinkedlist_get_head_item(TEST_LIST_HANDLE));
+    STRICT_EXPECTED_CALL(singlylinkedlist_item_get_value(TEST_LIST_ITEM_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(singlylinkedlist_item_get_value(TEST_LIST_ITEM_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(singlylinkedlist_remove(TEST_LIST_HANDLE, TEST_LIST_ITEM_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_client_get_offline_queue_count(mqttHandle));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_052: [If the parameter handle is NULL or maxDelayMs is smaller than initialDelayMs then mqtt_client_set_reconnect shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_reconnect_handle_NULL_fail)
+{
+    // arrange
+    MQTT_RECONNECT_OPTIONS options = { 0 };
+
+    // act
+    int result = mqtt_client_set_reconnect(NULL, &options);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_053: [After a connection error, a failed send or a missing ping response the client shall reopen the xio after a delay that doubles on each failed attempt, up to maxDelayMs, with a random jitter of up to half the delay.]*/
+TEST_FUNCTION(mqtt_client_set_reconnect_io_error_schedules_reconnect_succeeds)
+{
+    // arrange
+    MQTT_RECONNECT_OPTIONS options = { 0 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_reconnect(mqttHandle, &options);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+
+    // act
+    g_ioError(g_ioErrorCtx);
+
+    // assert
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_055: [When the backoff delay has elapsed mqtt_client_dowork shall reopen the xio and send a CONNECT with the options given to mqtt_client_connect.]*/
+TEST_FUNCTION(mqtt_client_set_reconnect_dowork_reopens_xio_succeeds)
+{
+    // arrange
+    MQTT_RECONNECT_OPTIONS options = { 0 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_reconnect(mqttHandle, &options);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_ioError(g_ioErrorCtx);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(xio_open(TEST_IO_HANDLE, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(2).IgnoreArgument(3).IgnoreArgument(4).IgnoreArgument(5).IgnoreArgument(6).IgnoreArgument(7);
+    STRICT_EXPECTED_CALL(xio_dowork(TEST_IO_HANDLE));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_053: [After a connection error, a failed send or a missing ping response the client shall reopen the xio after a delay that doubles on each failed attempt, up to maxDelayMs, with a random jitter of up to half the delay.]*/
+TEST_FUNCTION(mqtt_client_set_reconnect_send_error_reopens_xio_succeeds)
+{
+    // arrange
+    MQTT_RECONNECT_OPTIONS options = { 0 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_reconnect(mqttHandle, &options);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    g_sendComplete(g_onSendCtx, IO_SEND_ERROR);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(xio_open(TEST_IO_HANDLE, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(2).IgnoreArgument(3).IgnoreArgument(4).IgnoreArgument(5).IgnoreArgument(6).IgnoreArgument(7);
+    STRICT_EXPECTED_CALL(xio_dowork(TEST_IO_HANDLE));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_111: [The CONNECT packet shall be encoded on the first open only and sent again as is on every later open, until mqtt_client_connect is called with different options.]*/
+TEST_FUNCTION(mqtt_client_set_reconnect_reopen_sends_encoded_CONNECT_succeeds)
+{
+    // arrange
+    MQTT_RECONNECT_OPTIONS options = { 0 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_reconnect(mqttHandle, &options);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    g_ioError(g_ioErrorCtx);
+    mqtt_client_dowork(mqttHandle);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG))
+        .IgnoreArgument_current_ms();
+    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+
+    // act
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_112: [mqtt_client_connect shall discard the encoded CONNECT packet when any of the options differ from the ones it was encoded from.]*/
+TEST_FUNCTION(mqtt_client_connect_changed_options_discards_CONNECT_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    umock_c_reset_all_calls();
+
+    mqttOptions.keepAliveInterval = TEST_KEEP_ALIVE_INTERVAL + 1;
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(mallocAndStrcpy_s(IGNORED_PTR_ARG, TEST_CLIENT_ID));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(mallocAndStrcpy_s(IGNORED_PTR_ARG, TEST_WILL_TOPIC));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(mallocAndStrcpy_s(IGNORED_PTR_ARG, TEST_WILL_MSG));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(mallocAndStrcpy_s(IGNORED_PTR_ARG, TEST_USERNAME));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(mallocAndStrcpy_s(IGNORED_PTR_ARG, TEST_PASSWORD));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(xio_open(TEST_IO_HANDLE, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument(2).IgnoreArgument(3).IgnoreArgument(4).IgnoreArgument(5).IgnoreArgument(6).IgnoreArgument(7);
+
+    // act
+    int result = mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_054: [If the broker did not keep the session the client shall restore every subscription made since mqtt_client_connect in the fewest SUBSCRIBE packets no larger than the maximum packet size, using consecutive packet ids starting at resubscribePacketId.]*/
+TEST_FUNCTION(mqtt_client_set_reconnect_CONNACK_restores_subscriptions_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x0, 0x0 };
+    size_t length = sizeof(CONNACK_RESP) / sizeof(CONNACK_RESP[0]);
+    MQTT_RECONNECT_OPTIONS options = { 0 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_reconnect(mqttHandle, &options);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    (void)mqtt_client_subscribe(mqttHandle, TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 1);
+    g_ioError(g_ioErrorCtx);
+    mqtt_client_dowork(mqttHandle);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
+    STRICT_EXPECTED_CALL(singlylinkedlist_get_head_item(TEST_LIST_HANDLE));
+    STRICT_EXPECTED_CALL(singlylinkedlist_get_next_item(TEST_LIST_ITEM_HANDLE));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(singlylinkedlist_get_head_item(TEST_LIST_HANDLE));
+    STRICT_EXPECTED_CALL(singlylinkedlist_item_get_value(TEST_LIST_ITEM_HANDLE));
+    STRICT_EXPECTED_CALL(singlylinkedlist_get_next_item(TEST_LIST_ITEM_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_subscribe(0xFF00, IGNORED_PTR_ARG, 1, NULL));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, TEST_BUFFER_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_115: [The SUBACKs of the packets restoring the subscriptions shall not be reported to the operation callback.]*/
+TEST_FUNCTION(mqtt_client_set_reconnect_restore_SUBACK_not_reported_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x0, 0x0 };
+    unsigned char SUBSCRIBE_ACK_RESP[] = { 0xFF, 0x00, 0x01 };
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    QOS_VALUE qosReturn[] = { DELIVER_AT_LEAST_ONCE };
+    SUBSCRIBE_ACK suback = { 0 };
+    suback.packetId = 0xFF00;
+    suback.qosReturn = qosReturn;
+    suback.qosCount = 1;
+    testData.actionResult = MQTT_CLIENT_ON_SUBSCRIBE_ACK;
+    testData.msgInfo = &suback;
+
+    MQTT_RECONNECT_OPTIONS options = { 0 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    (void)mqtt_client_set_reconnect(mqttHandle, &options);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    (void)mqtt_client_subscribe(mqttHandle, TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 1);
+    g_ioError(g_ioErrorCtx);
+    mqtt_client_dowork(mqttHandle);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(CONNACK_RESP));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
+    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, TEST_BUFFER_HANDLE);
+    g_operationCallbackInvoked = false;
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(SUBSCRIBE_ACK_RESP));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(SUBSCRIBE_ACK_RESP);
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    g_packetComplete(mqttHandle, SUBACK_TYPE, 0, TEST_BUFFER_HANDLE);
+
+    // assert
+    ASSERT_IS_FALSE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_057: [If any of the parameters handle, subscribeList or onComplete is NULL, count is 0 or firstPacketId is 0 then mqtt_client_subscribe_batch shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_subscribe_batch_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_subscribe_batch(NULL, TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, 0, TestSubscribeBatchComplete, NULL, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_058: [mqtt_client_subscribe_batch shall split subscribeList into the fewest SUBSCRIBE packets no larger than maxPacketSize, and fail if a single filter does not fit.]*/
+TEST_FUNCTION(mqtt_client_subscribe_batch_filter_too_large_fail)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_subscribe_batch(mqttHandle, TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, 10, TestSubscribeBatchComplete, NULL, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_060: [mqtt_client_subscribe_batch shall send every packet without waiting for the previous SUBACK, using consecutive packet ids starting at firstPacketId.]*/
+TEST_FUNCTION(mqtt_client_subscribe_batch_splits_packets_succeeds)
+{
+    // arrange
+    size_t packetCount = 0;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(singlylinkedlist_create());
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(singlylinkedlist_add(TEST_LIST_HANDLE, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_subscribe(TEST_PACKET_ID, &TEST_SUBSCRIBE_PAYLOAD[0], 1, NULL));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_subscribe(TEST_PACKET_ID + 1, &TEST_SUBSCRIBE_PAYLOAD[1], 1, NULL));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_subscribe_batch(mqttHandle, TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, 20, TestSubscribeBatchComplete, NULL, &packetCount);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 2, packetCount);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_059: [Once every packet of the batch is acknowledged onComplete shall be called with the granted QoS of every filter in list order, the individual SUBACKs shall not be reported to the operation callback.]*/
+TEST_FUNCTION(mqtt_client_subscribe_batch_SUBACKs_merged_succeeds)
+{
+    // arrange
+    unsigned char SUBACK_RESP_1[] = { 0x12, 0x34, 0x01 };
+    unsigned char SUBACK_RESP_2[] = { 0x12, 0x35, 0x02 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_subscribe_batch(mqttHandle, TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, 20, TestSubscribeBatchComplete, NULL, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(SUBACK_RESP_1));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(SUBACK_RESP_1);
+    g_packetComplete(mqttHandle, SUBACK_TYPE, 0, TEST_BUFFER_HANDLE);
+    ASSERT_IS_FALSE(g_batchCompleteInvoked);
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(SUBACK_RESP_2));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(SUBACK_RESP_2);
+
+    // act
+    g_packetComplete(mqttHandle, SUBACK_TYPE, 0, TEST_BUFFER_HANDLE);
+
+    // assert
+    ASSERT_IS_TRUE(g_batchCompleteInvoked);
+    ASSERT_IS_FALSE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(size_t, 2, g_batchQosCount);
+    ASSERT_ARE_EQUAL(int, DELIVER_AT_LEAST_ONCE, g_batchQosReturn[0]);
+    ASSERT_ARE_EQUAL(int, DELIVER_EXACTLY_ONCE, g_batchQosReturn[1]);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_061: [If the parameters handle or limits are NULL then mqtt_client_get_connection_limits shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_get_connection_limits_handle_NULL_fail)
+{
+    // arrange
+    MQTT_CONNECTION_LIMITS limits;
+
+    // act
+    int result = mqtt_client_get_connection_limits(NULL, &limits);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_068: [mqtt_client_get_connection_limits shall copy the limits negotiated with the server into limits, the 3.1.1 defaults being a Receive Maximum of 65535, no Maximum Packet Size, no topic aliases, QoS 2 and retain available.]*/
+TEST_FUNCTION(mqtt_client_get_connection_limits_default_succeeds)
+{
+    // arrange
+    MQTT_CONNECTION_LIMITS limits;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_get_connection_limits(mqttHandle, &limits);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(int, 65535, limits.receiveMaximum);
+    ASSERT_ARE_EQUAL(int, 0, limits.maximumPacketSize);
+    ASSERT_ARE_EQUAL(int, 0, limits.topicAliasMaximum);
+    ASSERT_ARE_EQUAL(int, DELIVER_EXACTLY_ONCE, limits.maximumQos);
+    ASSERT_IS_TRUE(limits.retainAvailable);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_062: [In MQTT 5.0 mode the CONNACK reason code shall be passed in reasonCode and mapped to the closest CONNECT_RETURN_CODE, and its properties shall be passed in properties.]*/
+/*Tests_SRS_MQTT_CLIENT_07_063: [The Receive Maximum, Maximum Packet Size, Topic Alias Maximum, Maximum QoS and Retain Available announced in the CONNACK shall replace the defaults returned by mqtt_client_get_connection_limits.]*/
+TEST_FUNCTION(mqtt_client_v5_CONNACK_applies_server_limits_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x0, 0x0, 0x8, 0x21, 0x00, 0x05, 0x27, 0x00, 0x00, 0x00, 0x64 };
+    MQTT_CONNECTION_LIMITS limits;
+    TEST_COMPLETE_DATA_INSTANCE testData;
+    CONNECT_ACK connack = { 0 };
+    connack.returnCode = CONNECTION_ACCEPTED;
+    testData.actionResult = MQTT_CLIENT_ON_CONNACK;
+    testData.msgInfo = &connack;
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.protocolVersion = MQTT_PROTOCOL_VERSION_5;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&testData, TestErrorCallback, NULL);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    umock_c_reset_all_calls();
+
+    g_decoded_properties.present = MQTT_PROPERTY_MASK(MQTT_PROPERTY_RECEIVE_MAXIMUM) | MQTT_PROPERTY_MASK(MQTT_PROPERTY_MAXIMUM_PACKET_SIZE);
+    g_decoded_properties.receiveMaximum = 5;
+    g_decoded_properties.maximumPacketSize = 100;
+
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(CONNACK_RESP));
+    STRICT_EXPECTED_CALL(mqtt_codec_decode_properties(IGNORED_PTR_ARG, sizeof(CONNACK_RESP) - 2, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+
+    // act
+    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, TEST_BUFFER_HANDLE);
+    int result = mqtt_client_get_connection_limits(mqttHandle, &limits);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_IS_TRUE(g_operationCallbackInvoked);
+    ASSERT_ARE_EQUAL(int, 5, limits.receiveMaximum);
+    ASSERT_ARE_EQUAL(int, 100, limits.maximumPacketSize);
+    ASSERT_ARE_EQUAL(int, 0, limits.topicAliasMaximum);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_067: [mqtt_client_publish shall return a non-zero value without sending when the encoded PUBLISH is larger than the Maximum Packet Size announced by the server.]*/
+TEST_FUNCTION(mqtt_client_v5_publish_exceeds_maximum_packet_size_fail)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x0, 0x0, 0x8, 0x27, 0x00, 0x00, 0x00, 0x0a };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.protocolVersion = MQTT_PROTOCOL_VERSION_5;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_decoded_properties.present = MQTT_PROPERTY_MASK(MQTT_PROPERTY_MAXIMUM_PACKET_SIZE);
+    g_decoded_properties.maximumPacketSize = 10;
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(CONNACK_RESP));
+    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, TEST_BUFFER_HANDLE);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish_v5(DELIVER_AT_LEAST_ONCE, true, true, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_054: [If the broker did not keep the session the client shall restore every subscription made since mqtt_client_connect in the fewest SUBSCRIBE packets no larger than the maximum packet size, using consecutive packet ids starting at resubscribePacketId.]*/
+TEST_FUNCTION(mqtt_client_v5_set_reconnect_CONNACK_restores_subscriptions_succeeds)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x0, 0x0, 0x0 };
+    MQTT_RECONNECT_OPTIONS options = { 0 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.protocolVersion = MQTT_PROTOCOL_VERSION_5;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_reconnect(mqttHandle, &options);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    (void)mqtt_client_subscribe(mqttHandle, TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 1);
+    g_ioError(g_ioErrorCtx);
+    mqtt_client_dowork(mqttHandle);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(CONNACK_RESP));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
+    STRICT_EXPECTED_CALL(mqtt_codec_decode_properties(IGNORED_PTR_ARG, sizeof(CONNACK_RESP) - 2, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(singlylinkedlist_get_head_item(TEST_LIST_HANDLE));
+    STRICT_EXPECTED_CALL(singlylinkedlist_get_next_item(TEST_LIST_ITEM_HANDLE));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(singlylinkedlist_get_head_item(TEST_LIST_HANDLE));
+    STRICT_EXPECTED_CALL(singlylinkedlist_item_get_value(TEST_LIST_ITEM_HANDLE));
+    STRICT_EXPECTED_CALL(singlylinkedlist_get_next_item(TEST_LIST_ITEM_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_subscribe_v5(0xFF00, IGNORED_PTR_ARG, 1, NULL));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, TEST_BUFFER_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_054: [If the broker did not keep the session the client shall restore every subscription made since mqtt_client_connect in the fewest SUBSCRIBE packets no larger than the maximum packet size, using consecutive packet ids starting at resubscribePacketId.]*/
+TEST_FUNCTION(mqtt_client_v5_set_reconnect_restore_exceeds_maximum_packet_size_fail)
+{
+    // arrange
+    unsigned char CONNACK_RESP[] = { 0x0, 0x0, 0x5, 0x27, 0x00, 0x00, 0x00, 0x0a };
+    MQTT_RECONNECT_OPTIONS options = { 0 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.protocolVersion = MQTT_PROTOCOL_VERSION_5;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_reconnect(mqttHandle, &options);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    (void)mqtt_client_subscribe(mqttHandle, TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 1);
+    g_ioError(g_ioErrorCtx);
+    mqtt_client_dowork(mqttHandle);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    g_decoded_properties.present = MQTT_PROPERTY_MASK(MQTT_PROPERTY_MAXIMUM_PACKET_SIZE);
+    g_decoded_properties.maximumPacketSize = 10;
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(CONNACK_RESP));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(CONNACK_RESP);
+    STRICT_EXPECTED_CALL(mqtt_codec_decode_properties(IGNORED_PTR_ARG, sizeof(CONNACK_RESP) - 2, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(singlylinkedlist_get_head_item(TEST_LIST_HANDLE));
+    STRICT_EXPECTED_CALL(singlylinkedlist_get_next_item(TEST_LIST_ITEM_HANDLE));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(singlylinkedlist_get_head_item(TEST_LIST_HANDLE));
+    STRICT_EXPECTED_CALL(singlylinkedlist_item_get_value(TEST_LIST_ITEM_HANDLE));
+    STRICT_EXPECTED_CALL(singlylinkedlist_get_next_item(TEST_LIST_ITEM_HANDLE));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    g_packetComplete(mqttHandle, CONNACK_TYPE, 0, TEST_BUFFER_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+TEST_FUNCTION(mqtt_client_v5_subscribe_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.protocolVersion = MQTT_PROTOCOL_VERSION_5;
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_codec_subscribe_v5(TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_subscribe(mqttHandle, TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_069: [In MQTT 5.0 mode, when the server allows topic aliases, mqtt_client_publish shall send a topic with its new alias the first time and only the alias with an empty topic afterwards.]*/
+TEST_FUNCTION(mqtt_client_v5_publish_topic_alias_first_use_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    g_decoded_properties.present = MQTT_PROPERTY_MASK(MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM);
+    g_decoded_properties.topicAliasMaximum = 10;
+    make_connack_v5(mqttHandle, &mqttOptions);
+    umock_c_reset_all_calls();
+
+    setup_mqtt_client_publish_v5_mocks();
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    setup_mqtt_client_publish_v5_send_mocks();
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, TEST_TOPIC_NAME, g_publish_topic);
+    ASSERT_ARE_EQUAL(int, 1, g_publish_alias);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_069: [In MQTT 5.0 mode, when the server allows topic aliases, mqtt_client_publish shall send a topic with its new alias the first time and only the alias with an empty topic afterwards.]*/
+TEST_FUNCTION(mqtt_client_v5_publish_topic_alias_reused_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    g_decoded_properties.present = MQTT_PROPERTY_MASK(MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM);
+    g_decoded_properties.topicAliasMaximum = 10;
+    make_connack_v5(mqttHandle, &mqttOptions);
+    (void)mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+    umock_c_reset_all_calls();
+
+    setup_mqtt_client_publish_v5_mocks();
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    setup_mqtt_client_publish_v5_send_mocks();
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, "", g_publish_topic);
+    ASSERT_ARE_EQUAL(int, 1, g_publish_alias);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_070: [When every alias allowed by the server is in use the least recently used alias shall be remapped to the new topic.]*/
+TEST_FUNCTION(mqtt_client_v5_publish_topic_alias_replaces_least_recently_used_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    g_decoded_properties.present = MQTT_PROPERTY_MASK(MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM);
+    g_decoded_properties.topicAliasMaximum = 1;
+    make_connack_v5(mqttHandle, &mqttOptions);
+    (void)mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+    umock_c_reset_all_calls();
+
+    setup_mqtt_client_publish_v5_mocks();
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE)).SetReturn("other topic");
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+    setup_mqtt_client_publish_v5_send_mocks();
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, "other topic", g_publish_topic);
+    ASSERT_ARE_EQUAL(int, 1, g_publish_alias);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_071: [Every CONNACK shall discard the topic aliases of the previous connection.]*/
+TEST_FUNCTION(mqtt_client_v5_publish_topic_alias_reset_on_CONNACK_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    g_decoded_properties.present = MQTT_PROPERTY_MASK(MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM);
+    g_decoded_properties.topicAliasMaximum = 10;
+    make_connack_v5(mqttHandle, &mqttOptions);
+    (void)mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+    make_connack_v5(mqttHandle, &mqttOptions);
+    umock_c_reset_all_calls();
+
+    setup_mqtt_client_publish_v5_mocks();
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    setup_mqtt_client_publish_v5_send_mocks();
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, TEST_TOPIC_NAME, g_publish_topic);
+    ASSERT_ARE_EQUAL(int, 1, g_publish_alias);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_072: [In MQTT 5.0 mode a PUBLISH carrying both a topic and a topic alias shall map the alias to the topic for the rest of the connection.]*/
+TEST_FUNCTION(mqtt_client_v5_PUBLISH_topic_alias_mapped_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_VALUE[] = { 0x00, 0x03, 0x61, 0x2f, 0x62, 0x03, 0x23, 0x00, 0x01 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.topicAliasMaximum = 4;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    make_connack_v5(mqttHandle, &mqttOptions);
+    umock_c_reset_all_calls();
+
+    g_decoded_properties.present = MQTT_PROPERTY_MASK(MQTT_PROPERTY_TOPIC_ALIAS);
+    g_decoded_properties.topicAlias = 1;
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(PUBLISH_VALUE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_VALUE);
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(mqtt_codec_decode_properties(IGNORED_PTR_ARG, 4, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(0, IGNORED_PTR_ARG, DELIVER_AT_MOST_ONCE, IGNORED_PTR_ARG, 0));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_PTR_ARG, false));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_PTR_ARG, false));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_PTR_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    g_packetComplete(mqttHandle, PUBLISH_TYPE, 0, TEST_BUFFER_HANDLE);
+
+    // assert
+    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
+    ASSERT_IS_FALSE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_073: [A PUBLISH with an empty topic shall be delivered with the topic mapped to its alias, without copying the topic.]*/
+TEST_FUNCTION(mqtt_client_v5_PUBLISH_topic_alias_resolved_succeeds)
+{
+    // arrange
+    unsigned char MAPPING_PUBLISH_VALUE[] = { 0x00, 0x03, 0x61, 0x2f, 0x62, 0x03, 0x23, 0x00, 0x01 };
+    unsigned char PUBLISH_VALUE[] = { 0x00, 0x00, 0x03, 0x23, 0x00, 0x01 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.topicAliasMaximum = 4;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    make_connack_v5(mqttHandle, &mqttOptions);
+
+    g_decoded_properties.present = MQTT_PROPERTY_MASK(MQTT_PROPERTY_TOPIC_ALIAS);
+    g_decoded_properties.topicAlias = 1;
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(MAPPING_PUBLISH_VALUE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(MAPPING_PUBLISH_VALUE);
+    g_packetComplete(mqttHandle, PUBLISH_TYPE, 0, TEST_BUFFER_HANDLE);
+    umock_c_reset_all_calls();
+    g_message_topic = NULL;
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(PUBLISH_VALUE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_VALUE);
+    STRICT_EXPECTED_CALL(mqtt_codec_decode_properties(IGNORED_PTR_ARG, 4, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(0, IGNORED_PTR_ARG, DELIVER_AT_MOST_ONCE, IGNORED_PTR_ARG, 0));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_PTR_ARG, false));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_PTR_ARG, false));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_PTR_ARG));
+
+    // act
+    g_packetComplete(mqttHandle, PUBLISH_TYPE, 0, TEST_BUFFER_HANDLE);
+
+    // assert
+    ASSERT_IS_FALSE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, "a/b", g_message_topic);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_074: [A topic alias that is out of range or was never mapped shall be reported as MQTT_CLIENT_PARSE_ERROR.]*/
+TEST_FUNCTION(mqtt_client_v5_PUBLISH_unknown_topic_alias_fail)
+{
+    // arrange
+    unsigned char PUBLISH_VALUE[] = { 0x00, 0x00, 0x03, 0x23, 0x00, 0x02 };
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.topicAliasMaximum = 4;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    make_connack_v5(mqttHandle, &mqttOptions);
+    umock_c_reset_all_calls();
+
+    g_decoded_properties.present = MQTT_PROPERTY_MASK(MQTT_PROPERTY_TOPIC_ALIAS);
+    g_decoded_properties.topicAlias = 2;
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(PUBLISH_VALUE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_VALUE);
+    STRICT_EXPECTED_CALL(mqtt_codec_decode_properties(IGNORED_PTR_ARG, 4, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+
+    // act
+    g_packetComplete(mqttHandle, PUBLISH_TYPE, 0, TEST_BUFFER_HANDLE);
+
+    // assert
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_IS_FALSE(g_msgRecvCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_075: [If the parameter handle is NULL then mqtt_client_set_max_inflight shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_max_inflight_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_set_max_inflight(NULL, 1);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+    // cleanup
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_079: [If any of the parameters handle, inflightCount or windowSize is NULL then mqtt_client_get_inflight_window shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_get_inflight_window_handle_NULL_fail)
+{
+    // arrange
+    size_t inflightCount;
+    size_t windowSize;
+
+    // act
+    int result = mqtt_client_get_inflight_window(NULL, &inflightCount, &windowSize);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+    // cleanup
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_077: [When the in-flight window is full a QoS 1 or 2 publish shall be added to the offline queue if it is enabled, otherwise mqtt_client_publish shall return a non-zero value without sending it.]*/
+TEST_FUNCTION(mqtt_client_publish_inflight_window_full_fail)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_max_inflight(mqttHandle, 1);
+    (void)mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_076: [A QoS 1 or 2 publish shall hold a slot of the in-flight window from the time it is sent until its PUBACK, its PUBCOMP or a PUBREC with a failure reason code is received, before the operation callback is called.]*/
+/*Tests_SRS_MQTT_CLIENT_07_080: [mqtt_client_get_inflight_window shall return the number of unacknowledged QoS 1 and 2 publishes and the size of the window, the smaller of maxInflight and the server Receive Maximum.]*/
+TEST_FUNCTION(mqtt_client_PUBACK_opens_inflight_window_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_ACK_RESP[] = { 0x12, 0x34 };
+    size_t inflightCount;
+    size_t windowSize;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_max_inflight(mqttHandle, 1);
+    (void)mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+    (void)mqtt_client_get_inflight_window(mqttHandle, &inflightCount, &windowSize);
+    ASSERT_ARE_EQUAL(size_t, 1, inflightCount);
+    ASSERT_ARE_EQUAL(size_t, 1, windowSize);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(PUBLISH_ACK_RESP));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_ACK_RESP);
+
+    // act
+    g_packetComplete(mqttHandle, PUBACK_TYPE, 0, TEST_BUFFER_HANDLE);
+    int result = mqtt_client_get_inflight_window(mqttHandle, &inflightCount, &windowSize);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 0, inflightCount);
+    ASSERT_ARE_EQUAL(size_t, 1, windowSize);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_084: [mqtt_client_connect shall reject incoming packets larger than the maximumPacketSize of MQTT_CLIENT_OPTIONS, in 3.1.1 as well as in MQTT 5.0.]*/
+TEST_FUNCTION(mqtt_client_connect_maximum_packet_size_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, NULL, NULL, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.maximumPacketSize = 1024;
+
+    setup_mqtt_client_connect_mocks(&mqttOptions);
+
+    // act
+    int result = mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_081: [If the parameter handle is NULL then mqtt_client_set_message_stream shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_message_stream_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_set_message_stream(NULL, 64, TestChunkCallback, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+    // cleanup
+}
+
+TEST_FUNCTION(mqtt_client_set_message_stream_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqtt_codec_set_publish_stream(TEST_MQTTCODEC_HANDLE, 64, false, IGNORED_PTR_ARG));
+
+    // act
+    int result = mqtt_client_set_message_stream(mqttHandle, 64, TestChunkCallback, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_IS_NOT_NULL(g_publishStream);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_082: [For a streamed PUBLISH the chunk callback shall be called for every payload chunk with a message that holds the topic, QoS, packet id and flags of the PUBLISH, the offset of the chunk and the payload length.]*/
+/*Tests_SRS_MQTT_CLIENT_07_083: [The PUBACK or PUBREC of a streamed PUBLISH shall be sent once its final chunk has been delivered.]*/
+TEST_FUNCTION(mqtt_client_stream_PUBLISH_acknowledged_after_final_chunk_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_HEADER[] = { 0x00, 0x03, 0x61, 0x2f, 0x62, 0x12, 0x34 };
+    unsigned char PAYLOAD[] = { 0x01, 0x02, 0x03, 0x04 };
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_message_stream(mqttHandle, 4, TestChunkCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(sizeof(PUBLISH_HEADER));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_HEADER);
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_create(TEST_PACKET_ID, IGNORED_PTR_ARG, DELIVER_AT_LEAST_ONCE, NULL, 0))
+        .ValidateArgumentBuffer(2, "a/b", 4);
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_PTR_ARG, false));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_PTR_ARG, false));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(NULL));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 4, IGNORED_PTR_ARG, IGNORED_PTR_ARG)).IgnoreArgument_buffer();
+
+    // act
+    g_publishStream(mqttHandle, 0x02, TEST_BUFFER_HANDLE, sizeof(PAYLOAD), NULL, 0);
+    g_publishStream(mqttHandle, 0x02, NULL, sizeof(PAYLOAD), PAYLOAD, 3);
+    ASSERT_ARE_EQUAL(size_t, 0, g_finalChunks);
+    g_publishStream(mqttHandle, 0x02, NULL, sizeof(PAYLOAD), PAYLOAD + 3, 1);
+
+    // assert
+    ASSERT_IS_FALSE(g_msgRecvCallbackInvoked);
+    ASSERT_ARE_EQUAL(size_t, sizeof(PAYLOAD), g_chunkBytes);
+    ASSERT_ARE_EQUAL(size_t, 1, g_finalChunks);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+static void setup_publish_stream(MQTT_CLIENT_HANDLE mqttHandle, MQTT_CLIENT_OPTIONS* mqttOptions, size_t payloadLength, size_t chunkSize)
+{
+    SetupMqttLibOptions(mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    make_connack(mqttHandle, mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    (void)mqtt_client_publish_stream(mqttHandle, TEST_MESSAGE_HANDLE, payloadLength, chunkSize, TestPublishChunkCallback, NULL);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_085: [If any of the parameters handle, msgHandle or chunkCallback is NULL or chunkSize is 0 then mqtt_client_publish_stream shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_publish_stream_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_publish_stream(NULL, TEST_MESSAGE_HANDLE, 8, 4, TestPublishChunkCallback, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+    // cleanup
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_086: [mqtt_client_publish_stream shall return a non-zero value when the client is not connected or another streamed publish is being sent, a streamed publish is neither queued offline nor persisted.]*/
+TEST_FUNCTION(mqtt_client_publish_stream_not_connected_fail)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_publish_stream(mqttHandle, TEST_MESSAGE_HANDLE, 8, 4, TestPublishChunkCallback, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_091: [mqtt_client_publish_stream shall send the fixed and variable header of the PUBLISH declaring payloadLength bytes of payload and return, the payload is pulled from chunkCallback by mqtt_client_dowork.]*/
+TEST_FUNCTION(mqtt_client_publish_stream_sends_header_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    make_connack(mqttHandle, &mqttOptions);
+    g_openComplete(g_onCompleteCtx, IO_OPEN_OK);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish_header(DELIVER_AT_LEAST_ONCE, true, true, TEST_PACKET_ID, TEST_TOPIC_NAME, 8, NULL));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(gballoc_malloc(4));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish_stream(mqttHandle, TEST_MESSAGE_HANDLE, 8, 4, TestPublishChunkCallback, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 0, g_publishChunkCalls);
+    ASSERT_ARE_NOT_EQUAL(int, 0, mqtt_client_publish_stream(mqttHandle, TEST_MESSAGE_HANDLE, 8, 4, TestPublishChunkCallback, NULL));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_089: [mqtt_client_dowork shall pull the next chunk of a streamed publish into a buffer of at most chunkSize bytes once the previous chunk has been sent, a chunk of 0 bytes shall be pulled again on the next call.]*/
+TEST_FUNCTION(mqtt_client_dowork_publish_stream_pulls_one_chunk_until_sent_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    setup_publish_stream(mqttHandle, &mqttOptions, 8, 4);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(xio_dowork(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(xio_send(TEST_IO_HANDLE, IGNORED_PTR_ARG, 4, IGNORED_PTR_ARG, IGNORED_PTR_ARG))
+        .IgnoreArgument_buffer()
+        .IgnoreArgument_on_send_complete()
+        .IgnoreArgument_callback_context();
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(xio_dowork(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, g_publishChunkCalls);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_088: [While a streamed publish is being sent the packets of the other operations shall be held and sent after its last chunk, as MQTT packets cannot interleave.]*/
+TEST_FUNCTION(mqtt_client_publish_during_publish_stream_is_held_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    setup_publish_stream(mqttHandle, &mqttOptions, 8, 4);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(singlylinkedlist_create());
+    STRICT_EXPECTED_CALL(BUFFER_create(TEST_BUFFER_U_CHAR, 11));
+    STRICT_EXPECTED_CALL(singlylinkedlist_add(TEST_LIST_HANDLE, TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_090: [If a chunk cannot be pulled or sent the client shall report MQTT_CLIENT_COMMUNICATION_ERROR and close the connection, as the publish cannot be completed.]*/
+TEST_FUNCTION(mqtt_client_dowork_publish_stream_chunk_fail)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    setup_publish_stream(mqttHandle, &mqttOptions, 8, 4);
+    g_publishChunkResult = __FAILURE__;
+    umock_c_reset_all_calls();
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, g_publishChunkCalls);
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+static void setup_batched_ack_mocks(unsigned char* PUBLISH_RESP, size_t length, unsigned char* pendingAcks, size_t pendingLength, bool delayed)
+{
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_RESP);
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(TEST_PACKET_ID, IGNORED_PTR_ARG, DELIVER_AT_LEAST_ONCE, IGNORED_PTR_ARG, TEST_APP_PAYLOAD.length));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_PTR_ARG, true));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_PTR_ARG, false));
+    if (pendingLength == 0)
+    {
+        EXPECTED_CALL(BUFFER_new()).SetReturn(TEST_BUFFER_HANDLE);
+    }
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG)).SetReturn(pendingLength);
+    STRICT_EXPECTED_CALL(BUFFER_enlarge(IGNORED_PTR_ARG, 4));
+    if (delayed)
+    {
+        STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG));
+    }
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG)).SetReturn(pendingAcks);
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_PTR_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_092: [If the parameter handle is NULL then mqtt_client_set_ack_delay shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_ack_delay_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_set_ack_delay(NULL, 10);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+    // cleanup
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_093: [The PUBACK and PUBREC packets produced while processing the bytes of one receive call shall be sent together in a single write at the end of it.]*/
+TEST_FUNCTION(mqtt_client_on_bytes_received_batches_acks_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+    unsigned char ackPacket[] = { 0x40, 0x02, 0x12, 0x34 };
+    unsigned char pendingAcks[8] = { 0 };
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    g_codecPublishes = 2;
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(mqtt_codec_bytesReceived(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    setup_batched_ack_mocks(PUBLISH_RESP, length, pendingAcks, 0, false);
+    setup_batched_ack_mocks(PUBLISH_RESP, length, pendingAcks, 4, false);
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG)).SetReturn(pendingAcks);
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(xio_send(TEST_IO_HANDLE, IGNORED_PTR_ARG, 8, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+
+    // act
+    g_bytesRecv(g_bytesRecvCtx, TEST_BUFFER_U_CHAR, 1);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, memcmp(pendingAcks, ackPacket, sizeof(ackPacket)));
+    ASSERT_ARE_EQUAL(int, 0, memcmp(pendingAcks + 4, ackPacket, sizeof(ackPacket)));
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_094: [With a maximum ack delay the acknowledgements shall be held across receive calls and sent from mqtt_client_dowork once the oldest has waited maxAckDelayMs.]*/
+TEST_FUNCTION(mqtt_client_on_bytes_received_ack_delay_holds_acks_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+    unsigned char ackPacket[] = { 0x40, 0x02, 0x12, 0x34 };
+    unsigned char pendingAcks[4] = { 0 };
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, (void*)&PUBLISH_RESP, TestErrorCallback, NULL);
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, TEST_KEEP_ALIVE_INTERVAL, false, true, DELIVER_AT_MOST_ONCE);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    (void)mqtt_client_set_ack_delay(mqttHandle, 50);
+    g_codecPublishes = 1;
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(mqtt_codec_bytesReceived(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    setup_batched_ack_mocks(PUBLISH_RESP, length, pendingAcks, 0, true);
+
+    // act
+    g_bytesRecv(g_bytesRecvCtx, TEST_BUFFER_U_CHAR, 1);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, memcmp(pendingAcks, ackPacket, sizeof(ackPacket)));
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_096: [If the parameter handle is NULL then mqtt_client_set_manual_ack shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_manual_ack_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_set_manual_ack(NULL, TestRecvAckCallback, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+    // cleanup
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_096: [If the parameter handle is NULL then mqtt_client_set_manual_ack shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_manual_ack_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(VECTOR_create(sizeof(MQTT_ACK_TOKEN)));
+    STRICT_EXPECTED_CALL(VECTOR_create(sizeof(MQTT_ACK_TOKEN)));
+    STRICT_EXPECTED_CALL(Lock_Init());
+
+    // act
+    int result = mqtt_client_set_manual_ack(mqttHandle, TestRecvAckCallback, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_097: [In manual acknowledgement mode the ON_MQTT_MESSAGE_RECV_ACK_CALLBACK shall be called with the ack token of the message instead of the ON_MQTT_MESSAGE_RECV_CALLBACK and no PUBACK or PUBREC shall be sent.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_manual_ack_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_manual_ack(mqttHandle, TestRecvAckCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_RESP);
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(TEST_PACKET_ID, IGNORED_PTR_ARG, DELIVER_AT_LEAST_ONCE, IGNORED_PTR_ARG, TEST_APP_PAYLOAD.length));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_PTR_ARG, true));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_PTR_ARG, false));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_PTR_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    g_packetComplete(mqttHandle, PUBLISH_TYPE, 0x0a, TEST_BUFFER_HANDLE);
+
+    // assert
+    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
+    ASSERT_IS_TRUE(g_ackToken == (((MQTT_ACK_TOKEN)DELIVER_AT_LEAST_ONCE << 16) | TEST_PACKET_ID));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_100: [If the parameter handle is NULL, manual acknowledgement was never enabled or ackToken was not handed out by the client then mqtt_client_ack shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_ack_not_manual_fail)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_ack(mqttHandle, ((MQTT_ACK_TOKEN)DELIVER_AT_LEAST_ONCE << 16) | TEST_PACKET_ID);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_101: [mqtt_client_ack may be called from any thread, it shall queue the acknowledgement for the next call to mqtt_client_dowork.]*/
+TEST_FUNCTION(mqtt_client_ack_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_manual_ack(mqttHandle, TestRecvAckCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(VECTOR_push_back(TEST_VECTOR_HANDLE, IGNORED_PTR_ARG, 1));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+
+    // act
+    int result = mqtt_client_ack(mqttHandle, ((MQTT_ACK_TOKEN)DELIVER_AT_LEAST_ONCE << 16) | TEST_PACKET_ID);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_098: [mqtt_client_dowork shall send the acknowledgements queued by mqtt_client_ack since its last call together in a single write.]*/
+TEST_FUNCTION(mqtt_client_dowork_manual_ack_nothing_queued_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, TEST_USERNAME, TEST_PASSWORD, 0, false, true, DELIVER_AT_MOST_ONCE);
+    (void)mqtt_client_connect(mqttHandle, TEST_IO_HANDLE, &mqttOptions);
+    (void)mqtt_client_set_manual_ack(mqttHandle, TestRecvAckCallback, NULL);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(xio_dowork(TEST_IO_HANDLE));
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(VECTOR_size(TEST_VECTOR_HANDLE)).SetReturn(0);
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+
+    // act
+    mqtt_client_dowork(mqttHandle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_106: [If the parameter handle or topicFilter is NULL, topicFilter is empty or a member of transform is NULL then mqtt_client_set_payload_transform shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_payload_transform_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_client_set_payload_transform(NULL, "#", &TEST_PAYLOAD_TRANSFORM);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+    // cleanup
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_106: [If the parameter handle or topicFilter is NULL, topicFilter is empty or a member of transform is NULL then mqtt_client_set_payload_transform shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_client_set_payload_transform_invalid_transform_fail)
+{
+    // arrange
+    MQTT_PAYLOAD_TRANSFORM transform = TEST_PAYLOAD_TRANSFORM;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    transform.decode = NULL;
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_client_set_payload_transform(mqttHandle, "#", &transform);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_107: [mqtt_client_set_payload_transform shall add topicFilter with transform, replace the transform of a topicFilter already set, or remove topicFilter when transform is NULL.]*/
+TEST_FUNCTION(mqtt_client_set_payload_transform_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(mallocAndStrcpy_s(IGNORED_PTR_ARG, "#"));
+
+    // act
+    int result = mqtt_client_set_payload_transform(mqttHandle, "#", &TEST_PAYLOAD_TRANSFORM);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_107: [mqtt_client_set_payload_transform shall add topicFilter with transform, replace the transform of a topicFilter already set, or remove topicFilter when transform is NULL.]*/
+TEST_FUNCTION(mqtt_client_set_payload_transform_remove_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_payload_transform(mqttHandle, "#", &TEST_PAYLOAD_TRANSFORM);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    int result = mqtt_client_set_payload_transform(mqttHandle, "#", NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_108: [When the topic matches the filter of a transform, mqtt_client_publish shall send the payload encoded by the transform after its decoded length, flagged with the content type of the transform in MQTT 5.0 mode. A payload that does not shrink shall be sent as it is in MQTT 5.0 mode and stored after its length in MQTT 3.1.1 mode.]*/
+TEST_FUNCTION(mqtt_client_publish_payload_transform_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_payload_transform(mqttHandle, "topic Name", &TEST_PAYLOAD_TRANSFORM);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    // The decoded length and the one encoded byte
+    STRICT_EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, IGNORED_NUM_ARG, TEST_TOPIC_NAME, IGNORED_PTR_ARG, 2, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+TEST_FUNCTION(mqtt_client_publish_payload_transform_other_topic_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_payload_transform(mqttHandle, "topic/+", &TEST_PAYLOAD_TRANSFORM);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_codec_publish(DELIVER_AT_LEAST_ONCE, true, true, IGNORED_NUM_ARG, TEST_TOPIC_NAME, TEST_APP_PAYLOAD.message, TEST_APP_PAYLOAD.length, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_NUM_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(BUFFER_delete(TEST_BUFFER_HANDLE));
+
+    // act
+    int result = mqtt_client_publish(mqttHandle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_109: [A PUBLISH flagged with the content type of a transform in MQTT 5.0 mode, or received on a topic matching the filter of a transform in MQTT 3.1.1 mode, shall be delivered with its payload decoded into a buffer of the client.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_payload_transform_succeeds)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, 0x0f, TEST_ENCODED_BYTE };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_payload_transform(mqttHandle, "topic Name", &TEST_PAYLOAD_TRANSFORM);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_RESP);
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(gballoc_malloc(TEST_APP_PAYLOAD.length));
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(TEST_PACKET_ID, IGNORED_PTR_ARG, DELIVER_AT_LEAST_ONCE, IGNORED_PTR_ARG, TEST_APP_PAYLOAD.length));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(IGNORED_PTR_ARG, false));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(IGNORED_PTR_ARG, false));
+    STRICT_EXPECTED_CALL(tickcounter_get_current_ms(TEST_COUNTER_HANDLE, IGNORED_PTR_ARG)).IgnoreArgument(2);
+    STRICT_EXPECTED_CALL(xio_send(IGNORED_PTR_ARG, IGNORED_PTR_ARG, 4, IGNORED_PTR_ARG, IGNORED_PTR_ARG)).IgnoreArgument_buffer();
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(IGNORED_PTR_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    g_packetComplete(mqttHandle, PUBLISH_TYPE, 0x02, TEST_BUFFER_HANDLE);
+
+    // assert
+    ASSERT_IS_TRUE(g_msgRecvCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_110: [A transformed payload that cannot be decoded shall be reported as MQTT_CLIENT_PARSE_ERROR and the message shall not be delivered.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_payload_transform_decode_fail)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, 0x0f, 0xCD };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_payload_transform(mqttHandle, "topic Name", &TEST_PAYLOAD_TRANSFORM);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_RESP);
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(gballoc_malloc(TEST_APP_PAYLOAD.length));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    g_packetComplete(mqttHandle, PUBLISH_TYPE, 0x02, TEST_BUFFER_HANDLE);
+
+    // assert
+    ASSERT_IS_FALSE(g_msgRecvCallbackInvoked);
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
+/*Tests_SRS_MQTT_CLIENT_07_114: [A transformed payload whose decoded length is larger than the maximumPacketSize of MQTT_CLIENT_OPTIONS, or when it is 0 than the maxDecodedLength of the transform, shall not be decoded.]*/
+TEST_FUNCTION(mqtt_client_recvCompleteCallback_PUBLISH_payload_transform_too_large_fail)
+{
+    // arrange
+    unsigned char PUBLISH_RESP[] = { 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, 0x0f, TEST_ENCODED_BYTE };
+    size_t length = sizeof(PUBLISH_RESP) / sizeof(PUBLISH_RESP[0]);
+    MQTT_PAYLOAD_TRANSFORM transform = TEST_PAYLOAD_TRANSFORM;
+    transform.maxDecodedLength = TEST_APP_PAYLOAD.length - 1;
+    MQTT_CLIENT_HANDLE mqttHandle = mqtt_client_init(TestRecvCallback, TestOpCallback, NULL, TestErrorCallback, NULL);
+    (void)mqtt_client_set_payload_transform(mqttHandle, "topic Name", &transform);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(BUFFER_length(TEST_BUFFER_HANDLE)).SetReturn(length);
+    STRICT_EXPECTED_CALL(BUFFER_u_char(TEST_BUFFER_HANDLE)).SetReturn(PUBLISH_RESP);
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    g_packetComplete(mqttHandle, PUBLISH_TYPE, 0x02, TEST_BUFFER_HANDLE);
+
+    // assert
+    ASSERT_IS_FALSE(g_msgRecvCallbackInvoked);
+    ASSERT_IS_TRUE(g_errorCallbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_client_deinit(mqttHandle);
+}
+
 END_TEST_SUITE(mqtt_client_ut)
@@ -58,6 +58,11 @@ extern "C"
 static bool g_fail_alloc_calls;
 static bool g_callbackInvoked;
 static CONTROL_PACKET_TYPE g_curr_packet_type;
+static size_t g_stream_header_length;
+static size_t g_stream_payload_length;
+static unsigned char g_stream_payload[16];
+static size_t g_stream_received;
+static size_t g_stream_chunks;
 static const char* TEST_SUBSCRIPTION_TOPIC = "subTopic";
 static const char* TEST_CLIENT_ID = "single_threaded_test";
 static const char* TEST_TOPIC_NAME = "topic Name";
@@ -220,6 +225,10 @@ TEST_FUNCTION_INITIALIZE(method_init)
     }
     g_fail_alloc_calls = false;
     g_callbackInvoked = false;
+    g_stream_header_length = 0;
+    g_stream_payload_length = 0;
+    g_stream_received = 0;
+    g_stream_chunks = 0;
 
     umock_c_reset_all_calls();
 }
@@ -241,7 +250,7 @@ static void TestOnCompleteCallback(void* context, CONTROL_PACKET_TYPE packet, in
     (void)flags;
     if (testData != NULL)
     {
-        if (packet == PINGRESP_TYPE)
+        if (packet == PINGRESP_TYPE || (packet == DISCONNECT_TYPE && headerData == NULL))
         {
             g_callbackInvoked = true;
         }
@@ -255,6 +264,23 @@ static void TestOnCompleteCallback(void* context, CONTROL_PACKET_TYPE packet, in
     }
 }
 
+static void TestOnStreamCallback(void* context, int flags, BUFFER_HANDLE headerData, size_t payloadLength, const uint8_t* chunk, size_t chunkLength)
+{
+    (void)context;
+    (void)flags;
+    g_stream_payload_length = payloadLength;
+    if (headerData != NULL)
+    {
+        g_stream_header_length = real_BUFFER_length(headerData);
+    }
+    else if (g_stream_received + chunkLength <= sizeof(g_stream_payload))
+    {
+        memcpy(g_stream_payload + g_stream_received, chunk, chunkLength);
+        g_stream_received += chunkLength;
+        g_stream_chunks++;
+    }
+}
+
 /* Tests_SRS_MQTT_CODEC_07_002: [On success mqtt_codec_create shall return a MQTTCODEC_HANDLE value.] */
 TEST_FUNCTION(mqtt_codec_create_succeed)
 {
@@ -1635,6 +1661,31 @@ TEST_FUNCTION(mqtt_codec_bytesReceived_pingresp_succeed)
     mqtt_codec_destroy(handle);
 }
 
+/* Codes_SRS_MQTT_CODEC_07_034: [Upon a constructing a complete MQTT packet mqtt_codec_bytesReceived shall call the ON_PACKET_COMPLETE_CALLBACK function.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_disconnect_no_reason_code_succeed)
+{
+    // arrange
+    unsigned char DISCONNECT_RESP[] = { 0xE0, 0x0 };
+
+    TEST_COMPLETE_DATA_INSTANCE testData = { 0 };
+
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, &testData);
+
+    umock_c_reset_all_calls();
+    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
+
+    // act
+    int result = mqtt_codec_bytesReceived(handle, DISCONNECT_RESP, sizeof(DISCONNECT_RESP));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_IS_TRUE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
 TEST_FUNCTION(mqtt_codec_bytesReceived_publish_long_message_succeed)
 {
     // arrange
@@ -1955,4 +2006,832 @@ TEST_FUNCTION(mqtt_codec_connect_trace_succeeds)
     real_BUFFER_delete(handle);
 }
 
+/* Tests_SRS_MQTT_CODEC_07_037: [When protocolVersion is MQTT_PROTOCOL_VERSION_5 mqtt_codec_connect shall use protocol level 5 and encode the non-zero sessionExpiryInterval, receiveMaximum, maximumPacketSize and topicAliasMaximum as CONNECT properties.] */
+TEST_FUNCTION(mqtt_codec_connect_v5_succeeds)
+{
+    // arrange
+    MQTT_CLIENT_OPTIONS mqttOptions = { 0 };
+    SetupMqttLibOptions(&mqttOptions, TEST_CLIENT_ID, TEST_WILL_MSG, TEST_WILL_TOPIC, NULL, NULL, 20, true, true, DELIVER_AT_MOST_ONCE);
+    mqttOptions.protocolVersion = MQTT_PROTOCOL_VERSION_5;
+    mqttOptions.receiveMaximum = 10;
+    mqttOptions.maximumPacketSize = 0x1000;
+
+    const unsigned char CONNECT_VALUE[] = { 0x10, 0x40, 0x00, 0x04, 0x4d, 0x51, 0x54, 0x54, 0x05, 0x26, 0x00, 0x14, 0x08, 0x21, 0x00, 0x0a, \
+        0x27, 0x00, 0x00, 0x10, 0x00, 0x00, 0x14, 0x73, 0x69, 0x6e, 0x67, 0x6c, 0x65, 0x5f, 0x74, 0x68, 0x72, 0x65, 0x61, 0x64, 0x65, 0x64, \
+        0x5f, 0x74, 0x65, 0x73, 0x74, 0x00, 0x00, 0x0a, 0x57, 0x69, 0x6c, 0x6c, 0x20, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x00, 0x08, 0x57, 0x69, \
+        0x6c, 0x6c, 0x20, 0x4d, 0x73, 0x67 };
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_prepend(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_connect(&mqttOptions, NULL);
+
+    unsigned char* data = real_BUFFER_u_char(handle);
+    size_t length = BUFFER_length(handle);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, sizeof(CONNECT_VALUE), length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, CONNECT_VALUE, length));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    real_BUFFER_delete(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_038: [mqtt_codec_publish_v5 shall encode a PUBLISH like mqtt_codec_publish followed by a property list holding the payload format indicator, message expiry interval, topic alias, content type, response topic and correlation data set in properties, an empty list if properties is NULL.] */
+TEST_FUNCTION(mqtt_codec_publish_v5_topic_alias_succeeds)
+{
+    // arrange
+    MQTT_PROPERTIES properties = { 0 };
+    properties.present = MQTT_PROPERTY_MASK(MQTT_PROPERTY_TOPIC_ALIAS);
+    properties.topicAlias = 1;
+
+    const unsigned char PUBLISH_VALUE[] = { 0x3a, 0x21, 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, 0x03, 0x23, \
+        0x00, 0x01, 0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_prepend(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+
+    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_publish_v5(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, TEST_TOPIC_NAME, TEST_MESSAGE, TEST_MESSAGE_LEN, &properties, NULL);
+
+    unsigned char* data = real_BUFFER_u_char(handle);
+    size_t length = BUFFER_length(handle);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, sizeof(PUBLISH_VALUE), length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, PUBLISH_VALUE, length));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    real_BUFFER_delete(handle);
+}
+
+TEST_FUNCTION(mqtt_codec_publish_v5_empty_topic_with_alias_succeeds)
+{
+    // arrange
+    MQTT_PROPERTIES properties = { 0 };
+    properties.present = MQTT_PROPERTY_MASK(MQTT_PROPERTY_TOPIC_ALIAS);
+    properties.topicAlias = 1;
+
+    const unsigned char PUBLISH_VALUE[] = { 0x3a, 0x17, 0x00, 0x00, 0x12, 0x34, 0x03, 0x23, 0x00, 0x01, \
+        0x4d, 0x65, 0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_prepend(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+
+    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_publish_v5(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, "", TEST_MESSAGE, TEST_MESSAGE_LEN, &properties, NULL);
+
+    unsigned char* data = real_BUFFER_u_char(handle);
+    size_t length = BUFFER_length(handle);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, sizeof(PUBLISH_VALUE), length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, PUBLISH_VALUE, length));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    real_BUFFER_delete(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_043: [mqtt_codec_publish_v5 shall return NULL if topicName is empty and properties does not hold a non-zero topic alias.] */
+TEST_FUNCTION(mqtt_codec_publish_v5_empty_topic_without_alias_fails)
+{
+    // arrange
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_publish_v5(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, "", TEST_MESSAGE, TEST_MESSAGE_LEN, NULL, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_051: [mqtt_codec_publish_header shall encode the fixed and variable header of a PUBLISH like mqtt_codec_publish, with a remaining length that counts payloadLength bytes of payload that are not part of the returned buffer.] */
+TEST_FUNCTION(mqtt_codec_publish_header_succeeds)
+{
+    // arrange
+    const unsigned char PUBLISH_HEADER_VALUE[] = { 0x3a, 0xd6, 0x01, 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34 };
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_prepend(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_publish_header(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, TEST_TOPIC_NAME, 200, NULL);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, sizeof(PUBLISH_HEADER_VALUE), real_BUFFER_length(handle));
+    ASSERT_ARE_EQUAL(int, 0, memcmp(real_BUFFER_u_char(handle), PUBLISH_HEADER_VALUE, sizeof(PUBLISH_HEADER_VALUE)));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    real_BUFFER_delete(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_052: [mqtt_codec_publish_header shall return NULL if topicName is NULL or the remaining length would be greater than 268435455.] */
+TEST_FUNCTION(mqtt_codec_publish_header_remaining_length_too_long_fail)
+{
+    // arrange
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_publish_header(DELIVER_AT_LEAST_ONCE, true, false, TEST_PACKET_ID, TEST_TOPIC_NAME, 268435455 - 10, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_053: [mqtt_codec_publish_header_v5 shall encode the PUBLISH header like mqtt_codec_publish_header followed by the property list of mqtt_codec_publish_v5.] */
+TEST_FUNCTION(mqtt_codec_publish_header_v5_succeeds)
+{
+    // arrange
+    const unsigned char PUBLISH_HEADER_VALUE[] = { 0x30, 0x11, 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x00 };
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_publish_header_v5(DELIVER_AT_MOST_ONCE, false, false, 0, TEST_TOPIC_NAME, 4, NULL, NULL);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, sizeof(PUBLISH_HEADER_VALUE), real_BUFFER_length(handle));
+    ASSERT_ARE_EQUAL(int, 0, memcmp(real_BUFFER_u_char(handle), PUBLISH_HEADER_VALUE, sizeof(PUBLISH_HEADER_VALUE)));
+
+    // cleanup
+    real_BUFFER_delete(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_060: [mqtt_codec_publish_template_create shall return NULL if topicName is NULL, empty or longer than 65535 bytes.] */
+TEST_FUNCTION(mqtt_codec_publish_template_create_topicName_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_PUBLISH_TEMPLATE_HANDLE handle = mqtt_codec_publish_template_create(DELIVER_AT_LEAST_ONCE, false, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_060: [mqtt_codec_publish_template_create shall return NULL if topicName is NULL, empty or longer than 65535 bytes.] */
+TEST_FUNCTION(mqtt_codec_publish_template_create_topicName_empty_fail)
+{
+    // arrange
+
+    // act
+    MQTT_PUBLISH_TEMPLATE_HANDLE handle = mqtt_codec_publish_template_create(DELIVER_AT_LEAST_ONCE, false, "");
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_061: [mqtt_codec_publish_template_create shall encode the topic and the QoS and retain flags once, in a single allocation.] */
+TEST_FUNCTION(mqtt_codec_publish_template_create_malloc_fail)
+{
+    // arrange
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG)).SetReturn(NULL);
+
+    // act
+    MQTT_PUBLISH_TEMPLATE_HANDLE handle = mqtt_codec_publish_template_create(DELIVER_AT_LEAST_ONCE, false, TEST_TOPIC_NAME);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_063: [mqtt_codec_publish_template_encode shall compute the remaining length once and write the fixed header, the cached topic, the packet id when the QoS is not 0, an empty property list when includeProperties is true and the payload into a single buffer.] */
+TEST_FUNCTION(mqtt_codec_publish_template_encode_succeeds)
+{
+    // arrange
+    const unsigned char PUBLISH_VALUE[] = { 0x3a, 0x1d, 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x12, 0x34, 0x4d, 0x65, \
+        0x73, 0x73, 0x61, 0x67, 0x65, 0x20, 0x74, 0x6f, 0x20, 0x73, 0x65, 0x6e, 0x64 };
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    MQTT_PUBLISH_TEMPLATE_HANDLE publishTemplate = mqtt_codec_publish_template_create(DELIVER_AT_LEAST_ONCE, false, TEST_TOPIC_NAME);
+    ASSERT_IS_NOT_NULL(publishTemplate);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_new());
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_PTR_ARG, sizeof(PUBLISH_VALUE)))
+        .IgnoreArgument(1);
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_publish_template_encode(publishTemplate, true, TEST_PACKET_ID, false, TEST_MESSAGE, TEST_MESSAGE_LEN, NULL);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, sizeof(PUBLISH_VALUE), real_BUFFER_length(handle));
+    ASSERT_ARE_EQUAL(int, 0, memcmp(real_BUFFER_u_char(handle), PUBLISH_VALUE, sizeof(PUBLISH_VALUE)));
+    ASSERT_ARE_EQUAL(int, DELIVER_AT_LEAST_ONCE, mqtt_codec_publish_template_get_qos(publishTemplate));
+
+    // cleanup
+    real_BUFFER_delete(handle);
+    mqtt_codec_publish_template_destroy(publishTemplate);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_063: [mqtt_codec_publish_template_encode shall compute the remaining length once and write the fixed header, the cached topic, the packet id when the QoS is not 0, an empty property list when includeProperties is true and the payload into a single buffer.] */
+TEST_FUNCTION(mqtt_codec_publish_template_encode_v5_retain_succeeds)
+{
+    // arrange
+    const unsigned char PUBLISH_VALUE[] = { 0x31, 0x11, 0x00, 0x0a, 0x74, 0x6f, 0x70, 0x69, 0x63, 0x20, 0x4e, 0x61, 0x6d, 0x65, 0x00, 0x4d, 0x65, 0x73, 0x73 };
+
+    MQTT_PUBLISH_TEMPLATE_HANDLE publishTemplate = mqtt_codec_publish_template_create(DELIVER_AT_MOST_ONCE, true, TEST_TOPIC_NAME);
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_publish_template_encode(publishTemplate, false, TEST_PACKET_ID, true, TEST_MESSAGE, 4, NULL);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, sizeof(PUBLISH_VALUE), real_BUFFER_length(handle));
+    ASSERT_ARE_EQUAL(int, 0, memcmp(real_BUFFER_u_char(handle), PUBLISH_VALUE, sizeof(PUBLISH_VALUE)));
+
+    // cleanup
+    real_BUFFER_delete(handle);
+    mqtt_codec_publish_template_destroy(publishTemplate);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_062: [mqtt_codec_publish_template_encode shall return NULL if handle is NULL, msgBuffer is NULL with a non-zero buffLen or the remaining length would be greater than 268435455.] */
+TEST_FUNCTION(mqtt_codec_publish_template_encode_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_publish_template_encode(NULL, false, TEST_PACKET_ID, false, TEST_MESSAGE, TEST_MESSAGE_LEN, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_062: [mqtt_codec_publish_template_encode shall return NULL if handle is NULL, msgBuffer is NULL with a non-zero buffLen or the remaining length would be greater than 268435455.] */
+TEST_FUNCTION(mqtt_codec_publish_template_encode_remaining_length_too_long_fail)
+{
+    // arrange
+    MQTT_PUBLISH_TEMPLATE_HANDLE publishTemplate = mqtt_codec_publish_template_create(DELIVER_AT_LEAST_ONCE, false, TEST_TOPIC_NAME);
+    umock_c_reset_all_calls();
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_publish_template_encode(publishTemplate, false, TEST_PACKET_ID, false, TEST_MESSAGE, 268435455 - 10, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_publish_template_destroy(publishTemplate);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_063: [mqtt_codec_publish_template_encode shall compute the remaining length once and write the fixed header, the cached topic, the packet id when the QoS is not 0, an empty property list when includeProperties is true and the payload into a single buffer.] */
+TEST_FUNCTION(mqtt_codec_publish_template_encode_pre_build_fail)
+{
+    // arrange
+    MQTT_PUBLISH_TEMPLATE_HANDLE publishTemplate = mqtt_codec_publish_template_create(DELIVER_AT_LEAST_ONCE, false, TEST_TOPIC_NAME);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_PTR_ARG, IGNORED_NUM_ARG)).SetReturn(__FAILURE__);
+    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_publish_template_encode(publishTemplate, false, TEST_PACKET_ID, false, TEST_MESSAGE, TEST_MESSAGE_LEN, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_publish_template_destroy(publishTemplate);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_039: [mqtt_codec_subscribe_v5 and mqtt_codec_unsubscribe_v5 shall encode the packet like their 3.1.1 counterparts with an empty property list after the packet id.] */
+TEST_FUNCTION(mqtt_codec_subscribe_v5_succeeds)
+{
+    // arrange
+    unsigned char SUBSCRIBE_VALUE[] = { 0x82, 0x1b, 0x12, 0x34, 0x00, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x31, 0x01, 0x00, 0x09, 0x73, 0x75, 0x62, 0x54, 0x6f, 0x70, 0x69, 0x63, 0x32, 0x02 };
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_pre_build(IGNORED_PTR_ARG, IGNORED_NUM_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_prepend(IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+
+    // act
+    BUFFER_HANDLE handle = mqtt_codec_subscribe_v5(TEST_PACKET_ID, TEST_SUBSCRIBE_PAYLOAD, 2, NULL);
+
+    unsigned char* data = real_BUFFER_u_char(handle);
+    size_t length = BUFFER_length(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, sizeof(SUBSCRIBE_VALUE), length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(data, SUBSCRIBE_VALUE, length));
+
+    // cleanup
+    real_BUFFER_delete(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_040: [If the parameters buffer, properties or consumed are NULL then mqtt_codec_decode_properties shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_codec_decode_properties_buffer_NULL_fails)
+{
+    // arrange
+    MQTT_PROPERTIES properties;
+    size_t consumed;
+
+    // act
+    int result = mqtt_codec_decode_properties(NULL, 1, &properties, &consumed);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_041: [mqtt_codec_decode_properties shall decode the variable byte integer length and every property that follows into properties, and store the number of bytes read in consumed.] */
+TEST_FUNCTION(mqtt_codec_decode_properties_connack_succeeds)
+{
+    // arrange
+    const uint8_t CONNACK_PROPERTIES[] = { 0x0f, 0x21, 0x00, 0x0a, 0x27, 0x00, 0x00, 0x04, 0x00, 0x26, 0x00, 0x01, 0x6b, 0x00, 0x01, 0x76, 0xff };
+    MQTT_PROPERTIES properties;
+    size_t consumed = 0;
+
+    // act
+    int result = mqtt_codec_decode_properties(CONNACK_PROPERTIES, sizeof(CONNACK_PROPERTIES), &properties, &consumed);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 16, consumed);
+    ASSERT_IS_TRUE(MQTT_PROPERTY_IS_SET(&properties, MQTT_PROPERTY_RECEIVE_MAXIMUM));
+    ASSERT_IS_FALSE(MQTT_PROPERTY_IS_SET(&properties, MQTT_PROPERTY_TOPIC_ALIAS_MAXIMUM));
+    ASSERT_ARE_EQUAL(int, 10, (int)properties.receiveMaximum);
+    ASSERT_ARE_EQUAL(int, 0x400, (int)properties.maximumPacketSize);
+    ASSERT_ARE_EQUAL(size_t, 1, properties.userPropertyCount);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_042: [If the property list is truncated, malformed or holds an unknown property mqtt_codec_decode_properties shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_codec_decode_properties_truncated_fails)
+{
+    // arrange
+    const uint8_t TRUNCATED_PROPERTIES[] = { 0x03, 0x21, 0x00 };
+    MQTT_PROPERTIES properties;
+    size_t consumed = 0;
+
+    // act
+    int result = mqtt_codec_decode_properties(TRUNCATED_PROPERTIES, sizeof(TRUNCATED_PROPERTIES), &properties, &consumed);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_042: [If the property list is truncated, malformed or holds an unknown property mqtt_codec_decode_properties shall return a non-zero value.] */
+TEST_FUNCTION(mqtt_codec_decode_properties_unknown_property_fails)
+{
+    // arrange
+    const uint8_t UNKNOWN_PROPERTIES[] = { 0x02, 0x55, 0x00 };
+    MQTT_PROPERTIES properties;
+    size_t consumed = 0;
+
+    // act
+    int result = mqtt_codec_decode_properties(UNKNOWN_PROPERTIES, sizeof(UNKNOWN_PROPERTIES), &properties, &consumed);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/* Tests_SRS_MQTT_CODEC_07_044: [ If the handle parameter is NULL then mqtt_codec_set_max_packet_size shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_codec_set_max_packet_size_handle_NULL_fails)
+{
+    // arrange
+
+    // act
+    int result = mqtt_codec_set_max_packet_size(NULL, 128);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_045: [ When a maximum packet size is set mqtt_codec_bytesReceived shall return a non-zero value for a packet whose fixed header declares a larger packet, before allocating any memory for it. ] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_exceeds_max_packet_size_fails)
+{
+    // arrange
+    unsigned char PUBLISH[] = { 0x30, 0x80, 0x01 };
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+    (void)mqtt_codec_set_max_packet_size(handle, 130);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_codec_bytesReceived(handle, PUBLISH, sizeof(PUBLISH));
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_046: [ mqtt_codec_bytesReceived shall return a non-zero value when the remaining length of a packet continues past four bytes. ] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_remaining_length_too_long_fails)
+{
+    // arrange
+    unsigned char PUBLISH[] = { 0x30, 0x80, 0x80, 0x80, 0x80, 0x01 };
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_codec_bytesReceived(handle, PUBLISH, sizeof(PUBLISH));
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_four_byte_remaining_length_succeed)
+{
+    // arrange
+    unsigned char PUBLISH[] = { 0x30, 0x80, 0x80, 0x80, 0x01 };
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_new());
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_PTR_ARG, 2097152));
+
+    // act
+    int result = mqtt_codec_bytesReceived(handle, PUBLISH, sizeof(PUBLISH));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Codes_SRS_MQTT_CODEC_07_033: [mqtt_codec_bytesReceived constructs a sequence of bytes into the corresponding MQTT packets and on success returns zero.] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_split_remaining_length_succeed)
+{
+    // arrange
+    unsigned char PUBLISH_START[] = { 0x30, 0x80 };
+    unsigned char PUBLISH_END[] = { 0x80, 0x01 };
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+    (void)mqtt_codec_bytesReceived(handle, PUBLISH_START, sizeof(PUBLISH_START));
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_new());
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_PTR_ARG, 16384));
+
+    // act
+    int result = mqtt_codec_bytesReceived(handle, PUBLISH_END, sizeof(PUBLISH_END));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_047: [ If the handle parameter is NULL then mqtt_codec_set_publish_stream shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_codec_set_publish_stream_handle_NULL_fails)
+{
+    // arrange
+
+    // act
+    int result = mqtt_codec_set_publish_stream(NULL, 4, false, TestOnStreamCallback);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_048: [ A PUBLISH whose remaining length is larger than the stream threshold shall not be buffered, mqtt_codec_bytesReceived shall pass its variable header and then its payload chunks to the ON_PUBLISH_STREAM_CALLBACK. ] */
+/* Tests_SRS_MQTT_CODEC_07_049: [ Payload chunks of a streamed PUBLISH shall point into the buffer passed to mqtt_codec_bytesReceived, one chunk per call for the bytes of the packet it holds. ] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_publish_streamed_succeed)
+{
+    // arrange
+    size_t i;
+    //                            1     2     3     4     a     /     b     12    34    d     a     t     a
+    unsigned char PUBLISH[] = { 0x32, 0x0b, 0x00, 0x03, 0x61, 0x2f, 0x62, 0x12, 0x34, 0x64, 0x61, 0x74, 0x61 };
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+    (void)mqtt_codec_set_publish_stream(handle, 4, false, TestOnStreamCallback);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_new());
+    STRICT_EXPECTED_CALL(BUFFER_pre_build(IGNORED_PTR_ARG, 2));
+    for (i = 0; i < 2; i++)
+    {
+        EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+        EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    }
+    STRICT_EXPECTED_CALL(BUFFER_enlarge(IGNORED_PTR_ARG, 5));
+    for (i = 0; i < 5; i++)
+    {
+        EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+        EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    }
+    EXPECTED_CALL(BUFFER_delete(IGNORED_PTR_ARG));
+
+    // act
+    int result = mqtt_codec_bytesReceived(handle, PUBLISH, sizeof(PUBLISH));
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 7, g_stream_header_length);
+    ASSERT_ARE_EQUAL(size_t, 4, g_stream_payload_length);
+    ASSERT_ARE_EQUAL(size_t, 1, g_stream_chunks);
+    ASSERT_ARE_EQUAL(size_t, 4, g_stream_received);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(g_stream_payload, PUBLISH + 9, 4));
+    ASSERT_IS_FALSE(g_callbackInvoked);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_050: [ mqtt_codec_bytesReceived shall return a non-zero value when the variable header of a streamed PUBLISH is malformed or longer than the packet. ] */
+TEST_FUNCTION(mqtt_codec_bytesReceived_publish_streamed_topic_too_long_fails)
+{
+    // arrange
+    unsigned char PUBLISH[] = { 0x30, 0x08, 0x00, 0x40, 0x61, 0x2f, 0x62 };
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+    (void)mqtt_codec_set_publish_stream(handle, 4, false, TestOnStreamCallback);
+
+    // act
+    int result = mqtt_codec_bytesReceived(handle, PUBLISH, sizeof(PUBLISH));
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 0, g_stream_header_length);
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_054: [ If the handle, packets or count parameter is NULL, capacity is 0 or buffer is NULL with a non-zero length then mqtt_codec_decode_batch shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_codec_decode_batch_handle_NULL_fails)
+{
+    // arrange
+    unsigned char PINGRESP[] = { 0xD0, 0x00 };
+    MQTT_PACKET_DESC packets[2];
+    size_t count;
+
+    // act
+    int result = mqtt_codec_decode_batch(NULL, PINGRESP, sizeof(PINGRESP), packets, 2, &count);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_054: [ If the handle, packets or count parameter is NULL, capacity is 0 or buffer is NULL with a non-zero length then mqtt_codec_decode_batch shall return a non-zero value. ] */
+TEST_FUNCTION(mqtt_codec_decode_batch_capacity_0_fails)
+{
+    // arrange
+    unsigned char PINGRESP[] = { 0xD0, 0x00 };
+    MQTT_PACKET_DESC packets[2];
+    size_t count;
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_codec_decode_batch(handle, PINGRESP, sizeof(PINGRESP), packets, 0, &count);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_055: [ mqtt_codec_decode_batch shall fill packets with the type, flags, variable header offset and remaining length of each complete packet, up to capacity, and set count to their number. ] */
+/* Tests_SRS_MQTT_CODEC_07_056: [ The bytes of an incomplete packet at the end of buffer shall be kept in the codec and the packet reported by a following call once the rest of it is received. ] */
+TEST_FUNCTION(mqtt_codec_decode_batch_succeed)
+{
+    // arrange
+    unsigned char PACKETS[] = { 0x40, 0x02, 0x12, 0x34, 0xD0, 0x00, 0x32, 0x08, 0x00 };
+    MQTT_PACKET_DESC packets[4];
+    size_t count;
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_new());
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_PTR_ARG, 3));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+
+    // act
+    int result = mqtt_codec_decode_batch(handle, PACKETS, sizeof(PACKETS), packets, 4, &count);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 2, count);
+    ASSERT_ARE_EQUAL(int, PUBACK_TYPE, packets[0].packetType);
+    ASSERT_ARE_EQUAL(size_t, 2, packets[0].offset);
+    ASSERT_ARE_EQUAL(size_t, 2, packets[0].length);
+    ASSERT_IS_TRUE(packets[0].data == PACKETS + 2);
+    ASSERT_IS_FALSE(packets[0].carriedOver);
+    ASSERT_ARE_EQUAL(int, PINGRESP_TYPE, packets[1].packetType);
+    ASSERT_ARE_EQUAL(size_t, 6, packets[1].offset);
+    ASSERT_ARE_EQUAL(size_t, 0, packets[1].length);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_056: [ The bytes of an incomplete packet at the end of buffer shall be kept in the codec and the packet reported by a following call once the rest of it is received. ] */
+TEST_FUNCTION(mqtt_codec_decode_batch_carried_over_succeed)
+{
+    // arrange
+    unsigned char PUBLISH_START[] = { 0x32, 0x08, 0x00, 0x03 };
+    unsigned char PUBLISH_END[] = { 0x61, 0x2f, 0x62, 0x12, 0x34, 0x01, 0xD0, 0x00 };
+    unsigned char VARIABLE_HEADER[] = { 0x00, 0x03, 0x61, 0x2f, 0x62, 0x12, 0x34, 0x01 };
+    MQTT_PACKET_DESC packets[4];
+    size_t count;
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+    (void)mqtt_codec_decode_batch(handle, PUBLISH_START, sizeof(PUBLISH_START), packets, 4, &count);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_length(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_enlarge(IGNORED_PTR_ARG, 6));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+    EXPECTED_CALL(BUFFER_u_char(IGNORED_PTR_ARG));
+
+    // act
+    int result = mqtt_codec_decode_batch(handle, PUBLISH_END, sizeof(PUBLISH_END), packets, 4, &count);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 2, count);
+    ASSERT_ARE_EQUAL(int, PUBLISH_TYPE, packets[0].packetType);
+    ASSERT_ARE_EQUAL(int, 0x02, packets[0].flags);
+    ASSERT_IS_TRUE(packets[0].carriedOver);
+    ASSERT_ARE_EQUAL(size_t, 8, packets[0].length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(packets[0].data, VARIABLE_HEADER, sizeof(VARIABLE_HEADER)));
+    ASSERT_ARE_EQUAL(int, PINGRESP_TYPE, packets[1].packetType);
+    ASSERT_IS_FALSE(packets[1].carriedOver);
+    ASSERT_ARE_EQUAL(size_t, 8, packets[1].offset);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_057: [ When packets is full the bytes that are not reported shall be kept in the codec and reported by the following calls. ] */
+TEST_FUNCTION(mqtt_codec_decode_batch_capacity_reached_succeed)
+{
+    // arrange
+    unsigned char PACKETS[] = { 0x40, 0x02, 0x12, 0x34, 0xD0, 0x00 };
+    MQTT_PACKET_DESC packets[1];
+    size_t count;
+    size_t drained;
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_codec_decode_batch(handle, PACKETS, sizeof(PACKETS), packets, 1, &count);
+    int drainResult = mqtt_codec_decode_batch(handle, NULL, 0, packets, 1, &drained);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(int, 0, drainResult);
+    ASSERT_ARE_EQUAL(size_t, 1, count);
+    ASSERT_ARE_EQUAL(size_t, 1, drained);
+    ASSERT_ARE_EQUAL(int, PINGRESP_TYPE, packets[0].packetType);
+    ASSERT_IS_TRUE(packets[0].carriedOver);
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_058: [ mqtt_codec_decode_batch shall return a non-zero value and drop the carried bytes when a packet has a malformed remaining length or is larger than the maximum packet size. ] */
+TEST_FUNCTION(mqtt_codec_decode_batch_remaining_length_too_long_fails)
+{
+    // arrange
+    unsigned char PUBLISH[] = { 0x30, 0x80, 0x80, 0x80, 0x80, 0x01 };
+    MQTT_PACKET_DESC packets[2];
+    size_t count;
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_codec_decode_batch(handle, PUBLISH, sizeof(PUBLISH), packets, 2, &count);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 0, count);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
+/* Tests_SRS_MQTT_CODEC_07_059: [ mqtt_codec_decode_batch shall return a non-zero value while mqtt_codec_bytesReceived is in the middle of a packet. ] */
+TEST_FUNCTION(mqtt_codec_decode_batch_bytesReceived_in_progress_fails)
+{
+    // arrange
+    unsigned char PUBACK_START[] = { 0x40, 0x02, 0x12 };
+    unsigned char PINGRESP[] = { 0xD0, 0x00 };
+    MQTT_PACKET_DESC packets[2];
+    size_t count;
+    MQTTCODEC_HANDLE handle = mqtt_codec_create(TestOnCompleteCallback, NULL);
+    (void)mqtt_codec_bytesReceived(handle, PUBACK_START, sizeof(PUBACK_START));
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_codec_decode_batch(handle, PINGRESP, sizeof(PINGRESP), packets, 2, &count);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_codec_destroy(handle);
+}
+
 END_TEST_SUITE(mqtt_codec_ut)
@@ -0,0 +1,485 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "umock_c.h"
+
+#include "azure_umqtt_c/mqtt_compress.h"
+
+#define TEST_BUFFER_SIZE        20000
+
+static const uint8_t TEST_SHORT_PAYLOAD[] = { 'h', 'e', 'l', 'l', 'o' };
+
+// "MQTT " eight times then "broker" as the reference LZ4 encoder writes it
+static const uint8_t TEST_REFERENCE_BLOCK[] = { 0x5F, 'M', 'Q', 'T', 'T', ' ', 0x05, 0x00, 0x10, 0x60, 'b', 'r', 'o', 'k', 'e', 'r' };
+static const char* TEST_REFERENCE_TEXT = "MQTT MQTT MQTT MQTT MQTT MQTT MQTT MQTT broker";
+
+// One literal, a match of 8 at offset 1 that overlaps the bytes it produces, then one literal
+static const uint8_t TEST_OVERLAP_BLOCK[] = { 0x14, 'a', 0x01, 0x00, 0x10, 'b' };
+
+static uint8_t g_payload[TEST_BUFFER_SIZE];
+static uint8_t g_encoded[TEST_BUFFER_SIZE + TEST_BUFFER_SIZE / 255 + 16];
+static uint8_t g_decoded[TEST_BUFFER_SIZE];
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    char temp_str[256];
+    (void)snprintf(temp_str, sizeof(temp_str), "umock_c reported error :%s", ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+    ASSERT_FAIL(temp_str);
+}
+
+static void fill_text(uint8_t* payload, size_t length)
+{
+    static const char* words[] = { "temperature", "humidity", "pressure", "device", "reading", "value" };
+    size_t index = 0;
+    size_t word = 0;
+    while (index < length)
+    {
+        const char* iterator = words[word++ % (sizeof(words) / sizeof(words[0]))];
+        while (*iterator != '\0' && index < length)
+        {
+            payload[index++] = (uint8_t)*iterator++;
+        }
+        if (index < length)
+        {
+            payload[index++] = ' ';
+        }
+    }
+}
+
+static void fill_random(uint8_t* payload, size_t length)
+{
+    uint32_t state = 0x2545F491;
+    size_t index;
+    for (index = 0; index < length; index++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        payload[index] = (uint8_t)state;
+    }
+}
+
+static size_t encode_and_decode(const uint8_t* payload, size_t length)
+{
+    size_t encodedLength = 0;
+    size_t decodedLength = 0;
+    ASSERT_ARE_EQUAL(int, 0, mqtt_compress_lz4_encode(payload, length, g_encoded, mqtt_compress_lz4_bound(length), &encodedLength));
+    ASSERT_IS_TRUE(encodedLength <= mqtt_compress_lz4_bound(length));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_compress_lz4_decode(g_encoded, encodedLength, g_decoded, length, &decodedLength));
+    ASSERT_ARE_EQUAL(size_t, length, decodedLength);
+    ASSERT_ARE_EQUAL(int, 0, length == 0 ? 0 : memcmp(payload, g_decoded, length));
+    return encodedLength;
+}
+
+BEGIN_TEST_SUITE(mqtt_compress_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_001: [mqtt_compress_lz4_bound shall return the largest size of the LZ4 block of a payload of length bytes, length + length / 255 + 16.]*/
+TEST_FUNCTION(mqtt_compress_lz4_bound_succeed)
+{
+    // arrange
+
+    // act
+    size_t emptyBound = mqtt_compress_lz4_bound(0);
+    size_t bound = mqtt_compress_lz4_bound(1000);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 16, emptyBound);
+    ASSERT_ARE_EQUAL(size_t, 1000 + 1000 / 255 + 16, bound);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_002: [If buffer or encodedLength is NULL, or payload is NULL while length is not 0, then mqtt_compress_lz4_encode shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_compress_lz4_encode_payload_NULL_fail)
+{
+    // arrange
+    size_t encodedLength = 0;
+
+    // act
+    int result = mqtt_compress_lz4_encode(NULL, 10, g_encoded, sizeof(g_encoded), &encodedLength);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_002: [If buffer or encodedLength is NULL, or payload is NULL while length is not 0, then mqtt_compress_lz4_encode shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_compress_lz4_encode_buffer_NULL_fail)
+{
+    // arrange
+    size_t encodedLength = 0;
+
+    // act
+    int result = mqtt_compress_lz4_encode(TEST_SHORT_PAYLOAD, sizeof(TEST_SHORT_PAYLOAD), NULL, sizeof(g_encoded), &encodedLength);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_002: [If buffer or encodedLength is NULL, or payload is NULL while length is not 0, then mqtt_compress_lz4_encode shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_compress_lz4_encode_encodedLength_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_compress_lz4_encode(TEST_SHORT_PAYLOAD, sizeof(TEST_SHORT_PAYLOAD), g_encoded, sizeof(g_encoded), NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_003: [A payload of 12 bytes or less shall be encoded as a single sequence of literals.]*/
+/*Tests_SRS_MQTT_COMPRESS_07_007: [On success mqtt_compress_lz4_encode shall set encodedLength to the size of the block and return 0.]*/
+TEST_FUNCTION(mqtt_compress_lz4_encode_empty_payload_succeed)
+{
+    // arrange
+
+    // act
+    size_t encodedLength = encode_and_decode(NULL, 0);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, encodedLength);
+    ASSERT_ARE_EQUAL(int, 0, g_encoded[0]);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_003: [A payload of 12 bytes or less shall be encoded as a single sequence of literals.]*/
+/*Tests_SRS_MQTT_COMPRESS_07_005: [Each sequence shall be written as a token, the literal length run, the literals, the little endian offset and the match length run, as the LZ4 block format defines them.]*/
+TEST_FUNCTION(mqtt_compress_lz4_encode_short_payload_stored_as_literals)
+{
+    // arrange
+    const uint8_t expected[] = { 0x50, 'h', 'e', 'l', 'l', 'o' };
+
+    // act
+    size_t encodedLength = encode_and_decode(TEST_SHORT_PAYLOAD, sizeof(TEST_SHORT_PAYLOAD));
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, sizeof(expected), encodedLength);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(expected, g_encoded, sizeof(expected)));
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_004: [mqtt_compress_lz4_encode shall find matches of at least 4 bytes within the last 65535 bytes with a hash table on the stack, leaving the last 5 bytes as literals.]*/
+/*Tests_SRS_MQTT_COMPRESS_07_007: [On success mqtt_compress_lz4_encode shall set encodedLength to the size of the block and return 0.]*/
+/*Tests_SRS_MQTT_COMPRESS_07_013: [On success mqtt_compress_lz4_decode shall set decodedLength to the decompressed size and return 0.]*/
+TEST_FUNCTION(mqtt_compress_lz4_encode_text_round_trip_shrinks)
+{
+    // arrange
+    fill_text(g_payload, 4000);
+
+    // act
+    size_t encodedLength = encode_and_decode(g_payload, 4000);
+
+    // assert
+    ASSERT_IS_TRUE(encodedLength < 4000 / 4);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_004: [mqtt_compress_lz4_encode shall find matches of at least 4 bytes within the last 65535 bytes with a hash table on the stack, leaving the last 5 bytes as literals.]*/
+/*Tests_SRS_MQTT_COMPRESS_07_005: [Each sequence shall be written as a token, the literal length run, the literals, the little endian offset and the match length run, as the LZ4 block format defines them.]*/
+TEST_FUNCTION(mqtt_compress_lz4_encode_long_match_round_trip)
+{
+    // arrange
+    memset(g_payload, 'a', TEST_BUFFER_SIZE);
+
+    // act
+    size_t encodedLength = encode_and_decode(g_payload, TEST_BUFFER_SIZE);
+
+    // assert
+    ASSERT_IS_TRUE(encodedLength < 100);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_004: [mqtt_compress_lz4_encode shall find matches of at least 4 bytes within the last 65535 bytes with a hash table on the stack, leaving the last 5 bytes as literals.]*/
+TEST_FUNCTION(mqtt_compress_lz4_encode_random_round_trip)
+{
+    // arrange
+    fill_random(g_payload, TEST_BUFFER_SIZE);
+
+    // act
+    size_t encodedLength = encode_and_decode(g_payload, TEST_BUFFER_SIZE);
+
+    // assert
+    ASSERT_IS_TRUE(encodedLength > TEST_BUFFER_SIZE);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_001: [mqtt_compress_lz4_bound shall return the largest size of the LZ4 block of a payload of length bytes, length + length / 255 + 16.]*/
+/*Tests_SRS_MQTT_COMPRESS_07_004: [mqtt_compress_lz4_encode shall find matches of at least 4 bytes within the last 65535 bytes with a hash table on the stack, leaving the last 5 bytes as literals.]*/
+TEST_FUNCTION(mqtt_compress_lz4_encode_every_length_round_trip)
+{
+    // arrange
+    size_t length;
+    fill_text(g_payload, 300);
+
+    // act
+    for (length = 0; length <= 300; length++)
+    {
+        // assert
+        (void)encode_and_decode(g_payload, length);
+    }
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_006: [If the block does not fit in bufferSize then mqtt_compress_lz4_encode shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_compress_lz4_encode_buffer_too_small_fail)
+{
+    // arrange
+    size_t encodedLength = 0;
+    size_t neededLength = 0;
+    fill_text(g_payload, 4000);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_compress_lz4_encode(g_payload, 4000, g_encoded, sizeof(g_encoded), &neededLength));
+
+    // act
+    int result = mqtt_compress_lz4_encode(g_payload, 4000, g_encoded, neededLength - 1, &encodedLength);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 0, encodedLength);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_013: [On success mqtt_compress_lz4_decode shall set decodedLength to the decompressed size and return 0.]*/
+TEST_FUNCTION(mqtt_compress_lz4_decode_reference_block_succeed)
+{
+    // arrange
+    size_t decodedLength = 0;
+
+    // act
+    int result = mqtt_compress_lz4_decode(TEST_REFERENCE_BLOCK, sizeof(TEST_REFERENCE_BLOCK), g_decoded, sizeof(g_decoded), &decodedLength);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, strlen(TEST_REFERENCE_TEXT), decodedLength);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(TEST_REFERENCE_TEXT, g_decoded, decodedLength));
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_012: [mqtt_compress_lz4_decode shall copy a match a byte at a time so a match may overlap the bytes it produces.]*/
+TEST_FUNCTION(mqtt_compress_lz4_decode_overlapping_match_succeed)
+{
+    // arrange
+    size_t decodedLength = 0;
+
+    // act
+    int result = mqtt_compress_lz4_decode(TEST_OVERLAP_BLOCK, sizeof(TEST_OVERLAP_BLOCK), g_decoded, sizeof(g_decoded), &decodedLength);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 10, decodedLength);
+    ASSERT_ARE_EQUAL(int, 0, memcmp("aaaaaaaaab", g_decoded, decodedLength));
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_011: [If the literals or a match do not fit in bufferSize then mqtt_compress_lz4_decode shall return a non-zero value without writing past the buffer.]*/
+TEST_FUNCTION(mqtt_compress_lz4_decode_buffer_too_small_fail)
+{
+    // arrange
+    size_t decodedLength = 0;
+
+    // act
+    int result = mqtt_compress_lz4_decode(TEST_OVERLAP_BLOCK, sizeof(TEST_OVERLAP_BLOCK), g_decoded, 9, &decodedLength);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 0, decodedLength);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_011: [If the literals or a match do not fit in bufferSize then mqtt_compress_lz4_decode shall return a non-zero value without writing past the buffer.]*/
+TEST_FUNCTION(mqtt_compress_lz4_decode_literals_larger_than_buffer_fail)
+{
+    // arrange
+    size_t decodedLength = 0;
+
+    // act
+    int result = mqtt_compress_lz4_decode(TEST_REFERENCE_BLOCK, sizeof(TEST_REFERENCE_BLOCK), g_decoded, 4, &decodedLength);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_010: [If an offset is 0 or points before the start of the decoded bytes then mqtt_compress_lz4_decode shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_compress_lz4_decode_zero_offset_fail)
+{
+    // arrange
+    const uint8_t block[] = { 0x14, 'a', 0x00, 0x00, 0x10, 'b' };
+    size_t decodedLength = 0;
+
+    // act
+    int result = mqtt_compress_lz4_decode(block, sizeof(block), g_decoded, sizeof(g_decoded), &decodedLength);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_010: [If an offset is 0 or points before the start of the decoded bytes then mqtt_compress_lz4_decode shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_compress_lz4_decode_offset_before_start_fail)
+{
+    // arrange
+    const uint8_t block[] = { 0x14, 'a', 0x02, 0x00, 0x10, 'b' };
+    size_t decodedLength = 0;
+
+    // act
+    int result = mqtt_compress_lz4_decode(block, sizeof(block), g_decoded, sizeof(g_decoded), &decodedLength);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_009: [If a length run, the literals or an offset goes past the end of the payload then mqtt_compress_lz4_decode shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_compress_lz4_decode_literals_past_end_fail)
+{
+    // arrange
+    const uint8_t block[] = { 0x50, 'a', 'b' };
+    size_t decodedLength = 0;
+
+    // act
+    int result = mqtt_compress_lz4_decode(block, sizeof(block), g_decoded, sizeof(g_decoded), &decodedLength);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_009: [If a length run, the literals or an offset goes past the end of the payload then mqtt_compress_lz4_decode shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_compress_lz4_decode_truncated_literal_run_fail)
+{
+    // arrange
+    const uint8_t block[] = { 0xF0, 0xFF };
+    size_t decodedLength = 0;
+
+    // act
+    int result = mqtt_compress_lz4_decode(block, sizeof(block), g_decoded, sizeof(g_decoded), &decodedLength);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_009: [If a length run, the literals or an offset goes past the end of the payload then mqtt_compress_lz4_decode shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_compress_lz4_decode_truncated_offset_fail)
+{
+    // arrange
+    const uint8_t block[] = { 0x14, 'a', 0x01 };
+    size_t decodedLength = 0;
+
+    // act
+    int result = mqtt_compress_lz4_decode(block, sizeof(block), g_decoded, sizeof(g_decoded), &decodedLength);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_009: [If a length run, the literals or an offset goes past the end of the payload then mqtt_compress_lz4_decode shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_compress_lz4_decode_truncated_match_run_fail)
+{
+    // arrange
+    const uint8_t block[] = { 0x1F, 'a', 0x01, 0x00 };
+    size_t decodedLength = 0;
+
+    // act
+    int result = mqtt_compress_lz4_decode(block, sizeof(block), g_decoded, sizeof(g_decoded), &decodedLength);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_009: [If a length run, the literals or an offset goes past the end of the payload then mqtt_compress_lz4_decode shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_compress_lz4_decode_truncated_block_never_full_payload)
+{
+    // arrange
+    size_t encodedLength = 0;
+    size_t length;
+    fill_text(g_payload, 4000);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_compress_lz4_encode(g_payload, 4000, g_encoded, sizeof(g_encoded), &encodedLength));
+
+    // act
+    for (length = 0; length < encodedLength; length++)
+    {
+        size_t decodedLength = 0;
+        int result = mqtt_compress_lz4_decode(g_encoded, length, g_decoded, sizeof(g_decoded), &decodedLength);
+
+        // assert
+        ASSERT_IS_TRUE(result != 0 || decodedLength < 4000);
+    }
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_008: [If decodedLength is NULL, payload is NULL while length is not 0, or buffer is NULL while bufferSize is not 0, then mqtt_compress_lz4_decode shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_compress_lz4_decode_decodedLength_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_compress_lz4_decode(TEST_OVERLAP_BLOCK, sizeof(TEST_OVERLAP_BLOCK), g_decoded, sizeof(g_decoded), NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_008: [If decodedLength is NULL, payload is NULL while length is not 0, or buffer is NULL while bufferSize is not 0, then mqtt_compress_lz4_decode shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_compress_lz4_decode_payload_NULL_fail)
+{
+    // arrange
+    size_t decodedLength = 0;
+
+    // act
+    int result = mqtt_compress_lz4_decode(NULL, 6, g_decoded, sizeof(g_decoded), &decodedLength);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_COMPRESS_07_014: [mqtt_compress_get_lz4_transform shall return a transform with the content type application/x-lz4-block that calls mqtt_compress_lz4_bound, mqtt_compress_lz4_encode and mqtt_compress_lz4_decode, and the default largest decoded payload.]*/
+TEST_FUNCTION(mqtt_compress_get_lz4_transform_succeed)
+{
+    // arrange
+    size_t encodedLength = 0;
+    size_t decodedLength = 0;
+    fill_text(g_payload, 1000);
+
+    // act
+    const MQTT_PAYLOAD_TRANSFORM* transform = mqtt_compress_get_lz4_transform();
+
+    // assert
+    ASSERT_IS_NOT_NULL(transform);
+    ASSERT_ARE_EQUAL(char_ptr, MQTT_COMPRESS_LZ4_CONTENT_TYPE, transform->contentType);
+    ASSERT_ARE_EQUAL(size_t, mqtt_compress_lz4_bound(1000), transform->getEncodedBound(1000));
+    ASSERT_ARE_EQUAL(int, 0, transform->encode(g_payload, 1000, g_encoded, transform->getEncodedBound(1000), &encodedLength));
+    ASSERT_ARE_EQUAL(int, 0, transform->decode(g_encoded, encodedLength, g_decoded, 1000, &decodedLength));
+    ASSERT_ARE_EQUAL(size_t, 1000, decodedLength);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(g_payload, g_decoded, 1000));
+    ASSERT_ARE_EQUAL(size_t, 0, transform->maxDecodedLength);
+}
+
+END_TEST_SUITE(mqtt_compress_ut)
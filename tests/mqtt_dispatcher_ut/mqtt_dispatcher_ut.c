@@ -0,0 +1,622 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "umock_c.h"
+#include "umock_c_negative_tests.h"
+#include "umocktypes_charptr.h"
+#include "umocktypes_stdint.h"
+#include "umocktypes_bool.h"
+#include "umocktypes.h"
+#include "umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/condition.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_umqtt_c/mqtt_message.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_dispatcher.h"
+#include "mqtt_topic_hash.h"
+
+#define MAX_TEST_WORKERS                4
+#define MAX_TEST_MESSAGES               16
+#define TEST_LOCK_HANDLE                (LOCK_HANDLE)0x11
+#define TEST_HANDLER_CONTEXT            (void*)0x12
+#define TEST_THREAD_HANDLE(index)       (THREAD_HANDLE)(uintptr_t)(0x300 + (index))
+#define TEST_COND_HANDLE(index)         (COND_HANDLE)(uintptr_t)(0x400 + (index))
+#define TEST_SOURCE_MESSAGE(index)      (MQTT_MESSAGE_HANDLE)(uintptr_t)(0x500 + (index))
+#define TEST_CLONE_MESSAGE(index)       (MQTT_MESSAGE_HANDLE)(uintptr_t)(0x1000 + (index))
+
+// Condition_Init runs notEmpty then notFull for each worker
+#define TEST_NOT_EMPTY_HANDLE(worker)   TEST_COND_HANDLE((worker) * 2)
+#define TEST_NOT_FULL_HANDLE(worker)    TEST_COND_HANDLE((worker) * 2 + 1)
+
+typedef struct TEST_HANDLED_MESSAGE_TAG
+{
+    size_t sequence;
+    MQTT_ACK_TOKEN ackToken;
+    size_t worker;
+    bool destroyedBefore;
+} TEST_HANDLED_MESSAGE;
+
+static char g_sourceTopics[MAX_TEST_WORKERS][32];
+
+static size_t g_threadCount;
+static THREAD_START_FUNC g_threadFuncs[MAX_TEST_WORKERS];
+static void* g_threadArgs[MAX_TEST_WORKERS];
+static size_t g_runningWorker;
+static size_t g_condCount;
+static bool g_failLock;
+static bool g_runWorkerOnFullQueue;
+static bool g_stopWorkerAfterHandle;
+
+static size_t g_cloneCount;
+static const char* g_cloneTopics[MAX_TEST_MESSAGES];
+static bool g_cloneDestroyed[MAX_TEST_MESSAGES];
+
+static size_t g_handledCount;
+static TEST_HANDLED_MESSAGE g_handled[MAX_TEST_MESSAGES];
+
+static THREADAPI_RESULT my_ThreadAPI_Create(THREAD_HANDLE* threadHandle, THREAD_START_FUNC func, void* arg)
+{
+    size_t index = g_threadCount++ % MAX_TEST_WORKERS;
+    g_threadFuncs[index] = func;
+    g_threadArgs[index] = arg;
+    *threadHandle = TEST_THREAD_HANDLE(index);
+    return THREADAPI_OK;
+}
+
+static void run_worker_thread(size_t index)
+{
+    g_runningWorker = index;
+    (void)g_threadFuncs[index](g_threadArgs[index]);
+}
+
+// There are no real threads, a worker runs when destroy joins it
+static THREADAPI_RESULT my_ThreadAPI_Join(THREAD_HANDLE threadHandle, int* res)
+{
+    run_worker_thread((size_t)((uintptr_t)threadHandle - 0x300));
+    *res = 0;
+    return THREADAPI_OK;
+}
+
+static COND_HANDLE my_Condition_Init(void)
+{
+    return TEST_COND_HANDLE(g_condCount++);
+}
+
+// Stands in for the worker taking one message off a full queue while the receive path waits
+static COND_RESULT my_Condition_Wait(COND_HANDLE handle, LOCK_HANDLE lock, int timeout_milliseconds)
+{
+    (void)lock;
+    (void)timeout_milliseconds;
+    if (g_runWorkerOnFullQueue && handle == TEST_NOT_FULL_HANDLE(0))
+    {
+        g_stopWorkerAfterHandle = true;
+        run_worker_thread(0);
+        g_failLock = false;
+    }
+    return COND_OK;
+}
+
+static LOCK_RESULT my_Lock(LOCK_HANDLE handle)
+{
+    (void)handle;
+    return g_failLock ? LOCK_ERROR : LOCK_OK;
+}
+
+static MQTT_MESSAGE_HANDLE my_mqttmessage_clone(MQTT_MESSAGE_HANDLE handle)
+{
+    size_t sequence = g_cloneCount++;
+    g_cloneTopics[sequence] = g_sourceTopics[(uintptr_t)handle - 0x500];
+    g_cloneDestroyed[sequence] = false;
+    return TEST_CLONE_MESSAGE(sequence);
+}
+
+static const char* my_mqttmessage_getTopicName(MQTT_MESSAGE_HANDLE handle)
+{
+    return g_cloneTopics[(uintptr_t)handle - 0x1000];
+}
+
+static void my_mqttmessage_destroy(MQTT_MESSAGE_HANDLE handle)
+{
+    g_cloneDestroyed[(uintptr_t)handle - 0x1000] = true;
+}
+
+static void TestMessageHandler(MQTT_MESSAGE_HANDLE msgHandle, MQTT_ACK_TOKEN ackToken, void* handlerCtx)
+{
+    if (handlerCtx == TEST_HANDLER_CONTEXT && g_handledCount < MAX_TEST_MESSAGES)
+    {
+        TEST_HANDLED_MESSAGE* handled = &g_handled[g_handledCount++];
+        handled->sequence = (uintptr_t)msgHandle - 0x1000;
+        handled->ackToken = ackToken;
+        handled->worker = g_runningWorker;
+        handled->destroyedBefore = g_cloneDestroyed[handled->sequence];
+    }
+    if (g_stopWorkerAfterHandle)
+    {
+        // Fails the next lock of the worker loop so it returns
+        g_stopWorkerAfterHandle = false;
+        g_failLock = true;
+    }
+}
+
+static MQTT_DISPATCHER_HANDLE create_dispatcher(size_t workerCount, size_t queueDepth)
+{
+    MQTT_DISPATCHER_OPTIONS options;
+    MQTT_DISPATCHER_HANDLE handle;
+    options.workerCount = workerCount;
+    options.queueDepth = queueDepth;
+    handle = mqtt_dispatcher_create(&options, TestMessageHandler, TEST_HANDLER_CONTEXT);
+    ASSERT_IS_NOT_NULL(handle);
+    umock_c_reset_all_calls();
+    return handle;
+}
+
+// Picks a topic for each worker so the tests know where every message goes
+static void setup_source_topics(size_t workerCount)
+{
+    size_t found = 0;
+    size_t index = 0;
+    while (found < workerCount)
+    {
+        char topicName[32];
+        size_t worker;
+        (void)snprintf(topicName, sizeof(topicName), "devices/%lu/messages", (unsigned long)index++);
+        worker = mqtt_topic_hash(topicName) % workerCount;
+        if (g_sourceTopics[worker][0] == '\0')
+        {
+            (void)strcpy(g_sourceTopics[worker], topicName);
+            found++;
+        }
+    }
+}
+
+TEST_DEFINE_ENUM_TYPE(LOCK_RESULT, LOCK_RESULT_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(LOCK_RESULT, LOCK_RESULT_VALUES);
+TEST_DEFINE_ENUM_TYPE(COND_RESULT, COND_RESULT_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(COND_RESULT, COND_RESULT_VALUES);
+TEST_DEFINE_ENUM_TYPE(THREADAPI_RESULT, THREADAPI_RESULT_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(THREADAPI_RESULT, THREADAPI_RESULT_VALUES);
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    char temp_str[256];
+    (void)snprintf(temp_str, sizeof(temp_str), "umock_c reported error :%s", ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+    ASSERT_FAIL(temp_str);
+}
+
+BEGIN_TEST_SUITE(mqtt_dispatcher_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_charptr_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_bool_register_types());
+
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_MESSAGE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(LOCK_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(COND_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(THREAD_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(THREAD_START_FUNC, void*);
+    REGISTER_TYPE(LOCK_RESULT, LOCK_RESULT);
+    REGISTER_TYPE(COND_RESULT, COND_RESULT);
+    REGISTER_TYPE(THREADAPI_RESULT, THREADAPI_RESULT);
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+    REGISTER_GLOBAL_MOCK_HOOK(Lock, my_Lock);
+    REGISTER_GLOBAL_MOCK_HOOK(Condition_Init, my_Condition_Init);
+    REGISTER_GLOBAL_MOCK_HOOK(Condition_Wait, my_Condition_Wait);
+    REGISTER_GLOBAL_MOCK_HOOK(ThreadAPI_Create, my_ThreadAPI_Create);
+    REGISTER_GLOBAL_MOCK_HOOK(ThreadAPI_Join, my_ThreadAPI_Join);
+    REGISTER_GLOBAL_MOCK_HOOK(mqttmessage_clone, my_mqttmessage_clone);
+    REGISTER_GLOBAL_MOCK_HOOK(mqttmessage_getTopicName, my_mqttmessage_getTopicName);
+    REGISTER_GLOBAL_MOCK_HOOK(mqttmessage_destroy, my_mqttmessage_destroy);
+
+    REGISTER_GLOBAL_MOCK_RETURN(Lock_Init, TEST_LOCK_HANDLE);
+    REGISTER_GLOBAL_MOCK_RETURN(Unlock, LOCK_OK);
+    REGISTER_GLOBAL_MOCK_RETURN(Condition_Post, COND_OK);
+
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(gballoc_malloc, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(Lock_Init, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(Condition_Init, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(ThreadAPI_Create, THREADAPI_ERROR);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    memset(g_sourceTopics, 0, sizeof(g_sourceTopics));
+    g_threadCount = 0;
+    g_runningWorker = 0;
+    g_condCount = 0;
+    g_failLock = false;
+    g_runWorkerOnFullQueue = false;
+    g_stopWorkerAfterHandle = false;
+    g_cloneCount = 0;
+    g_handledCount = 0;
+    memset(g_handled, 0, sizeof(g_handled));
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/*Tests_SRS_MQTT_DISPATCHER_07_001: [If handler is NULL then mqtt_dispatcher_create shall return NULL.]*/
+TEST_FUNCTION(mqtt_dispatcher_create_handler_NULL_fail)
+{
+    // arrange
+    MQTT_DISPATCHER_OPTIONS options = { 2, 4 };
+
+    // act
+    MQTT_DISPATCHER_HANDLE handle = mqtt_dispatcher_create(&options, NULL, TEST_HANDLER_CONTEXT);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_DISPATCHER_07_003: [mqtt_dispatcher_create shall start workerCount worker threads, each with its own queue of queueDepth messages.]*/
+TEST_FUNCTION(mqtt_dispatcher_create_succeed)
+{
+    // arrange
+    MQTT_DISPATCHER_OPTIONS options = { 2, 4 };
+    size_t index;
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(Lock_Init());
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    for (index = 0; index < 2; index++)
+    {
+        EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+        STRICT_EXPECTED_CALL(Lock_Init());
+        STRICT_EXPECTED_CALL(Condition_Init());
+        STRICT_EXPECTED_CALL(Condition_Init());
+        EXPECTED_CALL(ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    }
+
+    // act
+    MQTT_DISPATCHER_HANDLE handle = mqtt_dispatcher_create(&options, TestMessageHandler, TEST_HANDLER_CONTEXT);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 2, g_threadCount);
+
+    // cleanup
+    mqtt_dispatcher_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_DISPATCHER_07_002: [If options is NULL, or its workerCount or queueDepth is 0, then mqtt_dispatcher_create shall use 4 workers and a queue depth of 64 messages.]*/
+TEST_FUNCTION(mqtt_dispatcher_create_options_NULL_uses_default_workers)
+{
+    // arrange
+
+    // act
+    MQTT_DISPATCHER_HANDLE handle = mqtt_dispatcher_create(NULL, TestMessageHandler, TEST_HANDLER_CONTEXT);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(size_t, 4, g_threadCount);
+
+    // cleanup
+    mqtt_dispatcher_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_DISPATCHER_07_004: [If any allocation or the creation of a lock, a condition or a thread fails then mqtt_dispatcher_create shall stop the started workers, free everything it allocated and return NULL.]*/
+TEST_FUNCTION(mqtt_dispatcher_create_fail)
+{
+    // arrange
+    MQTT_DISPATCHER_OPTIONS options = { 1, 4 };
+    int negativeTestsInitResult = umock_c_negative_tests_init();
+    ASSERT_ARE_EQUAL(int, 0, negativeTestsInitResult);
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(Lock_Init());
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(Lock_Init());
+    STRICT_EXPECTED_CALL(Condition_Init());
+    STRICT_EXPECTED_CALL(Condition_Init());
+    EXPECTED_CALL(ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+
+    umock_c_negative_tests_snapshot();
+
+    size_t count = umock_c_negative_tests_call_count();
+    for (size_t index = 0; index < count; index++)
+    {
+        umock_c_negative_tests_reset();
+        umock_c_negative_tests_fail_call(index);
+
+        // act
+        MQTT_DISPATCHER_HANDLE handle = mqtt_dispatcher_create(&options, TestMessageHandler, TEST_HANDLER_CONTEXT);
+
+        // assert
+        ASSERT_IS_NULL(handle);
+    }
+
+    // cleanup
+    umock_c_negative_tests_deinit();
+}
+
+/*Tests_SRS_MQTT_DISPATCHER_07_008: [mqtt_dispatcher_message_received_ack shall copy the message, since the client destroys msgHandle once the callback returns.]*/
+/*Tests_SRS_MQTT_DISPATCHER_07_010: [mqtt_dispatcher_message_received_ack shall queue the copy and ackToken on the worker selected by the hash of the topic name.]*/
+/*Tests_SRS_MQTT_DISPATCHER_07_012: [mqtt_dispatcher_message_received shall behave as mqtt_dispatcher_message_received_ack with an ackToken of 0.]*/
+TEST_FUNCTION(mqtt_dispatcher_message_received_queues_copy_on_topic_worker)
+{
+    // arrange
+    MQTT_DISPATCHER_HANDLE handle = create_dispatcher(2, 4);
+    setup_source_topics(2);
+
+    STRICT_EXPECTED_CALL(mqttmessage_clone(TEST_SOURCE_MESSAGE(1)));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_CLONE_MESSAGE(0)));
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Condition_Post(TEST_NOT_EMPTY_HANDLE(1)));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+
+    // act
+    mqtt_dispatcher_message_received(TEST_SOURCE_MESSAGE(1), handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 0, g_handledCount);
+    mqtt_dispatcher_destroy(handle);
+    ASSERT_ARE_EQUAL(size_t, 1, g_handledCount);
+    ASSERT_ARE_EQUAL(size_t, 1, g_handled[0].worker);
+    ASSERT_ARE_EQUAL(size_t, 0, (size_t)g_handled[0].ackToken);
+    ASSERT_IS_FALSE(g_handled[0].destroyedBefore);
+    ASSERT_IS_TRUE(g_cloneDestroyed[0]);
+}
+
+/*Tests_SRS_MQTT_DISPATCHER_07_009: [If the message cannot be copied then mqtt_dispatcher_message_received_ack shall drop it.]*/
+TEST_FUNCTION(mqtt_dispatcher_message_received_clone_fail_drops_message)
+{
+    // arrange
+    MQTT_DISPATCHER_HANDLE handle = create_dispatcher(2, 4);
+    setup_source_topics(2);
+
+    STRICT_EXPECTED_CALL(mqttmessage_clone(TEST_SOURCE_MESSAGE(0)))
+        .SetReturn(NULL);
+
+    // act
+    mqtt_dispatcher_message_received(TEST_SOURCE_MESSAGE(0), handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    mqtt_dispatcher_destroy(handle);
+    ASSERT_ARE_EQUAL(size_t, 0, g_handledCount);
+}
+
+/*Tests_SRS_MQTT_DISPATCHER_07_007: [If msgHandle or callbackCtx is NULL then mqtt_dispatcher_message_received_ack shall do nothing.]*/
+TEST_FUNCTION(mqtt_dispatcher_message_received_ack_context_NULL_fail)
+{
+    // arrange
+
+    // act
+    mqtt_dispatcher_message_received_ack(TEST_SOURCE_MESSAGE(0), 7, NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_DISPATCHER_07_007: [If msgHandle or callbackCtx is NULL then mqtt_dispatcher_message_received_ack shall do nothing.]*/
+TEST_FUNCTION(mqtt_dispatcher_message_received_ack_msgHandle_NULL_fail)
+{
+    // arrange
+    MQTT_DISPATCHER_OPTIONS options = { 1, 2 };
+    MQTT_DISPATCHER_HANDLE handle = mqtt_dispatcher_create(&options, TestMessageHandler, TEST_HANDLER_CONTEXT);
+    umock_c_reset_all_calls();
+
+    // act
+    mqtt_dispatcher_message_received_ack(NULL, 7, handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_dispatcher_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_DISPATCHER_07_005: [If handle is NULL then mqtt_dispatcher_destroy shall do nothing.]*/
+TEST_FUNCTION(mqtt_dispatcher_destroy_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_dispatcher_destroy(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_DISPATCHER_07_013: [Each worker shall call handler with the queued message, its ackToken and handlerCtx in the order the messages were queued, then destroy the message.]*/
+TEST_FUNCTION(mqtt_dispatcher_keeps_order_within_topic)
+{
+    // arrange
+    static const size_t topicOrder[] = { 0, 1, 0, 0, 1, 1, 0 };
+    const size_t messageCount = sizeof(topicOrder) / sizeof(topicOrder[0]);
+    MQTT_DISPATCHER_HANDLE handle = create_dispatcher(2, 8);
+    size_t lastSequence[2] = { 0, 0 };
+    size_t handledPerTopic[2] = { 0, 0 };
+    size_t index;
+    setup_source_topics(2);
+    for (index = 0; index < messageCount; index++)
+    {
+        mqtt_dispatcher_message_received_ack(TEST_SOURCE_MESSAGE(topicOrder[index]), 100 + index, handle);
+    }
+
+    // act
+    mqtt_dispatcher_destroy(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, messageCount, g_handledCount);
+    for (index = 0; index < g_handledCount; index++)
+    {
+        size_t sequence = g_handled[index].sequence;
+        size_t topic = topicOrder[sequence];
+        ASSERT_ARE_EQUAL(size_t, topic, g_handled[index].worker);
+        ASSERT_ARE_EQUAL(size_t, 100 + sequence, (size_t)g_handled[index].ackToken);
+        ASSERT_IS_FALSE(g_handled[index].destroyedBefore);
+        if (handledPerTopic[topic] > 0)
+        {
+            ASSERT_IS_TRUE(sequence > lastSequence[topic]);
+        }
+        lastSequence[topic] = sequence;
+        handledPerTopic[topic]++;
+    }
+    ASSERT_ARE_EQUAL(size_t, 4, handledPerTopic[0]);
+    ASSERT_ARE_EQUAL(size_t, 3, handledPerTopic[1]);
+    for (index = 0; index < messageCount; index++)
+    {
+        ASSERT_IS_TRUE(g_cloneDestroyed[index]);
+    }
+}
+
+/*Tests_SRS_MQTT_DISPATCHER_07_011: [If the queue of the worker is full then mqtt_dispatcher_message_received_ack shall count the wait and block until the worker makes room.]*/
+/*Tests_SRS_MQTT_DISPATCHER_07_016: [mqtt_dispatcher_get_wait_count shall return the number of times the receive path waited for room in a full queue.]*/
+TEST_FUNCTION(mqtt_dispatcher_full_queue_waits_for_worker)
+{
+    // arrange
+    MQTT_DISPATCHER_HANDLE handle = create_dispatcher(1, 2);
+    setup_source_topics(1);
+    mqtt_dispatcher_message_received_ack(TEST_SOURCE_MESSAGE(0), 1, handle);
+    mqtt_dispatcher_message_received_ack(TEST_SOURCE_MESSAGE(0), 2, handle);
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_dispatcher_get_wait_count(handle));
+    umock_c_reset_all_calls();
+    g_runWorkerOnFullQueue = true;
+
+    STRICT_EXPECTED_CALL(mqttmessage_clone(TEST_SOURCE_MESSAGE(0)));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_CLONE_MESSAGE(2)));
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Condition_Wait(TEST_NOT_FULL_HANDLE(0), TEST_LOCK_HANDLE, 0));
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Condition_Post(TEST_NOT_FULL_HANDLE(0)));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(TEST_CLONE_MESSAGE(0)));
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Condition_Post(TEST_NOT_EMPTY_HANDLE(0)));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+
+    // act
+    mqtt_dispatcher_message_received_ack(TEST_SOURCE_MESSAGE(0), 3, handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_dispatcher_get_wait_count(handle));
+    ASSERT_ARE_EQUAL(size_t, 1, g_handledCount);
+    ASSERT_ARE_EQUAL(size_t, 1, (size_t)g_handled[0].ackToken);
+
+    g_runWorkerOnFullQueue = false;
+    mqtt_dispatcher_destroy(handle);
+    ASSERT_ARE_EQUAL(size_t, 3, g_handledCount);
+    ASSERT_ARE_EQUAL(size_t, 2, (size_t)g_handled[1].ackToken);
+    ASSERT_ARE_EQUAL(size_t, 3, (size_t)g_handled[2].ackToken);
+}
+
+/*Tests_SRS_MQTT_DISPATCHER_07_006: [mqtt_dispatcher_destroy shall let every worker handle the messages already queued, join the worker threads and free all resources.]*/
+/*Tests_SRS_MQTT_DISPATCHER_07_014: [A worker shall only exit once it is stopped and its queue is empty.]*/
+TEST_FUNCTION(mqtt_dispatcher_destroy_drains_queue_before_release)
+{
+    // arrange
+    MQTT_DISPATCHER_HANDLE handle = create_dispatcher(1, 2);
+    setup_source_topics(1);
+    mqtt_dispatcher_message_received(TEST_SOURCE_MESSAGE(0), handle);
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Condition_Post(TEST_NOT_EMPTY_HANDLE(0)));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(ThreadAPI_Join(TEST_THREAD_HANDLE(0), IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Condition_Post(TEST_NOT_FULL_HANDLE(0)));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(TEST_CLONE_MESSAGE(0)));
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(Condition_Deinit(TEST_NOT_FULL_HANDLE(0)));
+    STRICT_EXPECTED_CALL(Condition_Deinit(TEST_NOT_EMPTY_HANDLE(0)));
+    STRICT_EXPECTED_CALL(Lock_Deinit(TEST_LOCK_HANDLE));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(Lock_Deinit(TEST_LOCK_HANDLE));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    mqtt_dispatcher_destroy(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, g_handledCount);
+}
+
+/*Tests_SRS_MQTT_DISPATCHER_07_015: [If handle is NULL then mqtt_dispatcher_get_wait_count shall return 0.]*/
+TEST_FUNCTION(mqtt_dispatcher_get_wait_count_handle_NULL_returns_0)
+{
+    // arrange
+
+    // act
+    size_t result = mqtt_dispatcher_get_wait_count(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, result);
+}
+
+END_TEST_SUITE(mqtt_dispatcher_ut)
@@ -306,6 +306,32 @@ TEST_FUNCTION(mqttmessage_clone_succeed)
     mqttmessage_destroy(cloneHandle);
 }
 
+/* Test_SRS_MQTTMESSAGE_07_008: [mqttmessage_clone shall create a new MQTT_MESSAGE_HANDLE with data content identical of the handle value.] */
+TEST_FUNCTION(mqttmessage_clone_in_place_succeed)
+{
+    // arrange
+    MQTT_MESSAGE_HANDLE handle = mqttmessage_create_in_place(TEST_PACKET_ID, TEST_TOPIC_NAME, DELIVER_AT_LEAST_ONCE, TEST_MESSAGE, TEST_MSG_LEN);
+    umock_c_reset_all_calls();
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(mallocAndStrcpy_s(IGNORED_PTR_ARG, TEST_TOPIC_NAME));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+
+    // act
+    MQTT_MESSAGE_HANDLE cloneHandle = mqttmessage_clone(handle);
+    mqttmessage_destroy(handle);
+
+    // assert
+    ASSERT_IS_NOT_NULL(cloneHandle);
+    ASSERT_ARE_EQUAL(char_ptr, TEST_TOPIC_NAME, mqttmessage_getTopicName(cloneHandle));
+    ASSERT_ARE_EQUAL(size_t, (size_t)TEST_MSG_LEN, mqttmessage_getApplicationMsg(cloneHandle)->length);
+    ASSERT_ARE_EQUAL(int, 0, memcmp(TEST_MESSAGE, mqttmessage_getApplicationMsg(cloneHandle)->message, TEST_MSG_LEN));
+
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    mqttmessage_destroy(cloneHandle);
+}
+
 /* Test_SRS_MQTTMESSAGE_07_007: [If handle parameter is NULL then mqttmessage_clone shall return NULL.] */
 TEST_FUNCTION(mqttmessage_clone_handle_fails)
 {
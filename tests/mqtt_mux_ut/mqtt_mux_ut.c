@@ -0,0 +1,805 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "umock_c.h"
+#include "umock_c_negative_tests.h"
+#include "umocktypes_charptr.h"
+#include "umocktypes_stdint.h"
+#include "umocktypes_bool.h"
+#include "umocktypes.h"
+#include "umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_umqtt_c/mqtt_client.h"
+#include "azure_umqtt_c/mqtt_message.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_mux.h"
+
+#define TEST_MQTT_CLIENT_HANDLE         (MQTT_CLIENT_HANDLE)0x11
+#define TEST_MESSAGE_HANDLE             (MQTT_MESSAGE_HANDLE)0x12
+#define TEST_SESSION_MESSAGE_HANDLE     (MQTT_MESSAGE_HANDLE)0x13
+#define TEST_PACKET_ID                  (uint16_t)0x21
+#define TEST_UNROUTED_CONTEXT           (void*)0x31
+#define MAX_TEST_TOPIC                  64
+
+static uint8_t TEST_PAYLOAD_BYTES[] = { 'd', 'a', 't', 'a' };
+static APP_PAYLOAD TEST_APP_PAYLOAD = { TEST_PAYLOAD_BYTES, sizeof(TEST_PAYLOAD_BYTES) };
+
+static ON_MQTT_MESSAGE_RECV_CALLBACK g_msgRecv;
+static void* g_msgRecvCtx;
+static const char* g_topicName;
+
+static size_t g_unroutedCount;
+static size_t g_sessionRecvCount;
+static void* g_sessionRecvCtx;
+static char g_sessionTopic[MAX_TEST_TOPIC];
+static MQTT_MUX_SESSION_HANDLE g_removedSession;
+
+static char g_subscribeTopics[2][MAX_TEST_TOPIC];
+static QOS_VALUE g_subscribeQos[2];
+
+static MQTT_CLIENT_HANDLE my_mqtt_client_init(ON_MQTT_MESSAGE_RECV_CALLBACK msgRecv, ON_MQTT_OPERATION_CALLBACK opCallback, void* opCallbackCtx, ON_MQTT_ERROR_CALLBACK onErrorCallBack, void* errorCBCtx)
+{
+    (void)opCallback;
+    (void)onErrorCallBack;
+    (void)errorCBCtx;
+    g_msgRecv = msgRecv;
+    g_msgRecvCtx = opCallbackCtx;
+    return TEST_MQTT_CLIENT_HANDLE;
+}
+
+static const char* my_mqttmessage_getTopicName(MQTT_MESSAGE_HANDLE handle)
+{
+    (void)handle;
+    return g_topicName;
+}
+
+static MQTT_MESSAGE_HANDLE my_mqttmessage_create_in_place(uint16_t packetId, const char* topicName, QOS_VALUE qosValue, const uint8_t* appMsg, size_t appMsgLength)
+{
+    (void)packetId;
+    (void)qosValue;
+    (void)appMsg;
+    (void)appMsgLength;
+    (void)snprintf(g_sessionTopic, sizeof(g_sessionTopic), "%s", topicName);
+    return TEST_SESSION_MESSAGE_HANDLE;
+}
+
+static int my_mqtt_client_subscribe(MQTT_CLIENT_HANDLE handle, uint16_t packetId, SUBSCRIBE_PAYLOAD* subscribeList, size_t count)
+{
+    size_t index;
+    (void)handle;
+    (void)packetId;
+    for (index = 0; index < count && index < 2; index++)
+    {
+        (void)snprintf(g_subscribeTopics[index], MAX_TEST_TOPIC, "%s", subscribeList[index].subscribeTopic);
+        g_subscribeQos[index] = subscribeList[index].qosReturn;
+    }
+    return 0;
+}
+
+static int my_mqtt_client_unsubscribe(MQTT_CLIENT_HANDLE handle, uint16_t packetId, const char** unsubscribeList, size_t count)
+{
+    size_t index;
+    (void)handle;
+    (void)packetId;
+    for (index = 0; index < count && index < 2; index++)
+    {
+        (void)snprintf(g_subscribeTopics[index], MAX_TEST_TOPIC, "%s", unsubscribeList[index]);
+    }
+    return 0;
+}
+
+static void TestUnroutedRecv(MQTT_MESSAGE_HANDLE msgHandle, void* callbackCtx)
+{
+    ASSERT_ARE_EQUAL(void_ptr, TEST_MESSAGE_HANDLE, msgHandle);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_UNROUTED_CONTEXT, callbackCtx);
+    g_unroutedCount++;
+}
+
+static void TestSessionRecv(MQTT_MESSAGE_HANDLE msgHandle, void* callbackCtx)
+{
+    ASSERT_ARE_EQUAL(void_ptr, TEST_SESSION_MESSAGE_HANDLE, msgHandle);
+    g_sessionRecvCount++;
+    g_sessionRecvCtx = callbackCtx;
+}
+
+static void TestSessionRecvRemoving(MQTT_MESSAGE_HANDLE msgHandle, void* callbackCtx)
+{
+    TestSessionRecv(msgHandle, callbackCtx);
+    mqtt_mux_remove_session(g_removedSession);
+}
+
+static MQTT_MUX_HANDLE create_mux(void)
+{
+    MQTT_MUX_HANDLE handle = mqtt_mux_create(TestUnroutedRecv, TEST_UNROUTED_CONTEXT, NULL, NULL, NULL, NULL);
+    ASSERT_IS_NOT_NULL(handle);
+    umock_c_reset_all_calls();
+    return handle;
+}
+
+static MQTT_MUX_SESSION_HANDLE add_session(MQTT_MUX_HANDLE handle, const char* topicPrefix, void* callbackCtx)
+{
+    MQTT_MUX_SESSION_HANDLE session = mqtt_mux_add_session(handle, topicPrefix, TestSessionRecv, callbackCtx);
+    ASSERT_IS_NOT_NULL(session);
+    umock_c_reset_all_calls();
+    return session;
+}
+
+static void receive_message(const char* topicName)
+{
+    g_topicName = topicName;
+    g_sessionRecvCount = 0;
+    g_sessionRecvCtx = NULL;
+    g_unroutedCount = 0;
+    g_sessionTopic[0] = '\0';
+    g_msgRecv(TEST_MESSAGE_HANDLE, g_msgRecvCtx);
+}
+
+TEST_DEFINE_ENUM_TYPE(QOS_VALUE, QOS_VALUE_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(QOS_VALUE, QOS_VALUE_VALUES);
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    char temp_str[256];
+    (void)snprintf(temp_str, sizeof(temp_str), "umock_c reported error :%s", ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+    ASSERT_FAIL(temp_str);
+}
+
+BEGIN_TEST_SUITE(mqtt_mux_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_charptr_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_bool_register_types());
+
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_CLIENT_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_MESSAGE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_MESSAGE_RECV_CALLBACK, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_OPERATION_CALLBACK, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_ERROR_CALLBACK, void*);
+    REGISTER_TYPE(QOS_VALUE, QOS_VALUE);
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_init, my_mqtt_client_init);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_subscribe, my_mqtt_client_subscribe);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_unsubscribe, my_mqtt_client_unsubscribe);
+    REGISTER_GLOBAL_MOCK_HOOK(mqttmessage_getTopicName, my_mqttmessage_getTopicName);
+    REGISTER_GLOBAL_MOCK_HOOK(mqttmessage_create_in_place, my_mqttmessage_create_in_place);
+
+    REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_getApplicationMsg, &TEST_APP_PAYLOAD);
+    REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_getPacketId, TEST_PACKET_ID);
+    REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_getQosType, DELIVER_AT_LEAST_ONCE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_client_publish, 0);
+
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(gballoc_malloc, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_client_init, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqttmessage_create_in_place, NULL);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    g_msgRecv = NULL;
+    g_msgRecvCtx = NULL;
+    g_topicName = NULL;
+    g_removedSession = NULL;
+    memset(g_subscribeTopics, 0, sizeof(g_subscribeTopics));
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/*Tests_SRS_MQTT_MUX_07_001: [mqtt_mux_create shall allocate the multiplexer and create the shared client with mqtt_client_init.]*/
+/*Tests_SRS_MQTT_MUX_07_006: [If handle is NULL then mqtt_mux_get_client shall return NULL, otherwise it shall return the shared client.]*/
+/*Tests_SRS_MQTT_MUX_07_026: [If handle is NULL then mqtt_mux_get_session_count shall return 0, otherwise it shall return the number of sessions.]*/
+TEST_FUNCTION(mqtt_mux_create_succeed)
+{
+    // arrange
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(mqtt_client_init(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+
+    // act
+    MQTT_MUX_HANDLE handle = mqtt_mux_create(TestUnroutedRecv, TEST_UNROUTED_CONTEXT, NULL, NULL, NULL, NULL);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_MQTT_CLIENT_HANDLE, mqtt_mux_get_client(handle));
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_mux_get_session_count(handle));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_002: [If the allocation or mqtt_client_init fails then mqtt_mux_create shall free everything it allocated and return NULL.]*/
+TEST_FUNCTION(mqtt_mux_create_fail)
+{
+    // arrange
+    int negativeTestsInitResult = umock_c_negative_tests_init();
+    ASSERT_ARE_EQUAL(int, 0, negativeTestsInitResult);
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(mqtt_client_init(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+
+    umock_c_negative_tests_snapshot();
+
+    size_t count = umock_c_negative_tests_call_count();
+    for (size_t index = 0; index < count; index++)
+    {
+        umock_c_negative_tests_reset();
+        umock_c_negative_tests_fail_call(index);
+
+        // act
+        MQTT_MUX_HANDLE handle = mqtt_mux_create(TestUnroutedRecv, TEST_UNROUTED_CONTEXT, NULL, NULL, NULL, NULL);
+
+        // assert
+        ASSERT_IS_NULL(handle);
+    }
+
+    // cleanup
+    umock_c_negative_tests_deinit();
+}
+
+/*Tests_SRS_MQTT_MUX_07_009: [mqtt_mux_add_session shall double the session list when it is full, starting with 8 sessions.]*/
+/*Tests_SRS_MQTT_MUX_07_011: [mqtt_mux_add_session shall allocate the session with a copy of topicPrefix and insert it in the list sorted by prefix.]*/
+TEST_FUNCTION(mqtt_mux_add_session_succeed)
+{
+    // arrange
+    MQTT_MUX_HANDLE handle = create_mux();
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(8 * sizeof(void*)));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+
+    // act
+    MQTT_MUX_SESSION_HANDLE session = mqtt_mux_add_session(handle, "devices/dev1", TestSessionRecv, NULL);
+
+    // assert
+    ASSERT_IS_NOT_NULL(session);
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_mux_get_session_count(handle));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_007: [If handle, topicPrefix or msgRecv is NULL, or topicPrefix is empty or holds a wildcard, then mqtt_mux_add_session shall return NULL.]*/
+TEST_FUNCTION(mqtt_mux_add_session_invalid_prefix_fail)
+{
+    // arrange
+    MQTT_MUX_HANDLE handle = create_mux();
+
+    // act
+    MQTT_MUX_SESSION_HANDLE nullSession = mqtt_mux_add_session(handle, NULL, TestSessionRecv, NULL);
+    MQTT_MUX_SESSION_HANDLE emptySession = mqtt_mux_add_session(handle, "", TestSessionRecv, NULL);
+    MQTT_MUX_SESSION_HANDLE plusSession = mqtt_mux_add_session(handle, "devices/+", TestSessionRecv, NULL);
+    MQTT_MUX_SESSION_HANDLE hashSession = mqtt_mux_add_session(handle, "devices/#", TestSessionRecv, NULL);
+    MQTT_MUX_SESSION_HANDLE noCallbackSession = mqtt_mux_add_session(handle, "devices", NULL, NULL);
+
+    // assert
+    ASSERT_IS_NULL(nullSession);
+    ASSERT_IS_NULL(emptySession);
+    ASSERT_IS_NULL(plusSession);
+    ASSERT_IS_NULL(hashSession);
+    ASSERT_IS_NULL(noCallbackSession);
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_mux_get_session_count(handle));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_008: [If a session already uses topicPrefix then mqtt_mux_add_session shall return NULL.]*/
+TEST_FUNCTION(mqtt_mux_add_session_duplicate_prefix_fail)
+{
+    // arrange
+    MQTT_MUX_HANDLE handle = create_mux();
+    (void)add_session(handle, "devices/dev1", NULL);
+
+    // act
+    MQTT_MUX_SESSION_HANDLE session = mqtt_mux_add_session(handle, "devices/dev1", TestSessionRecv, NULL);
+
+    // assert
+    ASSERT_IS_NULL(session);
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_mux_get_session_count(handle));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_010: [If an allocation fails then mqtt_mux_add_session shall return NULL.]*/
+TEST_FUNCTION(mqtt_mux_add_session_allocation_fail)
+{
+    // arrange
+    MQTT_MUX_HANDLE handle = create_mux();
+
+    STRICT_EXPECTED_CALL(gballoc_malloc(8 * sizeof(void*)));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+        .SetReturn(NULL);
+
+    // act
+    MQTT_MUX_SESSION_HANDLE session = mqtt_mux_add_session(handle, "devices/dev1", TestSessionRecv, NULL);
+
+    // assert
+    ASSERT_IS_NULL(session);
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_mux_get_session_count(handle));
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_009: [mqtt_mux_add_session shall double the session list when it is full, starting with 8 sessions.]*/
+/*Tests_SRS_MQTT_MUX_07_011: [mqtt_mux_add_session shall allocate the session with a copy of topicPrefix and insert it in the list sorted by prefix.]*/
+/*Tests_SRS_MQTT_MUX_07_012: [A message shall be routed to the session with the longest prefix that matches the topic up to a level separator, found with a binary search per topic level.]*/
+TEST_FUNCTION(mqtt_mux_add_session_grows_and_routes_every_session)
+{
+    // arrange
+    static const char* prefixes[] = { "m", "c", "x", "a", "k", "e", "z", "b", "q", "d", "y" };
+    static const char* topics[] = { "m/t", "c/t", "x/t", "a/t", "k/t", "e/t", "z/t", "b/t", "q/t", "d/t", "y/t" };
+    size_t count = sizeof(prefixes) / sizeof(prefixes[0]);
+    size_t index;
+    MQTT_MUX_HANDLE handle = create_mux();
+
+    // act
+    for (index = 0; index < count; index++)
+    {
+        (void)add_session(handle, prefixes[index], (void*)(prefixes + index));
+    }
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, count, mqtt_mux_get_session_count(handle));
+    for (index = 0; index < count; index++)
+    {
+        receive_message(topics[index]);
+        ASSERT_ARE_EQUAL(size_t, 1, g_sessionRecvCount);
+        ASSERT_ARE_EQUAL(void_ptr, (void*)(prefixes + index), g_sessionRecvCtx);
+        ASSERT_ARE_EQUAL(char_ptr, "t", g_sessionTopic);
+    }
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_012: [A message shall be routed to the session with the longest prefix that matches the topic up to a level separator, found with a binary search per topic level.]*/
+/*Tests_SRS_MQTT_MUX_07_014: [The session shall get a message created in place with the topic after its prefix and the packet id, QoS, payload, duplicate and retain flags of the message received.]*/
+TEST_FUNCTION(mqtt_mux_message_recv_routes_to_session)
+{
+    // arrange
+    MQTT_MUX_HANDLE handle = create_mux();
+    (void)add_session(handle, "devices/dev1", (void*)0x41);
+
+    g_topicName = "devices/dev1/telemetry";
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getPacketId(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(TEST_PACKET_ID, "telemetry", DELIVER_AT_LEAST_ONCE, TEST_PAYLOAD_BYTES, sizeof(TEST_PAYLOAD_BYTES)));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE))
+        .SetReturn(true);
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(TEST_SESSION_MESSAGE_HANDLE, true));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE))
+        .SetReturn(false);
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(TEST_SESSION_MESSAGE_HANDLE, false));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(TEST_SESSION_MESSAGE_HANDLE));
+
+    // act
+    g_msgRecv(TEST_MESSAGE_HANDLE, g_msgRecvCtx);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(void_ptr, (void*)0x41, g_sessionRecvCtx);
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_012: [A message shall be routed to the session with the longest prefix that matches the topic up to a level separator, found with a binary search per topic level.]*/
+TEST_FUNCTION(mqtt_mux_message_recv_longest_prefix_wins)
+{
+    // arrange
+    MQTT_MUX_HANDLE handle = create_mux();
+    (void)add_session(handle, "devices", (void*)0x41);
+    (void)add_session(handle, "devices/dev1", (void*)0x42);
+
+    // act
+    receive_message("devices/dev1/telemetry");
+
+    // assert
+    ASSERT_ARE_EQUAL(void_ptr, (void*)0x42, g_sessionRecvCtx);
+    ASSERT_ARE_EQUAL(char_ptr, "telemetry", g_sessionTopic);
+
+    receive_message("devices/dev10/telemetry");
+    ASSERT_ARE_EQUAL(void_ptr, (void*)0x41, g_sessionRecvCtx);
+    ASSERT_ARE_EQUAL(char_ptr, "dev10/telemetry", g_sessionTopic);
+
+    receive_message("devices/dev1");
+    ASSERT_ARE_EQUAL(void_ptr, (void*)0x41, g_sessionRecvCtx);
+    ASSERT_ARE_EQUAL(char_ptr, "dev1", g_sessionTopic);
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_013: [A message whose topic is under no session prefix shall be passed to unroutedRecv when it is not NULL.]*/
+TEST_FUNCTION(mqtt_mux_message_recv_unrouted)
+{
+    // arrange
+    MQTT_MUX_HANDLE handle = create_mux();
+    (void)add_session(handle, "devices/dev1", (void*)0x41);
+
+    // act
+    receive_message("devices/dev2/telemetry");
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, g_unroutedCount);
+    ASSERT_ARE_EQUAL(size_t, 0, g_sessionRecvCount);
+
+    // A prefix only matches a whole topic level followed by more levels
+    receive_message("devices/dev1");
+    ASSERT_ARE_EQUAL(size_t, 1, g_unroutedCount);
+    receive_message("devices/dev1x/telemetry");
+    ASSERT_ARE_EQUAL(size_t, 1, g_unroutedCount);
+    ASSERT_ARE_EQUAL(size_t, 0, g_sessionRecvCount);
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_013: [A message whose topic is under no session prefix shall be passed to unroutedRecv when it is not NULL.]*/
+/*Tests_SRS_MQTT_MUX_07_016: [mqtt_mux_remove_session shall remove the session from the list and free it, leaving its subscriptions on the connection.]*/
+TEST_FUNCTION(mqtt_mux_remove_session_messages_unrouted)
+{
+    // arrange
+    MQTT_MUX_HANDLE handle = create_mux();
+    MQTT_MUX_SESSION_HANDLE session = add_session(handle, "devices/dev1", (void*)0x41);
+    (void)add_session(handle, "devices/dev2", (void*)0x42);
+
+    // act
+    mqtt_mux_remove_session(session);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_mux_get_session_count(handle));
+    receive_message("devices/dev1/telemetry");
+    ASSERT_ARE_EQUAL(size_t, 1, g_unroutedCount);
+    receive_message("devices/dev2/telemetry");
+    ASSERT_ARE_EQUAL(void_ptr, (void*)0x42, g_sessionRecvCtx);
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_016: [mqtt_mux_remove_session shall remove the session from the list and free it, leaving its subscriptions on the connection.]*/
+TEST_FUNCTION(mqtt_mux_remove_session_from_its_callback_succeed)
+{
+    // arrange
+    MQTT_MUX_HANDLE handle = create_mux();
+    g_removedSession = mqtt_mux_add_session(handle, "devices/dev1", TestSessionRecvRemoving, (void*)0x41);
+    ASSERT_IS_NOT_NULL(g_removedSession);
+
+    // act
+    receive_message("devices/dev1/telemetry");
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, g_sessionRecvCount);
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_mux_get_session_count(handle));
+    receive_message("devices/dev1/telemetry");
+    ASSERT_ARE_EQUAL(size_t, 1, g_unroutedCount);
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_018: [mqtt_mux_publish shall write topicPrefix/<topic> in a buffer kept from one publish to the next, growing it when the topic does not fit, and return a non-zero value if it cannot grow.]*/
+/*Tests_SRS_MQTT_MUX_07_019: [mqtt_mux_publish shall publish a message created in place over that topic and the payload of msgHandle, with its duplicate and retain flags, and return the result of mqtt_client_publish.]*/
+/*Tests_SRS_MQTT_MUX_07_020: [QoS 1 and 2 publishes shall take the next packet id of the multiplexer, wrapping from 65535 to 1, QoS 0 publishes a packet id of 0.]*/
+TEST_FUNCTION(mqtt_mux_publish_prefixes_topic_and_numbers_packets)
+{
+    // arrange
+    MQTT_MUX_HANDLE handle = create_mux();
+    MQTT_MUX_SESSION_HANDLE session = add_session(handle, "devices/dev1", NULL);
+    MQTT_MUX_SESSION_HANDLE otherSession = add_session(handle, "devices/dev2", NULL);
+    g_topicName = "telemetry";
+
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(1, "devices/dev1/telemetry", DELIVER_AT_LEAST_ONCE, TEST_PAYLOAD_BYTES, sizeof(TEST_PAYLOAD_BYTES)));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(TEST_SESSION_MESSAGE_HANDLE, false));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(TEST_SESSION_MESSAGE_HANDLE, false));
+    STRICT_EXPECTED_CALL(mqtt_client_publish(TEST_MQTT_CLIENT_HANDLE, TEST_SESSION_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(TEST_SESSION_MESSAGE_HANDLE));
+
+    // act
+    int result = mqtt_mux_publish(session, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // The topic buffer is kept and the packet ids are shared by the sessions
+    umock_c_reset_all_calls();
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(2, "devices/dev2/telemetry", DELIVER_AT_LEAST_ONCE, TEST_PAYLOAD_BYTES, sizeof(TEST_PAYLOAD_BYTES)));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_mux_publish(otherSession, TEST_MESSAGE_HANDLE));
+    ASSERT_ARE_EQUAL(char_ptr, "", umock_c_get_expected_calls());
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_020: [QoS 1 and 2 publishes shall take the next packet id of the multiplexer, wrapping from 65535 to 1, QoS 0 publishes a packet id of 0.]*/
+TEST_FUNCTION(mqtt_mux_publish_qos0_packet_id_0)
+{
+    // arrange
+    MQTT_MUX_HANDLE handle = create_mux();
+    MQTT_MUX_SESSION_HANDLE session = add_session(handle, "devices/dev1", NULL);
+    g_topicName = "telemetry";
+
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE))
+        .SetReturn(DELIVER_AT_MOST_ONCE);
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(0, "devices/dev1/telemetry", DELIVER_AT_MOST_ONCE, TEST_PAYLOAD_BYTES, sizeof(TEST_PAYLOAD_BYTES)));
+
+    // act
+    int result = mqtt_mux_publish(session, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, "", umock_c_get_expected_calls());
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_017: [If session or msgHandle is NULL, or the message has no topic, then mqtt_mux_publish shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_mux_publish_session_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_mux_publish(NULL, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_MUX_07_022: [mqtt_mux_subscribe shall subscribe to topicPrefix/<filter> for every filter of subscribeList with the next packet id of the multiplexer and return the result of mqtt_client_subscribe.]*/
+TEST_FUNCTION(mqtt_mux_subscribe_prefixes_filters)
+{
+    // arrange
+    MQTT_MUX_HANDLE handle = create_mux();
+    MQTT_MUX_SESSION_HANDLE session = add_session(handle, "devices/dev1", NULL);
+    SUBSCRIBE_PAYLOAD subscribeList[] = { { "#", DELIVER_AT_LEAST_ONCE }, { "commands/+", DELIVER_EXACTLY_ONCE } };
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(mqtt_client_subscribe(TEST_MQTT_CLIENT_HANDLE, 1, IGNORED_PTR_ARG, 2));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    int result = mqtt_mux_subscribe(session, subscribeList, 2);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(char_ptr, "devices/dev1/#", g_subscribeTopics[0]);
+    ASSERT_ARE_EQUAL(char_ptr, "devices/dev1/commands/+", g_subscribeTopics[1]);
+    ASSERT_ARE_EQUAL(QOS_VALUE, DELIVER_AT_LEAST_ONCE, g_subscribeQos[0]);
+    ASSERT_ARE_EQUAL(QOS_VALUE, DELIVER_EXACTLY_ONCE, g_subscribeQos[1]);
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_023: [If the prefixed filters cannot be allocated then mqtt_mux_subscribe shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_mux_subscribe_allocation_fail)
+{
+    // arrange
+    MQTT_MUX_HANDLE handle = create_mux();
+    MQTT_MUX_SESSION_HANDLE session = add_session(handle, "devices/dev1", NULL);
+    SUBSCRIBE_PAYLOAD subscribeList[] = { { "#", DELIVER_AT_LEAST_ONCE } };
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG))
+        .SetReturn(NULL);
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    int result = mqtt_mux_subscribe(session, subscribeList, 1);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_025: [mqtt_mux_unsubscribe shall unsubscribe from topicPrefix/<topic> for every topic of unsubscribeList with the next packet id of the multiplexer and return the result of mqtt_client_unsubscribe, or a non-zero value if the prefixed topics cannot be allocated.]*/
+TEST_FUNCTION(mqtt_mux_unsubscribe_prefixes_filters)
+{
+    // arrange
+    MQTT_MUX_HANDLE handle = create_mux();
+    MQTT_MUX_SESSION_HANDLE session = add_session(handle, "devices/dev1", NULL);
+    const char* unsubscribeList[] = { "#", "commands/+" };
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(mqtt_client_unsubscribe(TEST_MQTT_CLIENT_HANDLE, 1, IGNORED_PTR_ARG, 2));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    int result = mqtt_mux_unsubscribe(session, unsubscribeList, 2);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(char_ptr, "devices/dev1/#", g_subscribeTopics[0]);
+    ASSERT_ARE_EQUAL(char_ptr, "devices/dev1/commands/+", g_subscribeTopics[1]);
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_MUX_07_005: [mqtt_mux_destroy shall deinitialize the shared client, free the sessions left and all resources.]*/
+TEST_FUNCTION(mqtt_mux_destroy_succeed)
+{
+    // arrange
+    MQTT_MUX_HANDLE handle = create_mux();
+    (void)add_session(handle, "devices/dev1", NULL);
+
+    STRICT_EXPECTED_CALL(mqtt_client_deinit(TEST_MQTT_CLIENT_HANDLE));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+    EXPECTED_CALL(gballoc_free(IGNORED_PTR_ARG));
+
+    // act
+    mqtt_mux_destroy(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_MUX_07_004: [If handle is NULL then mqtt_mux_destroy shall do nothing.]*/
+TEST_FUNCTION(mqtt_mux_destroy_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_mux_destroy(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_MUX_07_006: [If handle is NULL then mqtt_mux_get_client shall return NULL, otherwise it shall return the shared client.]*/
+TEST_FUNCTION(mqtt_mux_get_client_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_CLIENT_HANDLE result = mqtt_mux_get_client(NULL);
+
+    // assert
+    ASSERT_IS_NULL(result);
+}
+
+/*Tests_SRS_MQTT_MUX_07_026: [If handle is NULL then mqtt_mux_get_session_count shall return 0, otherwise it shall return the number of sessions.]*/
+TEST_FUNCTION(mqtt_mux_get_session_count_handle_NULL_returns_0)
+{
+    // arrange
+
+    // act
+    size_t result = mqtt_mux_get_session_count(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, result);
+}
+
+/*Tests_SRS_MQTT_MUX_07_015: [If session is NULL then mqtt_mux_remove_session shall do nothing.]*/
+TEST_FUNCTION(mqtt_mux_remove_session_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_mux_remove_session(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_MUX_07_021: [If session or subscribeList is NULL, or count is 0, then mqtt_mux_subscribe shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_mux_subscribe_session_NULL_fail)
+{
+    // arrange
+    SUBSCRIBE_PAYLOAD subscribeList[] = { { "#", DELIVER_AT_LEAST_ONCE } };
+
+    // act
+    int result = mqtt_mux_subscribe(NULL, subscribeList, 1);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_MUX_07_024: [If session or unsubscribeList is NULL, or count is 0, then mqtt_mux_unsubscribe shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_mux_unsubscribe_count_0_fail)
+{
+    // arrange
+    const char* unsubscribeList[] = { "#" };
+    MQTT_MUX_HANDLE handle = create_mux();
+    MQTT_MUX_SESSION_HANDLE session = add_session(handle, "devices/dev1", NULL);
+
+    // act
+    int result = mqtt_mux_unsubscribe(session, unsubscribeList, 0);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_mux_destroy(handle);
+}
+
+END_TEST_SUITE(mqtt_mux_ut)
@@ -0,0 +1,774 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdarg>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "umock_c.h"
+#include "umock_c_negative_tests.h"
+#include "umocktypes_charptr.h"
+#include "umocktypes_stdint.h"
+#include "umocktypes_bool.h"
+#include "umocktypes.h"
+#include "umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/crt_abstractions.h"
+#include "azure_c_shared_utility/strings.h"
+#include "azure_c_shared_utility/vector.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_persist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    extern VECTOR_HANDLE real_VECTOR_create(size_t elementSize);
+    extern void real_VECTOR_destroy(VECTOR_HANDLE handle);
+    extern int real_VECTOR_push_back(VECTOR_HANDLE handle, const void* elements, size_t numElements);
+    extern void real_VECTOR_erase(VECTOR_HANDLE handle, void* elements, size_t numElements);
+    extern void* real_VECTOR_element(VECTOR_HANDLE handle, size_t index);
+    extern void* real_VECTOR_front(VECTOR_HANDLE handle);
+    extern void* real_VECTOR_back(VECTOR_HANDLE handle);
+    extern size_t real_VECTOR_size(VECTOR_HANDLE handle);
+
+    STRING_HANDLE STRING_construct_sprintf(const char* format, ...)
+    {
+        char buffer[128];
+        char* result;
+        va_list args;
+        va_start(args, format);
+        (void)vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        if ((result = (char*)my_gballoc_malloc(strlen(buffer) + 1)) != NULL)
+        {
+            (void)strcpy(result, buffer);
+        }
+        return (STRING_HANDLE)result;
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define TEST_FILE_PREFIX                "mqtt_persist_ut"
+#define TEST_MANIFEST_NAME              TEST_FILE_PREFIX ".manifest"
+#define TEST_MAX_SEGMENT_INDEX          8
+#define TEST_MAX_PACKETS                16
+#define TEST_PACKET_LENGTH              20
+
+// A 20 byte packet takes a 32 byte record, so a 64 byte segment holds one record and a 128 byte one holds three
+#define TEST_ONE_RECORD_SEGMENT_SIZE    64
+#define TEST_THREE_RECORD_SEGMENT_SIZE  128
+
+typedef struct TEST_PERSISTED_PACKET_TAG
+{
+    uint16_t packetId;
+    bool released;
+    size_t length;
+    uint8_t packet[TEST_PACKET_LENGTH];
+} TEST_PERSISTED_PACKET;
+
+static size_t g_persistedCount;
+static TEST_PERSISTED_PACKET g_persisted[TEST_MAX_PACKETS];
+
+static int my_mallocAndStrcpy_s(char** destination, const char* source)
+{
+    size_t src_len = strlen(source);
+    *destination = (char*)my_gballoc_malloc(src_len + 1);
+    memcpy(*destination, source, src_len + 1);
+    return 0;
+}
+
+static const char* my_STRING_c_str(STRING_HANDLE handle)
+{
+    return (const char*)handle;
+}
+
+static void my_STRING_delete(STRING_HANDLE handle)
+{
+    my_gballoc_free(handle);
+}
+
+static void on_persisted_packet(void* context, uint16_t packetId, bool released, uint8_t* packet, size_t length)
+{
+    (void)context;
+    if (g_persistedCount < TEST_MAX_PACKETS)
+    {
+        TEST_PERSISTED_PACKET* persisted = &g_persisted[g_persistedCount++];
+        persisted->packetId = packetId;
+        persisted->released = released;
+        persisted->length = length;
+        memcpy(persisted->packet, packet, (length < TEST_PACKET_LENGTH) ? length : TEST_PACKET_LENGTH);
+    }
+}
+
+static void get_segment_file_name(char* fileName, size_t size, size_t index)
+{
+    (void)snprintf(fileName, size, "%s_%05lu.seg", TEST_FILE_PREFIX, (unsigned long)index);
+}
+
+static bool segment_file_exists(size_t index)
+{
+    char fileName[64];
+    FILE* file;
+    get_segment_file_name(fileName, sizeof(fileName), index);
+    if ((file = fopen(fileName, "rb")) != NULL)
+    {
+        (void)fclose(file);
+    }
+    return file != NULL;
+}
+
+static void remove_persist_files(void)
+{
+    size_t index;
+    for (index = 0; index < TEST_MAX_SEGMENT_INDEX; index++)
+    {
+        char fileName[64];
+        get_segment_file_name(fileName, sizeof(fileName), index);
+        (void)remove(fileName);
+    }
+    (void)remove(TEST_MANIFEST_NAME);
+}
+
+static void read_manifest(unsigned long* first, unsigned long* next)
+{
+    FILE* manifest = fopen(TEST_MANIFEST_NAME, "r");
+    ASSERT_IS_NOT_NULL(manifest);
+    ASSERT_ARE_EQUAL(int, 2, fscanf(manifest, "%lu %lu", first, next));
+    (void)fclose(manifest);
+}
+
+static void make_packet(uint16_t packetId, uint8_t* packet)
+{
+    size_t index;
+    for (index = 0; index < TEST_PACKET_LENGTH; index++)
+    {
+        packet[index] = (uint8_t)(packetId * 16 + index);
+    }
+}
+
+static MQTT_PERSIST_HANDLE open_persist(size_t segmentSize)
+{
+    MQTT_PERSIST_OPTIONS options;
+    MQTT_PERSIST_HANDLE handle;
+    options.filePrefix = TEST_FILE_PREFIX;
+    options.segmentSize = segmentSize;
+    options.syncOnAppend = false;
+    handle = mqtt_persist_open(&options);
+    ASSERT_IS_NOT_NULL(handle);
+    umock_c_reset_all_calls();
+    return handle;
+}
+
+static void append_packet(MQTT_PERSIST_HANDLE handle, uint16_t packetId)
+{
+    uint8_t packet[TEST_PACKET_LENGTH];
+    make_packet(packetId, packet);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_persist_append(handle, packetId, packet, sizeof(packet)));
+}
+
+static void assert_persisted_packets(MQTT_PERSIST_HANDLE handle, const uint16_t* packetIds, const bool* released, size_t count)
+{
+    size_t index;
+    g_persistedCount = 0;
+    ASSERT_ARE_EQUAL(int, 0, mqtt_persist_foreach(handle, on_persisted_packet, NULL));
+    ASSERT_ARE_EQUAL(size_t, count, g_persistedCount);
+    ASSERT_ARE_EQUAL(size_t, count, mqtt_persist_get_count(handle));
+    for (index = 0; index < count; index++)
+    {
+        uint8_t packet[TEST_PACKET_LENGTH];
+        make_packet(packetIds[index], packet);
+        ASSERT_ARE_EQUAL(int, (int)packetIds[index], (int)g_persisted[index].packetId);
+        ASSERT_ARE_EQUAL(int, (int)released[index], (int)g_persisted[index].released);
+        ASSERT_ARE_EQUAL(size_t, TEST_PACKET_LENGTH, g_persisted[index].length);
+        ASSERT_ARE_EQUAL(int, 0, memcmp(packet, g_persisted[index].packet, TEST_PACKET_LENGTH));
+    }
+}
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    char temp_str[256];
+    (void)snprintf(temp_str, sizeof(temp_str), "umock_c reported error :%s", ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+    ASSERT_FAIL(temp_str);
+}
+
+BEGIN_TEST_SUITE(mqtt_persist_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_charptr_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_bool_register_types());
+
+    REGISTER_UMOCK_ALIAS_TYPE(STRING_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(VECTOR_HANDLE, void*);
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+    REGISTER_GLOBAL_MOCK_HOOK(mallocAndStrcpy_s, my_mallocAndStrcpy_s);
+    REGISTER_GLOBAL_MOCK_HOOK(STRING_c_str, my_STRING_c_str);
+    REGISTER_GLOBAL_MOCK_HOOK(STRING_delete, my_STRING_delete);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_create, real_VECTOR_create);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_destroy, real_VECTOR_destroy);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_push_back, real_VECTOR_push_back);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_erase, real_VECTOR_erase);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_element, real_VECTOR_element);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_front, real_VECTOR_front);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_back, real_VECTOR_back);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_size, real_VECTOR_size);
+
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(gballoc_malloc, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mallocAndStrcpy_s, __LINE__);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(VECTOR_create, NULL);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    g_persistedCount = 0;
+    memset(g_persisted, 0, sizeof(g_persisted));
+    remove_persist_files();
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    remove_persist_files();
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_001: [If options or options->filePrefix is NULL then mqtt_persist_open shall return NULL.]*/
+TEST_FUNCTION(mqtt_persist_open_options_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_PERSIST_HANDLE handle = mqtt_persist_open(NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_001: [If options or options->filePrefix is NULL then mqtt_persist_open shall return NULL.]*/
+TEST_FUNCTION(mqtt_persist_open_filePrefix_NULL_fail)
+{
+    // arrange
+    MQTT_PERSIST_OPTIONS options = { NULL, 0, false };
+
+    // act
+    MQTT_PERSIST_HANDLE handle = mqtt_persist_open(&options);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_003: [If any allocation fails then mqtt_persist_open shall free everything it allocated and return NULL.]*/
+TEST_FUNCTION(mqtt_persist_open_fail)
+{
+    // arrange
+    MQTT_PERSIST_OPTIONS options = { TEST_FILE_PREFIX, 0, false };
+    int negativeTestsInitResult = umock_c_negative_tests_init();
+    ASSERT_ARE_EQUAL(int, 0, negativeTestsInitResult);
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(mallocAndStrcpy_s(IGNORED_PTR_ARG, TEST_FILE_PREFIX));
+    EXPECTED_CALL(VECTOR_create(IGNORED_NUM_ARG));
+    EXPECTED_CALL(VECTOR_create(IGNORED_NUM_ARG));
+
+    umock_c_negative_tests_snapshot();
+
+    size_t count = umock_c_negative_tests_call_count();
+    for (size_t index = 0; index < count; index++)
+    {
+        umock_c_negative_tests_reset();
+        umock_c_negative_tests_fail_call(index);
+
+        // act
+        MQTT_PERSIST_HANDLE handle = mqtt_persist_open(&options);
+
+        // assert
+        ASSERT_IS_NULL(handle);
+    }
+
+    // cleanup
+    umock_c_negative_tests_deinit();
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_004: [mqtt_persist_open shall read the segment range from <filePrefix>.manifest and recover the records of every segment <filePrefix>_<index>.seg in that range.]*/
+/*Tests_SRS_MQTT_PERSIST_07_027: [mqtt_persist_get_count shall return the number of stored packets.]*/
+TEST_FUNCTION(mqtt_persist_open_without_files_is_empty)
+{
+    // arrange
+
+    // act
+    MQTT_PERSIST_HANDLE handle = open_persist(0);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_persist_get_count(handle));
+    ASSERT_IS_FALSE(segment_file_exists(0));
+
+    // cleanup
+    mqtt_persist_close(handle);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_010: [If handle or packet is NULL, or length is 0 or does not fit a record, then mqtt_persist_append shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_persist_append_handle_NULL_fail)
+{
+    // arrange
+    uint8_t packet[TEST_PACKET_LENGTH];
+    make_packet(1, packet);
+
+    // act
+    int result = mqtt_persist_append(NULL, 1, packet, sizeof(packet));
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_010: [If handle or packet is NULL, or length is 0 or does not fit a record, then mqtt_persist_append shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_persist_append_packet_NULL_fail)
+{
+    // arrange
+    MQTT_PERSIST_HANDLE handle = open_persist(0);
+
+    // act
+    int result = mqtt_persist_append(handle, 1, NULL, TEST_PACKET_LENGTH);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_persist_get_count(handle));
+
+    // cleanup
+    mqtt_persist_close(handle);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_010: [If handle or packet is NULL, or length is 0 or does not fit a record, then mqtt_persist_append shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_persist_append_length_0_fail)
+{
+    // arrange
+    uint8_t packet[TEST_PACKET_LENGTH];
+    MQTT_PERSIST_HANDLE handle = open_persist(0);
+    make_packet(1, packet);
+
+    // act
+    int result = mqtt_persist_append(handle, 1, packet, 0);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_persist_get_count(handle));
+
+    // cleanup
+    mqtt_persist_close(handle);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_011: [If a packet with the same packetId is still stored then mqtt_persist_append shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_persist_append_duplicate_packetId_fail)
+{
+    // arrange
+    uint8_t packet[TEST_PACKET_LENGTH];
+    MQTT_PERSIST_HANDLE handle = open_persist(0);
+    append_packet(handle, 1);
+    make_packet(1, packet);
+
+    // act
+    int result = mqtt_persist_append(handle, 1, packet, sizeof(packet));
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_persist_get_count(handle));
+
+    // cleanup
+    mqtt_persist_close(handle);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_015: [If handle is NULL or no packet with packetId is stored then mqtt_persist_mark_released shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_persist_mark_released_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_persist_mark_released(NULL, 1);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_015: [If handle is NULL or no packet with packetId is stored then mqtt_persist_mark_released shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_persist_mark_released_unknown_packetId_fail)
+{
+    // arrange
+    MQTT_PERSIST_HANDLE handle = open_persist(0);
+    append_packet(handle, 1);
+
+    // act
+    int result = mqtt_persist_mark_released(handle, 2);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+    // cleanup
+    mqtt_persist_close(handle);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_017: [If handle is NULL or no packet with packetId is stored then mqtt_persist_remove shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_persist_remove_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_persist_remove(NULL, 1);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_017: [If handle is NULL or no packet with packetId is stored then mqtt_persist_remove shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_persist_remove_unknown_packetId_fail)
+{
+    // arrange
+    MQTT_PERSIST_HANDLE handle = open_persist(0);
+    append_packet(handle, 1);
+
+    // act
+    int result = mqtt_persist_remove(handle, 2);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(size_t, 1, mqtt_persist_get_count(handle));
+
+    // cleanup
+    mqtt_persist_close(handle);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_024: [If handle or callback is NULL then mqtt_persist_foreach shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_persist_foreach_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_persist_foreach(NULL, on_persisted_packet, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_024: [If handle or callback is NULL then mqtt_persist_foreach shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_persist_foreach_callback_NULL_fail)
+{
+    // arrange
+    MQTT_PERSIST_HANDLE handle = open_persist(0);
+    append_packet(handle, 1);
+
+    // act
+    int result = mqtt_persist_foreach(handle, NULL, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+
+    // cleanup
+    mqtt_persist_close(handle);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_026: [If handle is NULL then mqtt_persist_get_count shall return 0.]*/
+TEST_FUNCTION(mqtt_persist_get_count_handle_NULL_returns_0)
+{
+    // arrange
+
+    // act
+    size_t result = mqtt_persist_get_count(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, result);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_008: [If handle is NULL then mqtt_persist_close shall do nothing.]*/
+TEST_FUNCTION(mqtt_persist_close_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_persist_close(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_014: [If writing or tracking the record fails then mqtt_persist_append shall return a non-zero value, otherwise it shall return 0.]*/
+/*Tests_SRS_MQTT_PERSIST_07_016: [mqtt_persist_mark_released shall mark the record as released in place and return 0.]*/
+/*Tests_SRS_MQTT_PERSIST_07_025: [mqtt_persist_foreach shall call callback for every stored packet in the order the packets were appended, with the released flag and the writable packet bytes, and return 0.]*/
+TEST_FUNCTION(mqtt_persist_foreach_returns_packets_in_append_order)
+{
+    // arrange
+    static const uint16_t packetIds[] = { 7, 3, 5 };
+    static const bool released[] = { false, true, false };
+    MQTT_PERSIST_HANDLE handle = open_persist(0);
+    append_packet(handle, 7);
+    append_packet(handle, 3);
+    append_packet(handle, 5);
+
+    // act
+    int result = mqtt_persist_mark_released(handle, 3);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    assert_persisted_packets(handle, packetIds, released, 3);
+
+    // cleanup
+    mqtt_persist_close(handle);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_004: [mqtt_persist_open shall read the segment range from <filePrefix>.manifest and recover the records of every segment <filePrefix>_<index>.seg in that range.]*/
+/*Tests_SRS_MQTT_PERSIST_07_007: [mqtt_persist_open shall order the recovered records by the sequence they were appended in.]*/
+/*Tests_SRS_MQTT_PERSIST_07_009: [mqtt_persist_close shall flush every segment to its file and free all resources.]*/
+/*Tests_SRS_MQTT_PERSIST_07_016: [mqtt_persist_mark_released shall mark the record as released in place and return 0.]*/
+/*Tests_SRS_MQTT_PERSIST_07_018: [mqtt_persist_remove shall mark the record as removed and return 0.]*/
+TEST_FUNCTION(mqtt_persist_reopen_recovers_outstanding_packets)
+{
+    // arrange
+    static const uint16_t packetIds[] = { 2, 3 };
+    static const bool released[] = { true, false };
+    MQTT_PERSIST_HANDLE handle = open_persist(0);
+    append_packet(handle, 1);
+    append_packet(handle, 2);
+    append_packet(handle, 3);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_persist_mark_released(handle, 2));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_persist_remove(handle, 1));
+    mqtt_persist_close(handle);
+
+    // act
+    handle = open_persist(0);
+
+    // assert
+    assert_persisted_packets(handle, packetIds, released, 2);
+
+    // cleanup
+    mqtt_persist_close(handle);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_011: [If a packet with the same packetId is still stored then mqtt_persist_append shall return a non-zero value.]*/
+/*Tests_SRS_MQTT_PERSIST_07_012: [mqtt_persist_append shall write the record to the active segment, creating a new segment when the record does not fit, and write the record length last so a partially written record is never recovered.]*/
+TEST_FUNCTION(mqtt_persist_reopen_appends_after_recovered_packets)
+{
+    // arrange
+    static const uint16_t packetIds[] = { 9, 4, 1 };
+    static const bool released[] = { false, false, false };
+    uint8_t packet[TEST_PACKET_LENGTH];
+    MQTT_PERSIST_HANDLE handle = open_persist(TEST_ONE_RECORD_SEGMENT_SIZE);
+    append_packet(handle, 9);
+    append_packet(handle, 4);
+    mqtt_persist_close(handle);
+    handle = open_persist(TEST_ONE_RECORD_SEGMENT_SIZE);
+    make_packet(4, packet);
+
+    // act
+    int duplicateResult = mqtt_persist_append(handle, 4, packet, sizeof(packet));
+    append_packet(handle, 1);
+    mqtt_persist_close(handle);
+    handle = open_persist(TEST_ONE_RECORD_SEGMENT_SIZE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, duplicateResult);
+    assert_persisted_packets(handle, packetIds, released, 3);
+    ASSERT_IS_TRUE(segment_file_exists(2));
+
+    // cleanup
+    mqtt_persist_close(handle);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_005: [Missing segments and segments with an invalid header shall be ignored.]*/
+TEST_FUNCTION(mqtt_persist_reopen_ignores_segment_with_invalid_header)
+{
+    // arrange
+    char fileName[64];
+    FILE* file;
+    MQTT_PERSIST_HANDLE handle = open_persist(0);
+    append_packet(handle, 1);
+    mqtt_persist_close(handle);
+    get_segment_file_name(fileName, sizeof(fileName), 0);
+    file = fopen(fileName, "r+b");
+    ASSERT_IS_NOT_NULL(file);
+    (void)fputc(0, file);
+    (void)fclose(file);
+
+    // act
+    handle = open_persist(0);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, mqtt_persist_get_count(handle));
+
+    // cleanup
+    mqtt_persist_close(handle);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_018: [mqtt_persist_remove shall mark the record as removed and return 0.]*/
+/*Tests_SRS_MQTT_PERSIST_07_019: [When a sealed segment is left without live records mqtt_persist_remove shall delete its file and update the manifest.]*/
+TEST_FUNCTION(mqtt_persist_remove_deletes_emptied_sealed_segment)
+{
+    // arrange
+    static const uint16_t packetIds[] = { 2 };
+    static const bool released[] = { false };
+    unsigned long first;
+    unsigned long next;
+    MQTT_PERSIST_HANDLE handle = open_persist(TEST_ONE_RECORD_SEGMENT_SIZE);
+    append_packet(handle, 1);
+    append_packet(handle, 2);
+    ASSERT_IS_TRUE(segment_file_exists(1));
+
+    // act
+    int result = mqtt_persist_remove(handle, 1);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_IS_FALSE(segment_file_exists(0));
+    read_manifest(&first, &next);
+    ASSERT_ARE_EQUAL(int, 1, (int)first);
+    ASSERT_ARE_EQUAL(int, 2, (int)next);
+    mqtt_persist_close(handle);
+    handle = open_persist(TEST_ONE_RECORD_SEGMENT_SIZE);
+    assert_persisted_packets(handle, packetIds, released, 1);
+
+    // cleanup
+    mqtt_persist_close(handle);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_021: [mqtt_persist_compact shall move the live records of every sealed segment that is less than half live to the active segment, keeping their order.]*/
+/*Tests_SRS_MQTT_PERSIST_07_023: [mqtt_persist_compact shall delete every sealed segment left without live records.]*/
+TEST_FUNCTION(mqtt_persist_compact_moves_records_out_of_sparse_segment)
+{
+    // arrange
+    static const uint16_t packetIds[] = { 3, 4, 5, 6, 7 };
+    static const bool released[] = { true, false, false, false, false };
+    uint16_t packetId;
+    unsigned long first;
+    unsigned long next;
+    MQTT_PERSIST_HANDLE handle = open_persist(TEST_THREE_RECORD_SEGMENT_SIZE);
+    // Segment 0 holds 1 to 3, segment 1 holds 4 to 6 and 7 goes to the active segment 2
+    for (packetId = 1; packetId <= 7; packetId++)
+    {
+        append_packet(handle, packetId);
+    }
+    ASSERT_ARE_EQUAL(int, 0, mqtt_persist_mark_released(handle, 3));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_persist_remove(handle, 1));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_persist_remove(handle, 2));
+    ASSERT_IS_TRUE(segment_file_exists(0));
+
+    // act
+    int result = mqtt_persist_compact(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_IS_FALSE(segment_file_exists(0));
+    ASSERT_IS_TRUE(segment_file_exists(1));
+    ASSERT_IS_TRUE(segment_file_exists(2));
+    ASSERT_IS_FALSE(segment_file_exists(3));
+    read_manifest(&first, &next);
+    ASSERT_ARE_EQUAL(int, 1, (int)first);
+    ASSERT_ARE_EQUAL(int, 3, (int)next);
+    assert_persisted_packets(handle, packetIds, released, 5);
+
+    // The moved record keeps its place in the replay order after a restart
+    mqtt_persist_close(handle);
+    handle = open_persist(TEST_THREE_RECORD_SEGMENT_SIZE);
+    assert_persisted_packets(handle, packetIds, released, 5);
+
+    // cleanup
+    mqtt_persist_close(handle);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_021: [mqtt_persist_compact shall move the live records of every sealed segment that is less than half live to the active segment, keeping their order.]*/
+TEST_FUNCTION(mqtt_persist_compact_keeps_dense_segments)
+{
+    // arrange
+    static const uint16_t packetIds[] = { 2, 3, 4 };
+    static const bool released[] = { false, false, false };
+    uint16_t packetId;
+    MQTT_PERSIST_HANDLE handle = open_persist(TEST_THREE_RECORD_SEGMENT_SIZE);
+    for (packetId = 1; packetId <= 4; packetId++)
+    {
+        append_packet(handle, packetId);
+    }
+    ASSERT_ARE_EQUAL(int, 0, mqtt_persist_remove(handle, 1));
+
+    // act
+    int result = mqtt_persist_compact(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_IS_TRUE(segment_file_exists(0));
+    assert_persisted_packets(handle, packetIds, released, 3);
+
+    // cleanup
+    mqtt_persist_close(handle);
+}
+
+/*Tests_SRS_MQTT_PERSIST_07_020: [If handle is NULL then mqtt_persist_compact shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_persist_compact_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_persist_compact(NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+}
+
+END_TEST_SUITE(mqtt_persist_ut)
@@ -0,0 +1,986 @@
+// Copyright (c) Microsoft. All rights reserved.
+// Licensed under the MIT license. See LICENSE file in the project root for full license information.
+
+#ifdef __cplusplus
+#include <cstdlib>
+#include <cstddef>
+#include <cstdint>
+#include <cstdarg>
+#else
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
+#endif
+
+#include "testrunnerswitcher.h"
+#include "umock_c.h"
+#include "umock_c_negative_tests.h"
+#include "umocktypes_charptr.h"
+#include "umocktypes_stdint.h"
+#include "umocktypes_bool.h"
+#include "umocktypes.h"
+#include "umocktypes_c.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void* my_gballoc_malloc(size_t size)
+    {
+        return malloc(size);
+    }
+
+    void my_gballoc_free(void* ptr)
+    {
+        free(ptr);
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define ENABLE_MOCKS
+
+#include "azure_c_shared_utility/gballoc.h"
+#include "azure_c_shared_utility/lock.h"
+#include "azure_c_shared_utility/strings.h"
+#include "azure_c_shared_utility/threadapi.h"
+#include "azure_c_shared_utility/vector.h"
+#include "azure_c_shared_utility/xio.h"
+#include "azure_umqtt_c/mqtt_client.h"
+#include "azure_umqtt_c/mqtt_message.h"
+
+#undef ENABLE_MOCKS
+
+#include "azure_umqtt_c/mqtt_pool.h"
+#include "mqtt_topic_hash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    extern VECTOR_HANDLE real_VECTOR_create(size_t elementSize);
+    extern void real_VECTOR_destroy(VECTOR_HANDLE handle);
+    extern int real_VECTOR_push_back(VECTOR_HANDLE handle, const void* elements, size_t numElements);
+    extern void* real_VECTOR_element(VECTOR_HANDLE handle, size_t index);
+    extern void real_VECTOR_clear(VECTOR_HANDLE handle);
+    extern size_t real_VECTOR_size(VECTOR_HANDLE handle);
+
+    STRING_HANDLE STRING_construct_sprintf(const char* format, ...)
+    {
+        char buffer[128];
+        char* result;
+        va_list args;
+        va_start(args, format);
+        (void)vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        if ((result = (char*)my_gballoc_malloc(strlen(buffer) + 1)) != NULL)
+        {
+            (void)strcpy(result, buffer);
+        }
+        return (STRING_HANDLE)result;
+    }
+
+#ifdef __cplusplus
+}
+#endif
+
+#define MAX_TEST_SHARDS                 4
+#define TEST_LOCK_HANDLE                (LOCK_HANDLE)0x11
+#define TEST_MESSAGE_HANDLE             (MQTT_MESSAGE_HANDLE)0x12
+#define TEST_SHARD_MESSAGE_HANDLE       (MQTT_MESSAGE_HANDLE)0x13
+#define TEST_CLONE_MESSAGE_HANDLE       (MQTT_MESSAGE_HANDLE)0x14
+#define TEST_CLIENT_HANDLE(index)       (MQTT_CLIENT_HANDLE)(uintptr_t)(0x100 + (index))
+#define TEST_XIO_HANDLE(index)          (XIO_HANDLE)(uintptr_t)(0x200 + (index))
+#define TEST_CALLBACK_CONTEXT           (void*)0x31
+
+static const char* TEST_CLIENT_ID = "device";
+static const char* TEST_TOPIC_NAME = "telemetry/device1";
+static uint8_t TEST_PAYLOAD_BYTES[] = { 'd', 'a', 't', 'a' };
+static APP_PAYLOAD TEST_APP_PAYLOAD = { TEST_PAYLOAD_BYTES, sizeof(TEST_PAYLOAD_BYTES) };
+
+typedef enum TEST_DOWORK_EVENT_TAG
+{
+    TEST_DOWORK_NONE,
+    TEST_DOWORK_MESSAGE,
+    TEST_DOWORK_CONNACK,
+    TEST_DOWORK_DISCONNECT,
+    TEST_DOWORK_ERROR
+} TEST_DOWORK_EVENT;
+
+static size_t g_clientCount;
+static ON_MQTT_MESSAGE_RECV_CALLBACK g_msgRecv;
+static ON_MQTT_OPERATION_CALLBACK g_opCallback;
+static ON_MQTT_ERROR_CALLBACK g_errorCallback;
+static void* g_shardContexts[MAX_TEST_SHARDS];
+
+static size_t g_threadCount;
+static THREAD_START_FUNC g_threadFuncs[MAX_TEST_SHARDS];
+static void* g_threadArgs[MAX_TEST_SHARDS];
+
+static bool g_failLock;
+static int g_lockDepth;
+static TEST_DOWORK_EVENT g_doworkEvent;
+static size_t g_createXioCount;
+static char g_connectClientIds[MAX_TEST_SHARDS][32];
+
+static size_t g_poolRecvCount;
+static MQTT_MESSAGE_HANDLE g_poolRecvMessage;
+static int g_poolRecvLockDepth;
+static size_t g_poolErrorCount;
+static size_t g_poolErrorShard;
+static MQTT_CLIENT_EVENT_ERROR g_poolError;
+static int g_poolErrorLockDepth;
+
+static MQTT_CLIENT_HANDLE my_mqtt_client_init(ON_MQTT_MESSAGE_RECV_CALLBACK msgRecv, ON_MQTT_OPERATION_CALLBACK opCallback, void* opCallbackCtx, ON_MQTT_ERROR_CALLBACK onErrorCallBack, void* errorCBCtx)
+{
+    size_t index = g_clientCount++ % MAX_TEST_SHARDS;
+    (void)errorCBCtx;
+    g_msgRecv = msgRecv;
+    g_opCallback = opCallback;
+    g_errorCallback = onErrorCallBack;
+    g_shardContexts[index] = opCallbackCtx;
+    return TEST_CLIENT_HANDLE(index);
+}
+
+static int my_mqtt_client_connect(MQTT_CLIENT_HANDLE handle, XIO_HANDLE xioHandle, MQTT_CLIENT_OPTIONS* mqttOptions)
+{
+    size_t index = (uintptr_t)handle - 0x100;
+    (void)xioHandle;
+    (void)snprintf(g_connectClientIds[index], sizeof(g_connectClientIds[index]), "%s", mqttOptions->clientId);
+    return 0;
+}
+
+static void my_mqtt_client_dowork(MQTT_CLIENT_HANDLE handle)
+{
+    size_t index = (uintptr_t)handle - 0x100;
+    void* context = g_shardContexts[index];
+    CONNECT_ACK connack;
+    switch (g_doworkEvent)
+    {
+        case TEST_DOWORK_MESSAGE:
+            g_msgRecv(TEST_MESSAGE_HANDLE, context);
+            break;
+        case TEST_DOWORK_CONNACK:
+            memset(&connack, 0, sizeof(connack));
+            connack.returnCode = CONNECTION_ACCEPTED;
+            g_opCallback(handle, MQTT_CLIENT_ON_CONNACK, &connack, context);
+            break;
+        case TEST_DOWORK_DISCONNECT:
+            g_opCallback(handle, MQTT_CLIENT_ON_DISCONNECT, NULL, context);
+            break;
+        case TEST_DOWORK_ERROR:
+            g_errorCallback(handle, MQTT_CLIENT_NO_PING_RESPONSE, context);
+            break;
+        default:
+            break;
+    }
+}
+
+static int my_mqtt_client_get_inflight_window(MQTT_CLIENT_HANDLE handle, size_t* inflightCount, size_t* windowSize)
+{
+    (void)handle;
+    *inflightCount = 1;
+    *windowSize = 10;
+    return 0;
+}
+
+static THREADAPI_RESULT my_ThreadAPI_Create(THREAD_HANDLE* threadHandle, THREAD_START_FUNC func, void* arg)
+{
+    size_t index = g_threadCount++ % MAX_TEST_SHARDS;
+    g_threadFuncs[index] = func;
+    g_threadArgs[index] = arg;
+    *threadHandle = (THREAD_HANDLE)(uintptr_t)(0x300 + index);
+    return THREADAPI_OK;
+}
+
+// Ends the shard loop at its next lock, so a shard thread runs a single dowork
+static void my_ThreadAPI_Sleep(unsigned int milliseconds)
+{
+    (void)milliseconds;
+    g_failLock = true;
+}
+
+static LOCK_RESULT my_Lock(LOCK_HANDLE handle)
+{
+    LOCK_RESULT result;
+    (void)handle;
+    if (g_failLock)
+    {
+        result = LOCK_ERROR;
+    }
+    else
+    {
+        g_lockDepth++;
+        result = LOCK_OK;
+    }
+    return result;
+}
+
+static LOCK_RESULT my_Unlock(LOCK_HANDLE handle)
+{
+    (void)handle;
+    g_lockDepth--;
+    return LOCK_OK;
+}
+
+static const char* my_STRING_c_str(STRING_HANDLE handle)
+{
+    return (const char*)handle;
+}
+
+static void my_STRING_delete(STRING_HANDLE handle)
+{
+    my_gballoc_free(handle);
+}
+
+static const char* my_mqttmessage_getTopicName(MQTT_MESSAGE_HANDLE handle)
+{
+    (void)handle;
+    return TEST_TOPIC_NAME;
+}
+
+static XIO_HANDLE TestCreateXio(size_t shardIndex, void* context)
+{
+    ASSERT_ARE_EQUAL(void_ptr, TEST_CALLBACK_CONTEXT, context);
+    g_createXioCount++;
+    return TEST_XIO_HANDLE(shardIndex);
+}
+
+static void TestPoolRecv(MQTT_MESSAGE_HANDLE msgHandle, void* callbackCtx)
+{
+    ASSERT_ARE_EQUAL(void_ptr, TEST_CALLBACK_CONTEXT, callbackCtx);
+    g_poolRecvCount++;
+    g_poolRecvMessage = msgHandle;
+    g_poolRecvLockDepth = g_lockDepth;
+}
+
+static void TestPoolError(MQTT_POOL_HANDLE handle, size_t shardIndex, MQTT_CLIENT_EVENT_ERROR error, void* callbackCtx)
+{
+    (void)handle;
+    ASSERT_ARE_EQUAL(void_ptr, TEST_CALLBACK_CONTEXT, callbackCtx);
+    g_poolErrorCount++;
+    g_poolErrorShard = shardIndex;
+    g_poolError = error;
+    g_poolErrorLockDepth = g_lockDepth;
+}
+
+static MQTT_POOL_HANDLE create_pool(size_t shardCount)
+{
+    MQTT_POOL_OPTIONS options;
+    MQTT_POOL_HANDLE handle;
+    options.shardCount = shardCount;
+    options.doworkIntervalMs = 0;
+    handle = mqtt_pool_create(&options, TestCreateXio, TEST_CALLBACK_CONTEXT, TestPoolRecv, TEST_CALLBACK_CONTEXT, TestPoolError, TEST_CALLBACK_CONTEXT);
+    ASSERT_IS_NOT_NULL(handle);
+    umock_c_reset_all_calls();
+    return handle;
+}
+
+static void setup_client_options(MQTT_CLIENT_OPTIONS* mqttOptions)
+{
+    memset(mqttOptions, 0, sizeof(MQTT_CLIENT_OPTIONS));
+    mqttOptions->clientId = (char*)TEST_CLIENT_ID;
+    mqttOptions->keepAliveInterval = 30;
+}
+
+static void run_shard_thread(size_t shardIndex, TEST_DOWORK_EVENT doworkEvent)
+{
+    g_doworkEvent = doworkEvent;
+    g_failLock = false;
+    ASSERT_ARE_EQUAL(int, 0, g_threadFuncs[shardIndex](g_threadArgs[shardIndex]));
+    g_failLock = false;
+    g_doworkEvent = TEST_DOWORK_NONE;
+}
+
+static size_t get_other_shard_topic(MQTT_POOL_HANDLE handle, size_t shardIndex, char* topicName, size_t size)
+{
+    size_t index = 0;
+    size_t result;
+    do
+    {
+        (void)snprintf(topicName, size, "telemetry/device%lu", (unsigned long)index++);
+        result = mqtt_pool_get_shard_index(handle, topicName);
+    } while (result == shardIndex);
+    return result;
+}
+
+TEST_DEFINE_ENUM_TYPE(QOS_VALUE, QOS_VALUE_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(QOS_VALUE, QOS_VALUE_VALUES);
+TEST_DEFINE_ENUM_TYPE(LOCK_RESULT, LOCK_RESULT_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(LOCK_RESULT, LOCK_RESULT_VALUES);
+TEST_DEFINE_ENUM_TYPE(THREADAPI_RESULT, THREADAPI_RESULT_VALUES);
+IMPLEMENT_UMOCK_C_ENUM_TYPE(THREADAPI_RESULT, THREADAPI_RESULT_VALUES);
+TEST_DEFINE_ENUM_TYPE(MQTT_CLIENT_EVENT_ERROR, MQTT_CLIENT_EVENT_ERROR_VALUES);
+
+TEST_MUTEX_HANDLE test_serialize_mutex;
+
+DEFINE_ENUM_STRINGS(UMOCK_C_ERROR_CODE, UMOCK_C_ERROR_CODE_VALUES)
+
+static void on_umock_c_error(UMOCK_C_ERROR_CODE error_code)
+{
+    char temp_str[256];
+    (void)snprintf(temp_str, sizeof(temp_str), "umock_c reported error :%s", ENUM_TO_STRING(UMOCK_C_ERROR_CODE, error_code));
+    ASSERT_FAIL(temp_str);
+}
+
+BEGIN_TEST_SUITE(mqtt_pool_ut)
+
+TEST_SUITE_INITIALIZE(suite_init)
+{
+    test_serialize_mutex = TEST_MUTEX_CREATE();
+    ASSERT_IS_NOT_NULL(test_serialize_mutex);
+
+    umock_c_init(on_umock_c_error);
+
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_charptr_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_stdint_register_types());
+    ASSERT_ARE_EQUAL(int, 0, umocktypes_bool_register_types());
+
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_CLIENT_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(MQTT_MESSAGE_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_MESSAGE_RECV_CALLBACK, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_OPERATION_CALLBACK, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_ERROR_CALLBACK, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(ON_MQTT_DISCONNECTED_CALLBACK, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(LOCK_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(THREAD_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(THREAD_START_FUNC, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(STRING_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(VECTOR_HANDLE, void*);
+    REGISTER_UMOCK_ALIAS_TYPE(XIO_HANDLE, void*);
+    REGISTER_TYPE(QOS_VALUE, QOS_VALUE);
+    REGISTER_TYPE(LOCK_RESULT, LOCK_RESULT);
+    REGISTER_TYPE(THREADAPI_RESULT, THREADAPI_RESULT);
+
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_malloc, my_gballoc_malloc);
+    REGISTER_GLOBAL_MOCK_HOOK(gballoc_free, my_gballoc_free);
+    REGISTER_GLOBAL_MOCK_HOOK(Lock, my_Lock);
+    REGISTER_GLOBAL_MOCK_HOOK(Unlock, my_Unlock);
+    REGISTER_GLOBAL_MOCK_HOOK(ThreadAPI_Create, my_ThreadAPI_Create);
+    REGISTER_GLOBAL_MOCK_HOOK(ThreadAPI_Sleep, my_ThreadAPI_Sleep);
+    REGISTER_GLOBAL_MOCK_HOOK(STRING_c_str, my_STRING_c_str);
+    REGISTER_GLOBAL_MOCK_HOOK(STRING_delete, my_STRING_delete);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_create, real_VECTOR_create);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_destroy, real_VECTOR_destroy);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_push_back, real_VECTOR_push_back);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_element, real_VECTOR_element);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_clear, real_VECTOR_clear);
+    REGISTER_GLOBAL_MOCK_HOOK(VECTOR_size, real_VECTOR_size);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_init, my_mqtt_client_init);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_connect, my_mqtt_client_connect);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_dowork, my_mqtt_client_dowork);
+    REGISTER_GLOBAL_MOCK_HOOK(mqtt_client_get_inflight_window, my_mqtt_client_get_inflight_window);
+    REGISTER_GLOBAL_MOCK_HOOK(mqttmessage_getTopicName, my_mqttmessage_getTopicName);
+
+    REGISTER_GLOBAL_MOCK_RETURN(Lock_Init, TEST_LOCK_HANDLE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_getQosType, DELIVER_AT_LEAST_ONCE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_getApplicationMsg, &TEST_APP_PAYLOAD);
+    REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_create_in_place, TEST_SHARD_MESSAGE_HANDLE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqttmessage_clone, TEST_CLONE_MESSAGE_HANDLE);
+    REGISTER_GLOBAL_MOCK_RETURN(mqtt_client_publish, 0);
+
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(gballoc_malloc, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(Lock_Init, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(ThreadAPI_Create, THREADAPI_ERROR);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(VECTOR_create, NULL);
+    REGISTER_GLOBAL_MOCK_FAIL_RETURN(mqtt_client_init, NULL);
+}
+
+TEST_SUITE_CLEANUP(suite_cleanup)
+{
+    umock_c_deinit();
+
+    TEST_MUTEX_DESTROY(test_serialize_mutex);
+}
+
+TEST_FUNCTION_INITIALIZE(method_init)
+{
+    if (TEST_MUTEX_ACQUIRE(test_serialize_mutex))
+    {
+        ASSERT_FAIL("Could not acquire test serialization mutex.");
+    }
+    g_clientCount = 0;
+    g_threadCount = 0;
+    g_failLock = false;
+    g_lockDepth = 0;
+    g_doworkEvent = TEST_DOWORK_NONE;
+    g_createXioCount = 0;
+    memset(g_connectClientIds, 0, sizeof(g_connectClientIds));
+    g_poolRecvCount = 0;
+    g_poolRecvMessage = NULL;
+    g_poolRecvLockDepth = -1;
+    g_poolErrorCount = 0;
+    g_poolErrorLockDepth = -1;
+    umock_c_reset_all_calls();
+}
+
+TEST_FUNCTION_CLEANUP(method_cleanup)
+{
+    TEST_MUTEX_RELEASE(test_serialize_mutex);
+}
+
+/*Tests_SRS_MQTT_POOL_07_001: [If options or createXio is NULL, or options->shardCount is 0, then mqtt_pool_create shall return NULL.]*/
+TEST_FUNCTION(mqtt_pool_create_options_NULL_fail)
+{
+    // arrange
+
+    // act
+    MQTT_POOL_HANDLE handle = mqtt_pool_create(NULL, TestCreateXio, NULL, TestPoolRecv, NULL, TestPoolError, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_POOL_07_001: [If options or createXio is NULL, or options->shardCount is 0, then mqtt_pool_create shall return NULL.]*/
+TEST_FUNCTION(mqtt_pool_create_shardCount_0_fail)
+{
+    // arrange
+    MQTT_POOL_OPTIONS options = { 0, 0 };
+
+    // act
+    MQTT_POOL_HANDLE handle = mqtt_pool_create(&options, TestCreateXio, NULL, TestPoolRecv, NULL, TestPoolError, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_POOL_07_001: [If options or createXio is NULL, or options->shardCount is 0, then mqtt_pool_create shall return NULL.]*/
+TEST_FUNCTION(mqtt_pool_create_createXio_NULL_fail)
+{
+    // arrange
+    MQTT_POOL_OPTIONS options = { 2, 0 };
+
+    // act
+    MQTT_POOL_HANDLE handle = mqtt_pool_create(&options, NULL, NULL, TestPoolRecv, NULL, TestPoolError, NULL);
+
+    // assert
+    ASSERT_IS_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_POOL_07_003: [mqtt_pool_create shall create shardCount shards, each with a lock, a client created with mqtt_client_init and a thread.]*/
+TEST_FUNCTION(mqtt_pool_create_succeed)
+{
+    // arrange
+    MQTT_POOL_OPTIONS options = { 2, 0 };
+    size_t index;
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(Lock_Init());
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    for (index = 0; index < 2; index++)
+    {
+        STRICT_EXPECTED_CALL(Lock_Init());
+        STRICT_EXPECTED_CALL(VECTOR_create(sizeof(MQTT_MESSAGE_HANDLE)));
+        STRICT_EXPECTED_CALL(VECTOR_create(sizeof(MQTT_MESSAGE_HANDLE)));
+        EXPECTED_CALL(mqtt_client_init(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+        EXPECTED_CALL(ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    }
+
+    // act
+    MQTT_POOL_HANDLE handle = mqtt_pool_create(&options, TestCreateXio, TEST_CALLBACK_CONTEXT, TestPoolRecv, TEST_CALLBACK_CONTEXT, TestPoolError, TEST_CALLBACK_CONTEXT);
+
+    // assert
+    ASSERT_IS_NOT_NULL(handle);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 2, g_threadCount);
+
+    // cleanup
+    mqtt_pool_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_POOL_07_004: [If any allocation or the creation of a lock, a client or a thread fails then mqtt_pool_create shall stop the started shards, free everything it allocated and return NULL.]*/
+TEST_FUNCTION(mqtt_pool_create_fail)
+{
+    // arrange
+    MQTT_POOL_OPTIONS options = { 1, 0 };
+    int negativeTestsInitResult = umock_c_negative_tests_init();
+    ASSERT_ARE_EQUAL(int, 0, negativeTestsInitResult);
+
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(Lock_Init());
+    EXPECTED_CALL(gballoc_malloc(IGNORED_NUM_ARG));
+    STRICT_EXPECTED_CALL(Lock_Init());
+    STRICT_EXPECTED_CALL(VECTOR_create(sizeof(MQTT_MESSAGE_HANDLE)));
+    STRICT_EXPECTED_CALL(VECTOR_create(sizeof(MQTT_MESSAGE_HANDLE)));
+    EXPECTED_CALL(mqtt_client_init(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+    EXPECTED_CALL(ThreadAPI_Create(IGNORED_PTR_ARG, IGNORED_PTR_ARG, IGNORED_PTR_ARG));
+
+    umock_c_negative_tests_snapshot();
+
+    size_t count = umock_c_negative_tests_call_count();
+    for (size_t index = 0; index < count; index++)
+    {
+        umock_c_negative_tests_reset();
+        umock_c_negative_tests_fail_call(index);
+
+        // act
+        MQTT_POOL_HANDLE handle = mqtt_pool_create(&options, TestCreateXio, NULL, TestPoolRecv, NULL, TestPoolError, NULL);
+
+        // assert
+        ASSERT_IS_NULL(handle);
+    }
+
+    // cleanup
+    umock_c_negative_tests_deinit();
+}
+
+/*Tests_SRS_MQTT_POOL_07_018: [mqtt_pool_get_shard_index shall return the hash of topicName modulo shardCount.]*/
+TEST_FUNCTION(mqtt_pool_get_shard_index_uses_topic_hash)
+{
+    // arrange
+    MQTT_POOL_HANDLE handle = create_pool(MAX_TEST_SHARDS);
+    bool shardUsed[MAX_TEST_SHARDS] = { false, false, false, false };
+    char topicName[32];
+    size_t index;
+
+    // act
+    for (index = 0; index < 64; index++)
+    {
+        size_t shardIndex;
+        (void)snprintf(topicName, sizeof(topicName), "telemetry/device%lu", (unsigned long)index);
+        shardIndex = mqtt_pool_get_shard_index(handle, topicName);
+
+        // assert
+        ASSERT_ARE_EQUAL(size_t, mqtt_topic_hash(topicName) % MAX_TEST_SHARDS, shardIndex);
+        ASSERT_ARE_EQUAL(size_t, shardIndex, mqtt_pool_get_shard_index(handle, topicName));
+        shardUsed[shardIndex] = true;
+    }
+    for (index = 0; index < MAX_TEST_SHARDS; index++)
+    {
+        ASSERT_IS_TRUE(shardUsed[index]);
+    }
+
+    // cleanup
+    mqtt_pool_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_POOL_07_020: [mqtt_pool_publish shall publish on the shard selected by the hash of the topic name, under the shard lock.]*/
+/*Tests_SRS_MQTT_POOL_07_022: [mqtt_pool_publish shall publish a message created in place over the topic and payload of msgHandle, with its duplicate and retain flags.]*/
+/*Tests_SRS_MQTT_POOL_07_023: [mqtt_pool_publish shall count the publish as succeeded or failed and return the result of mqtt_client_publish.]*/
+TEST_FUNCTION(mqtt_pool_publish_on_shard_of_topic)
+{
+    // arrange
+    MQTT_POOL_HANDLE handle = create_pool(MAX_TEST_SHARDS);
+    size_t shardIndex = mqtt_pool_get_shard_index(handle, TEST_TOPIC_NAME);
+
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getQosType(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getApplicationMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(1, TEST_TOPIC_NAME, DELIVER_AT_LEAST_ONCE, TEST_PAYLOAD_BYTES, sizeof(TEST_PAYLOAD_BYTES)));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsDuplicateMsg(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsDuplicateMsg(TEST_SHARD_MESSAGE_HANDLE, false));
+    STRICT_EXPECTED_CALL(mqttmessage_getIsRetained(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_setIsRetained(TEST_SHARD_MESSAGE_HANDLE, false));
+    STRICT_EXPECTED_CALL(mqtt_client_publish(TEST_CLIENT_HANDLE(shardIndex), TEST_SHARD_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(TEST_SHARD_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+
+    // act
+    int result = mqtt_pool_publish(handle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(int, 0, g_lockDepth);
+
+    // cleanup
+    mqtt_pool_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_POOL_07_021: [For QoS 1 and 2 mqtt_pool_publish shall use the next packet id of the shard, wrapping from 65535 to 1.]*/
+TEST_FUNCTION(mqtt_pool_publish_numbers_packets_per_shard)
+{
+    // arrange
+    MQTT_POOL_HANDLE handle = create_pool(MAX_TEST_SHARDS);
+    size_t shardIndex = mqtt_pool_get_shard_index(handle, TEST_TOPIC_NAME);
+    char otherTopic[32];
+    size_t otherShardIndex = get_other_shard_topic(handle, shardIndex, otherTopic, sizeof(otherTopic));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_pool_publish(handle, TEST_MESSAGE_HANDLE));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(2, TEST_TOPIC_NAME, DELIVER_AT_LEAST_ONCE, TEST_PAYLOAD_BYTES, sizeof(TEST_PAYLOAD_BYTES)));
+    STRICT_EXPECTED_CALL(mqtt_client_publish(TEST_CLIENT_HANDLE(shardIndex), TEST_SHARD_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_getTopicName(TEST_MESSAGE_HANDLE))
+        .SetReturn(otherTopic);
+    STRICT_EXPECTED_CALL(mqttmessage_create_in_place(1, otherTopic, DELIVER_AT_LEAST_ONCE, TEST_PAYLOAD_BYTES, sizeof(TEST_PAYLOAD_BYTES)));
+    STRICT_EXPECTED_CALL(mqtt_client_publish(TEST_CLIENT_HANDLE(otherShardIndex), TEST_SHARD_MESSAGE_HANDLE));
+
+    // act
+    int result = mqtt_pool_publish(handle, TEST_MESSAGE_HANDLE);
+    int otherResult = mqtt_pool_publish(handle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(int, 0, otherResult);
+    ASSERT_ARE_EQUAL(char_ptr, "", umock_c_get_expected_calls());
+
+    // cleanup
+    mqtt_pool_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_POOL_07_023: [mqtt_pool_publish shall count the publish as succeeded or failed and return the result of mqtt_client_publish.]*/
+/*Tests_SRS_MQTT_POOL_07_025: [mqtt_pool_get_metrics shall sum the counters and the inflight window of every shard, set the error count and the last error of the pool and return 0.]*/
+TEST_FUNCTION(mqtt_pool_publish_failure_counted_in_metrics)
+{
+    // arrange
+    MQTT_POOL_HANDLE handle = create_pool(2);
+    MQTT_POOL_METRICS metrics;
+    ASSERT_ARE_EQUAL(int, 0, mqtt_pool_publish(handle, TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_client_publish(IGNORED_PTR_ARG, TEST_SHARD_MESSAGE_HANDLE))
+        .SetReturn(__LINE__);
+
+    // act
+    int result = mqtt_pool_publish(handle, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_pool_get_metrics(handle, &metrics));
+    ASSERT_ARE_EQUAL(size_t, 1, metrics.publishCount);
+    ASSERT_ARE_EQUAL(size_t, 1, metrics.publishFailureCount);
+    ASSERT_ARE_EQUAL(size_t, 2, metrics.inflightCount);
+    ASSERT_ARE_EQUAL(size_t, 0, metrics.connectedCount);
+    ASSERT_ARE_EQUAL(size_t, 0, metrics.errorCount);
+
+    // cleanup
+    mqtt_pool_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_POOL_07_013: [mqtt_pool_connect shall connect every other shard with a copy of mqttOptions whose clientId is suffixed with -<shardIndex>, creating the xio of the shard with createXio unless it already has one.]*/
+TEST_FUNCTION(mqtt_pool_connect_suffixes_client_id_per_shard)
+{
+    // arrange
+    MQTT_POOL_HANDLE handle = create_pool(2);
+    MQTT_CLIENT_OPTIONS mqttOptions;
+    setup_client_options(&mqttOptions);
+
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_client_connect(TEST_CLIENT_HANDLE(0), TEST_XIO_HANDLE(0), IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_client_connect(TEST_CLIENT_HANDLE(1), TEST_XIO_HANDLE(1), IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+
+    // act
+    int result = mqtt_pool_connect(handle, &mqttOptions);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, "", umock_c_get_expected_calls());
+    ASSERT_ARE_EQUAL(char_ptr, "device-0", g_connectClientIds[0]);
+    ASSERT_ARE_EQUAL(char_ptr, "device-1", g_connectClientIds[1]);
+    ASSERT_ARE_EQUAL(size_t, 2, g_createXioCount);
+    ASSERT_ARE_EQUAL(char_ptr, TEST_CLIENT_ID, mqttOptions.clientId);
+
+    // cleanup
+    mqtt_pool_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_POOL_07_011: [If handle, mqttOptions or mqttOptions->clientId is NULL then mqtt_pool_connect shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_pool_connect_clientId_NULL_fail)
+{
+    // arrange
+    MQTT_POOL_HANDLE handle = create_pool(2);
+    MQTT_CLIENT_OPTIONS mqttOptions;
+    setup_client_options(&mqttOptions);
+    mqttOptions.clientId = NULL;
+
+    // act
+    int result = mqtt_pool_connect(handle, &mqttOptions);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_pool_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_POOL_07_012: [mqtt_pool_connect shall skip the shards that are already connecting.]*/
+TEST_FUNCTION(mqtt_pool_connect_again_skips_connecting_shards)
+{
+    // arrange
+    MQTT_POOL_HANDLE handle = create_pool(2);
+    MQTT_CLIENT_OPTIONS mqttOptions;
+    setup_client_options(&mqttOptions);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_pool_connect(handle, &mqttOptions));
+    umock_c_reset_all_calls();
+
+    // act
+    int result = mqtt_pool_connect(handle, &mqttOptions);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+    ASSERT_ARE_EQUAL(size_t, 2, g_createXioCount);
+
+    // cleanup
+    mqtt_pool_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_POOL_07_007: [On an error of its client the shard shall no longer be connecting, count the error and call onError with the shard index once the shard lock is released.]*/
+/*Tests_SRS_MQTT_POOL_07_013: [mqtt_pool_connect shall connect every other shard with a copy of mqttOptions whose clientId is suffixed with -<shardIndex>, creating the xio of the shard with createXio unless it already has one.]*/
+TEST_FUNCTION(mqtt_pool_connect_failed_shard_connects_again)
+{
+    // arrange
+    MQTT_POOL_HANDLE handle = create_pool(2);
+    MQTT_CLIENT_OPTIONS mqttOptions;
+    setup_client_options(&mqttOptions);
+    STRICT_EXPECTED_CALL(mqtt_client_connect(TEST_CLIENT_HANDLE(1), TEST_XIO_HANDLE(1), IGNORED_PTR_ARG))
+        .SetReturn(__LINE__);
+    ASSERT_ARE_NOT_EQUAL(int, 0, mqtt_pool_connect(handle, &mqttOptions));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_client_connect(TEST_CLIENT_HANDLE(1), TEST_XIO_HANDLE(1), IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+
+    // act
+    int result = mqtt_pool_connect(handle, &mqttOptions);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, "", umock_c_get_expected_calls());
+    // The xio of the shard is reused
+    ASSERT_ARE_EQUAL(size_t, 2, g_createXioCount);
+
+    // cleanup
+    mqtt_pool_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_POOL_07_005: [Each shard thread shall call mqtt_client_dowork under the shard lock every doworkIntervalMs until the pool is destroyed.]*/
+/*Tests_SRS_MQTT_POOL_07_008: [A CONNACK that accepts the connection shall mark the shard connected, a PUBACK or PUBCOMP shall be counted as acknowledged and a disconnect shall mark the shard neither connecting nor connected.]*/
+/*Tests_SRS_MQTT_POOL_07_025: [mqtt_pool_get_metrics shall sum the counters and the inflight window of every shard, set the error count and the last error of the pool and return 0.]*/
+TEST_FUNCTION(mqtt_pool_shard_connack_counts_connected)
+{
+    // arrange
+    MQTT_POOL_HANDLE handle = create_pool(2);
+    MQTT_CLIENT_OPTIONS mqttOptions;
+    MQTT_POOL_METRICS metrics;
+    setup_client_options(&mqttOptions);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_pool_connect(handle, &mqttOptions));
+
+    // act
+    run_shard_thread(1, TEST_DOWORK_CONNACK);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, mqtt_pool_get_metrics(handle, &metrics));
+    ASSERT_ARE_EQUAL(size_t, 1, metrics.connectedCount);
+    run_shard_thread(1, TEST_DOWORK_DISCONNECT);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_pool_get_metrics(handle, &metrics));
+    ASSERT_ARE_EQUAL(size_t, 0, metrics.connectedCount);
+
+    // cleanup
+    mqtt_pool_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_POOL_07_007: [On an error of its client the shard shall no longer be connecting, count the error and call onError with the shard index once the shard lock is released.]*/
+TEST_FUNCTION(mqtt_pool_shard_error_reported_outside_lock_and_shard_reconnects)
+{
+    // arrange
+    MQTT_POOL_HANDLE handle = create_pool(2);
+    MQTT_CLIENT_OPTIONS mqttOptions;
+    MQTT_POOL_METRICS metrics;
+    setup_client_options(&mqttOptions);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_pool_connect(handle, &mqttOptions));
+    run_shard_thread(0, TEST_DOWORK_CONNACK);
+    umock_c_reset_all_calls();
+
+    // act
+    run_shard_thread(0, TEST_DOWORK_ERROR);
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 1, g_poolErrorCount);
+    ASSERT_ARE_EQUAL(size_t, 0, g_poolErrorShard);
+    ASSERT_ARE_EQUAL(MQTT_CLIENT_EVENT_ERROR, MQTT_CLIENT_NO_PING_RESPONSE, g_poolError);
+    ASSERT_ARE_EQUAL(int, 0, g_poolErrorLockDepth);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_pool_get_metrics(handle, &metrics));
+    ASSERT_ARE_EQUAL(size_t, 0, metrics.connectedCount);
+    ASSERT_ARE_EQUAL(size_t, 1, metrics.errorCount);
+    ASSERT_ARE_EQUAL(MQTT_CLIENT_EVENT_ERROR, MQTT_CLIENT_NO_PING_RESPONSE, metrics.lastError);
+
+    // Only the failed shard connects again, on its own xio
+    umock_c_reset_all_calls();
+    STRICT_EXPECTED_CALL(mqtt_client_connect(TEST_CLIENT_HANDLE(0), TEST_XIO_HANDLE(0), IGNORED_PTR_ARG));
+    ASSERT_ARE_EQUAL(int, 0, mqtt_pool_connect(handle, &mqttOptions));
+    ASSERT_ARE_EQUAL(char_ptr, "", umock_c_get_expected_calls());
+    ASSERT_ARE_EQUAL(size_t, 2, g_createXioCount);
+
+    // cleanup
+    mqtt_pool_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_POOL_07_006: [Messages received by a shard shall be copied and passed to msgRecv once the shard lock is released.]*/
+TEST_FUNCTION(mqtt_pool_shard_message_delivered_outside_lock)
+{
+    // arrange
+    MQTT_POOL_HANDLE handle = create_pool(2);
+
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_client_dowork(TEST_CLIENT_HANDLE(1)));
+    STRICT_EXPECTED_CALL(mqttmessage_clone(TEST_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(mqttmessage_destroy(TEST_CLONE_MESSAGE_HANDLE));
+    STRICT_EXPECTED_CALL(ThreadAPI_Sleep(10));
+
+    // act
+    run_shard_thread(1, TEST_DOWORK_MESSAGE);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, "", umock_c_get_expected_calls());
+    ASSERT_ARE_EQUAL(size_t, 1, g_poolRecvCount);
+    ASSERT_ARE_EQUAL(void_ptr, TEST_CLONE_MESSAGE_HANDLE, g_poolRecvMessage);
+    ASSERT_ARE_EQUAL(int, 0, g_poolRecvLockDepth);
+
+    // cleanup
+    mqtt_pool_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_POOL_07_016: [mqtt_pool_disconnect shall call mqtt_client_disconnect for every connecting shard and return a non-zero value if any call fails.]*/
+TEST_FUNCTION(mqtt_pool_disconnect_only_connecting_shards)
+{
+    // arrange
+    MQTT_POOL_HANDLE handle = create_pool(2);
+    MQTT_CLIENT_OPTIONS mqttOptions;
+    setup_client_options(&mqttOptions);
+    STRICT_EXPECTED_CALL(mqtt_client_connect(TEST_CLIENT_HANDLE(0), TEST_XIO_HANDLE(0), IGNORED_PTR_ARG))
+        .SetReturn(__LINE__);
+    ASSERT_ARE_NOT_EQUAL(int, 0, mqtt_pool_connect(handle, &mqttOptions));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(mqtt_client_disconnect(TEST_CLIENT_HANDLE(1), NULL, NULL));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+
+    // act
+    int result = mqtt_pool_disconnect(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_pool_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_POOL_07_010: [mqtt_pool_destroy shall stop and join the shard threads, then deinitialize every client, destroy its xio and free all resources.]*/
+TEST_FUNCTION(mqtt_pool_destroy_stops_shards_and_releases_connections)
+{
+    // arrange
+    MQTT_POOL_HANDLE handle = create_pool(2);
+    MQTT_CLIENT_OPTIONS mqttOptions;
+    setup_client_options(&mqttOptions);
+    ASSERT_ARE_EQUAL(int, 0, mqtt_pool_connect(handle, &mqttOptions));
+    umock_c_reset_all_calls();
+
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Lock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(Unlock(TEST_LOCK_HANDLE));
+    STRICT_EXPECTED_CALL(ThreadAPI_Join((THREAD_HANDLE)0x300, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(ThreadAPI_Join((THREAD_HANDLE)0x301, IGNORED_PTR_ARG));
+    STRICT_EXPECTED_CALL(mqtt_client_deinit(TEST_CLIENT_HANDLE(0)));
+    STRICT_EXPECTED_CALL(xio_destroy(TEST_XIO_HANDLE(0)));
+    STRICT_EXPECTED_CALL(mqtt_client_deinit(TEST_CLIENT_HANDLE(1)));
+    STRICT_EXPECTED_CALL(xio_destroy(TEST_XIO_HANDLE(1)));
+
+    // act
+    mqtt_pool_destroy(handle);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, "", umock_c_get_expected_calls());
+}
+
+/*Tests_SRS_MQTT_POOL_07_009: [If handle is NULL then mqtt_pool_destroy shall do nothing.]*/
+TEST_FUNCTION(mqtt_pool_destroy_handle_NULL_succeed)
+{
+    // arrange
+
+    // act
+    mqtt_pool_destroy(NULL);
+
+    // assert
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_POOL_07_015: [If handle is NULL then mqtt_pool_disconnect shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_pool_disconnect_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_pool_disconnect(NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_POOL_07_019: [If handle or msgHandle is NULL then mqtt_pool_publish shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_pool_publish_handle_NULL_fail)
+{
+    // arrange
+
+    // act
+    int result = mqtt_pool_publish(NULL, TEST_MESSAGE_HANDLE);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+}
+
+/*Tests_SRS_MQTT_POOL_07_019: [If handle or msgHandle is NULL then mqtt_pool_publish shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_pool_publish_msgHandle_NULL_fail)
+{
+    // arrange
+    MQTT_POOL_HANDLE handle = create_pool(2);
+
+    // act
+    int result = mqtt_pool_publish(handle, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_pool_destroy(handle);
+}
+
+/*Tests_SRS_MQTT_POOL_07_017: [If handle is NULL then mqtt_pool_get_shard_index shall return 0.]*/
+TEST_FUNCTION(mqtt_pool_get_shard_index_handle_NULL_returns_0)
+{
+    // arrange
+
+    // act
+    size_t result = mqtt_pool_get_shard_index(NULL, "a/b");
+
+    // assert
+    ASSERT_ARE_EQUAL(size_t, 0, result);
+}
+
+/*Tests_SRS_MQTT_POOL_07_024: [If handle or metrics is NULL then mqtt_pool_get_metrics shall return a non-zero value.]*/
+TEST_FUNCTION(mqtt_pool_get_metrics_metrics_NULL_fail)
+{
+    // arrange
+    MQTT_POOL_HANDLE handle = create_pool(2);
+
+    // act
+    int result = mqtt_pool_get_metrics(handle, NULL);
+
+    // assert
+    ASSERT_ARE_NOT_EQUAL(int, 0, result);
+    ASSERT_ARE_EQUAL(char_ptr, umock_c_get_expected_calls(), umock_c_get_actual_calls());
+
+    // cleanup
+    mqtt_pool_destroy(handle);
+}
+
+END_TEST_SUITE(mqtt_pool_ut)